@@ -42,7 +42,7 @@ define ( "SEARCHD_COMMAND_STATUS",		5 );
 define ( "SEARCHD_COMMAND_FLUSHATTRS",	7 );
 
 /// current client-side command implementation versions
-define ( "VER_COMMAND_SEARCH",		0x120 );
+define ( "VER_COMMAND_SEARCH",		0x121 );
 define ( "VER_COMMAND_EXCERPT",		0x104 );
 define ( "VER_COMMAND_UPDATE",		0x103 );
 define ( "VER_COMMAND_KEYWORDS",	0x100 );
@@ -450,6 +450,7 @@ class SphinxClient
 	var $_token_filter_library; ///< token_filter plugin library name
 	var $_token_filter_name; ///< token_filter plugin name
 	var $_token_filter_opts; ///< token_filter plugin options
+	var $_search_after; ///< sort key values of the previous page last match
 
 	var $_error;		///< last error message
 	var $_warning;		///< last warning message
@@ -508,6 +509,7 @@ class SphinxClient
 		$this->_token_filter_library = '';
 		$this->_token_filter_name = '';
 		$this->_token_filter_opts = '';
+		$this->_search_after = '';
 
 		$this->_error		= ""; // per-reply fields (for single-query case)
 		$this->_warning		= "";
@@ -1046,6 +1048,15 @@ class SphinxClient
 		$this->_token_filter_name = $name;
 		$this->_token_filter_opts = $opts;
 	}
+
+	/// fetch the page after the given match; values are its sort key values in ORDER BY order,
+	/// followed by its document id (unless id is a sort key already); empty array resets
+	function SetSearchAfter ( $values )
+	{
+		assert ( is_array($values) );
+
+		$this->_search_after = join ( ",", $values );
+	}
 	
 	//////////////////////////////////////////////////////////////////////////////
 
@@ -1251,6 +1262,9 @@ class SphinxClient
 		$req .= pack ( "N", strlen($this->_token_filter_name) ) . $this->_token_filter_name;
 		$req .= pack ( "N", strlen($this->_token_filter_opts) ) . $this->_token_filter_opts;
 
+		// search_after
+		$req .= pack ( "N", strlen($this->_search_after) ) . $this->_search_after;
+
 		// mbstring workaround
 		$this->_MBPop ();
 
@@ -50,7 +50,7 @@ SEARCHD_COMMAND_STATUS		= 5
 SEARCHD_COMMAND_FLUSHATTRS	= 7
 
 # current client-side command implementation versions
-VER_COMMAND_SEARCH		= 0x120
+VER_COMMAND_SEARCH		= 0x121
 VER_COMMAND_EXCERPT		= 0x104
 VER_COMMAND_UPDATE		= 0x103
 VER_COMMAND_KEYWORDS	= 0x100
@@ -176,6 +176,7 @@ class SphinxClient:
 		self._tokenfilterlibrary = bytearray()						# token_filter plugin library name
 		self._tokenfiltername = bytearray()						# token_filter plugin name
 		self._tokenfilteropts = bytearray()						# token_filter plugin options
+		self._searchafter = bytearray()							# sort key values of the previous page last match
 		
 		self._error			= ''							# last error message
 		self._warning		= ''							# last warning message
@@ -574,6 +575,14 @@ class SphinxClient:
 		self._tokenfilterlibrary = str_bytes(library)
 		self._tokenfiltername = str_bytes(name)
 		self._tokenfilteropts = str_bytes(opts)
+
+	def SetSearchAfter ( self, values ):
+		"""
+		Fetch the page after the given match. Values are its sort key values in ORDER BY order,
+		followed by its document id (unless id is a sort key already). Empty list resets.
+		"""
+		assert(isinstance(values, (list, tuple)))
+		self._searchafter = str_bytes(','.join([str(v) for v in values]))
 		
 	def ResetOverrides (self):
 		self._overrides = {}
@@ -755,6 +764,9 @@ class SphinxClient:
 		req.extend ( pack('>L',len(self._tokenfilterlibrary)) + self._tokenfilterlibrary )
 		req.extend ( pack('>L',len(self._tokenfiltername)) + self._tokenfiltername )
 		req.extend ( pack('>L',len(self._tokenfilteropts)) + self._tokenfilteropts )
+
+		# search_after
+		req.extend ( pack('>L',len(self._searchafter)) + self._searchafter )
 			
 		# send query, get response
 
@@ -775,6 +775,9 @@ int main ( int argc, char ** argv )
 			"--dumphitlist <INDEX> <KEYWORD>\n"
 			"--dumphitlist <INDEX> --wordid <ID>\n"
 			"\t\t\tdump hits for a given keyword\n"
+			"--estimate-reorder <INDEX> <ATTR>\n"
+			"\t\t\testimate doclist docid bytes if documents were renumbered\n"
+			"\t\t\tin ATTR order\n"
 			"--fold <INDEX> [FILE]\tfold FILE or stdin using INDEX charset_table\n"
 			"--htmlstrip <INDEX>\tfilter stdin using index HTML stripper settings\n"
 			"--optimize-rt-klists <INDEX>\n"
@@ -804,7 +807,7 @@ int main ( int argc, char ** argv )
 	#define OPT1(_a1)		else if ( !strcmp(argv[i],_a1) )
 
 	const char * sOptConfig = NULL;
-	CSphString sDumpHeader, sIndex, sKeyword, sFoldFile;
+	CSphString sDumpHeader, sIndex, sKeyword, sFoldFile, sReorderAttr;
 	bool bWordid = false;
 	bool bStripPath = false;
 	CSphVector<CSphString> dFiles;
@@ -823,6 +826,7 @@ int main ( int argc, char ** argv )
 		CMD_DUMPDOCIDS,
 		CMD_DUMPHITLIST,
 		CMD_DUMPDICT,
+		CMD_ESTIMATEREORDER,
 		CMD_CHECK,
 		CMD_STRIP,
 		CMD_OPTIMIZEKLISTS,
@@ -902,6 +906,12 @@ int main ( int argc, char ** argv )
 
 			sKeyword = argv[++i];
 
+		} else if ( !strcmp ( argv[i], "--estimate-reorder" ) )
+		{
+			eCommand = CMD_ESTIMATEREORDER;
+			sIndex = argv[++i];
+			sReorderAttr = argv[++i];
+
 		} else if ( !strcmp ( argv[i], "--buildidf" ) || !strcmp ( argv[i], "--mergeidf" ) )
 		{
 			eCommand = !strcmp ( argv[i], "--buildidf" ) ? CMD_BUILDIDF : CMD_MERGEIDF;
@@ -1179,6 +1189,13 @@ int main ( int argc, char ** argv )
 			break;
 		}
 
+		case CMD_ESTIMATEREORDER:
+			if ( hConf["index"][sIndex]("type") && hConf["index"][sIndex]["type"]=="rt" )
+				sphDie ( "estimate-reorder requires a disk index" );
+			fprintf ( stdout, "estimating reorder for index '%s' by attribute '%s'...\n", sIndex.cstr(), sReorderAttr.cstr() );
+			pIndex->DebugEstimateReorder ( stdout, sReorderAttr.cstr() );
+			break;
+
 		case CMD_CHECK:
 			fprintf ( stdout, "checking index '%s'...\n", sIndex.cstr() );
 			iCheckErrno = pIndex->DebugCheck ( stdout );
@@ -45,6 +45,10 @@ extern "C"
 #include "searchdaemon.h"
 #include "searchdha.h"
 
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
 #define SEARCHD_BACKLOG			5
 #define SPHINXAPI_PORT			9312
 #define SPHINXQL_PORT			9306
@@ -176,8 +180,35 @@ struct Listener_t
 	bool				m_bTcp;
 	ProtocolType_e		m_eProto;
 	bool				m_bVIP;
+	DWORD				m_uIP;
+	int					m_iPort;
 };
 static CSphVector<Listener_t>	g_dListeners;
+static bool						g_bNetReusePort = false;	// every net loop binds its own copy of tcp listeners
+static CSphVector< CSphVector<Listener_t> >	g_dNetLoopListeners;
+
+// per net-loop counters, written by loop thread only, read by SHOW STATUS
+struct NetLoopStats_t
+{
+	int64_t				m_iTicks;
+	int64_t				m_iEvents;
+	int64_t				m_iConnections;
+	int64_t				m_tmPoll;
+	int64_t				m_tmWork;
+	int					m_iListeners;
+	int					m_iOwnListeners;
+
+	NetLoopStats_t ()
+		: m_iTicks ( 0 )
+		, m_iEvents ( 0 )
+		, m_iConnections ( 0 )
+		, m_tmPoll ( 0 )
+		, m_tmWork ( 0 )
+		, m_iListeners ( 0 )
+		, m_iOwnListeners ( 0 )
+	{}
+};
+static CSphVector<NetLoopStats_t>	g_dNetLoopStats;
 
 static int				g_iQueryLogFile	= -1;
 static CSphString		g_sQueryLogFile;
@@ -358,14 +389,14 @@ static CSphAtomic							g_iPersistentInUse;
 /// master-agent API protocol extensions version
 enum
 {
-	VER_MASTER = 14
+	VER_MASTER = 15
 };
 
 
 /// command names
 static const char * g_dApiCommands[SEARCHD_COMMAND_TOTAL] =
 {
-	"search", "excerpt", "update", "keywords", "persist", "status", "query", "flushattrs", "query", "ping", "delete", "uvar"
+	"search", "excerpt", "update", "keywords", "persist", "status", "query", "flushattrs", "query", "ping", "delete", "uvar", "mux"
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -374,7 +405,8 @@ const char * sAgentStatsNames[eMaxAgentStat+ehMaxStat]=
 	{ "query_timeouts", "connect_timeouts", "connect_failures",
 		"network_errors", "wrong_replies", "unexpected_closings",
 		"warnings", "succeeded_queries", "total_query_time",
-		"connect_count", "connect_avg", "connect_max" };
+		"connect_count", "connect_avg", "connect_max",
+		"packed_replies", "reply_bytes", "unpacked_bytes" };
 
 static CSphQueryResultMeta		g_tLastMeta;
 static CSphMutex				g_tLastMetaMutex;
@@ -1432,6 +1464,9 @@ void Shutdown ()
 			sphThreadJoin ( g_dTickPoolThread.Begin() + i );
 	}
 
+	// indexes still replaying their binlogs in background must finish first
+	sphWaitBinlogReplay();
+
 	CSphString sError;
 	// save attribute updates for all local indexes
 	bAttrsSaveOk = SaveIndexes();
@@ -1453,6 +1488,7 @@ void Shutdown ()
 	SafeDelete ( g_pLocalIndexes );
 	SafeDelete ( g_pTemplateIndexes );
 	sphDoneIOStats();
+	sphDoneMatchArena();
 	sphRTDone();
 
 	sphShutdownWordforms ();
@@ -1464,6 +1500,12 @@ void Shutdown ()
 		if ( g_dListeners[i].m_iSock>=0 )
 			sphSockClose ( g_dListeners[i].m_iSock );
 
+	// net loops past the first one might own reuseport copies of tcp listeners
+	for ( int i=1; i<g_dNetLoopListeners.GetLength(); i++ )
+		ARRAY_FOREACH ( j, g_dNetLoopListeners[i] )
+			if ( g_dNetLoopListeners[i][j].m_iSock>=0 && g_dNetLoopListeners[i][j].m_iSock!=g_dListeners[j].m_iSock )
+				sphSockClose ( g_dNetLoopListeners[i][j].m_iSock );
+
 	ClosePersistentSockets();
 
 	// remove pid
@@ -2057,7 +2099,38 @@ int sphCreateUnixSocket ( const char * sPath )
 #endif // !USE_WINDOWS
 
 
-int sphCreateInetSocket ( DWORD uAddr, int iPort )
+static int CreateTcpSocket ( bool bReusePort )
+{
+	int iSock = socket ( AF_INET, SOCK_STREAM, 0 );
+	if ( iSock==-1 )
+		return -1;
+
+	int iOn = 1;
+	if ( setsockopt ( iSock, SOL_SOCKET, SO_REUSEADDR, (char*)&iOn, sizeof(iOn) ) )
+		sphWarning ( "setsockopt() failed: %s", sphSockError() );
+#ifdef SO_REUSEPORT
+	if ( bReusePort && setsockopt ( iSock, SOL_SOCKET, SO_REUSEPORT, (char*)&iOn, sizeof(iOn) ) )
+		sphWarning ( "setsockopt(SO_REUSEPORT) failed: %s", sphSockError() );
+#endif
+#ifdef TCP_NODELAY
+	if ( setsockopt ( iSock, IPPROTO_TCP, TCP_NODELAY, (char*)&iOn, sizeof(iOn) ) )
+		sphWarning ( "setsockopt() failed: %s", sphSockError() );
+#endif
+
+	return iSock;
+}
+
+
+static void FillInetAddr ( struct sockaddr_in & tAddr, DWORD uAddr, int iPort )
+{
+	memset ( &tAddr, 0, sizeof(tAddr) );
+	tAddr.sin_family = AF_INET;
+	tAddr.sin_addr.s_addr = uAddr;
+	tAddr.sin_port = htons ( (short)iPort );
+}
+
+
+int sphCreateInetSocket ( DWORD uAddr, int iPort, bool bReusePort=false )
 {
 	char sAddress[SPH_ADDRESS_SIZE];
 	sphFormatIP ( sAddress, SPH_ADDRESS_SIZE, uAddr );
@@ -2068,23 +2141,12 @@ int sphCreateInetSocket ( DWORD uAddr, int iPort )
 		sphInfo ( "listening on %s:%d", sAddress, iPort );
 
 	static struct sockaddr_in iaddr;
-	memset ( &iaddr, 0, sizeof(iaddr) );
-	iaddr.sin_family = AF_INET;
-	iaddr.sin_addr.s_addr = uAddr;
-	iaddr.sin_port = htons ( (short)iPort );
+	FillInetAddr ( iaddr, uAddr, iPort );
 
-	int iSock = socket ( AF_INET, SOCK_STREAM, 0 );
+	int iSock = CreateTcpSocket ( bReusePort );
 	if ( iSock==-1 )
 		sphFatal ( "failed to create TCP socket: %s", sphSockError() );
 
-	int iOn = 1;
-	if ( setsockopt ( iSock, SOL_SOCKET, SO_REUSEADDR, (char*)&iOn, sizeof(iOn) ) )
-		sphWarning ( "setsockopt() failed: %s", sphSockError() );
-#ifdef TCP_NODELAY
-	if ( setsockopt ( iSock, IPPROTO_TCP, TCP_NODELAY, (char*)&iOn, sizeof(iOn) ) )
-		sphWarning ( "setsockopt() failed: %s", sphSockError() );
-#endif
-
 	int iTries = 12;
 	int iRes;
 	do
@@ -2103,6 +2165,43 @@ int sphCreateInetSocket ( DWORD uAddr, int iPort )
 }
 
 
+/// non-fatal SO_REUSEPORT copy of an already bound listener for the extra net loops
+/// binds once without retries; returns listening non-blocking socket, or -1 and error message
+static int CreateReusePortListener ( DWORD uAddr, int iPort, CSphString & sError )
+{
+	char sAddress[SPH_ADDRESS_SIZE];
+	sphFormatIP ( sAddress, SPH_ADDRESS_SIZE, uAddr );
+	sphLogDebug ( "listening on %s:%d (net-loop copy)", sAddress, iPort );
+
+	struct sockaddr_in tAddr;
+	FillInetAddr ( tAddr, uAddr, iPort );
+
+	int iSock = CreateTcpSocket ( true );
+	if ( iSock==-1 )
+	{
+		sError.SetSprintf ( "failed to create TCP socket: %s", sphSockError() );
+		return -1;
+	}
+
+	const char * sCall = NULL;
+	if ( bind ( iSock, (struct sockaddr *)&tAddr, sizeof(tAddr) )!=0 )
+		sCall = "bind()";
+	else if ( listen ( iSock, g_iBacklog )==-1 )
+		sCall = "listen()";
+	else if ( sphSetSockNB ( iSock )<0 )
+		sCall = "sphSetSockNB()";
+
+	if ( sCall )
+	{
+		sError.SetSprintf ( "%s failed on %s:%d: %s", sCall, sAddress, iPort, sphSockError() );
+		sphSockClose ( iSock );
+		return -1;
+	}
+
+	return iSock;
+}
+
+
 bool IsPortInRange ( int iPort )
 {
 	return ( iPort>0 ) && ( iPort<=0xFFFF );
@@ -2260,6 +2359,8 @@ void AddListener ( const CSphString & sListen, bool bHttpAllowed )
 	tListener.m_eProto = tDesc.m_eProto;
 	tListener.m_bTcp = true;
 	tListener.m_bVIP = tDesc.m_bVIP;
+	tListener.m_uIP = 0;
+	tListener.m_iPort = 0;
 
 	if ( tDesc.m_eProto==PROTO_HTTP && !bHttpAllowed )
 	{
@@ -2274,7 +2375,11 @@ void AddListener ( const CSphString & sListen, bool bHttpAllowed )
 		tListener.m_bTcp = false;
 	} else
 #endif
-		tListener.m_iSock = sphCreateInetSocket ( tDesc.m_uIP, tDesc.m_iPort );
+	{
+		tListener.m_iSock = sphCreateInetSocket ( tDesc.m_uIP, tDesc.m_iPort, g_bNetReusePort );
+		tListener.m_uIP = tDesc.m_uIP;
+		tListener.m_iPort = tDesc.m_iPort;
+	}
 
 	g_dListeners.Add ( tListener );
 }
@@ -2291,7 +2396,7 @@ int sphSetSockNB ( int iSock )
 }
 
 /// wait until socket is readable or writable
-int sphPoll ( int iSock, int64_t tmTimeout, bool bWrite=false )
+int sphPoll ( int iSock, int64_t tmTimeout, bool bWrite )
 {
 	// don't need any epoll/kqueue here, since we check only 1 socket
 #if HAVE_POLL
@@ -2982,11 +3087,11 @@ struct SearchRequestBuilder_t : public IRequestBuilder_t
 		: m_dQueries ( dQueries ), m_iStart ( iStart ), m_iEnd ( iEnd ), m_iDivideLimits ( iDivideLimits )
 	{}
 
-	virtual void		BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const;
+	virtual void		BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const;
 
 protected:
 	int					CalcQueryLen ( const char * sIndexes, const CSphQuery & q, bool bAgentWeight ) const;
-	void				SendQuery ( const char * sIndexes, NetOutputBuffer_c & tOut, const CSphQuery & q, bool bAgentWeight, int iWeight ) const;
+	void				SendQuery ( const char * sIndexes, ISphOutputBuffer & tOut, const CSphQuery & q, bool bAgentWeight, int iWeight ) const;
 
 protected:
 	const CSphVector<CSphQuery> &		m_dQueries;
@@ -3018,7 +3123,7 @@ protected:
 
 int SearchRequestBuilder_t::CalcQueryLen ( const char * sIndexes, const CSphQuery & q, bool bAgentWeight ) const
 {
-	int iReqSize = 156 + 2*sizeof(SphDocID_t) + 4*q.m_dWeights.GetLength()
+	int iReqSize = 160 + 2*sizeof(SphDocID_t) + 4*q.m_dWeights.GetLength()
 		+ q.m_sSortBy.Length()
 		+ strlen ( sIndexes )
 		+ q.m_sGroupBy.Length()
@@ -3031,7 +3136,8 @@ int SearchRequestBuilder_t::CalcQueryLen ( const char * sIndexes, const CSphQuer
 		+ q.m_sUDRankerOpts.Length()
 		+ q.m_sQueryTokenFilterLib.Length()
 		+ q.m_sQueryTokenFilterName.Length()
-		+ q.m_sQueryTokenFilterOpts.Length();
+		+ q.m_sQueryTokenFilterOpts.Length()
+		+ q.m_sSearchAfter.Length();
 	iReqSize += q.m_sRawQuery.IsEmpty()
 		? q.m_sQuery.Length()
 		: q.m_sRawQuery.Length();
@@ -3092,10 +3198,11 @@ enum
 	QFLAG_GLOBAL_IDF			= 1UL << 5,
 	QFLAG_NORMALIZED_TF			= 1UL << 6,
 	QFLAG_LOCAL_DF				= 1UL << 7,
-	QFLAG_LOW_PRIORITY			= 1UL << 8
+	QFLAG_LOW_PRIORITY			= 1UL << 8,
+	QFLAG_PACKED_REPLY			= 1UL << 9
 };
 
-void SearchRequestBuilder_t::SendQuery ( const char * sIndexes, NetOutputBuffer_c & tOut, const CSphQuery & q, bool bAgentWeight, int iWeight ) const
+void SearchRequestBuilder_t::SendQuery ( const char * sIndexes, ISphOutputBuffer & tOut, const CSphQuery & q, bool bAgentWeight, int iWeight ) const
 {
 	// starting with command version 1.27, flags go first
 	// reason being, i might add flags that affect *any* of the subsequent data (eg. qflag_pack_ints)
@@ -3109,6 +3216,7 @@ void SearchRequestBuilder_t::SendQuery ( const char * sIndexes, NetOutputBuffer_
 	uFlags |= QFLAG_NORMALIZED_TF * q.m_bNormalizedTFIDF;
 	uFlags |= QFLAG_LOCAL_DF * q.m_bLocalDF;
 	uFlags |= QFLAG_LOW_PRIORITY * q.m_bLowPriority;
+	uFlags |= QFLAG_PACKED_REPLY * g_bAgentCompression;
 	tOut.SendDword ( uFlags );
 
 	// The Search Legacy
@@ -3264,10 +3372,11 @@ void SearchRequestBuilder_t::SendQuery ( const char * sIndexes, NetOutputBuffer_
 	tOut.SendString ( q.m_sQueryTokenFilterLib.cstr() );
 	tOut.SendString ( q.m_sQueryTokenFilterName.cstr() );
 	tOut.SendString ( q.m_sQueryTokenFilterOpts.cstr() );
+	tOut.SendString ( q.m_sSearchAfter.cstr() );
 }
 
 
-void SearchRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const
+void SearchRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const
 {
 	const char* sIndexes = tAgent.m_sIndexes.cstr();
 	bool bAgentWeigth = ( tAgent.m_iWeight!=-1 );
@@ -4092,6 +4201,7 @@ bool ParseSearchQuery ( InputBuffer_c & tReq, ISphOutputBuffer & tOut, CSphQuery
 		tQuery.m_bGlobalIDF = !!( uFlags & QFLAG_GLOBAL_IDF );
 		tQuery.m_bLocalDF = !!( uFlags & QFLAG_LOCAL_DF );
 		tQuery.m_bLowPriority = !!( uFlags & QFLAG_LOW_PRIORITY );
+		tQuery.m_bPackedReply = ( iMasterVer>0 && ( uFlags & QFLAG_PACKED_REPLY ) );
 
 		if ( iMasterVer>0 || iVer==0x11E )
 			tQuery.m_bNormalizedTFIDF = !!( uFlags & QFLAG_NORMALIZED_TF );
@@ -4141,6 +4251,9 @@ bool ParseSearchQuery ( InputBuffer_c & tReq, ISphOutputBuffer & tOut, CSphQuery
 		tQuery.m_sQueryTokenFilterOpts = tReq.GetString();
 	}
 
+	if ( iMasterVer>=15 || iVer>=0x121 )
+		tQuery.m_sSearchAfter = tReq.GetString();
+
 	/////////////////////
 	// additional checks
 	/////////////////////
@@ -4469,6 +4582,12 @@ static void FormatOption ( const CSphQuery & tQuery, CSphStringBuilder & tBuf )
 		tBuf.Appendf ( "comment='%s'", tQuery.m_sComment.cstr() ); // FIXME! escape, replace newlines..
 	}
 
+	if ( !tQuery.m_sSearchAfter.IsEmpty() )
+	{
+		tBuf.Appendf ( iOpts++ ? ", " : " OPTION " );
+		tBuf.Appendf ( "search_after='%s'", tQuery.m_sSearchAfter.cstr() );
+	}
+
 	if ( tQuery.m_eRanker!=SPH_RANK_DEFAULT )
 	{
 		const char * sRanker = sphGetRankerName ( tQuery.m_eRanker );
@@ -5488,31 +5607,6 @@ void AggrResult_t::ClampMatches ( int iLimit, bool bCommonSchema )
 }
 
 
-struct TaggedMatchSorter_fn : public SphAccessor_T<CSphMatch>
-{
-	void CopyKey ( CSphMatch * pMed, CSphMatch * pVal ) const
-	{
-		pMed->m_uDocID = pVal->m_uDocID;
-		pMed->m_iTag = pVal->m_iTag;
-	}
-
-	bool IsLess ( const CSphMatch & a, const CSphMatch & b ) const
-	{
-		bool bDistA = ( ( a.m_iTag & 0x80000000 )==0x80000000 );
-		bool bDistB = ( ( b.m_iTag & 0x80000000 )==0x80000000 );
-		// sort by doc_id, dist_tag, tag
-		return ( a.m_uDocID < b.m_uDocID ) ||
-			( a.m_uDocID==b.m_uDocID && ( ( !bDistA && bDistB ) || ( ( a.m_iTag & 0x7FFFFFFF )>( b.m_iTag & 0x7FFFFFFF ) ) ) );
-	}
-
-	// inherited swap does not work on gcc
-	void Swap ( CSphMatch * a, CSphMatch * b ) const
-	{
-		::Swap ( *a, *b );
-	}
-};
-
-
 void RemapResult ( const ISphSchema * pTarget, AggrResult_t * pRes )
 {
 	int iCur = 0;
@@ -5613,6 +5707,8 @@ const CSphVector<CSphQueryItem> * ExpandAsterisk ( const ISphSchema & tSchema,
 			{
 				if ( !j && bNoID && tSchema.GetAttr(j).m_sName=="id" )
 					continue;
+				if ( sphJsonNameSplit ( tSchema.GetAttr(j).m_sName.cstr(), NULL, NULL ) )
+					continue; // typed columns extracted from JSON are only reachable by their path
 				CSphQueryItem& tItem = pExpanded->Add();
 				tItem.m_sExpr = tSchema.GetAttr ( j ).m_sName;
 			}
@@ -5650,11 +5746,19 @@ static void RemapStrings ( ISphMatchSorter * pSorter, AggrResult_t & tRes )
 }
 
 
-static int KillAllDupes ( ISphMatchSorter * pSorter, AggrResult_t & tRes )
+static int KillAllDupes ( ISphMatchSorter * pSorter, AggrResult_t & tRes, const CSphQuery & tQuery )
 {
 	assert ( pSorter );
 	int iDupes = 0;
 
+	// search_after cursor is only applied by the sorter, and agents might not know it
+	if ( !pSorter->IsGroupby() && pSorter->CanMergeSorted() && !tQuery.m_bHasOuter && tQuery.m_sSearchAfter.IsEmpty()
+		&& sphMergeSortedSets ( *pSorter, tRes.m_dMatches, tRes.m_dMatchCounts, tQuery.m_iMaxMatches, tRes.m_tSchema, iDupes ) )
+	{
+		SafeDelete ( pSorter );
+		return iDupes;
+	}
+
 	if ( pSorter->IsGroupby () )
 	{
 		// groupby sorter does that automagically
@@ -6197,7 +6301,7 @@ bool MinimizeAggrResult ( AggrResult_t & tRes, CSphQuery & tQuery, int iLocals,
 		RemapStrings ( pSorter, tRes );
 
 		// do the sort work!
-		tRes.m_iTotalMatches -= KillAllDupes ( pSorter, tRes );
+		tRes.m_iTotalMatches -= KillAllDupes ( pSorter, tRes, tQuery );
 	}
 
 	// apply outer order clause to single result set
@@ -6322,6 +6426,14 @@ bool MinimizeAggrResult ( AggrResult_t & tRes, CSphQuery & tQuery, int iLocals,
 			}
 	}
 
+	// cursor for the next page, built while the full schema (with all the sort keys) is still at hand
+	if ( tQuery.m_bSearchAfter && tQuery.m_sGroupBy.IsEmpty() && !tQuery.m_bHasOuter )
+	{
+		int iLast = Min ( tQuery.m_iOffset+tQuery.m_iLimit, tRes.m_dMatches.GetLength() ) - 1;
+		if ( iLast>=0 )
+			sphFormatSearchAfter ( tQuery, tRes.m_tSchema, tRes.m_dMatches[iLast], tRes.m_sNextSearchAfter );
+	}
+
 	// all the merging and sorting is now done
 	// replace the minimized matches schema with its subset, the result set schema
 	tRes.m_tSchema.SwapAttrs ( dFrontend );
@@ -6745,6 +6857,7 @@ protected:
 	bool							RunLocalSearch ( int iLocal, ISphMatchSorter ** ppSorters, CSphQueryResult ** pResults, bool * pMulti ) const;
 	bool							AllowsMulti ( int iStart, int iEnd ) const;
 	void							SetupLocalDF ( int iStart, int iEnd );
+	bool							HasDisjointLocals () const;
 
 	int								m_iStart;		///< subset start
 	int								m_iEnd;			///< subset end
@@ -6752,6 +6865,8 @@ protected:
 	bool							m_bFacetQueue;	///< whether current subset is subject to facet-queue optimization
 	CSphVector<LocalIndex_t>		m_dLocal;		///< local indexes for the current subset
 	mutable CSphVector<CSphSchemaMT>		m_dExtraSchemas; ///< the extra fields for agents
+	mutable CSphFixedVector<SharedTopWeight_t>	m_dTopWeights;	///< per-query weight threshold shared by local index sorters
+	bool							m_bShareTopWeight;	///< whether local index sorters may use the shared threshold
 	bool							m_bSphinxql;	///< if the query get from sphinxql - to avoid applying sphinxql magick for others
 	CSphAttrUpdateEx *				m_pUpdates;		///< holder for updates
 	CSphVector<SphDocID_t> *		m_pDelete;		///< this query is for deleting
@@ -6780,11 +6895,13 @@ ISphSearchHandler * sphCreateSearchHandler ( int iQueries, bool bSphinxql, bool
 
 
 SearchHandler_c::SearchHandler_c ( int iQueries, bool bSphinxql, bool bMaster, int iCid )
+	: m_dTopWeights ( iQueries )
 {
 	m_iStart = 0;
 	m_iEnd = 0;
 	m_bMultiQueue = false;
 	m_bFacetQueue = false;
+	m_bShareTopWeight = false;
 
 	m_dQueries.Resize ( iQueries );
 	m_dResults.Resize ( iQueries );
@@ -7327,6 +7444,8 @@ void SearchHandler_c::RunLocalSearchesMT ()
 			}
 			if ( tRaw.m_iBadRows )
 				tRes.m_sWarning.SetSprintf ( "query result is inaccurate because of " INT64_FMT " missed documents", tRaw.m_iBadRows );
+			else if ( tRaw.m_iUnscannedRows )
+				tRes.m_sWarning.SetSprintf ( "total_found is approximate, sort_by order scan stopped before " INT64_FMT " documents", tRaw.m_iUnscannedRows );
 
 			m_dQueryIndexStats[iLocal].m_dStats[iQuery-m_iStart].m_iSuccesses = 1;
 			m_dQueryIndexStats[iLocal].m_dStats[iQuery-m_iStart].m_uFoundRows = pSorter->GetTotalCount();
@@ -7398,6 +7517,9 @@ bool SearchHandler_c::RunLocalSearch ( int iLocal, ISphMatchSorter ** ppSorters,
 		tQueueSettings.m_pUpdate = m_pUpdates;
 		tQueueSettings.m_pDeletes = m_pDelete;
 		tQueueSettings.m_pHook = &m_tHook;
+		tQueueSettings.m_bStringDicts = true;
+		if ( m_bShareTopWeight )
+			tQueueSettings.m_pTopWeight = &m_dTopWeights[i+m_iStart];
 
 		ppSorters[i] = sphCreateQueue ( tQueueSettings );
 
@@ -7537,6 +7659,9 @@ void SearchHandler_c::RunLocalSearches ( ISphMatchSorter * pLocalSorter, DWORD u
 				tQueueSettings.m_pUpdate = m_pUpdates;
 				tQueueSettings.m_pDeletes = m_pDelete;
 				tQueueSettings.m_pHook = &m_tHook;
+				tQueueSettings.m_bStringDicts = true;
+				if ( m_bShareTopWeight )
+					tQueueSettings.m_pTopWeight = &m_dTopWeights[iQuery];
 
 				pSorter = sphCreateQueue ( tQueueSettings );
 
@@ -7680,8 +7805,11 @@ void SearchHandler_c::RunLocalSearches ( ISphMatchSorter * pLocalSorter, DWORD u
 				AggrResult_t & tRes = m_dResults[iQuery];
 
 				int64_t iBadRows = m_bMultiQueue ? tStats.m_iBadRows : tRes.m_iBadRows;
+				int64_t iUnscannedRows = m_bMultiQueue ? tStats.m_iUnscannedRows : tRes.m_iUnscannedRows;
 				if ( iBadRows )
 					tRes.m_sWarning.SetSprintf ( "query result is inaccurate because of " INT64_FMT " missed documents", iBadRows );
+				else if ( iUnscannedRows )
+					tRes.m_sWarning.SetSprintf ( "total_found is approximate, sort_by order scan stopped before " INT64_FMT " documents", iUnscannedRows );
 
 				int iQTimeForStats = tRes.m_iQueryTime;
 
@@ -7791,6 +7919,41 @@ bool SearchHandler_c::AllowsMulti ( int iStart, int iEnd ) const
 }
 
 
+struct DocidRange_t
+{
+	SphDocID_t	m_uMin;
+	SphDocID_t	m_uMax;
+};
+
+// a match rejected by the shared weight threshold might be the freshest copy of a document
+// that is also found in another index; so only share it when local indexes can't have common docids
+bool SearchHandler_c::HasDisjointLocals () const
+{
+	if ( m_dLocal.GetLength()<2 )
+		return false;
+
+	CSphVector<DocidRange_t> dRanges;
+	ARRAY_FOREACH ( i, m_dLocal )
+	{
+		const ServedIndex_c * pServed = UseIndex ( i );
+		if ( !pServed )
+			return false;
+
+		DocidRange_t & tRange = dRanges.Add();
+		bool bRange = pServed->m_bEnabled && pServed->m_pIndex->GetDocidRange ( tRange.m_uMin, tRange.m_uMax );
+		ReleaseIndex ( i );
+		if ( !bRange )
+			return false;
+	}
+
+	dRanges.Sort ( bind ( &DocidRange_t::m_uMin ) );
+	for ( int i=1; i<dRanges.GetLength(); i++ )
+		if ( dRanges[i].m_uMin<=dRanges[i-1].m_uMax )
+			return false;
+	return true;
+}
+
+
 struct IndexSettings_t
 {
 	uint64_t	m_uHash;
@@ -7991,6 +8154,10 @@ void SearchHandler_c::RunSubset ( int iStart, int iEnd )
 	int64_t tmLocal = 0;
 	int64_t tmCpu = sphCpuTimer ();
 
+	// matches of local searches, and of the following master merge, share the subset arena
+	CSphMatchArena tArena;
+	tArena.Start();
+
 	// prepare for descent
 	CSphQuery & tFirst = m_dQueries[iStart];
 
@@ -8307,6 +8474,9 @@ void SearchHandler_c::RunSubset ( int iStart, int iEnd )
 		if ( m_pProfile )
 			m_pProfile->Switch ( SPH_QSTATE_LOCAL_SEARCH );
 
+		// remote agents might return copies of local documents, too
+		m_bShareTopWeight = !dAgents.GetLength() && HasDisjointLocals();
+
 		tmLocal = -sphMicroTimer();
 		RunLocalSearches ( pLocalSorter, uLocalPFFlags );
 		tmLocal += sphMicroTimer();
@@ -8337,7 +8507,7 @@ void SearchHandler_c::RunSubset ( int iStart, int iEnd )
 				dStringStorage.Add ( 0 );
 				SearchReplyParser_t tParser ( iStart, iEnd, dMvaStorage, dStringStorage );
 				int iMsecLeft = iAgentQueryTimeout - (int)( tmLocal/1000 );
-				int iReplys = RemoteWaitForAgents ( dAgents, Max ( iMsecLeft, 0 ), tParser );
+				int iReplys = RemoteWaitForAgents ( dAgents, Max ( iMsecLeft, 0 ), tParser, tReqBuilder.Ptr() );
 				if ( tDistCtrl->RetryFailed ()>0 )
 					bDistDone = false;
 				// check if there were valid (though might be 0-matches) replies, and merge them
@@ -8737,6 +8907,37 @@ bool CheckCommandVersion ( int iVer, int iDaemonVersion, ISphOutputBuffer & tOut
 }
 
 
+#if USE_ZLIB
+static const int PACKED_REPLY_MIN = 1024; // smaller replies are sent as is
+
+// send reply body zlib-packed, or plain when packing does not pay off
+static void SendPackedReply ( ISphOutputBuffer & tOut, WORD uVer, ISphOutputBuffer & tBody )
+{
+	CSphVector<BYTE> dBody;
+	tBody.SwapData ( dBody );
+
+	uLongf uPacked = compressBound ( dBody.GetLength() );
+	CSphFixedVector<BYTE> dPacked ( (int)uPacked );
+	bool bPacked = ( compress2 ( dPacked.Begin(), &uPacked, dBody.Begin(), dBody.GetLength(), Z_BEST_SPEED )==Z_OK
+		&& (int)uPacked+(int)sizeof(DWORD)<dBody.GetLength() );
+
+	tOut.SendWord ( (WORD)SEARCHD_OK );
+	if ( !bPacked )
+	{
+		tOut.SendWord ( uVer );
+		tOut.SendInt ( dBody.GetLength() );
+		tOut.SendBytes ( dBody.Begin(), dBody.GetLength() );
+		return;
+	}
+
+	// packed body is the unpacked length followed by zlib stream
+	tOut.SendWord ( uVer | VER_REPLY_PACKED );
+	tOut.SendInt ( sizeof(DWORD) + (int)uPacked );
+	tOut.SendDword ( dBody.GetLength() );
+	tOut.SendBytes ( dPacked.Begin(), (int)uPacked );
+}
+#endif
+
 void SendSearchResponse ( SearchHandler_c & tHandler, ISphOutputBuffer & tOut, int iVer, int iMasterVer )
 {
 	// serve the response
@@ -8770,6 +8971,21 @@ void SendSearchResponse ( SearchHandler_c & tHandler, ISphOutputBuffer & tOut, i
 		ARRAY_FOREACH ( i, tHandler.m_dQueries )
 			iReplyLen += CalcResultLength ( iVer, &tHandler.m_dResults[i], tHandler.m_dResults[i].m_dTag2Pools, bAgentMode, tHandler.m_dQueries[i], iMasterVer );
 
+#if USE_ZLIB
+		// master asked for compressed reply; worth it for big result sets only
+		if ( bAgentMode && iReplyLen>=PACKED_REPLY_MIN && tHandler.m_dQueries[0].m_bPackedReply )
+		{
+			ISphOutputBuffer tBody;
+			ARRAY_FOREACH ( i, tHandler.m_dQueries )
+				SendResult ( iVer, tBody, &tHandler.m_dResults[i], tHandler.m_dResults[i].m_dTag2Pools, bAgentMode, tHandler.m_dQueries[i], iMasterVer );
+			assert ( tBody.GetSentCount()==iReplyLen );
+
+			SendPackedReply ( tOut, VER_COMMAND_SEARCH, tBody );
+			tOut.Flush ();
+			return;
+		}
+#endif
+
 		// send it
 		tOut.SendWord ( (WORD)SEARCHD_OK );
 		tOut.SendWord ( VER_COMMAND_SEARCH );
@@ -9461,6 +9677,11 @@ bool SqlParser_c::AddOption ( const SqlNode_t & tIdent, const SqlNode_t & tValue
 	{
 		ToStringUnescape ( m_pQuery->m_sComment, tValue );
 
+	} else if ( sOpt=="search_after" )
+	{
+		ToStringUnescape ( m_pQuery->m_sSearchAfter, tValue );
+		m_pQuery->m_bSearchAfter = true;
+
 	} else if ( sOpt=="sort_method" )
 	{
 		if ( sVal=="pq" )			m_pQuery->m_bSortKbuffer = false;
@@ -10232,7 +10453,7 @@ struct SnippetRequestBuilder_t : public IRequestBuilder_t
 		, m_iWorker ( 0 )
 	{
 	}
-	virtual void BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const;
+	virtual void BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const;
 
 private:
 	const SnippetsRemote_t * m_pWorker;
@@ -10257,7 +10478,7 @@ private:
 };
 
 
-void SnippetRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const
+void SnippetRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const
 {
 	// it sends either all queries to each agent or sequence of queries to current agent
 	m_tWorkerMutex.Lock();
@@ -10888,7 +11109,7 @@ void HandleCommandKeywords ( ISphOutputBuffer & tOut, int iVer, InputBuffer_c &
 struct UpdateRequestBuilder_t : public IRequestBuilder_t
 {
 	explicit UpdateRequestBuilder_t ( const CSphAttrUpdate & pUpd ) : m_tUpd ( pUpd ) {}
-	virtual void BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const;
+	virtual void BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const;
 
 protected:
 	const CSphAttrUpdate & m_tUpd;
@@ -10912,7 +11133,7 @@ protected:
 };
 
 
-void UpdateRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const
+void UpdateRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const
 {
 	const char* sIndexes = tAgent.m_sIndexes.cstr();
 	int iReqSize = 4+strlen(sIndexes); // indexes string
@@ -11388,6 +11609,12 @@ void BuildStatus ( VectorLike & dStatus )
 		dStatus.Add().SetSprintf ( FMT64, (int64_t) g_tStats.m_iAgentConnect );
 	if ( dStatus.MatchAdd ( "agent_retry" ) )
 		dStatus.Add().SetSprintf ( FMT64, (int64_t) g_tStats.m_iAgentRetry );
+	if ( dStatus.MatchAdd ( "agent_mux_connections" ) )
+		dStatus.Add().SetSprintf ( "%d", GetAgentMuxConnections() );
+	if ( dStatus.MatchAdd ( "agent_hedged" ) )
+		dStatus.Add().SetSprintf ( FMT64, (int64_t) g_tStats.m_iAgentHedged );
+	if ( dStatus.MatchAdd ( "agent_hedge_wins" ) )
+		dStatus.Add().SetSprintf ( FMT64, (int64_t) g_tStats.m_iAgentHedgeWins );
 	if ( dStatus.MatchAdd ( "queries" ) )
 		dStatus.Add().SetSprintf ( FMT64, (int64_t) g_tStats.m_iQueries );
 	if ( dStatus.MatchAdd ( "dist_queries" ) )
@@ -11402,6 +11629,25 @@ void BuildStatus ( VectorLike & dStatus )
 			dStatus.Add().SetSprintf ( "%d", g_pThdPool->GetActiveWorkerCount() );
 		if ( dStatus.MatchAdd ( "work_queue_length" ) )
 			dStatus.Add().SetSprintf ( "%d", g_pThdPool->GetQueueLength() );
+
+		ARRAY_FOREACH ( i, g_dNetLoopStats )
+		{
+			const NetLoopStats_t & tLoop = g_dNetLoopStats[i];
+			if ( dStatus.MatchAddVa ( "net_loop_%d_listeners", i ) )
+				dStatus.Add().SetSprintf ( "%d", tLoop.m_iListeners );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_own_listeners", i ) )
+				dStatus.Add().SetSprintf ( "%d", tLoop.m_iOwnListeners );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_connections", i ) )
+				dStatus.Add().SetSprintf ( INT64_FMT, tLoop.m_iConnections );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_ticks", i ) )
+				dStatus.Add().SetSprintf ( INT64_FMT, tLoop.m_iTicks );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_events", i ) )
+				dStatus.Add().SetSprintf ( INT64_FMT, tLoop.m_iEvents );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_poll_time", i ) )
+				FormatMsec ( dStatus.Add(), tLoop.m_tmPoll );
+			if ( dStatus.MatchAddVa ( "net_loop_%d_work_time", i ) )
+				FormatMsec ( dStatus.Add(), tLoop.m_tmWork );
+		}
 	}
 
 	g_tDistLock.Lock();
@@ -11525,6 +11771,16 @@ void BuildStatus ( VectorLike & dStatus )
 		dStatus.Add().SetSprintf ( INT64_FMT, s.m_iUsedBytes );
 	if ( dStatus.MatchAdd ( "qcache_hits" ) )
 		dStatus.Add().SetSprintf ( INT64_FMT, s.m_iHits );
+
+	const PcacheStatus_t & p = PcacheGetStatus();
+	if ( dStatus.MatchAdd ( "expansion_cache_max_bytes" ) )
+		dStatus.Add().SetSprintf ( INT64_FMT, p.m_iMaxBytes );
+	if ( dStatus.MatchAdd ( "expansion_cache_cached_entries" ) )
+		dStatus.Add().SetSprintf ( "%d", p.m_iCachedEntries );
+	if ( dStatus.MatchAdd ( "expansion_cache_used_bytes" ) )
+		dStatus.Add().SetSprintf ( INT64_FMT, p.m_iUsedBytes );
+	if ( dStatus.MatchAdd ( "expansion_cache_hits" ) )
+		dStatus.Add().SetSprintf ( INT64_FMT, p.m_iHits );
 }
 
 void BuildOneAgentStatus ( VectorLike & dStatus, HostDashboard_t* pDash, const char * sPrefix="agent" )
@@ -11719,6 +11975,9 @@ void BuildMeta ( VectorLike & dStatus, const CSphQueryResultMeta & tMeta )
 	if ( dStatus.MatchAdd ( "total_found" ) )
 		dStatus.Add().SetSprintf ( INT64_FMT, tMeta.m_iTotalMatches );
 
+	if ( !tMeta.m_sNextSearchAfter.IsEmpty() && dStatus.MatchAdd ( "next_search_after" ) )
+		dStatus.Add ( tMeta.m_sNextSearchAfter );
+
 	if ( dStatus.MatchAdd ( "time" ) )
 		dStatus.Add().SetSprintf ( "%d.%03d", tMeta.m_iQueryTime/1000, tMeta.m_iQueryTime%1000 );
 
@@ -11901,6 +12160,112 @@ void HandleCommandPing ( ISphOutputBuffer & tOut, int iVer, InputBuffer_c & tReq
 
 static bool LoopClientSphinx ( int iCommand, int iCommandVer, int iLength, const char * sClientIP, int64_t iCID, ThdDesc_t * pThd, InputBuffer_c & tBuf, ISphOutputBuffer & tOut, bool bManagePersist );
 
+// reply to multiplexed request: tag followed by regular reply
+static bool SendTaggedReply ( int iSock, DWORD uTag, ISphOutputBuffer & tReply )
+{
+	// every request must be answered, otherwise master waits for the tag forever
+	if ( !tReply.GetSentCount() )
+	{
+		tReply.SendWord ( SEARCHD_OK );
+		tReply.SendWord ( 0 );
+		tReply.SendInt ( 0 );
+	}
+
+	CSphVector<BYTE> dReply;
+	tReply.SwapData ( dReply );
+
+	NetOutputBuffer_c tOut ( iSock );
+	tOut.SendDword ( uTag );
+	tOut.SendBytes ( dReply.Begin(), dReply.GetLength() );
+	tOut.Flush();
+	return !tOut.GetError();
+}
+
+static void SendMuxConfirmation ( ISphOutputBuffer & tOut )
+{
+	tOut.SendWord ( SEARCHD_OK );
+	tOut.SendWord ( VER_COMMAND_MUX );
+	tOut.SendInt ( 4 ); // resplen, 1 dword
+	tOut.SendInt ( 1 ); // multiplexing is on
+}
+
+// multiplexed connection in threads mode; requests are handled one by one in order of arrival
+static void HandleClientMux ( int iSock, const char * sClientIP, ThdDesc_t * pThd, NetOutputBuffer_c & tOut, bool & bPersist )
+{
+	int64_t iCID = pThd->m_iConnID;
+	StatCountCommand ( SEARCHD_COMMAND_MUX );
+
+	// multiplexed connection occupies a worker just as persistent one does
+	if ( !bPersist )
+	{
+		bPersist = ( g_iMaxChildren && 1+g_iPersistentInUse.GetValue()<g_iMaxChildren );
+		if ( !bPersist )
+		{
+			SendErrorReply ( tOut, "multiplexing is not available (too many persistent connections)" );
+			tOut.Flush();
+			return;
+		}
+		g_iPersistentInUse.Inc();
+	}
+
+	SendMuxConfirmation ( tOut );
+	tOut.Flush();
+	if ( tOut.GetError() )
+		return;
+	sphLogDebugv ( "conn %s(" INT64_FMT "): multiplexing is on", sClientIP, iCID );
+
+	int iPconnIdle = 0;
+	for ( ;; )
+	{
+		NetInputBuffer_c tBuf ( iSock );
+
+		THD_STATE ( THD_NET_IDLE );
+		bool bCommand = tBuf.ReadFrom ( 12, 1, true );
+		if ( !bCommand && g_bGotSigterm )
+		{
+			sphLogDebugv ( "conn %s(" INT64_FMT "): bailing on SIGTERM", sClientIP, iCID );
+			break;
+		}
+
+		if ( !bCommand && sphSockPeekErrno()==ETIMEDOUT )
+		{
+			++iPconnIdle;
+			if ( g_bGotSighup || iPconnIdle>=g_iClientTimeout )
+			{
+				sphLogDebugv ( "conn %s(" INT64_FMT "): bailing idle multiplexed conn", sClientIP, iCID );
+				break;
+			}
+			continue;
+		}
+
+		if ( !bCommand && tBuf.IsIntr() )
+			continue;
+		iPconnIdle = 0;
+
+		THD_STATE ( THD_NET_READ );
+		DWORD uTag = tBuf.GetDword ();
+		int iCommand = tBuf.GetWord ();
+		int iCommandVer = tBuf.GetWord ();
+		int iLength = tBuf.GetInt ();
+		if ( tBuf.GetError() || iCommand<0 || iCommand>=SEARCHD_COMMAND_TOTAL || iLength<0 || iLength>g_iMaxPacketSize )
+		{
+			sphLogDebugv ( "conn %s(" INT64_FMT "): bailing on failed multiplexed request header (command=%d, len=%d)", sClientIP, iCID, iCommand, iLength );
+			break;
+		}
+
+		if ( iLength && !tBuf.ReadFrom ( iLength ) )
+		{
+			sphWarning ( "failed to receive client request body (client=%s(" INT64_FMT "), exp=%d, error='%s')", sClientIP, iCID, iLength, sphSockError() );
+			break;
+		}
+
+		ISphOutputBuffer tReply;
+		LoopClientSphinx ( iCommand, iCommandVer, iLength, sClientIP, iCID, pThd, tBuf, tReply, false );
+		if ( !SendTaggedReply ( iSock, uTag, tReply ) )
+			break;
+	}
+}
+
 static void HandleClientSphinx ( int iSock, const char * sClientIP, ThdDesc_t * pThd )
 {
 	MEMORY ( MEM_API_HANDLE );
@@ -12023,6 +12388,12 @@ static void HandleClientSphinx ( int iSock, const char * sClientIP, ThdDesc_t *
 			break;
 		}
 
+		if ( iCommand==SEARCHD_COMMAND_MUX )
+		{
+			HandleClientMux ( iSock, sClientIP, pThd, tOut, bPersist );
+			break;
+		}
+
 		bPersist |= LoopClientSphinx ( iCommand, iCommandVer, iLength, sClientIP, iCID, pThd, tBuf, tOut, true );
 	} while ( bPersist );
 
@@ -12086,6 +12457,7 @@ bool LoopClientSphinx ( int iCommand, int iCommandVer, int iLength, const char *
 		case SEARCHD_COMMAND_SPHINXQL:	HandleCommandSphinxql ( tOut, iCommandVer, tBuf, pThd ); break;
 		case SEARCHD_COMMAND_PING:		HandleCommandPing ( tOut, iCommandVer, tBuf ); break;
 		case SEARCHD_COMMAND_UVAR:		HandleCommandUserVar ( tOut, iCommandVer, tBuf ); break;
+		case SEARCHD_COMMAND_MUX:		SendErrorReply ( tOut, "connection is already multiplexed" ); break;
 		default:						assert ( 0 && "INTERNAL ERROR: unhandled command" ); break;
 	}
 
@@ -12598,6 +12970,9 @@ void HandleMysqlInsert ( SqlRowBuffer_c & tOut, const SqlStmt_t & tStmt,
 	int iSchemaSz = tSchema.GetAttrsCount() + tSchema.m_dFields.GetLength() + 1;
 	if ( pIndex->GetSettings().m_bIndexFieldLens )
 		iSchemaSz -= tSchema.m_dFields.GetLength();
+	for ( int i=0; i<tSchema.GetAttrsCount(); i++ )
+		if ( sphJsonNameSplit ( tSchema.GetAttr(i).m_sName.cstr(), NULL, NULL ) )
+			iSchemaSz--; // typed columns extracted from JSON are filled by the index itself
 	int iExp = tStmt.m_iSchemaSz;
 	int iGot = tStmt.m_dInsertValues.GetLength();
 	if ( !tStmt.m_dInsertSchema.GetLength() && ( iSchemaSz!=tStmt.m_iSchemaSz ) )
@@ -12632,9 +13007,9 @@ void HandleMysqlInsert ( SqlRowBuffer_c & tOut, const SqlStmt_t & tStmt,
 		// no columns list, use index schema
 		ARRAY_FOREACH ( i, dFieldSchema )
 			dFieldSchema[i] = i+1;
-		int iFields = dFieldSchema.GetLength();
+		int iCol = dFieldSchema.GetLength()+1;
 		ARRAY_FOREACH ( j, dAttrSchema )
-			dAttrSchema[j] = j+iFields+1;
+			dAttrSchema[j] = sphJsonNameSplit ( tSchema.GetAttr(j).m_sName.cstr(), NULL, NULL ) ? -1 : iCol++;
 	} else
 	{
 		// got a list of columns, check for 1) existance, 2) dupes
@@ -13268,7 +13643,10 @@ void HandleMysqlCallSuggest ( SqlRowBuffer_c & tOut, SqlStmt_t & tStmt, bool bQu
 		return;
 	}
 
-	if ( !pServed->m_pIndex->GetSettings().m_iMinInfixLen || !pServed->m_pIndex->GetDictionary()->GetSettings().m_bWordDict )
+	// plain index with keywords FST does not need infixes
+	const CSphIndexSettings & tIndexSettings = pServed->m_pIndex->GetSettings();
+	bool bCanSuggest = ( tIndexSettings.m_iMinInfixLen>0 || ( tIndexSettings.m_bDictFst && !pServed->m_pIndex->IsRT() ) );
+	if ( !bCanSuggest || !pServed->m_pIndex->GetDictionary()->GetSettings().m_bWordDict )
 	{
 		sError.SetSprintf ( "suggests work only for keywords dictionary with infix enabled" );
 		tOut.Error ( tStmt.m_sStmt, sError.cstr() );
@@ -13653,7 +14031,7 @@ struct PingRequestBuilder_t : public IRequestBuilder_t
 	explicit PingRequestBuilder_t ( int iCookie = 0 )
 		: m_iCookie ( iCookie )
 	{}
-	virtual void BuildRequest ( AgentConn_t &, NetOutputBuffer_c & tOut ) const
+	virtual void BuildRequest ( AgentConn_t &, ISphOutputBuffer & tOut ) const
 	{
 		// header
 		tOut.SendWord ( SEARCHD_COMMAND_PING );
@@ -13775,7 +14153,7 @@ struct UVarRequestBuilder_t : public IRequestBuilder_t
 		, m_iLength ( iLength )
 	{}
 
-	virtual void BuildRequest ( AgentConn_t &, NetOutputBuffer_c & tOut ) const
+	virtual void BuildRequest ( AgentConn_t &, ISphOutputBuffer & tOut ) const
 	{
 		// header
 		tOut.SendWord ( SEARCHD_COMMAND_UVAR );
@@ -13942,7 +14320,7 @@ struct SphinxqlRequestBuilder_t : public IRequestBuilder_t
 		, m_sEnd ( sQuery.cstr() + tStmt.m_iListEnd, sQuery.Length() - tStmt.m_iListEnd )
 	{
 	}
-	virtual void BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const;
+	virtual void BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const;
 
 protected:
 	const CSphString m_sBegin;
@@ -13990,7 +14368,7 @@ protected:
 };
 
 
-void SphinxqlRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const
+void SphinxqlRequestBuilder_t::BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const
 {
 	const char* sIndexes = tAgent.m_sIndexes.cstr();
 	int iReqSize = strlen(sIndexes) + m_sBegin.Length() + m_sEnd.Length(); // indexes string
@@ -15157,6 +15535,9 @@ void HandleMysqlSet ( SqlRowBuffer_c & tOut, SqlStmt_t & tStmt, SessionVars_t &
 		{
 			const QcacheStatus_t & s = QcacheGetStatus();
 			QcacheSetup ( s.m_iMaxBytes, s.m_iThreshMsec, (int)tStmt.m_iSetValue );
+		} else if ( tStmt.m_sSetName=="expansion_cache_max_bytes" )
+		{
+			PcacheSetup ( tStmt.m_iSetValue );
 		} else if ( tStmt.m_sSetName=="log_debug_filter" )
 		{
 			int iLen = tStmt.m_sSetValue.Length();
@@ -15762,6 +16143,11 @@ void DumpIndexSettings ( CSphStringBuilder & tBuf, CSphIndex * pIndex )
 	DumpKey ( tBuf, "bigram_freq_words",	tSettings.m_sBigramWords.cstr(),		!tSettings.m_sBigramWords.IsEmpty() );
 	DumpKey ( tBuf, "rlp_context",			tSettings.m_sRLPContext.cstr(),			!tSettings.m_sRLPContext.IsEmpty() );
 	DumpKey ( tBuf, "index_token_filter",	tSettings.m_sIndexTokenFilter.cstr(),	!tSettings.m_sIndexTokenFilter.IsEmpty() );
+	DumpKey ( tBuf, "dict_fst",				1,										tSettings.m_bDictFst );
+	DumpKey ( tBuf, "infix_trigrams",		1,										tSettings.m_bInfixTrigrams );
+	if ( !tSettings.m_sGeoLat.IsEmpty() )
+		tBuf.Appendf ( "geo_grid = %s, %s\n", tSettings.m_sGeoLat.cstr(), tSettings.m_sGeoLon.cstr() );
+	DumpKey ( tBuf, "sort_by",				tSettings.m_sSortByAttr.cstr(),			!tSettings.m_sSortByAttr.IsEmpty() );
 	CSphFieldFilterSettings tFieldFilter;
 	pIndex->GetFieldFilterSettings ( tFieldFilter );
 	ARRAY_FOREACH ( i, tFieldFilter.m_dRegexps )
@@ -17492,6 +17878,26 @@ static void PrereadFunc ( void * )
 }
 
 
+/// keeps index unavailable while its binlog replays in background; preread and serve it once done
+static void BinlogReplayedFunc ( const char * sIndex, bool bReplayed )
+{
+	ServedIndex_c * pServed = g_pLocalIndexes->GetWlockedEntry ( sIndex );
+	if ( !pServed )
+		return;
+
+	if ( bReplayed && !g_bShutdown )
+	{
+		pServed->m_pIndex->Preread();
+		if ( !pServed->m_pIndex->GetLastWarning().IsEmpty() )
+			sphWarning ( "'%s' preread: %s", sIndex, pServed->m_pIndex->GetLastWarning().cstr() );
+		sphInfo ( "index '%s': binlog replayed, serving", sIndex );
+	}
+
+	pServed->m_bEnabled = bReplayed;
+	pServed->Unlock();
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 // SPHINXQL STATE
 //////////////////////////////////////////////////////////////////////////
@@ -17835,10 +18241,23 @@ static void ConfigureDistributedIndex ( DistributedIndex_t & tIdx, const char *
 			sphWarning ( "index '%s': ha_strategy (%s) is unknown for me, will use random", szIndexName, hIndex["ha_strategy"].cstr() );
 	}
 
-	bool bEnablePersistentConns = ( g_iPersistentPoolSize>0 );
+	// configure ha_hedge_delay
+	int iHedgeDelay = 0;
+	if ( hIndex("ha_hedge_delay") )
+	{
+		const CSphString & sHedge = hIndex["ha_hedge_delay"].strval();
+		if ( sHedge=="auto" )
+			iHedgeDelay = HEDGE_DELAY_AUTO;
+		else if ( hIndex["ha_hedge_delay"].intval()>=0 )
+			iHedgeDelay = hIndex["ha_hedge_delay"].intval();
+		else
+			sphWarning ( "index '%s': ha_hedge_delay must be non-negative or 'auto', ignored", szIndexName );
+	}
+
+	bool bEnablePersistentConns = ( g_iPersistentPoolSize>0 || g_bAgentMultiplex );
 	if ( hIndex ( "agent_persistent" ) && !bEnablePersistentConns )
 	{
-			sphWarning ( "index '%s': agent_persistent used, but no persistent_connections_limit defined. Fall back to non-persistent agent", szIndexName );
+			sphWarning ( "index '%s': agent_persistent used, but neither persistent_connections_limit nor agent_multiplex defined. Fall back to non-persistent agent", szIndexName );
 			bEnablePersistentConns = false;
 	}
 
@@ -17873,7 +18292,7 @@ static void ConfigureDistributedIndex ( DistributedIndex_t & tIdx, const char *
 			tIdx.m_dKillBreak.BitSet ( dKillBreak[i] );
 	}
 
-	AgentOptions_t tAgentOptions { false, false, tIdx.m_eHaStrategy };
+	AgentOptions_t tAgentOptions { false, false, tIdx.m_eHaStrategy, iHedgeDelay };
 	// add remote agents
 	for ( CSphVariant * pAgent = hIndex("agent"); pAgent; pAgent = pAgent->m_pNext )
 	{
@@ -18240,16 +18659,21 @@ bool CheckConfigChanges ()
 
 void InitPersistentPool()
 {
-	if ( g_iPersistentPoolSize )
+	if ( g_iPersistentPoolSize || g_bAgentMultiplex )
 	{
 		g_tDashes.Lock();
 		CSphVector<HostDashboard_t *> tHosts;
 		g_tDashes.GetActiveDashes (tHosts);
 		for ( auto& pHost : tHosts )
 		{
-			if ( !pHost->m_pPersPool )
-				pHost->m_pPersPool = new PersistentConnectionsPool_t;
-			pHost->m_pPersPool->Init ( g_iPersistentPoolSize );
+			if ( g_iPersistentPoolSize )
+			{
+				if ( !pHost->m_pPersPool )
+					pHost->m_pPersPool = new PersistentConnectionsPool_t;
+				pHost->m_pPersPool->Init ( g_iPersistentPoolSize );
+			}
+			if ( g_bAgentMultiplex && !pHost->m_pMux )
+				pHost->m_pMux = new AgentMux_c;
 		}
 		g_tDashes.Unlock();
 	}
@@ -19573,6 +19997,31 @@ struct ISphNetAction : ISphNoncopyable, public ListNode_t
 	virtual void			CloseSocket () = 0;
 };
 
+/// client socket switched to multiplexed mode; shared by the receiving action and in-flight jobs
+struct NetMuxConn_t : public ISphRefcountedMT
+{
+	explicit NetMuxConn_t ( int iSock )
+		: m_iSock ( iSock )
+	{}
+
+	bool SendReply ( DWORD uTag, ISphOutputBuffer & tReply )
+	{
+		CSphScopedLock<CSphMutex> tLock ( m_tLock );
+		return SendTaggedReply ( m_iSock, uTag, tReply );
+	}
+
+protected:
+	~NetMuxConn_t () override
+	{
+		sphLogDebugv ( "%p mux closing sock=%d", this, m_iSock );
+		sphSockClose ( m_iSock );
+	}
+
+private:
+	int					m_iSock;
+	CSphMutex			m_tLock;	///< replies of concurrent jobs must not interleave
+};
+
 struct NetStateCommon_t
 {
 	int					m_iClientSock;
@@ -19580,6 +20029,7 @@ struct NetStateCommon_t
 	char				m_sClientName[SPH_ADDRPORT_SIZE];
 	bool				m_bKeepSocket;
 	bool				m_bVIP;
+	NetMuxConn_t *		m_pMux;		///< set when connection is multiplexed; owns the socket then
 
 	CSphVector<BYTE>	m_dBuf;
 	int					m_iLeft;
@@ -19635,6 +20085,7 @@ struct NetReceiveDataAPI_t : public ISphNetAction
 
 	int					m_iCommand;
 	int					m_iCommandVer;
+	DWORD				m_uTag;
 
 	explicit NetReceiveDataAPI_t ( NetStateAPI_t * pState );
 	virtual ~NetReceiveDataAPI_t() {}
@@ -19645,6 +20096,8 @@ struct NetReceiveDataAPI_t : public ISphNetAction
 
 	void				SetupBodyPhase();
 	void				AddJobAPI ( CSphNetLoop * pLoop );
+	NetEvent_e			SetupMux ( CSphVector<ISphNetAction *> & dNextTick );
+	void				AddJobMux ( CSphNetLoop * pLoop );
 };
 
 enum ActionQL_e
@@ -20074,11 +20527,16 @@ struct LoopProfiler_t
 
 	bool					m_bEnable;
 	int64_t					m_tmTotal;
+	int64_t					m_tmPoll;
 	int m_iPerfEv, m_iPerfNext, m_iPerfExt, m_iPerfClean;
+	NetLoopStats_t *		m_pStats;
 
-	LoopProfiler_t ()
+	explicit LoopProfiler_t ( NetLoopStats_t * pStats )
 	{
 		m_bEnable = g_bVtune;
+		m_tmTotal = m_tmPoll = 0;
+		m_iPerfEv = m_iPerfNext = m_iPerfExt = m_iPerfClean = 0;
+		m_pStats = pStats;
 #ifdef USE_VTUNE
 		__itt_thread_set_name ( "net-loop" );
 		m_pDomain = __itt_domain_create ( "Task Domain" );
@@ -20102,6 +20560,14 @@ struct LoopProfiler_t
 	void End ()
 	{
 		EndTask();
+		if ( m_pStats )
+		{
+			int64_t tmTick = sphMicroTimer() - m_tmTotal;
+			m_pStats->m_iTicks++;
+			m_pStats->m_iEvents += m_iPerfEv;
+			m_pStats->m_tmPoll += m_tmPoll;
+			m_pStats->m_tmWork += Max ( tmTick - m_tmPoll, 0 );
+		}
 #ifdef USE_VTUNE
 		if ( m_bEnable )
 		{
@@ -20122,22 +20588,32 @@ struct LoopProfiler_t
 	}
 	void Start ()
 	{
+		m_tmTotal = sphMicroTimer();
+		m_tmPoll = 0;
+		m_iPerfEv = m_iPerfNext = m_iPerfExt = m_iPerfClean = 0;
 #ifdef USE_VTUNE
 		if ( m_bEnable )
-		{
 			__itt_task_begin ( m_pDomain, __itt_null, __itt_null, m_pTaskTick );
-			m_tmTotal = sphMicroTimer();
-			m_iPerfEv = m_iPerfNext = m_iPerfExt = m_iPerfClean = 0;
-		}
 #endif
 	}
 	void StartPoll ()
 	{
+		m_tmPoll = sphMicroTimer();
 #ifdef USE_VTUNE
 		if ( m_bEnable )
 			__itt_task_begin ( m_pDomain, __itt_null, __itt_null, m_pTaskPoll );
 #endif
 	}
+	void EndPoll ()
+	{
+		m_tmPoll = sphMicroTimer() - m_tmPoll;
+		EndTask();
+	}
+	void AddConnections ( int iConnections )
+	{
+		if ( m_pStats )
+			m_pStats->m_iConnections += iConnections;
+	}
 	void StartTick ()
 	{
 #ifdef USE_VTUNE
@@ -20224,8 +20700,12 @@ private:
 	LoopProfiler_t					m_tPrf;
 	NetActionsPoller				m_tPoller;
 
-	explicit CSphNetLoop ( CSphVector<Listener_t> & dListeners )
+	CSphNetLoop ( CSphVector<Listener_t> & dListeners, NetLoopStats_t * pStats )
+		: m_tPrf ( pStats )
 	{
+		if ( pStats )
+			pStats->m_iListeners = dListeners.GetLength();
+
 		int64_t tmNow = sphMicroTimer();
 		ARRAY_FOREACH ( i, dListeners )
 		{
@@ -20288,7 +20768,7 @@ private:
 			m_tPrf.StartPoll();
 			// need positive timeout for communicate threads back and shutdown
 			bool bGot = m_tPoller.Wait ( iSpinWait );
-			m_tPrf.EndTask();
+			m_tPrf.EndPoll();
 
 			m_uTick++;
 
@@ -20376,6 +20856,7 @@ private:
 			{
 				m_tPrf.StartStat();
 				g_tStats.m_iConnections += iConnections;
+				m_tPrf.AddConnections ( iConnections );
 				m_tPrf.EndTask();
 			}
 
@@ -20452,12 +20933,14 @@ public:
 	}
 
 	// main thread wrapper
-	static void ThdTick ( void * )
+	static void ThdTick ( void * pArg )
 	{
 		SphCrashLogger_c tQueryTLS;
 		tQueryTLS.SetupTLS ();
 
-		CSphNetLoop tLoop ( g_dListeners );
+		int iLoop = (int)(intptr_t)pArg;
+		assert ( iLoop>=0 && iLoop<g_dNetLoopListeners.GetLength() );
+		CSphNetLoop tLoop ( g_dNetLoopListeners[iLoop], g_dNetLoopStats.Begin()+iLoop );
 		tLoop.Tick();
 	}
 };
@@ -20475,6 +20958,23 @@ struct ThdJobAPI_t : public ISphJob
 	virtual void		Call ();
 };
 
+struct ThdJobMuxAPI_t : public ISphJob
+{
+	NetMuxConn_t *		m_pMux;
+	CSphVector<BYTE>	m_dBuf;
+	DWORD				m_uTag;
+	int					m_iCommand;
+	int					m_iCommandVer;
+	int					m_iConnID;
+	int					m_iClientSock;
+	CSphString			m_sClientName;
+
+	ThdJobMuxAPI_t ( NetStateAPI_t * pState, DWORD uTag, int iCommand, int iCommandVer );
+	virtual ~ThdJobMuxAPI_t ();
+
+	virtual void		Call ();
+};
+
 struct ThdJobQL_t : public ISphJob
 {
 	CSphScopedPtr<NetStateQL_t>		m_tState;
@@ -20736,6 +21236,7 @@ NetReceiveDataAPI_t::NetReceiveDataAPI_t ( NetStateAPI_t *	pState )
 	m_tState->m_iPos = 0;
 	m_iCommand = 0;
 	m_iCommandVer = 0;
+	m_uTag = 0;
 
 	m_tState->m_dBuf.Resize ( 4 );
 	*(DWORD *)( m_tState->m_dBuf.Begin() ) = htonl ( SPHINX_SEARCHD_PROTO );
@@ -20762,7 +21263,8 @@ NetEvent_e NetReceiveDataAPI_t::Setup ( int64_t tmNow )
 
 void NetReceiveDataAPI_t::SetupBodyPhase()
 {
-	m_tState->m_dBuf.Resize ( 8 );
+	// multiplexed request header starts with the tag
+	m_tState->m_dBuf.Resize ( m_tState->m_pMux ? 12 : 8 );
 	m_tState->m_iLeft = m_tState->m_dBuf.GetLength();
 	m_ePhase = AAPI_COMMAND;
 }
@@ -20783,8 +21285,53 @@ void NetReceiveDataAPI_t::AddJobAPI ( CSphNetLoop * pLoop )
 		g_pThdPool->AddJob ( pJob );
 }
 
+// switch the connection to tagged requests and confirm that to the client
+NetEvent_e NetReceiveDataAPI_t::SetupMux ( CSphVector<ISphNetAction *> & dNextTick )
+{
+	assert ( !m_tState->m_pMux );
+	StatCountCommand ( SEARCHD_COMMAND_MUX );
+	sphLogDebugv ( "%p multiplexing is on, client=%s, conn=%d, sock=%d", this, m_tState->m_sClientName, m_tState->m_iConnID, m_iSock );
+
+	m_tState->m_bKeepSocket = true;
+	m_tState->m_pMux = new NetMuxConn_t ( m_tState->m_iClientSock );
+
+	m_tState->m_dBuf.Resize ( 0 );
+	ISphOutputBuffer tOut ( m_tState->m_dBuf );
+	SendMuxConfirmation ( tOut );
+	tOut.SwapData ( m_tState->m_dBuf );
+	NetSendData_t * pSend = new NetSendData_t ( m_tState.LeakPtr(), PROTO_SPHINX );
+	dNextTick.Add ( pSend );
+	return NE_REMOVE;
+}
+
 static char g_sMaxedOutMessage[] = "maxed out, dismissing client";
 
+// hand multiplexed request over to a job and keep reading the next ones
+void NetReceiveDataAPI_t::AddJobMux ( CSphNetLoop * pLoop )
+{
+	assert ( m_tState->m_pMux );
+	m_tmTimeout = sphMicroTimer() + MS2SEC * g_iClientTimeout;
+
+	if ( g_iThdQueueMax && !m_tState->m_bVIP && g_pThdPool->GetQueueLength()>=g_iThdQueueMax )
+	{
+		sphWarning ( "%s", g_sMaxedOutMessage );
+		ISphOutputBuffer tOut;
+		tOut.SendWord ( (WORD)SEARCHD_RETRY );
+		tOut.SendWord ( 0 ); // version doesn't matter
+		tOut.SendInt ( 4 + strlen(g_sMaxedOutMessage) );
+		tOut.SendString ( g_sMaxedOutMessage );
+		m_tState->m_pMux->SendReply ( m_uTag, tOut );
+		return;
+	}
+
+	ThdJobMuxAPI_t * pJob = new ThdJobMuxAPI_t ( m_tState.Ptr(), m_uTag, m_iCommand, m_iCommandVer );
+	sphLogDebugv ( "%p receive mux job created (%p), tag=%u, buf=%d, sock=%d, tick=%u", this, pJob, m_uTag, pJob->m_dBuf.GetLength(), m_iSock, pLoop->m_uTick );
+	if ( m_tState->m_bVIP )
+		g_pThdPool->StartJob ( pJob );
+	else
+		g_pThdPool->AddJob ( pJob );
+}
+
 NetEvent_e NetReceiveDataAPI_t::Tick ( DWORD uGotEvents, CSphVector<ISphNetAction *> & dNextTick, CSphNetLoop * pLoop )
 {
 	assert ( m_tState.Ptr() );
@@ -20839,12 +21386,27 @@ NetEvent_e NetReceiveDataAPI_t::Tick ( DWORD uGotEvents, CSphVector<ISphNetActio
 
 		case AAPI_COMMAND:
 		{
-			m_iCommand = NetBufGetWord ( m_tState->m_dBuf.Begin() );
-			m_iCommandVer = NetBufGetWord ( m_tState->m_dBuf.Begin() + 2 );
-			m_tState->m_iLeft = NetBufGetInt ( m_tState->m_dBuf.Begin() + 4 );
+			const BYTE * pHeader = m_tState->m_dBuf.Begin();
+			bool bMux = ( m_tState->m_pMux!=nullptr );
+			if ( bMux )
+			{
+				m_uTag = NetBufGetInt ( pHeader );
+				pHeader += 4;
+			}
+			m_iCommand = NetBufGetWord ( pHeader );
+			m_iCommandVer = NetBufGetWord ( pHeader + 2 );
+			m_tState->m_iLeft = NetBufGetInt ( pHeader + 4 );
 			bool bBadCommand = ( m_iCommand<0 || m_iCommand>=SEARCHD_COMMAND_TOTAL );
 			bool bBadLength = ( m_tState->m_iLeft<0 || m_tState->m_iLeft>g_iMaxPacketSize );
-			bool bMaxedOut = ( g_iThdQueueMax && !m_tState->m_bVIP && g_pThdPool->GetQueueLength()>=g_iThdQueueMax );
+			// multiplexed request is checked for overload once it is fully read
+			bool bMaxedOut = ( !bMux && g_iThdQueueMax && !m_tState->m_bVIP && g_pThdPool->GetQueueLength()>=g_iThdQueueMax );
+			if ( bMux && ( bBadCommand || bBadLength ) )
+			{
+				// stream of tagged requests is broken, nobody to reply to
+				sphWarning ( "ill-formed multiplexed request (command=%d, length=%d), closing connection", m_iCommand, m_tState->m_iLeft );
+				return NE_REMOVE;
+			}
+
 			if ( bBadCommand || bBadLength || bMaxedOut )
 			{
 				m_tState->m_bKeepSocket = false;
@@ -20884,6 +21446,14 @@ NetEvent_e NetReceiveDataAPI_t::Tick ( DWORD uGotEvents, CSphVector<ISphNetActio
 			m_ePhase = AAPI_BODY;
 			if ( !m_tState->m_iLeft ) // command without body
 			{
+				if ( bMux )
+				{
+					AddJobMux ( pLoop );
+					SetupBodyPhase();
+					break;
+				}
+				if ( m_iCommand==SEARCHD_COMMAND_MUX )
+					return SetupMux ( dNextTick );
 				AddJobAPI ( pLoop );
 				return NE_REMOVED;
 			}
@@ -20892,6 +21462,16 @@ NetEvent_e NetReceiveDataAPI_t::Tick ( DWORD uGotEvents, CSphVector<ISphNetActio
 
 		case AAPI_BODY:
 		{
+			if ( m_tState->m_pMux )
+			{
+				AddJobMux ( pLoop );
+				SetupBodyPhase();
+				break;
+			}
+
+			if ( m_iCommand==SEARCHD_COMMAND_MUX )
+				return SetupMux ( dNextTick );
+
 			if ( m_iCommand==SEARCHD_COMMAND_PING )
 			{
 				bool bGotError = false;
@@ -21322,6 +21902,7 @@ NetStateCommon_t::NetStateCommon_t ()
 	, m_iConnID ( 0 )
 	, m_bKeepSocket ( false )
 	, m_bVIP ( false )
+	, m_pMux ( nullptr )
 	, m_iLeft ( 0 )
 	, m_iPos ( 0 )
 {
@@ -21335,6 +21916,15 @@ NetStateCommon_t::~NetStateCommon_t()
 
 void NetStateCommon_t::CloseSocket ()
 {
+	if ( m_pMux )
+	{
+		// in-flight jobs still reply to that socket; the last one closes it
+		sphLogDebugv ( "%p state releasing mux sock=%d", this, m_iClientSock );
+		SafeRelease ( m_pMux );
+		m_iClientSock = -1;
+		return;
+	}
+
 	if ( m_iClientSock>=0 )
 	{
 		sphLogDebugv ( "%p state closing sock=%d", this, m_iClientSock );
@@ -21552,6 +22142,60 @@ void ThdJobAPI_t::Call ()
 }
 
 
+ThdJobMuxAPI_t::ThdJobMuxAPI_t ( NetStateAPI_t * pState, DWORD uTag, int iCommand, int iCommandVer )
+	: m_pMux ( pState->m_pMux )
+	, m_uTag ( uTag )
+	, m_iCommand ( iCommand )
+	, m_iCommandVer ( iCommandVer )
+	, m_iConnID ( pState->m_iConnID )
+	, m_iClientSock ( pState->m_iClientSock )
+	, m_sClientName ( pState->m_sClientName )
+{
+	assert ( m_pMux );
+	m_pMux->AddRef();
+	m_dBuf.SwapData ( pState->m_dBuf );
+}
+
+ThdJobMuxAPI_t::~ThdJobMuxAPI_t ()
+{
+	SafeRelease ( m_pMux );
+}
+
+void ThdJobMuxAPI_t::Call ()
+{
+	SphCrashLogger_c tQueryTLS;
+	tQueryTLS.SetupTLS ();
+
+	sphLogDebugv ( "%p mux API job started, command=%d, tag=%u", this, m_iCommand, m_uTag );
+
+	ThdDesc_t tThdDesc;
+	tThdDesc.m_eProto = PROTO_SPHINX;
+	tThdDesc.m_iClientSock = m_iClientSock;
+	tThdDesc.m_sClientName = m_sClientName;
+	tThdDesc.m_iConnID = m_iConnID;
+	tThdDesc.m_tmConnect = sphMicroTimer();
+	tThdDesc.m_iTid = GetOsThreadId();
+
+	g_tThdMutex.Lock ();
+	g_dThd.Add ( &tThdDesc );
+	g_tThdMutex.Unlock ();
+
+	MemInputBuffer_c tBuf ( m_dBuf.Begin(), m_dBuf.GetLength() );
+	ISphOutputBuffer tOut;
+	LoopClientSphinx ( m_iCommand, m_iCommandVer, m_dBuf.GetLength(), m_sClientName.cstr(), m_iConnID, &tThdDesc, tBuf, tOut, false );
+
+	g_tThdMutex.Lock ();
+	g_dThd.Remove ( &tThdDesc );
+	g_tThdMutex.Unlock ();
+
+	sphLogDebugv ( "%p mux API job done, command=%d, tag=%u", this, m_iCommand, m_uTag );
+
+	if ( g_bShutdown )
+		return;
+
+	m_pMux->SendReply ( m_uTag, tOut );
+}
+
 ThdJobQL_t::ThdJobQL_t ( CSphNetLoop * pLoop, NetStateQL_t * pState )
 	: m_tState ( pState )
 	, m_pLoop ( pLoop )
@@ -21808,6 +22452,15 @@ void ConfigureSearchd ( const CSphConfig & hConf, bool bOptPIDFile )
 
 	if ( hSearchd.Exists ( "persistent_connections_limit" ) && hSearchd["persistent_connections_limit"].intval()>=0 )
 		g_iPersistentPoolSize = hSearchd["persistent_connections_limit"].intval();
+	g_bAgentMultiplex = ( hSearchd.GetInt ( "agent_multiplex", 0 )!=0 );
+	g_bAgentCompression = ( hSearchd.GetInt ( "agent_compression", 0 )!=0 );
+#if !USE_ZLIB
+	if ( g_bAgentCompression )
+	{
+		sphWarning ( "agent_compression requires zlib support, ignored" );
+		g_bAgentCompression = false;
+	}
+#endif
 
 	g_bPreopenIndexes = hSearchd.GetInt ( "preopen_indexes", (int)g_bPreopenIndexes )!=0;
 	sphSetUnlinkOld ( hSearchd.GetInt ( "unlink_old", 1 )!=0 );
@@ -21851,6 +22504,14 @@ void ConfigureSearchd ( const CSphConfig & hConf, bool bOptPIDFile )
 	g_iThrottleAccept = hSearchd.GetInt ( "net_throttle_accept", g_iThrottleAccept );
 	g_iNetWorkers = hSearchd.GetInt ( "net_workers", g_iNetWorkers );
 	g_iNetWorkers = Max ( g_iNetWorkers, 1 );
+	g_bNetReusePort = ( hSearchd.GetInt ( "net_reuseport", 0 )!=0 );
+#ifndef SO_REUSEPORT
+	if ( g_bNetReusePort )
+	{
+		sphWarning ( "net_reuseport is not supported on this platform, all net loops will share listeners" );
+		g_bNetReusePort = false;
+	}
+#endif
 
 	if ( hSearchd ( "collation_libc_locale" ) )
 	{
@@ -21896,6 +22557,7 @@ void ConfigureSearchd ( const CSphConfig & hConf, bool bOptPIDFile )
 	s.m_iThreshMsec = hSearchd.GetInt ( "qcache_thresh_msec", s.m_iThreshMsec );
 	s.m_iTtlSec = hSearchd.GetInt ( "qcache_ttl_sec", s.m_iTtlSec );
 	QcacheSetup ( s.m_iMaxBytes, s.m_iThreshMsec, s.m_iTtlSec );
+	PcacheSetup ( hSearchd.GetSize64 ( "expansion_cache_max_bytes", PcacheGetStatus().m_iMaxBytes ) );
 
 	// hostname_lookup = {config_load | request}
 	g_bHostnameLookup = ( strcmp ( hSearchd.GetStr ( "hostname_lookup", "" ), "request" )==0 );
@@ -22583,7 +23245,9 @@ int WINAPI ServiceMain ( int argc, char **argv )
 
 	} else if ( bOptPort )
 	{
-		tListener.m_iSock = sphCreateInetSocket ( htonl ( INADDR_ANY ), iOptPort );
+		tListener.m_iSock = sphCreateInetSocket ( htonl ( INADDR_ANY ), iOptPort, g_bNetReusePort );
+		tListener.m_uIP = htonl ( INADDR_ANY );
+		tListener.m_iPort = iOptPort;
 		g_dListeners.Add ( tListener );
 
 	} else
@@ -22595,11 +23259,14 @@ int WINAPI ServiceMain ( int argc, char **argv )
 		// default is to listen on our two ports
 		if ( !g_dListeners.GetLength() )
 		{
-			tListener.m_iSock = sphCreateInetSocket ( htonl ( INADDR_ANY ), SPHINXAPI_PORT );
+			tListener.m_uIP = htonl ( INADDR_ANY );
+			tListener.m_iSock = sphCreateInetSocket ( tListener.m_uIP, SPHINXAPI_PORT, g_bNetReusePort );
+			tListener.m_iPort = SPHINXAPI_PORT;
 			tListener.m_eProto = PROTO_SPHINX;
 			g_dListeners.Add ( tListener );
 
-			tListener.m_iSock = sphCreateInetSocket ( htonl ( INADDR_ANY ), SPHINXQL_PORT );
+			tListener.m_iSock = sphCreateInetSocket ( tListener.m_uIP, SPHINXQL_PORT, g_bNetReusePort );
+			tListener.m_iPort = SPHINXQL_PORT;
 			tListener.m_eProto = PROTO_MYSQL41;
 			g_dListeners.Add ( tListener );
 		}
@@ -22776,12 +23443,15 @@ int WINAPI ServiceMain ( int argc, char **argv )
 		if ( it.Get().m_bEnabled )
 			hIndexes.Add ( it.Get().m_pIndex, it.GetKey() );
 
-	sphReplayBinlog ( hIndexes, uReplayFlags, DumpMemStat );
+	sphReplayBinlog ( hIndexes, uReplayFlags, DumpMemStat, BinlogReplayedFunc );
 	hIndexes.Reset();
 
 	if ( g_bIOStats && !sphInitIOStats () )
 		sphWarning ( "unable to init IO statistics" );
 
+	if ( !sphInitMatchArena () )
+		sphWarning ( "unable to init match arenas" );
+
 	g_tStats.m_uStarted = (DWORD)time(NULL);
 
 	// threads mode
@@ -22847,10 +23517,38 @@ int WINAPI ServiceMain ( int argc, char **argv )
 			}
 		}
 
+		// first loop serves shared listeners; with net_reuseport others get own tcp sockets bound to the same address
+		// so that kernel balances incoming connections between loops instead of waking all of them on each accept
+		g_dNetLoopListeners.Resize ( g_iNetWorkers );
+		g_dNetLoopStats.Resize ( g_iNetWorkers );
+		ARRAY_FOREACH ( i, g_dNetLoopListeners )
+		{
+			CSphVector<Listener_t> & dLoop = g_dNetLoopListeners[i];
+			dLoop = g_dListeners;
+			if ( !i || !g_bNetReusePort )
+				continue;
+
+			ARRAY_FOREACH ( j, dLoop )
+			{
+				if ( !dLoop[j].m_bTcp || g_dListeners[j].m_iSock<0 )
+					continue;
+
+				CSphString sError;
+				int iSock = CreateReusePortListener ( dLoop[j].m_uIP, dLoop[j].m_iPort, sError );
+				if ( iSock<0 )
+				{
+					sphWarning ( "net-loop %d failed to setup reuseport listener, using shared: %s", i, sError.cstr() );
+					continue;
+				}
+				dLoop[j].m_iSock = iSock;
+				g_dNetLoopStats[i].m_iOwnListeners++;
+			}
+		}
+
 		g_dTickPoolThread.Resize ( g_iNetWorkers );
 		ARRAY_FOREACH ( i, g_dTickPoolThread )
 		{
-			if ( !sphThreadCreate ( g_dTickPoolThread.Begin()+i, CSphNetLoop::ThdTick, 0 ) )
+			if ( !sphThreadCreate ( g_dTickPoolThread.Begin()+i, CSphNetLoop::ThdTick, (void*)(intptr_t)i ) )
 				sphDie ( "failed to create tick pool thread" );
 		}
 	}
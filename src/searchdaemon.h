@@ -125,6 +125,7 @@ enum SearchdCommand_e
 	SEARCHD_COMMAND_PING		= 9,
 	SEARCHD_COMMAND_DELETE		= 10,
 	SEARCHD_COMMAND_UVAR		= 11,
+	SEARCHD_COMMAND_MUX			= 12,	///< switch persistent connection to tagged (multiplexed) requests
 
 	SEARCHD_COMMAND_TOTAL
 };
@@ -133,7 +134,7 @@ enum SearchdCommand_e
 /// (shared here because of REPLICATE)
 enum
 {
-	VER_COMMAND_SEARCH		= 0x120, // 1.32
+	VER_COMMAND_SEARCH		= 0x121, // 1.33
 	VER_COMMAND_EXCERPT		= 0x104,
 	VER_COMMAND_UPDATE		= 0x103,
 	VER_COMMAND_KEYWORDS	= 0x100,
@@ -142,8 +143,13 @@ enum
 	VER_COMMAND_SPHINXQL	= 0x100,
 	VER_COMMAND_PING		= 0x100,
 	VER_COMMAND_UVAR		= 0x100,
+	VER_COMMAND_MUX			= 0x100,
 };
 
+/// set in the reply version word when the reply body is zlib-packed
+/// (agent only packs the reply when master asked for it with a query flag)
+const WORD VER_REPLY_PACKED = 0x8000;
+
 enum ESphAddIndex
 {
 	ADD_ERROR	= 0,
@@ -350,6 +356,8 @@ protected:
 
 bool IsPortInRange ( int iPort );
 int sphSockRead ( int iSock, void * buf, int iLen, int iReadTimeout, bool bIntr );
+int sphPoll ( int iSock, int64_t tmTimeout, bool bWrite=false );
+bool sphCreateSocketPair ( int & iSock1, int & iSock2, CSphString & sError );
 
 struct CrashQuery_t
 {
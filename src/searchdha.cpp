@@ -23,6 +23,14 @@
 
 #include <utility>
 
+#if HAVE_EVENTFD
+	#include <sys/eventfd.h>
+#endif
+
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
 
 int				g_iPingInterval		= 0;		// by default ping HA agents every 1 second
 DWORD			g_uHAPeriodKarma	= 60;		// by default use the last 1 minute statistic to determine the best HA agent
@@ -45,6 +53,7 @@ HostDashboard_t::HostDashboard_t ( const HostUrl_c * pAgent )
 	, m_bNeedPing ( false )
 	, m_iErrorsARow ( 0 )
 	, m_pPersPool (nullptr)
+	, m_pMux (nullptr)
 {
 	m_iRefCount = 1;
 	m_iLastQueryTime = m_iLastAnswerTime = sphMicroTimer () - g_iPingInterval*1000;
@@ -55,6 +64,7 @@ HostDashboard_t::~HostDashboard_t ()
 {
 	m_dDataLock.Done();
 	SafeDelete ( m_pPersPool );
+	SafeDelete ( m_pMux );
 }
 
 bool HostDashboard_t::IsOlder ( int64_t iTime ) const
@@ -123,6 +133,55 @@ void HostDashboard_t::GetCollectedStat ( HostStatSnapshot_t& dResult, int iPerio
 		dResult[i+eMaxAgentStat] = tAccum.m_dHostStats[i];
 }
 
+// estimate given percentile of the successful queries latency, in microseconds
+// returns 0 if there are too few queries in the collected periods to judge
+int64_t HostDashboard_t::GetLatencyPercentile ( int iPercent, int iPeriods ) const
+{
+	const DWORD MIN_SAMPLES = 20;
+	DWORD dLatency[LATENCY_BUCKETS] = { 0 };
+
+	DWORD uSeconds = GetCurSeconds();
+	if ( (uSeconds % g_uHAPeriodKarma) < (g_uHAPeriodKarma/2) )
+		++iPeriods;
+
+	iPeriods = Min ( iPeriods, STATS_DASH_TIME );
+
+	DWORD uTime = uSeconds/g_uHAPeriodKarma;
+	int iIdx = uTime % STATS_DASH_TIME;
+
+	{
+		CSphScopedRLock tRguard ( m_dDataLock );
+		for ( ; iPeriods>0 ; --iPeriods )
+		{
+			const AgentDash_t & dStats = m_dStats[iIdx];
+			if ( dStats.m_uTimestamp==uTime )
+				for ( int i=0; i<LATENCY_BUCKETS; ++i )
+					dLatency[i] += dStats.m_dLatency[i];
+			--uTime;
+			--iIdx;
+			if ( iIdx<0 )
+				iIdx = STATS_DASH_TIME-1;
+		}
+	}
+
+	uint64_t uTotal = 0;
+	for ( DWORD uCount : dLatency )
+		uTotal += uCount;
+	if ( uTotal<MIN_SAMPLES )
+		return 0;
+
+	// walk the buckets up to the one which covers the percentile
+	uint64_t uWant = ( uTotal*iPercent+99 )/100;
+	uint64_t uSeen = 0;
+	for ( int i=0; i<LATENCY_BUCKETS; ++i )
+	{
+		uSeen += dLatency[i];
+		if ( uSeen>=uWant )
+			return LatencyBucketTop ( i );
+	}
+	return LatencyBucketTop ( LATENCY_BUCKETS-1 );
+}
+
 PersistentConnectionsPool_t::PersistentConnectionsPool_t ()
 	: m_bShutdown (false)
 	, m_iRit (0)
@@ -225,16 +284,624 @@ void ClosePersistentSockets()
 	g_tDashes.GetActiveDashes ( dHosts );
 	for ( auto& pHost : dHosts )
 	{
-		if ( pHost->m_pPersPool )
-			pHost->m_pPersPool->Shutdown ();
+		if ( pHost->m_pPersPool )
+			pHost->m_pPersPool->Shutdown ();
+		if ( pHost->m_pMux )
+			pHost->m_pMux->Shutdown ();
+	}
+	g_tDashes.Unlock();
+
+	// let reader threads of multiplexed connections notice the shutdown and exit
+	for ( int i=0; i<20 && GetAgentMuxConnections()>0; ++i )
+		sphSleepMsec ( 50 );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// multiplexed agent connections
+//////////////////////////////////////////////////////////////////////////
+
+bool g_bAgentMultiplex = false;
+bool g_bAgentCompression = false;
+
+static const int64_t	MUX_RECHECK_PERIOD = I64C(60000000);	// agent which refused to multiplex is asked again in a minute
+static CSphAtomic		g_iMuxConnections;						// live multiplexed connections (each has its reader thread)
+
+int GetAgentMuxConnections ()
+{
+	return (int) g_iMuxConnections.GetValue();
+}
+
+/// wakes up RemoteWaitForAgents when a reply of its multiplexed request arrives
+class MuxWaiter_c : public ISphNoncopyable
+{
+public:
+	MuxWaiter_c ()
+		: m_iReadFD ( -1 )
+		, m_iWriteFD ( -1 )
+	{
+#if HAVE_EVENTFD
+		m_iReadFD = m_iWriteFD = eventfd ( 0, EFD_NONBLOCK );
+#else
+		CSphString sError;
+		if ( !sphCreateSocketPair ( m_iReadFD, m_iWriteFD, sError ) )
+			sphWarning ( "multiplexed agents will poll due to %s", sError.cstr() );
+#endif
+	}
+
+	~MuxWaiter_c ()
+	{
+#if HAVE_EVENTFD
+		SafeClose ( m_iReadFD );
+#else
+		if ( m_iReadFD>=0 )
+			sphSockClose ( m_iReadFD );
+		if ( m_iWriteFD>=0 )
+			sphSockClose ( m_iWriteFD );
+#endif
+	}
+
+	bool IsValid () const
+	{
+		return m_iReadFD>=0 && m_iWriteFD>=0;
+	}
+
+	int GetFD () const
+	{
+		return m_iReadFD;
+	}
+
+	void Wakeup ()
+	{
+		if ( m_iWriteFD<0 )
+			return;
+
+		uint64_t uVal = 1;
+#if HAVE_EVENTFD
+		int iPut = ::write ( m_iWriteFD, &uVal, sizeof ( uVal ) );
+#else
+		int iPut = sphSockSend ( m_iWriteFD, (const char *)&uVal, sizeof ( uVal ) );
+#endif
+		// full socketpair means there is a pending wakeup anyway
+		if ( iPut<0 )
+			sphLogDebugv ( "failed to wakeup agent waiter ( error %d,'%s')", sphSockGetErrno(), sphSockError() );
+	}
+
+	void Drain ()
+	{
+		uint64_t uVal = 0;
+#if HAVE_EVENTFD
+		int iRes = ::read ( m_iReadFD, &uVal, sizeof ( uVal ) );
+		(void)iRes;
+#else
+		while ( sphSockRecv ( m_iReadFD, (char *)&uVal, sizeof ( uVal ) )>0 ) {}
+#endif
+	}
+
+private:
+	int m_iReadFD;
+	int m_iWriteFD;
+};
+
+/// tagged request in flight over a multiplexed connection
+struct AgentMuxRequest_t : public ISphRefcountedMT
+{
+	DWORD			m_uTag;
+	bool			m_bDone;		///< reply arrived or connection failed; guarded by connection lock
+	MuxWaiter_c *	m_pWaiter;		///< whom to wake up on completion; guarded by connection lock
+	CSphString		m_sError;		///< connection failure, if any
+	int				m_iStatus;		///< reply status
+	bool			m_bPacked;		///< reply body is compressed
+	BYTE *			m_pReply;		///< reply body, handed over to AgentConn_t
+	int				m_iReplySize;
+
+	AgentMuxRequest_t ()
+		: m_uTag ( 0 )
+		, m_bDone ( false )
+		, m_pWaiter ( nullptr )
+		, m_iStatus ( -1 )
+		, m_bPacked ( false )
+		, m_pReply ( nullptr )
+		, m_iReplySize ( 0 )
+	{}
+
+protected:
+	~AgentMuxRequest_t () override
+	{
+		SafeDeleteArray ( m_pReply );
+	}
+};
+
+/// one socket to a host shared by all the queries to it
+/// writers serialize on the send lock; the dedicated reader thread routes replies to requests by tag
+class AgentMuxConn_c : public ISphRefcountedMT
+{
+public:
+	AgentMuxConn_c ( int iSock, const CSphString & sHost )
+		: m_iSock ( iSock )
+		, m_sHost ( sHost )
+		, m_bBroken ( false )
+		, m_uLastTag ( 0 )
+	{
+		++g_iMuxConnections;
+	}
+
+	bool IsBroken () const
+	{
+		return m_bBroken;
+	}
+
+	bool Start ()
+	{
+		AddRef(); // the reader holds the connection till it exits
+		SphThread_t tThd;
+		if ( sphThreadCreate ( &tThd, ReaderThread, this, true ) )
+			return true;
+		Release();
+		return false;
+	}
+
+	bool Send ( AgentConn_t & tAgent, const CSphVector<BYTE> & dRequest, CSphString & sError ) EXCLUDES ( m_tLock, m_tSendLock )
+	{
+		assert ( !tAgent.m_pMuxReq );
+		AgentMuxRequest_t * pReq = new AgentMuxRequest_t;
+		{
+			CSphScopedLock<CSphMutex> tLock ( m_tLock );
+			if ( m_bBroken )
+			{
+				pReq->Release();
+				sError.SetSprintf ( "multiplexed connection to %s is broken", m_sHost.cstr() );
+				return false;
+			}
+			pReq->m_uTag = ++m_uLastTag;
+			pReq->AddRef(); // pending list owns one more ref
+			m_hPending.Add ( pReq, pReq->m_uTag );
+		}
+		tAgent.m_pMuxReq = pReq;
+
+		CSphScopedLock<CSphMutex> tSendLock ( m_tSendLock );
+		NetOutputBuffer_c tOut ( m_iSock );
+		tOut.SendDword ( pReq->m_uTag );
+		tOut.SendBytes ( dRequest.Begin(), dRequest.GetLength() );
+		tOut.Flush();
+		if ( !tOut.GetError() )
+			return true;
+
+		sError = tOut.GetErrorMsg();
+		Break ( sError.cstr() );
+		return false;
+	}
+
+	// returns whether the request is complete; otherwise the waiter will be woken up on completion
+	bool Attach ( AgentMuxRequest_t * pReq, MuxWaiter_c * pWaiter ) EXCLUDES ( m_tLock )
+	{
+		CSphScopedLock<CSphMutex> tLock ( m_tLock );
+		pReq->m_pWaiter = pWaiter;
+		return pReq->m_bDone;
+	}
+
+	// forget the request; its late reply (if any) will be dropped by reader
+	void Cancel ( AgentMuxRequest_t * pReq ) EXCLUDES ( m_tLock )
+	{
+		CSphScopedLock<CSphMutex> tLock ( m_tLock );
+		pReq->m_pWaiter = nullptr;
+		if ( pReq->m_bDone )
+			return;
+
+		AgentMuxRequest_t ** ppReq = m_hPending ( pReq->m_uTag );
+		if ( ppReq && *ppReq==pReq )
+		{
+			m_hPending.Delete ( pReq->m_uTag );
+			pReq->Release();
+		}
+	}
+
+	// fail all the pending requests; connection will be replaced on next use
+	void Break ( const char * sReason ) EXCLUDES ( m_tLock )
+	{
+		CSphScopedLock<CSphMutex> tLock ( m_tLock );
+		if ( !m_bBroken )
+		{
+			m_bBroken = true;
+			::shutdown ( m_iSock, 2 ); // both directions; wakes up the reader and the writers
+			sphLogDebug ( "multiplexed connection to %s broken: %s", m_sHost.cstr(), sReason );
+		}
+
+		m_hPending.IterateStart();
+		while ( m_hPending.IterateNext() )
+		{
+			AgentMuxRequest_t * pReq = m_hPending.IterateGet();
+			pReq->m_sError.SetSprintf ( "multiplexed connection failed: %s", sReason );
+			Complete ( pReq );
+		}
+		m_hPending.Reset();
+	}
+
+protected:
+	~AgentMuxConn_c () override
+	{
+		sphSockClose ( m_iSock );
+		--g_iMuxConnections;
+	}
+
+private:
+	CSphMutex			m_tLock;		///< guards pending requests and their completion
+	CSphMutex			m_tSendLock;	///< serializes writers; never taken while holding m_tLock
+	int					m_iSock;
+	CSphString			m_sHost;
+	volatile bool		m_bBroken;
+	DWORD				m_uLastTag GUARDED_BY ( m_tLock );
+	CSphOrderedHash < AgentMuxRequest_t *, DWORD, IdentityHash_fn, 256 > m_hPending GUARDED_BY ( m_tLock );
+
+	static void ReaderThread ( void * pArg )
+	{
+		AgentMuxConn_c * pConn = (AgentMuxConn_c *)pArg;
+		pConn->ReadReplies();
+		pConn->Release();
+	}
+
+	// wakes up with short time slices to notice that connection was broken
+	// idle wait is unlimited; once some bytes came, the rest must arrive within read_timeout
+	bool ReadExact ( void * pBuf, int iLen, bool bIdle )
+	{
+		BYTE * pCur = (BYTE *)pBuf;
+		int64_t tmMax = sphMicroTimer() + I64C(1000000)*Max ( g_iReadTimeout, 1 );
+		while ( iLen>0 )
+		{
+			if ( m_bBroken || g_bShutdown )
+				return false;
+
+			int iRes = sphPoll ( m_iSock, 100000 );
+			if ( iRes<0 && sphSockGetErrno()!=EINTR )
+				return false;
+
+			if ( iRes<=0 )
+			{
+				if ( !bIdle && sphMicroTimer()>tmMax )
+					return false;
+				continue;
+			}
+
+			iRes = sphSockRecv ( m_iSock, (char *)pCur, iLen );
+			if ( iRes<0 )
+			{
+				int iErr = sphSockGetErrno();
+				if ( iErr==EINTR || iErr==EAGAIN || iErr==EWOULDBLOCK )
+					continue;
+			}
+			if ( iRes<=0 )
+				return false;
+
+			if ( bIdle )
+			{
+				bIdle = false;
+				tmMax = sphMicroTimer() + I64C(1000000)*Max ( g_iReadTimeout, 1 );
+			}
+			pCur += iRes;
+			iLen -= iRes;
+		}
+		return true;
+	}
+
+	void ReadReplies ()
+	{
+		for ( ;; )
+		{
+			struct
+			{
+				DWORD	m_uTag;
+				WORD	m_iStatus;
+				WORD	m_iVer;
+				int		m_iLength;
+			} tHeader;
+			STATIC_SIZE_ASSERT ( tHeader, 12 );
+
+			if ( !ReadExact ( &tHeader, sizeof(tHeader), true ) )
+			{
+				Break ( "failed to receive reply header" );
+				break;
+			}
+
+			DWORD uTag = ntohl ( tHeader.m_uTag );
+			int iStatus = ntohs ( tHeader.m_iStatus );
+			int iLength = ntohl ( tHeader.m_iLength );
+			if ( iLength<0 || iLength>g_iMaxPacketSize )
+			{
+				CSphString sError;
+				sError.SetSprintf ( "invalid packet size (status=%d, len=%d, max_packet_size=%d)", iStatus, iLength, g_iMaxPacketSize );
+				Break ( sError.cstr() );
+				break;
+			}
+
+			BYTE * pReply = new BYTE [ iLength ];
+			if ( !ReadExact ( pReply, iLength, false ) )
+			{
+				SafeDeleteArray ( pReply );
+				Break ( "failed to receive reply body" );
+				break;
+			}
+
+			CSphScopedLock<CSphMutex> tLock ( m_tLock );
+			AgentMuxRequest_t ** ppReq = m_hPending ( uTag );
+			if ( !ppReq )
+			{
+				// request was cancelled (timed out); drop late reply
+				SafeDeleteArray ( pReply );
+				continue;
+			}
+
+			AgentMuxRequest_t * pReq = *ppReq;
+			m_hPending.Delete ( uTag );
+			pReq->m_iStatus = iStatus;
+			pReq->m_bPacked = ( ntohs ( tHeader.m_iVer ) & VER_REPLY_PACKED )!=0;
+			pReq->m_pReply = pReply;
+			pReq->m_iReplySize = iLength;
+			Complete ( pReq );
+		}
+	}
+
+	// mark done, wake up the waiter and drop the pending list ref
+	void Complete ( AgentMuxRequest_t * pReq ) REQUIRES ( m_tLock )
+	{
+		pReq->m_bDone = true;
+		if ( pReq->m_pWaiter )
+			pReq->m_pWaiter->Wakeup();
+		pReq->Release();
+	}
+};
+
+// fill the address of the agent to connect to; returns address length
+static socklen_t AgentSockAddr ( const AgentDesc_c & tAgent, struct sockaddr_storage & ss )
+{
+	socklen_t len = 0;
+	memset ( &ss, 0, sizeof(ss) );
+	ss.ss_family = (short)tAgent.m_iFamily;
+
+	if ( ss.ss_family==AF_INET )
+	{
+		DWORD uAddr = tAgent.m_uAddr;
+		if ( g_bHostnameLookup && !tAgent.m_sHost.IsEmpty() )
+		{
+			DWORD uRenew = sphGetAddress ( tAgent.m_sHost.cstr(), false );
+			if ( uRenew )
+				uAddr = uRenew;
+		}
+
+		struct sockaddr_in *in = (struct sockaddr_in *)&ss;
+		in->sin_port = htons ( (unsigned short)tAgent.m_iPort );
+		in->sin_addr.s_addr = uAddr;
+		len = sizeof(*in);
+	}
+#if !USE_WINDOWS
+	else if ( ss.ss_family==AF_UNIX )
+	{
+		struct sockaddr_un *un = (struct sockaddr_un *)&ss;
+		snprintf ( un->sun_path, sizeof(un->sun_path), "%s", tAgent.m_sPath.cstr() );
+		len = sizeof(*un);
+	}
+#endif
+	return len;
+}
+
+// blocking connect and handshake; returns socket switched to multiplexed mode, or -1
+static int MuxConnect ( const AgentConn_t & tAgent, bool & bUnsupported, CSphString & sError )
+{
+	struct sockaddr_storage ss;
+	socklen_t iLen = AgentSockAddr ( tAgent, ss );
+
+	int iSock = socket ( tAgent.m_iFamily, SOCK_STREAM, 0 );
+	if ( iSock<0 )
+	{
+		sError.SetSprintf ( "socket() failed: %s", sphSockError() );
+		return -1;
+	}
+
+	int64_t tmMax = sphMicroTimer() + I64C(1000)*g_iAgentConnectTimeout;
+	int iTimeoutSec = Max ( ( g_iAgentConnectTimeout+999 )/1000, 1 );
+	bool bOk = false;
+
+	do
+	{
+		if ( sphSetSockNB ( iSock )<0 )
+		{
+			sError.SetSprintf ( "sphSetSockNB() failed: %s", sphSockError() );
+			break;
+		}
+
+#ifdef TCP_NODELAY
+		int iOn = 1;
+		if ( tAgent.m_iFamily==AF_INET && setsockopt ( iSock, IPPROTO_TCP, TCP_NODELAY, (char*)&iOn, sizeof(iOn) ) )
+		{
+			sError.SetSprintf ( "setsockopt() failed: %s", sphSockError() );
+			break;
+		}
+#endif
+
+		++g_tStats.m_iAgentConnect;
+		if ( connect ( iSock, (struct sockaddr*)&ss, iLen )<0 )
+		{
+			int iErr = sphSockGetErrno();
+			if ( iErr!=EINPROGRESS && iErr!=EINTR && iErr!=EWOULDBLOCK )
+			{
+				sError.SetSprintf ( "connect() failed: errno=%d, %s", iErr, sphSockError(iErr) );
+				break;
+			}
+
+			if ( sphPoll ( iSock, Max ( tmMax-sphMicroTimer(), 0 ), true )<=0 )
+			{
+				sError = "connect() timed out";
+				break;
+			}
+
+			iErr = 0;
+			socklen_t iErrLen = sizeof(iErr);
+			getsockopt ( iSock, SOL_SOCKET, SO_ERROR, (char*)&iErr, &iErrLen );
+			if ( iErr )
+			{
+				sError.SetSprintf ( "connect() failed: errno=%d, %s", iErr, sphSockError(iErr) );
+				break;
+			}
+		}
+
+		int iRemoteVer = 0;
+		if ( sphSockRead ( iSock, &iRemoteVer, sizeof(iRemoteVer), iTimeoutSec, false )!=sizeof(iRemoteVer) )
+		{
+			sError = "handshake failure";
+			break;
+		}
+		iRemoteVer = ntohl ( iRemoteVer );
+		if (!( iRemoteVer==SPHINX_SEARCHD_PROTO || iRemoteVer==0x01000000UL ) )
+		{
+			sError.SetSprintf ( "handshake failure (unexpected protocol version=%d)", iRemoteVer );
+			break;
+		}
+
+		NetOutputBuffer_c tOut ( iSock );
+		tOut.SendDword ( SPHINX_CLIENT_VERSION );
+		tOut.SendWord ( SEARCHD_COMMAND_MUX );
+		tOut.SendWord ( VER_COMMAND_MUX );
+		tOut.SendInt ( 0 );
+		tOut.Flush();
+		if ( tOut.GetError() )
+		{
+			sError = tOut.GetErrorMsg();
+			break;
+		}
+
+		struct
+		{
+			WORD	m_iStatus;
+			WORD	m_iVer;
+			int		m_iLength;
+		} tReplyHeader;
+		STATIC_SIZE_ASSERT ( tReplyHeader, 8 );
+
+		if ( sphSockRead ( iSock, &tReplyHeader, sizeof(tReplyHeader), iTimeoutSec, false )!=sizeof(tReplyHeader) )
+		{
+			sError = "failed to receive multiplexing reply";
+			break;
+		}
+
+		int iLength = ntohl ( tReplyHeader.m_iLength );
+		if ( ntohs ( tReplyHeader.m_iStatus )!=SEARCHD_OK )
+		{
+			// older agents do not know the command and answer with an error
+			bUnsupported = true;
+			sError = "agent does not support multiplexing";
+			break;
+		}
+
+		CSphFixedVector<BYTE> dBody ( Max ( iLength, 0 ) );
+		if ( iLength<0 || iLength>64 || sphSockRead ( iSock, dBody.Begin(), iLength, iTimeoutSec, false )!=iLength )
+		{
+			sError = "failed to receive multiplexing reply";
+			break;
+		}
+
+		bOk = true;
+	} while ( false );
+
+	if ( bOk )
+		return iSock;
+
+	sphSockClose ( iSock );
+	return -1;
+}
+
+AgentMux_c::AgentMux_c ()
+	: m_pConn ( nullptr )
+	, m_bShutdown ( false )
+	, m_tmRecheck ( 0 )
+{}
+
+AgentMux_c::~AgentMux_c ()
+{
+	Shutdown();
+}
+
+bool AgentMux_c::IsSupported () const
+{
+	return sphMicroTimer()>=m_tmRecheck;
+}
+
+// returns addref'ed live connection, if any
+AgentMuxConn_c * AgentMux_c::GetLiveConn () const
+{
+	if ( !m_pConn || m_pConn->IsBroken() )
+		return nullptr;
+
+	m_pConn->AddRef();
+	return m_pConn;
+}
+
+AgentMuxConn_c * AgentMux_c::GetConn ( const AgentConn_t & tAgent, bool & bUnsupported, CSphString & sError )
+{
+	bUnsupported = false;
+	{
+		CSphScopedLock<CSphMutex> tLock ( m_tLock );
+		if ( m_bShutdown )
+		{
+			sError = "shutdown in progress";
+			return nullptr;
+		}
+
+		AgentMuxConn_c * pConn = GetLiveConn();
+		if ( pConn )
+			return pConn;
+	}
+
+	// connect and handshake might block up to agent_connect_timeout, so do not stall other queries to that host
+	int iSock = MuxConnect ( tAgent, bUnsupported, sError );
+	if ( iSock<0 )
+	{
+		if ( bUnsupported )
+			m_tmRecheck = sphMicroTimer() + MUX_RECHECK_PERIOD;
+		return nullptr;
+	}
+
+	CSphScopedLock<CSphMutex> tLock ( m_tLock );
+	if ( m_bShutdown )
+	{
+		sphSockClose ( iSock );
+		sError = "shutdown in progress";
+		return nullptr;
+	}
+
+	// another query connected concurrently and has already published its connection
+	AgentMuxConn_c * pConn = GetLiveConn();
+	if ( pConn )
+	{
+		sphSockClose ( iSock );
+		return pConn;
+	}
+
+	SafeRelease ( m_pConn );
+	m_pConn = new AgentMuxConn_c ( iSock, tAgent.GetMyUrl() );
+	if ( !m_pConn->Start() )
+	{
+		SafeRelease ( m_pConn );
+		sError = "failed to start multiplexed reader thread";
+		return nullptr;
 	}
-	g_tDashes.Unlock();
+
+	m_pConn->AddRef();
+	return m_pConn;
+}
+
+void AgentMux_c::Shutdown ()
+{
+	CSphScopedLock<CSphMutex> tLock ( m_tLock );
+	m_bShutdown = true;
+	if ( m_pConn )
+		m_pConn->Break ( "shutdown" );
+	SafeRelease ( m_pConn );
 }
 
+
 //////////////////////////////////////////////////////////////////////////
 void MultiAgentDesc_t::SetOptions ( const AgentOptions_t& tOpt )
 {
 	m_eStrategy = tOpt.m_eStrategy;
+	m_iHedgeDelay = tOpt.m_iHedgeDelay;
 	for ( auto& dHost : m_dHosts )
 	{
 		dHost.m_bPersistent = tOpt.m_bPersistent;
@@ -545,6 +1212,28 @@ const AgentDesc_c & MultiAgentDesc_t::ChooseAgent ()
 	}
 }
 
+// choose a mirror on another host for the hedged request, or NULL if there is none
+const AgentDesc_c * MultiAgentDesc_t::ChooseHedge ( const HostDashboard_t * pExclude )
+{
+	// first ask the strategy, so that hedges are balanced just as regular queries
+	// (but keep round-robin order intact, or the hedge would push the next query to the slow mirror)
+	if ( m_eStrategy!=HA_ROUNDROBIN )
+		for ( int i=0; i<GetLength(); ++i )
+		{
+			const AgentDesc_c & tAgent = ChooseAgent ();
+			if ( tAgent.m_pDash!=pExclude && !tAgent.m_bBlackhole )
+				return &tAgent;
+		}
+
+	int iStart = sphRand() % GetLength();
+	for ( int i=0; i<GetLength(); ++i )
+	{
+		const AgentDesc_c & tAgent = m_dHosts[( iStart+i ) % GetLength()];
+		if ( tAgent.m_pDash!=pExclude && !tAgent.m_bBlackhole )
+			return &tAgent;
+	}
+	return nullptr;
+}
 
 void MultiAgentDesc_t::QueuePings()
 {
@@ -563,6 +1252,7 @@ MultiAgentDesc_t & MultiAgentDesc_t::operator= ( const MultiAgentDesc_t & rhs )
 	m_iRRCounter.SetValue ( rhs.m_iRRCounter.GetValue () );
 	m_eStrategy = rhs.m_eStrategy;
 	m_eStrategy = rhs.m_eStrategy;
+	m_iHedgeDelay = rhs.m_iHedgeDelay;
 	CSphScopedWLock tWguard ( m_dWeightLock );
 	CSphScopedRLock tRguard ( rhs.m_dWeightLock );
 	if ( rhs.IsInitFinished () )
@@ -582,6 +1272,7 @@ MultiAgentDesc_t & MultiAgentDesc_t::operator= ( MultiAgentDesc_t && rhs )
 	m_iRRCounter.SetValue ( rhs.m_iRRCounter.GetValue () );
 	m_eStrategy = rhs.m_eStrategy;
 	m_eStrategy = rhs.m_eStrategy;
+	m_iHedgeDelay = rhs.m_iHedgeDelay;
 	{
 		CSphScopedWLock tWguard ( m_dWeightLock );
 		CSphScopedRLock tRguard ( rhs.m_dWeightLock );
@@ -594,9 +1285,13 @@ MultiAgentDesc_t & MultiAgentDesc_t::operator= ( MultiAgentDesc_t && rhs )
 AgentConn_t::AgentConn_t ()
 	: m_iSock ( -1 )
 	, m_bFresh ( true )
+	, m_bMux ( false )
+	, m_pMuxConn ( nullptr )
+	, m_pMuxReq ( nullptr )
 	, m_eState ( AGENT_UNUSED )
 	, m_bSuccess ( false )
 	, m_iReplyStatus ( -1 )
+	, m_bReplyPacked ( false )
 	, m_iReplySize ( 0 )
 	, m_iReplyRead ( 0 )
 	, m_iRetries ( 0 )
@@ -611,6 +1306,10 @@ AgentConn_t::AgentConn_t ()
 	, m_iWeight ( -1 )
 	, m_bPing ( false )
 	, m_pMirrorChooser { nullptr }
+	, m_pHedge ( nullptr )
+	, m_pHedgeOf ( nullptr )
+	, m_tmHedge ( 0 )
+	, m_bPolled ( false )
 {}
 
 AgentConn_t::~AgentConn_t ()
@@ -623,6 +1322,12 @@ AgentConn_t::~AgentConn_t ()
 void AgentConn_t::Close ( bool bClosePersist )
 {
 	SafeDeleteArray ( m_pReplyBuf );
+	if ( m_pMuxConn )
+	{
+		ReleaseMux ();
+		if ( m_eState!=AGENT_RETRY )
+			m_eState = AGENT_UNUSED;
+	}
 	if ( m_iSock>0 )
 	{
 		m_bFresh = false;
@@ -638,6 +1343,18 @@ void AgentConn_t::Close ( bool bClosePersist )
 	m_iWall += sphMicroTimer ();
 }
 
+// drop the in-flight multiplexed request (late reply will be discarded) and the connection
+void AgentConn_t::ReleaseMux ()
+{
+	if ( m_pMuxReq )
+	{
+		assert ( m_pMuxConn );
+		m_pMuxConn->Cancel ( m_pMuxReq );
+		SafeRelease ( m_pMuxReq );
+	}
+	SafeRelease ( m_pMuxConn );
+}
+
 AgentDesc_c & AgentDesc_c::operator = ( const AgentDesc_c & rhs )
 {
 	if ( this!=&rhs )
@@ -724,13 +1441,32 @@ void AgentConn_t::SpecifyAndSelectMirror ( MultiAgentDesc_t * pMirrorChooser )
 	}
 
 	assert ( m_pMirrorChooser );
-	AgentDesc_c::operator=( m_pMirrorChooser->ChooseAgent ());
+	SetMirror ( m_pMirrorChooser->ChooseAgent () );
+	m_tmHedge = 0;
+}
+
+void AgentConn_t::SetMirror ( const AgentDesc_c & tMirror )
+{
+	AgentDesc_c::operator=( tMirror );
+	ReleaseMux ();
+
+	// multiplexed connection of the host serves all its persistent queries, no need to rent a socket
+	m_bMux = ( m_bPersistent && g_bAgentMultiplex && m_pDash->m_pMux && m_pDash->m_pMux->IsSupported () );
+	if ( m_bMux )
+		m_bPersistent = false;
+	else
+		RentPersistent ();
+}
+
+void AgentConn_t::RentPersistent ()
+{
 	if ( m_bPersistent && m_pDash->m_pPersPool )
 	{
 		m_iSock = m_pDash->m_pPersPool->RentConnection ();
 		if ( m_iSock==-2 ) // no free persistent connections. This connection will be not persistent
 			m_bPersistent = false;
-	}
+	} else
+		m_bPersistent = false; // no pool (i.e. only agent_multiplex enabled)
 	m_bFresh = ( m_bPersistent && m_iSock<0 );
 }
 
@@ -771,6 +1507,8 @@ void agent_stats_inc ( AgentConn_t & tAgent, AgentStats_e iCounter )
 	// only count errors
 	if ( !tAgent.m_bPing )
 	{
+		if ( iCounter==eNetworkCritical || iCounter==eNetworkNonCritical )
+			++tAgentDash.m_dLatency[LatencyBucket ( tAgent.m_iEndQuery-tAgent.m_iStartQuery )];
 		tAgentDash.m_dHostStats[ehTotalMsecs]+=tAgent.m_iEndQuery-tAgent.m_iStartQuery;
 		if ( tAgent.m_pStats )
 			tAgent.m_pStats->m_dHostStats[ehTotalMsecs] += tAgent.m_iEndQuery - tAgent.m_iStartQuery;
@@ -1218,11 +1956,48 @@ void cDashStorage::GetActiveDashes ( CSphVector<HostDashboard_t *> & dAgents ) c
 	}
 }
 
+// attach the agent to the multiplexed connection of its host
+// returns false if the host refused to multiplex, and regular connection should be used instead
+static bool RemoteConnectMux ( AgentConn_t & tAgent, bool bAgentRetry )
+{
+	assert ( tAgent.m_pDash && tAgent.m_pDash->m_pMux );
+	tAgent.ReleaseMux ();
+	tAgent.m_bSuccess = false;
+
+	bool bUnsupported = false;
+	CSphString sError;
+	tAgent.m_pMuxConn = tAgent.m_pDash->m_pMux->GetConn ( tAgent, bUnsupported, sError );
+	tAgent.m_iStartQuery = sphMicroTimer();
+	if ( tAgent.m_pMuxConn )
+	{
+		tAgent.m_eState = AGENT_ESTABLISHED;
+		tAgent.m_iWall -= tAgent.m_iStartQuery;
+		return true;
+	}
+
+	if ( bUnsupported )
+	{
+		sphLogDebug ( "agent %s: %s, using regular connections", tAgent.GetMyUrl().cstr(), sError.cstr() );
+		tAgent.m_bMux = false;
+		tAgent.m_bPersistent = true;
+		tAgent.RentPersistent ();
+		return false;
+	}
+
+	g_tStats.m_iAgentRetry += bAgentRetry;
+	tAgent.m_iWall -= tAgent.m_iStartQuery;
+	tAgent.Fail ( eConnectFailures, "%s", sError.cstr() );
+	return true;
+}
+
 void RemoteConnectToAgent ( AgentConn_t & tAgent )
 {
 	bool bAgentRetry = ( tAgent.m_eState==AGENT_RETRY );
 	tAgent.m_eState = AGENT_UNUSED;
 
+	if ( tAgent.m_bMux && RemoteConnectMux ( tAgent, bAgentRetry ) )
+		return;
+
 	if ( tAgent.m_iSock>=0 ) // already connected
 	{
 		if ( !sphNBSockEof ( tAgent.m_iSock ) )
@@ -1237,39 +2012,10 @@ void RemoteConnectToAgent ( AgentConn_t & tAgent )
 
 	tAgent.m_bSuccess = false;
 
-	socklen_t len = 0;
 	struct sockaddr_storage ss;
-	memset ( &ss, 0, sizeof(ss) );
-	ss.ss_family = (short)tAgent.m_iFamily;
-#ifdef TCP_NODELAY
-	bool bUnixSocket = false;
-#endif
-
-	if ( ss.ss_family==AF_INET )
-	{
-		DWORD uAddr = tAgent.m_uAddr;
-		if ( g_bHostnameLookup && !tAgent.m_sHost.IsEmpty() )
-		{
-			DWORD uRenew = sphGetAddress ( tAgent.m_sHost.cstr(), false );
-			if ( uRenew )
-				uAddr = uRenew;
-		}
-
-		struct sockaddr_in *in = (struct sockaddr_in *)&ss;
-		in->sin_port = htons ( (unsigned short)tAgent.m_iPort );
-		in->sin_addr.s_addr = uAddr;
-		len = sizeof(*in);
-	}
-#if !USE_WINDOWS
-	else if ( ss.ss_family==AF_UNIX )
-	{
-		struct sockaddr_un *un = (struct sockaddr_un *)&ss;
-		snprintf ( un->sun_path, sizeof(un->sun_path), "%s", tAgent.m_sPath.cstr() );
-		len = sizeof(*un);
+	socklen_t len = AgentSockAddr ( tAgent, ss );
 #ifdef TCP_NODELAY
-		bUnixSocket = true;
-#endif
-	}
+	bool bUnixSocket = ( ss.ss_family==AF_UNIX );
 #endif
 
 	tAgent.m_iSock = socket ( tAgent.m_iFamily, SOCK_STREAM, 0 );
@@ -1328,6 +2074,25 @@ void RemoteConnectToAgent ( AgentConn_t & tAgent )
 	}
 }
 
+// send the request over multiplexed connection; returns 1 if sent
+static int RemoteQueryMux ( AgentConn_t & tAgent, const IRequestBuilder_t & tBuilder )
+{
+	ISphOutputBuffer tOut;
+	tBuilder.BuildRequest ( tAgent, tOut );
+	CSphVector<BYTE> dRequest;
+	tOut.SwapData ( dRequest );
+
+	CSphString sError;
+	if ( !tAgent.m_pMuxConn->Send ( tAgent, dRequest, sError ) )
+	{
+		tAgent.Fail ( eNetworkErrors, "%s", sError.cstr() );
+		return 0;
+	}
+
+	tAgent.m_eState = AGENT_QUERYED;
+	return 1;
+}
+
 // process states AGENT_CONNECTING, AGENT_HANDSHAKE, AGENT_ESTABLISHED and notes AGENT_QUERYED
 // called in serial order with RemoteConnectToAgents (so, the context is NOT changed during the call).
 int RemoteQueryAgents ( AgentConnectionContext_t * pCtx )
@@ -1339,6 +2104,14 @@ int RemoteQueryAgents ( AgentConnectionContext_t * pCtx )
 	int iAgents = 0;
 	int64_t tmMaxTimer = sphMicroTimer() + pCtx->m_iTimeout*1000; // in microseconds
 
+	// multiplexed agents need no polling; their requests just go to the shared connection
+	for ( int i=0; i<pCtx->m_iAgentCount; i++ )
+	{
+		AgentConn_t & tAgent = pCtx->m_pAgents[i];
+		if ( tAgent.m_pMuxConn && tAgent.m_eState==AGENT_ESTABLISHED )
+			iAgents += RemoteQueryMux ( tAgent, *pCtx->m_pBuilder );
+	}
+
 	ISphNetEvents* pEvents = sphCreatePoll ( pCtx->m_iAgentCount, true );
 	int iEvents = 0;
 	bool bTimeout = false;
@@ -1351,7 +2124,7 @@ int RemoteQueryAgents ( AgentConnectionContext_t * pCtx )
 			{
 				AgentConn_t & tAgent = pCtx->m_pAgents[i];
 				// select only 'initial' agents - which are not send query response.
-				if ( tAgent.m_eState<AGENT_CONNECTING || tAgent.m_eState>AGENT_QUERYED )
+				if ( tAgent.m_eState<AGENT_CONNECTING || tAgent.m_eState>AGENT_QUERYED || tAgent.m_pMuxConn )
 					continue;
 
 				assert ( !tAgent.m_sPath.IsEmpty() || tAgent.m_iPort>0 );
@@ -1547,28 +2320,358 @@ int RemoteQueryAgents ( AgentConnectionContext_t * pCtx )
 	return iAgents;
 }
 
+// account reply traffic of the agent
+static void track_reply_bytes ( AgentConn_t & tAgent, int iReplyBytes, int iUnpackedBytes )
+{
+	assert ( tAgent.m_pDash );
+	{
+		CSphScopedWLock tWguard ( tAgent.m_pDash->m_dDataLock );
+		uint64_t * pCurStat = tAgent.m_pDash->GetCurrentStat ()->m_dHostStats;
+		pCurStat[ehPackedReplies] += ( tAgent.m_bReplyPacked ? 1 : 0 );
+		pCurStat[ehReplyBytes] += iReplyBytes;
+		pCurStat[ehUnpackedBytes] += iUnpackedBytes;
+	}
+
+	if ( tAgent.m_pStats )
+	{
+		uint64_t * pHStat = tAgent.m_pStats->m_dHostStats;
+		pHStat[ehPackedReplies] += ( tAgent.m_bReplyPacked ? 1 : 0 );
+		pHStat[ehReplyBytes] += iReplyBytes;
+		pHStat[ehUnpackedBytes] += iUnpackedBytes;
+	}
+}
+
+// replace compressed reply body with the unpacked one; returns false on failure
+static bool UnpackAgentReply ( AgentConn_t & tAgent )
+{
+#if USE_ZLIB
+	if ( tAgent.m_iReplySize<(int)sizeof(DWORD) )
+		return false;
+
+	// packed body is the unpacked length followed by zlib stream
+	DWORD uLength = ntohl ( sphUnalignedRead ( *(DWORD*)tAgent.m_pReplyBuf ) );
+	if ( uLength>(DWORD)g_iMaxPacketSize )
+		return false;
+
+	BYTE * pUnpacked = new BYTE [ uLength ];
+	uLongf uUnpacked = uLength;
+	if ( uncompress ( pUnpacked, &uUnpacked, tAgent.m_pReplyBuf+sizeof(DWORD), tAgent.m_iReplySize-sizeof(DWORD) )!=Z_OK
+		|| uUnpacked!=uLength )
+	{
+		SafeDeleteArray ( pUnpacked );
+		return false;
+	}
+
+	SafeDeleteArray ( tAgent.m_pReplyBuf );
+	tAgent.m_pReplyBuf = pUnpacked;
+	tAgent.m_iReplySize = tAgent.m_iReplyRead = (int)uLength;
+	return true;
+#else
+	return false;
+#endif
+}
+
+// parse fully received reply; returns false on failure
+static bool ParseAgentReply ( AgentConn_t & tAgent, IReplyParser_t & tParser, bool & bWarnings )
+{
+	int iReplyBytes = tAgent.m_iReplySize;
+	if ( tAgent.m_bReplyPacked && !UnpackAgentReply ( tAgent ) )
+	{
+		tAgent.Fail ( eWrongReplies, "failed to unpack reply" );
+		return false;
+	}
+	track_reply_bytes ( tAgent, iReplyBytes, tAgent.m_iReplySize );
+
+	MemInputBuffer_c tReq ( tAgent.m_pReplyBuf, tAgent.m_iReplySize );
+
+	// absolve thy former sins
+	tAgent.m_sFailure = "";
+
+	// check for general errors/warnings first
+	if ( tAgent.m_iReplyStatus==SEARCHD_WARNING )
+	{
+		CSphString sAgentWarning = tReq.GetString ();
+		tAgent.m_sFailure.SetSprintf ( "remote warning: %s", sAgentWarning.cstr() );
+		bWarnings = true;
+
+	} else if ( tAgent.m_iReplyStatus==SEARCHD_RETRY )
+	{
+		tAgent.m_eState = AGENT_RETRY;
+		CSphString sAgentError = tReq.GetString ();
+		tAgent.m_sFailure.SetSprintf ( "remote warning: %s", sAgentError.cstr() );
+		return false;
+
+	} else if ( tAgent.m_iReplyStatus!=SEARCHD_OK )
+	{
+		CSphString sAgentError = tReq.GetString ();
+		tAgent.m_sFailure.SetSprintf ( "remote error: %s", sAgentError.cstr() );
+		return false;
+	}
+
+	// call parser
+	if ( !tParser.ParseReply ( tReq, tAgent ) )
+		return false;
+
+	// check if there was enough data
+	if ( tReq.GetError() )
+	{
+		tAgent.Fail ( eWrongReplies, "incomplete reply" );
+		return false;
+	}
+	return true;
+}
+
+// drop the in-flight request of the agent, which is not necessary anymore
+// polled socket is only closed by RemoteDropCancelled(), once it's out of the poller; otherwise its fd might get reused meanwhile
+static void RemoteCancelAgent ( AgentConn_t & tAgent )
+{
+	// the connection is in the middle of something, so it can't go back to persistent pool
+	if ( !tAgent.m_bPolled && tAgent.m_eState!=AGENT_UNUSED && tAgent.m_eState!=AGENT_RETRY )
+		tAgent.Close ();
+	tAgent.m_eState = AGENT_UNUSED;
+	tAgent.m_bSuccess = false;
+	tAgent.m_dResults.Reset ();
+}
+
+// take the cancelled agents (still polled, but unused) out of the poller, and only then close them
+static void RemoteDropCancelled ( ISphNetEvents * pEvents, const MuxWaiter_c * pWaiter, int & iEvents )
+{
+	pEvents->IterateStart ();
+	while ( pEvents->IterateNextAll () )
+	{
+		const void * pData = pEvents->IterateGet ().m_pData;
+		if ( !pData || pData==pWaiter )
+			continue;
+
+		AgentConn_t & tAgent = *(AgentConn_t *) pData;
+		if ( !tAgent.m_bPolled || tAgent.m_eState!=AGENT_UNUSED )
+			continue;
+
+		pEvents->IterateRemove ( tAgent.m_iSock );
+		tAgent.m_bPolled = false;
+		--iEvents;
+		tAgent.Close ();
+	}
+}
+
+// the first reply of the agent and its hedge wins; the other request is cancelled
+// results of the winning hedge are handed over to the agent
+static void RemoteResolveHedge ( AgentConn_t & tAgent )
+{
+	if ( !tAgent.m_bSuccess )
+		return;
+
+	if ( tAgent.m_pHedge )
+	{
+		RemoteCancelAgent ( *tAgent.m_pHedge );
+		return;
+	}
+
+	AgentConn_t * pAgent = tAgent.m_pHedgeOf;
+	if ( !pAgent )
+		return;
+
+	RemoteCancelAgent ( *pAgent );
+	pAgent->m_dResults.SwapData ( tAgent.m_dResults );
+	pAgent->m_sFailure = tAgent.m_sFailure;
+	pAgent->m_bSuccess = true;
+	++g_tStats.m_iAgentHedgeWins;
+}
+
+// pick up completed multiplexed request and parse its reply
+static void RemoteCheckMux ( AgentConn_t & tAgent, IReplyParser_t & tParser, MuxWaiter_c * pWaiter, int & iAgents )
+{
+	if ( !tAgent.m_pMuxReq || tAgent.m_eState!=AGENT_QUERYED )
+		return;
+
+	AgentMuxRequest_t * pReq = tAgent.m_pMuxReq;
+	if ( !tAgent.m_pMuxConn->Attach ( pReq, pWaiter ) )
+		return;
+
+	if ( !pReq->m_sError.IsEmpty() )
+	{
+		tAgent.Fail ( eNetworkErrors, "%s", pReq->m_sError.cstr() );
+		tAgent.m_dResults.Reset ();
+		return;
+	}
+
+	// take over the reply
+	assert ( !tAgent.m_pReplyBuf );
+	tAgent.m_pReplyBuf = pReq->m_pReply;
+	tAgent.m_iReplySize = tAgent.m_iReplyRead = pReq->m_iReplySize;
+	tAgent.m_iReplyStatus = pReq->m_iStatus;
+	tAgent.m_bReplyPacked = pReq->m_bPacked;
+	pReq->m_pReply = nullptr;
+
+	bool bWarnings = false;
+	if ( !ParseAgentReply ( tAgent, tParser, bWarnings ) )
+	{
+		tAgent.Close ();
+		tAgent.m_dResults.Reset ();
+		return;
+	}
+
+	iAgents++;
+	tAgent.Close ( false );
+	tAgent.m_bSuccess = true;
+
+	ARRAY_FOREACH_COND ( i, tAgent.m_dResults, !bWarnings )
+		bWarnings = !tAgent.m_dResults[i].m_sWarning.IsEmpty();
+	agent_stats_inc ( tAgent, bWarnings ? eNetworkCritical : eNetworkNonCritical );
+	RemoteResolveHedge ( tAgent );
+}
+
+static bool IsMuxPending ( const AgentConn_t & tAgent )
+{
+	return tAgent.m_pMuxReq && tAgent.m_eState==AGENT_QUERYED;
+}
+
+// when to hedge the agent's request to another mirror; -1 if never
+static int64_t HedgeDeadline ( const AgentConn_t & tAgent )
+{
+	if ( !tAgent.m_pMirrorChooser || tAgent.NumOfMirrors()<2 )
+		return -1;
+
+	int iDelay = tAgent.m_pMirrorChooser->GetHedgeDelay();
+	if ( !iDelay )
+		return -1;
+
+	if ( iDelay!=HEDGE_DELAY_AUTO )
+		return tAgent.m_iStartQuery + iDelay*1000;
+
+	int64_t iLatency = tAgent.m_pDash->GetLatencyPercentile ( 95 );
+	if ( !iLatency ) // don't know the host well enough yet
+		return -1;
+	return tAgent.m_iStartQuery + iLatency;
+}
+
+// send hedged requests for the agents which are late to reply
+// returns the number of hedges sent, and the time when the next hedge is due (0 if none) in tmNext
+static int RemoteLaunchHedges ( CSphVector<AgentConn_t> & dAgents, CSphVector<AgentConn_t *> & dHedges,
+	const IRequestBuilder_t & tBuilder, int64_t tmMaxTimer, ISphNetEvents * pEvents, int & iEvents,
+	MuxWaiter_c * & pWaiter, int64_t & tmNext )
+{
+	int iLaunched = 0;
+	int64_t tmNow = sphMicroTimer();
+	tmNext = 0;
+
+	for ( auto & tAgent : dAgents )
+	{
+		if ( tAgent.m_pHedge || tAgent.m_bBlackhole || tAgent.m_tmHedge<0 )
+			continue;
+		if ( tAgent.m_eState!=AGENT_QUERYED && tAgent.m_eState!=AGENT_PREREPLY )
+			continue;
+
+		if ( !tAgent.m_tmHedge )
+			tAgent.m_tmHedge = HedgeDeadline ( tAgent );
+		if ( tAgent.m_tmHedge<0 )
+			continue;
+
+		if ( tAgent.m_tmHedge>tmNow )
+		{
+			tmNext = tmNext ? Min ( tmNext, tAgent.m_tmHedge ) : tAgent.m_tmHedge;
+			continue;
+		}
+
+		tAgent.m_tmHedge = -1; // one hedge per request is enough
+		const AgentDesc_c * pMirror = tAgent.m_pMirrorChooser->ChooseHedge ( tAgent.m_pDash );
+		if ( !pMirror )
+			continue;
+
+		AgentConn_t * pHedge = new AgentConn_t;
+		dHedges.Add ( pHedge );
+		pHedge->m_pMirrorChooser = tAgent.m_pMirrorChooser;
+		pHedge->m_iStoreTag = tAgent.m_iStoreTag;
+		pHedge->m_iWeight = tAgent.m_iWeight;
+		pHedge->m_pHedgeOf = &tAgent;
+		pHedge->m_tmHedge = -1;
+		pHedge->SetMirror ( *pMirror );
+		tAgent.m_pHedge = pHedge;
+
+		sphLogDebugv ( "agent %s is late to reply, hedging to %s", tAgent.GetMyUrl().cstr(), pHedge->GetMyUrl().cstr() );
+		++g_tStats.m_iAgentHedged;
+		++iLaunched;
+
+		// connect and send right here; persistent and multiplexed connections make it cheap
+		AgentConnectionContext_t tCtx;
+		tCtx.m_pBuilder = &tBuilder;
+		tCtx.m_pAgents = pHedge;
+		tCtx.m_iAgentCount = 1;
+		tCtx.m_iTimeout = Max ( 0, Min ( g_iAgentConnectTimeout, int ( ( tmMaxTimer-tmNow )/1000 ) ) );
+		RemoteConnectToAgent ( *pHedge );
+		if ( pHedge->m_eState==AGENT_UNUSED || pHedge->m_eState==AGENT_RETRY )
+			continue;
+		RemoteQueryAgents ( &tCtx );
+
+		if ( pHedge->m_pMuxReq )
+		{
+			if ( !pWaiter )
+				pWaiter = new MuxWaiter_c;
+		} else if ( pHedge->m_eState==AGENT_QUERYED || pHedge->m_eState==AGENT_PREREPLY )
+		{
+			pEvents->SetupEvent ( pHedge->m_iSock, ISphNetEvents::SPH_POLL_RD, pHedge );
+			pHedge->m_bPolled = true;
+			++iEvents;
+		}
+	}
+	return iLaunched;
+}
+
 // processing states AGENT_QUERY, AGENT_PREREPLY and AGENT_REPLY
 // may work in parallel with RemoteQueryAgents, so the state MAY change during a call.
-int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IReplyParser_t & tParser )
+int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IReplyParser_t & tParser, const IRequestBuilder_t * pBuilder )
 {
 	assert ( iTimeout>=0 );
 
 	int iAgents = 0;
 	int64_t tmMaxTimer = sphMicroTimer() + iTimeout*1000; // in microseconds
 
-	ISphNetEvents * pEvents = sphCreatePoll ( dAgents.GetLength (), true );
+	ISphNetEvents * pEvents = sphCreatePoll ( dAgents.GetLength ()+1, true );
 	int iEvents = 0;
 	bool bTimeout = false;
 
+	// replies of multiplexed agents come from reader threads, which signal via waiter
+	MuxWaiter_c * pWaiter = nullptr;
+	bool bWaiterSet = false;
+	for ( const auto & tAgent : dAgents )
+		if ( tAgent.m_bMux )
+		{
+			pWaiter = new MuxWaiter_c;
+			break;
+		}
+
+	// hedged requests to other mirrors, live till the end of the call
+	CSphVector<AgentConn_t *> dHedges;
+	int64_t tmNextHedge = 0;
+
 	for ( ;; )
 	{
+		int iMuxPending = 0;
+		if ( pWaiter )
+		{
+			for ( auto & tAgent : dAgents )
+				RemoteCheckMux ( tAgent, tParser, pWaiter, iAgents );
+			for ( auto * pHedge : dHedges )
+				RemoteCheckMux ( *pHedge, tParser, pWaiter, iAgents );
+
+			// count after all the checks, as completed request might cancel its rival
+			for ( const auto & tAgent : dAgents )
+				iMuxPending += IsMuxPending ( tAgent );
+			for ( const auto * pHedge : dHedges )
+				iMuxPending += IsMuxPending ( *pHedge );
+		}
+
+		// losers of the hedge races have to leave the poller before anything else
+		if ( dHedges.GetLength() )
+			RemoteDropCancelled ( pEvents, pWaiter, iEvents );
+
 		if ( !iEvents )
 		{
 			bool bDone = true;
 			ARRAY_FOREACH ( iAgent, dAgents )
 			{
 				AgentConn_t & tAgent = dAgents[iAgent];
-				if ( tAgent.m_bBlackhole )
+				if ( tAgent.m_bBlackhole || tAgent.m_pMuxConn )
 					continue;
 
 				if ( tAgent.m_eState==AGENT_QUERYED || tAgent.m_eState==AGENT_REPLY || tAgent.m_eState==AGENT_PREREPLY )
@@ -1576,15 +2679,26 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 					assert ( !tAgent.m_sPath.IsEmpty() || tAgent.m_iPort>0 );
 					assert ( tAgent.m_iSock>0 );
 					pEvents->SetupEvent ( tAgent.m_iSock, ISphNetEvents::SPH_POLL_RD, &tAgent);
+					tAgent.m_bPolled = true;
 					++iEvents;
 					bDone = false;
 				}
 			}
 
-			if ( bDone )
+			if ( bDone && !iMuxPending )
 				break;
 		}
 
+		// freshly sent multiplexed hedges need to attach the waiter first, so go round
+		if ( pBuilder && RemoteLaunchHedges ( dAgents, dHedges, *pBuilder, tmMaxTimer, pEvents, iEvents, pWaiter, tmNextHedge ) )
+			continue;
+
+		if ( iMuxPending && !bWaiterSet && pWaiter->IsValid() )
+		{
+			pEvents->SetupEvent ( pWaiter->GetFD(), ISphNetEvents::SPH_POLL_RD, pWaiter );
+			bWaiterSet = true;
+		}
+
 		int64_t tmSelect = sphMicroTimer();
 		int64_t tmMicroLeft = tmMaxTimer - tmSelect;
 		if ( tmMicroLeft<=0 ) // FIXME? what about iTimeout==0 case?
@@ -1593,7 +2707,12 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 			break;
 		}
 
-		bool bHaveAnswered = pEvents->Wait( int( tmMicroLeft/1000 ) );
+		int iWait = int( tmMicroLeft/1000 );
+		if ( iMuxPending && !bWaiterSet )
+			iWait = Min ( iWait, 10 ); // no waiter, so poll multiplexed replies
+		if ( tmNextHedge )
+			iWait = Min ( iWait, int ( ( tmNextHedge-tmSelect )/1000 ) + 1 );
+		bool bHaveAnswered = pEvents->Wait( iWait );
 		dAgents.Begin()->m_iWaited += sphMicroTimer() - tmSelect;
 
 		if ( !bHaveAnswered )
@@ -1603,6 +2722,12 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 		while ( pEvents->IterateNextReady () )
 		{
 			NetEventsIterator_t &tEvent = pEvents->IterateGet ();
+			if ( tEvent.m_pData==pWaiter )
+			{
+				pWaiter->Drain();
+				continue;
+			}
+
 			AgentConn_t & tAgent = *(AgentConn_t*) tEvent.m_pData;
 			if ( tAgent.m_bBlackhole )
 				continue;
@@ -1662,6 +2787,7 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 					tAgent.m_iReplySize = tReplyHeader.m_iLength;
 					tAgent.m_iReplyRead = 0;
 					tAgent.m_iReplyStatus = tReplyHeader.m_iStatus;
+					tAgent.m_bReplyPacked = ( tReplyHeader.m_iVer & VER_REPLY_PACKED )!=0;
 
 					if ( !tAgent.m_pReplyBuf )
 					{
@@ -1694,44 +2820,11 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 				// if reply was fully received, parse it
 				if ( tAgent.m_eState==AGENT_REPLY && tAgent.m_iReplyRead==tAgent.m_iReplySize )
 				{
-					MemInputBuffer_c tReq ( tAgent.m_pReplyBuf, tAgent.m_iReplySize );
-
-					// absolve thy former sins
-					tAgent.m_sFailure = "";
-
-					// check for general errors/warnings first
-					if ( tAgent.m_iReplyStatus==SEARCHD_WARNING )
-					{
-						CSphString sAgentWarning = tReq.GetString ();
-						tAgent.m_sFailure.SetSprintf ( "remote warning: %s", sAgentWarning.cstr() );
-						bWarnings = true;
-
-					} else if ( tAgent.m_iReplyStatus==SEARCHD_RETRY )
-					{
-						tAgent.m_eState = AGENT_RETRY;
-						CSphString sAgentError = tReq.GetString ();
-						tAgent.m_sFailure.SetSprintf ( "remote warning: %s", sAgentError.cstr() );
-						break;
-
-					} else if ( tAgent.m_iReplyStatus!=SEARCHD_OK )
-					{
-						CSphString sAgentError = tReq.GetString ();
-						tAgent.m_sFailure.SetSprintf ( "remote error: %s", sAgentError.cstr() );
-						break;
-					}
-
-					// call parser
-					if ( !tParser.ParseReply ( tReq, tAgent ) )
+					if ( !ParseAgentReply ( tAgent, tParser, bWarnings ) )
 						break;
 
-					// check if there was enough data
-					if ( tReq.GetError() )
-					{
-						tAgent.Fail ( eWrongReplies, "incomplete reply" );
-						break;
-					}
-
 					pEvents->IterateRemove ( tAgent.m_iSock );
+					tAgent.m_bPolled = false;
 					--iEvents;
 					// all is well
 					iAgents++;
@@ -1746,6 +2839,7 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 			if ( bFailure )
 			{
 				pEvents->IterateRemove ( tAgent.m_iSock );
+				tAgent.m_bPolled = false;
 				--iEvents;
 				tAgent.Close ();
 				tAgent.m_dResults.Reset ();
@@ -1754,11 +2848,36 @@ int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IRepl
 				ARRAY_FOREACH_COND ( i, tAgent.m_dResults, !bWarnings )
 					bWarnings = !tAgent.m_dResults[i].m_sWarning.IsEmpty();
 				agent_stats_inc ( tAgent, bWarnings ? eNetworkCritical : eNetworkNonCritical );
+				RemoteResolveHedge ( tAgent );
 			}
 		}
 	}
 
+	// rival cancelled by the last reply is still polled
+	if ( dHedges.GetLength() )
+		RemoteDropCancelled ( pEvents, pWaiter, iEvents );
 	SafeDelete(pEvents);
+	for ( auto & tAgent : dAgents )
+		tAgent.m_bPolled = false;
+
+	// hedges still in flight have lost
+	for ( auto * pHedge : dHedges )
+	{
+		if ( bTimeout && ( pHedge->m_eState==AGENT_QUERYED || pHedge->m_eState==AGENT_PREREPLY || pHedge->m_eState==AGENT_REPLY ) )
+			pHedge->Fail ( eTimeoutsQuery, "query timed out" );
+		// only an idle connection might go back to persistent pool
+		if ( pHedge->m_eState!=AGENT_UNUSED )
+			pHedge->Close ();
+		pHedge->m_pHedgeOf->m_pHedge = nullptr;
+		SafeDelete ( pHedge );
+	}
+
+	// waiter is about to go away
+	if ( pWaiter )
+		for ( auto & tAgent : dAgents )
+			if ( tAgent.m_pMuxReq )
+				tAgent.m_pMuxConn->Attach ( tAgent.m_pMuxReq, nullptr );
+	SafeDelete ( pWaiter );
 
 	// close timed-out agents
 	ARRAY_FOREACH ( iAgent, dAgents )
@@ -38,6 +38,8 @@ extern int				g_iReadTimeout; // defined in searchd.cpp
 extern int				g_iPingInterval;		// by default ping HA agents every 1 second
 extern DWORD			g_uHAPeriodKarma;		// by default use the last 1 minute statistic to determine the best HA agent
 extern int				g_iPersistentPoolSize;
+extern bool				g_bAgentMultiplex;		// persistent agents share one tagged connection per host
+extern bool				g_bAgentCompression;	// ask agents for compressed search replies
 
 extern int				g_iAgentConnectTimeout;
 extern int				g_iAgentQueryTimeout;	// global (default). May be override by index-scope values, if one specified
@@ -92,6 +94,9 @@ enum HostStats_e
 	ehConnTries,		///< total number of connect tries
 	ehAverageMsecs,		///< average connect time
 	ehMaxMsecs,			///< maximal connect time
+	ehPackedReplies,	///< number of compressed replies
+	ehReplyBytes,		///< reply bytes received over the wire
+	ehUnpackedBytes,	///< reply bytes after decompression
 	ehMaxStat
 };
 
@@ -136,6 +141,35 @@ public:
 
 void ClosePersistentSockets();
 
+struct AgentConn_t;
+class AgentMuxConn_c;
+struct AgentMuxRequest_t;
+
+// manages multiplexed connection to a host (agent_multiplex mode)
+// all persistent queries to the host share one socket; requests are tagged with ids
+// and replies might come back in any order, the reader thread of the connection routes them
+class AgentMux_c : public ISphNoncopyable
+{
+public:
+	AgentMux_c ();
+	~AgentMux_c ();
+
+	bool				IsSupported () const;
+	// returns addref'ed live connection, (re)connects if necessary
+	AgentMuxConn_c *	GetConn ( const AgentConn_t & tAgent, bool & bUnsupported, CSphString & sError ) EXCLUDES ( m_tLock );
+	void				Shutdown () EXCLUDES ( m_tLock );
+
+private:
+	AgentMuxConn_c *	GetLiveConn () const REQUIRES ( m_tLock );
+
+	CSphMutex			m_tLock;
+	AgentMuxConn_c *	m_pConn GUARDED_BY ( m_tLock );
+	bool				m_bShutdown GUARDED_BY ( m_tLock );
+	volatile int64_t	m_tmRecheck;	// agent refused to multiplex, don't ask it again until then
+};
+
+int GetAgentMuxConnections ();
+
 struct AgentStats_t : public ISphRefcountedMT
 {
 	// was uint64_t, but for atomic it creates extra tmpl instantiation without practical difference
@@ -207,12 +241,16 @@ struct AgentConn_t : public AgentDesc_c
 {
 	int				m_iSock;		///< socket number, -1 if not connected
 	bool			m_bFresh;		///< just created persistent connection, need SEARCHD_COMMAND_PERSIST
+	bool			m_bMux;			///< query goes via multiplexed connection of the host
+	AgentMuxConn_c *	m_pMuxConn;	///< multiplexed connection in use (addref'ed), NULL if none
+	AgentMuxRequest_t *	m_pMuxReq;	///< in-flight multiplexed request (addref'ed), NULL if none
 	AgentState_e	m_eState;		///< current state
 
 	bool			m_bSuccess;		///< whether last request was successful (ie. there are available results)
 	CSphString		m_sFailure;		///< failure message
 
 	int				m_iReplyStatus;	///< reply status code
+	bool			m_bReplyPacked;	///< reply body is compressed
 	int				m_iReplySize;	///< how many reply bytes are there
 	int				m_iReplyRead;	///< how many reply bytes are alredy received
 	int 			m_iRetries;		///< count from 0 to m_iRetryLimit
@@ -230,35 +268,69 @@ struct AgentConn_t : public AgentDesc_c
 	int				m_iWeight;
 	bool			m_bPing;
 	MultiAgentDesc_t*	m_pMirrorChooser; ///< used to select another mirror if this one is broken
+	AgentConn_t *	m_pHedge;		///< hedged request to another mirror, if any
+	AgentConn_t *	m_pHedgeOf;		///< for hedged request, the agent it races with
+	int64_t			m_tmHedge;		///< when to send hedged request; 0 if not computed yet, -1 if never
+	bool			m_bPolled;		///< socket is set up in RemoteWaitForAgents poller
 
 public:
 	AgentConn_t ();
 	~AgentConn_t ();
 
 	void Close ( bool bClosePersist=true );
+	void ReleaseMux ();
+	void RentPersistent ();
 	void Fail ( AgentStats_e eStat, const char* sMessage, ... ) __attribute__ ( ( format ( printf, 3, 4 ) ) );
 
 	// works like =, but also adopt the persistent connection, if any.
 	void SpecifyAndSelectMirror ( MultiAgentDesc_t * pMirrorChooser = nullptr );
+	void SetMirror ( const AgentDesc_c & tMirror );
 	int NumOfMirrors () const;
 	AgentConn_t & operator = ( const HostUrl_c & rhs );
 };
 
 extern const char * sAgentStatsNames[eMaxAgentStat + ehMaxStat];
 
+/// query latency histogram buckets (half-octaves of microseconds)
+const int LATENCY_BUCKETS = 64;
+
+/// bucket of the given latency, in microseconds
+inline int LatencyBucket ( int64_t iLatency )
+{
+	if ( iLatency<2 )
+		return 0;
+	int iOctave = sphLog2 ( iLatency ) - 1;
+	int iBucket = iOctave*2 + int ( ( iLatency >> ( iOctave-1 ) ) & 1 );
+	return Min ( iBucket, LATENCY_BUCKETS-1 );
+}
+
+/// upper bound of the bucket latencies, in microseconds
+inline int64_t LatencyBucketTop ( int iBucket )
+{
+	int iOctave = iBucket/2;
+	if ( iBucket & 1 )
+		return I64C(1) << ( iOctave+1 );
+	return iOctave ? ( I64C(3) << ( iOctave-1 ) ) : 2;
+}
+
 struct AgentDash_t : AgentStats_t
 {
 	uint64_t		m_dHostStats[ehMaxStat];
 	DWORD			m_uTimestamp;	///< adds the minutes timestamp to AgentStats_t
+	DWORD			m_dLatency[LATENCY_BUCKETS];	///< latencies of successful queries
 	void Reset ()
 	{
 		AgentStats_t::Reset ();
 		for ( int i = 0; i<ehMaxStat; ++i )
 			m_dHostStats[i] = 0;
+		for ( int i = 0; i<LATENCY_BUCKETS; ++i )
+			m_dLatency[i] = 0;
 	}
 	void Add ( const AgentDash_t& rhs )
 	{
 		AgentStats_t::Add ( rhs );
+		for ( int i = 0; i<LATENCY_BUCKETS; ++i )
+			m_dLatency[i] += rhs.m_dLatency[i];
 
 		if ( m_dHostStats[ehConnTries] )
 			m_dHostStats[ehAverageMsecs] =
@@ -269,6 +341,9 @@ struct AgentDash_t : AgentStats_t
 			m_dHostStats[ehAverageMsecs] = rhs.m_dHostStats[ehAverageMsecs];
 		m_dHostStats[ehMaxMsecs] = Max ( m_dHostStats[ehMaxMsecs], rhs.m_dHostStats[ehMaxMsecs] );
 		m_dHostStats[ehConnTries] += rhs.m_dHostStats[ehConnTries];
+		m_dHostStats[ehPackedReplies] += rhs.m_dHostStats[ehPackedReplies];
+		m_dHostStats[ehReplyBytes] += rhs.m_dHostStats[ehReplyBytes];
+		m_dHostStats[ehUnpackedBytes] += rhs.m_dHostStats[ehUnpackedBytes];
 	}
 };
 
@@ -286,6 +361,7 @@ struct HostDashboard_t : public ISphRefcountedMT
 	int64_t		m_iErrorsARow GUARDED_BY ( m_dDataLock );			// num of errors a row, updated when we update the general statistic.
 
 	PersistentConnectionsPool_t*	m_pPersPool;					// persistence pool also lives here, one per dashboard
+	AgentMux_c*		m_pMux;					// multiplexed connection, one per dashboard
 
 private:
 	AgentDash_t	m_dStats[STATS_DASH_TIME] GUARDED_BY ( m_dDataLock );
@@ -298,13 +374,18 @@ public:
 	static bool IsHalfPeriodChanged ( DWORD * pLast );
 	AgentDash_t*	GetCurrentStat() REQUIRES ( m_dDataLock );
 	void GetCollectedStat ( HostStatSnapshot_t& dResult, int iPeriods=1 ) const EXCLUDES ( m_dDataLock );
+	int64_t GetLatencyPercentile ( int iPercent, int iPeriods=1 ) const EXCLUDES ( m_dDataLock );
 };
 
+/// ha_hedge_delay value which means 'use p95 latency of the mirror'
+const int HEDGE_DELAY_AUTO = -1;
+
 struct AgentOptions_t
 {
 	bool m_bBlackhole;
 	bool m_bPersistent;
 	HAStrategies_e m_eStrategy;
+	int m_iHedgeDelay;			///< msec to wait before hedging to another mirror, 0 is off, HEDGE_DELAY_AUTO is p95
 };
 
 /// descriptor for set of agents (mirrors) (stored in a global hash)
@@ -319,12 +400,14 @@ private:
 			GUARDED_BY (m_dWeightLock);
 	DWORD					m_uTimestamp;	/// timestamp of last weight's actualization
 	HAStrategies_e			m_eStrategy;
+	int						m_iHedgeDelay;	/// see AgentOptions_t
 
 public:
 	MultiAgentDesc_t ()
 		: m_dWeights ( 0 )
 		, m_uTimestamp ( HostDashboard_t::GetCurSeconds () )
 		, m_eStrategy ( HA_DEFAULT )
+		, m_iHedgeDelay ( 0 )
 	{
 		m_dWeightLock.Init();
 	}
@@ -347,6 +430,7 @@ public:
 	AgentDesc_c * NewAgent ();
 	AgentDesc_c * GetAgent ( int iAgent=0 );
 	const AgentDesc_c & ChooseAgent ();
+	const AgentDesc_c * ChooseHedge ( const HostDashboard_t * pExclude );
 
 	void SetOptions ( const AgentOptions_t& tOpt );
 	void FinalizeInitialization () NO_THREAD_SAFETY_ANALYSIS;
@@ -362,6 +446,11 @@ public:
 		return m_dHosts.GetLength();
 	}
 
+	inline int GetHedgeDelay() const
+	{
+		return m_iHedgeDelay;
+	}
+
 	inline bool IsInitFinished() const REQUIRES_SHARED (m_dWeightLock)
 	{
 		return m_dHosts.GetLength () == m_dWeights.GetLength ();
@@ -401,6 +490,8 @@ struct SearchdStats_t
 	CSphAtomicL		m_iCommandCount[SEARCHD_COMMAND_TOTAL];
 	CSphAtomicL		m_iAgentConnect;
 	CSphAtomicL		m_iAgentRetry;
+	CSphAtomicL		m_iAgentHedged;		///< hedged requests sent to another mirror
+	CSphAtomicL		m_iAgentHedgeWins;	///< hedged requests which replied first
 
 	CSphAtomicL		m_iQueries;			///< search queries count (differs from search commands count because of multi-queries)
 	CSphAtomicL		m_iQueryTime;		///< wall time spent (including network wait time)
@@ -478,7 +569,7 @@ bool ConfigureAgent ( MultiAgentDesc_t & tAgent, const char * szAgent, const cha
 struct IRequestBuilder_t : public ISphNoncopyable
 {
 	virtual ~IRequestBuilder_t () {} // to avoid gcc4 warns
-	virtual void BuildRequest ( AgentConn_t & tAgent, NetOutputBuffer_c & tOut ) const = 0;
+	virtual void BuildRequest ( AgentConn_t & tAgent, ISphOutputBuffer & tOut ) const = 0;
 };
 
 
@@ -511,7 +602,8 @@ int RemoteQueryAgents ( AgentConnectionContext_t * pCtx );
 
 // processing states AGENT_QUERY, AGENT_PREREPLY and AGENT_REPLY
 // may work in parallel with RemoteQueryAgents, so the state MAY change during a call.
-int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IReplyParser_t & tParser );
+// if request builder is given, agents which are late to reply are hedged to another mirror (see ha_hedge_delay)
+int RemoteWaitForAgents ( CSphVector<AgentConn_t> & dAgents, int iTimeout, IReplyParser_t & tParser, const IRequestBuilder_t * pBuilder=nullptr );
 
 
 class ISphRemoteAgentsController : ISphNoncopyable
@@ -247,6 +247,8 @@ static void EncodeResultJson ( const AggrResult_t & tRes, CSphStringBuilderJson
 	tOut += "{";
 
 	tOut.Appendf ( "\"total\":%d, \"total_found\":" INT64_FMT ", \"time\":%d.%03d,", tRes.m_iMatches, tRes.m_iTotalMatches, tRes.m_iQueryTime/1000, tRes.m_iQueryTime%1000 );
+	if ( !tRes.m_sNextSearchAfter.IsEmpty() )
+		tOut.Appendf ( "\"next_search_after\":\"%s\",", tRes.m_sNextSearchAfter.cstr() );
 
 	// word statistics
 	AppendJsonKey ( "words", tOut );
@@ -559,6 +561,13 @@ static void ParseSearchOptions ( const SmallStringHash_T<CSphString> & hOptions,
 	const CSphString * pLimit = hOptions ( "limit" );
 	if ( pLimit )
 		tQuery.m_iLimit = atoi ( pLimit->cstr() );
+
+	const CSphString * pAfter = hOptions ( "search_after" );
+	if ( pAfter )
+	{
+		tQuery.m_sSearchAfter = *pAfter;
+		tQuery.m_bSearchAfter = true;
+	}
 }
 
 static const char * g_sIndexPage =
@@ -74,6 +74,14 @@
 #include <re2/re2.h>
 #endif
 
+// vectorized ascii tokenizing path; picked at runtime, so the build itself needs no -m flags
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) ) && !defined(__INTEL_COMPILER)
+#define SPH_ASCII_SIMD 1
+#include <immintrin.h>
+#else
+#define SPH_ASCII_SIMD 0
+#endif
+
 #if USE_WINDOWS
 	#include <io.h> // for open()
 
@@ -171,6 +179,8 @@ const char *		MAGIC_WORD_PARAGRAPH	= "\3paragraph";	// emitted from source on pa
 bool				g_bJsonStrict				= false;
 bool				g_bJsonAutoconvNumbers		= false;
 bool				g_bJsonKeynamesToLowercase	= false;
+int					g_iJsonKeyDirectory			= 0;
+bool				g_bTokenizerAsciiFast		= true;
 
 static const int	DEFAULT_READ_BUFFER		= 262144;
 static const int	DEFAULT_READ_UNHINTED	= 32768;
@@ -311,6 +321,175 @@ void CSphIOStats::Add ( const CSphIOStats & b )
 	m_iWriteBytes += b.m_iWriteBytes;
 }
 
+//////////////////////////////////////////////////////////////////////////
+
+// whatever to use per-query match arenas
+static bool g_bMatchArena = false;
+static SphThreadKey_t g_tMatchArenaTls;
+
+static const int MATCH_ARENA_MIN_CHUNK = 4096;		// in rowitems, that is, 16K
+static const int MATCH_ARENA_MAX_CHUNK = 262144;	// in rowitems, that is, 1M
+static const long MATCH_ARENA_BIAS = 1<<30;		// arena own reference, keeps the chunk alive while rows are not yet accounted
+
+/// arena chunk
+/// rows are prefixed with 2 rowitems, the row offset within chunk data (0 for heap rows), and the row size
+/// chunk data starts with a back pointer to the chunk itself, so that any row could find its chunk
+struct MatchArenaChunk_t
+{
+	CSphAtomic		m_iRefs;	///< live rows, plus arena bias until it retires the chunk
+	CSphRowitem *	m_pData;
+};
+STATIC_ASSERT ( sizeof(MatchArenaChunk_t *)<=2*sizeof(CSphRowitem), MATCH_ARENA_BACK_POINTER_FITS );
+
+
+bool sphInitMatchArena ()
+{
+	if ( !sphThreadKeyCreate ( &g_tMatchArenaTls ) )
+		return false;
+
+	g_bMatchArena = true;
+	return true;
+}
+
+void sphDoneMatchArena ()
+{
+	sphThreadKeyDelete ( g_tMatchArenaTls );
+	g_bMatchArena = false;
+}
+
+
+static CSphRowitem * AllocHeapMatchRow ( int iDynamic )
+{
+	CSphRowitem * pRow = new CSphRowitem [ iDynamic+2 ];
+	pRow[0] = 0;
+	pRow[1] = iDynamic;
+	return pRow+2;
+}
+
+
+static void FreeMatchArenaChunk ( MatchArenaChunk_t * pChunk )
+{
+	SafeDeleteArray ( pChunk->m_pData );
+	SafeDelete ( pChunk );
+}
+
+
+CSphMatchArena::CSphMatchArena ()
+	: m_bEnabled ( false )
+	, m_pPrev ( NULL )
+	, m_pChunk ( NULL )
+	, m_iChunkItems ( 0 )
+	, m_iUsed ( 0 )
+	, m_iRows ( 0 )
+{}
+
+
+CSphMatchArena::~CSphMatchArena ()
+{
+	Stop();
+}
+
+
+void CSphMatchArena::Start()
+{
+	if ( !g_bMatchArena || m_bEnabled )
+		return;
+
+	// nested queries (eg. disk chunks of RT index, or local indexes of a distributed one) share the outermost arena
+	m_pPrev = (CSphMatchArena *)sphThreadGet ( g_tMatchArenaTls );
+	if ( m_pPrev )
+		return;
+
+	sphThreadSet ( g_tMatchArenaTls, this );
+	m_bEnabled = true;
+}
+
+
+void CSphMatchArena::Stop()
+{
+	if ( !m_bEnabled )
+		return;
+
+	m_bEnabled = false;
+	Retire();
+	sphThreadSet ( g_tMatchArenaTls, m_pPrev );
+}
+
+
+void CSphMatchArena::Retire()
+{
+	if ( !m_pChunk )
+		return;
+
+	// drop the bias; whoever brings the refcount to zero (us or the last row) frees the chunk
+	long iDrop = MATCH_ARENA_BIAS - m_iRows;
+	if ( m_pChunk->m_iRefs.Sub ( iDrop )==iDrop )
+		FreeMatchArenaChunk ( m_pChunk );
+
+	m_pChunk = NULL;
+	m_iUsed = 0;
+	m_iRows = 0;
+}
+
+
+CSphRowitem * CSphMatchArena::Alloc ( int iDynamic )
+{
+	assert ( m_bEnabled );
+
+	// header and data, rounded up to keep rows 8-byte aligned
+	int iItems = ( iDynamic+3 ) & ~1;
+	if ( iItems>MATCH_ARENA_MAX_CHUNK/4 )
+		return AllocHeapMatchRow ( iDynamic );
+
+	if ( !m_pChunk || m_iUsed+iItems>m_iChunkItems )
+	{
+		Retire();
+
+		m_iChunkItems = m_iChunkItems ? Min ( m_iChunkItems*2, MATCH_ARENA_MAX_CHUNK ) : MATCH_ARENA_MIN_CHUNK;
+		m_pChunk = new MatchArenaChunk_t;
+		m_pChunk->m_iRefs.SetValue ( MATCH_ARENA_BIAS );
+		m_pChunk->m_pData = new CSphRowitem [ m_iChunkItems ];
+		*(MatchArenaChunk_t **)m_pChunk->m_pData = m_pChunk;
+		m_iUsed = 2; // skip back pointer
+	}
+
+	CSphRowitem * pRow = m_pChunk->m_pData + m_iUsed;
+	pRow[0] = m_iUsed;
+	pRow[1] = iDynamic;
+	m_iUsed += iItems;
+	m_iRows++;
+	return pRow+2;
+}
+
+
+CSphRowitem * sphAllocMatchRow ( int iDynamic )
+{
+	assert ( iDynamic>0 );
+	if ( g_bMatchArena )
+	{
+		CSphMatchArena * pArena = (CSphMatchArena *)sphThreadGet ( g_tMatchArenaTls );
+		if ( pArena )
+			return pArena->Alloc ( iDynamic );
+	}
+	return AllocHeapMatchRow ( iDynamic );
+}
+
+
+void sphFreeMatchRow ( CSphRowitem * pRow )
+{
+	assert ( pRow );
+	CSphRowitem * pHeader = pRow-2;
+	if ( !pHeader[0] )
+	{
+		delete [] pHeader;
+		return;
+	}
+
+	MatchArenaChunk_t * pChunk = *(MatchArenaChunk_t **)( pHeader - pHeader[0] );
+	if ( pChunk->m_iRefs.Dec()==1 )
+		FreeMatchArenaChunk ( pChunk );
+}
+
 
 static CSphIOStats * GetIOStats ()
 {
@@ -1075,12 +1254,22 @@ struct DictHeader_t
 	int64_t			m_iInfixBlocksOffset;		///< infix blocks file position (stored as unsigned 32bit int as keywords dictionary is pretty small)
 	int				m_iInfixBlocksWordsSize;	///< infix checkpoints size
 
+	bool			m_bBuildFst;				///< whether to build keywords FST on dictionary save
+	int64_t			m_iFstOffset;				///< keywords FST file position (0 means no FST)
+
+	bool			m_bBuildTrigrams;			///< whether to build infix trigrams on dictionary save
+	int64_t			m_iTrigramsOffset;			///< infix trigrams file position (0 means no trigrams)
+
 	DictHeader_t()
 		: m_iDictCheckpoints ( 0 )
 		, m_iDictCheckpointsOffset ( 0 )
 		, m_iInfixCodepointBytes ( 0 )
 		, m_iInfixBlocksOffset ( 0 )
 		, m_iInfixBlocksWordsSize ( 0 )
+		, m_bBuildFst ( false )
+		, m_iFstOffset ( 0 )
+		, m_bBuildTrigrams ( false )
+		, m_iTrigramsOffset ( 0 )
 	{}
 };
 
@@ -1108,6 +1297,8 @@ public:
 	SphOffset_t									m_iWordsEnd;			///< end of wordlist
 	bool										m_bHaveSkips;			///< whether there are skiplists
 	CSphScopedPtr<ISphCheckpointReader>			m_tMapedCpReader;
+	KeywordsFst_c								m_tFst;					///< keywords FST, if any (checkpoint words are not loaded then)
+	InfixTrigrams_c								m_tTrigrams;			///< infix trigrams, if any
 
 public:
 										CWordlist ();
@@ -1125,11 +1316,22 @@ public:
 	virtual void						SuffixGetChekpoints ( const SuggestResult_t & tRes, const char * sSuffix, int iLen, CSphVector<DWORD> & dCheckpoints ) const;
 	virtual void						SetCheckpoint ( SuggestResult_t & tRes, DWORD iCP ) const;
 	virtual bool						ReadNextWord ( SuggestResult_t & tRes, DictWord_t & tWord ) const;
+	void								GetFuzzyWords ( const SuggestArgs_t & tArgs, SuggestResult_t & tRes ) const;
 
 	void								DebugPopulateCheckpoints();
 
 private:
 	bool								m_bWordDict;
+
+	// infix expansion cache, matching keyword ordinals by wildcard
+	// wordlist never changes once loaded, so the cache lives as long as this index generation does
+	static const int					INFIX_CACHE_ORDINALS	= 1048576;
+	mutable CSphMutex					m_tInfixCacheLock;
+	mutable SmallStringHash_T < CSphVector<int> >	m_hInfixCache;
+	mutable int							m_iInfixCacheOrdinals;
+
+	bool								GetCachedInfix ( const CSphString & sKey, CSphVector<int> & dOrdinals ) const;
+	void								CacheInfix ( const CSphString & sKey, const CSphVector<int> & dOrdinals ) const;
 };
 
 
@@ -1146,6 +1348,7 @@ struct BuildHeader_t : public CSphSourceStats, public DictHeader_t
 		, m_uKillListSize ( 0 )
 		, m_iMinMaxIndex ( 0 )
 		, m_iTotalDups ( 0 )
+		, m_bVerbatimStrings ( false )
 	{
 		m_iTotalDocuments = tStat.m_iTotalDocuments;
 		m_iTotalBytes = tStat.m_iTotalBytes;
@@ -1158,6 +1361,7 @@ struct BuildHeader_t : public CSphSourceStats, public DictHeader_t
 	DWORD				m_uKillListSize;
 	int64_t				m_iMinMaxIndex;
 	int					m_iTotalDups;
+	bool				m_bVerbatimStrings;	///< string pool was rewritten without dictionaries (merge)
 };
 
 const char* CheckFmtMagic ( DWORD uHeader )
@@ -1304,6 +1508,7 @@ public:
 	virtual void				DebugDumpHitlist ( FILE * , const char * , bool ) {}
 	virtual int					DebugCheck ( FILE * ) { return 0; } // NOLINT
 	virtual void				DebugDumpDict ( FILE * ) {}
+	virtual void				DebugEstimateReorder ( FILE *, const char * ) {}
 	virtual	void				SetProgressCallback ( CSphIndexProgress::IndexingProgress_fn ) {}
 };
 
@@ -1393,6 +1598,22 @@ CSphIndex * sphCreateIndexTemplate ( )
 }
 
 
+/// fullscan narrowed down to geo grid cells
+struct GeoScan_t
+{
+	GeoGrid_c::Box_t	m_tBox;			///< box implied by lat/lon range and geodist() filters
+	bool				m_bNearest;		///< whether to search nearest-first for ORDER BY geodist() ASC
+	GeodistSettings_t	m_tDist;		///< sorting geodist() settings
+	CSphAttrLocator		m_tDistLoc;		///< sorting geodist() value in the match
+	int					m_iNearest;		///< how many nearest matches the sorter needs
+
+	GeoScan_t ()
+		: m_bNearest ( false )
+		, m_iNearest ( 0 )
+	{}
+};
+
+
 /// this is my actual VLN-compressed phrase index implementation
 class CSphIndex_VLN : public CSphIndex
 {
@@ -1415,9 +1636,11 @@ public:
 	virtual void				DebugDumpDocids ( FILE * fp );
 	virtual void				DebugDumpHitlist ( FILE * fp, const char * sKeyword, bool bID );
 	virtual void				DebugDumpDict ( FILE * fp );
+	virtual void				DebugEstimateReorder ( FILE * fp, const char * sAttr );
 	virtual void				SetDebugCheck ();
 	virtual int					DebugCheck ( FILE * fp );
 	template <class Qword> void	DumpHitlist ( FILE * fp, const char * sKeyword, bool bID );
+	template <class Qword> void	EstimateReorder ( FILE * fp, const CSphFixedVector<DWORD> & dRank );
 
 	virtual bool				Prealloc ( bool bStripPath );
 	virtual void				Dealloc ();
@@ -1457,6 +1680,7 @@ public:
 	virtual SphDocID_t *		GetKillList () const;
 	virtual int					GetKillListSize () const;
 	virtual bool				HasDocid ( SphDocID_t uDocid ) const;
+	virtual bool				GetDocidRange ( SphDocID_t & uMin, SphDocID_t & uMax ) const;
 
 	virtual const CSphSourceStats &		GetStats () const { return m_tStats; }
 	virtual int64_t *					GetFieldLens() const { return m_tSettings.m_bIndexFieldLens ? m_dFieldLens.Begin() : NULL; }
@@ -1505,6 +1729,10 @@ private:
 	// recalculate on attr load complete
 	CSphLargeBuffer<DWORD>							m_tDocinfoHash;		///< hashed ids, to accelerate lookups
 	CSphLargeBuffer<DWORD>							m_tMinMaxLegacy;
+	GeoGrid_c										m_tGeoGrid;			///< lat/lon cells, to narrow down geodist() fullscans
+	bool											m_bGeoGridStale;	///< grid attributes were updated since the grid was built
+	CSphFixedVector<DWORD>							m_dAttrOrder;		///< row numbers in sort_by attribute order, to stop ORDER BY fullscans early
+	bool											m_bAttrOrderStale;	///< sort_by attribute was updated since the order was built
 
 	bool						m_bMlock;
 	bool						m_bOndiskAllAttr;
@@ -1530,6 +1758,12 @@ private:
 
 	bool						ParsedMultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult, int iSorters, ISphMatchSorter ** ppSorters, const XQQuery_t & tXQ, CSphDict * pDict, const CSphMultiQueryArgs & tArgs, CSphQueryNodeCache * pNodeCache, const SphWordStatChecker_t & tStatDiff ) const;
 	bool						MultiScan ( const CSphQuery * pQuery, CSphQueryResult * pResult, int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const;
+	bool						SetupGeoScan ( const CSphQuery * pQuery, const ISphSchema & tSchema, int iSorters, GeoScan_t & tScan ) const;
+	void						BuildGeoGrid ();
+	int							GetOrderedScanLimit ( const CSphQuery * pQuery, int iSorters, bool & bDesc ) const;
+	void						BuildAttrOrder ();
+	bool						ScanRow ( const DWORD * pDocinfo, CSphQueryContext & tCtx, CSphMatch & tMatch, CSphQueryResult * pResult,
+									int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs, bool bRandomize ) const;
 	void						MatchExtended ( CSphQueryContext * pCtx, const CSphQuery * pQuery, int iSorters, ISphMatchSorter ** ppSorters, ISphRanker * pRanker, int iTag, int iIndexWeight ) const;
 
 	const DWORD *				FindDocinfo ( SphDocID_t uDocID ) const;
@@ -2404,6 +2638,7 @@ protected:
 	BYTE *						DoGetToken();
 
 	void						FlushAccum ();
+	inline void					AccumAsciiRun ();
 
 public:
 	virtual int		SkipBlended ();
@@ -2798,7 +3033,10 @@ enum
 
 CSphLowercaser::CSphLowercaser ()
 	: m_pData ( NULL )
+	, m_bAsciiCaseOnly ( false )
 {
+	memset ( m_dAsciiFold, 0, sizeof(m_dAsciiFold) );
+	memset ( m_dAsciiClass, 0, sizeof(m_dAsciiClass) );
 }
 
 
@@ -2811,6 +3049,7 @@ void CSphLowercaser::Reset()
 	m_pChunk[0] = m_pData; // chunk 0 must always be allocated, for utf-8 tokenizer shortcut to work
 	for ( int i=1; i<CHUNK_COUNT; i++ )
 		m_pChunk[i] = NULL;
+	UpdateAsciiTables();
 }
 
 
@@ -2835,6 +3074,7 @@ void CSphLowercaser::SetRemap ( const CSphLowercaser * pLC )
 		m_pChunk[i] = pLC->m_pChunk[i]
 			? pLC->m_pChunk[i] - pLC->m_pData + m_pData
 			: NULL;
+	UpdateAsciiTables();
 }
 
 
@@ -2918,6 +3158,8 @@ void CSphLowercaser::AddRemaps ( const CSphVector<CSphRemapRange> & dRemaps, DWO
 			iCodepoint = iNew;
 		}
 	}
+
+	UpdateAsciiTables();
 }
 
 
@@ -2969,6 +3211,160 @@ int CSphLowercaser::GetMaxCodepointLength () const
 	return 3; // actually, 4 once we hit 0x10000
 }
 
+
+void CSphLowercaser::UpdateAsciiTables ()
+{
+	memset ( m_dAsciiFold, 0, sizeof(m_dAsciiFold) );
+	memset ( m_dAsciiClass, 0, sizeof(m_dAsciiClass) );
+	m_bAsciiCaseOnly = true;
+
+	if ( !m_pChunk[0] )
+		return;
+
+	// only chars that fold to a plain ascii char with no flags at all are eligible
+	// everything else (separators, specials, blended, ignored, boundaries, remaps to non-ascii) takes the slow path
+	for ( int i=1; i<128; i++ )
+	{
+		int iCode = m_pChunk[0][i];
+		if ( ( iCode & MASK_FLAGS ) || iCode<=0 || iCode>=128 )
+			continue;
+
+		m_dAsciiFold[i] = (BYTE)iCode;
+		m_dAsciiClass[i & 15] |= (BYTE)( 1 << ( i>>4 ) );
+		bool bUpper = ( i>='A' && i<='Z' );
+		if ( iCode!=( bUpper ? i+32 : i ) )
+			m_bAsciiCaseOnly = false;
+	}
+}
+
+
+static int AsciiRunScalar ( const BYTE * pSrc, const BYTE * pMax, const BYTE * dFold, const BYTE * )
+{
+	const BYTE * p = pSrc;
+	while ( p<pMax && *p<128 && dFold[*p] )
+		p++;
+	return p-pSrc;
+}
+
+
+static void AsciiFoldScalar ( BYTE * pDst, const BYTE * pSrc, int iLen, const BYTE * dFold, bool )
+{
+	for ( int i=0; i<iLen; i++ )
+		pDst[i] = dFold[pSrc[i]];
+}
+
+
+#if SPH_ASCII_SIMD
+
+// plain char classification is a 128-bit bitmap lookup done with two nibble shuffles;
+// bytes 0x80 and above have a high nibble of 8..15 that maps to an empty mask, so they always terminate the run
+
+__attribute__ ( ( target ( "ssse3" ) ) )
+static int AsciiRunSSSE3 ( const BYTE * pSrc, const BYTE * pMax, const BYTE * dFold, const BYTE * dClass )
+{
+	const __m128i tClassLo = _mm_loadu_si128 ( (const __m128i *)dClass );
+	const __m128i tClassHi = _mm_setr_epi8 ( 1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const __m128i tNibble = _mm_set1_epi8 ( 0x0f );
+
+	const BYTE * p = pSrc;
+	for ( ; p+16<=pMax; p+=16 )
+	{
+		__m128i tData = _mm_loadu_si128 ( (const __m128i *)p );
+		__m128i tLo = _mm_shuffle_epi8 ( tClassLo, _mm_and_si128 ( tData, tNibble ) );
+		__m128i tHi = _mm_shuffle_epi8 ( tClassHi, _mm_and_si128 ( _mm_srli_epi16 ( tData, 4 ), tNibble ) );
+		int iMiss = _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( _mm_and_si128 ( tLo, tHi ), _mm_setzero_si128() ) );
+		if ( iMiss )
+			return p - pSrc + __builtin_ctz ( iMiss );
+	}
+
+	return p - pSrc + AsciiRunScalar ( p, pMax, dFold, dClass );
+}
+
+
+__attribute__ ( ( target ( "ssse3" ) ) )
+static void AsciiFoldSSSE3 ( BYTE * pDst, const BYTE * pSrc, int iLen, const BYTE * dFold, bool bCaseOnly )
+{
+	int i = 0;
+	if ( bCaseOnly )
+	{
+		const __m128i tBeforeA = _mm_set1_epi8 ( 'A'-1 );
+		const __m128i tAfterZ = _mm_set1_epi8 ( 'Z'+1 );
+		const __m128i tCase = _mm_set1_epi8 ( 0x20 );
+		for ( ; i+16<=iLen; i+=16 )
+		{
+			__m128i tData = _mm_loadu_si128 ( (const __m128i *)( pSrc+i ) );
+			__m128i tUpper = _mm_and_si128 ( _mm_cmpgt_epi8 ( tData, tBeforeA ), _mm_cmplt_epi8 ( tData, tAfterZ ) );
+			_mm_storeu_si128 ( (__m128i *)( pDst+i ), _mm_add_epi8 ( tData, _mm_and_si128 ( tUpper, tCase ) ) );
+		}
+	}
+
+	AsciiFoldScalar ( pDst+i, pSrc+i, iLen-i, dFold, bCaseOnly );
+}
+
+
+__attribute__ ( ( target ( "avx2" ) ) )
+static int AsciiRunAVX2 ( const BYTE * pSrc, const BYTE * pMax, const BYTE * dFold, const BYTE * dClass )
+{
+	const __m256i tClassLo = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( (const __m128i *)dClass ) );
+	const __m256i tClassHi = _mm256_setr_epi8 ( 1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+		1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const __m256i tNibble = _mm256_set1_epi8 ( 0x0f );
+
+	const BYTE * p = pSrc;
+	for ( ; p+32<=pMax; p+=32 )
+	{
+		__m256i tData = _mm256_loadu_si256 ( (const __m256i *)p );
+		__m256i tLo = _mm256_shuffle_epi8 ( tClassLo, _mm256_and_si256 ( tData, tNibble ) );
+		__m256i tHi = _mm256_shuffle_epi8 ( tClassHi, _mm256_and_si256 ( _mm256_srli_epi16 ( tData, 4 ), tNibble ) );
+		DWORD uMiss = (DWORD)_mm256_movemask_epi8 ( _mm256_cmpeq_epi8 ( _mm256_and_si256 ( tLo, tHi ), _mm256_setzero_si256() ) );
+		if ( uMiss )
+			return p - pSrc + __builtin_ctz ( uMiss );
+	}
+
+	// most tokens are short, so the 16-byte tail is worth it
+	return p - pSrc + AsciiRunSSSE3 ( p, pMax, dFold, dClass );
+}
+
+#endif // SPH_ASCII_SIMD
+
+
+typedef int ( *AsciiRunFn_t ) ( const BYTE * pSrc, const BYTE * pMax, const BYTE * dFold, const BYTE * dClass );
+typedef void ( *AsciiFoldFn_t ) ( BYTE * pDst, const BYTE * pSrc, int iLen, const BYTE * dFold, bool bCaseOnly );
+
+static AsciiRunFn_t		g_fnAsciiRun	= AsciiRunScalar;
+static AsciiFoldFn_t	g_fnAsciiFold	= AsciiFoldScalar;
+
+
+/// pick the widest ascii fast path the cpu supports, once at startup
+static bool SetupAsciiFastPath ()
+{
+#if SPH_ASCII_SIMD
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports ( "ssse3" ) )
+	{
+		g_fnAsciiRun = AsciiRunSSSE3;
+		g_fnAsciiFold = AsciiFoldSSSE3;
+	}
+	if ( __builtin_cpu_supports ( "avx2" ) )
+		g_fnAsciiRun = AsciiRunAVX2;
+#endif
+	return true;
+}
+
+static bool g_bAsciiFastPathReady = SetupAsciiFastPath();
+
+
+int CSphLowercaser::GetAsciiRun ( const BYTE * pSrc, const BYTE * pMax ) const
+{
+	return g_fnAsciiRun ( pSrc, pMax, m_dAsciiFold, m_dAsciiClass );
+}
+
+
+void CSphLowercaser::FoldAsciiRun ( BYTE * pDst, const BYTE * pSrc, int iLen ) const
+{
+	g_fnAsciiFold ( pDst, pSrc, iLen, m_dAsciiFold, m_bAsciiCaseOnly );
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 const char * CSphCharsetDefinitionParser::GetLastError ()
@@ -4142,6 +4538,7 @@ void CSphTokenizerBase::CloneBase ( const CSphTokenizerBase * pFrom, ESphTokeniz
 			m_tLC.m_pData = NULL;
 			for ( int i=0; i<CSphLowercaser::CHUNK_COUNT; i++ )
 				m_tLC.m_pChunk[i] = pFrom->m_tLC.m_pChunk[i];
+			m_tLC.UpdateAsciiTables();
 			break;
 		}
 	}
@@ -5124,7 +5521,32 @@ BYTE * CSphTokenizerBase2::DoGetToken ()
 			m_iAccum++;
 			SPH_UTF8_ENCODE ( m_pAccum, iCode );
 		}
+
+		// we're inside a token now, so swallow the rest of its plain ascii chars in one go
+		// query mode (escapes, soft whitespace), blending, exceptions and sentences all need per-char handling
+		if_const ( !IS_QUERY && !IS_BLEND )
+			if ( !m_pExc && !m_bDetectSentences && g_bTokenizerAsciiFast )
+				AccumAsciiRun();
+	}
+}
+
+
+void CSphTokenizerBase2::AccumAsciiRun ()
+{
+	int iRun = m_tLC.GetAsciiRun ( m_pCur, m_pBufferMax );
+	if ( !iRun )
+		return;
+
+	// throw away everything which is over the token size, same limits as AccumCodepoint()
+	int iFit = Min ( iRun, SPH_MAX_WORD_LEN-m_iAccum );
+	iFit = Min ( iFit, (int)sizeof(m_sAccum) - SPH_MAX_UTF8_BYTES + 1 - (int)( m_pAccum-m_sAccum ) );
+	if ( iFit>0 )
+	{
+		m_tLC.FoldAsciiRun ( m_pAccum, m_pCur, iFit );
+		m_pAccum += iFit;
+		m_iAccum += iFit;
 	}
+	m_pCur += iRun;
 }
 
 
@@ -5593,6 +6015,7 @@ CSphQuery::CSphQuery ()
 	, m_bNormalizedTFIDF ( true )
 	, m_bLocalDF		( false )
 	, m_bLowPriority	( false )
+	, m_bPackedReply	( false )
 	, m_uDebugFlags		( 0 )
 	, m_eGroupFunc		( SPH_GROUPBY_ATTR )
 	, m_sGroupSortBy	( "@groupby desc" )
@@ -5607,6 +6030,8 @@ CSphQuery::CSphQuery ()
 	, m_uMaxQueryMsec	( 0 )
 	, m_iMaxPredictedMsec ( 0 )
 	, m_sComment		( "" )
+	, m_sSearchAfter	( "" )
+	, m_bSearchAfter	( false )
 	, m_sSelect			( "" )
 	, m_iOuterOffset	( 0 )
 	, m_iOuterLimit		( 0 )
@@ -5956,6 +6381,7 @@ CSphColumnInfo::CSphColumnInfo ( const char * sName, ESphAttr eType )
 	, m_bPayload ( false )
 	, m_bFilename ( false )
 	, m_bWeight ( false )
+	, m_uStringDict ( 0 )
 	, m_uNext ( 0xffff )
 {
 	sphColumnToLowercase ( const_cast<char *>( m_sName.cstr() ) );
@@ -7763,6 +8189,8 @@ CSphIndexSettings::CSphIndexSettings ()
 	, m_eBigramIndex		( SPH_BIGRAM_NONE )
 	, m_uAotFilterMask		( 0 )
 	, m_eChineseRLP			( SPH_RLP_NONE )
+	, m_bDictFst			( false )
+	, m_bInfixTrigrams		( false )
 {
 }
 
@@ -8612,6 +9040,7 @@ CSphIndex_VLN::CSphIndex_VLN ( const char* sIndexName, const char * sFilename )
 	, m_iTotalDups ( 0 )
 	, m_dMinRow ( 0 )
 	, m_dFieldLens ( SPH_MAX_FIELDS )
+	, m_dAttrOrder ( 0 )
 {
 	m_sFilename = sFilename;
 
@@ -8623,6 +9052,8 @@ CSphIndex_VLN::CSphIndex_VLN ( const char* sIndexName, const char * sFilename )
 	m_bOndiskAllAttr = false;
 	m_bOndiskPoolAttr = false;
 	m_bArenaProhibit = false;
+	m_bGeoGridStale = false;
+	m_bAttrOrderStale = false;
 	m_uVersion = INDEX_FORMAT_VERSION;
 	m_bPassedRead = false;
 	m_bPassedAlloc = false;
@@ -8686,6 +9117,13 @@ int CSphIndex_VLN::UpdateAttributes ( const CSphAttrUpdate & tUpd, int iIndex, C
 	{
 		int iIdx = m_tSchema.GetAttrIndex ( tUpd.m_dAttrs[i] );
 
+		// typed columns extracted from JSON must stay in sync with the JSON value itself
+		if ( iIdx>=0 && sphJsonNameSplit ( tUpd.m_dAttrs[i], NULL, NULL ) )
+		{
+			sError.SetSprintf ( "attribute '%s' is extracted from JSON and can not be updated (use REPLACE instead)", tUpd.m_dAttrs[i] );
+			return -1;
+		}
+
 		if ( iIdx<0 )
 		{
 			CSphString sJsonCol, sJsonKey;
@@ -8910,6 +9348,18 @@ int CSphIndex_VLN::UpdateAttributes ( const CSphAttrUpdate & tUpd, int iIndex, C
 		return -1;
 	}
 
+	// grid cells are bucketed by coordinates, so moved points leave it unusable until the next load
+	if ( !m_tGeoGrid.IsEmpty() )
+		ARRAY_FOREACH ( i, tUpd.m_dAttrs )
+			if ( m_tSettings.m_sGeoLat==tUpd.m_dAttrs[i] || m_tSettings.m_sGeoLon==tUpd.m_dAttrs[i] )
+				m_bGeoGridStale = true;
+
+	// same goes for the scan order
+	if ( m_dAttrOrder.GetLength() )
+		ARRAY_FOREACH ( i, tUpd.m_dAttrs )
+			if ( m_tSettings.m_sSortByAttr==tUpd.m_dAttrs[i] )
+				m_bAttrOrderStale = true;
+
 	// preallocation went OK; do the actual update
 	int iRowStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
 	int iUpdated = 0;
@@ -9701,7 +10151,7 @@ public:
 	bool	CreateIndexFiles ( const char * sDocName, const char * sHitName, const char * sSkipName, bool bInplace, int iWriteBuffer, CSphAutofile & tHit, SphOffset_t * pSharedOffset );
 	void	HitReset ();
 	void	cidxHit ( CSphAggregateHit * pHit, const CSphRowitem * pAttrs );
-	bool	cidxDone ( int iMemLimit, int iMinInfixLen, int iMaxCodepointLen, DictHeader_t * pDictHeader );
+	bool	cidxDone ( int iMemLimit, int iMinInfixLen, int iMaxCodepointLen, bool bDictFst, bool bInfixTrigrams, DictHeader_t * pDictHeader );
 	int		cidxWriteRawVLB ( int fd, CSphWordHit * pHit, int iHits, DWORD * pDocinfo, int iDocinfos, int iStride );
 
 	SphOffset_t		GetHitfilePos () const { return m_wrHitlist.GetPos (); }
@@ -10234,6 +10684,11 @@ void SaveIndexSettings ( CSphWriter & tWriter, const CSphIndexSettings & tSettin
 	tWriter.PutByte ( tSettings.m_eChineseRLP );
 	tWriter.PutString ( tSettings.m_sRLPContext );
 	tWriter.PutString ( tSettings.m_sIndexTokenFilter );
+	tWriter.PutByte ( tSettings.m_bDictFst ? 1 : 0 );
+	tWriter.PutByte ( tSettings.m_bInfixTrigrams ? 1 : 0 );
+	tWriter.PutString ( tSettings.m_sGeoLat );
+	tWriter.PutString ( tSettings.m_sGeoLon );
+	tWriter.PutString ( tSettings.m_sSortByAttr );
 }
 
 
@@ -10263,6 +10718,8 @@ bool CSphIndex_VLN::WriteHeader ( const BuildHeader_t & tBuildHeader, CSphWriter
 	fdInfo.PutByte ( tBuildHeader.m_iInfixCodepointBytes );
 	fdInfo.PutDword ( (DWORD)tBuildHeader.m_iInfixBlocksOffset );
 	fdInfo.PutDword ( tBuildHeader.m_iInfixBlocksWordsSize );
+	fdInfo.PutOffset ( tBuildHeader.m_iFstOffset );
+	fdInfo.PutOffset ( tBuildHeader.m_iTrigramsOffset );
 
 	// index stats
 	fdInfo.PutDword ( (DWORD)tBuildHeader.m_iTotalDocuments ); // FIXME? we don't expect over 4G docs per just 1 local index
@@ -10291,6 +10748,21 @@ bool CSphIndex_VLN::WriteHeader ( const BuildHeader_t & tBuildHeader, CSphWriter
 		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
 			fdInfo.PutOffset ( m_dFieldLens[i] );
 
+	// string dictionaries
+	CSphVector<int> dStringDicts;
+	if ( !tBuildHeader.m_bVerbatimStrings )
+		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
+			if ( m_tSchema.GetAttr(i).m_uStringDict )
+				dStringDicts.Add ( i );
+
+	fdInfo.PutDword ( dStringDicts.GetLength() );
+	ARRAY_FOREACH ( i, dStringDicts )
+	{
+		const CSphColumnInfo & tCol = m_tSchema.GetAttr ( dStringDicts[i] );
+		fdInfo.PutString ( tCol.m_sName );
+		fdInfo.PutDword ( tCol.m_uStringDict );
+	}
+
 	return true;
 }
 
@@ -10312,7 +10784,7 @@ bool CSphIndex_VLN::BuildDone ( const BuildHeader_t & tBuildHeader, CSphString &
 }
 
 
-bool CSphHitBuilder::cidxDone ( int iMemLimit, int iMinInfixLen, int iMaxCodepointLen, DictHeader_t * pDictHeader )
+bool CSphHitBuilder::cidxDone ( int iMemLimit, int iMinInfixLen, int iMaxCodepointLen, bool bDictFst, bool bInfixTrigrams, DictHeader_t * pDictHeader )
 {
 	assert ( pDictHeader );
 
@@ -10329,6 +10801,8 @@ bool CSphHitBuilder::cidxDone ( int iMemLimit, int iMinInfixLen, int iMaxCodepoi
 
 	if ( iMinInfixLen>0 && m_pDict->GetSettings().m_bWordDict )
 		pDictHeader->m_iInfixCodepointBytes = iMaxCodepointLen;
+	pDictHeader->m_bBuildFst = ( bDictFst && m_pDict->GetSettings().m_bWordDict );
+	pDictHeader->m_bBuildTrigrams = ( bInfixTrigrams && iMinInfixLen>0 && m_pDict->GetSettings().m_bWordDict );
 
 	if ( !m_pDict->DictEnd ( pDictHeader, iMemLimit, *m_pLastError, m_pThrottle ) )
 		return false;
@@ -11275,6 +11749,138 @@ static void CopyRow ( const CSphRowitem * pSrc, const ISphSchema & tSchema, cons
 	}
 }
 
+/// interns the values of dictionary encoded string attributes while the string pool is rewritten,
+/// then stores every distinct value once, along with its libc_ci hash and collation rank
+///
+/// entry layout is [packed 12][QWORD libc_ci hash][DWORD rank][packed len][bytes], and rows point at the packed len,
+/// so the hash is at offset-12 and the rank at offset-4; every dictionary is followed by a table of its entry offsets
+/// in libc_ci order, also stored as a regular packed string, so the pool can still be walked string by string
+class StringDictBuilder_c
+{
+public:
+	/// intern a value, returns its (1-based) entry id
+	DWORD Add ( int iDict, const BYTE * pStr, int iLen )
+	{
+		assert ( pStr && iLen>0 );
+		int64_t iKey = (int64_t)( sphFNV64 ( pStr, iLen, sphFNV64 ( &iDict, sizeof(iDict) ) ) & U64C(0x3fffffffffffffff) );
+
+		int * pHead = m_hEntries.Find ( iKey );
+		for ( int i = pHead ? *pHead : -1; i>=0; i = m_dEntries[i].m_iNext )
+		{
+			const Entry_t & tEntry = m_dEntries[i];
+			if ( tEntry.m_iDict==iDict && tEntry.m_iLen==iLen && memcmp ( m_dPool.Begin() + tEntry.m_iBytes, pStr, iLen )==0 )
+				return i+1;
+		}
+
+		Entry_t & tEntry = m_dEntries.Add();
+		tEntry.m_iDict = iDict;
+		tEntry.m_iStart = m_dPool.GetLength();
+		tEntry.m_iLen = iLen;
+		tEntry.m_iNext = pHead ? *pHead : -1;
+
+		BYTE * pPacked = m_dPool.AddN ( iLen+4 );
+		int iLenLen = sphPackStrlen ( pPacked, iLen );
+		memcpy ( pPacked+iLenLen, pStr, iLen );
+		m_dPool.Resize ( tEntry.m_iStart+iLenLen+iLen );
+		tEntry.m_iBytes = tEntry.m_iStart+iLenLen;
+
+		int iEntry = m_dEntries.GetLength()-1;
+		if ( pHead )
+			*pHead = iEntry;
+		else
+			m_hEntries.Add ( iKey, iEntry );
+		return iEntry+1;
+	}
+
+	/// write all the dictionaries, returns per dictionary table offsets
+	void Save ( int iDicts, CSphWriter & tWriter, CSphVector<DWORD> & dTables )
+	{
+		m_dOffsets.Resize ( m_dEntries.GetLength() );
+		dTables.Resize ( iDicts );
+
+		CSphVector<int> dOrder;
+		for ( int iDict=0; iDict<iDicts; iDict++ )
+		{
+			dOrder.Resize ( 0 );
+			ARRAY_FOREACH ( i, m_dEntries )
+				if ( m_dEntries[i].m_iDict==iDict )
+					dOrder.Add ( i );
+
+			EntryCmp_t tCmp ( this );
+			dOrder.Sort ( tCmp );
+
+			DWORD uRank = 0;
+			ARRAY_FOREACH ( i, dOrder )
+			{
+				const Entry_t & tEntry = m_dEntries[dOrder[i]];
+				if ( i && sphCollateLibcCI ( GetPacked ( dOrder[i-1] ), GetPacked ( dOrder[i] ), true )!=0 )
+					uRank++;
+
+				BYTE dPackedLen[4];
+				int iLenLen = sphPackStrlen ( dPackedLen, 12 );
+				uint64_t uHash = sphHashLibcCI ( m_dPool.Begin() + tEntry.m_iBytes, tEntry.m_iLen );
+				tWriter.PutBytes ( dPackedLen, iLenLen );
+				tWriter.PutBytes ( &uHash, sizeof(uHash) );
+				tWriter.PutDword ( uRank );
+
+				m_dOffsets[dOrder[i]] = (DWORD)tWriter.GetPos();
+				tWriter.PutBytes ( GetPacked ( dOrder[i] ), tEntry.m_iBytes - tEntry.m_iStart + tEntry.m_iLen );
+			}
+
+			BYTE dPackedLen[4];
+			int iLenLen = sphPackStrlen ( dPackedLen, ( dOrder.GetLength()+1 )*sizeof(DWORD) );
+			dTables[iDict] = (DWORD)tWriter.GetPos();
+			tWriter.PutBytes ( dPackedLen, iLenLen );
+			tWriter.PutDword ( dOrder.GetLength() );
+			ARRAY_FOREACH ( i, dOrder )
+				tWriter.PutDword ( m_dOffsets[dOrder[i]] );
+		}
+	}
+
+	/// final offset of an entry, only valid after Save()
+	DWORD GetOffset ( DWORD uEntry ) const
+	{
+		return m_dOffsets[uEntry-1];
+	}
+
+private:
+	struct Entry_t
+	{
+		int		m_iDict;
+		int		m_iStart;	///< packed string start in the pool
+		int		m_iBytes;	///< string bytes start in the pool
+		int		m_iLen;
+		int		m_iNext;	///< next entry with the same hash key
+	};
+
+	struct EntryCmp_t
+	{
+		const StringDictBuilder_c * m_pBuilder;
+		explicit EntryCmp_t ( const StringDictBuilder_c * pBuilder ) : m_pBuilder ( pBuilder ) {}
+
+		bool IsLess ( int a, int b ) const
+		{
+			const BYTE * pA = m_pBuilder->GetPacked(a);
+			const BYTE * pB = m_pBuilder->GetPacked(b);
+			int iCmp = sphCollateLibcCI ( pA, pB, true );
+			if ( iCmp==0 )
+				iCmp = sphCollateBinary ( pA, pB, true );
+			return iCmp<0;
+		}
+	};
+
+	const BYTE * GetPacked ( int iEntry ) const
+	{
+		return m_dPool.Begin() + m_dEntries[iEntry].m_iStart;
+	}
+
+	CSphTightVector<BYTE>	m_dPool;
+	CSphVector<Entry_t>		m_dEntries;
+	CSphHash<int>			m_hEntries;
+	CSphVector<DWORD>		m_dOffsets;
+};
+
+
 int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemoryLimit, int iWriteBuffer )
 {
 	assert ( dSources.GetLength() );
@@ -11834,7 +12440,7 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 						pData[iLen+1] = '\0';
 
 						dBson.Resize ( 0 );
-						if ( !sphJsonParse ( dBson, pData, g_bJsonAutoconvNumbers, g_bJsonKeynamesToLowercase, m_sLastError ) )
+						if ( !sphJsonParse ( dBson, pData, g_bJsonAutoconvNumbers, g_bJsonKeynamesToLowercase, g_iJsonKeyDirectory, m_sLastError ) )
 						{
 							m_sLastError.SetSprintf ( "document " DOCID_FMT ", attribute %s: JSON error: %s",
 								pSource->m_tDocInfo.m_uDocID, tCol.m_sName.cstr(),
@@ -12489,6 +13095,30 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 	SphOffset_t iNumDocs = iDocinfoWritePos/sizeof(DWORD)/iDocinfoStride;
 	CSphTightVector<DWORD> dStrOffsets;
 
+	// dictionary encoded string attributes (0 means verbatim, otherwise dictionary index+1)
+	CSphVector<WORD> dStrAttrDict ( iStringStride );
+	CSphVector<int> dStringDicts;
+	ARRAY_FOREACH ( i, dStrAttrDict )
+	{
+		const CSphColumnInfo & tCol = m_tSchema.GetAttr ( dStringAttrs[i] );
+		dStrAttrDict[i] = 0;
+		if ( tCol.m_eAttrType==SPH_ATTR_STRING && m_tSettings.m_dStringDict.Contains ( tCol.m_sName ) )
+		{
+			dStringDicts.Add ( dStringAttrs[i] );
+			dStrAttrDict[i] = (WORD)dStringDicts.GetLength();
+		}
+	}
+
+	ARRAY_FOREACH ( i, m_tSettings.m_dStringDict )
+	{
+		const CSphColumnInfo * pCol = m_tSchema.GetAttr ( m_tSettings.m_dStringDict[i].cstr() );
+		if ( !pCol || pCol->m_eAttrType!=SPH_ATTR_STRING )
+			sphWarn ( "string_dictionary: '%s' is not a string attribute, ignored", m_tSettings.m_dStringDict[i].cstr() );
+	}
+
+	StringDictBuilder_c tStringDict;
+	CSphTightVector<WORD> dStrDict; // per string dictionary, parallel to dStrOffsets
+
 	if ( iStringStride )
 	{
 		// read only non-zero string locators
@@ -12506,7 +13136,11 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 					const CSphAttrLocator & tLoc = m_tSchema.GetAttr ( dStringAttrs[j] ).m_tLocator;
 					DWORD uData = (DWORD)sphGetRowAttr ( pAttrs, tLoc );
 					if ( uData )
+					{
 						dStrOffsets.Add ( uData );
+						if ( dStringDicts.GetLength() )
+							dStrDict.Add ( dStrAttrDict[j] );
+					}
 				}
 			}
 		} // the spa reader eliminates out of this scope
@@ -12558,6 +13192,8 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 					int iLen = sphUnpackStr ( pStringsBegin + uCurStr - iMinStrings, &pStr );
 					if ( !iLen )
 						uCurStr = 0;
+					else if ( dStrDict.GetLength() && dStrDict[k] )
+						uCurStr = tStringDict.Add ( dStrDict[k]-1, pStr, iLen );
 					else
 					{
 						uCurStr = (DWORD)tStrFinalWriter.GetPos();
@@ -12587,6 +13223,8 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 				int iLen = sphUnpackStr ( pStringsBegin + uOffset, &pStr );
 				if ( !iLen )
 					uOffset = 0;
+				else if ( dStrDict.GetLength() && dStrDict[k] )
+					uOffset = tStringDict.Add ( dStrDict[k]-1, pStr, iLen );
 				else
 				{
 					uOffset = (DWORD)tStrFinalWriter.GetPos();
@@ -12598,6 +13236,20 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 			}
 		}
 		dStringPool.Reset(0);
+
+		// dictionaries go after all the verbatim strings; swap entry ids for their final offsets
+		if ( dStringDicts.GetLength() )
+		{
+			CSphVector<DWORD> dTables;
+			tStringDict.Save ( dStringDicts.GetLength(), tStrFinalWriter, dTables );
+			for ( DWORD k=0; k<iNumStrings; ++k )
+				if ( dStrDict[k] && dStrOffsets[k] )
+					dStrOffsets[k] = tStringDict.GetOffset ( dStrOffsets[k] );
+
+			ARRAY_FOREACH ( i, dStringDicts )
+				const_cast<CSphColumnInfo &>( m_tSchema.GetAttr ( dStringDicts[i] ) ).m_uStringDict = dTables[i];
+		}
+
 		// now save back patched string locators
 		{
 			DWORD iDocPoolSize = iPoolSize/iDocinfoStride/sizeof(DWORD);
@@ -12840,7 +13492,8 @@ int CSphIndex_VLN::Build ( const CSphVector<CSphSource*> & dSources, int iMemory
 		sphWarn ( "%d duplicate document id pairs found", iDupes );
 
 	BuildHeader_t tBuildHeader ( m_tStats );
-	if ( !tHitBuilder.cidxDone ( iMemoryLimit, m_tSettings.m_iMinInfixLen, m_pTokenizer->GetMaxCodepointLength(), &tBuildHeader ) )
+	if ( !tHitBuilder.cidxDone ( iMemoryLimit, m_tSettings.m_iMinInfixLen, m_pTokenizer->GetMaxCodepointLength(), m_tSettings.m_bDictFst,
+		m_tSettings.m_bInfixTrigrams, &tBuildHeader ) )
 		return 0;
 
 	tBuildHeader.m_sHeaderExtension = "sph";
@@ -13930,11 +14583,12 @@ bool CSphIndex_VLN::DoMerge ( const CSphIndex_VLN * pDstIndex, const CSphIndex_V
 	tHitBuilder.cidxHit ( &tFlush, NULL );
 
 	if ( !tHitBuilder.cidxDone ( iHitBufferSize, pDstIndex->m_tSettings.m_iMinInfixLen,
-								pDstIndex->m_pTokenizer->GetMaxCodepointLength(), &tBuildHeader ) )
+								pDstIndex->m_pTokenizer->GetMaxCodepointLength(), pDstIndex->m_tSettings.m_bDictFst, pDstIndex->m_tSettings.m_bInfixTrigrams, &tBuildHeader ) )
 		return false;
 
 	tBuildHeader.m_sHeaderExtension = "tmp.sph";
 	tBuildHeader.m_pThrottle = pThrottle;
+	tBuildHeader.m_bVerbatimStrings = true;
 
 	pDstIndex->BuildDone ( tBuildHeader, sError ); // FIXME? is this magic dict block constant any good?..
 
@@ -14267,6 +14921,19 @@ bool CSphIndex_VLN::HasDocid ( SphDocID_t uDocid ) const
 }
 
 
+bool CSphIndex_VLN::GetDocidRange ( SphDocID_t & uMin, SphDocID_t & uMax ) const
+{
+	// docinfo rows are sorted by docid; no rows means no range to tell (inline or none docinfo)
+	if ( m_iDocinfo<=0 || m_tAttr.IsEmpty() )
+		return false;
+
+	int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	uMin = DOCINFO2ID ( &m_tAttr[0] );
+	uMax = DOCINFO2ID ( &m_tAttr [ ( m_iDocinfo-1 )*iStride ] );
+	return true;
+}
+
+
 const DWORD * CSphIndex_VLN::FindDocinfo ( SphDocID_t uDocID ) const
 {
 	if ( m_iDocinfo<=0 )
@@ -14722,7324 +15389,9134 @@ public:
 };
 
 
-bool CSphIndex_VLN::MultiScan ( const CSphQuery * pQuery, CSphQueryResult * pResult,
-	int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
-{
-	assert ( pQuery->m_sQuery.IsEmpty() );
-	assert ( tArgs.m_iTag>=0 );
+//////////////////////////////////////////////////////////////////////////
+// GEO GRID
+//////////////////////////////////////////////////////////////////////////
 
-	// check if index is ready
-	if ( !m_bPassedAlloc )
-	{
-		pResult->m_sError = "index not preread";
-		return false;
-	}
+static const double	GEOGRID_PI				= 3.14159265358979323846;
+static const double	GEOGRID_MIN_RADIUS		= 6335000.0;	///< meters, smallest curvature radius that geodist() methods assume
+static const double	GEOGRID_SLACK			= 1.1;			///< circle radius overestimate, covers geodist() approximation errors
+static const double	GEOGRID_EPS				= 1e-6;			///< radians, covers float rounding of the box edges
+static const int	GEOGRID_ROWS_PER_CELL	= 8;
+static const int	GEOGRID_MAX_SIDE		= 1024;
 
-	// check if index supports scans
-	if ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN || !m_tSchema.GetAttrsCount() )
-	{
-		pResult->m_sError = "fullscan requires extern docinfo";
-		return false;
-	}
 
-	// we count documents only (before filters)
-	if ( pQuery->m_iMaxPredictedMsec )
-		pResult->m_bHasPrediction = true;
+GeoGrid_c::Box_t::Box_t ()
+	: m_fLatMin ( -FLT_MAX )
+	, m_fLatMax ( FLT_MAX )
+	, m_iLonRanges ( 1 )
+{
+	m_dLonMin[0] = -FLT_MAX;
+	m_dLonMax[0] = FLT_MAX;
+}
 
-	if ( tArgs.m_uPackedFactorFlags & SPH_FACTOR_ENABLE )
-		pResult->m_sWarning.SetSprintf ( "packedfactors() will not work with a fullscan; you need to specify a query" );
 
-	// check if index has data
-	if ( m_bIsEmpty || m_iDocinfo<=0 || m_tAttr.IsEmpty() )
-		return true;
+bool GeoGrid_c::Box_t::Intersect ( const Box_t & tBox )
+{
+	m_fLatMin = Max ( m_fLatMin, tBox.m_fLatMin );
+	m_fLatMax = Min ( m_fLatMax, tBox.m_fLatMax );
 
-	// start counting
-	int64_t tmQueryStart = sphMicroTimer();
+	float dMin [ MAX_LON_RANGES ];
+	float dMax [ MAX_LON_RANGES ];
+	int iRanges = 0;
+	for ( int i=0; i<m_iLonRanges; i++ )
+		for ( int j=0; j<tBox.m_iLonRanges; j++ )
+		{
+			float fMin = Max ( m_dLonMin[i], tBox.m_dLonMin[j] );
+			float fMax = Min ( m_dLonMax[i], tBox.m_dLonMax[j] );
+			if ( fMin>fMax )
+				continue;
 
-	ScopedThreadPriority_c tPrio ( pQuery->m_bLowPriority );
+			if ( iRanges==MAX_LON_RANGES )
+				return false;
 
-	// select the sorter with max schema
-	// uses GetAttrsCount to get working facets (was GetRowSize)
-	int iMaxSchemaSize = -1;
-	int iMaxSchemaIndex = -1;
-	for ( int i=0; i<iSorters; i++ )
-		if ( ppSorters[i]->GetSchema().GetAttrsCount() > iMaxSchemaSize )
-		{
-			iMaxSchemaSize = ppSorters[i]->GetSchema().GetAttrsCount();
-			iMaxSchemaIndex = i;
+			dMin[iRanges] = fMin;
+			dMax[iRanges] = fMax;
+			iRanges++;
 		}
 
-	// setup calculations and result schema
-	CSphQueryContext tCtx ( *pQuery );
-	if ( !tCtx.SetupCalc ( pResult, ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema, m_tMva.GetWritePtr(), m_bArenaProhibit ) )
-		return false;
+	memcpy ( m_dLonMin, dMin, sizeof(dMin) );
+	memcpy ( m_dLonMax, dMax, sizeof(dMax) );
+	m_iLonRanges = iRanges;
+	return true;
+}
 
-	// set string pool for string on_sort expression fix up
-	tCtx.SetStringPool ( m_tString.GetWritePtr() );
 
-	// setup filters
-	if ( !tCtx.CreateFilters ( true, &pQuery->m_dFilters, ppSorters[iMaxSchemaIndex]->GetSchema(),
-		m_tMva.GetWritePtr(), m_tString.GetWritePtr(), pResult->m_sError, pResult->m_sWarning, pQuery->m_eCollation, m_bArenaProhibit, tArgs.m_dKillList ) )
-			return false;
+GeoGrid_c::GeoGrid_c ()
+	: m_dCells ( 0 )
+	, m_dRows ( 0 )
+{
+	Reset();
+}
 
-	// check if we can early reject the whole index
-	if ( tCtx.m_pFilter && m_iDocinfoIndex )
-	{
-		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
-		DWORD * pMinEntry = const_cast<DWORD*> ( &m_pDocinfoIndex [ m_iDocinfoIndex*uStride*2 ] );
-		DWORD * pMaxEntry = pMinEntry + uStride;
 
-		if ( !tCtx.m_pFilter->EvalBlock ( pMinEntry, pMaxEntry ) )
-		{
-			pResult->m_iQueryTime += (int)( ( sphMicroTimer()-tmQueryStart )/1000 );
-			return true;
-		}
-	}
+void GeoGrid_c::Reset ()
+{
+	m_fLatMin = m_fLatMax = 0.0f;
+	m_fLonMin = m_fLonMax = 0.0f;
+	m_fLatScale = m_fLonScale = 0.0f;
+	m_iLatCells = m_iLonCells = 1;
+	m_dCells.Reset ( 0 );
+	m_dRows.Reset ( 0 );
+}
 
-	// setup lookup
-	tCtx.m_bLookupFilter = false;
-	tCtx.m_bLookupSort = true;
 
-	// setup sorters vs. MVA
-	for ( int i=0; i<iSorters; i++ )
-	{
-		(ppSorters[i])->SetMVAPool ( m_tMva.GetWritePtr(), m_bArenaProhibit );
-		(ppSorters[i])->SetStringPool ( m_tString.GetWritePtr() );
-	}
+static inline bool IsGeoCoord ( float fValue )
+{
+	return fabs ( fValue )<=FLT_MAX; // neither NaN nor infinity
+}
 
-	// setup overrides
-	if ( !tCtx.SetupOverrides ( pQuery, pResult, m_tSchema, ppSorters[iMaxSchemaIndex]->GetSchema() ) )
-		return false;
 
-	// prepare to work them rows
-	bool bRandomize = ppSorters[0]->m_bRandomize;
+int GeoGrid_c::GetCell ( float fLat, float fLon ) const
+{
+	int iLat = IsGeoCoord ( fLat ) ? Min ( (int)( ( fLat-m_fLatMin )*m_fLatScale ), m_iLatCells-1 ) : 0;
+	int iLon = IsGeoCoord ( fLon ) ? Min ( (int)( ( fLon-m_fLonMin )*m_fLonScale ), m_iLonCells-1 ) : 0;
+	return iLat*m_iLonCells + iLon;
+}
 
-	CSphMatch tMatch;
-	tMatch.Reset ( ppSorters[iMaxSchemaIndex]->GetSchema().GetDynamicSize() );
-	tMatch.m_iWeight = tArgs.m_iIndexWeight;
-	tMatch.m_iTag = tCtx.m_dCalcFinal.GetLength() ? -1 : tArgs.m_iTag;
 
-	if ( pResult->m_pProfile )
-		pResult->m_pProfile->Switch ( SPH_QSTATE_FULLSCAN );
+void GeoGrid_c::Build ( const DWORD * pDocinfo, int64_t iRows, int iStride, const CSphAttrLocator & tLat, const CSphAttrLocator & tLon )
+{
+	Reset();
+	if ( iRows<=0 || iRows>INT_MAX )
+		return;
 
-	// optimize direct lookups by id
-	// run full scan with block and row filtering for everything else
-	if ( pQuery->m_dFilters.GetLength()==1
-		&& pQuery->m_dFilters[0].m_eType==SPH_FILTER_VALUES
-		&& pQuery->m_dFilters[0].m_bExclude==false
-		&& pQuery->m_dFilters[0].m_sAttrName=="@id"
-		&& tArgs.m_dKillList.GetLength()==0 )
+	// bounds (rows with broken coordinates go to the first cell)
+	float fLatMin = FLT_MAX, fLatMax = -FLT_MAX;
+	float fLonMin = FLT_MAX, fLonMax = -FLT_MAX;
+	const DWORD * pRow = pDocinfo;
+	for ( int64_t i=0; i<iRows; i++, pRow+=iStride )
 	{
-		// run id lookups
-		for ( int i=0; i<pQuery->m_dFilters[0].GetNumValues(); i++ )
+		float fLat = sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLat ) );
+		float fLon = sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLon ) );
+		if ( IsGeoCoord ( fLat ) )
 		{
-			pResult->m_tStats.m_iFetchedDocs++;
-			SphDocID_t uDocid = (SphDocID_t) pQuery->m_dFilters[0].GetValue(i);
-			const DWORD * pRow = FindDocinfo ( uDocid );
+			fLatMin = Min ( fLatMin, fLat );
+			fLatMax = Max ( fLatMax, fLat );
+		}
+		if ( IsGeoCoord ( fLon ) )
+		{
+			fLonMin = Min ( fLonMin, fLon );
+			fLonMax = Max ( fLonMax, fLon );
+		}
+	}
 
-			if ( !pRow )
-				continue;
+	if ( fLatMin<=fLatMax )
+	{
+		m_fLatMin = fLatMin;
+		m_fLatMax = fLatMax;
+	}
+	if ( fLonMin<=fLonMax )
+	{
+		m_fLonMin = fLonMin;
+		m_fLonMax = fLonMax;
+	}
 
-			assert ( uDocid==DOCINFO2ID(pRow) );
-			tMatch.m_uDocID = uDocid;
-			CopyDocinfo ( &tCtx, tMatch, pRow );
+	// square grid, a few rows per cell on average
+	int iSide = (int)ceil ( sqrt ( double(iRows) / GEOGRID_ROWS_PER_CELL ) );
+	iSide = Max ( Min ( iSide, GEOGRID_MAX_SIDE ), 1 );
+	m_iLatCells = m_iLonCells = iSide;
+	m_fLatScale = m_fLatMax>m_fLatMin ? float ( iSide / ( double(m_fLatMax)-m_fLatMin ) ) : 0.0f;
+	m_fLonScale = m_fLonMax>m_fLonMin ? float ( iSide / ( double(m_fLonMax)-m_fLonMin ) ) : 0.0f;
 
-			if ( bRandomize )
-				tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
+	// counting sort of row numbers by cell
+	int iCells = iSide*iSide;
+	m_dCells.Reset ( iCells+1 );
+	memset ( m_dCells.Begin(), 0, m_dCells.GetSizeBytes() );
 
-			// submit match to sorters
-			tCtx.CalcSort ( tMatch );
+	pRow = pDocinfo;
+	for ( int64_t i=0; i<iRows; i++, pRow+=iStride )
+		m_dCells [ GetCell ( sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLat ) ),
+			sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLon ) ) )+1 ]++;
 
-			for ( int iSorter=0; iSorter<iSorters; iSorter++ )
-				ppSorters[iSorter]->Push ( tMatch );
+	for ( int i=0; i<iCells; i++ )
+		m_dCells[i+1] += m_dCells[i];
 
-			// stringptr expressions should be duplicated (or taken over) at this point
-			tCtx.FreeStrSort ( tMatch );
-		}
-	} else
+	CSphFixedVector<DWORD> dCursor ( iCells );
+	memcpy ( dCursor.Begin(), m_dCells.Begin(), dCursor.GetSizeBytes() );
+
+	m_dRows.Reset ( (int)iRows );
+	pRow = pDocinfo;
+	for ( int64_t i=0; i<iRows; i++, pRow+=iStride )
 	{
-		bool bReverse = pQuery->m_bReverseScan; // shortcut
-		int iCutoff = ( pQuery->m_iCutoff<=0 ) ? -1 : pQuery->m_iCutoff;
+		int iCell = GetCell ( sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLat ) ),
+			sphDW2F ( (DWORD)sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLon ) ) );
+		m_dRows [ dCursor[iCell]++ ] = (DWORD)i;
+	}
+}
 
-		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
-		int64_t iStart = bReverse ? m_iDocinfoIndex-1 : 0;
-		int64_t iEnd = bReverse ? -1 : m_iDocinfoIndex;
-		int64_t iStep = bReverse ? -1 : 1;
-		for ( int64_t iIndexEntry=iStart; iIndexEntry!=iEnd; iIndexEntry+=iStep )
-		{
-			// block-level filtering
-			const DWORD * pMin = &m_pDocinfoIndex[ iIndexEntry*uStride*2 ];
-			const DWORD * pMax = pMin + uStride;
-			if ( tCtx.m_pFilter && !tCtx.m_pFilter->EvalBlock ( pMin, pMax ) )
-				continue;
 
-			// row-level filtering
-			const DWORD * pBlockStart = m_tAttr.GetWritePtr() + ( iIndexEntry*uStride*DOCINFO_INDEX_FREQ );
-			const DWORD * pBlockEnd = m_tAttr.GetWritePtr() + ( Min ( ( iIndexEntry+1 )*DOCINFO_INDEX_FREQ, m_iDocinfo )*uStride );
-			if ( bReverse )
-			{
-				pBlockStart = m_tAttr.GetWritePtr() + ( ( Min ( ( iIndexEntry+1 )*DOCINFO_INDEX_FREQ, m_iDocinfo ) - 1 ) * uStride );
-				pBlockEnd = m_tAttr.GetWritePtr() + uStride*( iIndexEntry*DOCINFO_INDEX_FREQ-1 );
-			}
-			int iDocinfoStep = bReverse ? -(int)uStride : (int)uStride;
+GeoGrid_c::Box_t GeoGrid_c::GetBounds () const
+{
+	Box_t tBox;
+	tBox.m_fLatMin = m_fLatMin;
+	tBox.m_fLatMax = m_fLatMax;
+	tBox.m_dLonMin[0] = m_fLonMin;
+	tBox.m_dLonMax[0] = m_fLonMax;
+	return tBox;
+}
 
-			if ( !tCtx.m_pOverrides && tCtx.m_pFilter && !pQuery->m_iCutoff && !tCtx.m_dCalcFilter.GetLength() && !tCtx.m_dCalcSort.GetLength() )
-			{
-				// kinda fastpath
-				for ( const DWORD * pDocinfo=pBlockStart; pDocinfo!=pBlockEnd; pDocinfo+=iDocinfoStep )
-				{
-					pResult->m_tStats.m_iFetchedDocs++;
-					tMatch.m_uDocID = DOCINFO2ID ( pDocinfo );
-					tMatch.m_pStatic = DOCINFO2ATTRS ( pDocinfo );
 
-					if ( tCtx.m_pFilter->Eval ( tMatch ) )
-					{
-						if ( bRandomize )
-							tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
-						for ( int iSorter=0; iSorter<iSorters; iSorter++ )
-							ppSorters[iSorter]->Push ( tMatch );
-					}
-					// stringptr expressions should be duplicated (or taken over) at this point
-					tCtx.FreeStrFilter ( tMatch );
-				}
-			} else
-			{
-				// generic path
-				for ( const DWORD * pDocinfo=pBlockStart; pDocinfo!=pBlockEnd; pDocinfo+=iDocinfoStep )
-				{
-					pResult->m_tStats.m_iFetchedDocs++;
-					tMatch.m_uDocID = DOCINFO2ID ( pDocinfo );
-					CopyDocinfo ( &tCtx, tMatch, pDocinfo );
+bool GeoGrid_c::GetCircleBox ( float fLat, float fLon, float fMeters, bool bDeg, Box_t & tBox ) const
+{
+	const double fUnit = bDeg ? GEOGRID_PI/180.0 : 1.0;
+	const double fHalfPi = GEOGRID_PI/2;
 
-					// early filter only (no late filters in full-scan because of no @weight)
-					tCtx.CalcFilter ( tMatch );
-					if ( tCtx.m_pFilter && !tCtx.m_pFilter->Eval ( tMatch ) )
-					{
-						tCtx.FreeStrFilter ( tMatch );
-						continue;
-					}
+	// coordinates off the sphere (say, degrees in a query that assumes radians) can not be bounded
+	if ( m_fLatMin*fUnit<-fHalfPi-GEOGRID_EPS || m_fLatMax*fUnit>fHalfPi+GEOGRID_EPS || !( fabs ( fLat*fUnit )<=fHalfPi+GEOGRID_EPS ) )
+		return false;
 
-					if ( bRandomize )
-						tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
+	double fTheta = Max ( fMeters, 0.0f )*GEOGRID_SLACK/GEOGRID_MIN_RADIUS + GEOGRID_EPS;
+	double fLatLo = fLat*fUnit - fTheta;
+	double fLatHi = fLat*fUnit + fTheta;
 
-					// submit match to sorters
-					tCtx.CalcSort ( tMatch );
+	tBox = GetBounds();
+	tBox.m_fLatMin = (float)( fLatLo/fUnit );
+	tBox.m_fLatMax = (float)( fLatHi/fUnit );
 
-					bool bNewMatch = false;
-					for ( int iSorter=0; iSorter<iSorters; iSorter++ )
-						bNewMatch |= ppSorters[iSorter]->Push ( tMatch );
+	// wrapping only works for longitudes within [-pi, pi], otherwise just narrow down the latitude
+	if ( m_fLonMin*fUnit<-GEOGRID_PI-GEOGRID_EPS || m_fLonMax*fUnit>GEOGRID_PI+GEOGRID_EPS || !IsGeoCoord ( fLon ) )
+		return true;
 
-					// stringptr expressions should be duplicated (or taken over) at this point
-					tCtx.FreeStrFilter ( tMatch );
-					tCtx.FreeStrSort ( tMatch );
+	if ( fLatLo<=-fHalfPi || fLatHi>=fHalfPi )
+		return true;
 
-					// handle cutoff
-					if ( bNewMatch && --iCutoff==0 )
-					{
-						iIndexEntry = iEnd - iStep; // outer break
-						break;
-					}
-				}
-			}
-		}
-	}
+	// haversine bound for the longitude delta, with both latitudes within the box
+	double fSin = sin ( fTheta/2 ) / cos ( Max ( fabs ( fLatLo ), fabs ( fLatHi ) ) );
+	if ( fSin>=1.0 )
+		return true;
 
-	if ( pResult->m_pProfile )
-		pResult->m_pProfile->Switch ( SPH_QSTATE_FINALIZE );
+	double fDelta = 2*asin ( fSin );
+	if ( fDelta>=GEOGRID_PI )
+		return true;
 
-	// do final expression calculations
-	if ( tCtx.m_dCalcFinal.GetLength() )
+	double fLon0 = fmod ( fLon*fUnit, 2*GEOGRID_PI );
+	if ( fLon0>GEOGRID_PI )
+		fLon0 -= 2*GEOGRID_PI;
+	else if ( fLon0<-GEOGRID_PI )
+		fLon0 += 2*GEOGRID_PI;
+
+	double fLo = fLon0 - fDelta;
+	double fHi = fLon0 + fDelta;
+	tBox.m_iLonRanges = 1;
+	if ( fLo<-GEOGRID_PI )
+	{
+		tBox.m_dLonMin[0] = -FLT_MAX;
+		tBox.m_dLonMax[0] = (float)( fHi/fUnit );
+		tBox.m_dLonMin[1] = (float)( ( fLo+2*GEOGRID_PI )/fUnit );
+		tBox.m_dLonMax[1] = FLT_MAX;
+		tBox.m_iLonRanges = 2;
+	} else if ( fHi>GEOGRID_PI )
+	{
+		tBox.m_dLonMin[0] = (float)( fLo/fUnit );
+		tBox.m_dLonMax[0] = FLT_MAX;
+		tBox.m_dLonMin[1] = -FLT_MAX;
+		tBox.m_dLonMax[1] = (float)( ( fHi-2*GEOGRID_PI )/fUnit );
+		tBox.m_iLonRanges = 2;
+	} else
 	{
-		SphFinalMatchCalc_t tFinal ( tArgs.m_iTag, NULL, tCtx );
-		for ( int iSorter=0; iSorter<iSorters; iSorter++ )
-		{
-			ISphMatchSorter * pTop = ppSorters[iSorter];
-			pTop->Finalize ( tFinal, false );
-		}
-		tCtx.m_iBadRows += tFinal.m_iBadRows;
+		tBox.m_dLonMin[0] = (float)( fLo/fUnit );
+		tBox.m_dLonMax[0] = (float)( fHi/fUnit );
 	}
+	return true;
+}
 
-	// done
-	pResult->m_pMva = m_tMva.GetWritePtr();
-	pResult->m_pStrings = m_tString.GetWritePtr();
-	pResult->m_bArenaProhibit = m_bArenaProhibit;
-	pResult->m_iQueryTime += (int)( ( sphMicroTimer()-tmQueryStart )/1000 );
-	pResult->m_iBadRows += tCtx.m_iBadRows;
 
+float GeoGrid_c::GetCellMeters ( bool bDeg ) const
+{
+	double fUnit = bDeg ? GEOGRID_PI/180.0 : 1.0;
+	return (float)( ( double(m_fLatMax)-m_fLatMin ) / m_iLatCells * fUnit * GEOGRID_MIN_RADIUS );
+}
+
+
+bool GeoGrid_c::GetCellRange ( float fMin, float fMax, float fFrom, float fTo, float fScale, int iCells, int & iFirst, int & iLast ) const
+{
+	if ( fMin>fMax || fMax<fFrom || fMin>fTo )
+		return false;
+
+	fMin = Max ( fMin, fFrom );
+	fMax = Min ( fMax, fTo );
+	iFirst = Min ( (int)( ( fMin-fFrom )*fScale ), iCells-1 );
+	iLast = Min ( (int)( ( fMax-fFrom )*fScale ), iCells-1 );
 	return true;
 }
 
-//////////////////////////////////////////////////////////////////////////////
 
-ISphQword * DiskIndexQwordSetup_c::QwordSpawn ( const XQKeyword_t & tWord ) const
+template < typename FN >
+void GeoGrid_c::ForEachCell ( const Box_t & tBox, FN & tFunc ) const
 {
-	if ( !tWord.m_pPayload )
+	if ( IsEmpty() || tBox.IsEmpty() )
+		return;
+
+	int iLatFirst, iLatLast;
+	if ( !GetCellRange ( tBox.m_fLatMin, tBox.m_fLatMax, m_fLatMin, m_fLatMax, m_fLatScale, m_iLatCells, iLatFirst, iLatLast ) )
+		return;
+
+	// longitude cell spans, sorted and merged so that no cell gets visited twice
+	int dFirst [ Box_t::MAX_LON_RANGES ];
+	int dLast [ Box_t::MAX_LON_RANGES ];
+	int iSpans = 0;
+	for ( int i=0; i<tBox.m_iLonRanges; i++ )
 	{
-		WITH_QWORD ( m_pIndex, false, Qword, return new Qword ( tWord.m_bExpanded, tWord.m_bExcluded ) );
-	} else
-	{
-		if ( m_pIndex->GetSettings().m_eHitFormat==SPH_HIT_FORMAT_INLINE )
+		int iFirst, iLast;
+		if ( !GetCellRange ( tBox.m_dLonMin[i], tBox.m_dLonMax[i], m_fLonMin, m_fLonMax, m_fLonScale, m_iLonCells, iFirst, iLast ) )
+			continue;
+
+		int j = iSpans++;
+		for ( ; j>0 && dFirst[j-1]>iFirst; j-- )
 		{
-			return new DiskPayloadQword_c<true> ( (const DiskSubstringPayload_t *)tWord.m_pPayload, tWord.m_bExcluded, m_tDoclist, m_tHitlist, m_pProfile );
-		} else
+			dFirst[j] = dFirst[j-1];
+			dLast[j] = dLast[j-1];
+		}
+		dFirst[j] = iFirst;
+		dLast[j] = iLast;
+	}
+
+	int iMerged = 0;
+	for ( int i=0; i<iSpans; i++ )
+	{
+		if ( iMerged && dFirst[i]<=dLast[iMerged-1] )
 		{
-			return new DiskPayloadQword_c<false> ( (const DiskSubstringPayload_t *)tWord.m_pPayload, tWord.m_bExcluded, m_tDoclist, m_tHitlist, m_pProfile );
+			dLast[iMerged-1] = Max ( dLast[iMerged-1], dLast[i] );
+			continue;
 		}
+		dFirst[iMerged] = dFirst[i];
+		dLast[iMerged] = dLast[i];
+		iMerged++;
 	}
-	return NULL;
+
+	for ( int iLat=iLatFirst; iLat<=iLatLast; iLat++ )
+		for ( int i=0; i<iMerged; i++ )
+			for ( int iLon=dFirst[i]; iLon<=dLast[i]; iLon++ )
+				tFunc ( iLat*m_iLonCells + iLon );
 }
 
 
-bool DiskIndexQwordSetup_c::QwordSetup ( ISphQword * pWord ) const
+struct GeoCellCounter_t
 {
-	DiskIndexQwordTraits_c * pMyWord = (DiskIndexQwordTraits_c*)pWord;
+	const CSphFixedVector<DWORD> &	m_dCells;
+	int64_t							m_iRows;
 
-	// setup attrs
-	pMyWord->m_tDoc.Reset ( m_iDynamicRowitems );
-	pMyWord->m_iMinID = m_uMinDocid;
-	pMyWord->m_tDoc.m_uDocID = m_uMinDocid;
+	explicit GeoCellCounter_t ( const CSphFixedVector<DWORD> & dCells )
+		: m_dCells ( dCells )
+		, m_iRows ( 0 )
+	{}
 
-	return pMyWord->Setup ( this );
-}
+	void operator () ( int iCell )
+	{
+		m_iRows += m_dCells[iCell+1] - m_dCells[iCell];
+	}
+};
 
 
-bool DiskIndexQwordSetup_c::Setup ( ISphQword * pWord ) const
+struct GeoCellCollector_t
 {
-	// there was a dynamic_cast here once but it's not necessary
-	// maybe it worth to rewrite class hierarchy to avoid c-cast here?
-	DiskIndexQwordTraits_c & tWord = *(DiskIndexQwordTraits_c*)pWord;
+	const CSphFixedVector<DWORD> &	m_dCells;
+	const CSphFixedVector<DWORD> &	m_dGridRows;
+	CSphVector<DWORD> &				m_dRows;
+	CSphBitvec *					m_pVisited;
 
-	if ( m_eDocinfo==SPH_DOCINFO_INLINE )
-	{
-		tWord.m_iInlineAttrs = m_iInlineRowitems;
-		tWord.m_pInlineFixup = m_pMinRow;
-	} else
+	GeoCellCollector_t ( const CSphFixedVector<DWORD> & dCells, const CSphFixedVector<DWORD> & dGridRows, CSphVector<DWORD> & dRows, CSphBitvec * pVisited )
+		: m_dCells ( dCells )
+		, m_dGridRows ( dGridRows )
+		, m_dRows ( dRows )
+		, m_pVisited ( pVisited )
+	{}
+
+	void operator () ( int iCell )
 	{
-		tWord.m_iInlineAttrs = 0;
-		tWord.m_pInlineFixup = NULL;
+		if ( m_pVisited )
+		{
+			if ( m_pVisited->BitGet ( iCell ) )
+				return;
+			m_pVisited->BitSet ( iCell );
+		}
+
+		for ( DWORD i=m_dCells[iCell]; i<m_dCells[iCell+1]; i++ )
+			m_dRows.Add ( m_dGridRows[i] );
 	}
+};
 
-	// setup stats
-	tWord.m_iDocs = 0;
-	tWord.m_iHits = 0;
 
-	CSphIndex_VLN * pIndex = (CSphIndex_VLN *)m_pIndex;
+int64_t GeoGrid_c::CountRows ( const Box_t & tBox ) const
+{
+	GeoCellCounter_t tCounter ( m_dCells );
+	ForEachCell ( tBox, tCounter );
+	return tCounter.m_iRows;
+}
 
-	// !COMMIT FIXME!
-	// the below stuff really belongs in wordlist
-	// which in turn really belongs in dictreader
-	// which in turn might or might not be a part of dict
 
-	// binary search through checkpoints for a one whose range matches word ID
-	assert ( pIndex->m_bPassedAlloc );
-	assert ( !pIndex->m_tWordlist.m_tBuf.IsEmpty() );
+void GeoGrid_c::CollectRows ( const Box_t & tBox, CSphVector<DWORD> & dRows, CSphBitvec * pVisited ) const
+{
+	GeoCellCollector_t tCollector ( m_dCells, m_dRows, dRows, pVisited );
+	ForEachCell ( tBox, tCollector );
+}
 
-	// empty index?
-	if ( !pIndex->m_tWordlist.m_dCheckpoints.GetLength() )
-		return false;
 
-	const char * sWord = tWord.m_sDictWord.cstr();
-	const bool bWordDict = pIndex->m_pDict->GetSettings().m_bWordDict;
-	int iWordLen = sWord ? strlen ( sWord ) : 0;
-	if ( bWordDict && tWord.m_sWord.Ends("*") )
+void CSphIndex_VLN::BuildGeoGrid ()
+{
+	m_tGeoGrid.Reset();
+	m_bGeoGridStale = false;
+
+	const CSphColumnInfo * pLat = m_tSchema.GetAttr ( m_tSettings.m_sGeoLat.cstr() );
+	const CSphColumnInfo * pLon = m_tSchema.GetAttr ( m_tSettings.m_sGeoLon.cstr() );
+	if ( !pLat || !pLon || pLat->m_eAttrType!=SPH_ATTR_FLOAT || pLon->m_eAttrType!=SPH_ATTR_FLOAT )
 	{
-		iWordLen = Max ( iWordLen-1, 0 );
+		sphWarning ( "index '%s': geo_grid requires two float attributes, grid disabled", m_sIndexName.cstr() );
+		return;
+	}
 
-		// might match either infix or prefix
-		int iMinLen = Max ( pIndex->m_tSettings.m_iMinPrefixLen, pIndex->m_tSettings.m_iMinInfixLen );
-		if ( pIndex->m_tSettings.m_iMinPrefixLen )
-			iMinLen = Min ( iMinLen, pIndex->m_tSettings.m_iMinPrefixLen );
-		if ( pIndex->m_tSettings.m_iMinInfixLen )
-			iMinLen = Min ( iMinLen, pIndex->m_tSettings.m_iMinInfixLen );
+	int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	m_tGeoGrid.Build ( m_tAttr.GetWritePtr(), m_iDocinfo, iStride, pLat->m_tLocator, pLon->m_tLocator );
+}
 
-		// bail out term shorter than prefix or infix allowed
-		if ( iWordLen<iMinLen )
-			return false;
-	}
 
-	// leading special symbols trimming
-	if ( bWordDict && tWord.m_sDictWord.Begins("*") )
-	{
-		sWord++;
-		iWordLen = Max ( iWordLen-1, 0 );
-		// bail out term shorter than infix allowed
-		if ( iWordLen<pIndex->m_tSettings.m_iMinInfixLen )
-			return false;
-	}
+/// check if that schema column is a geodist() over the grid attributes with a constant anchor
+static bool GetGridGeodist ( const ISphSchema & tSchema, int iAttr, int iLat, int iLon, GeodistSettings_t & tDist )
+{
+	if ( iAttr<0 )
+		return false;
 
-	const CSphWordlistCheckpoint * pCheckpoint = pIndex->m_tWordlist.FindCheckpoint ( sWord, iWordLen, tWord.m_uWordID, false );
-	if ( !pCheckpoint )
+	ISphExpr * pExpr = tSchema.GetAttr(iAttr).m_pExpr.Ptr();
+	if ( !pExpr )
 		return false;
 
-	// decode wordlist chunk
-	const BYTE * pBuf = pIndex->m_tWordlist.AcquireDict ( pCheckpoint );
-	assert ( pBuf );
+	pExpr->Command ( SPH_EXPR_GET_GEODIST_SETTINGS, &tDist );
+	return tDist.m_pExpr==pExpr && tDist.m_iLat==iLat && tDist.m_iLon==iLon;
+}
 
-	CSphDictEntry tRes;
-	if ( bWordDict )
+
+bool CSphIndex_VLN::SetupGeoScan ( const CSphQuery * pQuery, const ISphSchema & tSchema, int iSorters, GeoScan_t & tScan ) const
+{
+	if ( m_tGeoGrid.IsEmpty() || m_bGeoGridStale || pQuery->m_bReverseScan || pQuery->m_iCutoff>0 || pQuery->m_dOverrides.GetLength() )
+		return false;
+
+	int iLat = tSchema.GetAttrIndex ( m_tSettings.m_sGeoLat.cstr() );
+	int iLon = tSchema.GetAttrIndex ( m_tSettings.m_sGeoLon.cstr() );
+	if ( iLat<0 || iLon<0 )
+		return false;
+
+	// lat/lon ranges and geodist() upper bounds narrow down the box
+	// integer bounds are only used as coarse limits here, the filters still check every row
+	bool bNarrowed = false;
+	ARRAY_FOREACH ( i, pQuery->m_dFilters )
 	{
-		KeywordsBlockReader_c tCtx ( pBuf, m_pSkips!=NULL );
-		while ( tCtx.UnpackWord() )
+		const CSphFilterSettings & tFilter = pQuery->m_dFilters[i];
+		if ( tFilter.m_bExclude || ( tFilter.m_eType!=SPH_FILTER_RANGE && tFilter.m_eType!=SPH_FILTER_FLOATRANGE ) )
+			continue;
+
+		float fMin = tFilter.m_eType==SPH_FILTER_FLOATRANGE ? tFilter.m_fMinValue : (float)tFilter.m_iMinValue-1.0f;
+		float fMax = tFilter.m_eType==SPH_FILTER_FLOATRANGE ? tFilter.m_fMaxValue : (float)tFilter.m_iMaxValue+1.0f;
+
+		GeoGrid_c::Box_t tBox;
+		int iAttr = tSchema.GetAttrIndex ( tFilter.m_sAttrName.cstr() );
+		if ( iAttr==iLat )
 		{
-			// block is sorted
-			// so once keywords are greater than the reference word, no more matches
-			assert ( tCtx.GetWordLen()>0 );
-			int iCmp = sphDictCmpStrictly ( sWord, iWordLen, tCtx.GetWord(), tCtx.GetWordLen() );
-			if ( iCmp<0 )
-				return false;
-			if ( iCmp==0 )
-				break;
+			tBox.m_fLatMin = fMin;
+			tBox.m_fLatMax = fMax;
+		} else if ( iAttr==iLon )
+		{
+			tBox.m_dLonMin[0] = fMin;
+			tBox.m_dLonMax[0] = fMax;
+		} else
+		{
+			GeodistSettings_t tDist;
+			if ( !GetGridGeodist ( tSchema, iAttr, iLat, iLon, tDist ) || tDist.m_fOut<=0.0f )
+				continue;
+			if ( !m_tGeoGrid.GetCircleBox ( tDist.m_fAnchorLat, tDist.m_fAnchorLon, fMax/tDist.m_fOut, tDist.m_bDeg, tBox ) )
+				continue;
 		}
-		if ( tCtx.GetWordLen()<=0 )
-			return false;
-		tRes = tCtx;
 
-	} else
-	{
-		if ( !pIndex->m_tWordlist.GetWord ( pBuf, tWord.m_uWordID, tRes ) )
+		if ( !tScan.m_tBox.Intersect ( tBox ) )
 			return false;
+		bNarrowed = true;
 	}
 
-	const ESphHitless eMode = pIndex->m_tSettings.m_eHitless;
-	tWord.m_iDocs = eMode==SPH_HITLESS_SOME ? ( tRes.m_iDocs & HITLESS_DOC_MASK ) : tRes.m_iDocs;
-	tWord.m_iHits = tRes.m_iHits;
-	tWord.m_bHasHitlist =
-		( eMode==SPH_HITLESS_NONE ) ||
-		( eMode==SPH_HITLESS_SOME && !( tRes.m_iDocs & HITLESS_DOC_FLAG ) );
-
-	if ( m_bSetupReaders )
+	// nearest-first search needs a single sorter ordered by just the geodist() ascending
+	if ( iSorters==1 && pQuery->m_eSort==SPH_SORT_EXTENDED && pQuery->m_sGroupBy.IsEmpty() )
 	{
-		tWord.m_rdDoclist.SetBuffers ( g_iReadBuffer, g_iReadUnhinted );
-		tWord.m_rdDoclist.SetFile ( m_tDoclist );
-		tWord.m_rdDoclist.m_pProfile = m_pProfile;
-		tWord.m_rdDoclist.m_eProfileState = SPH_QSTATE_READ_DOCS;
-
-		// read in skiplist
-		// OPTIMIZE? maybe cache hot decompressed lists?
-		// OPTIMIZE? maybe add an option to decompress on preload instead?
-		if ( m_pSkips && tRes.m_iDocs>SPH_SKIPLIST_BLOCK )
+		CSphVector<CSphString> dSort;
+		sphSplit ( dSort, pQuery->m_sSortBy.cstr(), " \t" );
+		if ( dSort.GetLength()==2 && strcasecmp ( dSort[1].cstr(), "asc" )==0 )
 		{
-			const BYTE * pSkip = m_pSkips + tRes.m_iSkiplistOffset;
-
-			tWord.m_dSkiplist.Add();
-			tWord.m_dSkiplist.Last().m_iBaseDocid = 0;
-			tWord.m_dSkiplist.Last().m_iOffset = tRes.m_iDoclistOffset;
-			tWord.m_dSkiplist.Last().m_iBaseHitlistPos = 0;
-
-			for ( int i=1; i<( tWord.m_iDocs/SPH_SKIPLIST_BLOCK ); i++ )
+			int iAttr = tSchema.GetAttrIndex ( dSort[0].cstr() );
+			GeoGrid_c::Box_t tCircle;
+			if ( GetGridGeodist ( tSchema, iAttr, iLat, iLon, tScan.m_tDist ) && tScan.m_tDist.m_fOut>0.0f
+				&& m_tGeoGrid.GetCircleBox ( tScan.m_tDist.m_fAnchorLat, tScan.m_tDist.m_fAnchorLon, 0.0f, tScan.m_tDist.m_bDeg, tCircle ) )
 			{
-				SkiplistEntry_t & t = tWord.m_dSkiplist.Add();
-				SkiplistEntry_t & p = tWord.m_dSkiplist [ tWord.m_dSkiplist.GetLength()-2 ];
-				t.m_iBaseDocid = p.m_iBaseDocid + SPH_SKIPLIST_BLOCK + (SphDocID_t) sphUnzipOffset ( pSkip );
-				t.m_iOffset = p.m_iOffset + 4*SPH_SKIPLIST_BLOCK + sphUnzipOffset ( pSkip );
-				t.m_iBaseHitlistPos = p.m_iBaseHitlistPos + sphUnzipOffset ( pSkip );
+				tScan.m_bNearest = true;
+				tScan.m_tDistLoc = tSchema.GetAttr(iAttr).m_tLocator;
+				tScan.m_iNearest = Max ( Min ( pQuery->m_iOffset+pQuery->m_iLimit, pQuery->m_iMaxMatches ), 1 );
 			}
 		}
-
-		tWord.m_rdDoclist.SeekTo ( tRes.m_iDoclistOffset, tRes.m_iDoclistHint );
-
-		tWord.m_rdHitlist.SetBuffers ( g_iReadBuffer, g_iReadUnhinted );
-		tWord.m_rdHitlist.SetFile ( m_tHitlist );
-		tWord.m_rdHitlist.m_pProfile = m_pProfile;
-		tWord.m_rdHitlist.m_eProfileState = SPH_QSTATE_READ_HITS;
 	}
 
-	return true;
+	if ( tScan.m_bNearest )
+		return true;
+
+	// plain box lookup only pays off when it skips most of the rows
+	return bNarrowed && m_tGeoGrid.CountRows ( tScan.m_tBox )*2<m_iDocinfo;
 }
 
-//////////////////////////////////////////////////////////////////////////////
 
-bool CSphIndex_VLN::Lock ()
+//////////////////////////////////////////////////////////////////////////
+// SCAN ORDER
+//////////////////////////////////////////////////////////////////////////
+
+template < typename T >
+struct AttrOrderEntry_t
 {
-	CSphString sName = GetIndexFileName("spl");
-	sphLogDebug ( "Locking the index via file %s", sName.cstr() );
+	T		m_tKey;
+	DWORD	m_uRow;
 
-	if ( m_iLockFD<0 )
+	bool operator < ( const AttrOrderEntry_t & rhs ) const
 	{
-		m_iLockFD = ::open ( sName.cstr(), SPH_O_NEW, 0644 );
-		if ( m_iLockFD<0 )
-		{
-			m_sLastError.SetSprintf ( "failed to open %s: %s", sName.cstr(), strerror(errno) );
-			sphLogDebug ( "failed to open %s: %s", sName.cstr(), strerror(errno) );
-			return false;
-		}
+		return m_tKey<rhs.m_tKey || ( m_tKey==rhs.m_tKey && m_uRow<rhs.m_uRow );
 	}
+};
 
-	if ( !sphLockEx ( m_iLockFD, false ) )
-	{
-		m_sLastError.SetSprintf ( "failed to lock %s: %s", sName.cstr(), strerror(errno) );
-		::close ( m_iLockFD );
-		m_iLockFD = -1;
-		return false;
-	}
-	sphLogDebug ( "lock %s success", sName.cstr() );
-	return true;
+
+static inline void GetOrderKey ( SphAttr_t uValue, SphAttr_t & tKey )
+{
+	tKey = uValue;
 }
 
 
-void CSphIndex_VLN::Unlock()
+static inline void GetOrderKey ( SphAttr_t uValue, float & tKey )
 {
-	CSphString sName = GetIndexFileName("spl");
-	sphLogDebug ( "Unlocking the index (lock %s)", sName.cstr() );
-	if ( m_iLockFD>=0 )
-	{
-		sphLogDebug ( "File ID ok, closing lock FD %d, unlinking %s", m_iLockFD, sName.cstr() );
-		sphLockUn ( m_iLockFD );
-		::close ( m_iLockFD );
-		::unlink ( sName.cstr() );
-		m_iLockFD = -1;
-	}
+	tKey = sphDW2F ( (DWORD)uValue );
 }
 
-void CSphIndex_VLN::Dealloc ()
+
+template < typename T >
+static bool SortRowsByAttr ( const DWORD * pDocinfo, int iRows, int iStride, const CSphAttrLocator & tLoc, CSphFixedVector<DWORD> & dOrder )
 {
-	if ( !m_bPassedAlloc )
-		return;
+	CSphFixedVector< AttrOrderEntry_t<T> > dEntries ( iRows );
+	const DWORD * pRow = pDocinfo;
+	for ( int i=0; i<iRows; i++, pRow+=iStride )
+	{
+		GetOrderKey ( sphGetRowAttr ( DOCINFO2ATTRS ( pRow ), tLoc ), dEntries[i].m_tKey );
+		if ( !( dEntries[i].m_tKey==dEntries[i].m_tKey ) )
+			return false; // NaN, no order to speak of
+		dEntries[i].m_uRow = (DWORD)i;
+	}
 
-	m_tDoclistFile.Close ();
-	m_tHitlistFile.Close ();
+	sphSort ( dEntries.Begin(), dEntries.GetLength() );
 
-	m_tAttr.Reset ();
-	m_tMva.Reset ();
-	m_tString.Reset ();
-	m_tKillList.Reset ();
-	m_tSkiplists.Reset ();
-	m_tWordlist.Reset ();
-	m_tDocinfoHash.Reset ();
-	m_tMinMaxLegacy.Reset();
+	dOrder.Reset ( iRows );
+	for ( int i=0; i<iRows; i++ )
+		dOrder[i] = dEntries[i].m_uRow;
+	return true;
+}
 
-	m_iDocinfo = 0;
-	m_iMinMaxIndex = 0;
-	m_tSettings.m_eDocinfo = SPH_DOCINFO_NONE;
 
-	SafeDelete ( m_pFieldFilter );
-	SafeDelete ( m_pQueryTokenizer );
-	SafeDelete ( m_pTokenizer );
-	SafeDelete ( m_pDict );
+bool sphBuildAttrOrder ( const DWORD * pDocinfo, int64_t iRows, int iStride, const CSphColumnInfo & tCol, CSphFixedVector<DWORD> & dOrder )
+{
+	dOrder.Reset ( 0 );
+	if ( iRows<=0 || iRows>INT_MAX )
+		return false;
 
-	if ( m_iIndexTag>=0 && g_pMvaArena )
-		g_tMvaArena.TaggedFreeTag ( m_iIndexTag );
-	m_iIndexTag = -1;
+	switch ( tCol.m_eAttrType )
+	{
+	case SPH_ATTR_INTEGER:
+	case SPH_ATTR_TIMESTAMP:
+	case SPH_ATTR_BOOL:
+	case SPH_ATTR_BIGINT:
+		return SortRowsByAttr<SphAttr_t> ( pDocinfo, (int)iRows, iStride, tCol.m_tLocator, dOrder );
 
-	m_bPassedRead = false;
-	m_bPassedAlloc = false;
-	m_uAttrsStatus = false;
+	case SPH_ATTR_FLOAT:
+		return SortRowsByAttr<float> ( pDocinfo, (int)iRows, iStride, tCol.m_tLocator, dOrder );
 
-	QcacheDeleteIndex ( m_iIndexId );
-	m_iIndexId = m_tIdGenerator.Inc();
+	default:
+		return false;
+	}
 }
 
 
-void LoadIndexSettings ( CSphIndexSettings & tSettings, CSphReader & tReader, DWORD uVersion )
+void CSphIndex_VLN::BuildAttrOrder ()
 {
-	if ( uVersion>=8 )
+	m_dAttrOrder.Reset ( 0 );
+	m_bAttrOrderStale = false;
+
+	const CSphColumnInfo * pCol = m_tSchema.GetAttr ( m_tSettings.m_sSortByAttr.cstr() );
+	if ( !pCol )
 	{
-		tSettings.m_iMinPrefixLen = tReader.GetDword ();
-		tSettings.m_iMinInfixLen = tReader.GetDword ();
+		sphWarning ( "index '%s': sort_by attribute '%s' not found, scan order disabled", m_sIndexName.cstr(), m_tSettings.m_sSortByAttr.cstr() );
+		return;
+	}
 
-	} else if ( uVersion>=6 )
+	int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	if ( !sphBuildAttrOrder ( m_tAttr.GetWritePtr(), m_iDocinfo, iStride, *pCol, m_dAttrOrder ) )
+		sphWarning ( "index '%s': sort_by requires an integer or float attribute with no NaN values, scan order disabled", m_sIndexName.cstr() );
+}
+
+
+int CSphIndex_VLN::GetOrderedScanLimit ( const CSphQuery * pQuery, int iSorters, bool & bDesc ) const
+{
+	if ( !m_dAttrOrder.GetLength() || m_bAttrOrderStale || iSorters!=1 || !pQuery->m_sGroupBy.IsEmpty()
+		|| pQuery->m_bReverseScan || pQuery->m_iCutoff>0 || pQuery->m_dOverrides.GetLength() )
+		return 0;
+
+	// aggregates without group by need every row (implicit grouping)
+	ARRAY_FOREACH ( i, pQuery->m_dItems )
 	{
-		bool bPrefixesOnly = ( tReader.GetByte ()!=0 );
-		tSettings.m_iMinPrefixLen = tReader.GetDword ();
-		tSettings.m_iMinInfixLen = 0;
-		if ( !bPrefixesOnly )
-			Swap ( tSettings.m_iMinPrefixLen, tSettings.m_iMinInfixLen );
+		const CSphQueryItem & tItem = pQuery->m_dItems[i];
+		if ( tItem.m_eAggrFunc!=SPH_AGGR_NONE || tItem.m_sExpr=="count(*)" || tItem.m_sExpr=="@distinct" )
+			return 0;
 	}
 
-	if ( uVersion>=38 )
-		tSettings.m_iMaxSubstringLen = tReader.GetDword();
+	// the cursor makes the sorter drop the rows of the previous pages, so the rows passing the filters don't tell when to stop
+	if ( !pQuery->m_sSearchAfter.IsEmpty() )
+		return 0;
 
-	if ( uVersion>=9 )
+	// just the sort_by attribute, in either direction
+	CSphVector<CSphString> dSort;
+	sphSplit ( dSort, pQuery->m_sSortBy.cstr(), " \t" );
+	switch ( pQuery->m_eSort )
 	{
-		tSettings.m_bHtmlStrip = !!tReader.GetByte ();
-		tSettings.m_sHtmlIndexAttrs = tReader.GetString ();
-		tSettings.m_sHtmlRemoveElements = tReader.GetString ();
+	case SPH_SORT_ATTR_ASC:
+	case SPH_SORT_ATTR_DESC:
+		if ( dSort.GetLength()!=1 )
+			return 0;
+		bDesc = ( pQuery->m_eSort==SPH_SORT_ATTR_DESC );
+		break;
+
+	case SPH_SORT_EXTENDED:
+		if ( dSort.GetLength()!=2 )
+			return 0;
+		if ( strcasecmp ( dSort[1].cstr(), "asc" )==0 )
+			bDesc = false;
+		else if ( strcasecmp ( dSort[1].cstr(), "desc" )==0 )
+			bDesc = true;
+		else
+			return 0;
+		break;
+
+	default:
+		return 0;
 	}
 
-	if ( uVersion>=12 )
-		tSettings.m_bIndexExactWords = !!tReader.GetByte ();
+	if ( strcasecmp ( dSort[0].cstr(), m_tSettings.m_sSortByAttr.cstr() )!=0 )
+		return 0;
 
-	if ( uVersion>=18 )
-		tSettings.m_eHitless = (ESphHitless)tReader.GetDword();
+	// legacy attribute sort modes compare floats as raw bits, so negative ones go in another order than the scan
+	const CSphColumnInfo * pKey = m_tSchema.GetAttr ( m_tSettings.m_sSortByAttr.cstr() );
+	if ( !pKey || ( pKey->m_eAttrType==SPH_ATTR_FLOAT && pQuery->m_eSort!=SPH_SORT_EXTENDED ) )
+		return 0;
 
-	if ( uVersion>=19 )
-		tSettings.m_eHitFormat = (ESphHitFormat)tReader.GetDword();
-	else // force plain format for old indices
-		tSettings.m_eHitFormat = SPH_HIT_FORMAT_PLAIN;
+	return Max ( Min ( pQuery->m_iOffset+pQuery->m_iLimit, pQuery->m_iMaxMatches ), 1 );
+}
 
-	if ( uVersion>=21 )
-		tSettings.m_bIndexSP = !!tReader.GetByte();
 
-	if ( uVersion>=22 )
-	{
-		tSettings.m_sZones = tReader.GetString();
-		if ( uVersion<25 && !tSettings.m_sZones.IsEmpty() )
-			tSettings.m_sZones.SetSprintf ( "%s*", tSettings.m_sZones.cstr() );
-	}
+/// fullscan one row through the filters into the sorters; returns true if it passed the filters
+bool CSphIndex_VLN::ScanRow ( const DWORD * pDocinfo, CSphQueryContext & tCtx, CSphMatch & tMatch, CSphQueryResult * pResult,
+	int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs, bool bRandomize ) const
+{
+	pResult->m_tStats.m_iFetchedDocs++;
+	tMatch.m_uDocID = DOCINFO2ID ( pDocinfo );
+	CopyDocinfo ( &tCtx, tMatch, pDocinfo );
 
-	if ( uVersion>=23 )
+	tCtx.CalcFilter ( tMatch );
+	if ( tCtx.m_pFilter && !tCtx.m_pFilter->Eval ( tMatch ) )
 	{
-		tSettings.m_iBoundaryStep = (int)tReader.GetDword();
-		tSettings.m_iStopwordStep = (int)tReader.GetDword();
+		tCtx.FreeStrFilter ( tMatch );
+		return false;
 	}
 
-	if ( uVersion>=28 )
-		tSettings.m_iOvershortStep = (int)tReader.GetDword();
+	if ( bRandomize )
+		tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
 
-	if ( uVersion>=30 )
-		tSettings.m_iEmbeddedLimit = (int)tReader.GetDword();
+	// submit match to sorters
+	tCtx.CalcSort ( tMatch );
 
-	if ( uVersion>=32 )
-	{
-		tSettings.m_eBigramIndex = (ESphBigram)tReader.GetByte();
-		tSettings.m_sBigramWords = tReader.GetString();
-	}
+	for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+		ppSorters[iSorter]->Push ( tMatch );
 
-	if ( uVersion>=35 )
-		tSettings.m_bIndexFieldLens = ( tReader.GetByte()!=0 );
+	// stringptr expressions should be duplicated (or taken over) at this point
+	tCtx.FreeStrFilter ( tMatch );
+	tCtx.FreeStrSort ( tMatch );
+	return true;
+}
 
-	if ( uVersion>=39 )
+
+/// check that every dictionary encoded string of the sorter schema is the very same column of the index
+/// (a sorter shared by several indexes carries the dictionary offsets of the first one)
+static bool HasOwnStringDicts ( const ISphSchema & tSorterSchema, const CSphSchema & tIndexSchema )
+{
+	for ( int i=0; i<tSorterSchema.GetAttrsCount(); i++ )
 	{
-		tSettings.m_eChineseRLP = (ESphRLPFilter)tReader.GetByte();
-		tSettings.m_sRLPContext = tReader.GetString();
-	}
+		const CSphColumnInfo & tCol = tSorterSchema.GetAttr(i);
+		if ( !tCol.m_uStringDict )
+			continue;
 
-	if ( uVersion>=41 )
-		tSettings.m_sIndexTokenFilter = tReader.GetString();
+		const CSphColumnInfo * pOwn = tIndexSchema.GetAttr ( tCol.m_sName.cstr() );
+		if ( !pOwn || pOwn->m_uStringDict!=tCol.m_uStringDict || !( pOwn->m_tLocator==tCol.m_tLocator ) )
+			return false;
+	}
+	return true;
 }
 
 
-bool CSphIndex_VLN::LoadHeader ( const char * sHeaderName, bool bStripPath, CSphEmbeddedFiles & tEmbeddedFiles, CSphString & sWarning )
+bool CSphIndex_VLN::MultiScan ( const CSphQuery * pQuery, CSphQueryResult * pResult,
+	int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
 {
-	const int MAX_HEADER_SIZE = 32768;
-	CSphFixedVector<BYTE> dCacheInfo ( MAX_HEADER_SIZE );
-
-	CSphAutoreader rdInfo ( dCacheInfo.Begin(), MAX_HEADER_SIZE ); // to avoid mallocs
-	if ( !rdInfo.Open ( sHeaderName, m_sLastError ) )
-		return false;
+	assert ( pQuery->m_sQuery.IsEmpty() );
+	assert ( tArgs.m_iTag>=0 );
 
-	// magic header
-	const char* sFmt = CheckFmtMagic ( rdInfo.GetDword () );
-	if ( sFmt )
+	// check if index is ready
+	if ( !m_bPassedAlloc )
 	{
-		m_sLastError.SetSprintf ( sFmt, sHeaderName );
+		pResult->m_sError = "index not preread";
 		return false;
 	}
 
-	// version
-	m_uVersion = rdInfo.GetDword();
-	if ( m_uVersion==0 || m_uVersion>INDEX_FORMAT_VERSION )
+	// check if index supports scans
+	if ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN || !m_tSchema.GetAttrsCount() )
 	{
-		m_sLastError.SetSprintf ( "%s is v.%d, binary is v.%d", sHeaderName, m_uVersion, INDEX_FORMAT_VERSION );
+		pResult->m_sError = "fullscan requires extern docinfo";
 		return false;
 	}
 
-	// bits
-	bool bUse64 = false;
-	if ( m_uVersion>=2 )
-		bUse64 = ( rdInfo.GetDword ()!=0 );
+	// we count documents only (before filters)
+	if ( pQuery->m_iMaxPredictedMsec )
+		pResult->m_bHasPrediction = true;
 
-	if ( bUse64!=USE_64BIT )
-	{
-		m_sLastError.SetSprintf ( "'%s' is id%d, and this binary is id%d",
-			GetIndexFileName("sph").cstr(),
-			bUse64 ? 64 : 32, USE_64BIT ? 64 : 32 );
-		return false;
-	}
+	if ( tArgs.m_uPackedFactorFlags & SPH_FACTOR_ENABLE )
+		pResult->m_sWarning.SetSprintf ( "packedfactors() will not work with a fullscan; you need to specify a query" );
 
-	// skiplists
-	m_bHaveSkips = ( m_uVersion>=31 );
+	// check if index has data
+	if ( m_bIsEmpty || m_iDocinfo<=0 || m_tAttr.IsEmpty() )
+		return true;
 
-	// docinfo
-	m_tSettings.m_eDocinfo = (ESphDocinfo) rdInfo.GetDword();
+	// start counting
+	int64_t tmQueryStart = sphMicroTimer();
 
-	// schema
-	// 4th arg means that inline attributes need be dynamic in searching time too
-	ReadSchema ( rdInfo, m_tSchema, m_uVersion, m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE );
+	ScopedThreadPriority_c tPrio ( pQuery->m_bLowPriority );
 
-	// check schema for dupes
-	for ( int iAttr=1; iAttr<m_tSchema.GetAttrsCount(); iAttr++ )
+	// select the sorter with max schema
+	// uses GetAttrsCount to get working facets (was GetRowSize)
+	int iMaxSchemaSize = -1;
+	int iMaxSchemaIndex = -1;
+	for ( int i=0; i<iSorters; i++ )
+		if ( ppSorters[i]->GetSchema().GetAttrsCount() > iMaxSchemaSize )
+		{
+			iMaxSchemaSize = ppSorters[i]->GetSchema().GetAttrsCount();
+			iMaxSchemaIndex = i;
+		}
+
+	// setup calculations and result schema
+	CSphQueryContext tCtx ( *pQuery );
+	if ( !tCtx.SetupCalc ( pResult, ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema, m_tMva.GetWritePtr(), m_bArenaProhibit ) )
+		return false;
+
+	// set string pool for string on_sort expression fix up
+	tCtx.SetStringPool ( m_tString.GetWritePtr() );
+
+	// setup filters
+	tCtx.m_bStringDicts = HasOwnStringDicts ( ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema );
+	if ( !tCtx.CreateFilters ( true, &pQuery->m_dFilters, ppSorters[iMaxSchemaIndex]->GetSchema(),
+		m_tMva.GetWritePtr(), m_tString.GetWritePtr(), pResult->m_sError, pResult->m_sWarning, pQuery->m_eCollation, m_bArenaProhibit, tArgs.m_dKillList ) )
+			return false;
+
+	// check if we can early reject the whole index
+	if ( tCtx.m_pFilter && m_iDocinfoIndex )
 	{
-		const CSphColumnInfo & tCol = m_tSchema.GetAttr(iAttr);
-		for ( int i=0; i<iAttr; i++ )
-			if ( m_tSchema.GetAttr(i).m_sName==tCol.m_sName )
-				sWarning.SetSprintf ( "duplicate attribute name: %s", tCol.m_sName.cstr() );
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		DWORD * pMinEntry = const_cast<DWORD*> ( &m_pDocinfoIndex [ m_iDocinfoIndex*uStride*2 ] );
+		DWORD * pMaxEntry = pMinEntry + uStride;
+
+		if ( !tCtx.m_pFilter->EvalBlock ( pMinEntry, pMaxEntry ) )
+		{
+			pResult->m_iQueryTime += (int)( ( sphMicroTimer()-tmQueryStart )/1000 );
+			return true;
+		}
 	}
 
-	// in case of *fork rotation we reuse min match from 1st rotated index ( it could be less than my size and inline ( m_pDynamic ) )
-	// min doc
-	m_dMinRow.Reset ( m_tSchema.GetRowSize() );
-	if ( m_uVersion>=2 )
-		m_uMinDocid = (SphDocID_t) rdInfo.GetOffset (); // v2+; losing high bits when !USE_64 is intentional, check is performed on bUse64 above
-	else
-		m_uMinDocid = rdInfo.GetDword(); // v1
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
-		rdInfo.GetBytes ( m_dMinRow.Begin(), sizeof(CSphRowitem)*m_tSchema.GetRowSize() );
+	// setup lookup
+	tCtx.m_bLookupFilter = false;
+	tCtx.m_bLookupSort = true;
 
-	// dictionary header (wordlist checkpoints, infix blocks, etc)
-	m_tWordlist.m_iDictCheckpointsOffset = rdInfo.GetOffset();
-	m_tWordlist.m_iDictCheckpoints = rdInfo.GetDword();
-	if ( m_uVersion>=27 )
+	// setup sorters vs. MVA
+	for ( int i=0; i<iSorters; i++ )
 	{
-		m_tWordlist.m_iInfixCodepointBytes = rdInfo.GetByte();
-		m_tWordlist.m_iInfixBlocksOffset = rdInfo.GetDword();
+		(ppSorters[i])->SetMVAPool ( m_tMva.GetWritePtr(), m_bArenaProhibit );
+		(ppSorters[i])->SetStringPool ( m_tString.GetWritePtr() );
 	}
-	if ( m_uVersion>=34 )
-		m_tWordlist.m_iInfixBlocksWordsSize = rdInfo.GetDword();
-
-	m_tWordlist.m_dCheckpoints.Reset ( m_tWordlist.m_iDictCheckpoints );
 
-	// index stats
-	m_tStats.m_iTotalDocuments = rdInfo.GetDword ();
-	m_tStats.m_iTotalBytes = rdInfo.GetOffset ();
-	if ( m_uVersion>=40 )
-		m_iTotalDups = rdInfo.GetDword();
+	// setup overrides
+	if ( !tCtx.SetupOverrides ( pQuery, pResult, m_tSchema, ppSorters[iMaxSchemaIndex]->GetSchema() ) )
+		return false;
 
-	LoadIndexSettings ( m_tSettings, rdInfo, m_uVersion );
-	if ( m_uVersion<9 )
-		m_bStripperInited = false;
+	// prepare to work them rows
+	bool bRandomize = ppSorters[0]->m_bRandomize;
 
-	CSphTokenizerSettings tTokSettings;
-	if ( m_uVersion>=9 )
-	{
-		// tokenizer stuff
-		if ( !LoadTokenizerSettings ( rdInfo, tTokSettings, tEmbeddedFiles, m_uVersion, m_sLastError ) )
-			return false;
+	CSphMatch tMatch;
+	tMatch.Reset ( ppSorters[iMaxSchemaIndex]->GetSchema().GetDynamicSize() );
+	tMatch.m_iWeight = tArgs.m_iIndexWeight;
+	tMatch.m_iTag = tCtx.m_dCalcFinal.GetLength() ? -1 : tArgs.m_iTag;
 
-		if ( bStripPath )
-			StripPath ( tTokSettings.m_sSynonymsFile );
+	if ( pResult->m_pProfile )
+		pResult->m_pProfile->Switch ( SPH_QSTATE_FULLSCAN );
 
-		ISphTokenizer * pTokenizer = ISphTokenizer::Create ( tTokSettings, &tEmbeddedFiles, m_sLastError );
-		if ( !pTokenizer )
-			return false;
+	GeoScan_t tGeo;
+	bool bGeoScan = SetupGeoScan ( pQuery, ppSorters[iMaxSchemaIndex]->GetSchema(), iSorters, tGeo );
 
-		// dictionary stuff
-		CSphDictSettings tDictSettings;
-		LoadDictionarySettings ( rdInfo, tDictSettings, tEmbeddedFiles, m_uVersion, sWarning );
+	bool bOrderDesc = false;
+	int iOrderedLimit = bGeoScan ? 0 : GetOrderedScanLimit ( pQuery, iSorters, bOrderDesc );
 
-		if ( bStripPath )
+	// optimize direct lookups by id
+	// narrow down geo lookups to the grid cells
+	// walk ORDER BY sort_by attribute queries in that order, and stop early
+	// run full scan with block and row filtering for everything else
+	if ( pQuery->m_dFilters.GetLength()==1
+		&& pQuery->m_dFilters[0].m_eType==SPH_FILTER_VALUES
+		&& pQuery->m_dFilters[0].m_bExclude==false
+		&& pQuery->m_dFilters[0].m_sAttrName=="@id"
+		&& tArgs.m_dKillList.GetLength()==0 )
+	{
+		// run id lookups
+		for ( int i=0; i<pQuery->m_dFilters[0].GetNumValues(); i++ )
 		{
-			StripPath ( tDictSettings.m_sStopwords );
-			ARRAY_FOREACH ( i, tDictSettings.m_dWordforms )
-				StripPath ( tDictSettings.m_dWordforms[i] );
-		}
+			pResult->m_tStats.m_iFetchedDocs++;
+			SphDocID_t uDocid = (SphDocID_t) pQuery->m_dFilters[0].GetValue(i);
+			const DWORD * pRow = FindDocinfo ( uDocid );
 
-		CSphDict * pDict = tDictSettings.m_bWordDict
-			? sphCreateDictionaryKeywords ( tDictSettings, &tEmbeddedFiles, pTokenizer, m_sIndexName.cstr(), m_sLastError )
-			: sphCreateDictionaryCRC ( tDictSettings, &tEmbeddedFiles, pTokenizer, m_sIndexName.cstr(), m_sLastError );
+			if ( !pRow )
+				continue;
 
-		if ( !pDict )
-			return false;
+			assert ( uDocid==DOCINFO2ID(pRow) );
+			tMatch.m_uDocID = uDocid;
+			CopyDocinfo ( &tCtx, tMatch, pRow );
 
-		if ( tDictSettings.m_sMorphFingerprint!=pDict->GetMorphDataFingerprint() )
-			sWarning.SetSprintf ( "different lemmatizer dictionaries (index='%s', current='%s')",
-				tDictSettings.m_sMorphFingerprint.cstr(),
-				pDict->GetMorphDataFingerprint().cstr() );
+			if ( bRandomize )
+				tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
 
-		SetDictionary ( pDict );
+			// submit match to sorters
+			tCtx.CalcSort ( tMatch );
 
-		pTokenizer = ISphTokenizer::CreateMultiformFilter ( pTokenizer, pDict->GetMultiWordforms () );
-		SetTokenizer ( pTokenizer );
-		SetupQueryTokenizer();
+			for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+				ppSorters[iSorter]->Push ( tMatch );
 
-		// initialize AOT if needed
-		m_tSettings.m_uAotFilterMask = sphParseMorphAot ( tDictSettings.m_sMorphology.cstr() );
-	}
+			// stringptr expressions should be duplicated (or taken over) at this point
+			tCtx.FreeStrSort ( tMatch );
+		}
+	} else if ( bGeoScan )
+	{
+		// scan rows from the cells that cover the filters box
+		// nearest-first search repeats that over a growing circle, until enough matches are closer than its radius
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		CSphVector<DWORD> dRows;
+		CSphVector<float> dDists;
+		CSphBitvec dVisited ( m_tGeoGrid.GetCellsCount() );
+		float fRadius = Max ( m_tGeoGrid.GetCellMeters ( tGeo.m_tDist.m_bDeg ), 1.0f );
+		GeoGrid_c::Box_t tBounds = m_tGeoGrid.GetBounds();
 
-	if ( m_uVersion>=10 )
-		rdInfo.GetDword ();
+		for ( ;; )
+		{
+			GeoGrid_c::Box_t tBox = tGeo.m_tBox;
+			bool bLast = true;
+			if ( tGeo.m_bNearest )
+			{
+				GeoGrid_c::Box_t tCircle;
+				Verify ( m_tGeoGrid.GetCircleBox ( tGeo.m_tDist.m_fAnchorLat, tGeo.m_tDist.m_fAnchorLon, fRadius, tGeo.m_tDist.m_bDeg, tCircle ) );
+				bLast = tCircle.m_fLatMin<=tBounds.m_fLatMin && tCircle.m_fLatMax>=tBounds.m_fLatMax && tCircle.m_iLonRanges==1
+					&& tCircle.m_dLonMin[0]<=tBounds.m_dLonMin[0] && tCircle.m_dLonMax[0]>=tBounds.m_dLonMax[0];
+				if ( !tBox.Intersect ( tCircle ) )
+				{
+					tBox = tGeo.m_tBox;
+					bLast = true;
+				}
+			}
 
-	if ( m_uVersion>=33 )
-		m_iMinMaxIndex = rdInfo.GetOffset ();
-	else if ( m_uVersion>=20 )
-		m_iMinMaxIndex = rdInfo.GetDword ();
+			dRows.Resize ( 0 );
+			m_tGeoGrid.CollectRows ( tBox, dRows, &dVisited );
+			dRows.Sort();
 
-	if ( m_uVersion>=28 )
+			ARRAY_FOREACH ( i, dRows )
+			{
+				const DWORD * pDocinfo = m_tAttr.GetWritePtr() + (int64_t)dRows[i]*uStride;
+				if ( ScanRow ( pDocinfo, tCtx, tMatch, pResult, iSorters, ppSorters, tArgs, bRandomize ) && tGeo.m_bNearest )
+					dDists.Add ( tMatch.GetAttrFloat ( tGeo.m_tDistLoc ) );
+			}
+
+			if ( bLast )
+				break;
+
+			// every row within the radius was scanned by now
+			float fCovered = fRadius*tGeo.m_tDist.m_fOut;
+			int iWithin = 0;
+			ARRAY_FOREACH ( i, dDists )
+				iWithin += ( dDists[i]<=fCovered );
+			if ( iWithin>=tGeo.m_iNearest )
+				break;
+
+			fRadius *= 2.0f;
+		}
+	} else if ( iOrderedLimit )
 	{
-		ISphFieldFilter * pFieldFilter = NULL;
-		CSphFieldFilterSettings tFieldFilterSettings;
-		LoadFieldFilterSettings ( rdInfo, tFieldFilterSettings );
-		if ( tFieldFilterSettings.m_dRegexps.GetLength() )
-			pFieldFilter = sphCreateRegexpFilter ( tFieldFilterSettings, m_sLastError );
+		// once the sorter got enough matches, rows past the last matched key can only rank lower
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		const CSphColumnInfo * pKey = m_tSchema.GetAttr ( m_tSettings.m_sSortByAttr.cstr() );
+		assert ( pKey );
+		bool bFloat = ( pKey->m_eAttrType==SPH_ATTR_FLOAT );
+		int iRows = m_dAttrOrder.GetLength();
+		int iMatched = 0;
+		SphAttr_t uLastKey = 0;
 
-		if ( !sphSpawnRLPFilter ( pFieldFilter, m_tSettings, tTokSettings, sHeaderName, m_sLastError ) )
+		for ( int i=0; i<iRows; i++ )
 		{
-			SafeDelete ( pFieldFilter );
-			return false;
+			const DWORD * pDocinfo = m_tAttr.GetWritePtr() + (int64_t)m_dAttrOrder [ bOrderDesc ? iRows-1-i : i ]*uStride;
+			SphAttr_t uKey = sphGetRowAttr ( DOCINFO2ATTRS ( pDocinfo ), pKey->m_tLocator );
+			if ( iMatched>=iOrderedLimit && ( bFloat ? sphDW2F ( (DWORD)uKey )!=sphDW2F ( (DWORD)uLastKey ) : uKey!=uLastKey ) )
+			{
+				pResult->m_iUnscannedRows += iRows-i;
+				break;
+			}
+
+			if ( ScanRow ( pDocinfo, tCtx, tMatch, pResult, iSorters, ppSorters, tArgs, bRandomize ) && ++iMatched<=iOrderedLimit )
+				uLastKey = uKey;
 		}
+	} else
+	{
+		bool bReverse = pQuery->m_bReverseScan; // shortcut
+		int iCutoff = ( pQuery->m_iCutoff<=0 ) ? -1 : pQuery->m_iCutoff;
 
-		SetFieldFilter ( pFieldFilter );
-	}
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		int64_t iStart = bReverse ? m_iDocinfoIndex-1 : 0;
+		int64_t iEnd = bReverse ? -1 : m_iDocinfoIndex;
+		int64_t iStep = bReverse ? -1 : 1;
+		for ( int64_t iIndexEntry=iStart; iIndexEntry!=iEnd; iIndexEntry+=iStep )
+		{
+			// block-level filtering
+			const DWORD * pMin = &m_pDocinfoIndex[ iIndexEntry*uStride*2 ];
+			const DWORD * pMax = pMin + uStride;
+			if ( tCtx.m_pFilter && !tCtx.m_pFilter->EvalBlock ( pMin, pMax ) )
+				continue;
 
+			// row-level filtering
+			const DWORD * pBlockStart = m_tAttr.GetWritePtr() + ( iIndexEntry*uStride*DOCINFO_INDEX_FREQ );
+			const DWORD * pBlockEnd = m_tAttr.GetWritePtr() + ( Min ( ( iIndexEntry+1 )*DOCINFO_INDEX_FREQ, m_iDocinfo )*uStride );
+			if ( bReverse )
+			{
+				pBlockStart = m_tAttr.GetWritePtr() + ( ( Min ( ( iIndexEntry+1 )*DOCINFO_INDEX_FREQ, m_iDocinfo ) - 1 ) * uStride );
+				pBlockEnd = m_tAttr.GetWritePtr() + uStride*( iIndexEntry*DOCINFO_INDEX_FREQ-1 );
+			}
+			int iDocinfoStep = bReverse ? -(int)uStride : (int)uStride;
 
-	if ( m_uVersion>=35 && m_tSettings.m_bIndexFieldLens )
-		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
-			m_dFieldLens[i] = rdInfo.GetOffset(); // FIXME? ideally 64bit even when off is 32bit..
+			if ( !tCtx.m_pOverrides && tCtx.m_pFilter && !pQuery->m_iCutoff && !tCtx.m_dCalcFilter.GetLength() && !tCtx.m_dCalcSort.GetLength() )
+			{
+				// kinda fastpath
+				for ( const DWORD * pDocinfo=pBlockStart; pDocinfo!=pBlockEnd; pDocinfo+=iDocinfoStep )
+				{
+					pResult->m_tStats.m_iFetchedDocs++;
+					tMatch.m_uDocID = DOCINFO2ID ( pDocinfo );
+					tMatch.m_pStatic = DOCINFO2ATTRS ( pDocinfo );
 
-	// post-load stuff.. for now, bigrams
-	CSphIndexSettings & s = m_tSettings;
-	if ( s.m_eBigramIndex!=SPH_BIGRAM_NONE && s.m_eBigramIndex!=SPH_BIGRAM_ALL )
+					if ( tCtx.m_pFilter->Eval ( tMatch ) )
+					{
+						if ( bRandomize )
+							tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
+						for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+							ppSorters[iSorter]->Push ( tMatch );
+					}
+					// stringptr expressions should be duplicated (or taken over) at this point
+					tCtx.FreeStrFilter ( tMatch );
+				}
+			} else
+			{
+				// generic path
+				for ( const DWORD * pDocinfo=pBlockStart; pDocinfo!=pBlockEnd; pDocinfo+=iDocinfoStep )
+				{
+					pResult->m_tStats.m_iFetchedDocs++;
+					tMatch.m_uDocID = DOCINFO2ID ( pDocinfo );
+					CopyDocinfo ( &tCtx, tMatch, pDocinfo );
+
+					// early filter only (no late filters in full-scan because of no @weight)
+					tCtx.CalcFilter ( tMatch );
+					if ( tCtx.m_pFilter && !tCtx.m_pFilter->Eval ( tMatch ) )
+					{
+						tCtx.FreeStrFilter ( tMatch );
+						continue;
+					}
+
+					if ( bRandomize )
+						tMatch.m_iWeight = ( sphRand() & 0xffff ) * tArgs.m_iIndexWeight;
+
+					// submit match to sorters
+					tCtx.CalcSort ( tMatch );
+
+					bool bNewMatch = false;
+					for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+						bNewMatch |= ppSorters[iSorter]->Push ( tMatch );
+
+					// stringptr expressions should be duplicated (or taken over) at this point
+					tCtx.FreeStrFilter ( tMatch );
+					tCtx.FreeStrSort ( tMatch );
+
+					// handle cutoff
+					if ( bNewMatch && --iCutoff==0 )
+					{
+						iIndexEntry = iEnd - iStep; // outer break
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	if ( pResult->m_pProfile )
+		pResult->m_pProfile->Switch ( SPH_QSTATE_FINALIZE );
+
+	// do final expression calculations
+	if ( tCtx.m_dCalcFinal.GetLength() )
 	{
-		BYTE * pTok;
-		m_pTokenizer->SetBuffer ( (BYTE*)s.m_sBigramWords.cstr(), s.m_sBigramWords.Length() );
-		while ( ( pTok = m_pTokenizer->GetToken() )!=NULL )
-			s.m_dBigramWords.Add() = (const char*)pTok;
-		s.m_dBigramWords.Sort();
+		SphFinalMatchCalc_t tFinal ( tArgs.m_iTag, NULL, tCtx );
+		for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+		{
+			ISphMatchSorter * pTop = ppSorters[iSorter];
+			pTop->Finalize ( tFinal, false );
+		}
+		tCtx.m_iBadRows += tFinal.m_iBadRows;
 	}
 
+	// done
+	pResult->m_pMva = m_tMva.GetWritePtr();
+	pResult->m_pStrings = m_tString.GetWritePtr();
+	pResult->m_bArenaProhibit = m_bArenaProhibit;
+	pResult->m_iQueryTime += (int)( ( sphMicroTimer()-tmQueryStart )/1000 );
+	pResult->m_iBadRows += tCtx.m_iBadRows;
 
-	if ( rdInfo.GetErrorFlag() )
-		m_sLastError.SetSprintf ( "%s: failed to parse header (unexpected eof)", sHeaderName );
-	return !rdInfo.GetErrorFlag();
+	return true;
 }
 
+//////////////////////////////////////////////////////////////////////////////
 
-void CSphIndex_VLN::DebugDumpHeader ( FILE * fp, const char * sHeaderName, bool bConfig )
+ISphQword * DiskIndexQwordSetup_c::QwordSpawn ( const XQKeyword_t & tWord ) const
 {
-	CSphEmbeddedFiles tEmbeddedFiles;
-	CSphString sWarning;
-	if ( !LoadHeader ( sHeaderName, false, tEmbeddedFiles, sWarning ) )
+	if ( !tWord.m_pPayload )
 	{
-		fprintf ( fp, "FATAL: failed to load header: %s.\n", m_sLastError.cstr() );
-		return;
+		WITH_QWORD ( m_pIndex, false, Qword, return new Qword ( tWord.m_bExpanded, tWord.m_bExcluded ) );
+	} else
+	{
+		if ( m_pIndex->GetSettings().m_eHitFormat==SPH_HIT_FORMAT_INLINE )
+		{
+			return new DiskPayloadQword_c<true> ( (const DiskSubstringPayload_t *)tWord.m_pPayload, tWord.m_bExcluded, m_tDoclist, m_tHitlist, m_pProfile );
+		} else
+		{
+			return new DiskPayloadQword_c<false> ( (const DiskSubstringPayload_t *)tWord.m_pPayload, tWord.m_bExcluded, m_tDoclist, m_tHitlist, m_pProfile );
+		}
 	}
+	return NULL;
+}
 
-	if ( !sWarning.IsEmpty () )
-		fprintf ( fp, "WARNING: %s\n", sWarning.cstr () );
-
-	///////////////////////////////////////////////
-	// print header in index config section format
-	///////////////////////////////////////////////
 
-	if ( bConfig )
-	{
-		fprintf ( fp, "\nsource $dump\n{\n" );
+bool DiskIndexQwordSetup_c::QwordSetup ( ISphQword * pWord ) const
+{
+	DiskIndexQwordTraits_c * pMyWord = (DiskIndexQwordTraits_c*)pWord;
 
-		fprintf ( fp, "\tsql_query = SELECT id \\\n" );
-		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
-			fprintf ( fp, "\t, %s \\\n", m_tSchema.m_dFields[i].m_sName.cstr() );
-		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
-		{
-			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
-			fprintf ( fp, "\t, %s \\\n", tAttr.m_sName.cstr() );
-		}
-		fprintf ( fp, "\tFROM documents\n" );
+	// setup attrs
+	pMyWord->m_tDoc.Reset ( m_iDynamicRowitems );
+	pMyWord->m_iMinID = m_uMinDocid;
+	pMyWord->m_tDoc.m_uDocID = m_uMinDocid;
 
-		if ( m_tSchema.GetAttrsCount() )
-			fprintf ( fp, "\n" );
+	return pMyWord->Setup ( this );
+}
 
-		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
-		{
-			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
-			if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET )
-				fprintf ( fp, "\tsql_attr_multi = uint %s from field\n", tAttr.m_sName.cstr() );
-			else if ( tAttr.m_eAttrType==SPH_ATTR_INT64SET )
-				fprintf ( fp, "\tsql_attr_multi = bigint %s from field\n", tAttr.m_sName.cstr() );
-			else if ( tAttr.m_eAttrType==SPH_ATTR_INTEGER && tAttr.m_tLocator.IsBitfield() )
-				fprintf ( fp, "\tsql_attr_uint = %s:%d\n", tAttr.m_sName.cstr(), tAttr.m_tLocator.m_iBitCount );
-			else if ( tAttr.m_eAttrType==SPH_ATTR_TOKENCOUNT )
-			{; // intendedly skip, as these are autogenerated by index_field_lengths=1
-			} else
-				fprintf ( fp, "\t%s = %s\n", sphTypeDirective ( tAttr.m_eAttrType ), tAttr.m_sName.cstr() );
-		}
 
-		fprintf ( fp, "}\n\nindex $dump\n{\n\tsource = $dump\n\tpath = $dump\n" );
-
-		if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
-			fprintf ( fp, "\tdocinfo = inline\n" );
-		if ( m_tSettings.m_iMinPrefixLen )
-			fprintf ( fp, "\tmin_prefix_len = %d\n", m_tSettings.m_iMinPrefixLen );
-		if ( m_tSettings.m_iMinInfixLen )
-			fprintf ( fp, "\tmin_prefix_len = %d\n", m_tSettings.m_iMinInfixLen );
-		if ( m_tSettings.m_iMaxSubstringLen )
-			fprintf ( fp, "\tmax_substring_len = %d\n", m_tSettings.m_iMaxSubstringLen );
-		if ( m_tSettings.m_bIndexExactWords )
-			fprintf ( fp, "\tindex_exact_words = %d\n", m_tSettings.m_bIndexExactWords ? 1 : 0 );
-		if ( m_tSettings.m_bHtmlStrip )
-			fprintf ( fp, "\thtml_strip = 1\n" );
-		if ( !m_tSettings.m_sHtmlIndexAttrs.IsEmpty() )
-			fprintf ( fp, "\thtml_index_attrs = %s\n", m_tSettings.m_sHtmlIndexAttrs.cstr () );
-		if ( !m_tSettings.m_sHtmlRemoveElements.IsEmpty() )
-			fprintf ( fp, "\thtml_remove_elements = %s\n", m_tSettings.m_sHtmlRemoveElements.cstr () );
-		if ( !m_tSettings.m_sZones.IsEmpty() )
-			fprintf ( fp, "\tindex_zones = %s\n", m_tSettings.m_sZones.cstr() );
-		if ( m_tSettings.m_bIndexFieldLens )
-			fprintf ( fp, "\tindex_field_lengths = 1\n" );
-		if ( m_tSettings.m_bIndexSP )
-			fprintf ( fp, "\tindex_sp = 1\n" );
-		if ( m_tSettings.m_iBoundaryStep!=0 )
-			fprintf ( fp, "\tphrase_boundary_step = %d\n", m_tSettings.m_iBoundaryStep );
-		if ( m_tSettings.m_iStopwordStep!=1 )
-			fprintf ( fp, "\tstopword_step = %d\n", m_tSettings.m_iStopwordStep );
-		if ( m_tSettings.m_iOvershortStep!=1 )
-			fprintf ( fp, "\tovershort_step = %d\n", m_tSettings.m_iOvershortStep );
-		if ( m_tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE )
-			fprintf ( fp, "\tbigram_index = %s\n", sphBigramName ( m_tSettings.m_eBigramIndex ) );
-		if ( !m_tSettings.m_sBigramWords.IsEmpty() )
-			fprintf ( fp, "\tbigram_freq_words = %s\n", m_tSettings.m_sBigramWords.cstr() );
-		if ( !m_tSettings.m_sRLPContext.IsEmpty() )
-			fprintf ( fp, "\trlp_context = %s\n", m_tSettings.m_sRLPContext.cstr() );
-		if ( !m_tSettings.m_sIndexTokenFilter.IsEmpty() )
-			fprintf ( fp, "\tindex_token_filter = %s\n", m_tSettings.m_sIndexTokenFilter.cstr() );
+bool DiskIndexQwordSetup_c::Setup ( ISphQword * pWord ) const
+{
+	// there was a dynamic_cast here once but it's not necessary
+	// maybe it worth to rewrite class hierarchy to avoid c-cast here?
+	DiskIndexQwordTraits_c & tWord = *(DiskIndexQwordTraits_c*)pWord;
 
+	if ( m_eDocinfo==SPH_DOCINFO_INLINE )
+	{
+		tWord.m_iInlineAttrs = m_iInlineRowitems;
+		tWord.m_pInlineFixup = m_pMinRow;
+	} else
+	{
+		tWord.m_iInlineAttrs = 0;
+		tWord.m_pInlineFixup = NULL;
+	}
 
-		CSphFieldFilterSettings tFieldFilter;
-		GetFieldFilterSettings ( tFieldFilter );
-		ARRAY_FOREACH ( i, tFieldFilter.m_dRegexps )
-			fprintf ( fp, "\tregexp_filter = %s\n", tFieldFilter.m_dRegexps[i].cstr() );
+	// setup stats
+	tWord.m_iDocs = 0;
+	tWord.m_iHits = 0;
 
-		if ( m_pTokenizer )
-		{
-			const CSphTokenizerSettings & tSettings = m_pTokenizer->GetSettings ();
-			fprintf ( fp, "\tcharset_type = %s\n", ( tSettings.m_iType==TOKENIZER_UTF8 || tSettings.m_iType==TOKENIZER_NGRAM )
-					? "utf-8"
-					: "unknown tokenizer (deprecated sbcs?)" );
-			if ( !tSettings.m_sCaseFolding.IsEmpty() )
-				fprintf ( fp, "\tcharset_table = %s\n", tSettings.m_sCaseFolding.cstr () );
-			if ( tSettings.m_iMinWordLen>1 )
-				fprintf ( fp, "\tmin_word_len = %d\n", tSettings.m_iMinWordLen );
-			if ( tSettings.m_iNgramLen && !tSettings.m_sNgramChars.IsEmpty() )
-				fprintf ( fp, "\tngram_len = %d\nngram_chars = %s\n",
-					tSettings.m_iNgramLen, tSettings.m_sNgramChars.cstr () );
-			if ( !tSettings.m_sSynonymsFile.IsEmpty() )
-				fprintf ( fp, "\texceptions = %s\n", tSettings.m_sSynonymsFile.cstr () );
-			if ( !tSettings.m_sBoundary.IsEmpty() )
-				fprintf ( fp, "\tphrase_boundary = %s\n", tSettings.m_sBoundary.cstr () );
-			if ( !tSettings.m_sIgnoreChars.IsEmpty() )
-				fprintf ( fp, "\tignore_chars = %s\n", tSettings.m_sIgnoreChars.cstr () );
-			if ( !tSettings.m_sBlendChars.IsEmpty() )
-				fprintf ( fp, "\tblend_chars = %s\n", tSettings.m_sBlendChars.cstr () );
-			if ( !tSettings.m_sBlendMode.IsEmpty() )
-				fprintf ( fp, "\tblend_mode = %s\n", tSettings.m_sBlendMode.cstr () );
-		}
+	CSphIndex_VLN * pIndex = (CSphIndex_VLN *)m_pIndex;
 
-		if ( m_pDict )
-		{
-			const CSphDictSettings & tSettings = m_pDict->GetSettings ();
-			if ( tSettings.m_bWordDict )
-				fprintf ( fp, "\tdict = keywords\n" );
-			if ( !tSettings.m_sMorphology.IsEmpty() )
-				fprintf ( fp, "\tmorphology = %s\n", tSettings.m_sMorphology.cstr () );
-			if ( !tSettings.m_sStopwords.IsEmpty() )
-				fprintf ( fp, "\tstopwords = %s\n", tSettings.m_sStopwords.cstr () );
-			if ( tSettings.m_dWordforms.GetLength() )
-			{
-				fprintf ( fp, "\twordforms =" );
-				ARRAY_FOREACH ( i, tSettings.m_dWordforms )
-					fprintf ( fp, " %s", tSettings.m_dWordforms[i].cstr () );
-				fprintf ( fp, "\n" );
-			}
-			if ( tSettings.m_iMinStemmingLen>1 )
-				fprintf ( fp, "\tmin_stemming_len = %d\n", tSettings.m_iMinStemmingLen );
-			if ( tSettings.m_bStopwordsUnstemmed )
-				fprintf ( fp, "\tstopwords_unstemmed = 1\n" );
-		}
+	// !COMMIT FIXME!
+	// the below stuff really belongs in wordlist
+	// which in turn really belongs in dictreader
+	// which in turn might or might not be a part of dict
 
-		fprintf ( fp, "}\n" );
-		return;
-	}
+	// binary search through checkpoints for a one whose range matches word ID
+	assert ( pIndex->m_bPassedAlloc );
+	assert ( !pIndex->m_tWordlist.m_tBuf.IsEmpty() );
 
-	///////////////////////////////////////////////
-	// print header and stats in "readable" format
-	///////////////////////////////////////////////
+	// empty index?
+	if ( !pIndex->m_tWordlist.m_dCheckpoints.GetLength() )
+		return false;
 
-	fprintf ( fp, "version: %d\n",			m_uVersion );
-	fprintf ( fp, "idbits: %d\n",			USE_64BIT ? 64 : 32 );
-	fprintf ( fp, "docinfo: " );
-	switch ( m_tSettings.m_eDocinfo )
+	const char * sWord = tWord.m_sDictWord.cstr();
+	const bool bWordDict = pIndex->m_pDict->GetSettings().m_bWordDict;
+	int iWordLen = sWord ? strlen ( sWord ) : 0;
+	if ( bWordDict && tWord.m_sWord.Ends("*") )
 	{
-		case SPH_DOCINFO_NONE:		fprintf ( fp, "none\n" ); break;
-		case SPH_DOCINFO_INLINE:	fprintf ( fp, "inline\n" ); break;
-		case SPH_DOCINFO_EXTERN:	fprintf ( fp, "extern\n" ); break;
-		default:					fprintf ( fp, "unknown (value=%d)\n", m_tSettings.m_eDocinfo ); break;
-	}
+		iWordLen = Max ( iWordLen-1, 0 );
 
-	fprintf ( fp, "fields: %d\n", m_tSchema.m_dFields.GetLength() );
-	ARRAY_FOREACH ( i, m_tSchema.m_dFields )
-		fprintf ( fp, "  field %d: %s\n", i, m_tSchema.m_dFields[i].m_sName.cstr() );
+		// might match either infix or prefix
+		int iMinLen = Max ( pIndex->m_tSettings.m_iMinPrefixLen, pIndex->m_tSettings.m_iMinInfixLen );
+		if ( pIndex->m_tSettings.m_iMinPrefixLen )
+			iMinLen = Min ( iMinLen, pIndex->m_tSettings.m_iMinPrefixLen );
+		if ( pIndex->m_tSettings.m_iMinInfixLen )
+			iMinLen = Min ( iMinLen, pIndex->m_tSettings.m_iMinInfixLen );
 
-	fprintf ( fp, "attrs: %d\n", m_tSchema.GetAttrsCount() );
-	for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
-	{
-		const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
-		fprintf ( fp, "  attr %d: %s, %s", i, tAttr.m_sName.cstr(), sphTypeName ( tAttr.m_eAttrType ) );
-		if ( tAttr.m_eAttrType==SPH_ATTR_INTEGER && tAttr.m_tLocator.m_iBitCount!=32 )
-			fprintf ( fp, ", bits %d", tAttr.m_tLocator.m_iBitCount );
-		fprintf ( fp, ", bitoff %d\n", tAttr.m_tLocator.m_iBitOffset );
+		// bail out term shorter than prefix or infix allowed
+		if ( iWordLen<iMinLen )
+			return false;
 	}
 
-	// skipped min doc, wordlist checkpoints
-	fprintf ( fp, "total-documents: " INT64_FMT "\n", m_tStats.m_iTotalDocuments );
-	fprintf ( fp, "total-bytes: " INT64_FMT "\n", int64_t(m_tStats.m_iTotalBytes) );
-	fprintf ( fp, "total-duplicates: %d\n", m_iTotalDups );
-
-	fprintf ( fp, "min-prefix-len: %d\n", m_tSettings.m_iMinPrefixLen );
-	fprintf ( fp, "min-infix-len: %d\n", m_tSettings.m_iMinInfixLen );
-	fprintf ( fp, "max-substring-len: %d\n", m_tSettings.m_iMaxSubstringLen );
-	fprintf ( fp, "exact-words: %d\n", m_tSettings.m_bIndexExactWords ? 1 : 0 );
-	fprintf ( fp, "html-strip: %d\n", m_tSettings.m_bHtmlStrip ? 1 : 0 );
-	fprintf ( fp, "html-index-attrs: %s\n", m_tSettings.m_sHtmlIndexAttrs.cstr () );
-	fprintf ( fp, "html-remove-elements: %s\n", m_tSettings.m_sHtmlRemoveElements.cstr () );
-	fprintf ( fp, "index-zones: %s\n", m_tSettings.m_sZones.cstr() );
-	fprintf ( fp, "index-field-lengths: %d\n", m_tSettings.m_bIndexFieldLens ? 1 : 0 );
-	fprintf ( fp, "index-sp: %d\n", m_tSettings.m_bIndexSP ? 1 : 0 );
-	fprintf ( fp, "phrase-boundary-step: %d\n", m_tSettings.m_iBoundaryStep );
-	fprintf ( fp, "stopword-step: %d\n", m_tSettings.m_iStopwordStep );
-	fprintf ( fp, "overshort-step: %d\n", m_tSettings.m_iOvershortStep );
-	fprintf ( fp, "bigram-index: %s\n", sphBigramName ( m_tSettings.m_eBigramIndex ) );
-	fprintf ( fp, "bigram-freq-words: %s\n", m_tSettings.m_sBigramWords.cstr() );
-	fprintf ( fp, "rlp-context: %s\n", m_tSettings.m_sRLPContext.cstr() );
-	fprintf ( fp, "index-token-filter: %s\n", m_tSettings.m_sIndexTokenFilter.cstr() );
-	CSphFieldFilterSettings tFieldFilter;
-	GetFieldFilterSettings ( tFieldFilter );
-	ARRAY_FOREACH ( i, tFieldFilter.m_dRegexps )
-		fprintf ( fp, "regexp-filter: %s\n", tFieldFilter.m_dRegexps[i].cstr() );
-
-	if ( m_pTokenizer )
+	// leading special symbols trimming
+	if ( bWordDict && tWord.m_sDictWord.Begins("*") )
 	{
-		const CSphTokenizerSettings & tSettings = m_pTokenizer->GetSettings ();
-		fprintf ( fp, "tokenizer-type: %d\n", tSettings.m_iType );
-		fprintf ( fp, "tokenizer-case-folding: %s\n", tSettings.m_sCaseFolding.cstr () );
-		fprintf ( fp, "tokenizer-min-word-len: %d\n", tSettings.m_iMinWordLen );
-		fprintf ( fp, "tokenizer-ngram-chars: %s\n", tSettings.m_sNgramChars.cstr () );
-		fprintf ( fp, "tokenizer-ngram-len: %d\n", tSettings.m_iNgramLen );
-		fprintf ( fp, "tokenizer-exceptions: %s\n", tSettings.m_sSynonymsFile.cstr () );
-		fprintf ( fp, "tokenizer-phrase-boundary: %s\n", tSettings.m_sBoundary.cstr () );
-		fprintf ( fp, "tokenizer-ignore-chars: %s\n", tSettings.m_sIgnoreChars.cstr () );
-		fprintf ( fp, "tokenizer-blend-chars: %s\n", tSettings.m_sBlendChars.cstr () );
-		fprintf ( fp, "tokenizer-blend-mode: %s\n", tSettings.m_sBlendMode.cstr () );
-		fprintf ( fp, "tokenizer-blend-mode: %s\n", tSettings.m_sBlendMode.cstr () );
-
-		fprintf ( fp, "dictionary-embedded-exceptions: %d\n", tEmbeddedFiles.m_bEmbeddedSynonyms ? 1 : 0 );
-		if ( tEmbeddedFiles.m_bEmbeddedSynonyms )
-		{
-			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dSynonyms )
-				fprintf ( fp, "\tdictionary-embedded-exception [%d]: %s\n", i, tEmbeddedFiles.m_dSynonyms[i].cstr () );
-		}
+		sWord++;
+		iWordLen = Max ( iWordLen-1, 0 );
+		// bail out term shorter than infix allowed
+		if ( iWordLen<pIndex->m_tSettings.m_iMinInfixLen )
+			return false;
 	}
 
-	if ( m_pDict )
+	// keywords FST knows exact keyword position, or that there is no such keyword at all
+	const KeywordsFst_c & tFst = pIndex->m_tWordlist.m_tFst;
+	int iFstOrdinal = -1;
+	const CSphWordlistCheckpoint * pCheckpoint = NULL;
+	if ( bWordDict && !tFst.IsEmpty() )
 	{
-		const CSphDictSettings & tSettings = m_pDict->GetSettings ();
-		fprintf ( fp, "dict: %s\n", tSettings.m_bWordDict ? "keywords" : "crc" );
-		fprintf ( fp, "dictionary-morphology: %s\n", tSettings.m_sMorphology.cstr () );
+		iFstOrdinal = tFst.Find ( (const BYTE *)sWord, iWordLen );
+		if ( iFstOrdinal<0 )
+			return false;
+		pCheckpoint = pIndex->m_tWordlist.m_dCheckpoints.Begin() + iFstOrdinal / SPH_WORDLIST_CHECKPOINT;
+	} else
+	{
+		pCheckpoint = pIndex->m_tWordlist.FindCheckpoint ( sWord, iWordLen, tWord.m_uWordID, false );
+	}
+	if ( !pCheckpoint )
+		return false;
 
-		fprintf ( fp, "dictionary-stopwords-file: %s\n", tSettings.m_sStopwords.cstr () );
-		fprintf ( fp, "dictionary-embedded-stopwords: %d\n", tEmbeddedFiles.m_bEmbeddedStopwords ? 1 : 0 );
-		if ( tEmbeddedFiles.m_bEmbeddedStopwords )
-		{
-			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dStopwords )
-				fprintf ( fp, "\tdictionary-embedded-stopword [%d]: " DOCID_FMT "\n", i, tEmbeddedFiles.m_dStopwords[i] );
-		}
+	// decode wordlist chunk
+	const BYTE * pBuf = pIndex->m_tWordlist.AcquireDict ( pCheckpoint );
+	assert ( pBuf );
 
-		ARRAY_FOREACH ( i, tSettings.m_dWordforms )
-			fprintf ( fp, "dictionary-wordform-file [%d]: %s\n", i, tSettings.m_dWordforms[i].cstr () );
+	CSphDictEntry tRes;
+	if ( bWordDict && iFstOrdinal>=0 )
+	{
+		KeywordsBlockReader_c tCtx ( pBuf, m_pSkips!=NULL );
+		for ( int i=iFstOrdinal % SPH_WORDLIST_CHECKPOINT; i>=0; i-- )
+			if ( !tCtx.UnpackWord() )
+				return false;
+		tRes = tCtx;
 
-		fprintf ( fp, "dictionary-embedded-wordforms: %d\n", tEmbeddedFiles.m_bEmbeddedWordforms ? 1 : 0 );
-		if ( tEmbeddedFiles.m_bEmbeddedWordforms )
+	} else if ( bWordDict )
+	{
+		KeywordsBlockReader_c tCtx ( pBuf, m_pSkips!=NULL );
+		while ( tCtx.UnpackWord() )
 		{
-			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dWordforms )
-				fprintf ( fp, "\tdictionary-embedded-wordform [%d]: %s\n", i, tEmbeddedFiles.m_dWordforms[i].cstr () );
+			// block is sorted
+			// so once keywords are greater than the reference word, no more matches
+			assert ( tCtx.GetWordLen()>0 );
+			int iCmp = sphDictCmpStrictly ( sWord, iWordLen, tCtx.GetWord(), tCtx.GetWordLen() );
+			if ( iCmp<0 )
+				return false;
+			if ( iCmp==0 )
+				break;
 		}
+		if ( tCtx.GetWordLen()<=0 )
+			return false;
+		tRes = tCtx;
 
-		fprintf ( fp, "min-stemming-len: %d\n", tSettings.m_iMinStemmingLen );
-		fprintf ( fp, "stopwords-unstemmed: %d\n", tSettings.m_bStopwordsUnstemmed ? 1 : 0 );
+	} else
+	{
+		if ( !pIndex->m_tWordlist.GetWord ( pBuf, tWord.m_uWordID, tRes ) )
+			return false;
 	}
 
-	fprintf ( fp, "killlist-size: %u\n", 0 );
-	fprintf ( fp, "min-max-index: " INT64_FMT "\n", m_iMinMaxIndex );
-}
-
+	const ESphHitless eMode = pIndex->m_tSettings.m_eHitless;
+	tWord.m_iDocs = eMode==SPH_HITLESS_SOME ? ( tRes.m_iDocs & HITLESS_DOC_MASK ) : tRes.m_iDocs;
+	tWord.m_iHits = tRes.m_iHits;
+	tWord.m_bHasHitlist =
+		( eMode==SPH_HITLESS_NONE ) ||
+		( eMode==SPH_HITLESS_SOME && !( tRes.m_iDocs & HITLESS_DOC_FLAG ) );
 
-void CSphIndex_VLN::DebugDumpDocids ( FILE * fp )
-{
-	if ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN )
+	if ( m_bSetupReaders )
 	{
-		fprintf ( fp, "FATAL: docids dump only supported for docinfo=extern\n" );
-		return;
-	}
+		tWord.m_rdDoclist.SetBuffers ( g_iReadBuffer, g_iReadUnhinted );
+		tWord.m_rdDoclist.SetFile ( m_tDoclist );
+		tWord.m_rdDoclist.m_pProfile = m_pProfile;
+		tWord.m_rdDoclist.m_eProfileState = SPH_QSTATE_READ_DOCS;
 
-	const int iRowStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		// read in skiplist
+		// OPTIMIZE? maybe cache hot decompressed lists?
+		// OPTIMIZE? maybe add an option to decompress on preload instead?
+		if ( m_pSkips && tRes.m_iDocs>SPH_SKIPLIST_BLOCK )
+		{
+			const BYTE * pSkip = m_pSkips + tRes.m_iSkiplistOffset;
 
-	const int64_t iNumMinMaxRow = ( m_uVersion>=20 ) ? ( (m_iDocinfoIndex+1)*iRowStride*2 ) : 0;
-	const int64_t iNumRows = (m_tAttr.GetNumEntries()-iNumMinMaxRow) / iRowStride;
+			tWord.m_dSkiplist.Add();
+			tWord.m_dSkiplist.Last().m_iBaseDocid = 0;
+			tWord.m_dSkiplist.Last().m_iOffset = tRes.m_iDoclistOffset;
+			tWord.m_dSkiplist.Last().m_iBaseHitlistPos = 0;
 
-	const int64_t iDocinfoSize = iRowStride*m_iDocinfo*sizeof(DWORD);
-	const int64_t iMinmaxSize = iNumMinMaxRow*sizeof(CSphRowitem);
+			for ( int i=1; i<( tWord.m_iDocs/SPH_SKIPLIST_BLOCK ); i++ )
+			{
+				SkiplistEntry_t & t = tWord.m_dSkiplist.Add();
+				SkiplistEntry_t & p = tWord.m_dSkiplist [ tWord.m_dSkiplist.GetLength()-2 ];
+				t.m_iBaseDocid = p.m_iBaseDocid + SPH_SKIPLIST_BLOCK + (SphDocID_t) sphUnzipOffset ( pSkip );
+				t.m_iOffset = p.m_iOffset + 4*SPH_SKIPLIST_BLOCK + sphUnzipOffset ( pSkip );
+				t.m_iBaseHitlistPos = p.m_iBaseHitlistPos + sphUnzipOffset ( pSkip );
+			}
+		}
 
-	fprintf ( fp, "docinfo-bytes: docinfo=" INT64_FMT ", min-max=" INT64_FMT ", total=" UINT64_FMT "\n"
-		, iDocinfoSize, iMinmaxSize, (uint64_t)m_tAttr.GetLengthBytes() );
-	fprintf ( fp, "docinfo-stride: %d\n", (int)(iRowStride*sizeof(DWORD)) );
-	fprintf ( fp, "docinfo-rows: " INT64_FMT "\n", iNumRows );
+		tWord.m_rdDoclist.SeekTo ( tRes.m_iDoclistOffset, tRes.m_iDoclistHint );
 
-	if ( !m_tAttr.GetNumEntries() )
-		return;
+		tWord.m_rdHitlist.SetBuffers ( g_iReadBuffer, g_iReadUnhinted );
+		tWord.m_rdHitlist.SetFile ( m_tHitlist );
+		tWord.m_rdHitlist.m_pProfile = m_pProfile;
+		tWord.m_rdHitlist.m_eProfileState = SPH_QSTATE_READ_HITS;
+	}
 
-	DWORD * pDocinfo = m_tAttr.GetWritePtr();
-	for ( int64_t iRow=0; iRow<iNumRows; iRow++, pDocinfo+=iRowStride )
-		printf ( INT64_FMT". id=" DOCID_FMT "\n", iRow+1, DOCINFO2ID ( pDocinfo ) );
-	printf ( "--- min-max=" INT64_FMT " ---\n", iNumMinMaxRow );
-	for ( int64_t iRow=0; iRow<(m_iDocinfoIndex+1)*2; iRow++, pDocinfo+=iRowStride )
-		printf ( "id=" DOCID_FMT "\n", DOCINFO2ID ( pDocinfo ) );
+	return true;
 }
 
+//////////////////////////////////////////////////////////////////////////////
 
-void CSphIndex_VLN::DebugDumpHitlist ( FILE * fp, const char * sKeyword, bool bID )
+bool CSphIndex_VLN::Lock ()
 {
-	WITH_QWORD ( this, false, Qword, DumpHitlist<Qword> ( fp, sKeyword, bID ) );
-}
-
+	CSphString sName = GetIndexFileName("spl");
+	sphLogDebug ( "Locking the index via file %s", sName.cstr() );
 
-template < class Qword >
-void CSphIndex_VLN::DumpHitlist ( FILE * fp, const char * sKeyword, bool bID )
-{
-	// get keyword id
-	SphWordID_t uWordID = 0;
-	BYTE * sTok = NULL;
-	if ( !bID )
+	if ( m_iLockFD<0 )
 	{
-		CSphString sBuf ( sKeyword );
-
-		m_pTokenizer->SetBuffer ( (BYTE*)sBuf.cstr(), strlen ( sBuf.cstr() ) );
-		sTok = m_pTokenizer->GetToken();
-
-		if ( !sTok )
-			sphDie ( "keyword=%s, no token (too short?)", sKeyword );
+		m_iLockFD = ::open ( sName.cstr(), SPH_O_NEW, 0644 );
+		if ( m_iLockFD<0 )
+		{
+			m_sLastError.SetSprintf ( "failed to open %s: %s", sName.cstr(), strerror(errno) );
+			sphLogDebug ( "failed to open %s: %s", sName.cstr(), strerror(errno) );
+			return false;
+		}
+	}
 
-		uWordID = m_pDict->GetWordID ( sTok );
-		if ( !uWordID )
-			sphDie ( "keyword=%s, tok=%s, no wordid (stopped?)", sKeyword, sTok );
+	if ( !sphLockEx ( m_iLockFD, false ) )
+	{
+		m_sLastError.SetSprintf ( "failed to lock %s: %s", sName.cstr(), strerror(errno) );
+		::close ( m_iLockFD );
+		m_iLockFD = -1;
+		return false;
+	}
+	sphLogDebug ( "lock %s success", sName.cstr() );
+	return true;
+}
 
-		fprintf ( fp, "keyword=%s, tok=%s, wordid=" UINT64_FMT "\n", sKeyword, sTok, uint64_t(uWordID) );
 
-	} else
+void CSphIndex_VLN::Unlock()
+{
+	CSphString sName = GetIndexFileName("spl");
+	sphLogDebug ( "Unlocking the index (lock %s)", sName.cstr() );
+	if ( m_iLockFD>=0 )
 	{
-		uWordID = (SphWordID_t) strtoull ( sKeyword, NULL, 10 );
-		if ( !uWordID )
-			sphDie ( "failed to convert keyword=%s to id (must be integer)", sKeyword );
-
-		fprintf ( fp, "wordid=" UINT64_FMT "\n", uint64_t(uWordID) );
+		sphLogDebug ( "File ID ok, closing lock FD %d, unlinking %s", m_iLockFD, sName.cstr() );
+		sphLockUn ( m_iLockFD );
+		::close ( m_iLockFD );
+		::unlink ( sName.cstr() );
+		m_iLockFD = -1;
 	}
+}
 
-	// open files
-	CSphAutofile tDoclist, tHitlist;
-	if ( tDoclist.Open ( GetIndexFileName("spd"), SPH_O_READ, m_sLastError ) < 0 )
-		sphDie ( "failed to open doclist: %s", m_sLastError.cstr() );
+void CSphIndex_VLN::Dealloc ()
+{
+	if ( !m_bPassedAlloc )
+		return;
 
-	if ( tHitlist.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, m_sLastError ) < 0 )
-		sphDie ( "failed to open hitlist: %s", m_sLastError.cstr() );
+	m_tDoclistFile.Close ();
+	m_tHitlistFile.Close ();
 
-	// aim
-	DiskIndexQwordSetup_c tTermSetup ( tDoclist, tHitlist, m_tSkiplists.GetWritePtr(), NULL );
-	tTermSetup.m_pDict = m_pDict;
-	tTermSetup.m_pIndex = this;
-	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
-	tTermSetup.m_uMinDocid = m_uMinDocid;
-	tTermSetup.m_pMinRow = m_dMinRow.Begin();
-	tTermSetup.m_bSetupReaders = true;
+	m_tAttr.Reset ();
+	m_tMva.Reset ();
+	m_tString.Reset ();
+	m_tKillList.Reset ();
+	m_tSkiplists.Reset ();
+	m_tWordlist.Reset ();
+	m_tDocinfoHash.Reset ();
+	m_tMinMaxLegacy.Reset();
+	m_tGeoGrid.Reset();
+	m_dAttrOrder.Reset ( 0 );
 
-	Qword tKeyword ( false, false );
-	tKeyword.m_tDoc.m_uDocID = m_uMinDocid;
-	tKeyword.m_uWordID = uWordID;
-	tKeyword.m_sWord = sKeyword;
-	tKeyword.m_sDictWord = (const char *)sTok;
-	if ( !tTermSetup.QwordSetup ( &tKeyword ) )
-		sphDie ( "failed to setup keyword" );
+	m_iDocinfo = 0;
+	m_iMinMaxIndex = 0;
+	m_tSettings.m_eDocinfo = SPH_DOCINFO_NONE;
 
-	int iSize = m_tSchema.GetRowSize();
-	CSphVector<CSphRowitem> dAttrs ( iSize );
+	SafeDelete ( m_pFieldFilter );
+	SafeDelete ( m_pQueryTokenizer );
+	SafeDelete ( m_pTokenizer );
+	SafeDelete ( m_pDict );
 
-	// press play on tape
-	for ( ;; )
-	{
-		tKeyword.GetNextDoc ( iSize ? &dAttrs[0] : NULL );
-		if ( !tKeyword.m_tDoc.m_uDocID )
-			break;
-		tKeyword.SeekHitlist ( tKeyword.m_iHitlistPos );
+	if ( m_iIndexTag>=0 && g_pMvaArena )
+		g_tMvaArena.TaggedFreeTag ( m_iIndexTag );
+	m_iIndexTag = -1;
 
-		int iHits = 0;
-		if ( tKeyword.m_bHasHitlist )
-			for ( Hitpos_t uHit = tKeyword.GetNextHit(); uHit!=EMPTY_HIT; uHit = tKeyword.GetNextHit() )
-			{
-				fprintf ( fp, "doc=" DOCID_FMT ", hit=0x%08x\n", tKeyword.m_tDoc.m_uDocID, uHit ); // FIXME?
-				iHits++;
-			}
+	m_bPassedRead = false;
+	m_bPassedAlloc = false;
+	m_uAttrsStatus = false;
 
-		if ( !iHits )
-		{
-			uint64_t uOff = tKeyword.m_iHitlistPos;
-			fprintf ( fp, "doc=" DOCID_FMT ", NO HITS, inline=%d, off=" UINT64_FMT "\n",
-				tKeyword.m_tDoc.m_uDocID, (int)(uOff>>63), (uOff<<1)>>1 );
-		}
-	}
+	QcacheDeleteIndex ( m_iIndexId );
+	m_iIndexId = m_tIdGenerator.Inc();
 }
 
 
-void CSphIndex_VLN::DebugDumpDict ( FILE * fp )
+void LoadIndexSettings ( CSphIndexSettings & tSettings, CSphReader & tReader, DWORD uVersion )
 {
-	if ( !m_pDict->GetSettings().m_bWordDict )
+	if ( uVersion>=8 )
 	{
-		fprintf ( fp, "sorry, DebugDumpDict() only supports dict=keywords for now\n" );
-		return;
-	}
+		tSettings.m_iMinPrefixLen = tReader.GetDword ();
+		tSettings.m_iMinInfixLen = tReader.GetDword ();
 
-	fprintf ( fp, "keyword,docs,hits,offset\n" );
-	m_tWordlist.DebugPopulateCheckpoints();
-	ARRAY_FOREACH ( i, m_tWordlist.m_dCheckpoints )
+	} else if ( uVersion>=6 )
 	{
-		KeywordsBlockReader_c tCtx ( m_tWordlist.AcquireDict ( &m_tWordlist.m_dCheckpoints[i] ), m_bHaveSkips );
-		while ( tCtx.UnpackWord() )
-			fprintf ( fp, "%s,%d,%d," INT64_FMT "\n", tCtx.GetWord(), tCtx.m_iDocs, tCtx.m_iHits, int64_t(tCtx.m_iDoclistOffset) );
+		bool bPrefixesOnly = ( tReader.GetByte ()!=0 );
+		tSettings.m_iMinPrefixLen = tReader.GetDword ();
+		tSettings.m_iMinInfixLen = 0;
+		if ( !bPrefixesOnly )
+			Swap ( tSettings.m_iMinPrefixLen, tSettings.m_iMinInfixLen );
 	}
-}
 
-//////////////////////////////////////////////////////////////////////////
+	if ( uVersion>=38 )
+		tSettings.m_iMaxSubstringLen = tReader.GetDword();
 
-bool CSphIndex_VLN::Prealloc ( bool bStripPath )
-{
-	MEMORY ( MEM_INDEX_DISK );
+	if ( uVersion>=9 )
+	{
+		tSettings.m_bHtmlStrip = !!tReader.GetByte ();
+		tSettings.m_sHtmlIndexAttrs = tReader.GetString ();
+		tSettings.m_sHtmlRemoveElements = tReader.GetString ();
+	}
 
-	// reset
-	Dealloc ();
+	if ( uVersion>=12 )
+		tSettings.m_bIndexExactWords = !!tReader.GetByte ();
 
-	CSphEmbeddedFiles tEmbeddedFiles;
+	if ( uVersion>=18 )
+		tSettings.m_eHitless = (ESphHitless)tReader.GetDword();
 
-	// preload schema
-	if ( !LoadHeader ( GetIndexFileName("sph").cstr(), bStripPath, tEmbeddedFiles, m_sLastWarning ) )
-		return false;
+	if ( uVersion>=19 )
+		tSettings.m_eHitFormat = (ESphHitFormat)tReader.GetDword();
+	else // force plain format for old indices
+		tSettings.m_eHitFormat = SPH_HIT_FORMAT_PLAIN;
 
-	tEmbeddedFiles.Reset();
+	if ( uVersion>=21 )
+		tSettings.m_bIndexSP = !!tReader.GetByte();
 
-	// verify that data files are readable
-	if ( !sphIsReadable ( GetIndexFileName("spd").cstr(), &m_sLastError ) )
-		return false;
+	if ( uVersion>=22 )
+	{
+		tSettings.m_sZones = tReader.GetString();
+		if ( uVersion<25 && !tSettings.m_sZones.IsEmpty() )
+			tSettings.m_sZones.SetSprintf ( "%s*", tSettings.m_sZones.cstr() );
+	}
 
-	if ( m_uVersion>=3 && !sphIsReadable ( GetIndexFileName("spp").cstr(), &m_sLastError ) )
-		return false;
+	if ( uVersion>=23 )
+	{
+		tSettings.m_iBoundaryStep = (int)tReader.GetDword();
+		tSettings.m_iStopwordStep = (int)tReader.GetDword();
+	}
 
-	if ( m_bHaveSkips && !sphIsReadable ( GetIndexFileName("spe").cstr(), &m_sLastError ) )
-		return false;
+	if ( uVersion>=28 )
+		tSettings.m_iOvershortStep = (int)tReader.GetDword();
 
-	// preopen
-	if ( m_bKeepFilesOpen )
+	if ( uVersion>=30 )
+		tSettings.m_iEmbeddedLimit = (int)tReader.GetDword();
+
+	if ( uVersion>=32 )
 	{
-		if ( m_tDoclistFile.Open ( GetIndexFileName("spd"), SPH_O_READ, m_sLastError ) < 0 )
-			return false;
+		tSettings.m_eBigramIndex = (ESphBigram)tReader.GetByte();
+		tSettings.m_sBigramWords = tReader.GetString();
+	}
 
-		if ( m_tHitlistFile.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, m_sLastError ) < 0 )
-			return false;
+	if ( uVersion>=35 )
+		tSettings.m_bIndexFieldLens = ( tReader.GetByte()!=0 );
+
+	if ( uVersion>=39 )
+	{
+		tSettings.m_eChineseRLP = (ESphRLPFilter)tReader.GetByte();
+		tSettings.m_sRLPContext = tReader.GetString();
 	}
 
-	/////////////////////
-	// prealloc wordlist
-	/////////////////////
+	if ( uVersion>=41 )
+		tSettings.m_sIndexTokenFilter = tReader.GetString();
 
-	if ( m_uVersion>=3 && !sphIsReadable ( GetIndexFileName("spi").cstr(), &m_sLastError ) )
+	if ( uVersion>=43 )
+		tSettings.m_bDictFst = ( tReader.GetByte()!=0 );
+
+	if ( uVersion>=44 )
+		tSettings.m_bInfixTrigrams = ( tReader.GetByte()!=0 );
+
+	if ( uVersion>=46 )
+	{
+		tSettings.m_sGeoLat = tReader.GetString();
+		tSettings.m_sGeoLon = tReader.GetString();
+	}
+
+	if ( uVersion>=47 )
+		tSettings.m_sSortByAttr = tReader.GetString();
+}
+
+
+bool CSphIndex_VLN::LoadHeader ( const char * sHeaderName, bool bStripPath, CSphEmbeddedFiles & tEmbeddedFiles, CSphString & sWarning )
+{
+	const int MAX_HEADER_SIZE = 32768;
+	CSphFixedVector<BYTE> dCacheInfo ( MAX_HEADER_SIZE );
+
+	CSphAutoreader rdInfo ( dCacheInfo.Begin(), MAX_HEADER_SIZE ); // to avoid mallocs
+	if ( !rdInfo.Open ( sHeaderName, m_sLastError ) )
 		return false;
 
-	// might be no dictionary at this point for old index format
-	bool bWordDict = m_pDict && m_pDict->GetSettings().m_bWordDict;
+	// magic header
+	const char* sFmt = CheckFmtMagic ( rdInfo.GetDword () );
+	if ( sFmt )
+	{
+		m_sLastError.SetSprintf ( sFmt, sHeaderName );
+		return false;
+	}
 
-	// only checkpoint and wordlist infixes are actually read here; dictionary itself is just mapped
-	if ( !m_tWordlist.Preread ( GetIndexFileName("spi").cstr() , m_uVersion, bWordDict, m_sLastError ) )
+	// version
+	m_uVersion = rdInfo.GetDword();
+	if ( m_uVersion==0 || m_uVersion>INDEX_FORMAT_VERSION )
+	{
+		m_sLastError.SetSprintf ( "%s is v.%d, binary is v.%d", sHeaderName, m_uVersion, INDEX_FORMAT_VERSION );
 		return false;
+	}
 
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN )
+	// bits
+	bool bUse64 = false;
+	if ( m_uVersion>=2 )
+		bUse64 = ( rdInfo.GetDword ()!=0 );
+
+	if ( bUse64!=USE_64BIT )
 	{
-		CSphAutofile tDocinfo ( GetIndexFileName("spa"), SPH_O_READ, m_sLastError );
-		if ( tDocinfo.GetFD()<0 )
-			return false;
+		m_sLastError.SetSprintf ( "'%s' is id%d, and this binary is id%d",
+			GetIndexFileName("sph").cstr(),
+			bUse64 ? 64 : 32, USE_64BIT ? 64 : 32 );
+		return false;
+	}
 
-		m_bIsEmpty = ( tDocinfo.GetSize ( 0, false, m_sLastError )==0 );
-	} else
-		m_bIsEmpty = ( m_tWordlist.m_tBuf.GetLengthBytes()<=1 );
+	// skiplists
+	m_bHaveSkips = ( m_uVersion>=31 );
 
-	if ( ( m_tWordlist.m_tBuf.GetLengthBytes()<=1 )!=( m_tWordlist.m_dCheckpoints.GetLength()==0 ) )
-		sphWarning ( "wordlist size mismatch (size=" INT64_FMT ", checkpoints=%d)", m_tWordlist.m_tBuf.GetLengthBytes(), m_tWordlist.m_dCheckpoints.GetLength() );
+	// docinfo
+	m_tSettings.m_eDocinfo = (ESphDocinfo) rdInfo.GetDword();
 
-	// make sure checkpoints are loadable
-	// pre-11 indices use different offset type (this is fixed up later during the loading)
-	assert ( m_tWordlist.m_iDictCheckpointsOffset>0 );
+	// schema
+	// 4th arg means that inline attributes need be dynamic in searching time too
+	ReadSchema ( rdInfo, m_tSchema, m_uVersion, m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE );
 
-	/////////////////////
-	// prealloc docinfos
-	/////////////////////
+	// check schema for dupes
+	for ( int iAttr=1; iAttr<m_tSchema.GetAttrsCount(); iAttr++ )
+	{
+		const CSphColumnInfo & tCol = m_tSchema.GetAttr(iAttr);
+		for ( int i=0; i<iAttr; i++ )
+			if ( m_tSchema.GetAttr(i).m_sName==tCol.m_sName )
+				sWarning.SetSprintf ( "duplicate attribute name: %s", tCol.m_sName.cstr() );
+	}
 
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_bIsEmpty )
+	// in case of *fork rotation we reuse min match from 1st rotated index ( it could be less than my size and inline ( m_pDynamic ) )
+	// min doc
+	m_dMinRow.Reset ( m_tSchema.GetRowSize() );
+	if ( m_uVersion>=2 )
+		m_uMinDocid = (SphDocID_t) rdInfo.GetOffset (); // v2+; losing high bits when !USE_64 is intentional, check is performed on bUse64 above
+	else
+		m_uMinDocid = rdInfo.GetDword(); // v1
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
+		rdInfo.GetBytes ( m_dMinRow.Begin(), sizeof(CSphRowitem)*m_tSchema.GetRowSize() );
+
+	// dictionary header (wordlist checkpoints, infix blocks, etc)
+	m_tWordlist.m_iDictCheckpointsOffset = rdInfo.GetOffset();
+	m_tWordlist.m_iDictCheckpoints = rdInfo.GetDword();
+	if ( m_uVersion>=27 )
 	{
-		/////////////
-		// attr data
-		/////////////
+		m_tWordlist.m_iInfixCodepointBytes = rdInfo.GetByte();
+		m_tWordlist.m_iInfixBlocksOffset = rdInfo.GetDword();
+	}
+	if ( m_uVersion>=34 )
+		m_tWordlist.m_iInfixBlocksWordsSize = rdInfo.GetDword();
+	m_tWordlist.m_iFstOffset = 0;
+	if ( m_uVersion>=43 )
+		m_tWordlist.m_iFstOffset = rdInfo.GetOffset();
+	m_tWordlist.m_iTrigramsOffset = 0;
+	if ( m_uVersion>=44 )
+		m_tWordlist.m_iTrigramsOffset = rdInfo.GetOffset();
 
-		int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	m_tWordlist.m_dCheckpoints.Reset ( m_tWordlist.m_iDictCheckpoints );
 
-		if ( !m_tAttr.Setup ( GetIndexFileName("spa").cstr(), m_sLastError, true ) )
-			return false;
+	// index stats
+	m_tStats.m_iTotalDocuments = rdInfo.GetDword ();
+	m_tStats.m_iTotalBytes = rdInfo.GetOffset ();
+	if ( m_uVersion>=40 )
+		m_iTotalDups = rdInfo.GetDword();
 
-		int64_t iDocinfoSize = m_tAttr.GetLengthBytes();
-		if ( iDocinfoSize<0 )
-			return false;
-		iDocinfoSize = iDocinfoSize / sizeof(DWORD);
-		int64_t iRealDocinfoSize = m_iMinMaxIndex ? m_iMinMaxIndex : iDocinfoSize;
-		m_iDocinfo = iRealDocinfoSize / iStride;
+	LoadIndexSettings ( m_tSettings, rdInfo, m_uVersion );
+	if ( m_uVersion<9 )
+		m_bStripperInited = false;
 
-		if ( !CheckDocsCount ( m_iDocinfo, m_sLastError ) )
+	CSphTokenizerSettings tTokSettings;
+	if ( m_uVersion>=9 )
+	{
+		// tokenizer stuff
+		if ( !LoadTokenizerSettings ( rdInfo, tTokSettings, tEmbeddedFiles, m_uVersion, m_sLastError ) )
 			return false;
 
-		if ( iDocinfoSize < iRealDocinfoSize )
-		{
-			m_sLastError.SetSprintf ( "precomputed chunk size check mismatch" );
-			sphLogDebug ( "precomputed chunk size check mismatch (size=" INT64_FMT ", real=" INT64_FMT ", min-max=" INT64_FMT ", count=" INT64_FMT ")",
-				iDocinfoSize, iRealDocinfoSize, m_iMinMaxIndex, m_iDocinfo );
+		if ( bStripPath )
+			StripPath ( tTokSettings.m_sSynonymsFile );
+
+		ISphTokenizer * pTokenizer = ISphTokenizer::Create ( tTokSettings, &tEmbeddedFiles, m_sLastError );
+		if ( !pTokenizer )
 			return false;
-		}
 
-		m_iDocinfoIndex = ( ( iDocinfoSize - iRealDocinfoSize ) / iStride / 2 ) - 1;
-		m_pDocinfoIndex = m_tAttr.GetWritePtr() + m_iMinMaxIndex;
+		// dictionary stuff
+		CSphDictSettings tDictSettings;
+		LoadDictionarySettings ( rdInfo, tDictSettings, tEmbeddedFiles, m_uVersion, sWarning );
 
-		// prealloc docinfo hash but only if docinfo is big enough (in other words if hash is 8x+ less in size)
-		if ( m_tAttr.GetLengthBytes() > ( 32 << DOCINFO_HASH_BITS ) && !m_bDebugCheck )
+		if ( bStripPath )
 		{
-			if ( !m_tDocinfoHash.Alloc ( ( 1 << DOCINFO_HASH_BITS )+4, m_sLastError ) )
-				return false;
+			StripPath ( tDictSettings.m_sStopwords );
+			ARRAY_FOREACH ( i, tDictSettings.m_dWordforms )
+				StripPath ( tDictSettings.m_dWordforms[i] );
 		}
 
-		////////////
-		// MVA data
-		////////////
-
-		if ( m_uVersion>=4 )
-		{
-			if ( !m_tMva.Setup ( GetIndexFileName("spm").cstr(), m_sLastError, false ) )
-				return false;
+		CSphDict * pDict = tDictSettings.m_bWordDict
+			? sphCreateDictionaryKeywords ( tDictSettings, &tEmbeddedFiles, pTokenizer, m_sIndexName.cstr(), m_sLastError )
+			: sphCreateDictionaryCRC ( tDictSettings, &tEmbeddedFiles, pTokenizer, m_sIndexName.cstr(), m_sLastError );
 
-			if ( m_tMva.GetNumEntries()>INT_MAX )
-			{
-				m_bArenaProhibit = true;
-				sphWarning ( "MVA update disabled (loaded MVA " INT64_FMT ", should be less %d)", m_tMva.GetNumEntries(), INT_MAX );
-			}
-		}
+		if ( !pDict )
+			return false;
 
-		///////////////
-		// string data
-		///////////////
+		if ( tDictSettings.m_sMorphFingerprint!=pDict->GetMorphDataFingerprint() )
+			sWarning.SetSprintf ( "different lemmatizer dictionaries (index='%s', current='%s')",
+				tDictSettings.m_sMorphFingerprint.cstr(),
+				pDict->GetMorphDataFingerprint().cstr() );
 
-		if ( m_uVersion>=17 && !m_tString.Setup ( GetIndexFileName("sps").cstr(), m_sLastError, true ) )
-				return false;
-	}
+		SetDictionary ( pDict );
 
+		pTokenizer = ISphTokenizer::CreateMultiformFilter ( pTokenizer, pDict->GetMultiWordforms () );
+		SetTokenizer ( pTokenizer );
+		SetupQueryTokenizer();
 
-	// prealloc killlist
-	if ( m_uVersion>=10 )
-	{
-		// FIXME!!! m_bId32to64
-		if ( !m_tKillList.Setup ( GetIndexFileName("spk").cstr(), m_sLastError, false ) )
-			return false;
+		// initialize AOT if needed
+		m_tSettings.m_uAotFilterMask = sphParseMorphAot ( tDictSettings.m_sMorphology.cstr() );
 	}
 
-	// prealloc skiplist
-	if ( !m_bDebugCheck && m_bHaveSkips && !m_tSkiplists.Setup ( GetIndexFileName("spe").cstr(), m_sLastError, false ) )
-			return false;
+	if ( m_uVersion>=10 )
+		rdInfo.GetDword ();
 
-	// almost done
-	m_bPassedAlloc = true;
-	m_iIndexTag = ++m_iIndexTagSeq;
+	if ( m_uVersion>=33 )
+		m_iMinMaxIndex = rdInfo.GetOffset ();
+	else if ( m_uVersion>=20 )
+		m_iMinMaxIndex = rdInfo.GetDword ();
 
-	bool bPersistMVA = sphIsReadable ( GetIndexFileName("mvp").cstr() );
-	bool bNoMinMax = ( m_uVersion<20 );
-	if ( ( bPersistMVA || bNoMinMax ) && !m_bDebugCheck )
+	if ( m_uVersion>=28 )
 	{
-		sphLogDebug ( "'%s' forced to read data at prealloc (persist MVA = %d, no min-max = %d)", m_sIndexName.cstr(), (int)bPersistMVA, (int)bNoMinMax );
-		Preread();
+		ISphFieldFilter * pFieldFilter = NULL;
+		CSphFieldFilterSettings tFieldFilterSettings;
+		LoadFieldFilterSettings ( rdInfo, tFieldFilterSettings );
+		if ( tFieldFilterSettings.m_dRegexps.GetLength() )
+			pFieldFilter = sphCreateRegexpFilter ( tFieldFilterSettings, m_sLastError );
 
-		// persist MVA needs valid DocinfoHash
-		sphLogDebug ( "Prereading .mvp" );
-		if ( !LoadPersistentMVA ( m_sLastError ) )
+		if ( !sphSpawnRLPFilter ( pFieldFilter, m_tSettings, tTokSettings, sHeaderName, m_sLastError ) )
+		{
+			SafeDelete ( pFieldFilter );
 			return false;
+		}
 
-		// build "indexes" for full-scan
-		if ( m_uVersion<20 && !PrecomputeMinMax() )
-			return false;
+		SetFieldFilter ( pFieldFilter );
 	}
 
-	return true;
-}
-
-
-void CSphIndex_VLN::Preread ()
-{
-	MEMORY ( MEM_INDEX_DISK );
-
-	sphLogDebug ( "CSphIndex_VLN::Preread invoked '%s'", m_sIndexName.cstr() );
-
-	assert ( m_bPassedAlloc );
-	if ( m_bPassedRead )
-		return;
-
-	///////////////////
-	// read everything
-	///////////////////
-
-	volatile BYTE uRead = 0; // just need all side-effects
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "attributes", m_bMlock, m_bOndiskAllAttr, m_tAttr );
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "MVA", m_bMlock, m_bOndiskPoolAttr, m_tMva );
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "strings", m_bMlock, m_bOndiskPoolAttr, m_tString );
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "kill-list", m_bMlock, m_bOndiskAllAttr, m_tKillList );
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "skip-list", m_bMlock, false, m_tSkiplists );
-	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "dictionary", m_bMlock, false, m_tWordlist.m_tBuf );
 
-	//////////////////////
-	// precalc everything
-	//////////////////////
+	if ( m_uVersion>=35 && m_tSettings.m_bIndexFieldLens )
+		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
+			m_dFieldLens[i] = rdInfo.GetOffset(); // FIXME? ideally 64bit even when off is 32bit..
 
-	// build attributes hash
-	if ( m_tAttr.GetLengthBytes() && m_tDocinfoHash.GetLengthBytes() && !m_bDebugCheck )
+	if ( m_uVersion>=45 )
 	{
-		sphLogDebug ( "Hashing docinfo" );
-		assert ( CheckDocsCount ( m_iDocinfo, m_sLastError ) );
-		int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
-		SphDocID_t uFirst = DOCINFO2ID ( &m_tAttr[0] );
-		SphDocID_t uRange = DOCINFO2ID ( &m_tAttr[ ( m_iDocinfo-1)*iStride ] ) - uFirst;
-		DWORD iShift = 0;
-		while ( uRange>=( 1 << DOCINFO_HASH_BITS ) )
-		{
-			iShift++;
-			uRange >>= 1;
-		}
-
-		DWORD * pHash = m_tDocinfoHash.GetWritePtr();
-		*pHash++ = iShift;
-		*pHash = 0;
-		DWORD uLastHash = 0;
-
-		for ( int64_t i=1; i<m_iDocinfo; i++ )
+		int iStringDicts = rdInfo.GetDword();
+		for ( int i=0; i<iStringDicts; i++ )
 		{
-			assert ( DOCINFO2ID ( &m_tAttr[ i*iStride ] )>uFirst
-				&& DOCINFO2ID ( &m_tAttr[ ( i-1 )*iStride ] ) < DOCINFO2ID ( &m_tAttr[ i*iStride ] )
-				&& "descending document ID found" );
-			DWORD uHash = (DWORD)( ( DOCINFO2ID ( &m_tAttr[ i*iStride ] ) - uFirst ) >> iShift );
-			if ( uHash==uLastHash )
-				continue;
-
-			while ( uLastHash<uHash )
-				pHash [ ++uLastHash ] = (DWORD)i;
-
-			uLastHash = uHash;
+			CSphString sAttr = rdInfo.GetString();
+			DWORD uTable = rdInfo.GetDword();
+			int iAttr = m_tSchema.GetAttrIndex ( sAttr.cstr() );
+			if ( iAttr>=0 && m_tSchema.GetAttr ( iAttr ).m_eAttrType==SPH_ATTR_STRING )
+				const_cast<CSphColumnInfo &>( m_tSchema.GetAttr ( iAttr ) ).m_uStringDict = uTable;
 		}
-		pHash [ ++uLastHash ] = (DWORD)m_iDocinfo;
 	}
 
-	m_bPassedRead = true;
-	sphLogDebug ( "Preread successfully finished, hash=%u", (DWORD)uRead );
-	return;
-}
-
-void CSphIndex_VLN::SetMemorySettings ( bool bMlock, bool bOndiskAttrs, bool bOndiskPool )
-{
-	m_bMlock = bMlock;
-	m_bOndiskAllAttr = bOndiskAttrs;
-	m_bOndiskPoolAttr = ( bOndiskAttrs || bOndiskPool );
-}
+	// post-load stuff.. for now, bigrams
+	CSphIndexSettings & s = m_tSettings;
+	if ( s.m_eBigramIndex!=SPH_BIGRAM_NONE && s.m_eBigramIndex!=SPH_BIGRAM_ALL )
+	{
+		BYTE * pTok;
+		m_pTokenizer->SetBuffer ( (BYTE*)s.m_sBigramWords.cstr(), s.m_sBigramWords.Length() );
+		while ( ( pTok = m_pTokenizer->GetToken() )!=NULL )
+			s.m_dBigramWords.Add() = (const char*)pTok;
+		s.m_dBigramWords.Sort();
+	}
 
 
-void CSphIndex_VLN::SetBase ( const char * sNewBase )
-{
-	m_sFilename = sNewBase;
+	if ( rdInfo.GetErrorFlag() )
+		m_sLastError.SetSprintf ( "%s: failed to parse header (unexpected eof)", sHeaderName );
+	return !rdInfo.GetErrorFlag();
 }
 
 
-bool CSphIndex_VLN::Rename ( const char * sNewBase )
+void CSphIndex_VLN::DebugDumpHeader ( FILE * fp, const char * sHeaderName, bool bConfig )
 {
-	if ( m_sFilename==sNewBase )
-		return true;
+	CSphEmbeddedFiles tEmbeddedFiles;
+	CSphString sWarning;
+	if ( !LoadHeader ( sHeaderName, false, tEmbeddedFiles, sWarning ) )
+	{
+		fprintf ( fp, "FATAL: failed to load header: %s.\n", m_sLastError.cstr() );
+		return;
+	}
 
-	// try to rename everything
-	char sFrom [ SPH_MAX_FILENAME_LEN ];
-	char sTo [ SPH_MAX_FILENAME_LEN ];
+	if ( !sWarning.IsEmpty () )
+		fprintf ( fp, "WARNING: %s\n", sWarning.cstr () );
 
-	// +1 for ".spl"
-	int iExtCount = sphGetExtCount() + 1;
-	const char ** sExts = sphGetExts ( SPH_EXT_TYPE_LOC );
-	DWORD uMask = 0;
+	///////////////////////////////////////////////
+	// print header in index config section format
+	///////////////////////////////////////////////
 
-	int iExt;
-	for ( iExt=0; iExt<iExtCount; iExt++ )
+	if ( bConfig )
 	{
-		const char * sExt = sExts[iExt];
-		if ( !strcmp ( sExt, ".spp" ) && m_uVersion<3 ) // .spp files are v3+
-			continue;
-		if ( !strcmp ( sExt, ".spm" ) && m_uVersion<4 ) // .spm files are v4+
-			continue;
-		if ( !strcmp ( sExt, ".spk" ) && m_uVersion<10 ) // .spk files are v10+
-			continue;
-		if ( !strcmp ( sExt, ".sps" ) && m_uVersion<17 ) // .sps files are v17+
-			continue;
-		if ( !strcmp ( sExt, ".spe" ) && m_uVersion<31 ) // .spe files are v31+
-			continue;
+		fprintf ( fp, "\nsource $dump\n{\n" );
 
-#if !USE_WINDOWS
-		if ( !strcmp ( sExt, ".spl" ) && m_iLockFD<0 ) // .spl files are locks
-			continue;
-#else
-		if ( !strcmp ( sExt, ".spl" ) )
+		fprintf ( fp, "\tsql_query = SELECT id \\\n" );
+		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
+			fprintf ( fp, "\t, %s \\\n", m_tSchema.m_dFields[i].m_sName.cstr() );
+		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
 		{
-			if ( m_iLockFD>=0 )
-			{
-				::close ( m_iLockFD );
-				::unlink ( GetIndexFileName("spl").cstr() );
-				sphLogDebug ( "lock %s unlinked, file with ID %d closed", GetIndexFileName("spl").cstr(), m_iLockFD );
-				m_iLockFD = -1;
-			}
-			continue;
+			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
+			fprintf ( fp, "\t, %s \\\n", tAttr.m_sName.cstr() );
 		}
-#endif
-
-		snprintf ( sFrom, sizeof(sFrom), "%s%s", m_sFilename.cstr(), sExt );
-		snprintf ( sTo, sizeof(sTo), "%s%s", sNewBase, sExt );
+		fprintf ( fp, "\tFROM documents\n" );
 
-#if USE_WINDOWS
-		::unlink ( sTo );
-		sphLogDebug ( "%s unlinked", sTo );
-#endif
+		if ( m_tSchema.GetAttrsCount() )
+			fprintf ( fp, "\n" );
 
-		if ( ::rename ( sFrom, sTo ) )
+		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
 		{
-			m_sLastError.SetSprintf ( "rename %s to %s failed: %s", sFrom, sTo, strerror(errno) );
-			// this is no reason to fail if spl is missing, since it is only lock and no data.
-			if ( strcmp ( sExt, ".spl" ) )
-				break;
+			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
+			if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET )
+				fprintf ( fp, "\tsql_attr_multi = uint %s from field\n", tAttr.m_sName.cstr() );
+			else if ( tAttr.m_eAttrType==SPH_ATTR_INT64SET )
+				fprintf ( fp, "\tsql_attr_multi = bigint %s from field\n", tAttr.m_sName.cstr() );
+			else if ( tAttr.m_eAttrType==SPH_ATTR_INTEGER && tAttr.m_tLocator.IsBitfield() )
+				fprintf ( fp, "\tsql_attr_uint = %s:%d\n", tAttr.m_sName.cstr(), tAttr.m_tLocator.m_iBitCount );
+			else if ( tAttr.m_eAttrType==SPH_ATTR_TOKENCOUNT )
+			{; // intendedly skip, as these are autogenerated by index_field_lengths=1
+			} else
+				fprintf ( fp, "\t%s = %s\n", sphTypeDirective ( tAttr.m_eAttrType ), tAttr.m_sName.cstr() );
 		}
-		uMask |= ( 1UL << iExt );
-	}
 
-	// are we good?
-	if ( iExt==iExtCount )
-	{
-		SetBase ( sNewBase );
-		sphLogDebug ( "Base set to %s", sNewBase );
-		return true;
-	}
+		fprintf ( fp, "}\n\nindex $dump\n{\n\tsource = $dump\n\tpath = $dump\n" );
 
-	// if there were errors, rollback
-	for ( iExt=0; iExt<iExtCount; iExt++ )
-	{
-		if (!( uMask & ( 1UL << iExt ) ))
-			continue;
+		if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
+			fprintf ( fp, "\tdocinfo = inline\n" );
+		if ( m_tSettings.m_iMinPrefixLen )
+			fprintf ( fp, "\tmin_prefix_len = %d\n", m_tSettings.m_iMinPrefixLen );
+		if ( m_tSettings.m_iMinInfixLen )
+			fprintf ( fp, "\tmin_prefix_len = %d\n", m_tSettings.m_iMinInfixLen );
+		if ( m_tSettings.m_iMaxSubstringLen )
+			fprintf ( fp, "\tmax_substring_len = %d\n", m_tSettings.m_iMaxSubstringLen );
+		if ( m_tSettings.m_bIndexExactWords )
+			fprintf ( fp, "\tindex_exact_words = %d\n", m_tSettings.m_bIndexExactWords ? 1 : 0 );
+		if ( m_tSettings.m_bHtmlStrip )
+			fprintf ( fp, "\thtml_strip = 1\n" );
+		if ( !m_tSettings.m_sHtmlIndexAttrs.IsEmpty() )
+			fprintf ( fp, "\thtml_index_attrs = %s\n", m_tSettings.m_sHtmlIndexAttrs.cstr () );
+		if ( !m_tSettings.m_sHtmlRemoveElements.IsEmpty() )
+			fprintf ( fp, "\thtml_remove_elements = %s\n", m_tSettings.m_sHtmlRemoveElements.cstr () );
+		if ( !m_tSettings.m_sZones.IsEmpty() )
+			fprintf ( fp, "\tindex_zones = %s\n", m_tSettings.m_sZones.cstr() );
+		if ( m_tSettings.m_bIndexFieldLens )
+			fprintf ( fp, "\tindex_field_lengths = 1\n" );
+		if ( m_tSettings.m_bIndexSP )
+			fprintf ( fp, "\tindex_sp = 1\n" );
+		if ( m_tSettings.m_iBoundaryStep!=0 )
+			fprintf ( fp, "\tphrase_boundary_step = %d\n", m_tSettings.m_iBoundaryStep );
+		if ( m_tSettings.m_iStopwordStep!=1 )
+			fprintf ( fp, "\tstopword_step = %d\n", m_tSettings.m_iStopwordStep );
+		if ( m_tSettings.m_iOvershortStep!=1 )
+			fprintf ( fp, "\tovershort_step = %d\n", m_tSettings.m_iOvershortStep );
+		if ( m_tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE )
+			fprintf ( fp, "\tbigram_index = %s\n", sphBigramName ( m_tSettings.m_eBigramIndex ) );
+		if ( !m_tSettings.m_sBigramWords.IsEmpty() )
+			fprintf ( fp, "\tbigram_freq_words = %s\n", m_tSettings.m_sBigramWords.cstr() );
+		if ( !m_tSettings.m_sRLPContext.IsEmpty() )
+			fprintf ( fp, "\trlp_context = %s\n", m_tSettings.m_sRLPContext.cstr() );
+		if ( !m_tSettings.m_sIndexTokenFilter.IsEmpty() )
+			fprintf ( fp, "\tindex_token_filter = %s\n", m_tSettings.m_sIndexTokenFilter.cstr() );
+		if ( m_tSettings.m_bDictFst )
+			fprintf ( fp, "\tdict_fst = 1\n" );
+		if ( m_tSettings.m_bInfixTrigrams )
+			fprintf ( fp, "\tinfix_trigrams = 1\n" );
 
-		const char * sExt = sExts[iExt];
-		snprintf ( sFrom, sizeof(sFrom), "%s%s", sNewBase, sExt );
-		snprintf ( sTo, sizeof(sTo), "%s%s", m_sFilename.cstr(), sExt );
-		if ( ::rename ( sFrom, sTo ) )
-		{
-			sphLogDebug ( "Rollback failure when renaming %s to %s", sFrom, sTo );
-			// !COMMIT should handle rollback failures somehow
-		}
-	}
-	return false;
-}
 
-//////////////////////////////////////////////////////////////////////////
+		CSphFieldFilterSettings tFieldFilter;
+		GetFieldFilterSettings ( tFieldFilter );
+		ARRAY_FOREACH ( i, tFieldFilter.m_dRegexps )
+			fprintf ( fp, "\tregexp_filter = %s\n", tFieldFilter.m_dRegexps[i].cstr() );
 
-CSphQueryContext::CSphQueryContext ( const CSphQuery & q )
-	: m_tQuery ( q )
-{
-	m_iWeights = 0;
-	m_bLookupFilter = false;
-	m_bLookupSort = false;
-	m_uPackedFactorFlags = SPH_FACTOR_DISABLE;
-	m_pFilter = NULL;
-	m_pWeightFilter = NULL;
-	m_pIndexData = NULL;
-	m_pProfile = NULL;
-	m_pLocalDocs = NULL;
-	m_iTotalDocs = 0;
-	m_iBadRows = 0;
-}
-
-CSphQueryContext::~CSphQueryContext ()
-{
-	SafeDelete ( m_pFilter );
-	SafeDelete ( m_pWeightFilter );
-
-	ARRAY_FOREACH ( i, m_dUserVals )
-		m_dUserVals[i]->Release();
-}
-
-void CSphQueryContext::BindWeights ( const CSphQuery * pQuery, const CSphSchema & tSchema, CSphString & sWarning )
-{
-	const int MIN_WEIGHT = 1;
-	// const int HEAVY_FIELDS = 32;
-	const int HEAVY_FIELDS = SPH_MAX_FIELDS;
-
-	// defaults
-	m_iWeights = Min ( tSchema.m_dFields.GetLength(), HEAVY_FIELDS );
-	for ( int i=0; i<m_iWeights; i++ )
-		m_dWeights[i] = MIN_WEIGHT;
+		if ( m_pTokenizer )
+		{
+			const CSphTokenizerSettings & tSettings = m_pTokenizer->GetSettings ();
+			fprintf ( fp, "\tcharset_type = %s\n", ( tSettings.m_iType==TOKENIZER_UTF8 || tSettings.m_iType==TOKENIZER_NGRAM )
+					? "utf-8"
+					: "unknown tokenizer (deprecated sbcs?)" );
+			if ( !tSettings.m_sCaseFolding.IsEmpty() )
+				fprintf ( fp, "\tcharset_table = %s\n", tSettings.m_sCaseFolding.cstr () );
+			if ( tSettings.m_iMinWordLen>1 )
+				fprintf ( fp, "\tmin_word_len = %d\n", tSettings.m_iMinWordLen );
+			if ( tSettings.m_iNgramLen && !tSettings.m_sNgramChars.IsEmpty() )
+				fprintf ( fp, "\tngram_len = %d\nngram_chars = %s\n",
+					tSettings.m_iNgramLen, tSettings.m_sNgramChars.cstr () );
+			if ( !tSettings.m_sSynonymsFile.IsEmpty() )
+				fprintf ( fp, "\texceptions = %s\n", tSettings.m_sSynonymsFile.cstr () );
+			if ( !tSettings.m_sBoundary.IsEmpty() )
+				fprintf ( fp, "\tphrase_boundary = %s\n", tSettings.m_sBoundary.cstr () );
+			if ( !tSettings.m_sIgnoreChars.IsEmpty() )
+				fprintf ( fp, "\tignore_chars = %s\n", tSettings.m_sIgnoreChars.cstr () );
+			if ( !tSettings.m_sBlendChars.IsEmpty() )
+				fprintf ( fp, "\tblend_chars = %s\n", tSettings.m_sBlendChars.cstr () );
+			if ( !tSettings.m_sBlendMode.IsEmpty() )
+				fprintf ( fp, "\tblend_mode = %s\n", tSettings.m_sBlendMode.cstr () );
+		}
 
-	// name-bound weights
-	CSphString sFieldsNotFound;
-	if ( pQuery->m_dFieldWeights.GetLength() )
-	{
-		ARRAY_FOREACH ( i, pQuery->m_dFieldWeights )
+		if ( m_pDict )
 		{
-			int j = tSchema.GetFieldIndex ( pQuery->m_dFieldWeights[i].m_sName.cstr() );
-			if ( j<0 )
+			const CSphDictSettings & tSettings = m_pDict->GetSettings ();
+			if ( tSettings.m_bWordDict )
+				fprintf ( fp, "\tdict = keywords\n" );
+			if ( !tSettings.m_sMorphology.IsEmpty() )
+				fprintf ( fp, "\tmorphology = %s\n", tSettings.m_sMorphology.cstr () );
+			if ( !tSettings.m_sStopwords.IsEmpty() )
+				fprintf ( fp, "\tstopwords = %s\n", tSettings.m_sStopwords.cstr () );
+			if ( tSettings.m_dWordforms.GetLength() )
 			{
-				if ( sFieldsNotFound.IsEmpty() )
-					sFieldsNotFound = pQuery->m_dFieldWeights[i].m_sName;
-				else
-					sFieldsNotFound.SetSprintf ( "%s %s", sFieldsNotFound.cstr(), pQuery->m_dFieldWeights[i].m_sName.cstr() );
+				fprintf ( fp, "\twordforms =" );
+				ARRAY_FOREACH ( i, tSettings.m_dWordforms )
+					fprintf ( fp, " %s", tSettings.m_dWordforms[i].cstr () );
+				fprintf ( fp, "\n" );
 			}
-
-			if ( j>=0 && j<HEAVY_FIELDS )
-				m_dWeights[j] = Max ( MIN_WEIGHT, pQuery->m_dFieldWeights[i].m_iValue );
+			if ( tSettings.m_iMinStemmingLen>1 )
+				fprintf ( fp, "\tmin_stemming_len = %d\n", tSettings.m_iMinStemmingLen );
+			if ( tSettings.m_bStopwordsUnstemmed )
+				fprintf ( fp, "\tstopwords_unstemmed = 1\n" );
 		}
 
-		if ( !sFieldsNotFound.IsEmpty() )
-			sWarning.SetSprintf ( "Fields specified in field_weights option not found: [%s]", sFieldsNotFound.cstr() );
-
+		fprintf ( fp, "}\n" );
 		return;
 	}
 
-	// order-bound weights
-	if ( pQuery->m_dWeights.GetLength() )
+	///////////////////////////////////////////////
+	// print header and stats in "readable" format
+	///////////////////////////////////////////////
+
+	fprintf ( fp, "version: %d\n",			m_uVersion );
+	fprintf ( fp, "idbits: %d\n",			USE_64BIT ? 64 : 32 );
+	fprintf ( fp, "docinfo: " );
+	switch ( m_tSettings.m_eDocinfo )
 	{
-		for ( int i=0; i<Min ( m_iWeights, pQuery->m_dWeights.GetLength() ); i++ )
-			m_dWeights[i] = Max ( MIN_WEIGHT, (int)pQuery->m_dWeights[i] );
+		case SPH_DOCINFO_NONE:		fprintf ( fp, "none\n" ); break;
+		case SPH_DOCINFO_INLINE:	fprintf ( fp, "inline\n" ); break;
+		case SPH_DOCINFO_EXTERN:	fprintf ( fp, "extern\n" ); break;
+		default:					fprintf ( fp, "unknown (value=%d)\n", m_tSettings.m_eDocinfo ); break;
 	}
-}
 
-bool CSphQueryContext::SetupCalc ( CSphQueryResult * pResult, const ISphSchema & tInSchema,
-									const CSphSchema & tSchema, const DWORD * pMvaPool, bool bArenaProhibit )
-{
-	m_dCalcFilter.Resize ( 0 );
-	m_dCalcSort.Resize ( 0 );
-	m_dCalcFinal.Resize ( 0 );
+	fprintf ( fp, "fields: %d\n", m_tSchema.m_dFields.GetLength() );
+	ARRAY_FOREACH ( i, m_tSchema.m_dFields )
+		fprintf ( fp, "  field %d: %s\n", i, m_tSchema.m_dFields[i].m_sName.cstr() );
 
-	// quickly verify that all my real attributes can be stashed there
-	if ( tInSchema.GetAttrsCount() < tSchema.GetAttrsCount() )
+	fprintf ( fp, "attrs: %d\n", m_tSchema.GetAttrsCount() );
+	for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
 	{
-		pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema mismatch (incount=%d, mycount=%d)",
-			tInSchema.GetAttrsCount(), tSchema.GetAttrsCount() );
-		return false;
+		const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
+		fprintf ( fp, "  attr %d: %s, %s", i, tAttr.m_sName.cstr(), sphTypeName ( tAttr.m_eAttrType ) );
+		if ( tAttr.m_eAttrType==SPH_ATTR_INTEGER && tAttr.m_tLocator.m_iBitCount!=32 )
+			fprintf ( fp, ", bits %d", tAttr.m_tLocator.m_iBitCount );
+		fprintf ( fp, ", bitoff %d\n", tAttr.m_tLocator.m_iBitOffset );
 	}
 
-	bool bGotAggregate = false;
+	// skipped min doc, wordlist checkpoints
+	fprintf ( fp, "total-documents: " INT64_FMT "\n", m_tStats.m_iTotalDocuments );
+	fprintf ( fp, "total-bytes: " INT64_FMT "\n", int64_t(m_tStats.m_iTotalBytes) );
+	fprintf ( fp, "total-duplicates: %d\n", m_iTotalDups );
 
-	// now match everyone
-	for ( int iIn=0; iIn<tInSchema.GetAttrsCount(); iIn++ )
+	fprintf ( fp, "min-prefix-len: %d\n", m_tSettings.m_iMinPrefixLen );
+	fprintf ( fp, "min-infix-len: %d\n", m_tSettings.m_iMinInfixLen );
+	fprintf ( fp, "max-substring-len: %d\n", m_tSettings.m_iMaxSubstringLen );
+	fprintf ( fp, "exact-words: %d\n", m_tSettings.m_bIndexExactWords ? 1 : 0 );
+	fprintf ( fp, "html-strip: %d\n", m_tSettings.m_bHtmlStrip ? 1 : 0 );
+	fprintf ( fp, "html-index-attrs: %s\n", m_tSettings.m_sHtmlIndexAttrs.cstr () );
+	fprintf ( fp, "html-remove-elements: %s\n", m_tSettings.m_sHtmlRemoveElements.cstr () );
+	fprintf ( fp, "index-zones: %s\n", m_tSettings.m_sZones.cstr() );
+	fprintf ( fp, "index-field-lengths: %d\n", m_tSettings.m_bIndexFieldLens ? 1 : 0 );
+	fprintf ( fp, "index-sp: %d\n", m_tSettings.m_bIndexSP ? 1 : 0 );
+	fprintf ( fp, "phrase-boundary-step: %d\n", m_tSettings.m_iBoundaryStep );
+	fprintf ( fp, "stopword-step: %d\n", m_tSettings.m_iStopwordStep );
+	fprintf ( fp, "overshort-step: %d\n", m_tSettings.m_iOvershortStep );
+	fprintf ( fp, "bigram-index: %s\n", sphBigramName ( m_tSettings.m_eBigramIndex ) );
+	fprintf ( fp, "bigram-freq-words: %s\n", m_tSettings.m_sBigramWords.cstr() );
+	fprintf ( fp, "rlp-context: %s\n", m_tSettings.m_sRLPContext.cstr() );
+	fprintf ( fp, "index-token-filter: %s\n", m_tSettings.m_sIndexTokenFilter.cstr() );
+	fprintf ( fp, "dict-fst: %d\n", m_tSettings.m_bDictFst ? 1 : 0 );
+	fprintf ( fp, "infix-trigrams: %d\n", m_tSettings.m_bInfixTrigrams ? 1 : 0 );
+	if ( !m_tSettings.m_sGeoLat.IsEmpty() )
+		fprintf ( fp, "geo-grid: %s, %s\n", m_tSettings.m_sGeoLat.cstr(), m_tSettings.m_sGeoLon.cstr() );
+	if ( !m_tSettings.m_sSortByAttr.IsEmpty() )
+		fprintf ( fp, "sort-by: %s\n", m_tSettings.m_sSortByAttr.cstr() );
+	for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
+		if ( m_tSchema.GetAttr(i).m_uStringDict )
+			fprintf ( fp, "string-dictionary: %s (table at %u)\n", m_tSchema.GetAttr(i).m_sName.cstr(), m_tSchema.GetAttr(i).m_uStringDict );
+	CSphFieldFilterSettings tFieldFilter;
+	GetFieldFilterSettings ( tFieldFilter );
+	ARRAY_FOREACH ( i, tFieldFilter.m_dRegexps )
+		fprintf ( fp, "regexp-filter: %s\n", tFieldFilter.m_dRegexps[i].cstr() );
+
+	if ( m_pTokenizer )
 	{
-		const CSphColumnInfo & tIn = tInSchema.GetAttr(iIn);
-		bGotAggregate |= ( tIn.m_eAggrFunc!=SPH_AGGR_NONE );
+		const CSphTokenizerSettings & tSettings = m_pTokenizer->GetSettings ();
+		fprintf ( fp, "tokenizer-type: %d\n", tSettings.m_iType );
+		fprintf ( fp, "tokenizer-case-folding: %s\n", tSettings.m_sCaseFolding.cstr () );
+		fprintf ( fp, "tokenizer-min-word-len: %d\n", tSettings.m_iMinWordLen );
+		fprintf ( fp, "tokenizer-ngram-chars: %s\n", tSettings.m_sNgramChars.cstr () );
+		fprintf ( fp, "tokenizer-ngram-len: %d\n", tSettings.m_iNgramLen );
+		fprintf ( fp, "tokenizer-exceptions: %s\n", tSettings.m_sSynonymsFile.cstr () );
+		fprintf ( fp, "tokenizer-phrase-boundary: %s\n", tSettings.m_sBoundary.cstr () );
+		fprintf ( fp, "tokenizer-ignore-chars: %s\n", tSettings.m_sIgnoreChars.cstr () );
+		fprintf ( fp, "tokenizer-blend-chars: %s\n", tSettings.m_sBlendChars.cstr () );
+		fprintf ( fp, "tokenizer-blend-mode: %s\n", tSettings.m_sBlendMode.cstr () );
+		fprintf ( fp, "tokenizer-blend-mode: %s\n", tSettings.m_sBlendMode.cstr () );
 
-		switch ( tIn.m_eStage )
+		fprintf ( fp, "dictionary-embedded-exceptions: %d\n", tEmbeddedFiles.m_bEmbeddedSynonyms ? 1 : 0 );
+		if ( tEmbeddedFiles.m_bEmbeddedSynonyms )
 		{
-			case SPH_EVAL_STATIC:
-			case SPH_EVAL_OVERRIDE:
-			{
-				// this check may significantly slow down queries with huge schema attribute count
-#ifndef NDEBUG
-				const CSphColumnInfo * pMy = tSchema.GetAttr ( tIn.m_sName.cstr() );
-				if ( !pMy )
-				{
-					pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema attr missing from index-schema (in=%s)",
-						sphDumpAttr(tIn).cstr() );
-					return false;
-				}
-
-				if ( tIn.m_eStage==SPH_EVAL_OVERRIDE )
-				{
-					// override; check for type/size match and dynamic part
-					if ( tIn.m_eAttrType!=pMy->m_eAttrType
-						|| tIn.m_tLocator.m_iBitCount!=pMy->m_tLocator.m_iBitCount
-						|| !tIn.m_tLocator.m_bDynamic )
-					{
-						pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema override mismatch (in=%s, my=%s)",
-							sphDumpAttr(tIn).cstr(), sphDumpAttr(*pMy).cstr() );
-						return false;
-					}
-				} else
-				{
-					// static; check for full match
-					if (!( tIn==*pMy ))
-					{
-						pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema mismatch (in=%s, my=%s)",
-							sphDumpAttr(tIn).cstr(), sphDumpAttr(*pMy).cstr() );
-						return false;
-					}
-				}
-#endif
-				break;
-			}
+			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dSynonyms )
+				fprintf ( fp, "\tdictionary-embedded-exception [%d]: %s\n", i, tEmbeddedFiles.m_dSynonyms[i].cstr () );
+		}
+	}
 
-			case SPH_EVAL_PREFILTER:
-			case SPH_EVAL_PRESORT:
-			case SPH_EVAL_FINAL:
-			{
-				ISphExpr * pExpr = tIn.m_pExpr.Ptr();
-				if ( !pExpr )
-				{
-					pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema expression missing evaluator (stage=%d, in=%s)",
-						(int)tIn.m_eStage, sphDumpAttr(tIn).cstr() );
-					return false;
-				}
+	if ( m_pDict )
+	{
+		const CSphDictSettings & tSettings = m_pDict->GetSettings ();
+		fprintf ( fp, "dict: %s\n", tSettings.m_bWordDict ? "keywords" : "crc" );
+		fprintf ( fp, "dictionary-morphology: %s\n", tSettings.m_sMorphology.cstr () );
 
-				// an expression that index/searcher should compute
-				CalcItem_t tCalc;
-				tCalc.m_eType = tIn.m_eAttrType;
-				tCalc.m_tLoc = tIn.m_tLocator;
-				tCalc.m_pExpr = pExpr;
-				PoolPtrs_t tMva;
-				tMva.m_pMva = pMvaPool;
-				tMva.m_bArenaProhibit = bArenaProhibit;
-				tCalc.m_pExpr->Command ( SPH_EXPR_SET_MVA_POOL, &tMva );
+		fprintf ( fp, "dictionary-stopwords-file: %s\n", tSettings.m_sStopwords.cstr () );
+		fprintf ( fp, "dictionary-embedded-stopwords: %d\n", tEmbeddedFiles.m_bEmbeddedStopwords ? 1 : 0 );
+		if ( tEmbeddedFiles.m_bEmbeddedStopwords )
+		{
+			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dStopwords )
+				fprintf ( fp, "\tdictionary-embedded-stopword [%d]: " DOCID_FMT "\n", i, tEmbeddedFiles.m_dStopwords[i] );
+		}
 
-				switch ( tIn.m_eStage )
-				{
-					case SPH_EVAL_PREFILTER:	m_dCalcFilter.Add ( tCalc ); break;
-					case SPH_EVAL_PRESORT:		m_dCalcSort.Add ( tCalc ); break;
-					case SPH_EVAL_FINAL:		m_dCalcFinal.Add ( tCalc ); break;
+		ARRAY_FOREACH ( i, tSettings.m_dWordforms )
+			fprintf ( fp, "dictionary-wordform-file [%d]: %s\n", i, tSettings.m_dWordforms[i].cstr () );
 
-					default:					break;
-				}
-				break;
-			}
+		fprintf ( fp, "dictionary-embedded-wordforms: %d\n", tEmbeddedFiles.m_bEmbeddedWordforms ? 1 : 0 );
+		if ( tEmbeddedFiles.m_bEmbeddedWordforms )
+		{
+			ARRAY_FOREACH ( i, tEmbeddedFiles.m_dWordforms )
+				fprintf ( fp, "\tdictionary-embedded-wordform [%d]: %s\n", i, tEmbeddedFiles.m_dWordforms[i].cstr () );
+		}
 
-			case SPH_EVAL_SORTER:
-				// sorter tells it will compute itself; so just skip it
-			case SPH_EVAL_POSTLIMIT:
-				break;
-
-			default:
-				pResult->m_sError.SetSprintf ( "INTERNAL ERROR: unhandled eval stage=%d", (int)tIn.m_eStage );
-				return false;
-		}
+		fprintf ( fp, "min-stemming-len: %d\n", tSettings.m_iMinStemmingLen );
+		fprintf ( fp, "stopwords-unstemmed: %d\n", tSettings.m_bStopwordsUnstemmed ? 1 : 0 );
 	}
 
-	// ok, we can emit matches in this schema (incoming for sorter, outgoing for index/searcher)
-	return true;
+	fprintf ( fp, "killlist-size: %u\n", 0 );
+	fprintf ( fp, "min-max-index: " INT64_FMT "\n", m_iMinMaxIndex );
 }
 
 
-bool CSphIndex_VLN::IsStarDict () const
+void CSphIndex_VLN::DebugDumpDocids ( FILE * fp )
 {
-	return (
-		( m_uVersion>=7 && ( m_tSettings.m_iMinPrefixLen>0 || m_tSettings.m_iMinInfixLen>0 ) ) || // v.7 added mangling to infixes
-		( m_uVersion==6 && ( m_tSettings.m_iMinPrefixLen>0 ) ) ); // v.6 added mangling to prefixes
-}
+	if ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN )
+	{
+		fprintf ( fp, "FATAL: docids dump only supported for docinfo=extern\n" );
+		return;
+	}
 
+	const int iRowStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
 
-CSphDict * CSphIndex_VLN::SetupStarDict ( CSphScopedPtr<CSphDict> & tContainer, CSphDict * pPrevDict ) const
-{
-	// spawn wrapper, and put it in the box
-	// wrapper type depends on version; v.8 introduced new mangling rules
-	if ( !IsStarDict() )
-		return pPrevDict;
-	if ( m_uVersion>=8 )
-		tContainer = new CSphDictStarV8 ( pPrevDict, m_tSettings.m_iMinPrefixLen>0, m_tSettings.m_iMinInfixLen>0 );
-	else
-		tContainer = new CSphDictStar ( pPrevDict );
+	const int64_t iNumMinMaxRow = ( m_uVersion>=20 ) ? ( (m_iDocinfoIndex+1)*iRowStride*2 ) : 0;
+	const int64_t iNumRows = (m_tAttr.GetNumEntries()-iNumMinMaxRow) / iRowStride;
 
-	// FIXME? might wanna verify somehow that the tokenizer has '*' as a character
-	return tContainer.Ptr();
-}
+	const int64_t iDocinfoSize = iRowStride*m_iDocinfo*sizeof(DWORD);
+	const int64_t iMinmaxSize = iNumMinMaxRow*sizeof(CSphRowitem);
 
+	fprintf ( fp, "docinfo-bytes: docinfo=" INT64_FMT ", min-max=" INT64_FMT ", total=" UINT64_FMT "\n"
+		, iDocinfoSize, iMinmaxSize, (uint64_t)m_tAttr.GetLengthBytes() );
+	fprintf ( fp, "docinfo-stride: %d\n", (int)(iRowStride*sizeof(DWORD)) );
+	fprintf ( fp, "docinfo-rows: " INT64_FMT "\n", iNumRows );
 
-CSphDict * CSphIndex_VLN::SetupExactDict ( CSphScopedPtr<CSphDict> & tContainer, CSphDict * pPrevDict ) const
-{
-	if ( m_uVersion<12 || !m_tSettings.m_bIndexExactWords )
-		return pPrevDict;
+	if ( !m_tAttr.GetNumEntries() )
+		return;
 
-	tContainer = new CSphDictExact ( pPrevDict );
-	return tContainer.Ptr();
+	DWORD * pDocinfo = m_tAttr.GetWritePtr();
+	for ( int64_t iRow=0; iRow<iNumRows; iRow++, pDocinfo+=iRowStride )
+		printf ( INT64_FMT". id=" DOCID_FMT "\n", iRow+1, DOCINFO2ID ( pDocinfo ) );
+	printf ( "--- min-max=" INT64_FMT " ---\n", iNumMinMaxRow );
+	for ( int64_t iRow=0; iRow<(m_iDocinfoIndex+1)*2; iRow++, pDocinfo+=iRowStride )
+		printf ( "id=" DOCID_FMT "\n", DOCINFO2ID ( pDocinfo ) );
 }
 
 
-bool CSphIndex_VLN::GetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords,
-	const char * szQuery, const GetKeywordsSettings_t & tSettings, CSphString * pError ) const
+void CSphIndex_VLN::DebugDumpHitlist ( FILE * fp, const char * sKeyword, bool bID )
 {
-	WITH_QWORD ( this, false, Qword, return DoGetKeywords<Qword> ( dKeywords, szQuery, tSettings, false, pError ) );
-	return false;
+	WITH_QWORD ( this, false, Qword, DumpHitlist<Qword> ( fp, sKeyword, bID ) );
 }
 
-void CSphIndex_VLN::GetSuggest ( const SuggestArgs_t & tArgs, SuggestResult_t & tRes ) const
+
+template < class Qword >
+void CSphIndex_VLN::DumpHitlist ( FILE * fp, const char * sKeyword, bool bID )
 {
-	if ( m_tWordlist.m_tBuf.IsEmpty() || !m_tWordlist.m_dCheckpoints.GetLength() )
-		return;
+	// get keyword id
+	SphWordID_t uWordID = 0;
+	BYTE * sTok = NULL;
+	if ( !bID )
+	{
+		CSphString sBuf ( sKeyword );
 
-	assert ( !tRes.m_pWordReader );
-	tRes.m_pWordReader = new KeywordsBlockReader_c ( m_tWordlist.m_tBuf.GetWritePtr(), m_tWordlist.m_bHaveSkips );
-	tRes.m_bHasExactDict = m_tSettings.m_bIndexExactWords;
+		m_pTokenizer->SetBuffer ( (BYTE*)sBuf.cstr(), strlen ( sBuf.cstr() ) );
+		sTok = m_pTokenizer->GetToken();
 
-	sphGetSuggest ( &m_tWordlist, m_tWordlist.m_iInfixCodepointBytes, tArgs, tRes );
+		if ( !sTok )
+			sphDie ( "keyword=%s, no token (too short?)", sKeyword );
 
-	KeywordsBlockReader_c * pReader = (KeywordsBlockReader_c *)tRes.m_pWordReader;
-	SafeDelete ( pReader );
-	tRes.m_pWordReader = NULL;
-}
+		uWordID = m_pDict->GetWordID ( sTok );
+		if ( !uWordID )
+			sphDie ( "keyword=%s, tok=%s, no wordid (stopped?)", sKeyword, sTok );
+
+		fprintf ( fp, "keyword=%s, tok=%s, wordid=" UINT64_FMT "\n", sKeyword, sTok, uint64_t(uWordID) );
 
+	} else
+	{
+		uWordID = (SphWordID_t) strtoull ( sKeyword, NULL, 10 );
+		if ( !uWordID )
+			sphDie ( "failed to convert keyword=%s to id (must be integer)", sKeyword );
 
-DWORD sphParseMorphAot ( const char * sMorphology )
-{
-	if ( !sMorphology || !*sMorphology )
-		return 0;
+		fprintf ( fp, "wordid=" UINT64_FMT "\n", uint64_t(uWordID) );
+	}
 
-	CSphVector<CSphString> dMorphs;
-	sphSplit ( dMorphs, sMorphology );
+	// open files
+	CSphAutofile tDoclist, tHitlist;
+	if ( tDoclist.Open ( GetIndexFileName("spd"), SPH_O_READ, m_sLastError ) < 0 )
+		sphDie ( "failed to open doclist: %s", m_sLastError.cstr() );
 
-	DWORD uAotFilterMask = 0;
-	for ( int j=0; j<AOT_LENGTH; ++j )
+	if ( tHitlist.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, m_sLastError ) < 0 )
+		sphDie ( "failed to open hitlist: %s", m_sLastError.cstr() );
+
+	// aim
+	DiskIndexQwordSetup_c tTermSetup ( tDoclist, tHitlist, m_tSkiplists.GetWritePtr(), NULL );
+	tTermSetup.m_pDict = m_pDict;
+	tTermSetup.m_pIndex = this;
+	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
+	tTermSetup.m_uMinDocid = m_uMinDocid;
+	tTermSetup.m_pMinRow = m_dMinRow.Begin();
+	tTermSetup.m_bSetupReaders = true;
+
+	Qword tKeyword ( false, false );
+	tKeyword.m_tDoc.m_uDocID = m_uMinDocid;
+	tKeyword.m_uWordID = uWordID;
+	tKeyword.m_sWord = sKeyword;
+	tKeyword.m_sDictWord = (const char *)sTok;
+	if ( !tTermSetup.QwordSetup ( &tKeyword ) )
+		sphDie ( "failed to setup keyword" );
+
+	int iSize = m_tSchema.GetRowSize();
+	CSphVector<CSphRowitem> dAttrs ( iSize );
+
+	// press play on tape
+	for ( ;; )
 	{
-		char buf_all[20];
-		sprintf ( buf_all, "lemmatize_%s_all", AOT_LANGUAGES[j] ); // NOLINT
-		ARRAY_FOREACH ( i, dMorphs )
-		{
-			if ( dMorphs[i]==buf_all )
+		tKeyword.GetNextDoc ( iSize ? &dAttrs[0] : NULL );
+		if ( !tKeyword.m_tDoc.m_uDocID )
+			break;
+		tKeyword.SeekHitlist ( tKeyword.m_iHitlistPos );
+
+		int iHits = 0;
+		if ( tKeyword.m_bHasHitlist )
+			for ( Hitpos_t uHit = tKeyword.GetNextHit(); uHit!=EMPTY_HIT; uHit = tKeyword.GetNextHit() )
 			{
-				uAotFilterMask |= (1UL) << j;
-				break;
+				fprintf ( fp, "doc=" DOCID_FMT ", hit=0x%08x\n", tKeyword.m_tDoc.m_uDocID, uHit ); // FIXME?
+				iHits++;
 			}
+
+		if ( !iHits )
+		{
+			uint64_t uOff = tKeyword.m_iHitlistPos;
+			fprintf ( fp, "doc=" DOCID_FMT ", NO HITS, inline=%d, off=" UINT64_FMT "\n",
+				tKeyword.m_tDoc.m_uDocID, (int)(uOff>>63), (uOff<<1)>>1 );
 		}
 	}
+}
 
-	return uAotFilterMask;
+
+void CSphIndex_VLN::DebugDumpDict ( FILE * fp )
+{
+	if ( !m_pDict->GetSettings().m_bWordDict )
+	{
+		fprintf ( fp, "sorry, DebugDumpDict() only supports dict=keywords for now\n" );
+		return;
+	}
+
+	fprintf ( fp, "keyword,docs,hits,offset\n" );
+	m_tWordlist.DebugPopulateCheckpoints();
+	ARRAY_FOREACH ( i, m_tWordlist.m_dCheckpoints )
+	{
+		KeywordsBlockReader_c tCtx ( m_tWordlist.AcquireDict ( &m_tWordlist.m_dCheckpoints[i] ), m_bHaveSkips );
+		while ( tCtx.UnpackWord() )
+			fprintf ( fp, "%s,%d,%d," INT64_FMT "\n", tCtx.GetWord(), tCtx.m_iDocs, tCtx.m_iHits, int64_t(tCtx.m_iDoclistOffset) );
+	}
 }
 
 
-GetKeywordsSettings_t::GetKeywordsSettings_t ()
+static inline int ZippedBytes ( uint64_t uValue )
 {
-	m_bStats = true;
-	m_bFoldLemmas = false;
-	m_bFoldBlended = false;
-	m_bFoldWildcards = false;
-	m_iExpansionLimit = 0;
+	int iBytes = 1;
+	for ( ; uValue>=0x80; uValue >>= 7 )
+		iBytes++;
+	return iBytes;
 }
 
 
-ISphQueryFilter::ISphQueryFilter ()
+ReorderEstimate_t::ReorderEstimate_t ()
+	: m_iPostings ( 0 )
+	, m_iCurBytes ( 0 )
+	, m_iDenseBytes ( 0 )
+	, m_iOrderBytes ( 0 )
+	, m_uLastID ( 0 )
+	, m_iLastRow ( -1 )
+{}
+
+
+void ReorderEstimate_t::StartDoclist ( SphDocID_t uMinDocid )
 {
-	m_pTokenizer = NULL;
-	m_pDict = NULL;
-	m_pSettings = NULL;
+	m_uLastID = uMinDocid;
+	m_iLastRow = -1;
+	m_dRanks.Resize ( 0 );
 }
 
 
-ISphQueryFilter::~ISphQueryFilter ()
+void ReorderEstimate_t::AddDoc ( SphDocID_t uDocID, int64_t iRow, DWORD uRank )
 {
+	assert ( uDocID>=m_uLastID && iRow>m_iLastRow );
+	m_iPostings++;
+	m_iCurBytes += ZippedBytes ( uDocID - m_uLastID );
+	m_iDenseBytes += ZippedBytes ( iRow - m_iLastRow );
+	m_uLastID = uDocID;
+	m_iLastRow = iRow;
+	m_dRanks.Add ( uRank );
 }
 
 
-void ISphQueryFilter::GetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords, const ExpansionContext_t & tCtx )
+void ReorderEstimate_t::FinishDoclist ()
 {
-	assert ( m_pTokenizer && m_pDict && m_pSettings );
+	// renumbered doclist has to be stored in the new docid order
+	m_dRanks.Sort();
+	int64_t iLastRank = -1;
+	ARRAY_FOREACH ( i, m_dRanks )
+	{
+		m_iOrderBytes += ZippedBytes ( m_dRanks[i] - iLastRank );
+		iLastRank = m_dRanks[i];
+	}
+	m_dRanks.Resize ( 0 );
+}
 
-	BYTE sTokenized[3*SPH_MAX_WORD_LEN+4];
-	BYTE * sWord;
-	int iQpos = 1;
-	CSphVector<int> dQposWildcards;
 
-	// FIXME!!! got rid of duplicated term stat and qword setup
-	while ( ( sWord = m_pTokenizer->GetToken() )!=NULL )
+void CSphIndex_VLN::DebugEstimateReorder ( FILE * fp, const char * sAttr )
+{
+	if ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN || !m_iDocinfo )
 	{
-		const BYTE * sMultiform = m_pTokenizer->GetTokenizedMultiform();
-		strncpy ( (char *)sTokenized, sMultiform ? (const char*)sMultiform : (const char*)sWord, sizeof(sTokenized) );
+		fprintf ( fp, "FATAL: reorder estimate only supported for non-empty docinfo=extern indexes\n" );
+		return;
+	}
 
-		if ( ( !m_tFoldSettings.m_bFoldWildcards || m_tFoldSettings.m_bStats ) && sphHasExpandableWildcards ( (const char *)sWord ) )
-		{
-			dQposWildcards.Add ( iQpos );
+	const CSphColumnInfo * pCol = m_tSchema.GetAttr ( sAttr );
+	if ( !pCol )
+	{
+		fprintf ( fp, "FATAL: attribute '%s' not found\n", sAttr );
+		return;
+	}
 
-			ISphWordlist::Args_t tWordlist ( false, tCtx.m_iExpansionLimit, tCtx.m_bHasMorphology, tCtx.m_eHitless, tCtx.m_pIndexData );
-			bool bExpanded = sphExpandGetWords ( (const char *)sWord, tCtx, tWordlist );
+	// position of every row once documents are laid out by the attribute
+	const int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	CSphFixedVector<DWORD> dOrder ( 0 );
+	if ( !sphBuildAttrOrder ( m_tAttr.GetWritePtr(), m_iDocinfo, iStride, *pCol, dOrder ) )
+	{
+		fprintf ( fp, "FATAL: attribute '%s' must be an integer or float with no NaN values\n", sAttr );
+		return;
+	}
 
-			int iDocs = 0;
-			int iHits = 0;
+	CSphFixedVector<DWORD> dRank ( dOrder.GetLength() );
+	ARRAY_FOREACH ( i, dOrder )
+		dRank[dOrder[i]] = (DWORD)i;
 
-			// might fold wildcards but still want to sum up stats
-			if ( m_tFoldSettings.m_bFoldWildcards && m_tFoldSettings.m_bStats )
-			{
-				ARRAY_FOREACH ( i, tWordlist.m_dExpanded )
-				{
-					iDocs += tWordlist.m_dExpanded[i].m_iDocs;
-					iHits += tWordlist.m_dExpanded[i].m_iHits;
-				}
-				bExpanded = false;
-			} else
-			{
-				ARRAY_FOREACH ( i, tWordlist.m_dExpanded )
-				{
-					CSphKeywordInfo & tInfo = dKeywords.Add();
-					tInfo.m_sTokenized = (const char *)sWord;
-					tInfo.m_sNormalized = tWordlist.GetWordExpanded ( i );
-					tInfo.m_iDocs = tWordlist.m_dExpanded[i].m_iDocs;
-					tInfo.m_iHits = tWordlist.m_dExpanded[i].m_iHits;
-					tInfo.m_iQpos = iQpos;
-				}
-			}
+	WITH_QWORD ( this, false, Qword, EstimateReorder<Qword> ( fp, dRank ) );
+}
 
-			if ( !bExpanded || !tWordlist.m_dExpanded.GetLength() )
-			{
-				CSphKeywordInfo & tInfo = dKeywords.Add ();
-				tInfo.m_sTokenized = (const char *)sWord;
-				tInfo.m_sNormalized = (const char *)sWord;
-				tInfo.m_iDocs = iDocs;
-				tInfo.m_iHits = iHits;
-				tInfo.m_iQpos = iQpos;
-			}
-		} else
-		{
-			AddKeywordStats ( sWord, sTokenized, iQpos, dKeywords );
-		}
-
-		// FIXME!!! handle consecutive blended wo blended parts
-		bool bBlended = m_pTokenizer->TokenIsBlended();
-
-		if ( bBlended )
-		{
-			if ( m_tFoldSettings.m_bFoldBlended )
-				iQpos += m_pTokenizer->SkipBlended();
-		} else
-		{
-			iQpos++;
-		}
-	}
-
-	if ( !m_pSettings->m_uAotFilterMask )
-		return;
 
-	XQLimitSpec_t tSpec;
-	BYTE sTmp[3*SPH_MAX_WORD_LEN+4];
-	BYTE sTmp2[3*SPH_MAX_WORD_LEN+4];
-	CSphVector<XQNode_t *> dChildren ( 64 );
+template < class Qword >
+void CSphIndex_VLN::EstimateReorder ( FILE * fp, const CSphFixedVector<DWORD> & dRank )
+{
+	CSphString sError;
+	const bool bWordDict = m_pDict->GetSettings().m_bWordDict;
 
-	CSphBitvec tSkipTransform;
-	if ( dQposWildcards.GetLength () )
+	CSphDictReader tReader;
+	if ( !tReader.Setup ( GetIndexFileName("spi"), m_tWordlist.m_iWordsEnd, m_tSettings.m_eHitless, sError, bWordDict, &g_tThrottle, m_tWordlist.m_bHaveSkips ) )
 	{
-		tSkipTransform.Init ( iQpos+1 );
-		ARRAY_FOREACH ( i, dQposWildcards )
-			tSkipTransform.BitSet ( dQposWildcards[i] );
+		fprintf ( fp, "FATAL: %s\n", sError.cstr() );
+		return;
 	}
 
-	int iTokenizedTotal = dKeywords.GetLength();
-	for ( int iTokenized=0; iTokenized<iTokenizedTotal; iTokenized++ )
+	CSphAutofile tDocs, tHits;
+	if ( tDocs.Open ( GetIndexFileName("spd"), SPH_O_READ, sError )<0 || tHits.Open ( GetIndexFileName("spp"), SPH_O_READ, sError )<0 )
 	{
-		int iQpos = dKeywords[iTokenized].m_iQpos;
-
-		// do not transform expanded wild-cards
-		if ( tSkipTransform.GetSize() && tSkipTransform.BitGet ( iQpos ) )
-			continue;
+		fprintf ( fp, "FATAL: %s\n", sError.cstr() );
+		return;
+	}
 
-		// MUST copy as Dict::GetWordID changes word and might add symbols
-		strncpy ( (char *)sTokenized, dKeywords[iTokenized].m_sNormalized.scstr(), sizeof(sTokenized) );
-		int iPreAotCount = dKeywords.GetLength();
+	Qword tQword ( false, false );
+	CSphMerger::ConfigureQword<Qword> ( tQword, tHits, tDocs, m_tSchema.GetDynamicSize(), 0, NULL, &g_tThrottle );
 
-		XQNode_t tAotNode ( tSpec );
-		tAotNode.m_dWords.Resize ( 1 );
-		tAotNode.m_dWords.Begin()->m_sWord = (char *)sTokenized;
-		TransformAotFilter ( &tAotNode, m_pDict->GetWordforms(), *m_pSettings );
+	// only the docid deltas depend on the document order; hitlist offsets, field masks etc are left out
+	const DWORD * pDocinfo = m_tAttr.GetWritePtr();
+	const int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+	int64_t iWords = 0, iMissing = 0;
+	ReorderEstimate_t tEstimate;
 
-		dChildren.Resize ( 0 );
-		dChildren.Add ( &tAotNode );
+	while ( tReader.Read() )
+	{
+		CSphMerger::PrepareQword<Qword> ( tQword, tReader, m_uMinDocid, bWordDict );
+		tEstimate.StartDoclist ( m_uMinDocid );
+		iWords++;
 
-		// recursion unfolded
-		ARRAY_FOREACH ( iChild, dChildren )
+		int64_t iRow = 0;
+		for ( ;; )
 		{
-			// process all words at node
-			ARRAY_FOREACH ( iAotKeyword, dChildren[iChild]->m_dWords )
-			{
-				// MUST copy as Dict::GetWordID changes word and might add symbols
-				strncpy ( (char *)sTmp, dChildren[iChild]->m_dWords[iAotKeyword].m_sWord.scstr(), sizeof(sTmp) );
-				// prevent use-after-free-bug due to vector grow: AddKeywordsStats() calls dKeywords.Add()
-				strncpy ( (char *)sTmp2, dKeywords[iTokenized].m_sTokenized.scstr (), sizeof ( sTmp2 ) );
-				AddKeywordStats ( sTmp, sTmp2, iQpos, dKeywords );
-			}
-
-			// push all child nodes at node to process list
-			const XQNode_t * pChild = dChildren[iChild];
-			ARRAY_FOREACH ( iRec, pChild->m_dChildren )
-				dChildren.Add ( pChild->m_dChildren[iRec] );
-		}
-
-		bool bGotLemmas = ( iPreAotCount!=dKeywords.GetLength() );
+			const SphDocID_t uDocID = tQword.GetNextDoc ( NULL ).m_uDocID;
+			if ( !uDocID )
+				break;
 
-		// remove (replace) original word in case of AOT taken place
-		if ( bGotLemmas )
-		{
-			if ( !m_tFoldSettings.m_bFoldLemmas )
+			// both doclist and rows are in docid order, so search the tail only
+			int64_t iR = m_iDocinfo;
+			while ( iRow<iR )
 			{
-				::Swap ( dKeywords[iTokenized], dKeywords.Last() );
-				dKeywords.Resize ( dKeywords.GetLength()-1 );
-			} else
+				int64_t iMid = iRow + ( iR-iRow )/2;
+				if ( DOCINFO2ID ( pDocinfo + iMid*iStride )<uDocID )
+					iRow = iMid+1;
+				else
+					iR = iMid;
+			}
+			if ( iRow>=m_iDocinfo || DOCINFO2ID ( pDocinfo + iRow*iStride )!=uDocID )
 			{
-				int iDocs = 0;
-				int iHits = 0;
-				if ( m_tFoldSettings.m_bStats )
-				{
-					for ( int i=iPreAotCount; i<dKeywords.GetLength(); i++ )
-					{
-						iDocs += dKeywords[i].m_iDocs;
-						iHits += dKeywords[i].m_iHits;
-					}
-				}
-				::Swap ( dKeywords[iTokenized], dKeywords[iPreAotCount] );
-				dKeywords.Resize ( iPreAotCount );
-				dKeywords[iTokenized].m_iDocs = iDocs;
-				dKeywords[iTokenized].m_iHits = iHits;
+				iMissing++;
+				continue;
 			}
+
+			tEstimate.AddDoc ( uDocID, iRow, dRank[(int)iRow] );
 		}
+
+		tEstimate.FinishDoclist();
 	}
 
-	// sort by qpos
-	if ( dKeywords.GetLength()!=iTokenizedTotal )
-		sphSort ( dKeywords.Begin(), dKeywords.GetLength(), bind ( &CSphKeywordInfo::m_iQpos ) );
+	fprintf ( fp, "documents: " INT64_FMT "\n", m_iDocinfo );
+	fprintf ( fp, "words: " INT64_FMT "\n", iWords );
+	fprintf ( fp, "postings: " INT64_FMT "\n", tEstimate.m_iPostings );
+	if ( iMissing )
+		fprintf ( fp, "postings-without-docinfo: " INT64_FMT "\n", iMissing );
+	fprintf ( fp, "doclist-bytes: " INT64_FMT "\n", tDocs.GetSize() );
+	fprintf ( fp, "docid-delta-bytes: current=" INT64_FMT ", dense=" INT64_FMT ", reordered=" INT64_FMT "\n",
+		tEstimate.m_iCurBytes, tEstimate.m_iDenseBytes, tEstimate.m_iOrderBytes );
+	if ( tEstimate.m_iCurBytes )
+		fprintf ( fp, "docid-delta-saving: dense=%.1f%%, reordered=%.1f%%\n",
+			100.0f*( tEstimate.m_iCurBytes-tEstimate.m_iDenseBytes )/tEstimate.m_iCurBytes,
+			100.0f*( tEstimate.m_iCurBytes-tEstimate.m_iOrderBytes )/tEstimate.m_iCurBytes );
 }
 
+//////////////////////////////////////////////////////////////////////////
 
-struct CSphPlainQueryFilter : public ISphQueryFilter
+bool CSphIndex_VLN::Prealloc ( bool bStripPath )
 {
-	const ISphQwordSetup *	m_pTermSetup;
-	ISphQword *				m_pQueryWord;
-
-	virtual void AddKeywordStats ( BYTE * sWord, const BYTE * sTokenized, int iQpos, CSphVector <CSphKeywordInfo> & dKeywords )
-	{
-		assert ( !m_tFoldSettings.m_bStats || ( m_pTermSetup && m_pQueryWord ) );
+	MEMORY ( MEM_INDEX_DISK );
 
-		SphWordID_t iWord = m_pDict->GetWordID ( sWord );
-		if ( !iWord )
-			return;
+	// reset
+	Dealloc ();
 
-		if ( m_tFoldSettings.m_bStats )
-		{
-			m_pQueryWord->Reset ();
-			m_pQueryWord->m_sWord = (const char*)sWord;
-			m_pQueryWord->m_sDictWord = (const char*)sWord;
-			m_pQueryWord->m_uWordID = iWord;
-			m_pTermSetup->QwordSetup ( m_pQueryWord );
-		}
+	CSphEmbeddedFiles tEmbeddedFiles;
 
-		CSphKeywordInfo & tInfo = dKeywords.Add();
-		tInfo.m_sTokenized = (const char *)sTokenized;
-		tInfo.m_sNormalized = (const char*)sWord;
-		tInfo.m_iDocs = m_tFoldSettings.m_bStats ? m_pQueryWord->m_iDocs : 0;
-		tInfo.m_iHits = m_tFoldSettings.m_bStats ? m_pQueryWord->m_iHits : 0;
-		tInfo.m_iQpos = iQpos;
+	// preload schema
+	if ( !LoadHeader ( GetIndexFileName("sph").cstr(), bStripPath, tEmbeddedFiles, m_sLastWarning ) )
+		return false;
 
-		if ( tInfo.m_sNormalized.cstr()[0]==MAGIC_WORD_HEAD_NONSTEMMED )
-			*(char *)tInfo.m_sNormalized.cstr() = '=';
-	}
-};
+	tEmbeddedFiles.Reset();
 
+	// verify that data files are readable
+	if ( !sphIsReadable ( GetIndexFileName("spd").cstr(), &m_sLastError ) )
+		return false;
 
-template < class Qword >
-bool CSphIndex_VLN::DoGetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords,
-	const char * szQuery, const GetKeywordsSettings_t & tSettings, bool bFillOnly, CSphString * pError ) const
-{
-	if ( !bFillOnly )
-		dKeywords.Resize ( 0 );
+	if ( m_uVersion>=3 && !sphIsReadable ( GetIndexFileName("spp").cstr(), &m_sLastError ) )
+		return false;
 
-	if ( !m_bPassedAlloc )
-	{
-		if ( pError )
-			*pError = "index not preread";
+	if ( m_bHaveSkips && !sphIsReadable ( GetIndexFileName("spe").cstr(), &m_sLastError ) )
 		return false;
-	}
 
-	// short-cut if no query or keywords to fill
-	if ( ( bFillOnly && !dKeywords.GetLength() ) || ( !bFillOnly && ( !szQuery || !szQuery[0] ) ) )
-		return true;
+	// preopen
+	if ( m_bKeepFilesOpen )
+	{
+		if ( m_tDoclistFile.Open ( GetIndexFileName("spd"), SPH_O_READ, m_sLastError ) < 0 )
+			return false;
 
-	// TODO: in case of bFillOnly skip tokenizer cloning and setup
-	CSphScopedPtr<ISphTokenizer> pTokenizer ( m_pTokenizer->Clone ( SPH_CLONE_INDEX ) ); // avoid race
-	pTokenizer->EnableTokenizedMultiformTracking ();
+		if ( m_tHitlistFile.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, m_sLastError ) < 0 )
+			return false;
+	}
 
-	// need to support '*' and '=' but not the other specials
-	// so m_pQueryTokenizer does not work for us, gotta clone and setup one manually
-	if ( IsStarDict() )
-		pTokenizer->AddPlainChar ( '*' );
-	if ( m_tSettings.m_bIndexExactWords )
-		pTokenizer->AddPlainChar ( '=' );
+	/////////////////////
+	// prealloc wordlist
+	/////////////////////
 
-	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
-	CSphDict * pDictBase = m_pDict;
-	if ( pDictBase->HasState() )
-		tDictCloned = pDictBase = pDictBase->Clone();
+	if ( m_uVersion>=3 && !sphIsReadable ( GetIndexFileName("spi").cstr(), &m_sLastError ) )
+		return false;
 
-	CSphScopedPtr<CSphDict> tDict ( NULL );
-	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
+	// might be no dictionary at this point for old index format
+	bool bWordDict = m_pDict && m_pDict->GetSettings().m_bWordDict;
 
-	CSphScopedPtr<CSphDict> tDict2 ( NULL );
-	pDict = SetupExactDict ( tDict2, pDict );
+	// only checkpoint and wordlist infixes are actually read here; dictionary itself is just mapped
+	if ( !m_tWordlist.Preread ( GetIndexFileName("spi").cstr() , m_uVersion, bWordDict, m_sLastError ) )
+		return false;
 
-	CSphVector<BYTE> dFiltered;
-	CSphScopedPtr<ISphFieldFilter> pFieldFilter ( NULL );
-	const BYTE * sModifiedQuery = (const BYTE *)szQuery;
-	if ( m_pFieldFilter && szQuery )
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN )
 	{
-		pFieldFilter = m_pFieldFilter->Clone();
-		if ( pFieldFilter.Ptr() && pFieldFilter->Apply ( sModifiedQuery, strlen ( (char*)sModifiedQuery ), dFiltered, true ) )
-			sModifiedQuery = dFiltered.Begin();
-	}
+		CSphAutofile tDocinfo ( GetIndexFileName("spa"), SPH_O_READ, m_sLastError );
+		if ( tDocinfo.GetFD()<0 )
+			return false;
 
-	// FIXME!!! missed bigram, add flags to fold blended parts, show expanded terms
+		m_bIsEmpty = ( tDocinfo.GetSize ( 0, false, m_sLastError )==0 );
+	} else
+		m_bIsEmpty = ( m_tWordlist.m_tBuf.GetLengthBytes()<=1 );
 
-	// prepare for setup
-	CSphAutofile tDummy1, tDummy2;
+	if ( ( m_tWordlist.m_tBuf.GetLengthBytes()<=1 )!=( m_tWordlist.m_dCheckpoints.GetLength()==0 ) )
+		sphWarning ( "wordlist size mismatch (size=" INT64_FMT ", checkpoints=%d)", m_tWordlist.m_tBuf.GetLengthBytes(), m_tWordlist.m_dCheckpoints.GetLength() );
 
-	DiskIndexQwordSetup_c tTermSetup ( tDummy1, tDummy2, m_tSkiplists.GetWritePtr(), NULL );
-	tTermSetup.m_pDict = pDict;
-	tTermSetup.m_pIndex = this;
-	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
+	// make sure checkpoints are loadable
+	// pre-11 indices use different offset type (this is fixed up later during the loading)
+	assert ( m_tWordlist.m_iDictCheckpointsOffset>0 );
 
-	Qword tQueryWord ( false, false );
+	/////////////////////
+	// prealloc docinfos
+	/////////////////////
 
-	if ( !bFillOnly )
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_bIsEmpty )
 	{
-		ExpansionContext_t tExpCtx;
-		// query defined options
-		tExpCtx.m_iExpansionLimit = ( tSettings.m_iExpansionLimit ? tSettings.m_iExpansionLimit : m_iExpansionLimit );
-		bool bExpandWildcards = ( pDict->GetSettings ().m_bWordDict && IsStarDict() && !tSettings.m_bFoldWildcards );
+		/////////////
+		// attr data
+		/////////////
 
-		CSphPlainQueryFilter tAotFilter;
-		tAotFilter.m_pTokenizer = pTokenizer.Ptr();
-		tAotFilter.m_pDict = pDict;
-		tAotFilter.m_pSettings = &m_tSettings;
-		tAotFilter.m_pTermSetup = &tTermSetup;
-		tAotFilter.m_pQueryWord = &tQueryWord;
-		tAotFilter.m_tFoldSettings = tSettings;
-		tAotFilter.m_tFoldSettings.m_bFoldWildcards = !bExpandWildcards;
+		int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
 
-		tExpCtx.m_pWordlist = &m_tWordlist;
-		tExpCtx.m_iMinPrefixLen = m_tSettings.m_iMinPrefixLen;
-		tExpCtx.m_iMinInfixLen = m_tSettings.m_iMinInfixLen;
-		tExpCtx.m_bHasMorphology = m_pDict->HasMorphology();
-		tExpCtx.m_bMergeSingles = false;
-		tExpCtx.m_eHitless = m_tSettings.m_eHitless;
+		if ( !m_tAttr.Setup ( GetIndexFileName("spa").cstr(), m_sLastError, true ) )
+			return false;
 
-		pTokenizer->SetBuffer ( sModifiedQuery, strlen ( (const char *)sModifiedQuery) );
+		int64_t iDocinfoSize = m_tAttr.GetLengthBytes();
+		if ( iDocinfoSize<0 )
+			return false;
+		iDocinfoSize = iDocinfoSize / sizeof(DWORD);
+		int64_t iRealDocinfoSize = m_iMinMaxIndex ? m_iMinMaxIndex : iDocinfoSize;
+		m_iDocinfo = iRealDocinfoSize / iStride;
 
-		tAotFilter.GetKeywords ( dKeywords, tExpCtx );
-	} else
-	{
-		BYTE sWord[MAX_KEYWORD_BYTES];
+		if ( !CheckDocsCount ( m_iDocinfo, m_sLastError ) )
+			return false;
 
-		ARRAY_FOREACH ( i, dKeywords )
+		if ( iDocinfoSize < iRealDocinfoSize )
 		{
-			CSphKeywordInfo & tInfo = dKeywords[i];
-			int iLen = tInfo.m_sTokenized.Length();
-			memcpy ( sWord, tInfo.m_sTokenized.cstr(), iLen );
-			sWord[iLen] = '\0';
+			m_sLastError.SetSprintf ( "precomputed chunk size check mismatch" );
+			sphLogDebug ( "precomputed chunk size check mismatch (size=" INT64_FMT ", real=" INT64_FMT ", min-max=" INT64_FMT ", count=" INT64_FMT ")",
+				iDocinfoSize, iRealDocinfoSize, m_iMinMaxIndex, m_iDocinfo );
+			return false;
+		}
 
-			SphWordID_t iWord = pDict->GetWordID ( sWord );
-			if ( iWord )
-			{
-				tQueryWord.Reset ();
-				tQueryWord.m_sWord = tInfo.m_sTokenized;
-				tQueryWord.m_sDictWord = (const char*)sWord;
-				tQueryWord.m_uWordID = iWord;
-				tTermSetup.QwordSetup ( &tQueryWord );
+		m_iDocinfoIndex = ( ( iDocinfoSize - iRealDocinfoSize ) / iStride / 2 ) - 1;
+		m_pDocinfoIndex = m_tAttr.GetWritePtr() + m_iMinMaxIndex;
 
-				tInfo.m_iDocs += tQueryWord.m_iDocs;
-				tInfo.m_iHits += tQueryWord.m_iHits;
+		// prealloc docinfo hash but only if docinfo is big enough (in other words if hash is 8x+ less in size)
+		if ( m_tAttr.GetLengthBytes() > ( 32 << DOCINFO_HASH_BITS ) && !m_bDebugCheck )
+		{
+			if ( !m_tDocinfoHash.Alloc ( ( 1 << DOCINFO_HASH_BITS )+4, m_sLastError ) )
+				return false;
+		}
+
+		////////////
+		// MVA data
+		////////////
+
+		if ( m_uVersion>=4 )
+		{
+			if ( !m_tMva.Setup ( GetIndexFileName("spm").cstr(), m_sLastError, false ) )
+				return false;
+
+			if ( m_tMva.GetNumEntries()>INT_MAX )
+			{
+				m_bArenaProhibit = true;
+				sphWarning ( "MVA update disabled (loaded MVA " INT64_FMT ", should be less %d)", m_tMva.GetNumEntries(), INT_MAX );
 			}
 		}
-	}
 
-	return true;
-}
+		///////////////
+		// string data
+		///////////////
 
+		if ( m_uVersion>=17 && !m_tString.Setup ( GetIndexFileName("sps").cstr(), m_sLastError, true ) )
+				return false;
+	}
 
-bool CSphIndex_VLN::FillKeywords ( CSphVector <CSphKeywordInfo> & dKeywords ) const
-{
-	GetKeywordsSettings_t tSettings;
-	tSettings.m_bStats = true;
 
-	WITH_QWORD ( this, false, Qword, return DoGetKeywords<Qword> ( dKeywords, NULL, tSettings, true, NULL ) );
-	return false;
-}
+	// prealloc killlist
+	if ( m_uVersion>=10 )
+	{
+		// FIXME!!! m_bId32to64
+		if ( !m_tKillList.Setup ( GetIndexFileName("spk").cstr(), m_sLastError, false ) )
+			return false;
+	}
 
+	// prealloc skiplist
+	if ( !m_bDebugCheck && m_bHaveSkips && !m_tSkiplists.Setup ( GetIndexFileName("spe").cstr(), m_sLastError, false ) )
+			return false;
 
-// fix MSVC 2005 fuckup, template DoGetKeywords() just above somehow resets forScope
-#if USE_WINDOWS
-#pragma conform(forScope,on)
-#endif
+	// almost done
+	m_bPassedAlloc = true;
+	m_iIndexTag = ++m_iIndexTagSeq;
+
+	bool bPersistMVA = sphIsReadable ( GetIndexFileName("mvp").cstr() );
+	bool bNoMinMax = ( m_uVersion<20 );
+	if ( ( bPersistMVA || bNoMinMax ) && !m_bDebugCheck )
+	{
+		sphLogDebug ( "'%s' forced to read data at prealloc (persist MVA = %d, no min-max = %d)", m_sIndexName.cstr(), (int)bPersistMVA, (int)bNoMinMax );
+		Preread();
 
+		// persist MVA needs valid DocinfoHash
+		sphLogDebug ( "Prereading .mvp" );
+		if ( !LoadPersistentMVA ( m_sLastError ) )
+			return false;
 
-static bool IsWeightColumn ( const CSphString & sAttr, const ISphSchema & tSchema )
-{
-	if ( sAttr=="@weight" )
-		return true;
+		// build "indexes" for full-scan
+		if ( m_uVersion<20 && !PrecomputeMinMax() )
+			return false;
+	}
 
-	const CSphColumnInfo * pCol = tSchema.GetAttr ( sAttr.cstr() );
-	return ( pCol && pCol->m_bWeight );
+	return true;
 }
 
 
-bool CSphQueryContext::CreateFilters ( bool bFullscan,
-	const CSphVector<CSphFilterSettings> * pdFilters, const ISphSchema & tSchema,
-	const DWORD * pMvaPool, const BYTE * pStrings, CSphString & sError, CSphString & sWarning, ESphCollation eCollation, bool bArenaProhibit,
-	const KillListVector & dKillList )
+void CSphIndex_VLN::Preread ()
 {
-	if ( !pdFilters && !dKillList.GetLength() )
-		return true;
+	MEMORY ( MEM_INDEX_DISK );
 
-	if ( pdFilters )
-	{
-		ARRAY_FOREACH ( i, (*pdFilters) )
-		{
-			const CSphFilterSettings * pFilterSettings = pdFilters->Begin() + i;
-			if ( pFilterSettings->m_sAttrName.IsEmpty() )
-				continue;
+	sphLogDebug ( "CSphIndex_VLN::Preread invoked '%s'", m_sIndexName.cstr() );
 
-			bool bWeight = IsWeightColumn ( pFilterSettings->m_sAttrName, tSchema );
+	assert ( m_bPassedAlloc );
+	if ( m_bPassedRead )
+		return;
 
-			if ( bFullscan && bWeight )
-				continue; // @weight is not available in fullscan mode
+	///////////////////
+	// read everything
+	///////////////////
 
-			// bind user variable local to that daemon
-			CSphFilterSettings tUservar;
-			if ( pFilterSettings->m_eType==SPH_FILTER_USERVAR )
-			{
-				const CSphString * sVar = pFilterSettings->m_dStrings.GetLength()==1 ? pFilterSettings->m_dStrings.Begin() : NULL;
-				if ( !g_pUservarsHook || !sVar )
-				{
-					sError = "no global variables found";
-					return false;
-				}
+	volatile BYTE uRead = 0; // just need all side-effects
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "attributes", m_bMlock, m_bOndiskAllAttr, m_tAttr );
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "MVA", m_bMlock, m_bOndiskPoolAttr, m_tMva );
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "strings", m_bMlock, m_bOndiskPoolAttr, m_tString );
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "kill-list", m_bMlock, m_bOndiskAllAttr, m_tKillList );
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "skip-list", m_bMlock, false, m_tSkiplists );
+	uRead ^= PrereadMapping ( m_sIndexName.cstr(), "dictionary", m_bMlock, false, m_tWordlist.m_tBuf );
 
-				const UservarIntSet_c * pUservar = g_pUservarsHook ( *sVar );
-				if ( !pUservar )
-				{
-					sError.SetSprintf ( "undefined global variable '%s'", sVar->cstr() );
-					return false;
-				}
+	//////////////////////
+	// precalc everything
+	//////////////////////
 
-				m_dUserVals.Add ( pUservar );
-				tUservar = *pFilterSettings;
-				tUservar.m_eType = SPH_FILTER_VALUES;
-				tUservar.SetExternalValues ( pUservar->Begin(), pUservar->GetLength() );
-				pFilterSettings = &tUservar;
-			}
+	// build attributes hash
+	if ( m_tAttr.GetLengthBytes() && m_tDocinfoHash.GetLengthBytes() && !m_bDebugCheck )
+	{
+		sphLogDebug ( "Hashing docinfo" );
+		assert ( CheckDocsCount ( m_iDocinfo, m_sLastError ) );
+		int iStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		SphDocID_t uFirst = DOCINFO2ID ( &m_tAttr[0] );
+		SphDocID_t uRange = DOCINFO2ID ( &m_tAttr[ ( m_iDocinfo-1)*iStride ] ) - uFirst;
+		DWORD iShift = 0;
+		while ( uRange>=( 1 << DOCINFO_HASH_BITS ) )
+		{
+			iShift++;
+			uRange >>= 1;
+		}
 
-			ISphFilter * pFilter = sphCreateFilter ( *pFilterSettings, tSchema, pMvaPool, pStrings, sError, sWarning, eCollation, bArenaProhibit );
-			if ( !pFilter )
-				return false;
+		DWORD * pHash = m_tDocinfoHash.GetWritePtr();
+		*pHash++ = iShift;
+		*pHash = 0;
+		DWORD uLastHash = 0;
 
-			ISphFilter ** pGroup = bWeight ? &m_pWeightFilter : &m_pFilter;
-			*pGroup = sphJoinFilters ( *pGroup, pFilter );
+		for ( int64_t i=1; i<m_iDocinfo; i++ )
+		{
+			assert ( DOCINFO2ID ( &m_tAttr[ i*iStride ] )>uFirst
+				&& DOCINFO2ID ( &m_tAttr[ ( i-1 )*iStride ] ) < DOCINFO2ID ( &m_tAttr[ i*iStride ] )
+				&& "descending document ID found" );
+			DWORD uHash = (DWORD)( ( DOCINFO2ID ( &m_tAttr[ i*iStride ] ) - uFirst ) >> iShift );
+			if ( uHash==uLastHash )
+				continue;
+
+			while ( uLastHash<uHash )
+				pHash [ ++uLastHash ] = (DWORD)i;
+
+			uLastHash = uHash;
 		}
+		pHash [ ++uLastHash ] = (DWORD)m_iDocinfo;
 	}
 
-	if ( dKillList.GetLength() )
-	{
-		ISphFilter * pFilter = sphCreateFilter ( dKillList );
-		if ( !pFilter )
-			return false;
+	// build geo grid
+	if ( !m_tSettings.m_sGeoLat.IsEmpty() && m_tAttr.GetLengthBytes() && !m_bDebugCheck )
+		BuildGeoGrid();
 
-		m_pFilter = sphJoinFilters ( m_pFilter, pFilter );
-	}
+	// build scan order
+	if ( !m_tSettings.m_sSortByAttr.IsEmpty() && m_tAttr.GetLengthBytes() && !m_bDebugCheck )
+		BuildAttrOrder();
 
-	if ( m_pFilter )
-		m_pFilter = m_pFilter->Optimize();
+	m_bPassedRead = true;
+	sphLogDebug ( "Preread successfully finished, hash=%u", (DWORD)uRead );
+	return;
+}
 
-	return true;
+void CSphIndex_VLN::SetMemorySettings ( bool bMlock, bool bOndiskAttrs, bool bOndiskPool )
+{
+	m_bMlock = bMlock;
+	m_bOndiskAllAttr = bOndiskAttrs;
+	m_bOndiskPoolAttr = ( bOndiskAttrs || bOndiskPool );
 }
 
 
-bool CSphQueryContext::SetupOverrides ( const CSphQuery * pQuery, CSphQueryResult * pResult, const CSphSchema & tIndexSchema, const ISphSchema & tOutgoingSchema )
+void CSphIndex_VLN::SetBase ( const char * sNewBase )
 {
-	m_pOverrides = NULL;
-	m_dOverrideIn.Resize ( pQuery->m_dOverrides.GetLength() );
-	m_dOverrideOut.Resize ( pQuery->m_dOverrides.GetLength() );
+	m_sFilename = sNewBase;
+}
 
-	ARRAY_FOREACH ( i, pQuery->m_dOverrides )
-	{
-		const char * sAttr = pQuery->m_dOverrides[i].m_sAttr.cstr(); // shortcut
-		const CSphColumnInfo * pCol = tIndexSchema.GetAttr ( sAttr );
-		if ( !pCol )
-		{
-			pResult->m_sError.SetSprintf ( "attribute override: unknown attribute name '%s'", sAttr );
-			return false;
-		}
 
-		if ( pCol->m_eAttrType!=pQuery->m_dOverrides[i].m_eAttrType )
-		{
-			pResult->m_sError.SetSprintf ( "attribute override: attribute '%s' type mismatch (index=%d, query=%d)",
-				sAttr, pCol->m_eAttrType, pQuery->m_dOverrides[i].m_eAttrType );
-			return false;
-		}
+bool CSphIndex_VLN::Rename ( const char * sNewBase )
+{
+	if ( m_sFilename==sNewBase )
+		return true;
 
-		const CSphColumnInfo * pOutCol = tOutgoingSchema.GetAttr ( pQuery->m_dOverrides[i].m_sAttr.cstr() );
-		if ( !pOutCol )
-		{
-			pResult->m_sError.SetSprintf ( "attribute override: unknown attribute name '%s' in outgoing schema", sAttr );
-			return false;
-		}
-
-		m_dOverrideIn[i] = pCol->m_tLocator;
-		m_dOverrideOut[i] = pOutCol->m_tLocator;
-
-#ifndef NDEBUG
-		// check that the values are actually sorted
-		const CSphVector<CSphAttrOverride::IdValuePair_t> & dValues = pQuery->m_dOverrides[i].m_dValues;
-		for ( int j=1; j<dValues.GetLength(); j++ )
-			assert ( dValues[j-1] < dValues[j] );
-#endif
-	}
+	// try to rename everything
+	char sFrom [ SPH_MAX_FILENAME_LEN ];
+	char sTo [ SPH_MAX_FILENAME_LEN ];
 
-	if ( pQuery->m_dOverrides.GetLength() )
-		m_pOverrides = &pQuery->m_dOverrides;
-	return true;
-}
+	// +1 for ".spl"
+	int iExtCount = sphGetExtCount() + 1;
+	const char ** sExts = sphGetExts ( SPH_EXT_TYPE_LOC );
+	DWORD uMask = 0;
 
-static int sphQueryHeightCalc ( const XQNode_t * pNode )
-{
-	if ( !pNode->m_dChildren.GetLength() )
+	int iExt;
+	for ( iExt=0; iExt<iExtCount; iExt++ )
 	{
-		// exception, pre-cached OR of tiny (rare) keywords is just one node
-		if ( pNode->GetOp()==SPH_QUERY_OR )
+		const char * sExt = sExts[iExt];
+		if ( !strcmp ( sExt, ".spp" ) && m_uVersion<3 ) // .spp files are v3+
+			continue;
+		if ( !strcmp ( sExt, ".spm" ) && m_uVersion<4 ) // .spm files are v4+
+			continue;
+		if ( !strcmp ( sExt, ".spk" ) && m_uVersion<10 ) // .spk files are v10+
+			continue;
+		if ( !strcmp ( sExt, ".sps" ) && m_uVersion<17 ) // .sps files are v17+
+			continue;
+		if ( !strcmp ( sExt, ".spe" ) && m_uVersion<31 ) // .spe files are v31+
+			continue;
+
+#if !USE_WINDOWS
+		if ( !strcmp ( sExt, ".spl" ) && m_iLockFD<0 ) // .spl files are locks
+			continue;
+#else
+		if ( !strcmp ( sExt, ".spl" ) )
 		{
-#ifndef NDEBUG
-			// sanity checks
-			// this node must be only created for a huge OR of tiny expansions
-			assert ( pNode->m_dWords.GetLength() );
-			ARRAY_FOREACH ( i, pNode->m_dWords )
+			if ( m_iLockFD>=0 )
 			{
-				assert ( pNode->m_dWords[i].m_iAtomPos==pNode->m_dWords[0].m_iAtomPos );
-				assert ( pNode->m_dWords[i].m_bExpanded );
+				::close ( m_iLockFD );
+				::unlink ( GetIndexFileName("spl").cstr() );
+				sphLogDebug ( "lock %s unlinked, file with ID %d closed", GetIndexFileName("spl").cstr(), m_iLockFD );
+				m_iLockFD = -1;
 			}
+			continue;
+		}
 #endif
-			return 1;
+
+		snprintf ( sFrom, sizeof(sFrom), "%s%s", m_sFilename.cstr(), sExt );
+		snprintf ( sTo, sizeof(sTo), "%s%s", sNewBase, sExt );
+
+#if USE_WINDOWS
+		::unlink ( sTo );
+		sphLogDebug ( "%s unlinked", sTo );
+#endif
+
+		if ( ::rename ( sFrom, sTo ) )
+		{
+			m_sLastError.SetSprintf ( "rename %s to %s failed: %s", sFrom, sTo, strerror(errno) );
+			// this is no reason to fail if spl is missing, since it is only lock and no data.
+			if ( strcmp ( sExt, ".spl" ) )
+				break;
 		}
-		return pNode->m_dWords.GetLength();
+		uMask |= ( 1UL << iExt );
 	}
 
-	if ( pNode->GetOp()==SPH_QUERY_BEFORE )
-		return 1;
+	// are we good?
+	if ( iExt==iExtCount )
+	{
+		SetBase ( sNewBase );
+		sphLogDebug ( "Base set to %s", sNewBase );
+		return true;
+	}
 
-	int iMaxChild = 0;
-	int iHeight = 0;
-	ARRAY_FOREACH ( i, pNode->m_dChildren )
+	// if there were errors, rollback
+	for ( iExt=0; iExt<iExtCount; iExt++ )
 	{
-		int iBottom = sphQueryHeightCalc ( pNode->m_dChildren[i] );
-		int iTop = pNode->m_dChildren.GetLength()-i-1;
-		if ( iBottom+iTop>=iMaxChild+iHeight )
+		if (!( uMask & ( 1UL << iExt ) ))
+			continue;
+
+		const char * sExt = sExts[iExt];
+		snprintf ( sFrom, sizeof(sFrom), "%s%s", sNewBase, sExt );
+		snprintf ( sTo, sizeof(sTo), "%s%s", m_sFilename.cstr(), sExt );
+		if ( ::rename ( sFrom, sTo ) )
 		{
-			iMaxChild = iBottom;
-			iHeight = iTop;
+			sphLogDebug ( "Rollback failure when renaming %s to %s", sFrom, sTo );
+			// !COMMIT should handle rollback failures somehow
 		}
 	}
-
-	return iMaxChild+iHeight;
+	return false;
 }
 
-#define SPH_EXTNODE_STACK_SIZE 160
+//////////////////////////////////////////////////////////////////////////
 
-bool sphCheckQueryHeight ( const XQNode_t * pRoot, CSphString & sError )
+CSphQueryContext::CSphQueryContext ( const CSphQuery & q )
+	: m_tQuery ( q )
 {
-	int iHeight = 0;
-	if ( pRoot )
-		iHeight = sphQueryHeightCalc ( pRoot );
-
-	int64_t iQueryStack = sphGetStackUsed() + iHeight*SPH_EXTNODE_STACK_SIZE;
-	bool bValid = ( g_iThreadStackSize>=iQueryStack );
-	if ( !bValid )
-		sError.SetSprintf ( "query too complex, not enough stack (thread_stack=%dK or higher required)",
-			(int)( ( iQueryStack + 1024 - ( iQueryStack%1024 ) ) / 1024 ) );
-	return bValid;
+	m_iWeights = 0;
+	m_bLookupFilter = false;
+	m_bLookupSort = false;
+	m_uPackedFactorFlags = SPH_FACTOR_DISABLE;
+	m_pFilter = NULL;
+	m_pWeightFilter = NULL;
+	m_pIndexData = NULL;
+	m_pProfile = NULL;
+	m_pLocalDocs = NULL;
+	m_iTotalDocs = 0;
+	m_iBadRows = 0;
+	m_bStringDicts = false;
 }
 
-static XQNode_t * CloneKeyword ( const XQNode_t * pNode )
+CSphQueryContext::~CSphQueryContext ()
 {
-	assert ( pNode );
+	SafeDelete ( m_pFilter );
+	SafeDelete ( m_pWeightFilter );
 
-	XQNode_t * pRes = new XQNode_t ( pNode->m_dSpec );
-	pRes->m_dWords = pNode->m_dWords;
-	return pRes;
+	ARRAY_FOREACH ( i, m_dUserVals )
+		m_dUserVals[i]->Release();
 }
 
-
-static XQNode_t * ExpandKeyword ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
+void CSphQueryContext::BindWeights ( const CSphQuery * pQuery, const CSphSchema & tSchema, CSphString & sWarning )
 {
-	assert ( pNode );
+	const int MIN_WEIGHT = 1;
+	// const int HEAVY_FIELDS = 32;
+	const int HEAVY_FIELDS = SPH_MAX_FIELDS;
 
-	XQNode_t * pExpand = new XQNode_t ( pNode->m_dSpec );
-	pExpand->SetOp ( SPH_QUERY_OR, pNode );
+	// defaults
+	m_iWeights = Min ( tSchema.m_dFields.GetLength(), HEAVY_FIELDS );
+	for ( int i=0; i<m_iWeights; i++ )
+		m_dWeights[i] = MIN_WEIGHT;
 
-	if ( tSettings.m_iMinInfixLen>0 )
-	{
-		assert ( pNode->m_dChildren.GetLength()==0 );
-		assert ( pNode->m_dWords.GetLength()==1 );
-		XQNode_t * pInfix = CloneKeyword ( pNode );
-		pInfix->m_dWords[0].m_sWord.SetSprintf ( "*%s*", pNode->m_dWords[0].m_sWord.cstr() );
-		pInfix->m_pParent = pExpand;
-		pExpand->m_dChildren.Add ( pInfix );
-	} else if ( tSettings.m_iMinPrefixLen>0 )
+	// name-bound weights
+	CSphString sFieldsNotFound;
+	if ( pQuery->m_dFieldWeights.GetLength() )
 	{
-		assert ( pNode->m_dChildren.GetLength()==0 );
-		assert ( pNode->m_dWords.GetLength()==1 );
-		XQNode_t * pPrefix = CloneKeyword ( pNode );
-		pPrefix->m_dWords[0].m_sWord.SetSprintf ( "%s*", pNode->m_dWords[0].m_sWord.cstr() );
-		pPrefix->m_pParent = pExpand;
-		pExpand->m_dChildren.Add ( pPrefix );
+		ARRAY_FOREACH ( i, pQuery->m_dFieldWeights )
+		{
+			int j = tSchema.GetFieldIndex ( pQuery->m_dFieldWeights[i].m_sName.cstr() );
+			if ( j<0 )
+			{
+				if ( sFieldsNotFound.IsEmpty() )
+					sFieldsNotFound = pQuery->m_dFieldWeights[i].m_sName;
+				else
+					sFieldsNotFound.SetSprintf ( "%s %s", sFieldsNotFound.cstr(), pQuery->m_dFieldWeights[i].m_sName.cstr() );
+			}
+
+			if ( j>=0 && j<HEAVY_FIELDS )
+				m_dWeights[j] = Max ( MIN_WEIGHT, pQuery->m_dFieldWeights[i].m_iValue );
+		}
+
+		if ( !sFieldsNotFound.IsEmpty() )
+			sWarning.SetSprintf ( "Fields specified in field_weights option not found: [%s]", sFieldsNotFound.cstr() );
+
+		return;
 	}
 
-	if ( tSettings.m_bIndexExactWords )
+	// order-bound weights
+	if ( pQuery->m_dWeights.GetLength() )
 	{
-		assert ( pNode->m_dChildren.GetLength()==0 );
-		assert ( pNode->m_dWords.GetLength()==1 );
-		XQNode_t * pExact = CloneKeyword ( pNode );
-		pExact->m_dWords[0].m_sWord.SetSprintf ( "=%s", pNode->m_dWords[0].m_sWord.cstr() );
-		pExact->m_pParent = pExpand;
-		pExpand->m_dChildren.Add ( pExact );
+		for ( int i=0; i<Min ( m_iWeights, pQuery->m_dWeights.GetLength() ); i++ )
+			m_dWeights[i] = Max ( MIN_WEIGHT, (int)pQuery->m_dWeights[i] );
 	}
-
-	return pExpand;
 }
 
-XQNode_t * sphQueryExpandKeywords ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
+bool CSphQueryContext::SetupCalc ( CSphQueryResult * pResult, const ISphSchema & tInSchema,
+									const CSphSchema & tSchema, const DWORD * pMvaPool, bool bArenaProhibit )
 {
-	// only if expansion makes sense at all
-	if ( tSettings.m_iMinInfixLen<=0 && tSettings.m_iMinPrefixLen<=0 && !tSettings.m_bIndexExactWords )
-		return pNode;
+	m_dCalcFilter.Resize ( 0 );
+	m_dCalcSort.Resize ( 0 );
+	m_dCalcFinal.Resize ( 0 );
 
-	// process children for composite nodes
-	if ( pNode->m_dChildren.GetLength() )
+	// quickly verify that all my real attributes can be stashed there
+	if ( tInSchema.GetAttrsCount() < tSchema.GetAttrsCount() )
 	{
-		ARRAY_FOREACH ( i, pNode->m_dChildren )
-		{
-			pNode->m_dChildren[i] = sphQueryExpandKeywords ( pNode->m_dChildren[i], tSettings );
-			pNode->m_dChildren[i]->m_pParent = pNode;
-		}
-		return pNode;
+		pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema mismatch (incount=%d, mycount=%d)",
+			tInSchema.GetAttrsCount(), tSchema.GetAttrsCount() );
+		return false;
 	}
 
-	// if that's a phrase/proximity node, create a very special, magic phrase/proximity node
-	if ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM )
-	{
-		assert ( pNode->m_dWords.GetLength()>1 );
-		ARRAY_FOREACH ( i, pNode->m_dWords )
-		{
-			XQNode_t * pWord = new XQNode_t ( pNode->m_dSpec );
-			pWord->m_dWords.Add ( pNode->m_dWords[i] );
-			pNode->m_dChildren.Add ( ExpandKeyword ( pWord, tSettings ) );
-			pNode->m_dChildren.Last()->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
-			pNode->m_dChildren.Last()->m_pParent = pNode;
-		}
-		pNode->m_dWords.Reset();
-		pNode->m_bVirtuallyPlain = true;
-		return pNode;
-	}
+	bool bGotAggregate = false;
 
-	// skip empty plain nodes
-	if ( pNode->m_dWords.GetLength()<=0 )
-		return pNode;
+	// now match everyone
+	for ( int iIn=0; iIn<tInSchema.GetAttrsCount(); iIn++ )
+	{
+		const CSphColumnInfo & tIn = tInSchema.GetAttr(iIn);
+		bGotAggregate |= ( tIn.m_eAggrFunc!=SPH_AGGR_NONE );
 
-	// process keywords for plain nodes
-	assert ( pNode->m_dWords.GetLength()==1 );
+		switch ( tIn.m_eStage )
+		{
+			case SPH_EVAL_STATIC:
+			case SPH_EVAL_OVERRIDE:
+			{
+				// this check may significantly slow down queries with huge schema attribute count
+#ifndef NDEBUG
+				const CSphColumnInfo * pMy = tSchema.GetAttr ( tIn.m_sName.cstr() );
+				if ( !pMy )
+				{
+					pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema attr missing from index-schema (in=%s)",
+						sphDumpAttr(tIn).cstr() );
+					return false;
+				}
 
-	XQKeyword_t & tKeyword = pNode->m_dWords[0];
-	if ( tKeyword.m_sWord.Begins("=")
-		|| tKeyword.m_sWord.Begins("*")
-		|| tKeyword.m_sWord.Ends("*") )
-	{
-		return pNode;
-	}
+				if ( tIn.m_eStage==SPH_EVAL_OVERRIDE )
+				{
+					// override; check for type/size match and dynamic part
+					if ( tIn.m_eAttrType!=pMy->m_eAttrType
+						|| tIn.m_tLocator.m_iBitCount!=pMy->m_tLocator.m_iBitCount
+						|| !tIn.m_tLocator.m_bDynamic )
+					{
+						pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema override mismatch (in=%s, my=%s)",
+							sphDumpAttr(tIn).cstr(), sphDumpAttr(*pMy).cstr() );
+						return false;
+					}
+				} else
+				{
+					// static; check for full match
+					if (!( tIn==*pMy ))
+					{
+						pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema mismatch (in=%s, my=%s)",
+							sphDumpAttr(tIn).cstr(), sphDumpAttr(*pMy).cstr() );
+						return false;
+					}
+				}
+#endif
+				break;
+			}
 
-	// do the expansion
-	return ExpandKeyword ( pNode, tSettings );
-}
+			case SPH_EVAL_PREFILTER:
+			case SPH_EVAL_PRESORT:
+			case SPH_EVAL_FINAL:
+			{
+				ISphExpr * pExpr = tIn.m_pExpr.Ptr();
+				if ( !pExpr )
+				{
+					pResult->m_sError.SetSprintf ( "INTERNAL ERROR: incoming-schema expression missing evaluator (stage=%d, in=%s)",
+						(int)tIn.m_eStage, sphDumpAttr(tIn).cstr() );
+					return false;
+				}
 
+				// an expression that index/searcher should compute
+				CalcItem_t tCalc;
+				tCalc.m_eType = tIn.m_eAttrType;
+				tCalc.m_tLoc = tIn.m_tLocator;
+				tCalc.m_pExpr = pExpr;
+				PoolPtrs_t tMva;
+				tMva.m_pMva = pMvaPool;
+				tMva.m_bArenaProhibit = bArenaProhibit;
+				tCalc.m_pExpr->Command ( SPH_EXPR_SET_MVA_POOL, &tMva );
 
-// transform the "one two three"/1 quorum into one|two|three (~40% faster)
-static void TransformQuorum ( XQNode_t ** ppNode )
-{
-	XQNode_t *& pNode = *ppNode;
+				switch ( tIn.m_eStage )
+				{
+					case SPH_EVAL_PREFILTER:	m_dCalcFilter.Add ( tCalc ); break;
+					case SPH_EVAL_PRESORT:		m_dCalcSort.Add ( tCalc ); break;
+					case SPH_EVAL_FINAL:		m_dCalcFinal.Add ( tCalc ); break;
 
-	// recurse non-quorum nodes
-	if ( pNode->GetOp()!=SPH_QUERY_QUORUM )
-	{
-		ARRAY_FOREACH ( i, pNode->m_dChildren )
-			TransformQuorum ( &pNode->m_dChildren[i] );
-		return;
-	}
+					default:					break;
+				}
+				break;
+			}
 
-	// skip quorums with thresholds other than 1
-	if ( pNode->m_iOpArg!=1 )
-		return;
+			case SPH_EVAL_SORTER:
+				// sorter tells it will compute itself; so just skip it
+			case SPH_EVAL_POSTLIMIT:
+				break;
 
-	// transform quorums with a threshold of 1 only
-	assert ( pNode->GetOp()==SPH_QUERY_QUORUM && pNode->m_dChildren.GetLength()==0 );
-	CSphVector<XQNode_t*> dArgs;
-	ARRAY_FOREACH ( i, pNode->m_dWords )
-	{
-		XQNode_t * pAnd = new XQNode_t ( pNode->m_dSpec );
-		pAnd->m_dWords.Add ( pNode->m_dWords[i] );
-		dArgs.Add ( pAnd );
+			default:
+				pResult->m_sError.SetSprintf ( "INTERNAL ERROR: unhandled eval stage=%d", (int)tIn.m_eStage );
+				return false;
+		}
 	}
-	pNode->m_dWords.Reset();
-	pNode->SetOp ( SPH_QUERY_OR, dArgs );
+
+	// ok, we can emit matches in this schema (incoming for sorter, outgoing for index/searcher)
+	return true;
 }
 
 
-struct BinaryNode_t
+bool CSphIndex_VLN::IsStarDict () const
 {
-	int m_iLo;
-	int m_iHi;
-};
+	return (
+		( m_uVersion>=7 && ( m_tSettings.m_iMinPrefixLen>0 || m_tSettings.m_iMinInfixLen>0 ) ) || // v.7 added mangling to infixes
+		( m_uVersion==6 && ( m_tSettings.m_iMinPrefixLen>0 ) ) ); // v.6 added mangling to prefixes
+}
 
-static void BuildExpandedTree ( const XQKeyword_t & tRootWord, ISphWordlist::Args_t & dWordSrc, XQNode_t * pRoot )
+
+CSphDict * CSphIndex_VLN::SetupStarDict ( CSphScopedPtr<CSphDict> & tContainer, CSphDict * pPrevDict ) const
 {
-	assert ( dWordSrc.m_dExpanded.GetLength() );
-	pRoot->m_dWords.Reset();
+	// spawn wrapper, and put it in the box
+	// wrapper type depends on version; v.8 introduced new mangling rules
+	if ( !IsStarDict() )
+		return pPrevDict;
+	if ( m_uVersion>=8 )
+		tContainer = new CSphDictStarV8 ( pPrevDict, m_tSettings.m_iMinPrefixLen>0, m_tSettings.m_iMinInfixLen>0 );
+	else
+		tContainer = new CSphDictStar ( pPrevDict );
 
-	// build a binary tree from all the other expansions
-	CSphVector<BinaryNode_t> dNodes;
-	dNodes.Reserve ( dWordSrc.m_dExpanded.GetLength() );
+	// FIXME? might wanna verify somehow that the tokenizer has '*' as a character
+	return tContainer.Ptr();
+}
 
-	XQNode_t * pCur = pRoot;
 
-	dNodes.Add();
-	dNodes.Last().m_iLo = 0;
-	dNodes.Last().m_iHi = ( dWordSrc.m_dExpanded.GetLength()-1 );
+CSphDict * CSphIndex_VLN::SetupExactDict ( CSphScopedPtr<CSphDict> & tContainer, CSphDict * pPrevDict ) const
+{
+	if ( m_uVersion<12 || !m_tSettings.m_bIndexExactWords )
+		return pPrevDict;
 
-	while ( dNodes.GetLength() )
-	{
-		BinaryNode_t tNode = dNodes.Pop();
-		if ( tNode.m_iHi<tNode.m_iLo )
-		{
-			pCur = pCur->m_pParent;
-			continue;
-		}
+	tContainer = new CSphDictExact ( pPrevDict );
+	return tContainer.Ptr();
+}
 
-		int iMid = ( tNode.m_iLo+tNode.m_iHi ) / 2;
-		dNodes.Add ();
-		dNodes.Last().m_iLo = tNode.m_iLo;
-		dNodes.Last().m_iHi = iMid-1;
-		dNodes.Add ();
-		dNodes.Last().m_iLo = iMid+1;
-		dNodes.Last().m_iHi = tNode.m_iHi;
 
-		if ( pCur->m_dWords.GetLength() )
-		{
-			assert ( pCur->m_dWords.GetLength()==1 );
-			XQNode_t * pTerm = CloneKeyword ( pRoot );
-			Swap ( pTerm->m_dWords, pCur->m_dWords );
-			pCur->m_dChildren.Add ( pTerm );
-			pTerm->m_pParent = pCur;
-		}
+bool CSphIndex_VLN::GetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords,
+	const char * szQuery, const GetKeywordsSettings_t & tSettings, CSphString * pError ) const
+{
+	WITH_QWORD ( this, false, Qword, return DoGetKeywords<Qword> ( dKeywords, szQuery, tSettings, false, pError ) );
+	return false;
+}
 
-		XQNode_t * pChild = CloneKeyword ( pRoot );
-		pChild->m_dWords.Add ( tRootWord );
-		pChild->m_dWords.Last().m_sWord = dWordSrc.GetWordExpanded ( iMid );
-		pChild->m_dWords.Last().m_bExpanded = true;
-		pChild->m_bNotWeighted = pRoot->m_bNotWeighted;
+void CSphIndex_VLN::GetSuggest ( const SuggestArgs_t & tArgs, SuggestResult_t & tRes ) const
+{
+	if ( m_tWordlist.m_tBuf.IsEmpty() || !m_tWordlist.m_dCheckpoints.GetLength() )
+		return;
 
-		pChild->m_pParent = pCur;
-		pCur->m_dChildren.Add ( pChild );
-		pCur->SetOp ( SPH_QUERY_OR );
+	tRes.m_bHasExactDict = m_tSettings.m_bIndexExactWords;
 
-		pCur = pChild;
+	// keywords FST walks levenshtein automaton instead of trigram filtered dictionary scan
+	if ( !m_tWordlist.m_tFst.IsEmpty() )
+	{
+		m_tWordlist.GetFuzzyWords ( tArgs, tRes );
+		return;
 	}
+
+	assert ( !tRes.m_pWordReader );
+	tRes.m_pWordReader = new KeywordsBlockReader_c ( m_tWordlist.m_tBuf.GetWritePtr(), m_tWordlist.m_bHaveSkips );
+
+	sphGetSuggest ( &m_tWordlist, m_tWordlist.m_iInfixCodepointBytes, tArgs, tRes );
+
+	KeywordsBlockReader_c * pReader = (KeywordsBlockReader_c *)tRes.m_pWordReader;
+	SafeDelete ( pReader );
+	tRes.m_pWordReader = NULL;
 }
 
 
-/// do wildcard expansion for keywords dictionary
-/// (including prefix and infix expansion)
-XQNode_t * sphExpandXQNode ( XQNode_t * pNode, ExpansionContext_t & tCtx )
+DWORD sphParseMorphAot ( const char * sMorphology )
 {
-	assert ( pNode );
-	assert ( tCtx.m_pResult );
+	if ( !sMorphology || !*sMorphology )
+		return 0;
 
-	// process children for composite nodes
-	if ( pNode->m_dChildren.GetLength() )
-	{
-		ARRAY_FOREACH ( i, pNode->m_dChildren )
-		{
-			pNode->m_dChildren[i] = sphExpandXQNode ( pNode->m_dChildren[i], tCtx );
-			pNode->m_dChildren[i]->m_pParent = pNode;
-		}
-		return pNode;
-	}
+	CSphVector<CSphString> dMorphs;
+	sphSplit ( dMorphs, sMorphology );
 
-	// if that's a phrase/proximity node, create a very special, magic phrase/proximity node
-	if ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM )
+	DWORD uAotFilterMask = 0;
+	for ( int j=0; j<AOT_LENGTH; ++j )
 	{
-		assert ( pNode->m_dWords.GetLength()>1 );
-		ARRAY_FOREACH ( i, pNode->m_dWords )
+		char buf_all[20];
+		sprintf ( buf_all, "lemmatize_%s_all", AOT_LANGUAGES[j] ); // NOLINT
+		ARRAY_FOREACH ( i, dMorphs )
 		{
-			XQNode_t * pWord = new XQNode_t ( pNode->m_dSpec );
-			pWord->m_dWords.Add ( pNode->m_dWords[i] );
-			pNode->m_dChildren.Add ( sphExpandXQNode ( pWord, tCtx ) );
-			pNode->m_dChildren.Last()->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
-			pNode->m_dChildren.Last()->m_pParent = pNode;
-
-			// tricky part
-			// current node may have field/zone limits attached
-			// normally those get pushed down during query parsing
-			// but here we create nodes manually and have to push down limits too
-			pWord->CopySpecs ( pNode );
+			if ( dMorphs[i]==buf_all )
+			{
+				uAotFilterMask |= (1UL) << j;
+				break;
+			}
 		}
-		pNode->m_dWords.Reset();
-		pNode->m_bVirtuallyPlain = true;
-		return pNode;
 	}
 
-	// skip empty plain nodes
-	if ( pNode->m_dWords.GetLength()<=0 )
-		return pNode;
+	return uAotFilterMask;
+}
 
-	// process keywords for plain nodes
-	assert ( pNode->m_dChildren.GetLength()==0 );
-	assert ( pNode->m_dWords.GetLength()==1 );
 
-	// check the wildcards
-	const char * sFull = pNode->m_dWords[0].m_sWord.cstr();
+GetKeywordsSettings_t::GetKeywordsSettings_t ()
+{
+	m_bStats = true;
+	m_bFoldLemmas = false;
+	m_bFoldBlended = false;
+	m_bFoldWildcards = false;
+	m_iExpansionLimit = 0;
+}
 
-	// no wildcards, or just wildcards? do not expand
-	if ( !sphHasExpandableWildcards ( sFull ) )
-		return pNode;
 
-	bool bUseTermMerge = ( tCtx.m_bMergeSingles && pNode->m_dSpec.m_dZones.GetLength()==0 );
-	ISphWordlist::Args_t tWordlist ( bUseTermMerge, tCtx.m_iExpansionLimit, tCtx.m_bHasMorphology, tCtx.m_eHitless, tCtx.m_pIndexData );
+ISphQueryFilter::ISphQueryFilter ()
+{
+	m_pTokenizer = NULL;
+	m_pDict = NULL;
+	m_pSettings = NULL;
+}
 
-	if ( !sphExpandGetWords ( sFull, tCtx, tWordlist ) )
-	{
-		tCtx.m_pResult->m_sWarning.SetSprintf ( "Query word length is less than min %s length. word: '%s' ", ( tCtx.m_iMinInfixLen>0 ? "infix" : "prefix" ), sFull );
-		return pNode;
-	}
 
-	// no real expansions?
-	// mark source word as expanded to prevent warning on terms mismatch in statistics
-	if ( !tWordlist.m_dExpanded.GetLength() && !tWordlist.m_pPayload )
-	{
-		tCtx.m_pResult->AddStat ( pNode->m_dWords.Begin()->m_sWord, 0, 0 );
-		pNode->m_dWords.Begin()->m_bExpanded = true;
-		return pNode;
-	}
+ISphQueryFilter::~ISphQueryFilter ()
+{
+}
 
-	// copy the original word (iirc it might get overwritten),
-	const XQKeyword_t tRootWord = pNode->m_dWords[0];
-	tCtx.m_pResult->AddStat ( tRootWord.m_sWord, tWordlist.m_iTotalDocs, tWordlist.m_iTotalHits );
 
-	// and build a binary tree of all the expansions
-	if ( tWordlist.m_dExpanded.GetLength() )
-	{
-		BuildExpandedTree ( tRootWord, tWordlist, pNode );
-	}
+void ISphQueryFilter::GetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords, const ExpansionContext_t & tCtx )
+{
+	assert ( m_pTokenizer && m_pDict && m_pSettings );
 
-	if ( tWordlist.m_pPayload )
+	BYTE sTokenized[3*SPH_MAX_WORD_LEN+4];
+	BYTE * sWord;
+	int iQpos = 1;
+	CSphVector<int> dQposWildcards;
+
+	// FIXME!!! got rid of duplicated term stat and qword setup
+	while ( ( sWord = m_pTokenizer->GetToken() )!=NULL )
 	{
-		ISphSubstringPayload * pPayload = tWordlist.m_pPayload;
-		tWordlist.m_pPayload = NULL;
-		tCtx.m_pPayloads->Add ( pPayload );
+		const BYTE * sMultiform = m_pTokenizer->GetTokenizedMultiform();
+		strncpy ( (char *)sTokenized, sMultiform ? (const char*)sMultiform : (const char*)sWord, sizeof(sTokenized) );
 
-		if ( pNode->m_dWords.GetLength() )
-		{
-			// all expanded fit to single payload
-			pNode->m_dWords.Begin()->m_bExpanded = true;
-			pNode->m_dWords.Begin()->m_pPayload = pPayload;
-		} else
+		if ( ( !m_tFoldSettings.m_bFoldWildcards || m_tFoldSettings.m_bStats ) && sphHasExpandableWildcards ( (const char *)sWord ) )
 		{
-			// payload added to expanded binary tree
-			assert ( pNode->GetOp()==SPH_QUERY_OR );
-			assert ( pNode->m_dChildren.GetLength() );
-
-			XQNode_t * pSubstringNode = new XQNode_t ( pNode->m_dSpec );
-			pSubstringNode->SetOp ( SPH_QUERY_OR );
+			dQposWildcards.Add ( iQpos );
 
-			XQKeyword_t tSubstringWord = tRootWord;
-			tSubstringWord.m_bExpanded = true;
-			tSubstringWord.m_pPayload = pPayload;
-			pSubstringNode->m_dWords.Add ( tSubstringWord );
+			ISphWordlist::Args_t tWordlist ( false, tCtx.m_iExpansionLimit, tCtx.m_bHasMorphology, tCtx.m_eHitless, tCtx.m_pIndexData );
+			bool bExpanded = sphExpandGetWords ( (const char *)sWord, tCtx, tWordlist );
 
-			pNode->m_dChildren.Add ( pSubstringNode );
-			pSubstringNode->m_pParent = pNode;
-		}
-	}
+			int iDocs = 0;
+			int iHits = 0;
 
-	return pNode;
-}
+			// might fold wildcards but still want to sum up stats
+			if ( m_tFoldSettings.m_bFoldWildcards && m_tFoldSettings.m_bStats )
+			{
+				ARRAY_FOREACH ( i, tWordlist.m_dExpanded )
+				{
+					iDocs += tWordlist.m_dExpanded[i].m_iDocs;
+					iHits += tWordlist.m_dExpanded[i].m_iHits;
+				}
+				bExpanded = false;
+			} else
+			{
+				ARRAY_FOREACH ( i, tWordlist.m_dExpanded )
+				{
+					CSphKeywordInfo & tInfo = dKeywords.Add();
+					tInfo.m_sTokenized = (const char *)sWord;
+					tInfo.m_sNormalized = tWordlist.GetWordExpanded ( i );
+					tInfo.m_iDocs = tWordlist.m_dExpanded[i].m_iDocs;
+					tInfo.m_iHits = tWordlist.m_dExpanded[i].m_iHits;
+					tInfo.m_iQpos = iQpos;
+				}
+			}
 
+			if ( !bExpanded || !tWordlist.m_dExpanded.GetLength() )
+			{
+				CSphKeywordInfo & tInfo = dKeywords.Add ();
+				tInfo.m_sTokenized = (const char *)sWord;
+				tInfo.m_sNormalized = (const char *)sWord;
+				tInfo.m_iDocs = iDocs;
+				tInfo.m_iHits = iHits;
+				tInfo.m_iQpos = iQpos;
+			}
+		} else
+		{
+			AddKeywordStats ( sWord, sTokenized, iQpos, dKeywords );
+		}
 
-bool sphHasExpandableWildcards ( const char * sWord )
-{
-	const char * pCur = sWord;
-	int iWilds = 0;
+		// FIXME!!! handle consecutive blended wo blended parts
+		bool bBlended = m_pTokenizer->TokenIsBlended();
 
-	for ( ; *pCur; pCur++ )
-		if ( sphIsWild ( *pCur ) )
-			iWilds++;
+		if ( bBlended )
+		{
+			if ( m_tFoldSettings.m_bFoldBlended )
+				iQpos += m_pTokenizer->SkipBlended();
+		} else
+		{
+			iQpos++;
+		}
+	}
 
-	int iLen = pCur - sWord;
+	if ( !m_pSettings->m_uAotFilterMask )
+		return;
 
-	return ( iWilds && iWilds<iLen );
-}
+	XQLimitSpec_t tSpec;
+	BYTE sTmp[3*SPH_MAX_WORD_LEN+4];
+	BYTE sTmp2[3*SPH_MAX_WORD_LEN+4];
+	CSphVector<XQNode_t *> dChildren ( 64 );
 
-bool sphExpandGetWords ( const char * sWord, const ExpansionContext_t & tCtx, ISphWordlist::Args_t & tWordlist )
-{
-	if ( !sphIsWild ( *sWord ) || tCtx.m_iMinInfixLen==0 )
+	CSphBitvec tSkipTransform;
+	if ( dQposWildcards.GetLength () )
 	{
-		// do prefix expansion
-		// remove exact form modifier, if any
-		const char * sPrefix = sWord;
-		if ( *sPrefix=='=' )
-			sPrefix++;
-
-		// skip leading wildcards
-		// (in case we got here on non-infixed index path)
-		const char * sWildcard = sPrefix;
-		while ( sphIsWild ( *sPrefix ) )
-		{
-			sPrefix++;
-			sWildcard++;
-		}
-
-		// compute non-wildcard prefix length
-		int iPrefix = 0;
-		for ( const char * s = sPrefix; *s && !sphIsWild ( *s ); s++ )
-			iPrefix++;
+		tSkipTransform.Init ( iQpos+1 );
+		ARRAY_FOREACH ( i, dQposWildcards )
+			tSkipTransform.BitSet ( dQposWildcards[i] );
+	}
 
-		// do not expand prefixes under min length
-		int iMinLen = Max ( tCtx.m_iMinPrefixLen, tCtx.m_iMinInfixLen );
-		if ( iPrefix<iMinLen )
-			return false;
+	int iTokenizedTotal = dKeywords.GetLength();
+	for ( int iTokenized=0; iTokenized<iTokenizedTotal; iTokenized++ )
+	{
+		int iQpos = dKeywords[iTokenized].m_iQpos;
 
-		// prefix expansion should work on nonstemmed words only
-		char sFixed[MAX_KEYWORD_BYTES];
-		if ( tCtx.m_bHasMorphology )
-		{
-			sFixed[0] = MAGIC_WORD_HEAD_NONSTEMMED;
-			memcpy ( sFixed+1, sPrefix, iPrefix );
-			sPrefix = sFixed;
-			iPrefix++;
-		}
+		// do not transform expanded wild-cards
+		if ( tSkipTransform.GetSize() && tSkipTransform.BitGet ( iQpos ) )
+			continue;
 
-		tCtx.m_pWordlist->GetPrefixedWords ( sPrefix, iPrefix, sWildcard, tWordlist );
+		// MUST copy as Dict::GetWordID changes word and might add symbols
+		strncpy ( (char *)sTokenized, dKeywords[iTokenized].m_sNormalized.scstr(), sizeof(sTokenized) );
+		int iPreAotCount = dKeywords.GetLength();
 
-	} else
-	{
-		// do infix expansion
-		assert ( sphIsWild ( *sWord ) );
-		assert ( tCtx.m_iMinInfixLen>0 );
+		XQNode_t tAotNode ( tSpec );
+		tAotNode.m_dWords.Resize ( 1 );
+		tAotNode.m_dWords.Begin()->m_sWord = (char *)sTokenized;
+		TransformAotFilter ( &tAotNode, m_pDict->GetWordforms(), *m_pSettings );
 
-		// find the longest substring of non-wildcards
-		const char * sMaxInfix = NULL;
-		int iMaxInfix = 0;
-		int iCur = 0;
+		dChildren.Resize ( 0 );
+		dChildren.Add ( &tAotNode );
 
-		for ( const char * s = sWord; *s; s++ )
+		// recursion unfolded
+		ARRAY_FOREACH ( iChild, dChildren )
 		{
-			if ( sphIsWild ( *s ) )
-			{
-				iCur = 0;
-			} else if ( ++iCur > iMaxInfix )
+			// process all words at node
+			ARRAY_FOREACH ( iAotKeyword, dChildren[iChild]->m_dWords )
 			{
-				sMaxInfix = s-iCur+1;
-				iMaxInfix = iCur;
+				// MUST copy as Dict::GetWordID changes word and might add symbols
+				strncpy ( (char *)sTmp, dChildren[iChild]->m_dWords[iAotKeyword].m_sWord.scstr(), sizeof(sTmp) );
+				// prevent use-after-free-bug due to vector grow: AddKeywordsStats() calls dKeywords.Add()
+				strncpy ( (char *)sTmp2, dKeywords[iTokenized].m_sTokenized.scstr (), sizeof ( sTmp2 ) );
+				AddKeywordStats ( sTmp, sTmp2, iQpos, dKeywords );
 			}
-		}
-
-		// do not expand infixes under min_infix_len
-		if ( iMaxInfix < tCtx.m_iMinInfixLen )
-			return false;
 
-		// ignore heading star
-		tCtx.m_pWordlist->GetInfixedWords ( sMaxInfix, iMaxInfix, sWord, tWordlist );
-	}
+			// push all child nodes at node to process list
+			const XQNode_t * pChild = dChildren[iChild];
+			ARRAY_FOREACH ( iRec, pChild->m_dChildren )
+				dChildren.Add ( pChild->m_dChildren[iRec] );
+		}
 
-	return true;
-}
+		bool bGotLemmas = ( iPreAotCount!=dKeywords.GetLength() );
 
-ExpansionContext_t::ExpansionContext_t()
-	: m_pWordlist ( NULL )
-	, m_pBuf ( NULL )
-	, m_pResult ( NULL )
-	, m_iMinPrefixLen ( 0 )
-	, m_iMinInfixLen ( 0 )
-	, m_iExpansionLimit ( 0 )
-	, m_bHasMorphology ( false )
-	, m_bMergeSingles ( false )
-	, m_pPayloads ( NULL )
-	, m_eHitless ( SPH_HITLESS_NONE )
-	, m_pIndexData ( NULL )
-{}
-
-
-XQNode_t * CSphIndex_VLN::ExpandPrefix ( XQNode_t * pNode, CSphQueryResultMeta * pResult, CSphScopedPayload * pPayloads, DWORD uQueryDebugFlags ) const
-{
-	if ( !pNode || !m_pDict->GetSettings().m_bWordDict || ( m_tSettings.m_iMinPrefixLen<=0 && m_tSettings.m_iMinInfixLen<=0 ) )
-		return pNode;
-
-	assert ( m_bPassedAlloc );
-	assert ( !m_tWordlist.m_tBuf.IsEmpty() );
-
-	ExpansionContext_t tCtx;
-	tCtx.m_pWordlist = &m_tWordlist;
-	tCtx.m_pResult = pResult;
-	tCtx.m_iMinPrefixLen = m_tSettings.m_iMinPrefixLen;
-	tCtx.m_iMinInfixLen = m_tSettings.m_iMinInfixLen;
-	tCtx.m_iExpansionLimit = m_iExpansionLimit;
-	tCtx.m_bHasMorphology = m_pDict->HasMorphology();
-	tCtx.m_bMergeSingles = ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_INLINE && ( uQueryDebugFlags & QUERY_DEBUG_NO_PAYLOAD )==0 );
-	tCtx.m_pPayloads = pPayloads;
-	tCtx.m_eHitless = m_tSettings.m_eHitless;
-
-	pNode = sphExpandXQNode ( pNode, tCtx );
-	pNode->Check ( true );
-
-	return pNode;
-}
-
-
-// transform the (A B) NEAR C into A NEAR B NEAR C
-static void TransformNear ( XQNode_t ** ppNode )
-{
-	XQNode_t *& pNode = *ppNode;
-	if ( pNode->GetOp()==SPH_QUERY_NEAR )
-	{
-		assert ( pNode->m_dWords.GetLength()==0 );
-		CSphVector<XQNode_t*> dArgs;
-		int iStartFrom;
-
-		// transform all (A B C) NEAR D into A NEAR B NEAR C NEAR D
-		do
+		// remove (replace) original word in case of AOT taken place
+		if ( bGotLemmas )
 		{
-			dArgs.Reset();
-			iStartFrom = 0;
-			ARRAY_FOREACH ( i, pNode->m_dChildren )
+			if ( !m_tFoldSettings.m_bFoldLemmas )
 			{
-				XQNode_t * pChild = pNode->m_dChildren[i]; ///< shortcut
-				if ( pChild->GetOp()==SPH_QUERY_AND && pChild->m_dChildren.GetLength()>0 )
+				::Swap ( dKeywords[iTokenized], dKeywords.Last() );
+				dKeywords.Resize ( dKeywords.GetLength()-1 );
+			} else
+			{
+				int iDocs = 0;
+				int iHits = 0;
+				if ( m_tFoldSettings.m_bStats )
 				{
-					ARRAY_FOREACH ( j, pChild->m_dChildren )
+					for ( int i=iPreAotCount; i<dKeywords.GetLength(); i++ )
 					{
-						if ( j==0 && iStartFrom==0 )
-						{
-							// we will remove the node anyway, so just replace it with 1-st child instead
-							pNode->m_dChildren[i] = pChild->m_dChildren[j];
-							pNode->m_dChildren[i]->m_pParent = pNode;
-							iStartFrom = i+1;
-						} else
-						{
-							dArgs.Add ( pChild->m_dChildren[j] );
-						}
+						iDocs += dKeywords[i].m_iDocs;
+						iHits += dKeywords[i].m_iHits;
 					}
-					pChild->m_dChildren.Reset();
-					SafeDelete ( pChild );
-				} else if ( iStartFrom!=0 )
-				{
-					dArgs.Add ( pChild );
-				}
-			}
-
-			if ( iStartFrom!=0 )
-			{
-				pNode->m_dChildren.Resize ( iStartFrom + dArgs.GetLength() );
-				ARRAY_FOREACH ( i, dArgs )
-				{
-					pNode->m_dChildren [ i + iStartFrom ] = dArgs[i];
-					pNode->m_dChildren [ i + iStartFrom ]->m_pParent = pNode;
 				}
+				::Swap ( dKeywords[iTokenized], dKeywords[iPreAotCount] );
+				dKeywords.Resize ( iPreAotCount );
+				dKeywords[iTokenized].m_iDocs = iDocs;
+				dKeywords[iTokenized].m_iHits = iHits;
 			}
-		} while ( iStartFrom!=0 );
+		}
 	}
 
-	ARRAY_FOREACH ( i, pNode->m_dChildren )
-		TransformNear ( &pNode->m_dChildren[i] );
+	// sort by qpos
+	if ( dKeywords.GetLength()!=iTokenizedTotal )
+		sphSort ( dKeywords.Begin(), dKeywords.GetLength(), bind ( &CSphKeywordInfo::m_iQpos ) );
 }
 
 
-/// tag excluded keywords (rvals to operator NOT)
-static void TagExcluded ( XQNode_t * pNode, bool bNot )
+struct CSphPlainQueryFilter : public ISphQueryFilter
 {
-	if ( pNode->GetOp()==SPH_QUERY_ANDNOT )
-	{
-		assert ( pNode->m_dChildren.GetLength()==2 );
-		assert ( pNode->m_dWords.GetLength()==0 );
-		TagExcluded ( pNode->m_dChildren[0], bNot );
-		TagExcluded ( pNode->m_dChildren[1], !bNot );
+	const ISphQwordSetup *	m_pTermSetup;
+	ISphQword *				m_pQueryWord;
 
-	} else if ( pNode->m_dChildren.GetLength() )
-	{
-		// FIXME? check if this works okay with "virtually plain" stuff?
-		ARRAY_FOREACH ( i, pNode->m_dChildren )
-			TagExcluded ( pNode->m_dChildren[i], bNot );
-	} else
+	virtual void AddKeywordStats ( BYTE * sWord, const BYTE * sTokenized, int iQpos, CSphVector <CSphKeywordInfo> & dKeywords )
 	{
-		// tricky bit
-		// no assert on length here and that is intended
-		// we have fully empty nodes (0 children, 0 words) sometimes!
-		ARRAY_FOREACH ( i, pNode->m_dWords )
-			pNode->m_dWords[i].m_bExcluded = bNot;
+		assert ( !m_tFoldSettings.m_bStats || ( m_pTermSetup && m_pQueryWord ) );
+
+		SphWordID_t iWord = m_pDict->GetWordID ( sWord );
+		if ( !iWord )
+			return;
+
+		if ( m_tFoldSettings.m_bStats )
+		{
+			m_pQueryWord->Reset ();
+			m_pQueryWord->m_sWord = (const char*)sWord;
+			m_pQueryWord->m_sDictWord = (const char*)sWord;
+			m_pQueryWord->m_uWordID = iWord;
+			m_pTermSetup->QwordSetup ( m_pQueryWord );
+		}
+
+		CSphKeywordInfo & tInfo = dKeywords.Add();
+		tInfo.m_sTokenized = (const char *)sTokenized;
+		tInfo.m_sNormalized = (const char*)sWord;
+		tInfo.m_iDocs = m_tFoldSettings.m_bStats ? m_pQueryWord->m_iDocs : 0;
+		tInfo.m_iHits = m_tFoldSettings.m_bStats ? m_pQueryWord->m_iHits : 0;
+		tInfo.m_iQpos = iQpos;
+
+		if ( tInfo.m_sNormalized.cstr()[0]==MAGIC_WORD_HEAD_NONSTEMMED )
+			*(char *)tInfo.m_sNormalized.cstr() = '=';
 	}
-}
+};
 
 
-/// optimize phrase queries if we have bigrams
-static void TransformBigrams ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
+template < class Qword >
+bool CSphIndex_VLN::DoGetKeywords ( CSphVector <CSphKeywordInfo> & dKeywords,
+	const char * szQuery, const GetKeywordsSettings_t & tSettings, bool bFillOnly, CSphString * pError ) const
 {
-	assert ( tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE );
-	assert ( tSettings.m_eBigramIndex==SPH_BIGRAM_ALL || tSettings.m_dBigramWords.GetLength() );
+	if ( !bFillOnly )
+		dKeywords.Resize ( 0 );
 
-	if ( pNode->GetOp()!=SPH_QUERY_PHRASE )
+	if ( !m_bPassedAlloc )
 	{
-		ARRAY_FOREACH ( i, pNode->m_dChildren )
-			TransformBigrams ( pNode->m_dChildren[i], tSettings );
-		return;
+		if ( pError )
+			*pError = "index not preread";
+		return false;
 	}
 
-	CSphBitvec bmRemove;
-	bmRemove.Init ( pNode->m_dWords.GetLength() );
+	// short-cut if no query or keywords to fill
+	if ( ( bFillOnly && !dKeywords.GetLength() ) || ( !bFillOnly && ( !szQuery || !szQuery[0] ) ) )
+		return true;
 
-	for ( int i=0; i<pNode->m_dWords.GetLength()-1; i++ )
-	{
-		// check whether this pair was indexed
-		bool bBigram = false;
-		switch ( tSettings.m_eBigramIndex )
-		{
-			case SPH_BIGRAM_NONE:
-				break;
-			case SPH_BIGRAM_ALL:
-				bBigram = true;
-				break;
-			case SPH_BIGRAM_FIRSTFREQ:
-				bBigram = tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i].m_sWord )!=NULL;
-				break;
-			case SPH_BIGRAM_BOTHFREQ:
-				bBigram =
-					( tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i].m_sWord )!=NULL ) &&
-					( tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i+1].m_sWord )!=NULL );
-				break;
-		}
-		if ( !bBigram )
-			continue;
+	// TODO: in case of bFillOnly skip tokenizer cloning and setup
+	CSphScopedPtr<ISphTokenizer> pTokenizer ( m_pTokenizer->Clone ( SPH_CLONE_INDEX ) ); // avoid race
+	pTokenizer->EnableTokenizedMultiformTracking ();
 
-		// replace the pair with a bigram keyword
-		// FIXME!!! set phrase weight for this "word" here
-		pNode->m_dWords[i].m_sWord.SetSprintf ( "%s%c%s",
-			pNode->m_dWords[i].m_sWord.cstr(),
-			MAGIC_WORD_BIGRAM,
-			pNode->m_dWords[i+1].m_sWord.cstr() );
+	// need to support '*' and '=' but not the other specials
+	// so m_pQueryTokenizer does not work for us, gotta clone and setup one manually
+	if ( IsStarDict() )
+		pTokenizer->AddPlainChar ( '*' );
+	if ( m_tSettings.m_bIndexExactWords )
+		pTokenizer->AddPlainChar ( '=' );
 
-		// only mark for removal now, we will sweep later
-		// so that [a b c] would convert to ["a b" "b c"], not just ["a b" c]
-		bmRemove.BitClear ( i );
-		bmRemove.BitSet ( i+1 );
-	}
+	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
+	CSphDict * pDictBase = m_pDict;
+	if ( pDictBase->HasState() )
+		tDictCloned = pDictBase = pDictBase->Clone();
 
-	// remove marked words
-	int iOut = 0;
-	ARRAY_FOREACH ( i, pNode->m_dWords )
-		if ( !bmRemove.BitGet(i) )
-			pNode->m_dWords[iOut++] = pNode->m_dWords[i];
-	pNode->m_dWords.Resize ( iOut );
+	CSphScopedPtr<CSphDict> tDict ( NULL );
+	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
 
-	// fixup nodes that are not real phrases any more
-	if ( pNode->m_dWords.GetLength()==1 )
-		pNode->SetOp ( SPH_QUERY_AND );
-}
+	CSphScopedPtr<CSphDict> tDict2 ( NULL );
+	pDict = SetupExactDict ( tDict2, pDict );
 
+	CSphVector<BYTE> dFiltered;
+	CSphScopedPtr<ISphFieldFilter> pFieldFilter ( NULL );
+	const BYTE * sModifiedQuery = (const BYTE *)szQuery;
+	if ( m_pFieldFilter && szQuery )
+	{
+		pFieldFilter = m_pFieldFilter->Clone();
+		if ( pFieldFilter.Ptr() && pFieldFilter->Apply ( sModifiedQuery, strlen ( (char*)sModifiedQuery ), dFiltered, true ) )
+			sModifiedQuery = dFiltered.Begin();
+	}
 
-/// create a node from a set of lemmas
-/// WARNING, tKeyword might or might not be pointing to pNode->m_dWords[0]
-/// Called from the daemon side (searchd) in time of query
-static void TransformAotFilterKeyword ( XQNode_t * pNode, const XQKeyword_t & tKeyword, const CSphWordforms * pWordforms, const CSphIndexSettings & tSettings )
-{
-	assert ( pNode->m_dWords.GetLength()<=1 );
-	assert ( pNode->m_dChildren.GetLength()==0 );
+	// FIXME!!! missed bigram, add flags to fold blended parts, show expanded terms
 
-	XQNode_t * pExact = NULL;
-	if ( pWordforms )
-	{
-		// do a copy, because patching in place is not an option
-		// short => longlonglong wordform mapping would crash
-		// OPTIMIZE? forms that are not found will (?) get looked up again in the dict
-		char sBuf [ MAX_KEYWORD_BYTES ];
-		strncpy ( sBuf, tKeyword.m_sWord.cstr(), sizeof(sBuf) );
-		if ( pWordforms->ToNormalForm ( (BYTE*)sBuf, true, false ) )
-		{
-			if ( !pNode->m_dWords.GetLength() )
-				pNode->m_dWords.Add ( tKeyword );
-			pNode->m_dWords[0].m_sWord = sBuf;
-			pNode->m_dWords[0].m_bMorphed = true;
-			return;
-		}
-	}
+	// prepare for setup
+	CSphAutofile tDummy1, tDummy2;
 
-	CSphVector<CSphString> dLemmas;
-	DWORD uLangMask = tSettings.m_uAotFilterMask;
-	for ( int i=AOT_BEGIN; i<AOT_LENGTH; ++i )
-	{
-		if ( uLangMask & (1UL<<i) )
-		{
-			if ( i==AOT_RU )
-				sphAotLemmatizeRu ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr() );
-			else if ( i==AOT_DE )
-				sphAotLemmatizeDe ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr() );
-			else
-				sphAotLemmatize ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr(), i );
-		}
-	}
+	DiskIndexQwordSetup_c tTermSetup ( tDummy1, tDummy2, m_tSkiplists.GetWritePtr(), NULL );
+	tTermSetup.m_pDict = pDict;
+	tTermSetup.m_pIndex = this;
+	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
 
-	// post-morph wordforms
-	if ( pWordforms && pWordforms->m_bHavePostMorphNF )
-	{
-		char sBuf [ MAX_KEYWORD_BYTES ];
-		ARRAY_FOREACH ( i, dLemmas )
-		{
-			strncpy ( sBuf, dLemmas[i].cstr(), sizeof(sBuf) );
-			if ( pWordforms->ToNormalForm ( (BYTE*)sBuf, false, false ) )
-				dLemmas[i] = sBuf;
-		}
-	}
+	Qword tQueryWord ( false, false );
 
-	if ( dLemmas.GetLength() && tSettings.m_bIndexExactWords )
+	if ( !bFillOnly )
 	{
-		pExact = CloneKeyword ( pNode );
-		if ( !pExact->m_dWords.GetLength() )
-			pExact->m_dWords.Add ( tKeyword );
+		ExpansionContext_t tExpCtx;
+		// query defined options
+		tExpCtx.m_iExpansionLimit = ( tSettings.m_iExpansionLimit ? tSettings.m_iExpansionLimit : m_iExpansionLimit );
+		bool bExpandWildcards = ( pDict->GetSettings ().m_bWordDict && IsStarDict() && !tSettings.m_bFoldWildcards );
 
-		pExact->m_dWords[0].m_sWord.SetSprintf ( "=%s", tKeyword.m_sWord.cstr() );
-		pExact->m_pParent = pNode;
-	}
+		CSphPlainQueryFilter tAotFilter;
+		tAotFilter.m_pTokenizer = pTokenizer.Ptr();
+		tAotFilter.m_pDict = pDict;
+		tAotFilter.m_pSettings = &m_tSettings;
+		tAotFilter.m_pTermSetup = &tTermSetup;
+		tAotFilter.m_pQueryWord = &tQueryWord;
+		tAotFilter.m_tFoldSettings = tSettings;
+		tAotFilter.m_tFoldSettings.m_bFoldWildcards = !bExpandWildcards;
 
-	if ( !pExact && dLemmas.GetLength()<=1 )
-	{
-		// zero or one lemmas, update node in-place
-		if ( !pNode->m_dWords.GetLength() )
-			pNode->m_dWords.Add ( tKeyword );
-		if ( dLemmas.GetLength() )
-		{
-			pNode->m_dWords[0].m_sWord = dLemmas[0];
-			pNode->m_dWords[0].m_bMorphed = true;
-		}
+		tExpCtx.m_pWordlist = &m_tWordlist;
+		tExpCtx.m_iMinPrefixLen = m_tSettings.m_iMinPrefixLen;
+		tExpCtx.m_iMinInfixLen = m_tSettings.m_iMinInfixLen;
+		tExpCtx.m_bHasMorphology = m_pDict->HasMorphology();
+		tExpCtx.m_bMergeSingles = false;
+		tExpCtx.m_eHitless = m_tSettings.m_eHitless;
+
+		pTokenizer->SetBuffer ( sModifiedQuery, strlen ( (const char *)sModifiedQuery) );
+
+		tAotFilter.GetKeywords ( dKeywords, tExpCtx );
 	} else
 	{
-		// multiple lemmas, create an OR node
-		pNode->SetOp ( SPH_QUERY_OR );
-		ARRAY_FOREACH ( i, dLemmas )
+		BYTE sWord[MAX_KEYWORD_BYTES];
+
+		ARRAY_FOREACH ( i, dKeywords )
 		{
-			pNode->m_dChildren.Add ( new XQNode_t ( pNode->m_dSpec ) );
-			pNode->m_dChildren.Last()->m_pParent = pNode;
-			XQKeyword_t & tLemma = pNode->m_dChildren.Last()->m_dWords.Add();
-			tLemma.m_sWord = dLemmas[i];
-			tLemma.m_iAtomPos = tKeyword.m_iAtomPos;
-			tLemma.m_bFieldStart = tKeyword.m_bFieldStart;
-			tLemma.m_bFieldEnd = tKeyword.m_bFieldEnd;
-			tLemma.m_bMorphed = true;
+			CSphKeywordInfo & tInfo = dKeywords[i];
+			int iLen = tInfo.m_sTokenized.Length();
+			memcpy ( sWord, tInfo.m_sTokenized.cstr(), iLen );
+			sWord[iLen] = '\0';
+
+			SphWordID_t iWord = pDict->GetWordID ( sWord );
+			if ( iWord )
+			{
+				tQueryWord.Reset ();
+				tQueryWord.m_sWord = tInfo.m_sTokenized;
+				tQueryWord.m_sDictWord = (const char*)sWord;
+				tQueryWord.m_uWordID = iWord;
+				tTermSetup.QwordSetup ( &tQueryWord );
+
+				tInfo.m_iDocs += tQueryWord.m_iDocs;
+				tInfo.m_iHits += tQueryWord.m_iHits;
+			}
 		}
-		pNode->m_dWords.Reset();
-		if ( pExact )
-			pNode->m_dChildren.Add ( pExact );
 	}
+
+	return true;
 }
 
 
-/// AOT morph guesses transform
-/// replaces tokens with their respective morph guesses subtrees
-/// used in lemmatize_ru_all morphology processing mode that can generate multiple guesses
-/// in other modes, there is always exactly one morph guess, and the dictionary handles it
-/// Called from the daemon side (searchd)
-void TransformAotFilter ( XQNode_t * pNode, const CSphWordforms * pWordforms, const CSphIndexSettings & tSettings )
+bool CSphIndex_VLN::FillKeywords ( CSphVector <CSphKeywordInfo> & dKeywords ) const
 {
-	// case one, regular operator (and empty nodes)
-	ARRAY_FOREACH ( i, pNode->m_dChildren )
-		TransformAotFilter ( pNode->m_dChildren[i], pWordforms, tSettings );
-	if ( pNode->m_dChildren.GetLength() || pNode->m_dWords.GetLength()==0 )
-		return;
-
-	// case two, operator on a bag of words
-	// FIXME? check phrase vs expand_keywords vs lemmatize_ru_all?
-	if ( pNode->m_dWords.GetLength()
-		&& ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM ) )
-	{
-		assert ( pNode->m_dWords.GetLength() );
+	GetKeywordsSettings_t tSettings;
+	tSettings.m_bStats = true;
 
-		ARRAY_FOREACH ( i, pNode->m_dWords )
-		{
-			XQNode_t * pNew = new XQNode_t ( pNode->m_dSpec );
-			pNew->m_pParent = pNode;
-			pNew->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
-			pNode->m_dChildren.Add ( pNew );
-			TransformAotFilterKeyword ( pNew, pNode->m_dWords[i], pWordforms, tSettings );
-		}
+	WITH_QWORD ( this, false, Qword, return DoGetKeywords<Qword> ( dKeywords, NULL, tSettings, true, NULL ) );
+	return false;
+}
 
-		pNode->m_dWords.Reset();
-		pNode->m_bVirtuallyPlain = true;
-		return;
-	}
 
-	// case three, plain old single keyword
-	assert ( pNode->m_dWords.GetLength()==1 );
-	TransformAotFilterKeyword ( pNode, pNode->m_dWords[0], pWordforms, tSettings );
-}
+// fix MSVC 2005 fuckup, template DoGetKeywords() just above somehow resets forScope
+#if USE_WINDOWS
+#pragma conform(forScope,on)
+#endif
 
 
-void sphTransformExtendedQuery ( XQNode_t ** ppNode, const CSphIndexSettings & tSettings, bool bHasBooleanOptimization, const ISphKeywordsStat * pKeywords )
+static bool IsWeightColumn ( const CSphString & sAttr, const ISphSchema & tSchema )
 {
-	TransformQuorum ( ppNode );
-	( *ppNode )->Check ( true );
-	TransformNear ( ppNode );
-	( *ppNode )->Check ( true );
-	if ( tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE )
-		TransformBigrams ( *ppNode, tSettings );
-	TagExcluded ( *ppNode, false );
-	( *ppNode )->Check ( true );
+	if ( sAttr=="@weight" )
+		return true;
 
-	// boolean optimization
-	if ( bHasBooleanOptimization )
-		sphOptimizeBoolean ( ppNode, pKeywords );
+	const CSphColumnInfo * pCol = tSchema.GetAttr ( sAttr.cstr() );
+	return ( pCol && pCol->m_bWeight );
 }
 
 
-struct CmpPSortersByRandom_fn
+bool CSphQueryContext::CreateFilters ( bool bFullscan,
+	const CSphVector<CSphFilterSettings> * pdFilters, const ISphSchema & tSchema,
+	const DWORD * pMvaPool, const BYTE * pStrings, CSphString & sError, CSphString & sWarning, ESphCollation eCollation, bool bArenaProhibit,
+	const KillListVector & dKillList )
 {
-	inline bool IsLess ( const ISphMatchSorter * a, const ISphMatchSorter * b ) const
+	if ( !pdFilters && !dKillList.GetLength() )
+		return true;
+
+	if ( pdFilters )
 	{
-		assert ( a );
-		assert ( b );
-		return a->m_bRandomize < b->m_bRandomize;
-	}
-};
+		ARRAY_FOREACH ( i, (*pdFilters) )
+		{
+			const CSphFilterSettings * pFilterSettings = pdFilters->Begin() + i;
+			if ( pFilterSettings->m_sAttrName.IsEmpty() )
+				continue;
 
+			bool bWeight = IsWeightColumn ( pFilterSettings->m_sAttrName, tSchema );
 
-/// one regular query vs many sorters
-bool CSphIndex_VLN::MultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult,
-	int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
-{
-	assert ( pQuery );
-	CSphQueryProfile * pProfile = pResult->m_pProfile;
+			if ( bFullscan && bWeight )
+				continue; // @weight is not available in fullscan mode
 
-	MEMORY ( MEM_DISK_QUERY );
+			// bind user variable local to that daemon
+			CSphFilterSettings tUservar;
+			if ( pFilterSettings->m_eType==SPH_FILTER_USERVAR )
+			{
+				const CSphString * sVar = pFilterSettings->m_dStrings.GetLength()==1 ? pFilterSettings->m_dStrings.Begin() : NULL;
+				if ( !g_pUservarsHook || !sVar )
+				{
+					sError = "no global variables found";
+					return false;
+				}
 
-	// to avoid the checking of a ppSorters's element for NULL on every next step, just filter out all nulls right here
-	CSphVector<ISphMatchSorter*> dSorters;
-	dSorters.Reserve ( iSorters );
-	for ( int i=0; i<iSorters; i++ )
-		if ( ppSorters[i] )
-			dSorters.Add ( ppSorters[i] );
+				const UservarIntSet_c * pUservar = g_pUservarsHook ( *sVar );
+				if ( !pUservar )
+				{
+					sError.SetSprintf ( "undefined global variable '%s'", sVar->cstr() );
+					return false;
+				}
 
-	iSorters = dSorters.GetLength();
+				m_dUserVals.Add ( pUservar );
+				tUservar = *pFilterSettings;
+				tUservar.m_eType = SPH_FILTER_VALUES;
+				tUservar.SetExternalValues ( pUservar->Begin(), pUservar->GetLength() );
+				pFilterSettings = &tUservar;
+			}
 
-	// if we have anything to work with
-	if ( iSorters==0 )
-		return false;
+			ISphFilter * pFilter = sphCreateFilter ( *pFilterSettings, tSchema, pMvaPool, pStrings, sError, sWarning, eCollation, bArenaProhibit, m_bStringDicts );
+			if ( !pFilter )
+				return false;
 
-	// non-random at the start, random at the end
-	dSorters.Sort ( CmpPSortersByRandom_fn() );
+			ISphFilter ** pGroup = bWeight ? &m_pWeightFilter : &m_pFilter;
+			*pGroup = sphJoinFilters ( *pGroup, pFilter );
+		}
+	}
 
-	// fast path for scans
-	if ( pQuery->m_sQuery.IsEmpty() )
-		return MultiScan ( pQuery, pResult, iSorters, &dSorters[0], tArgs );
+	if ( dKillList.GetLength() )
+	{
+		ISphFilter * pFilter = sphCreateFilter ( dKillList );
+		if ( !pFilter )
+			return false;
 
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_DICT_SETUP );
+		m_pFilter = sphJoinFilters ( m_pFilter, pFilter );
+	}
 
-	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
-	CSphDict * pDictBase = m_pDict;
-	if ( pDictBase->HasState() )
-		tDictCloned = pDictBase = pDictBase->Clone();
+	if ( m_pFilter )
+		m_pFilter = m_pFilter->Optimize();
 
-	CSphScopedPtr<CSphDict> tDict ( NULL );
-	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
+	return true;
+}
 
-	CSphScopedPtr<CSphDict> tDict2 ( NULL );
-	pDict = SetupExactDict ( tDict2, pDict );
 
-	CSphVector<BYTE> dFiltered;
-	const BYTE * sModifiedQuery = (BYTE *)pQuery->m_sQuery.cstr();
+bool CSphQueryContext::SetupOverrides ( const CSphQuery * pQuery, CSphQueryResult * pResult, const CSphSchema & tIndexSchema, const ISphSchema & tOutgoingSchema )
+{
+	m_pOverrides = NULL;
+	m_dOverrideIn.Resize ( pQuery->m_dOverrides.GetLength() );
+	m_dOverrideOut.Resize ( pQuery->m_dOverrides.GetLength() );
 
-	CSphScopedPtr<ISphFieldFilter> pFieldFilter ( NULL );
-	if ( m_pFieldFilter )
+	ARRAY_FOREACH ( i, pQuery->m_dOverrides )
 	{
-		pFieldFilter = m_pFieldFilter->Clone();
-		if ( pFieldFilter.Ptr() && pFieldFilter->Apply ( sModifiedQuery, strlen ( (char*)sModifiedQuery ), dFiltered, true ) )
-			sModifiedQuery = dFiltered.Begin();
-	}
+		const char * sAttr = pQuery->m_dOverrides[i].m_sAttr.cstr(); // shortcut
+		const CSphColumnInfo * pCol = tIndexSchema.GetAttr ( sAttr );
+		if ( !pCol )
+		{
+			pResult->m_sError.SetSprintf ( "attribute override: unknown attribute name '%s'", sAttr );
+			return false;
+		}
 
-	// parse query
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_PARSE );
+		if ( pCol->m_eAttrType!=pQuery->m_dOverrides[i].m_eAttrType )
+		{
+			pResult->m_sError.SetSprintf ( "attribute override: attribute '%s' type mismatch (index=%d, query=%d)",
+				sAttr, pCol->m_eAttrType, pQuery->m_dOverrides[i].m_eAttrType );
+			return false;
+		}
 
-	XQQuery_t tParsed;
-	if ( !sphParseExtendedQuery ( tParsed, (const char*)sModifiedQuery, pQuery, m_pQueryTokenizer, &m_tSchema, pDict, m_tSettings ) )
-	{
-		// FIXME? might wanna reset profile to unknown state
-		pResult->m_sError = tParsed.m_sParseError;
-		return false;
+		const CSphColumnInfo * pOutCol = tOutgoingSchema.GetAttr ( pQuery->m_dOverrides[i].m_sAttr.cstr() );
+		if ( !pOutCol )
+		{
+			pResult->m_sError.SetSprintf ( "attribute override: unknown attribute name '%s' in outgoing schema", sAttr );
+			return false;
+		}
+
+		m_dOverrideIn[i] = pCol->m_tLocator;
+		m_dOverrideOut[i] = pOutCol->m_tLocator;
+
+#ifndef NDEBUG
+		// check that the values are actually sorted
+		const CSphVector<CSphAttrOverride::IdValuePair_t> & dValues = pQuery->m_dOverrides[i].m_dValues;
+		for ( int j=1; j<dValues.GetLength(); j++ )
+			assert ( dValues[j-1] < dValues[j] );
+#endif
 	}
-	if ( !tParsed.m_sParseWarning.IsEmpty() )
-		pResult->m_sWarning = tParsed.m_sParseWarning;
 
-	// transform query if needed (quorum transform, etc.)
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_TRANSFORMS );
-	sphTransformExtendedQuery ( &tParsed.m_pRoot, m_tSettings, pQuery->m_bSimplify, this );
+	if ( pQuery->m_dOverrides.GetLength() )
+		m_pOverrides = &pQuery->m_dOverrides;
+	return true;
+}
 
-	if ( m_bExpandKeywords )
+static int sphQueryHeightCalc ( const XQNode_t * pNode )
+{
+	if ( !pNode->m_dChildren.GetLength() )
 	{
-		tParsed.m_pRoot = sphQueryExpandKeywords ( tParsed.m_pRoot, m_tSettings );
-		tParsed.m_pRoot->Check ( true );
+		// exception, pre-cached OR of tiny (rare) keywords is just one node
+		if ( pNode->GetOp()==SPH_QUERY_OR )
+		{
+#ifndef NDEBUG
+			// sanity checks
+			// this node must be only created for a huge OR of tiny expansions
+			assert ( pNode->m_dWords.GetLength() );
+			ARRAY_FOREACH ( i, pNode->m_dWords )
+			{
+				assert ( pNode->m_dWords[i].m_iAtomPos==pNode->m_dWords[0].m_iAtomPos );
+				assert ( pNode->m_dWords[i].m_bExpanded );
+			}
+#endif
+			return 1;
+		}
+		return pNode->m_dWords.GetLength();
 	}
 
-	// this should be after keyword expansion
-	if ( m_tSettings.m_uAotFilterMask )
-		TransformAotFilter ( tParsed.m_pRoot, pDict->GetWordforms(), m_tSettings );
+	if ( pNode->GetOp()==SPH_QUERY_BEFORE )
+		return 1;
 
-	SphWordStatChecker_t tStatDiff;
-	tStatDiff.Set ( pResult->m_hWordStats );
+	int iMaxChild = 0;
+	int iHeight = 0;
+	ARRAY_FOREACH ( i, pNode->m_dChildren )
+	{
+		int iBottom = sphQueryHeightCalc ( pNode->m_dChildren[i] );
+		int iTop = pNode->m_dChildren.GetLength()-i-1;
+		if ( iBottom+iTop>=iMaxChild+iHeight )
+		{
+			iMaxChild = iBottom;
+			iHeight = iTop;
+		}
+	}
 
-	// expanding prefix in word dictionary case
-	CSphScopedPayload tPayloads;
-	XQNode_t * pPrefixed = ExpandPrefix ( tParsed.m_pRoot, pResult, &tPayloads, pQuery->m_uDebugFlags );
-	if ( !pPrefixed )
-		return false;
-	tParsed.m_pRoot = pPrefixed;
+	return iMaxChild+iHeight;
+}
 
-	if ( !sphCheckQueryHeight ( tParsed.m_pRoot, pResult->m_sError ) )
-		return false;
+#define SPH_EXTNODE_STACK_SIZE 160
 
-	// flag common subtrees
-	int iCommonSubtrees = 0;
-	if ( m_iMaxCachedDocs && m_iMaxCachedHits )
-		iCommonSubtrees = sphMarkCommonSubtrees ( 1, &tParsed );
+bool sphCheckQueryHeight ( const XQNode_t * pRoot, CSphString & sError )
+{
+	int iHeight = 0;
+	if ( pRoot )
+		iHeight = sphQueryHeightCalc ( pRoot );
 
-	tParsed.m_bNeedSZlist = pQuery->m_bZSlist;
+	int64_t iQueryStack = sphGetStackUsed() + iHeight*SPH_EXTNODE_STACK_SIZE;
+	bool bValid = ( g_iThreadStackSize>=iQueryStack );
+	if ( !bValid )
+		sError.SetSprintf ( "query too complex, not enough stack (thread_stack=%dK or higher required)",
+			(int)( ( iQueryStack + 1024 - ( iQueryStack%1024 ) ) / 1024 ) );
+	return bValid;
+}
 
-	CSphQueryNodeCache tNodeCache ( iCommonSubtrees, m_iMaxCachedDocs, m_iMaxCachedHits );
-	bool bResult = ParsedMultiQuery ( pQuery, pResult, iSorters, &dSorters[0], tParsed, pDict, tArgs, &tNodeCache, tStatDiff );
+static XQNode_t * CloneKeyword ( const XQNode_t * pNode )
+{
+	assert ( pNode );
 
-	return bResult;
+	XQNode_t * pRes = new XQNode_t ( pNode->m_dSpec );
+	pRes->m_dWords = pNode->m_dWords;
+	return pRes;
 }
 
 
-/// many regular queries with one sorter attached to each query.
-/// returns true if at least one query succeeded. The failed queries indicated with pResult->m_iMultiplier==-1
-bool CSphIndex_VLN::MultiQueryEx ( int iQueries, const CSphQuery * pQueries,
-	CSphQueryResult ** ppResults, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
+static XQNode_t * ExpandKeyword ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
 {
-	// ensure we have multiple queries
-	assert ( ppResults );
-	if ( iQueries==1 )
-		return MultiQuery ( pQueries, ppResults[0], 1, ppSorters, tArgs );
+	assert ( pNode );
 
-	MEMORY ( MEM_DISK_QUERYEX );
+	XQNode_t * pExpand = new XQNode_t ( pNode->m_dSpec );
+	pExpand->SetOp ( SPH_QUERY_OR, pNode );
 
-	assert ( pQueries );
-	assert ( ppSorters );
+	if ( tSettings.m_iMinInfixLen>0 )
+	{
+		assert ( pNode->m_dChildren.GetLength()==0 );
+		assert ( pNode->m_dWords.GetLength()==1 );
+		XQNode_t * pInfix = CloneKeyword ( pNode );
+		pInfix->m_dWords[0].m_sWord.SetSprintf ( "*%s*", pNode->m_dWords[0].m_sWord.cstr() );
+		pInfix->m_pParent = pExpand;
+		pExpand->m_dChildren.Add ( pInfix );
+	} else if ( tSettings.m_iMinPrefixLen>0 )
+	{
+		assert ( pNode->m_dChildren.GetLength()==0 );
+		assert ( pNode->m_dWords.GetLength()==1 );
+		XQNode_t * pPrefix = CloneKeyword ( pNode );
+		pPrefix->m_dWords[0].m_sWord.SetSprintf ( "%s*", pNode->m_dWords[0].m_sWord.cstr() );
+		pPrefix->m_pParent = pExpand;
+		pExpand->m_dChildren.Add ( pPrefix );
+	}
 
-	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
-	CSphDict * pDictBase = m_pDict;
-	if ( pDictBase->HasState() )
-		tDictCloned = pDictBase = pDictBase->Clone();
+	if ( tSettings.m_bIndexExactWords )
+	{
+		assert ( pNode->m_dChildren.GetLength()==0 );
+		assert ( pNode->m_dWords.GetLength()==1 );
+		XQNode_t * pExact = CloneKeyword ( pNode );
+		pExact->m_dWords[0].m_sWord.SetSprintf ( "=%s", pNode->m_dWords[0].m_sWord.cstr() );
+		pExact->m_pParent = pExpand;
+		pExpand->m_dChildren.Add ( pExact );
+	}
 
-	CSphScopedPtr<CSphDict> tDict ( NULL );
-	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
+	return pExpand;
+}
 
-	CSphScopedPtr<CSphDict> tDict2 ( NULL );
-	pDict = SetupExactDict ( tDict2, pDict );
+XQNode_t * sphQueryExpandKeywords ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
+{
+	// only if expansion makes sense at all
+	if ( tSettings.m_iMinInfixLen<=0 && tSettings.m_iMinPrefixLen<=0 && !tSettings.m_bIndexExactWords )
+		return pNode;
 
-	CSphFixedVector<XQQuery_t> dXQ ( iQueries );
-	CSphFixedVector<SphWordStatChecker_t> dStatChecker ( iQueries );
-	CSphScopedPayload tPayloads;
-	bool bResult = false;
-	bool bResultScan = false;
-	for ( int i=0; i<iQueries; i++ )
+	// process children for composite nodes
+	if ( pNode->m_dChildren.GetLength() )
 	{
-		// nothing to do without a sorter
-		if ( !ppSorters[i] )
+		ARRAY_FOREACH ( i, pNode->m_dChildren )
 		{
-			ppResults[i]->m_iMultiplier = -1; ///< show that this particular query failed
-			continue;
+			pNode->m_dChildren[i] = sphQueryExpandKeywords ( pNode->m_dChildren[i], tSettings );
+			pNode->m_dChildren[i]->m_pParent = pNode;
 		}
+		return pNode;
+	}
 
-		// fast path for scans
-		if ( pQueries[i].m_sQuery.IsEmpty() )
+	// if that's a phrase/proximity node, create a very special, magic phrase/proximity node
+	if ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM )
+	{
+		assert ( pNode->m_dWords.GetLength()>1 );
+		ARRAY_FOREACH ( i, pNode->m_dWords )
 		{
-			if ( MultiScan ( pQueries + i, ppResults[i], 1, &ppSorters[i], tArgs ) )
-				bResultScan = true;
-			else
-				ppResults[i]->m_iMultiplier = -1; ///< show that this particular query failed
-			continue;
+			XQNode_t * pWord = new XQNode_t ( pNode->m_dSpec );
+			pWord->m_dWords.Add ( pNode->m_dWords[i] );
+			pNode->m_dChildren.Add ( ExpandKeyword ( pWord, tSettings ) );
+			pNode->m_dChildren.Last()->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
+			pNode->m_dChildren.Last()->m_pParent = pNode;
 		}
+		pNode->m_dWords.Reset();
+		pNode->m_bVirtuallyPlain = true;
+		return pNode;
+	}
 
-		ppResults[i]->m_tIOStats.Start();
-
-		// parse query
-		if ( sphParseExtendedQuery ( dXQ[i], pQueries[i].m_sQuery.cstr(), &(pQueries[i]), m_pQueryTokenizer, &m_tSchema, pDict, m_tSettings ) )
-		{
-			// transform query if needed (quorum transform, keyword expansion, etc.)
-			sphTransformExtendedQuery ( &dXQ[i].m_pRoot, m_tSettings, pQueries[i].m_bSimplify, this );
-
-			if ( m_bExpandKeywords )
-			{
-				dXQ[i].m_pRoot = sphQueryExpandKeywords ( dXQ[i].m_pRoot, m_tSettings );
-				dXQ[i].m_pRoot->Check ( true );
-			}
+	// skip empty plain nodes
+	if ( pNode->m_dWords.GetLength()<=0 )
+		return pNode;
 
-			// this should be after keyword expansion
-			if ( m_tSettings.m_uAotFilterMask )
-				TransformAotFilter ( dXQ[i].m_pRoot, pDict->GetWordforms(), m_tSettings );
+	// process keywords for plain nodes
+	assert ( pNode->m_dWords.GetLength()==1 );
 
-			dStatChecker[i].Set ( ppResults[i]->m_hWordStats );
+	XQKeyword_t & tKeyword = pNode->m_dWords[0];
+	if ( tKeyword.m_sWord.Begins("=")
+		|| tKeyword.m_sWord.Begins("*")
+		|| tKeyword.m_sWord.Ends("*") )
+	{
+		return pNode;
+	}
 
-			// expanding prefix in word dictionary case
-			XQNode_t * pPrefixed = ExpandPrefix ( dXQ[i].m_pRoot, ppResults[i], &tPayloads, pQueries[i].m_uDebugFlags );
-			if ( pPrefixed )
-			{
-				dXQ[i].m_pRoot = pPrefixed;
+	// do the expansion
+	return ExpandKeyword ( pNode, tSettings );
+}
 
-				if ( sphCheckQueryHeight ( dXQ[i].m_pRoot, ppResults[i]->m_sError ) )
-				{
-					bResult = true;
-				} else
-				{
-					ppResults[i]->m_iMultiplier = -1;
-					SafeDelete ( dXQ[i].m_pRoot );
-				}
-			} else
-			{
-				ppResults[i]->m_iMultiplier = -1;
-				SafeDelete ( dXQ[i].m_pRoot );
-			}
-		} else
-		{
-			ppResults[i]->m_sError = dXQ[i].m_sParseError;
-			ppResults[i]->m_iMultiplier = -1;
-		}
-		if ( !dXQ[i].m_sParseWarning.IsEmpty() )
-			ppResults[i]->m_sWarning = dXQ[i].m_sParseWarning;
 
-		ppResults[i]->m_tIOStats.Stop();
-	}
+// transform the "one two three"/1 quorum into one|two|three (~40% faster)
+static void TransformQuorum ( XQNode_t ** ppNode )
+{
+	XQNode_t *& pNode = *ppNode;
 
-	// continue only if we have at least one non-failed
-	if ( bResult )
+	// recurse non-quorum nodes
+	if ( pNode->GetOp()!=SPH_QUERY_QUORUM )
 	{
-		int iCommonSubtrees = 0;
-		if ( m_iMaxCachedDocs && m_iMaxCachedHits )
-			iCommonSubtrees = sphMarkCommonSubtrees ( iQueries, &dXQ[0] );
-
-		CSphQueryNodeCache tNodeCache ( iCommonSubtrees, m_iMaxCachedDocs, m_iMaxCachedHits );
-		bResult = false;
-		for ( int j=0; j<iQueries; j++ )
-		{
-			// fullscan case
-			if ( pQueries[j].m_sQuery.IsEmpty() )
-				continue;
-
-			ppResults[j]->m_tIOStats.Start();
+		ARRAY_FOREACH ( i, pNode->m_dChildren )
+			TransformQuorum ( &pNode->m_dChildren[i] );
+		return;
+	}
 
-			if ( dXQ[j].m_pRoot && ppSorters[j]
-					&& ParsedMultiQuery ( &pQueries[j], ppResults[j], 1, &ppSorters[j], dXQ[j], pDict, tArgs, &tNodeCache, dStatChecker[j] ) )
-			{
-				bResult = true;
-				ppResults[j]->m_iMultiplier = iCommonSubtrees ? iQueries : 1;
-			} else
-			{
-				ppResults[j]->m_iMultiplier = -1;
-			}
+	// skip quorums with thresholds other than 1
+	if ( pNode->m_iOpArg!=1 )
+		return;
 
-			ppResults[j]->m_tIOStats.Stop();
-		}
+	// transform quorums with a threshold of 1 only
+	assert ( pNode->GetOp()==SPH_QUERY_QUORUM && pNode->m_dChildren.GetLength()==0 );
+	CSphVector<XQNode_t*> dArgs;
+	ARRAY_FOREACH ( i, pNode->m_dWords )
+	{
+		XQNode_t * pAnd = new XQNode_t ( pNode->m_dSpec );
+		pAnd->m_dWords.Add ( pNode->m_dWords[i] );
+		dArgs.Add ( pAnd );
 	}
-
-	return bResult | bResultScan;
+	pNode->m_dWords.Reset();
+	pNode->SetOp ( SPH_QUERY_OR, dArgs );
 }
 
-bool CSphIndex_VLN::ParsedMultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult,
-	int iSorters, ISphMatchSorter ** ppSorters, const XQQuery_t & tXQ, CSphDict * pDict,
-	const CSphMultiQueryArgs & tArgs, CSphQueryNodeCache * pNodeCache, const SphWordStatChecker_t & tStatDiff ) const
+
+struct BinaryNode_t
 {
-	assert ( pQuery );
-	assert ( pResult );
-	assert ( ppSorters );
-	assert ( !pQuery->m_sQuery.IsEmpty() && pQuery->m_eMode!=SPH_MATCH_FULLSCAN ); // scans must go through MultiScan()
-	assert ( tArgs.m_iTag>=0 );
+	int m_iLo;
+	int m_iHi;
+};
 
-	// start counting
-	int64_t tmQueryStart = sphMicroTimer();
+static void BuildExpandedTree ( const XQKeyword_t & tRootWord, ISphWordlist::Args_t & dWordSrc, XQNode_t * pRoot )
+{
+	assert ( dWordSrc.m_dExpanded.GetLength() );
+	pRoot->m_dWords.Reset();
 
-	CSphQueryProfile * pProfile = pResult->m_pProfile;
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_INIT );
+	// build a binary tree from all the other expansions
+	CSphVector<BinaryNode_t> dNodes;
+	dNodes.Reserve ( dWordSrc.m_dExpanded.GetLength() );
 
-	ScopedThreadPriority_c tPrio ( pQuery->m_bLowPriority );
+	XQNode_t * pCur = pRoot;
 
-	///////////////////
-	// setup searching
-	///////////////////
+	dNodes.Add();
+	dNodes.Last().m_iLo = 0;
+	dNodes.Last().m_iHi = ( dWordSrc.m_dExpanded.GetLength()-1 );
 
-	// non-ready index, empty response!
-	if ( !m_bPassedAlloc )
+	while ( dNodes.GetLength() )
 	{
-		pResult->m_sError = "index not preread";
-		return false;
-	}
-
-	// select the sorter with max schema
-	int iMaxSchemaSize = -1;
-	int iMaxSchemaIndex = -1;
-	for ( int i=0; i<iSorters; i++ )
-		if ( ppSorters[i]->GetSchema().GetRowSize() > iMaxSchemaSize )
+		BinaryNode_t tNode = dNodes.Pop();
+		if ( tNode.m_iHi<tNode.m_iLo )
 		{
-			iMaxSchemaSize = ppSorters[i]->GetSchema().GetRowSize();
-			iMaxSchemaIndex = i;
+			pCur = pCur->m_pParent;
+			continue;
 		}
 
-	// setup calculations and result schema
-	CSphQueryContext tCtx ( *pQuery );
-	tCtx.m_pProfile = pProfile;
-	tCtx.m_pLocalDocs = tArgs.m_pLocalDocs;
-	tCtx.m_iTotalDocs = tArgs.m_iTotalDocs;
-	if ( !tCtx.SetupCalc ( pResult, ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema, m_tMva.GetWritePtr(), m_bArenaProhibit ) )
-		return false;
-
-	// set string pool for string on_sort expression fix up
-	tCtx.SetStringPool ( m_tString.GetWritePtr() );
+		int iMid = ( tNode.m_iLo+tNode.m_iHi ) / 2;
+		dNodes.Add ();
+		dNodes.Last().m_iLo = tNode.m_iLo;
+		dNodes.Last().m_iHi = iMid-1;
+		dNodes.Add ();
+		dNodes.Last().m_iLo = iMid+1;
+		dNodes.Last().m_iHi = tNode.m_iHi;
 
-	tCtx.m_uPackedFactorFlags = tArgs.m_uPackedFactorFlags;
+		if ( pCur->m_dWords.GetLength() )
+		{
+			assert ( pCur->m_dWords.GetLength()==1 );
+			XQNode_t * pTerm = CloneKeyword ( pRoot );
+			Swap ( pTerm->m_dWords, pCur->m_dWords );
+			pCur->m_dChildren.Add ( pTerm );
+			pTerm->m_pParent = pCur;
+		}
 
-	// open files
-	CSphAutofile tDoclist, tHitlist;
-	if ( !m_bKeepFilesOpen )
-	{
-		if ( pProfile )
-			pProfile->Switch ( SPH_QSTATE_OPEN );
+		XQNode_t * pChild = CloneKeyword ( pRoot );
+		pChild->m_dWords.Add ( tRootWord );
+		pChild->m_dWords.Last().m_sWord = dWordSrc.GetWordExpanded ( iMid );
+		pChild->m_dWords.Last().m_bExpanded = true;
+		pChild->m_bNotWeighted = pRoot->m_bNotWeighted;
 
-		if ( tDoclist.Open ( GetIndexFileName("spd"), SPH_O_READ, pResult->m_sError ) < 0 )
-			return false;
+		pChild->m_pParent = pCur;
+		pCur->m_dChildren.Add ( pChild );
+		pCur->SetOp ( SPH_QUERY_OR );
 
-		if ( tHitlist.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, pResult->m_sError ) < 0 )
-			return false;
+		pCur = pChild;
 	}
+}
 
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_INIT );
 
-	// setup search terms
-	DiskIndexQwordSetup_c tTermSetup ( m_bKeepFilesOpen ? m_tDoclistFile : tDoclist,
-		m_bKeepFilesOpen ? m_tHitlistFile : tHitlist,
-		m_tSkiplists.GetWritePtr(), pProfile );
+/// do wildcard expansion for keywords dictionary
+/// (including prefix and infix expansion)
+XQNode_t * sphExpandXQNode ( XQNode_t * pNode, ExpansionContext_t & tCtx )
+{
+	assert ( pNode );
+	assert ( tCtx.m_pResult );
 
-	tTermSetup.m_pDict = pDict;
-	tTermSetup.m_pIndex = this;
-	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
-	tTermSetup.m_uMinDocid = m_uMinDocid;
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
+	// process children for composite nodes
+	if ( pNode->m_dChildren.GetLength() )
 	{
-		tTermSetup.m_iInlineRowitems = m_tSchema.GetRowSize();
-		tTermSetup.m_pMinRow = m_dMinRow.Begin();
+		ARRAY_FOREACH ( i, pNode->m_dChildren )
+		{
+			pNode->m_dChildren[i] = sphExpandXQNode ( pNode->m_dChildren[i], tCtx );
+			pNode->m_dChildren[i]->m_pParent = pNode;
+		}
+		return pNode;
 	}
-	tTermSetup.m_iDynamicRowitems = ppSorters[iMaxSchemaIndex]->GetSchema().GetDynamicSize();
 
-	if ( pQuery->m_uMaxQueryMsec>0 )
-		tTermSetup.m_iMaxTimer = sphMicroTimer() + pQuery->m_uMaxQueryMsec*1000; // max_query_time
-	tTermSetup.m_pWarning = &pResult->m_sWarning;
-	tTermSetup.m_bSetupReaders = true;
-	tTermSetup.m_pCtx = &tCtx;
-	tTermSetup.m_pNodeCache = pNodeCache;
+	// if that's a phrase/proximity node, create a very special, magic phrase/proximity node
+	if ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM )
+	{
+		assert ( pNode->m_dWords.GetLength()>1 );
+		ARRAY_FOREACH ( i, pNode->m_dWords )
+		{
+			XQNode_t * pWord = new XQNode_t ( pNode->m_dSpec );
+			pWord->m_dWords.Add ( pNode->m_dWords[i] );
+			pNode->m_dChildren.Add ( sphExpandXQNode ( pWord, tCtx ) );
+			pNode->m_dChildren.Last()->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
+			pNode->m_dChildren.Last()->m_pParent = pNode;
 
-	// setup prediction constrain
-	CSphQueryStats tQueryStats;
-	bool bCollectPredictionCounters = ( pQuery->m_iMaxPredictedMsec>0 );
-	int64_t iNanoBudget = (int64_t)(pQuery->m_iMaxPredictedMsec) * 1000000; // from milliseconds to nanoseconds
-	tQueryStats.m_pNanoBudget = &iNanoBudget;
-	if ( bCollectPredictionCounters )
-		tTermSetup.m_pStats = &tQueryStats;
-
-	// bind weights
-	tCtx.BindWeights ( pQuery, m_tSchema, pResult->m_sWarning );
-
-	// setup query
-	// must happen before index-level reject, in order to build proper keyword stats
-	CSphScopedPtr<ISphRanker> pRanker ( sphCreateRanker ( tXQ, pQuery, pResult, tTermSetup, tCtx, ppSorters[iMaxSchemaIndex]->GetSchema() ) );
-	if ( !pRanker.Ptr() )
-		return false;
+			// tricky part
+			// current node may have field/zone limits attached
+			// normally those get pushed down during query parsing
+			// but here we create nodes manually and have to push down limits too
+			pWord->CopySpecs ( pNode );
+		}
+		pNode->m_dWords.Reset();
+		pNode->m_bVirtuallyPlain = true;
+		return pNode;
+	}
 
-	tStatDiff.DumpDiffer ( pResult->m_hWordStats, m_sIndexName.cstr(), pResult->m_sWarning );
+	// skip empty plain nodes
+	if ( pNode->m_dWords.GetLength()<=0 )
+		return pNode;
 
-	if ( ( tArgs.m_uPackedFactorFlags & SPH_FACTOR_ENABLE ) && pQuery->m_eRanker!=SPH_RANK_EXPR )
-		pResult->m_sWarning.SetSprintf ( "packedfactors() and bm25f() requires using an expression ranker" );
+	// process keywords for plain nodes
+	assert ( pNode->m_dChildren.GetLength()==0 );
+	assert ( pNode->m_dWords.GetLength()==1 );
 
-	tCtx.SetupExtraData ( pRanker.Ptr(), iSorters==1 ? ppSorters[0] : NULL );
+	// check the wildcards
+	const char * sFull = pNode->m_dWords[0].m_sWord.cstr();
 
-	PoolPtrs_t tMva;
-	tMva.m_pMva = m_tMva.GetWritePtr();
-	tMva.m_bArenaProhibit = m_bArenaProhibit;
-	pRanker->ExtraData ( EXTRA_SET_MVAPOOL, (void**)&tMva );
-	pRanker->ExtraData ( EXTRA_SET_STRINGPOOL, (void**)m_tString.GetWritePtr() );
+	// no wildcards, or just wildcards? do not expand
+	if ( !sphHasExpandableWildcards ( sFull ) )
+		return pNode;
 
-	int iMatchPoolSize = 0;
-	for ( int i=0; i<iSorters; i++ )
-		iMatchPoolSize += ppSorters[i]->m_iMatchCapacity;
+	bool bUseTermMerge = ( tCtx.m_bMergeSingles && pNode->m_dSpec.m_dZones.GetLength()==0 );
+	ISphWordlist::Args_t tWordlist ( bUseTermMerge, tCtx.m_iExpansionLimit, tCtx.m_bHasMorphology, tCtx.m_eHitless, tCtx.m_pIndexData );
 
-	pRanker->ExtraData ( EXTRA_SET_POOL_CAPACITY, (void**)&iMatchPoolSize );
+	if ( !sphExpandGetWords ( sFull, tCtx, tWordlist ) )
+	{
+		tCtx.m_pResult->m_sWarning.SetSprintf ( "Query word length is less than min %s length. word: '%s' ", ( tCtx.m_iMinInfixLen>0 ? "infix" : "prefix" ), sFull );
+		return pNode;
+	}
 
-	// check for the possible integer overflow in m_dPool.Resize
-	int64_t iPoolSize = 0;
-	if ( pRanker->ExtraData ( EXTRA_GET_POOL_SIZE, (void**)&iPoolSize ) && iPoolSize>INT_MAX )
+	// no real expansions?
+	// mark source word as expanded to prevent warning on terms mismatch in statistics
+	if ( !tWordlist.m_dExpanded.GetLength() && !tWordlist.m_pPayload )
 	{
-		pResult->m_sError.SetSprintf ( "ranking factors pool too big (%d Mb), reduce max_matches", (int)( iPoolSize/1024/1024 ) );
-		return false;
+		tCtx.m_pResult->AddStat ( pNode->m_dWords.Begin()->m_sWord, 0, 0 );
+		pNode->m_dWords.Begin()->m_bExpanded = true;
+		return pNode;
 	}
 
-	// empty index, empty response!
-	if ( m_bIsEmpty )
-		return true;
-	assert ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN || !m_tAttr.IsEmpty() ); // check that docinfo is preloaded
+	// copy the original word (iirc it might get overwritten),
+	const XQKeyword_t tRootWord = pNode->m_dWords[0];
+	tCtx.m_pResult->AddStat ( tRootWord.m_sWord, tWordlist.m_iTotalDocs, tWordlist.m_iTotalHits );
 
-	// setup filters
-	if ( !tCtx.CreateFilters ( pQuery->m_sQuery.IsEmpty(), &pQuery->m_dFilters, ppSorters[iMaxSchemaIndex]->GetSchema(),
-		m_tMva.GetWritePtr(), m_tString.GetWritePtr(), pResult->m_sError, pResult->m_sWarning, pQuery->m_eCollation, m_bArenaProhibit, tArgs.m_dKillList ) )
-			return false;
+	// and build a binary tree of all the expansions
+	if ( tWordlist.m_dExpanded.GetLength() )
+	{
+		BuildExpandedTree ( tRootWord, tWordlist, pNode );
+	}
 
-	// check if we can early reject the whole index
-	if ( tCtx.m_pFilter && m_iDocinfoIndex )
+	if ( tWordlist.m_pPayload )
 	{
-		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
-		DWORD * pMinEntry = const_cast<DWORD*> ( &m_pDocinfoIndex [ m_iDocinfoIndex*uStride*2 ] );
-		DWORD * pMaxEntry = pMinEntry + uStride;
+		ISphSubstringPayload * pPayload = tWordlist.m_pPayload;
+		tWordlist.m_pPayload = NULL;
+		tCtx.m_pPayloads->Add ( pPayload );
 
-		if ( !tCtx.m_pFilter->EvalBlock ( pMinEntry, pMaxEntry ) )
-			return true;
-	}
+		if ( pNode->m_dWords.GetLength() )
+		{
+			// all expanded fit to single payload
+			pNode->m_dWords.Begin()->m_bExpanded = true;
+			pNode->m_dWords.Begin()->m_pPayload = pPayload;
+		} else
+		{
+			// payload added to expanded binary tree
+			assert ( pNode->GetOp()==SPH_QUERY_OR );
+			assert ( pNode->m_dChildren.GetLength() );
 
-	// setup lookup
-	tCtx.m_bLookupFilter = ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN ) && pQuery->m_dFilters.GetLength();
-	if ( tCtx.m_dCalcFilter.GetLength() || pQuery->m_eRanker==SPH_RANK_EXPR || pQuery->m_eRanker==SPH_RANK_EXPORT )
-		tCtx.m_bLookupFilter = true; // suboptimal in case of attr-independent expressions, but we don't care
+			XQNode_t * pSubstringNode = new XQNode_t ( pNode->m_dSpec );
+			pSubstringNode->SetOp ( SPH_QUERY_OR );
 
-	tCtx.m_bLookupSort = false;
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !tCtx.m_bLookupFilter )
-		for ( int iSorter=0; iSorter<iSorters && !tCtx.m_bLookupSort; iSorter++ )
-			if ( ppSorters[iSorter]->UsesAttrs() )
-				tCtx.m_bLookupSort = true;
-	if ( tCtx.m_dCalcSort.GetLength() )
-		tCtx.m_bLookupSort = true; // suboptimal in case of attr-independent expressions, but we don't care
+			XQKeyword_t tSubstringWord = tRootWord;
+			tSubstringWord.m_bExpanded = true;
+			tSubstringWord.m_pPayload = pPayload;
+			pSubstringNode->m_dWords.Add ( tSubstringWord );
 
-	// setup sorters vs. MVA
-	for ( int i=0; i<iSorters; i++ )
-	{
-		(ppSorters[i])->SetMVAPool ( m_tMva.GetWritePtr(), m_bArenaProhibit );
-		(ppSorters[i])->SetStringPool ( m_tString.GetWritePtr() );
+			pNode->m_dChildren.Add ( pSubstringNode );
+			pSubstringNode->m_pParent = pNode;
+		}
 	}
 
-	// setup overrides
-	if ( !tCtx.SetupOverrides ( pQuery, pResult, m_tSchema, ppSorters[iMaxSchemaIndex]->GetSchema() ) )
-		return false;
-
-	//////////////////////////////////////
-	// find and weight matching documents
-	//////////////////////////////////////
+	return pNode;
+}
 
-	bool bFinalLookup = !tCtx.m_bLookupFilter && !tCtx.m_bLookupSort;
-	bool bFinalPass = bFinalLookup || tCtx.m_dCalcFinal.GetLength();
-	int iMyTag = bFinalPass ? -1 : tArgs.m_iTag;
 
-	switch ( pQuery->m_eMode )
-	{
-		case SPH_MATCH_ALL:
-		case SPH_MATCH_PHRASE:
-		case SPH_MATCH_ANY:
-		case SPH_MATCH_EXTENDED:
-		case SPH_MATCH_EXTENDED2:
-		case SPH_MATCH_BOOLEAN:
-			MatchExtended ( &tCtx, pQuery, iSorters, ppSorters, pRanker.Ptr(), iMyTag, tArgs.m_iIndexWeight );
-			break;
+bool sphHasExpandableWildcards ( const char * sWord )
+{
+	const char * pCur = sWord;
+	int iWilds = 0;
 
-		default:
-			sphDie ( "INTERNAL ERROR: unknown matching mode (mode=%d)", pQuery->m_eMode );
-	}
+	for ( ; *pCur; pCur++ )
+		if ( sphIsWild ( *pCur ) )
+			iWilds++;
 
-	////////////////////
-	// cook result sets
-	////////////////////
+	int iLen = pCur - sWord;
 
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_FINALIZE );
+	return ( iWilds && iWilds<iLen );
+}
 
-	// adjust result sets
-	if ( bFinalPass )
+bool sphExpandGetWords ( const char * sWord, const ExpansionContext_t & tCtx, ISphWordlist::Args_t & tWordlist )
+{
+	if ( !sphIsWild ( *sWord ) || tCtx.m_iMinInfixLen==0 )
 	{
-		// GotUDF means promise to UDFs that final-stage calls will be evaluated
-		// a) over the final, pre-limit result set
-		// b) in the final result set order
-		bool bGotUDF = false;
-		ARRAY_FOREACH_COND ( i, tCtx.m_dCalcFinal, !bGotUDF )
-			tCtx.m_dCalcFinal[i].m_pExpr->Command ( SPH_EXPR_GET_UDF, &bGotUDF );
+		// do prefix expansion
+		// remove exact form modifier, if any
+		const char * sPrefix = sWord;
+		if ( *sPrefix=='=' )
+			sPrefix++;
 
-		SphFinalMatchCalc_t tProcessor ( tArgs.m_iTag, bFinalLookup ? this : NULL, tCtx );
-		for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+		// skip leading wildcards
+		// (in case we got here on non-infixed index path)
+		const char * sWildcard = sPrefix;
+		while ( sphIsWild ( *sPrefix ) )
 		{
-			ISphMatchSorter * pTop = ppSorters[iSorter];
-			pTop->Finalize ( tProcessor, bGotUDF );
+			sPrefix++;
+			sWildcard++;
 		}
-		pResult->m_iBadRows += tProcessor.m_iBadRows;
-	}
-
-	pRanker->FinalizeCache ( ppSorters[iMaxSchemaIndex]->GetSchema() );
 
-	// mva and string pools ptrs
-	pResult->m_pMva = m_tMva.GetWritePtr();
-	pResult->m_pStrings = m_tString.GetWritePtr();
-	pResult->m_bArenaProhibit = m_bArenaProhibit;
-	pResult->m_iBadRows += tCtx.m_iBadRows;
+		// compute non-wildcard prefix length
+		int iPrefix = 0;
+		for ( const char * s = sPrefix; *s && !sphIsWild ( *s ); s++ )
+			iPrefix++;
 
-	// query timer
-	int64_t tmWall = sphMicroTimer() - tmQueryStart;
-	pResult->m_iQueryTime += (int)( tmWall/1000 );
+		// do not expand prefixes under min length
+		int iMinLen = Max ( tCtx.m_iMinPrefixLen, tCtx.m_iMinInfixLen );
+		if ( iPrefix<iMinLen )
+			return false;
 
-#if 0
-	printf ( "qtm %d, %d, %d, %d, %d\n", int(tmWall), tQueryStats.m_iFetchedDocs,
-		tQueryStats.m_iFetchedHits, tQueryStats.m_iSkips, ppSorters[0]->GetTotalCount() );
-#endif
+		// prefix expansion should work on nonstemmed words only
+		char sFixed[MAX_KEYWORD_BYTES];
+		if ( tCtx.m_bHasMorphology )
+		{
+			sFixed[0] = MAGIC_WORD_HEAD_NONSTEMMED;
+			memcpy ( sFixed+1, sPrefix, iPrefix );
+			sPrefix = sFixed;
+			iPrefix++;
+		}
 
-	if ( pProfile )
-		pProfile->Switch ( SPH_QSTATE_UNKNOWN );
+		tCtx.m_pWordlist->GetPrefixedWords ( sPrefix, iPrefix, sWildcard, tWordlist );
 
-	if ( bCollectPredictionCounters )
+	} else
 	{
-		pResult->m_tStats.m_iFetchedDocs += tQueryStats.m_iFetchedDocs;
-		pResult->m_tStats.m_iFetchedHits += tQueryStats.m_iFetchedHits;
-		pResult->m_tStats.m_iSkips += tQueryStats.m_iSkips;
-		pResult->m_bHasPrediction = true;
-	}
-
-	return true;
-}
+		// do infix expansion
+		assert ( sphIsWild ( *sWord ) );
+		assert ( tCtx.m_iMinInfixLen>0 );
 
-//////////////////////////////////////////////////////////////////////////
-// INDEX STATUS
-//////////////////////////////////////////////////////////////////////////
+		// find the longest substring of non-wildcards
+		const char * sMaxInfix = NULL;
+		int iMaxInfix = 0;
+		int iCur = 0;
 
-void CSphIndex_VLN::GetStatus ( CSphIndexStatus* pRes ) const
-{
-	assert ( pRes );
-	if ( !pRes )
-		return;
-	pRes->m_iRamUse = sizeof(CSphIndex_VLN)
-		+ m_dMinRow.GetSizeBytes()
-		+ m_dFieldLens.GetSizeBytes()
+		for ( const char * s = sWord; *s; s++ )
+		{
+			if ( sphIsWild ( *s ) )
+			{
+				iCur = 0;
+			} else if ( ++iCur > iMaxInfix )
+			{
+				sMaxInfix = s-iCur+1;
+				iMaxInfix = iCur;
+			}
+		}
 
-		+ m_tDocinfoHash.GetLengthBytes()
-		+ m_tAttr.GetLengthBytes()
-		+ m_tMva.GetLengthBytes()
-		+ m_tString.GetLengthBytes()
-		+ m_tWordlist.m_tBuf.GetLengthBytes()
-		+ m_tKillList.GetLengthBytes()
-		+ m_tSkiplists.GetLengthBytes();
+		// do not expand infixes under min_infix_len
+		if ( iMaxInfix < tCtx.m_iMinInfixLen )
+			return false;
 
-	char sFile [ SPH_MAX_FILENAME_LEN ];
-	pRes->m_iDiskUse = 0;
-	for ( int i=0; i<sphGetExtCount ( m_uVersion ); i++ )
-	{
-		snprintf ( sFile, sizeof(sFile), "%s%s", m_sFilename.cstr(), sphGetExts ( SPH_EXT_TYPE_CUR, m_uVersion )[i] );
-		struct_stat st;
-		if ( stat ( sFile, &st )==0 )
-			pRes->m_iDiskUse += st.st_size;
+		// ignore heading star
+		tCtx.m_pWordlist->GetInfixedWords ( sMaxInfix, iMaxInfix, sWord, tWordlist );
 	}
-}
-
-//////////////////////////////////////////////////////////////////////////
-// INDEX CHECKING
-//////////////////////////////////////////////////////////////////////////
 
-void CSphIndex_VLN::SetDebugCheck ()
-{
-	m_bDebugCheck = true;
+	return true;
 }
 
-static int sphUnpackStrLength ( CSphReader & tReader )
-{
-	int v = tReader.GetByte();
-	if ( v & 0x80 )
-	{
-		if ( v & 0x40 )
-		{
-			v = ( int ( v & 0x3f )<<16 ) + ( int ( tReader.GetByte() )<<8 );
-			v += ( tReader.GetByte() ); // MUST be separate statement; cf. sequence point
-		} else
-		{
-			v = ( int ( v & 0x3f )<<8 ) + ( tReader.GetByte() );
-		}
-	}
+ExpansionContext_t::ExpansionContext_t()
+	: m_pWordlist ( NULL )
+	, m_pBuf ( NULL )
+	, m_pResult ( NULL )
+	, m_iMinPrefixLen ( 0 )
+	, m_iMinInfixLen ( 0 )
+	, m_iExpansionLimit ( 0 )
+	, m_bHasMorphology ( false )
+	, m_bMergeSingles ( false )
+	, m_pPayloads ( NULL )
+	, m_eHitless ( SPH_HITLESS_NONE )
+	, m_pIndexData ( NULL )
+{}
 
-	return v;
-}
 
-class CSphDocidList
+XQNode_t * CSphIndex_VLN::ExpandPrefix ( XQNode_t * pNode, CSphQueryResultMeta * pResult, CSphScopedPayload * pPayloads, DWORD uQueryDebugFlags ) const
 {
-public:
-	CSphDocidList ()
-	{
-		m_bRawID = true;
-		m_iDocidMin = DOCID_MAX;
-		m_iDocidMax = 0;
-	}
+	if ( !pNode || !m_pDict->GetSettings().m_bWordDict || ( m_tSettings.m_iMinPrefixLen<=0 && m_tSettings.m_iMinInfixLen<=0 ) )
+		return pNode;
 
-	~CSphDocidList ()
-	{}
+	assert ( m_bPassedAlloc );
+	assert ( !m_tWordlist.m_tBuf.IsEmpty() );
 
-	bool Init ( int iRowSize, int64_t iRows, CSphReader & rdAttr, CSphString & sError )
-	{
-		if ( !iRows )
-			return true;
+	ExpansionContext_t tCtx;
+	tCtx.m_pWordlist = &m_tWordlist;
+	tCtx.m_pResult = pResult;
+	tCtx.m_iMinPrefixLen = m_tSettings.m_iMinPrefixLen;
+	tCtx.m_iMinInfixLen = m_tSettings.m_iMinInfixLen;
+	tCtx.m_iExpansionLimit = m_iExpansionLimit;
+	tCtx.m_bHasMorphology = m_pDict->HasMorphology();
+	tCtx.m_bMergeSingles = ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_INLINE && ( uQueryDebugFlags & QUERY_DEBUG_NO_PAYLOAD )==0 );
+	tCtx.m_pPayloads = pPayloads;
+	tCtx.m_eHitless = m_tSettings.m_eHitless;
 
-		int iSkip = sizeof ( CSphRowitem ) * iRowSize;
+	pNode = sphExpandXQNode ( pNode, tCtx );
+	pNode->Check ( true );
 
-		rdAttr.SeekTo ( 0, sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
-		m_iDocidMin = rdAttr.GetDocid ();
-		rdAttr.SeekTo ( ( iRows-1 ) * sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ), sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
-		m_iDocidMax = rdAttr.GetDocid();
-		rdAttr.SeekTo ( 0, sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
+	return pNode;
+}
 
-		if ( m_iDocidMax<m_iDocidMin )
-			return true;
 
-		uint64_t uRawBufLenght = sizeof(SphDocID_t) * iRows;
-		uint64_t uBitsBufLenght = ( m_iDocidMax - m_iDocidMin ) / 32;
-		if ( uRawBufLenght<uBitsBufLenght )
-		{
-			if ( !m_dDocid.Alloc ( iRows, sError ) )
-			{
-				sError.SetSprintf ( "unable to allocate doc-id storage: %s", sError.cstr () );
-				return false;
-			}
-		} else
+// transform the (A B) NEAR C into A NEAR B NEAR C
+static void TransformNear ( XQNode_t ** ppNode )
+{
+	XQNode_t *& pNode = *ppNode;
+	if ( pNode->GetOp()==SPH_QUERY_NEAR )
+	{
+		assert ( pNode->m_dWords.GetLength()==0 );
+		CSphVector<XQNode_t*> dArgs;
+		int iStartFrom;
+
+		// transform all (A B C) NEAR D into A NEAR B NEAR C NEAR D
+		do
 		{
-			if ( !m_dBits.Alloc ( ( uBitsBufLenght * sizeof(DWORD) )+1, sError ) )
+			dArgs.Reset();
+			iStartFrom = 0;
+			ARRAY_FOREACH ( i, pNode->m_dChildren )
 			{
-				sError.SetSprintf ( "unable to allocate doc-id storage: %s", sError.cstr () );
-				return false;
+				XQNode_t * pChild = pNode->m_dChildren[i]; ///< shortcut
+				if ( pChild->GetOp()==SPH_QUERY_AND && pChild->m_dChildren.GetLength()>0 )
+				{
+					ARRAY_FOREACH ( j, pChild->m_dChildren )
+					{
+						if ( j==0 && iStartFrom==0 )
+						{
+							// we will remove the node anyway, so just replace it with 1-st child instead
+							pNode->m_dChildren[i] = pChild->m_dChildren[j];
+							pNode->m_dChildren[i]->m_pParent = pNode;
+							iStartFrom = i+1;
+						} else
+						{
+							dArgs.Add ( pChild->m_dChildren[j] );
+						}
+					}
+					pChild->m_dChildren.Reset();
+					SafeDelete ( pChild );
+				} else if ( iStartFrom!=0 )
+				{
+					dArgs.Add ( pChild );
+				}
 			}
-			m_bRawID = false;
-			memset ( m_dBits.GetWritePtr(), 0, m_dBits.GetLengthBytes() );
-		}
-
-		for ( int64_t iRow=0; iRow<iRows && !rdAttr.GetErrorFlag (); iRow++ )
-		{
-			SphDocID_t uDocid = rdAttr.GetDocid ();
-			rdAttr.SkipBytes ( iSkip );
-
-			if ( uDocid<m_iDocidMin || uDocid>m_iDocidMax )
-				continue;
 
-			if ( m_bRawID )
-				m_dDocid.GetWritePtr()[iRow] = uDocid;
-			else
+			if ( iStartFrom!=0 )
 			{
-				SphDocID_t uIndex = uDocid - m_iDocidMin;
-				DWORD uBit = 1UL<<(uIndex & 31);
-				m_dBits.GetWritePtr()[uIndex>>5] |= uBit;
+				pNode->m_dChildren.Resize ( iStartFrom + dArgs.GetLength() );
+				ARRAY_FOREACH ( i, dArgs )
+				{
+					pNode->m_dChildren [ i + iStartFrom ] = dArgs[i];
+					pNode->m_dChildren [ i + iStartFrom ]->m_pParent = pNode;
+				}
 			}
-		}
+		} while ( iStartFrom!=0 );
+	}
 
-		if ( rdAttr.GetErrorFlag () )
-		{
-			sError.SetSprintf ( "unable to read attributes: %s", rdAttr.GetErrorMessage().cstr() );
-			rdAttr.ResetError();
-			return false;
-		}
+	ARRAY_FOREACH ( i, pNode->m_dChildren )
+		TransformNear ( &pNode->m_dChildren[i] );
+}
 
-		return true;
-	}
 
-	bool HasDocid ( SphDocID_t uDocid )
+/// tag excluded keywords (rvals to operator NOT)
+static void TagExcluded ( XQNode_t * pNode, bool bNot )
+{
+	if ( pNode->GetOp()==SPH_QUERY_ANDNOT )
 	{
-		if ( uDocid<m_iDocidMin || uDocid>m_iDocidMax )
-			return false;
-
-		if ( m_bRawID )
-		{
-			return ( sphBinarySearch ( m_dDocid.GetWritePtr(), m_dDocid.GetWritePtr () + m_dDocid.GetNumEntries() - 1, uDocid )!=NULL );
-		} else
-		{
-			SphDocID_t uIndex = uDocid - m_iDocidMin;
-			DWORD uBit = 1UL<<( uIndex & 31 );
+		assert ( pNode->m_dChildren.GetLength()==2 );
+		assert ( pNode->m_dWords.GetLength()==0 );
+		TagExcluded ( pNode->m_dChildren[0], bNot );
+		TagExcluded ( pNode->m_dChildren[1], !bNot );
 
-			return ( ( ( m_dBits.GetWritePtr()[uIndex>>5] & uBit ) )!=0 ); // NOLINT
-		}
+	} else if ( pNode->m_dChildren.GetLength() )
+	{
+		// FIXME? check if this works okay with "virtually plain" stuff?
+		ARRAY_FOREACH ( i, pNode->m_dChildren )
+			TagExcluded ( pNode->m_dChildren[i], bNot );
+	} else
+	{
+		// tricky bit
+		// no assert on length here and that is intended
+		// we have fully empty nodes (0 children, 0 words) sometimes!
+		ARRAY_FOREACH ( i, pNode->m_dWords )
+			pNode->m_dWords[i].m_bExcluded = bNot;
 	}
-
-private:
-	CSphLargeBuffer<SphDocID_t, false> m_dDocid;
-	CSphLargeBuffer<DWORD, false> m_dBits;
-	bool m_bRawID;
-	SphDocID_t m_iDocidMin;
-	SphDocID_t m_iDocidMax;
-};
+}
 
 
-// no strnlen on some OSes (Mac OS)
-#if !HAVE_STRNLEN
-size_t strnlen ( const char * s, size_t iMaxLen )
+/// optimize phrase queries if we have bigrams
+static void TransformBigrams ( XQNode_t * pNode, const CSphIndexSettings & tSettings )
 {
-	if ( !s )
-		return 0;
+	assert ( tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE );
+	assert ( tSettings.m_eBigramIndex==SPH_BIGRAM_ALL || tSettings.m_dBigramWords.GetLength() );
 
-	size_t iRes = 0;
-	while ( *s++ && iRes<iMaxLen )
-		++iRes;
-	return iRes;
-}
-#endif
-
-
-#define LOC_FAIL(_args) \
-	if ( ++iFails<=FAILS_THRESH ) \
-	{ \
-		fprintf ( fp, "FAILED, " ); \
-		fprintf _args; \
-		fprintf ( fp, "\n" ); \
-		iFailsPrinted++; \
-		\
-		if ( iFails==FAILS_THRESH ) \
-			fprintf ( fp, "(threshold reached; suppressing further output)\n" ); \
+	if ( pNode->GetOp()!=SPH_QUERY_PHRASE )
+	{
+		ARRAY_FOREACH ( i, pNode->m_dChildren )
+			TransformBigrams ( pNode->m_dChildren[i], tSettings );
+		return;
 	}
 
+	CSphBitvec bmRemove;
+	bmRemove.Init ( pNode->m_dWords.GetLength() );
 
-int CSphIndex_VLN::DebugCheck ( FILE * fp )
-{
-	int64_t tmCheck = sphMicroTimer();
-	int64_t iFails = 0;
-	int iFailsPrinted = 0;
-	const int FAILS_THRESH = 100;
-
-	// check if index is ready
-	if ( !m_bPassedAlloc )
-		LOC_FAIL(( fp, "index not preread" ));
+	for ( int i=0; i<pNode->m_dWords.GetLength()-1; i++ )
+	{
+		// check whether this pair was indexed
+		bool bBigram = false;
+		switch ( tSettings.m_eBigramIndex )
+		{
+			case SPH_BIGRAM_NONE:
+				break;
+			case SPH_BIGRAM_ALL:
+				bBigram = true;
+				break;
+			case SPH_BIGRAM_FIRSTFREQ:
+				bBigram = tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i].m_sWord )!=NULL;
+				break;
+			case SPH_BIGRAM_BOTHFREQ:
+				bBigram =
+					( tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i].m_sWord )!=NULL ) &&
+					( tSettings.m_dBigramWords.BinarySearch ( pNode->m_dWords[i+1].m_sWord )!=NULL );
+				break;
+		}
+		if ( !bBigram )
+			continue;
 
-	bool bProgress = isatty ( fileno ( fp ) )!=0;
+		// replace the pair with a bigram keyword
+		// FIXME!!! set phrase weight for this "word" here
+		pNode->m_dWords[i].m_sWord.SetSprintf ( "%s%c%s",
+			pNode->m_dWords[i].m_sWord.cstr(),
+			MAGIC_WORD_BIGRAM,
+			pNode->m_dWords[i+1].m_sWord.cstr() );
 
-	//////////////
-	// open files
-	//////////////
+		// only mark for removal now, we will sweep later
+		// so that [a b c] would convert to ["a b" "b c"], not just ["a b" c]
+		bmRemove.BitClear ( i );
+		bmRemove.BitSet ( i+1 );
+	}
 
-	CSphString sError;
-	CSphAutoreader rdDocs, rdHits;
-	CSphAutoreader rdDict;
-	CSphAutoreader rdSkips;
-	int64_t iSkiplistLen = 0;
+	// remove marked words
+	int iOut = 0;
+	ARRAY_FOREACH ( i, pNode->m_dWords )
+		if ( !bmRemove.BitGet(i) )
+			pNode->m_dWords[iOut++] = pNode->m_dWords[i];
+	pNode->m_dWords.Resize ( iOut );
 
-	if ( !rdDict.Open ( GetIndexFileName("spi").cstr(), sError ) )
-		LOC_FAIL(( fp, "unable to open dictionary: %s", sError.cstr() ));
+	// fixup nodes that are not real phrases any more
+	if ( pNode->m_dWords.GetLength()==1 )
+		pNode->SetOp ( SPH_QUERY_AND );
+}
 
-	if ( !rdDocs.Open ( GetIndexFileName("spd"), sError ) )
-		LOC_FAIL(( fp, "unable to open doclist: %s", sError.cstr() ));
 
-	if ( !rdHits.Open ( GetIndexFileName("spp"), sError ) )
-		LOC_FAIL(( fp, "unable to open hitlist: %s", sError.cstr() ));
+/// create a node from a set of lemmas
+/// WARNING, tKeyword might or might not be pointing to pNode->m_dWords[0]
+/// Called from the daemon side (searchd) in time of query
+static void TransformAotFilterKeyword ( XQNode_t * pNode, const XQKeyword_t & tKeyword, const CSphWordforms * pWordforms, const CSphIndexSettings & tSettings )
+{
+	assert ( pNode->m_dWords.GetLength()<=1 );
+	assert ( pNode->m_dChildren.GetLength()==0 );
 
-	if ( m_bHaveSkips )
+	XQNode_t * pExact = NULL;
+	if ( pWordforms )
 	{
-		if ( !rdSkips.Open ( GetIndexFileName ( "spe" ), sError ) )
-			LOC_FAIL ( ( fp, "unable to open skiplist: %s", sError.cstr () ) );
-		iSkiplistLen = rdSkips.GetFilesize();
+		// do a copy, because patching in place is not an option
+		// short => longlonglong wordform mapping would crash
+		// OPTIMIZE? forms that are not found will (?) get looked up again in the dict
+		char sBuf [ MAX_KEYWORD_BYTES ];
+		strncpy ( sBuf, tKeyword.m_sWord.cstr(), sizeof(sBuf) );
+		if ( pWordforms->ToNormalForm ( (BYTE*)sBuf, true, false ) )
+		{
+			if ( !pNode->m_dWords.GetLength() )
+				pNode->m_dWords.Add ( tKeyword );
+			pNode->m_dWords[0].m_sWord = sBuf;
+			pNode->m_dWords[0].m_bMorphed = true;
+			return;
+		}
 	}
 
-	CSphAutoreader rdAttr;
-	CSphAutoreader rdString;
-	CSphAutoreader rdMva;
-	int64_t iStrEnd = 0;
-	int64_t iMvaEnd = 0;
-
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_tAttr.IsEmpty() )
+	CSphVector<CSphString> dLemmas;
+	DWORD uLangMask = tSettings.m_uAotFilterMask;
+	for ( int i=AOT_BEGIN; i<AOT_LENGTH; ++i )
 	{
-		fprintf ( fp, "checking rows...\n" );
-
-		if ( !rdAttr.Open ( GetIndexFileName("spa").cstr(), sError ) )
-			LOC_FAIL(( fp, "unable to open attributes: %s", sError.cstr() ));
-
-		if ( !rdString.Open ( GetIndexFileName("sps").cstr(), sError ) )
-			LOC_FAIL(( fp, "unable to open strings: %s", sError.cstr() ));
-
-		if ( !rdMva.Open ( GetIndexFileName("spm").cstr(), sError ) )
-			LOC_FAIL(( fp, "unable to open MVA: %s", sError.cstr() ));
+		if ( uLangMask & (1UL<<i) )
+		{
+			if ( i==AOT_RU )
+				sphAotLemmatizeRu ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr() );
+			else if ( i==AOT_DE )
+				sphAotLemmatizeDe ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr() );
+			else
+				sphAotLemmatize ( dLemmas, (BYTE*)tKeyword.m_sWord.cstr(), i );
+		}
 	}
 
-	CSphVector<SphWordID_t> dHitlessWords;
-	if ( !LoadHitlessWords ( dHitlessWords ) )
-		LOC_FAIL(( fp, "unable to load hitless words: %s", m_sLastError.cstr() ));
-
-	CSphSavedFile tStat;
-	const CSphTokenizerSettings & tTokenizerSettings = m_pTokenizer->GetSettings ();
-	if ( !tTokenizerSettings.m_sSynonymsFile.IsEmpty() && !GetFileStats ( tTokenizerSettings.m_sSynonymsFile.cstr(), tStat, &sError ) )
-		LOC_FAIL(( fp, "unable to open exceptions '%s': %s", tTokenizerSettings.m_sSynonymsFile.cstr(), sError.cstr() ));
-
-	const CSphDictSettings & tDictSettings = m_pDict->GetSettings ();
-	const char * pStop = tDictSettings.m_sStopwords.cstr();
-	for ( ;; )
+	// post-morph wordforms
+	if ( pWordforms && pWordforms->m_bHavePostMorphNF )
 	{
-		// find next name start
-		while ( pStop && *pStop && isspace(*pStop) ) pStop++;
-		if ( !pStop || !*pStop ) break;
-
-		const char * sNameStart = pStop;
-
-		// find next name end
-		while ( *pStop && !isspace(*pStop) ) pStop++;
+		char sBuf [ MAX_KEYWORD_BYTES ];
+		ARRAY_FOREACH ( i, dLemmas )
+		{
+			strncpy ( sBuf, dLemmas[i].cstr(), sizeof(sBuf) );
+			if ( pWordforms->ToNormalForm ( (BYTE*)sBuf, false, false ) )
+				dLemmas[i] = sBuf;
+		}
+	}
 
-		CSphString sStopFile;
-		sStopFile.SetBinary ( sNameStart, pStop-sNameStart );
+	if ( dLemmas.GetLength() && tSettings.m_bIndexExactWords )
+	{
+		pExact = CloneKeyword ( pNode );
+		if ( !pExact->m_dWords.GetLength() )
+			pExact->m_dWords.Add ( tKeyword );
 
-		if ( !GetFileStats ( sStopFile.cstr(), tStat, &sError ) )
-			LOC_FAIL(( fp, "unable to open stopwords '%s': %s", sStopFile.cstr(), sError.cstr() ));
+		pExact->m_dWords[0].m_sWord.SetSprintf ( "=%s", tKeyword.m_sWord.cstr() );
+		pExact->m_pParent = pNode;
 	}
 
-	if ( !tDictSettings.m_dWordforms.GetLength() )
+	if ( !pExact && dLemmas.GetLength()<=1 )
 	{
-		ARRAY_FOREACH ( i, tDictSettings.m_dWordforms )
+		// zero or one lemmas, update node in-place
+		if ( !pNode->m_dWords.GetLength() )
+			pNode->m_dWords.Add ( tKeyword );
+		if ( dLemmas.GetLength() )
 		{
-			if ( !GetFileStats ( tDictSettings.m_dWordforms[i].cstr(), tStat, &sError ) )
-				LOC_FAIL(( fp, "unable to open wordforms '%s': %s", tDictSettings.m_dWordforms[i].cstr(), sError.cstr() ));
+			pNode->m_dWords[0].m_sWord = dLemmas[0];
+			pNode->m_dWords[0].m_bMorphed = true;
+		}
+	} else
+	{
+		// multiple lemmas, create an OR node
+		pNode->SetOp ( SPH_QUERY_OR );
+		ARRAY_FOREACH ( i, dLemmas )
+		{
+			pNode->m_dChildren.Add ( new XQNode_t ( pNode->m_dSpec ) );
+			pNode->m_dChildren.Last()->m_pParent = pNode;
+			XQKeyword_t & tLemma = pNode->m_dChildren.Last()->m_dWords.Add();
+			tLemma.m_sWord = dLemmas[i];
+			tLemma.m_iAtomPos = tKeyword.m_iAtomPos;
+			tLemma.m_bFieldStart = tKeyword.m_bFieldStart;
+			tLemma.m_bFieldEnd = tKeyword.m_bFieldEnd;
+			tLemma.m_bMorphed = true;
 		}
+		pNode->m_dWords.Reset();
+		if ( pExact )
+			pNode->m_dChildren.Add ( pExact );
 	}
+}
 
-	////////////////////
-	// check dictionary
-	////////////////////
-
-	fprintf ( fp, "checking dictionary...\n" );
 
-	SphWordID_t uWordid = 0;
-	int64_t iDoclistOffset = 0;
-	int iWordsTotal = 0;
+/// AOT morph guesses transform
+/// replaces tokens with their respective morph guesses subtrees
+/// used in lemmatize_ru_all morphology processing mode that can generate multiple guesses
+/// in other modes, there is always exactly one morph guess, and the dictionary handles it
+/// Called from the daemon side (searchd)
+void TransformAotFilter ( XQNode_t * pNode, const CSphWordforms * pWordforms, const CSphIndexSettings & tSettings )
+{
+	// case one, regular operator (and empty nodes)
+	ARRAY_FOREACH ( i, pNode->m_dChildren )
+		TransformAotFilter ( pNode->m_dChildren[i], pWordforms, tSettings );
+	if ( pNode->m_dChildren.GetLength() || pNode->m_dWords.GetLength()==0 )
+		return;
 
-	char sWord[MAX_KEYWORD_BYTES], sLastWord[MAX_KEYWORD_BYTES];
-	memset ( sWord, 0, sizeof(sWord) );
-	memset ( sLastWord, 0, sizeof(sLastWord) );
+	// case two, operator on a bag of words
+	// FIXME? check phrase vs expand_keywords vs lemmatize_ru_all?
+	if ( pNode->m_dWords.GetLength()
+		&& ( pNode->GetOp()==SPH_QUERY_PHRASE || pNode->GetOp()==SPH_QUERY_PROXIMITY || pNode->GetOp()==SPH_QUERY_QUORUM ) )
+	{
+		assert ( pNode->m_dWords.GetLength() );
 
-	const int iWordPerCP = m_uVersion>=21 ? SPH_WORDLIST_CHECKPOINT : 1024;
-	const bool bWordDict = m_pDict->GetSettings().m_bWordDict;
+		ARRAY_FOREACH ( i, pNode->m_dWords )
+		{
+			XQNode_t * pNew = new XQNode_t ( pNode->m_dSpec );
+			pNew->m_pParent = pNode;
+			pNew->m_iAtomPos = pNode->m_dWords[i].m_iAtomPos;
+			pNode->m_dChildren.Add ( pNew );
+			TransformAotFilterKeyword ( pNew, pNode->m_dWords[i], pWordforms, tSettings );
+		}
 
-	CSphVector<CSphWordlistCheckpoint> dCheckpoints;
-	dCheckpoints.Reserve ( m_tWordlist.m_dCheckpoints.GetLength() );
-	CSphVector<char> dCheckpointWords;
-	dCheckpointWords.Reserve ( m_tWordlist.m_pWords.GetLength() );
+		pNode->m_dWords.Reset();
+		pNode->m_bVirtuallyPlain = true;
+		return;
+	}
 
-	if ( bWordDict && m_uVersion<21 )
-		LOC_FAIL(( fp, "dictionary needed index version not less then 21 (readed=%d)"
-			, m_uVersion ));
+	// case three, plain old single keyword
+	assert ( pNode->m_dWords.GetLength()==1 );
+	TransformAotFilterKeyword ( pNode, pNode->m_dWords[0], pWordforms, tSettings );
+}
 
-	rdDict.GetByte();
-	int iLastSkipsOffset = 0;
-	SphOffset_t iWordsEnd = m_tWordlist.m_iWordsEnd;
 
-	while ( rdDict.GetPos()!=iWordsEnd && !m_bIsEmpty )
-	{
-		// sanity checks
-		if ( rdDict.GetPos()>=iWordsEnd )
-		{
-			LOC_FAIL(( fp, "reading past checkpoints" ));
-			break;
-		}
+void sphTransformExtendedQuery ( XQNode_t ** ppNode, const CSphIndexSettings & tSettings, bool bHasBooleanOptimization, const ISphKeywordsStat * pKeywords )
+{
+	TransformQuorum ( ppNode );
+	( *ppNode )->Check ( true );
+	TransformNear ( ppNode );
+	( *ppNode )->Check ( true );
+	if ( tSettings.m_eBigramIndex!=SPH_BIGRAM_NONE )
+		TransformBigrams ( *ppNode, tSettings );
+	TagExcluded ( *ppNode, false );
+	( *ppNode )->Check ( true );
 
-		// store current entry pos (for checkpointing later), read next delta
-		const int64_t iDictPos = rdDict.GetPos();
-		SphWordID_t iDeltaWord = 0;
-		if ( bWordDict )
-		{
-			iDeltaWord = rdDict.GetByte();
-		} else
-		{
-			iDeltaWord = rdDict.UnzipWordid();
-		}
+	// boolean optimization
+	if ( bHasBooleanOptimization )
+		sphOptimizeBoolean ( ppNode, pKeywords );
+}
 
-		// checkpoint encountered, handle it
-		if ( !iDeltaWord )
-		{
-			rdDict.UnzipOffset();
 
-			if ( ( iWordsTotal%iWordPerCP )!=0 && rdDict.GetPos()!=iWordsEnd )
-				LOC_FAIL(( fp, "unexpected checkpoint (pos=" INT64_FMT ", word=%d, words=%d, expected=%d)",
-					iDictPos, iWordsTotal, ( iWordsTotal%iWordPerCP ), iWordPerCP ));
+struct CmpPSortersByRandom_fn
+{
+	inline bool IsLess ( const ISphMatchSorter * a, const ISphMatchSorter * b ) const
+	{
+		assert ( a );
+		assert ( b );
+		return a->m_bRandomize < b->m_bRandomize;
+	}
+};
 
-			uWordid = 0;
-			iDoclistOffset = 0;
-			continue;
-		}
 
-		SphWordID_t uNewWordid = 0;
-		SphOffset_t iNewDoclistOffset = 0;
-		int iDocs = 0;
-		int iHits = 0;
-		bool bHitless = false;
+/// one regular query vs many sorters
+bool CSphIndex_VLN::MultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult,
+	int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
+{
+	assert ( pQuery );
+	CSphQueryProfile * pProfile = pResult->m_pProfile;
 
-		if ( bWordDict )
-		{
-			// unpack next word
-			// must be in sync with DictEnd()!
-			BYTE uPack = (BYTE)iDeltaWord;
-			int iMatch, iDelta;
-			if ( uPack & 0x80 )
-			{
-				iDelta = ( ( uPack>>4 ) & 7 ) + 1;
-				iMatch = uPack & 15;
-			} else
-			{
-				iDelta = uPack & 127;
-				iMatch = rdDict.GetByte();
-			}
-			const int iLastWordLen = strlen(sLastWord);
-			if ( iMatch+iDelta>=(int)sizeof(sLastWord)-1 || iMatch>iLastWordLen )
-			{
-				LOC_FAIL(( fp, "wrong word-delta (pos=" INT64_FMT ", word=%s, len=%d, begin=%d, delta=%d)",
-					iDictPos, sLastWord, iLastWordLen, iMatch, iDelta ));
-				rdDict.SkipBytes ( iDelta );
-			} else
-			{
-				rdDict.GetBytes ( sWord+iMatch, iDelta );
-				sWord [ iMatch+iDelta ] = '\0';
-			}
+	MEMORY ( MEM_DISK_QUERY );
 
-			iNewDoclistOffset = rdDict.UnzipOffset();
-			iDocs = rdDict.UnzipInt();
-			iHits = rdDict.UnzipInt();
-			int iHint = 0;
-			if ( iDocs>=DOCLIST_HINT_THRESH )
-			{
-				iHint = rdDict.GetByte();
-			}
-			iHint = DoclistHintUnpack ( iDocs, (BYTE)iHint );
+	CSphMatchArena tArena;
+	tArena.Start();
 
-			if ( m_tSettings.m_eHitless==SPH_HITLESS_SOME && ( iDocs & HITLESS_DOC_FLAG )!=0 )
-			{
-				iDocs = ( iDocs & HITLESS_DOC_MASK );
-				bHitless = true;
-			}
+	// to avoid the checking of a ppSorters's element for NULL on every next step, just filter out all nulls right here
+	CSphVector<ISphMatchSorter*> dSorters;
+	dSorters.Reserve ( iSorters );
+	for ( int i=0; i<iSorters; i++ )
+		if ( ppSorters[i] )
+			dSorters.Add ( ppSorters[i] );
 
-			const int iNewWordLen = strlen(sWord);
+	iSorters = dSorters.GetLength();
 
-			if ( iNewWordLen==0 )
-				LOC_FAIL(( fp, "empty word in dictionary (pos=" INT64_FMT ")",
-					iDictPos ));
+	// if we have anything to work with
+	if ( iSorters==0 )
+		return false;
 
-			if ( iLastWordLen && iNewWordLen )
-				if ( sphDictCmpStrictly ( sWord, iNewWordLen, sLastWord, iLastWordLen )<=0 )
-					LOC_FAIL(( fp, "word order decreased (pos=" INT64_FMT ", word=%s, prev=%s)",
-						iDictPos, sLastWord, sWord ));
+	// non-random at the start, random at the end
+	dSorters.Sort ( CmpPSortersByRandom_fn() );
 
-			if ( iHint<0 )
-				LOC_FAIL(( fp, "invalid word hint (pos=" INT64_FMT ", word=%s, hint=%d)",
-					iDictPos, sWord, iHint ));
+	// fast path for scans
+	if ( pQuery->m_sQuery.IsEmpty() )
+		return MultiScan ( pQuery, pResult, iSorters, &dSorters[0], tArgs );
 
-			if ( iDocs<=0 || iHits<=0 || iHits<iDocs )
-				LOC_FAIL(( fp, "invalid docs/hits (pos=" INT64_FMT ", word=%s, docs=" INT64_FMT ", hits=" INT64_FMT ")",
-					(int64_t)iDictPos, sWord, (int64_t)iDocs, (int64_t)iHits ));
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_DICT_SETUP );
 
-			memcpy ( sLastWord, sWord, sizeof(sLastWord) );
-		} else
-		{
-			// finish reading the entire entry
-			uNewWordid = uWordid + iDeltaWord;
-			iNewDoclistOffset = iDoclistOffset + rdDict.UnzipOffset();
-			iDocs = rdDict.UnzipInt();
-			iHits = rdDict.UnzipInt();
-			bHitless = ( dHitlessWords.BinarySearch ( uNewWordid )!=NULL );
-			if ( bHitless )
-				iDocs = ( iDocs & HITLESS_DOC_MASK );
+	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
+	CSphDict * pDictBase = m_pDict;
+	if ( pDictBase->HasState() )
+		tDictCloned = pDictBase = pDictBase->Clone();
 
-			if ( uNewWordid<=uWordid )
-				LOC_FAIL(( fp, "wordid decreased (pos=" INT64_FMT ", wordid=" UINT64_FMT ", previd=" UINT64_FMT ")",
-					(int64_t)iDictPos, (uint64_t)uNewWordid, (uint64_t)uWordid ));
+	CSphScopedPtr<CSphDict> tDict ( NULL );
+	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
 
-			if ( iNewDoclistOffset<=iDoclistOffset )
-				LOC_FAIL(( fp, "doclist offset decreased (pos=" INT64_FMT ", wordid=" UINT64_FMT ")",
-					(int64_t)iDictPos, (uint64_t)uNewWordid ));
+	CSphScopedPtr<CSphDict> tDict2 ( NULL );
+	pDict = SetupExactDict ( tDict2, pDict );
 
-			if ( iDocs<=0 || iHits<=0 || iHits<iDocs )
-				LOC_FAIL(( fp, "invalid docs/hits (pos=" INT64_FMT ", wordid=" UINT64_FMT ", docs=" INT64_FMT ", hits=" INT64_FMT ", hitless=%s)",
-					(int64_t)iDictPos, (uint64_t)uNewWordid, (int64_t)iDocs, (int64_t)iHits, ( bHitless?"true":"false" ) ));
-		}
+	CSphVector<BYTE> dFiltered;
+	const BYTE * sModifiedQuery = (BYTE *)pQuery->m_sQuery.cstr();
 
-		// skiplist
-		if ( m_bHaveSkips && iDocs>SPH_SKIPLIST_BLOCK && !bHitless )
-		{
-			int iSkipsOffset = rdDict.UnzipInt();
-			if ( !bWordDict && iSkipsOffset<iLastSkipsOffset )
-				LOC_FAIL(( fp, "descending skiplist pos (last=%d, cur=%d, wordid=%llu)",
-					iLastSkipsOffset, iSkipsOffset, UINT64 ( uNewWordid ) ));
-			iLastSkipsOffset = iSkipsOffset;
-		}
+	CSphScopedPtr<ISphFieldFilter> pFieldFilter ( NULL );
+	if ( m_pFieldFilter )
+	{
+		pFieldFilter = m_pFieldFilter->Clone();
+		if ( pFieldFilter.Ptr() && pFieldFilter->Apply ( sModifiedQuery, strlen ( (char*)sModifiedQuery ), dFiltered, true ) )
+			sModifiedQuery = dFiltered.Begin();
+	}
 
-		// update stats, add checkpoint
-		if ( ( iWordsTotal%iWordPerCP )==0 )
-		{
-			CSphWordlistCheckpoint & tCP = dCheckpoints.Add();
-			tCP.m_iWordlistOffset = iDictPos;
+	// parse query
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_PARSE );
 
-			if ( bWordDict )
-			{
-				const int iLen = strlen ( sWord );
-				char * sArenaWord = dCheckpointWords.AddN ( iLen + 1 );
-				memcpy ( sArenaWord, sWord, iLen );
-				sArenaWord[iLen] = '\0';
-				tCP.m_uWordID = sArenaWord - dCheckpointWords.Begin();
-			} else
-				tCP.m_uWordID = uNewWordid;
-		}
+	XQQuery_t tParsed;
+	if ( !sphParseExtendedQuery ( tParsed, (const char*)sModifiedQuery, pQuery, m_pQueryTokenizer, &m_tSchema, pDict, m_tSettings ) )
+	{
+		// FIXME? might wanna reset profile to unknown state
+		pResult->m_sError = tParsed.m_sParseError;
+		return false;
+	}
+	if ( !tParsed.m_sParseWarning.IsEmpty() )
+		pResult->m_sWarning = tParsed.m_sParseWarning;
 
-		// TODO add back infix checking
+	// transform query if needed (quorum transform, etc.)
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_TRANSFORMS );
+	sphTransformExtendedQuery ( &tParsed.m_pRoot, m_tSettings, pQuery->m_bSimplify, this );
 
-		uWordid = uNewWordid;
-		iDoclistOffset = iNewDoclistOffset;
-		iWordsTotal++;
+	if ( m_bExpandKeywords )
+	{
+		tParsed.m_pRoot = sphQueryExpandKeywords ( tParsed.m_pRoot, m_tSettings );
+		tParsed.m_pRoot->Check ( true );
 	}
 
-	// check the checkpoints
-	if ( dCheckpoints.GetLength()!=m_tWordlist.m_dCheckpoints.GetLength() )
-		LOC_FAIL(( fp, "checkpoint count mismatch (read=%d, calc=%d)",
-			m_tWordlist.m_dCheckpoints.GetLength(), dCheckpoints.GetLength() ));
+	// this should be after keyword expansion
+	if ( m_tSettings.m_uAotFilterMask )
+		TransformAotFilter ( tParsed.m_pRoot, pDict->GetWordforms(), m_tSettings );
+
+	SphWordStatChecker_t tStatDiff;
+	tStatDiff.Set ( pResult->m_hWordStats );
+
+	// expanding prefix in word dictionary case
+	CSphScopedPayload tPayloads;
+	XQNode_t * pPrefixed = ExpandPrefix ( tParsed.m_pRoot, pResult, &tPayloads, pQuery->m_uDebugFlags );
+	if ( !pPrefixed )
+		return false;
+	tParsed.m_pRoot = pPrefixed;
+
+	if ( !sphCheckQueryHeight ( tParsed.m_pRoot, pResult->m_sError ) )
+		return false;
+
+	// flag common subtrees
+	int iCommonSubtrees = 0;
+	if ( m_iMaxCachedDocs && m_iMaxCachedHits )
+		iCommonSubtrees = sphMarkCommonSubtrees ( 1, &tParsed );
+
+	tParsed.m_bNeedSZlist = pQuery->m_bZSlist;
+
+	CSphQueryNodeCache tNodeCache ( iCommonSubtrees, m_iMaxCachedDocs, m_iMaxCachedHits );
+	bool bResult = ParsedMultiQuery ( pQuery, pResult, iSorters, &dSorters[0], tParsed, pDict, tArgs, &tNodeCache, tStatDiff );
+
+	return bResult;
+}
+
+
+/// many regular queries with one sorter attached to each query.
+/// returns true if at least one query succeeded. The failed queries indicated with pResult->m_iMultiplier==-1
+bool CSphIndex_VLN::MultiQueryEx ( int iQueries, const CSphQuery * pQueries,
+	CSphQueryResult ** ppResults, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const
+{
+	// ensure we have multiple queries
+	assert ( ppResults );
+	if ( iQueries==1 )
+		return MultiQuery ( pQueries, ppResults[0], 1, ppSorters, tArgs );
+
+	MEMORY ( MEM_DISK_QUERYEX );
+
+	CSphMatchArena tArena;
+	tArena.Start();
+
+	assert ( pQueries );
+	assert ( ppSorters );
+
+	CSphScopedPtr<CSphDict> tDictCloned ( NULL );
+	CSphDict * pDictBase = m_pDict;
+	if ( pDictBase->HasState() )
+		tDictCloned = pDictBase = pDictBase->Clone();
+
+	CSphScopedPtr<CSphDict> tDict ( NULL );
+	CSphDict * pDict = SetupStarDict ( tDict, pDictBase );
+
+	CSphScopedPtr<CSphDict> tDict2 ( NULL );
+	pDict = SetupExactDict ( tDict2, pDict );
+
+	CSphFixedVector<XQQuery_t> dXQ ( iQueries );
+	CSphFixedVector<SphWordStatChecker_t> dStatChecker ( iQueries );
+	CSphScopedPayload tPayloads;
+	bool bResult = false;
+	bool bResultScan = false;
+	for ( int i=0; i<iQueries; i++ )
+	{
+		// nothing to do without a sorter
+		if ( !ppSorters[i] )
+		{
+			ppResults[i]->m_iMultiplier = -1; ///< show that this particular query failed
+			continue;
+		}
+
+		// fast path for scans
+		if ( pQueries[i].m_sQuery.IsEmpty() )
+		{
+			if ( MultiScan ( pQueries + i, ppResults[i], 1, &ppSorters[i], tArgs ) )
+				bResultScan = true;
+			else
+				ppResults[i]->m_iMultiplier = -1; ///< show that this particular query failed
+			continue;
+		}
+
+		ppResults[i]->m_tIOStats.Start();
+
+		// parse query
+		if ( sphParseExtendedQuery ( dXQ[i], pQueries[i].m_sQuery.cstr(), &(pQueries[i]), m_pQueryTokenizer, &m_tSchema, pDict, m_tSettings ) )
+		{
+			// transform query if needed (quorum transform, keyword expansion, etc.)
+			sphTransformExtendedQuery ( &dXQ[i].m_pRoot, m_tSettings, pQueries[i].m_bSimplify, this );
+
+			if ( m_bExpandKeywords )
+			{
+				dXQ[i].m_pRoot = sphQueryExpandKeywords ( dXQ[i].m_pRoot, m_tSettings );
+				dXQ[i].m_pRoot->Check ( true );
+			}
+
+			// this should be after keyword expansion
+			if ( m_tSettings.m_uAotFilterMask )
+				TransformAotFilter ( dXQ[i].m_pRoot, pDict->GetWordforms(), m_tSettings );
+
+			dStatChecker[i].Set ( ppResults[i]->m_hWordStats );
+
+			// expanding prefix in word dictionary case
+			XQNode_t * pPrefixed = ExpandPrefix ( dXQ[i].m_pRoot, ppResults[i], &tPayloads, pQueries[i].m_uDebugFlags );
+			if ( pPrefixed )
+			{
+				dXQ[i].m_pRoot = pPrefixed;
+
+				if ( sphCheckQueryHeight ( dXQ[i].m_pRoot, ppResults[i]->m_sError ) )
+				{
+					bResult = true;
+				} else
+				{
+					ppResults[i]->m_iMultiplier = -1;
+					SafeDelete ( dXQ[i].m_pRoot );
+				}
+			} else
+			{
+				ppResults[i]->m_iMultiplier = -1;
+				SafeDelete ( dXQ[i].m_pRoot );
+			}
+		} else
+		{
+			ppResults[i]->m_sError = dXQ[i].m_sParseError;
+			ppResults[i]->m_iMultiplier = -1;
+		}
+		if ( !dXQ[i].m_sParseWarning.IsEmpty() )
+			ppResults[i]->m_sWarning = dXQ[i].m_sParseWarning;
+
+		ppResults[i]->m_tIOStats.Stop();
+	}
+
+	// continue only if we have at least one non-failed
+	if ( bResult )
+	{
+		int iCommonSubtrees = 0;
+		if ( m_iMaxCachedDocs && m_iMaxCachedHits )
+			iCommonSubtrees = sphMarkCommonSubtrees ( iQueries, &dXQ[0] );
+
+		CSphQueryNodeCache tNodeCache ( iCommonSubtrees, m_iMaxCachedDocs, m_iMaxCachedHits );
+		bResult = false;
+		for ( int j=0; j<iQueries; j++ )
+		{
+			// fullscan case
+			if ( pQueries[j].m_sQuery.IsEmpty() )
+				continue;
+
+			ppResults[j]->m_tIOStats.Start();
+
+			if ( dXQ[j].m_pRoot && ppSorters[j]
+					&& ParsedMultiQuery ( &pQueries[j], ppResults[j], 1, &ppSorters[j], dXQ[j], pDict, tArgs, &tNodeCache, dStatChecker[j] ) )
+			{
+				bResult = true;
+				ppResults[j]->m_iMultiplier = iCommonSubtrees ? iQueries : 1;
+			} else
+			{
+				ppResults[j]->m_iMultiplier = -1;
+			}
+
+			ppResults[j]->m_tIOStats.Stop();
+		}
+	}
+
+	return bResult | bResultScan;
+}
+
+bool CSphIndex_VLN::ParsedMultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult,
+	int iSorters, ISphMatchSorter ** ppSorters, const XQQuery_t & tXQ, CSphDict * pDict,
+	const CSphMultiQueryArgs & tArgs, CSphQueryNodeCache * pNodeCache, const SphWordStatChecker_t & tStatDiff ) const
+{
+	assert ( pQuery );
+	assert ( pResult );
+	assert ( ppSorters );
+	assert ( !pQuery->m_sQuery.IsEmpty() && pQuery->m_eMode!=SPH_MATCH_FULLSCAN ); // scans must go through MultiScan()
+	assert ( tArgs.m_iTag>=0 );
+
+	// start counting
+	int64_t tmQueryStart = sphMicroTimer();
+
+	CSphQueryProfile * pProfile = pResult->m_pProfile;
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_INIT );
+
+	ScopedThreadPriority_c tPrio ( pQuery->m_bLowPriority );
+
+	///////////////////
+	// setup searching
+	///////////////////
+
+	// non-ready index, empty response!
+	if ( !m_bPassedAlloc )
+	{
+		pResult->m_sError = "index not preread";
+		return false;
+	}
+
+	// select the sorter with max schema
+	int iMaxSchemaSize = -1;
+	int iMaxSchemaIndex = -1;
+	for ( int i=0; i<iSorters; i++ )
+		if ( ppSorters[i]->GetSchema().GetRowSize() > iMaxSchemaSize )
+		{
+			iMaxSchemaSize = ppSorters[i]->GetSchema().GetRowSize();
+			iMaxSchemaIndex = i;
+		}
+
+	// setup calculations and result schema
+	CSphQueryContext tCtx ( *pQuery );
+	tCtx.m_pProfile = pProfile;
+	tCtx.m_pLocalDocs = tArgs.m_pLocalDocs;
+	tCtx.m_iTotalDocs = tArgs.m_iTotalDocs;
+	if ( !tCtx.SetupCalc ( pResult, ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema, m_tMva.GetWritePtr(), m_bArenaProhibit ) )
+		return false;
+
+	// set string pool for string on_sort expression fix up
+	tCtx.SetStringPool ( m_tString.GetWritePtr() );
+
+	tCtx.m_uPackedFactorFlags = tArgs.m_uPackedFactorFlags;
+
+	// open files
+	CSphAutofile tDoclist, tHitlist;
+	if ( !m_bKeepFilesOpen )
+	{
+		if ( pProfile )
+			pProfile->Switch ( SPH_QSTATE_OPEN );
+
+		if ( tDoclist.Open ( GetIndexFileName("spd"), SPH_O_READ, pResult->m_sError ) < 0 )
+			return false;
+
+		if ( tHitlist.Open ( GetIndexFileName ( m_uVersion>=3 ? "spp" : "spd" ), SPH_O_READ, pResult->m_sError ) < 0 )
+			return false;
+	}
+
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_INIT );
+
+	// setup search terms
+	DiskIndexQwordSetup_c tTermSetup ( m_bKeepFilesOpen ? m_tDoclistFile : tDoclist,
+		m_bKeepFilesOpen ? m_tHitlistFile : tHitlist,
+		m_tSkiplists.GetWritePtr(), pProfile );
+
+	tTermSetup.m_pDict = pDict;
+	tTermSetup.m_pIndex = this;
+	tTermSetup.m_eDocinfo = m_tSettings.m_eDocinfo;
+	tTermSetup.m_uMinDocid = m_uMinDocid;
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
+	{
+		tTermSetup.m_iInlineRowitems = m_tSchema.GetRowSize();
+		tTermSetup.m_pMinRow = m_dMinRow.Begin();
+	}
+	tTermSetup.m_iDynamicRowitems = ppSorters[iMaxSchemaIndex]->GetSchema().GetDynamicSize();
+
+	if ( pQuery->m_uMaxQueryMsec>0 )
+		tTermSetup.m_iMaxTimer = sphMicroTimer() + pQuery->m_uMaxQueryMsec*1000; // max_query_time
+	tTermSetup.m_pWarning = &pResult->m_sWarning;
+	tTermSetup.m_bSetupReaders = true;
+	tTermSetup.m_pCtx = &tCtx;
+	tTermSetup.m_pNodeCache = pNodeCache;
+
+	// setup prediction constrain
+	CSphQueryStats tQueryStats;
+	bool bCollectPredictionCounters = ( pQuery->m_iMaxPredictedMsec>0 );
+	int64_t iNanoBudget = (int64_t)(pQuery->m_iMaxPredictedMsec) * 1000000; // from milliseconds to nanoseconds
+	tQueryStats.m_pNanoBudget = &iNanoBudget;
+	if ( bCollectPredictionCounters )
+		tTermSetup.m_pStats = &tQueryStats;
+
+	// bind weights
+	tCtx.BindWeights ( pQuery, m_tSchema, pResult->m_sWarning );
+
+	// setup query
+	// must happen before index-level reject, in order to build proper keyword stats
+	CSphScopedPtr<ISphRanker> pRanker ( sphCreateRanker ( tXQ, pQuery, pResult, tTermSetup, tCtx, ppSorters[iMaxSchemaIndex]->GetSchema() ) );
+	if ( !pRanker.Ptr() )
+		return false;
+
+	tStatDiff.DumpDiffer ( pResult->m_hWordStats, m_sIndexName.cstr(), pResult->m_sWarning );
+
+	if ( ( tArgs.m_uPackedFactorFlags & SPH_FACTOR_ENABLE ) && pQuery->m_eRanker!=SPH_RANK_EXPR )
+		pResult->m_sWarning.SetSprintf ( "packedfactors() and bm25f() requires using an expression ranker" );
+
+	tCtx.SetupExtraData ( pRanker.Ptr(), iSorters==1 ? ppSorters[0] : NULL );
+
+	PoolPtrs_t tMva;
+	tMva.m_pMva = m_tMva.GetWritePtr();
+	tMva.m_bArenaProhibit = m_bArenaProhibit;
+	pRanker->ExtraData ( EXTRA_SET_MVAPOOL, (void**)&tMva );
+	pRanker->ExtraData ( EXTRA_SET_STRINGPOOL, (void**)m_tString.GetWritePtr() );
+
+	int iMatchPoolSize = 0;
+	for ( int i=0; i<iSorters; i++ )
+		iMatchPoolSize += ppSorters[i]->m_iMatchCapacity;
+
+	pRanker->ExtraData ( EXTRA_SET_POOL_CAPACITY, (void**)&iMatchPoolSize );
+
+	// check for the possible integer overflow in m_dPool.Resize
+	int64_t iPoolSize = 0;
+	if ( pRanker->ExtraData ( EXTRA_GET_POOL_SIZE, (void**)&iPoolSize ) && iPoolSize>INT_MAX )
+	{
+		pResult->m_sError.SetSprintf ( "ranking factors pool too big (%d Mb), reduce max_matches", (int)( iPoolSize/1024/1024 ) );
+		return false;
+	}
+
+	// empty index, empty response!
+	if ( m_bIsEmpty )
+		return true;
+	assert ( m_tSettings.m_eDocinfo!=SPH_DOCINFO_EXTERN || !m_tAttr.IsEmpty() ); // check that docinfo is preloaded
+
+	// setup filters
+	tCtx.m_bStringDicts = HasOwnStringDicts ( ppSorters[iMaxSchemaIndex]->GetSchema(), m_tSchema );
+	if ( !tCtx.CreateFilters ( pQuery->m_sQuery.IsEmpty(), &pQuery->m_dFilters, ppSorters[iMaxSchemaIndex]->GetSchema(),
+		m_tMva.GetWritePtr(), m_tString.GetWritePtr(), pResult->m_sError, pResult->m_sWarning, pQuery->m_eCollation, m_bArenaProhibit, tArgs.m_dKillList ) )
+			return false;
+
+	// check if we can early reject the whole index
+	if ( tCtx.m_pFilter && m_iDocinfoIndex )
+	{
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		DWORD * pMinEntry = const_cast<DWORD*> ( &m_pDocinfoIndex [ m_iDocinfoIndex*uStride*2 ] );
+		DWORD * pMaxEntry = pMinEntry + uStride;
+
+		if ( !tCtx.m_pFilter->EvalBlock ( pMinEntry, pMaxEntry ) )
+			return true;
+	}
+
+	// setup lookup
+	tCtx.m_bLookupFilter = ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN ) && pQuery->m_dFilters.GetLength();
+	if ( tCtx.m_dCalcFilter.GetLength() || pQuery->m_eRanker==SPH_RANK_EXPR || pQuery->m_eRanker==SPH_RANK_EXPORT )
+		tCtx.m_bLookupFilter = true; // suboptimal in case of attr-independent expressions, but we don't care
+
+	tCtx.m_bLookupSort = false;
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !tCtx.m_bLookupFilter )
+		for ( int iSorter=0; iSorter<iSorters && !tCtx.m_bLookupSort; iSorter++ )
+			if ( ppSorters[iSorter]->UsesAttrs() )
+				tCtx.m_bLookupSort = true;
+	if ( tCtx.m_dCalcSort.GetLength() )
+		tCtx.m_bLookupSort = true; // suboptimal in case of attr-independent expressions, but we don't care
+
+	// setup sorters vs. MVA
+	for ( int i=0; i<iSorters; i++ )
+	{
+		(ppSorters[i])->SetMVAPool ( m_tMva.GetWritePtr(), m_bArenaProhibit );
+		(ppSorters[i])->SetStringPool ( m_tString.GetWritePtr() );
+	}
+
+	// setup overrides
+	if ( !tCtx.SetupOverrides ( pQuery, pResult, m_tSchema, ppSorters[iMaxSchemaIndex]->GetSchema() ) )
+		return false;
+
+	//////////////////////////////////////
+	// find and weight matching documents
+	//////////////////////////////////////
+
+	bool bFinalLookup = !tCtx.m_bLookupFilter && !tCtx.m_bLookupSort;
+	bool bFinalPass = bFinalLookup || tCtx.m_dCalcFinal.GetLength();
+	int iMyTag = bFinalPass ? -1 : tArgs.m_iTag;
+
+	switch ( pQuery->m_eMode )
+	{
+		case SPH_MATCH_ALL:
+		case SPH_MATCH_PHRASE:
+		case SPH_MATCH_ANY:
+		case SPH_MATCH_EXTENDED:
+		case SPH_MATCH_EXTENDED2:
+		case SPH_MATCH_BOOLEAN:
+			MatchExtended ( &tCtx, pQuery, iSorters, ppSorters, pRanker.Ptr(), iMyTag, tArgs.m_iIndexWeight );
+			break;
+
+		default:
+			sphDie ( "INTERNAL ERROR: unknown matching mode (mode=%d)", pQuery->m_eMode );
+	}
+
+	////////////////////
+	// cook result sets
+	////////////////////
+
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_FINALIZE );
+
+	// adjust result sets
+	if ( bFinalPass )
+	{
+		// GotUDF means promise to UDFs that final-stage calls will be evaluated
+		// a) over the final, pre-limit result set
+		// b) in the final result set order
+		bool bGotUDF = false;
+		ARRAY_FOREACH_COND ( i, tCtx.m_dCalcFinal, !bGotUDF )
+			tCtx.m_dCalcFinal[i].m_pExpr->Command ( SPH_EXPR_GET_UDF, &bGotUDF );
+
+		SphFinalMatchCalc_t tProcessor ( tArgs.m_iTag, bFinalLookup ? this : NULL, tCtx );
+		for ( int iSorter=0; iSorter<iSorters; iSorter++ )
+		{
+			ISphMatchSorter * pTop = ppSorters[iSorter];
+			pTop->Finalize ( tProcessor, bGotUDF );
+		}
+		pResult->m_iBadRows += tProcessor.m_iBadRows;
+	}
+
+	pRanker->FinalizeCache ( ppSorters[iMaxSchemaIndex]->GetSchema() );
+
+	// mva and string pools ptrs
+	pResult->m_pMva = m_tMva.GetWritePtr();
+	pResult->m_pStrings = m_tString.GetWritePtr();
+	pResult->m_bArenaProhibit = m_bArenaProhibit;
+	pResult->m_iBadRows += tCtx.m_iBadRows;
+
+	// query timer
+	int64_t tmWall = sphMicroTimer() - tmQueryStart;
+	pResult->m_iQueryTime += (int)( tmWall/1000 );
+
+#if 0
+	printf ( "qtm %d, %d, %d, %d, %d\n", int(tmWall), tQueryStats.m_iFetchedDocs,
+		tQueryStats.m_iFetchedHits, tQueryStats.m_iSkips, ppSorters[0]->GetTotalCount() );
+#endif
+
+	if ( pProfile )
+		pProfile->Switch ( SPH_QSTATE_UNKNOWN );
+
+	if ( bCollectPredictionCounters )
+	{
+		pResult->m_tStats.m_iFetchedDocs += tQueryStats.m_iFetchedDocs;
+		pResult->m_tStats.m_iFetchedHits += tQueryStats.m_iFetchedHits;
+		pResult->m_tStats.m_iSkips += tQueryStats.m_iSkips;
+		pResult->m_bHasPrediction = true;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// INDEX STATUS
+//////////////////////////////////////////////////////////////////////////
+
+void CSphIndex_VLN::GetStatus ( CSphIndexStatus* pRes ) const
+{
+	assert ( pRes );
+	if ( !pRes )
+		return;
+	pRes->m_iRamUse = sizeof(CSphIndex_VLN)
+		+ m_dMinRow.GetSizeBytes()
+		+ m_dFieldLens.GetSizeBytes()
+
+		+ m_tDocinfoHash.GetLengthBytes()
+		+ m_tAttr.GetLengthBytes()
+		+ m_tMva.GetLengthBytes()
+		+ m_tString.GetLengthBytes()
+		+ m_tWordlist.m_tBuf.GetLengthBytes()
+		+ m_tKillList.GetLengthBytes()
+		+ m_tSkiplists.GetLengthBytes();
+
+	char sFile [ SPH_MAX_FILENAME_LEN ];
+	pRes->m_iDiskUse = 0;
+	for ( int i=0; i<sphGetExtCount ( m_uVersion ); i++ )
+	{
+		snprintf ( sFile, sizeof(sFile), "%s%s", m_sFilename.cstr(), sphGetExts ( SPH_EXT_TYPE_CUR, m_uVersion )[i] );
+		struct_stat st;
+		if ( stat ( sFile, &st )==0 )
+			pRes->m_iDiskUse += st.st_size;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// INDEX CHECKING
+//////////////////////////////////////////////////////////////////////////
+
+void CSphIndex_VLN::SetDebugCheck ()
+{
+	m_bDebugCheck = true;
+}
+
+static int sphUnpackStrLength ( CSphReader & tReader )
+{
+	int v = tReader.GetByte();
+	if ( v & 0x80 )
+	{
+		if ( v & 0x40 )
+		{
+			v = ( int ( v & 0x3f )<<16 ) + ( int ( tReader.GetByte() )<<8 );
+			v += ( tReader.GetByte() ); // MUST be separate statement; cf. sequence point
+		} else
+		{
+			v = ( int ( v & 0x3f )<<8 ) + ( tReader.GetByte() );
+		}
+	}
+
+	return v;
+}
+
+class CSphDocidList
+{
+public:
+	CSphDocidList ()
+	{
+		m_bRawID = true;
+		m_iDocidMin = DOCID_MAX;
+		m_iDocidMax = 0;
+	}
+
+	~CSphDocidList ()
+	{}
+
+	bool Init ( int iRowSize, int64_t iRows, CSphReader & rdAttr, CSphString & sError )
+	{
+		if ( !iRows )
+			return true;
+
+		int iSkip = sizeof ( CSphRowitem ) * iRowSize;
+
+		rdAttr.SeekTo ( 0, sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
+		m_iDocidMin = rdAttr.GetDocid ();
+		rdAttr.SeekTo ( ( iRows-1 ) * sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ), sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
+		m_iDocidMax = rdAttr.GetDocid();
+		rdAttr.SeekTo ( 0, sizeof ( CSphRowitem ) * ( DOCINFO_IDSIZE + iRowSize ) );
+
+		if ( m_iDocidMax<m_iDocidMin )
+			return true;
+
+		uint64_t uRawBufLenght = sizeof(SphDocID_t) * iRows;
+		uint64_t uBitsBufLenght = ( m_iDocidMax - m_iDocidMin ) / 32;
+		if ( uRawBufLenght<uBitsBufLenght )
+		{
+			if ( !m_dDocid.Alloc ( iRows, sError ) )
+			{
+				sError.SetSprintf ( "unable to allocate doc-id storage: %s", sError.cstr () );
+				return false;
+			}
+		} else
+		{
+			if ( !m_dBits.Alloc ( ( uBitsBufLenght * sizeof(DWORD) )+1, sError ) )
+			{
+				sError.SetSprintf ( "unable to allocate doc-id storage: %s", sError.cstr () );
+				return false;
+			}
+			m_bRawID = false;
+			memset ( m_dBits.GetWritePtr(), 0, m_dBits.GetLengthBytes() );
+		}
+
+		for ( int64_t iRow=0; iRow<iRows && !rdAttr.GetErrorFlag (); iRow++ )
+		{
+			SphDocID_t uDocid = rdAttr.GetDocid ();
+			rdAttr.SkipBytes ( iSkip );
+
+			if ( uDocid<m_iDocidMin || uDocid>m_iDocidMax )
+				continue;
+
+			if ( m_bRawID )
+				m_dDocid.GetWritePtr()[iRow] = uDocid;
+			else
+			{
+				SphDocID_t uIndex = uDocid - m_iDocidMin;
+				DWORD uBit = 1UL<<(uIndex & 31);
+				m_dBits.GetWritePtr()[uIndex>>5] |= uBit;
+			}
+		}
+
+		if ( rdAttr.GetErrorFlag () )
+		{
+			sError.SetSprintf ( "unable to read attributes: %s", rdAttr.GetErrorMessage().cstr() );
+			rdAttr.ResetError();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool HasDocid ( SphDocID_t uDocid )
+	{
+		if ( uDocid<m_iDocidMin || uDocid>m_iDocidMax )
+			return false;
+
+		if ( m_bRawID )
+		{
+			return ( sphBinarySearch ( m_dDocid.GetWritePtr(), m_dDocid.GetWritePtr () + m_dDocid.GetNumEntries() - 1, uDocid )!=NULL );
+		} else
+		{
+			SphDocID_t uIndex = uDocid - m_iDocidMin;
+			DWORD uBit = 1UL<<( uIndex & 31 );
+
+			return ( ( ( m_dBits.GetWritePtr()[uIndex>>5] & uBit ) )!=0 ); // NOLINT
+		}
+	}
+
+private:
+	CSphLargeBuffer<SphDocID_t, false> m_dDocid;
+	CSphLargeBuffer<DWORD, false> m_dBits;
+	bool m_bRawID;
+	SphDocID_t m_iDocidMin;
+	SphDocID_t m_iDocidMax;
+};
+
+
+// no strnlen on some OSes (Mac OS)
+#if !HAVE_STRNLEN
+size_t strnlen ( const char * s, size_t iMaxLen )
+{
+	if ( !s )
+		return 0;
+
+	size_t iRes = 0;
+	while ( *s++ && iRes<iMaxLen )
+		++iRes;
+	return iRes;
+}
+#endif
+
+
+#define LOC_FAIL(_args) \
+	if ( ++iFails<=FAILS_THRESH ) \
+	{ \
+		fprintf ( fp, "FAILED, " ); \
+		fprintf _args; \
+		fprintf ( fp, "\n" ); \
+		iFailsPrinted++; \
+		\
+		if ( iFails==FAILS_THRESH ) \
+			fprintf ( fp, "(threshold reached; suppressing further output)\n" ); \
+	}
+
+
+int CSphIndex_VLN::DebugCheck ( FILE * fp )
+{
+	int64_t tmCheck = sphMicroTimer();
+	int64_t iFails = 0;
+	int iFailsPrinted = 0;
+	const int FAILS_THRESH = 100;
+
+	// check if index is ready
+	if ( !m_bPassedAlloc )
+		LOC_FAIL(( fp, "index not preread" ));
+
+	bool bProgress = isatty ( fileno ( fp ) )!=0;
+
+	//////////////
+	// open files
+	//////////////
+
+	CSphString sError;
+	CSphAutoreader rdDocs, rdHits;
+	CSphAutoreader rdDict;
+	CSphAutoreader rdSkips;
+	int64_t iSkiplistLen = 0;
+
+	if ( !rdDict.Open ( GetIndexFileName("spi").cstr(), sError ) )
+		LOC_FAIL(( fp, "unable to open dictionary: %s", sError.cstr() ));
+
+	if ( !rdDocs.Open ( GetIndexFileName("spd"), sError ) )
+		LOC_FAIL(( fp, "unable to open doclist: %s", sError.cstr() ));
+
+	if ( !rdHits.Open ( GetIndexFileName("spp"), sError ) )
+		LOC_FAIL(( fp, "unable to open hitlist: %s", sError.cstr() ));
+
+	if ( m_bHaveSkips )
+	{
+		if ( !rdSkips.Open ( GetIndexFileName ( "spe" ), sError ) )
+			LOC_FAIL ( ( fp, "unable to open skiplist: %s", sError.cstr () ) );
+		iSkiplistLen = rdSkips.GetFilesize();
+	}
+
+	CSphAutoreader rdAttr;
+	CSphAutoreader rdString;
+	CSphAutoreader rdMva;
+	int64_t iStrEnd = 0;
+	int64_t iMvaEnd = 0;
+
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_tAttr.IsEmpty() )
+	{
+		fprintf ( fp, "checking rows...\n" );
+
+		if ( !rdAttr.Open ( GetIndexFileName("spa").cstr(), sError ) )
+			LOC_FAIL(( fp, "unable to open attributes: %s", sError.cstr() ));
+
+		if ( !rdString.Open ( GetIndexFileName("sps").cstr(), sError ) )
+			LOC_FAIL(( fp, "unable to open strings: %s", sError.cstr() ));
+
+		if ( !rdMva.Open ( GetIndexFileName("spm").cstr(), sError ) )
+			LOC_FAIL(( fp, "unable to open MVA: %s", sError.cstr() ));
+	}
+
+	CSphVector<SphWordID_t> dHitlessWords;
+	if ( !LoadHitlessWords ( dHitlessWords ) )
+		LOC_FAIL(( fp, "unable to load hitless words: %s", m_sLastError.cstr() ));
+
+	CSphSavedFile tStat;
+	const CSphTokenizerSettings & tTokenizerSettings = m_pTokenizer->GetSettings ();
+	if ( !tTokenizerSettings.m_sSynonymsFile.IsEmpty() && !GetFileStats ( tTokenizerSettings.m_sSynonymsFile.cstr(), tStat, &sError ) )
+		LOC_FAIL(( fp, "unable to open exceptions '%s': %s", tTokenizerSettings.m_sSynonymsFile.cstr(), sError.cstr() ));
+
+	const CSphDictSettings & tDictSettings = m_pDict->GetSettings ();
+	const char * pStop = tDictSettings.m_sStopwords.cstr();
+	for ( ;; )
+	{
+		// find next name start
+		while ( pStop && *pStop && isspace(*pStop) ) pStop++;
+		if ( !pStop || !*pStop ) break;
+
+		const char * sNameStart = pStop;
+
+		// find next name end
+		while ( *pStop && !isspace(*pStop) ) pStop++;
+
+		CSphString sStopFile;
+		sStopFile.SetBinary ( sNameStart, pStop-sNameStart );
+
+		if ( !GetFileStats ( sStopFile.cstr(), tStat, &sError ) )
+			LOC_FAIL(( fp, "unable to open stopwords '%s': %s", sStopFile.cstr(), sError.cstr() ));
+	}
+
+	if ( !tDictSettings.m_dWordforms.GetLength() )
+	{
+		ARRAY_FOREACH ( i, tDictSettings.m_dWordforms )
+		{
+			if ( !GetFileStats ( tDictSettings.m_dWordforms[i].cstr(), tStat, &sError ) )
+				LOC_FAIL(( fp, "unable to open wordforms '%s': %s", tDictSettings.m_dWordforms[i].cstr(), sError.cstr() ));
+		}
+	}
+
+	////////////////////
+	// check dictionary
+	////////////////////
+
+	fprintf ( fp, "checking dictionary...\n" );
+
+	SphWordID_t uWordid = 0;
+	int64_t iDoclistOffset = 0;
+	int iWordsTotal = 0;
+
+	char sWord[MAX_KEYWORD_BYTES], sLastWord[MAX_KEYWORD_BYTES];
+	memset ( sWord, 0, sizeof(sWord) );
+	memset ( sLastWord, 0, sizeof(sLastWord) );
+
+	const int iWordPerCP = m_uVersion>=21 ? SPH_WORDLIST_CHECKPOINT : 1024;
+	const bool bWordDict = m_pDict->GetSettings().m_bWordDict;
+
+	CSphVector<CSphWordlistCheckpoint> dCheckpoints;
+	dCheckpoints.Reserve ( m_tWordlist.m_dCheckpoints.GetLength() );
+	CSphVector<char> dCheckpointWords;
+	dCheckpointWords.Reserve ( m_tWordlist.m_pWords.GetLength() );
+
+	if ( bWordDict && m_uVersion<21 )
+		LOC_FAIL(( fp, "dictionary needed index version not less then 21 (readed=%d)"
+			, m_uVersion ));
+
+	rdDict.GetByte();
+	int iLastSkipsOffset = 0;
+	SphOffset_t iWordsEnd = m_tWordlist.m_iWordsEnd;
+
+	while ( rdDict.GetPos()!=iWordsEnd && !m_bIsEmpty )
+	{
+		// sanity checks
+		if ( rdDict.GetPos()>=iWordsEnd )
+		{
+			LOC_FAIL(( fp, "reading past checkpoints" ));
+			break;
+		}
+
+		// store current entry pos (for checkpointing later), read next delta
+		const int64_t iDictPos = rdDict.GetPos();
+		SphWordID_t iDeltaWord = 0;
+		if ( bWordDict )
+		{
+			iDeltaWord = rdDict.GetByte();
+		} else
+		{
+			iDeltaWord = rdDict.UnzipWordid();
+		}
+
+		// checkpoint encountered, handle it
+		if ( !iDeltaWord )
+		{
+			rdDict.UnzipOffset();
+
+			if ( ( iWordsTotal%iWordPerCP )!=0 && rdDict.GetPos()!=iWordsEnd )
+				LOC_FAIL(( fp, "unexpected checkpoint (pos=" INT64_FMT ", word=%d, words=%d, expected=%d)",
+					iDictPos, iWordsTotal, ( iWordsTotal%iWordPerCP ), iWordPerCP ));
+
+			uWordid = 0;
+			iDoclistOffset = 0;
+			continue;
+		}
+
+		SphWordID_t uNewWordid = 0;
+		SphOffset_t iNewDoclistOffset = 0;
+		int iDocs = 0;
+		int iHits = 0;
+		bool bHitless = false;
+
+		if ( bWordDict )
+		{
+			// unpack next word
+			// must be in sync with DictEnd()!
+			BYTE uPack = (BYTE)iDeltaWord;
+			int iMatch, iDelta;
+			if ( uPack & 0x80 )
+			{
+				iDelta = ( ( uPack>>4 ) & 7 ) + 1;
+				iMatch = uPack & 15;
+			} else
+			{
+				iDelta = uPack & 127;
+				iMatch = rdDict.GetByte();
+			}
+			const int iLastWordLen = strlen(sLastWord);
+			if ( iMatch+iDelta>=(int)sizeof(sLastWord)-1 || iMatch>iLastWordLen )
+			{
+				LOC_FAIL(( fp, "wrong word-delta (pos=" INT64_FMT ", word=%s, len=%d, begin=%d, delta=%d)",
+					iDictPos, sLastWord, iLastWordLen, iMatch, iDelta ));
+				rdDict.SkipBytes ( iDelta );
+			} else
+			{
+				rdDict.GetBytes ( sWord+iMatch, iDelta );
+				sWord [ iMatch+iDelta ] = '\0';
+			}
+
+			iNewDoclistOffset = rdDict.UnzipOffset();
+			iDocs = rdDict.UnzipInt();
+			iHits = rdDict.UnzipInt();
+			int iHint = 0;
+			if ( iDocs>=DOCLIST_HINT_THRESH )
+			{
+				iHint = rdDict.GetByte();
+			}
+			iHint = DoclistHintUnpack ( iDocs, (BYTE)iHint );
+
+			if ( m_tSettings.m_eHitless==SPH_HITLESS_SOME && ( iDocs & HITLESS_DOC_FLAG )!=0 )
+			{
+				iDocs = ( iDocs & HITLESS_DOC_MASK );
+				bHitless = true;
+			}
+
+			const int iNewWordLen = strlen(sWord);
+
+			if ( iNewWordLen==0 )
+				LOC_FAIL(( fp, "empty word in dictionary (pos=" INT64_FMT ")",
+					iDictPos ));
+
+			if ( iLastWordLen && iNewWordLen )
+				if ( sphDictCmpStrictly ( sWord, iNewWordLen, sLastWord, iLastWordLen )<=0 )
+					LOC_FAIL(( fp, "word order decreased (pos=" INT64_FMT ", word=%s, prev=%s)",
+						iDictPos, sLastWord, sWord ));
+
+			if ( iHint<0 )
+				LOC_FAIL(( fp, "invalid word hint (pos=" INT64_FMT ", word=%s, hint=%d)",
+					iDictPos, sWord, iHint ));
+
+			if ( iDocs<=0 || iHits<=0 || iHits<iDocs )
+				LOC_FAIL(( fp, "invalid docs/hits (pos=" INT64_FMT ", word=%s, docs=" INT64_FMT ", hits=" INT64_FMT ")",
+					(int64_t)iDictPos, sWord, (int64_t)iDocs, (int64_t)iHits ));
+
+			if ( !m_tWordlist.m_tFst.IsEmpty() && iNewWordLen )
+			{
+				int iFstOrdinal = m_tWordlist.m_tFst.Find ( (const BYTE *)sWord, iNewWordLen );
+				if ( iFstOrdinal!=iWordsTotal )
+					LOC_FAIL(( fp, "keywords FST mismatch (pos=" INT64_FMT ", word=%s, ordinal=%d, fst=%d)",
+						(int64_t)iDictPos, sWord, iWordsTotal, iFstOrdinal ));
+			}
+
+			memcpy ( sLastWord, sWord, sizeof(sLastWord) );
+		} else
+		{
+			// finish reading the entire entry
+			uNewWordid = uWordid + iDeltaWord;
+			iNewDoclistOffset = iDoclistOffset + rdDict.UnzipOffset();
+			iDocs = rdDict.UnzipInt();
+			iHits = rdDict.UnzipInt();
+			bHitless = ( dHitlessWords.BinarySearch ( uNewWordid )!=NULL );
+			if ( bHitless )
+				iDocs = ( iDocs & HITLESS_DOC_MASK );
+
+			if ( uNewWordid<=uWordid )
+				LOC_FAIL(( fp, "wordid decreased (pos=" INT64_FMT ", wordid=" UINT64_FMT ", previd=" UINT64_FMT ")",
+					(int64_t)iDictPos, (uint64_t)uNewWordid, (uint64_t)uWordid ));
+
+			if ( iNewDoclistOffset<=iDoclistOffset )
+				LOC_FAIL(( fp, "doclist offset decreased (pos=" INT64_FMT ", wordid=" UINT64_FMT ")",
+					(int64_t)iDictPos, (uint64_t)uNewWordid ));
+
+			if ( iDocs<=0 || iHits<=0 || iHits<iDocs )
+				LOC_FAIL(( fp, "invalid docs/hits (pos=" INT64_FMT ", wordid=" UINT64_FMT ", docs=" INT64_FMT ", hits=" INT64_FMT ", hitless=%s)",
+					(int64_t)iDictPos, (uint64_t)uNewWordid, (int64_t)iDocs, (int64_t)iHits, ( bHitless?"true":"false" ) ));
+		}
+
+		// skiplist
+		if ( m_bHaveSkips && iDocs>SPH_SKIPLIST_BLOCK && !bHitless )
+		{
+			int iSkipsOffset = rdDict.UnzipInt();
+			if ( !bWordDict && iSkipsOffset<iLastSkipsOffset )
+				LOC_FAIL(( fp, "descending skiplist pos (last=%d, cur=%d, wordid=%llu)",
+					iLastSkipsOffset, iSkipsOffset, UINT64 ( uNewWordid ) ));
+			iLastSkipsOffset = iSkipsOffset;
+		}
+
+		// update stats, add checkpoint
+		if ( ( iWordsTotal%iWordPerCP )==0 )
+		{
+			CSphWordlistCheckpoint & tCP = dCheckpoints.Add();
+			tCP.m_iWordlistOffset = iDictPos;
+
+			if ( bWordDict )
+			{
+				const int iLen = strlen ( sWord );
+				char * sArenaWord = dCheckpointWords.AddN ( iLen + 1 );
+				memcpy ( sArenaWord, sWord, iLen );
+				sArenaWord[iLen] = '\0';
+				tCP.m_uWordID = sArenaWord - dCheckpointWords.Begin();
+			} else
+				tCP.m_uWordID = uNewWordid;
+		}
+
+		// TODO add back infix checking
+
+		uWordid = uNewWordid;
+		iDoclistOffset = iNewDoclistOffset;
+		iWordsTotal++;
+	}
+
+	// check the checkpoints
+	if ( dCheckpoints.GetLength()!=m_tWordlist.m_dCheckpoints.GetLength() )
+		LOC_FAIL(( fp, "checkpoint count mismatch (read=%d, calc=%d)",
+			m_tWordlist.m_dCheckpoints.GetLength(), dCheckpoints.GetLength() ));
+
+	if ( !m_tWordlist.m_tFst.IsEmpty() && m_tWordlist.m_tFst.GetWords()!=iWordsTotal )
+		LOC_FAIL(( fp, "keywords FST count mismatch (fst=%d, dict=%d)",
+			m_tWordlist.m_tFst.GetWords(), iWordsTotal ));
+
+	if ( !m_tWordlist.m_tTrigrams.IsEmpty() )
+	{
+		CSphString sTrigramsError;
+		if ( !m_tWordlist.m_tTrigrams.Check ( iWordsTotal, sTrigramsError ) )
+			LOC_FAIL(( fp, "infix trigrams: %s", sTrigramsError.cstr() ));
+	}
+
+	m_tWordlist.DebugPopulateCheckpoints();
+	for ( int i=0; i < Min ( dCheckpoints.GetLength(), m_tWordlist.m_dCheckpoints.GetLength() ); i++ )
+	{
+		CSphWordlistCheckpoint tRefCP = dCheckpoints[i];
+		const CSphWordlistCheckpoint & tCP = m_tWordlist.m_dCheckpoints[i];
+		if ( bWordDict && !tCP.m_sWord )
+		{
+			// keywords FST in charge, checkpoint words are not loaded
+			if ( tRefCP.m_iWordlistOffset!=tCP.m_iWordlistOffset )
+				LOC_FAIL(( fp, "checkpoint %d differs (readpos=" INT64_FMT ", calcpos=" INT64_FMT ")",
+					i, (int64_t)tCP.m_iWordlistOffset, (int64_t)tRefCP.m_iWordlistOffset ));
+			continue;
+		}
+
+		const int iLen = bWordDict ? strlen ( tCP.m_sWord ) : 0;
+		if ( bWordDict )
+			tRefCP.m_sWord = dCheckpointWords.Begin() + tRefCP.m_uWordID;
+		if ( bWordDict && ( tRefCP.m_sWord[0]=='\0' || tCP.m_sWord[0]=='\0' ) )
+		{
+			LOC_FAIL(( fp, "empty checkpoint %d (read_word=%s, read_len=%u, readpos=" INT64_FMT ", calc_word=%s, calc_len=%u, calcpos=" INT64_FMT ")",
+				i, tCP.m_sWord, (DWORD)strlen ( tCP.m_sWord ), (int64_t)tCP.m_iWordlistOffset,
+					tRefCP.m_sWord, (DWORD)strlen ( tRefCP.m_sWord ), (int64_t)tRefCP.m_iWordlistOffset ));
+
+		} else if ( sphCheckpointCmpStrictly ( tCP.m_sWord, iLen, tCP.m_uWordID, bWordDict, tRefCP )
+			|| tRefCP.m_iWordlistOffset!=tCP.m_iWordlistOffset )
+		{
+			if ( bWordDict )
+			{
+				LOC_FAIL(( fp, "checkpoint %d differs (read_word=%s, readpos=" INT64_FMT ", calc_word=%s, calcpos=" INT64_FMT ")",
+					i,
+					tCP.m_sWord,
+					(int64_t)tCP.m_iWordlistOffset,
+					tRefCP.m_sWord,
+					(int64_t)tRefCP.m_iWordlistOffset ));
+			} else
+			{
+				LOC_FAIL(( fp, "checkpoint %d differs (readid=" UINT64_FMT ", readpos=" INT64_FMT ", calcid=" UINT64_FMT ", calcpos=" INT64_FMT ")",
+					i,
+					(uint64_t)tCP.m_uWordID,
+					(int64_t)tCP.m_iWordlistOffset,
+					(uint64_t)tRefCP.m_uWordID,
+					(int64_t)tRefCP.m_iWordlistOffset ));
+			}
+		}
+	}
+
+	dCheckpoints.Reset();
+	dCheckpointWords.Reset();
+
+	///////////////////////
+	// check docs and hits
+	///////////////////////
+
+	fprintf ( fp, "checking data...\n" );
+
+	CSphScopedPtr<CSphDocidList> tDoclist ( new CSphDocidList );
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !tDoclist->Init ( m_tSchema.GetRowSize (), m_iDocinfo, rdAttr, sError ) )
+		LOC_FAIL ( ( fp, "%s", sError.cstr () ) );
+
+	int64_t iDocsSize = rdDocs.GetFilesize();
+
+	rdDict.SeekTo ( 1, READ_NO_SIZE_HINT );
+	rdDocs.SeekTo ( 1, READ_NO_SIZE_HINT );
+	rdHits.SeekTo ( 1, READ_NO_SIZE_HINT );
+
+	uWordid = 0;
+	iDoclistOffset = 0;
+	int iDictDocs, iDictHits;
+	bool bHitless = false;
+
+	int iWordsChecked = 0;
+	while ( rdDict.GetPos()<iWordsEnd )
+	{
+		bHitless = false;
+		SphWordID_t iDeltaWord = 0;
+		if ( bWordDict )
+		{
+			iDeltaWord = rdDict.GetByte();
+		} else
+		{
+			iDeltaWord = rdDict.UnzipWordid();
+		}
+		if ( !iDeltaWord )
+		{
+			rdDict.UnzipOffset();
+
+			uWordid = 0;
+			iDoclistOffset = 0;
+			continue;
+		}
+
+		if ( bWordDict )
+		{
+			// unpack next word
+			// must be in sync with DictEnd()!
+			BYTE uPack = (BYTE)iDeltaWord;
+
+			int iMatch, iDelta;
+			if ( uPack & 0x80 )
+			{
+				iDelta = ( ( uPack>>4 ) & 7 ) + 1;
+				iMatch = uPack & 15;
+			} else
+			{
+				iDelta = uPack & 127;
+				iMatch = rdDict.GetByte();
+			}
+			const int iLastWordLen = strlen(sWord);
+			if ( iMatch+iDelta>=(int)sizeof(sWord)-1 || iMatch>iLastWordLen )
+			{
+				rdDict.SkipBytes ( iDelta );
+			} else
+			{
+				rdDict.GetBytes ( sWord+iMatch, iDelta );
+				sWord [ iMatch+iDelta ] = '\0';
+			}
+
+			iDoclistOffset = rdDict.UnzipOffset();
+			iDictDocs = rdDict.UnzipInt();
+			iDictHits = rdDict.UnzipInt();
+			if ( iDictDocs>=DOCLIST_HINT_THRESH )
+				rdDict.GetByte();
+
+			if ( m_tSettings.m_eHitless==SPH_HITLESS_SOME && ( iDictDocs & HITLESS_DOC_FLAG ) )
+			{
+				iDictDocs = ( iDictDocs & HITLESS_DOC_MASK );
+				bHitless = true;
+			}
+		} else
+		{
+			// finish reading the entire entry
+			uWordid = uWordid + iDeltaWord;
+			bHitless = ( dHitlessWords.BinarySearch ( uWordid )!=NULL );
+			iDoclistOffset = iDoclistOffset + rdDict.UnzipOffset();
+			iDictDocs = rdDict.UnzipInt();
+			if ( bHitless )
+				iDictDocs = ( iDictDocs & HITLESS_DOC_MASK );
+			iDictHits = rdDict.UnzipInt();
+		}
+
+		// FIXME? verify skiplist content too
+		int iSkipsOffset = 0;
+		if ( m_bHaveSkips && iDictDocs>SPH_SKIPLIST_BLOCK && !bHitless )
+			iSkipsOffset = rdDict.UnzipInt();
+
+		// check whether the offset is as expected
+		if ( iDoclistOffset!=rdDocs.GetPos() )
+		{
+			if ( !bWordDict )
+				LOC_FAIL(( fp, "unexpected doclist offset (wordid=" UINT64_FMT "(%s)(%d), dictpos=" INT64_FMT ", doclistpos=" INT64_FMT ")",
+					(uint64_t)uWordid, sWord, iWordsChecked, iDoclistOffset, (int64_t)rdDocs.GetPos() ));
+
+			if ( iDoclistOffset>=iDocsSize || iDoclistOffset<0 )
+			{
+				LOC_FAIL(( fp, "unexpected doclist offset, off the file (wordid=" UINT64_FMT "(%s)(%d), dictpos=" INT64_FMT ", doclistsize=" INT64_FMT ")",
+					(uint64_t)uWordid, sWord, iWordsChecked, iDoclistOffset, iDocsSize ));
+				iWordsChecked++;
+				continue;
+			} else
+				rdDocs.SeekTo ( iDoclistOffset, READ_NO_SIZE_HINT );
+		}
+
+		// create and manually setup doclist reader
+		DiskIndexQwordTraits_c * pQword = NULL;
+		DWORD uInlineHits = ( m_tSettings.m_eHitFormat==SPH_HIT_FORMAT_INLINE );
+		DWORD uInlineDocinfo = ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE );
+		switch ( ( uInlineHits<<1 ) | uInlineDocinfo )
+		{
+		case 0: { typedef DiskIndexQword_c < false, false, false > T; pQword = new T ( false, false ); break; }
+		case 1: { typedef DiskIndexQword_c < false, true, false > T; pQword = new T ( false, false ); break; }
+		case 2: { typedef DiskIndexQword_c < true, false, false > T; pQword = new T ( false, false ); break; }
+		case 3: { typedef DiskIndexQword_c < true, true, false > T; pQword = new T ( false, false ); break; }
+		}
+		if ( !pQword )
+			sphDie ( "INTERNAL ERROR: impossible qword settings" );
+
+		pQword->m_tDoc.Reset ( m_tSchema.GetDynamicSize() );
+		pQword->m_iMinID = m_uMinDocid;
+		pQword->m_tDoc.m_uDocID = m_uMinDocid;
+		if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
+		{
+			pQword->m_iInlineAttrs = m_tSchema.GetDynamicSize();
+			pQword->m_pInlineFixup = m_dMinRow.Begin();
+		} else
+		{
+			pQword->m_iInlineAttrs = 0;
+			pQword->m_pInlineFixup = NULL;
+		}
+		pQword->m_iDocs = 0;
+		pQword->m_iHits = 0;
+		pQword->m_rdDoclist.SetFile ( rdDocs.GetFD(), rdDocs.GetFilename().cstr() );
+		pQword->m_rdDoclist.SeekTo ( rdDocs.GetPos(), READ_NO_SIZE_HINT );
+		pQword->m_rdHitlist.SetFile ( rdHits.GetFD(), rdHits.GetFilename().cstr() );
+		pQword->m_rdHitlist.SeekTo ( rdHits.GetPos(), READ_NO_SIZE_HINT );
+
+		CSphRowitem * pInlineStorage = NULL;
+		if ( pQword->m_iInlineAttrs )
+			pInlineStorage = new CSphRowitem [ pQword->m_iInlineAttrs ];
+
+		// loop the doclist
+		SphDocID_t uLastDocid = 0;
+		int iDoclistDocs = 0;
+		int iDoclistHits = 0;
+		int iHitlistHits = 0;
+
+		bHitless |= ( m_tSettings.m_eHitless==SPH_HITLESS_ALL ||
+			( m_tSettings.m_eHitless==SPH_HITLESS_SOME && dHitlessWords.BinarySearch ( uWordid ) ) );
+		pQword->m_bHasHitlist = !bHitless;
+
+		CSphVector<SkiplistEntry_t> dDoclistSkips;
+		for ( ;; )
+		{
+			// skiplist state is saved just *before* decoding those boundary entries
+			if ( m_bHaveSkips && ( iDoclistDocs & ( SPH_SKIPLIST_BLOCK-1 ) )==0 )
+			{
+				SkiplistEntry_t & tBlock = dDoclistSkips.Add();
+				tBlock.m_iBaseDocid = pQword->m_tDoc.m_uDocID;
+				tBlock.m_iOffset = pQword->m_rdDoclist.GetPos();
+				tBlock.m_iBaseHitlistPos = pQword->m_uHitPosition;
+			}
+
+			// FIXME? this can fail on a broken entry (eg fieldid over 256)
+			const CSphMatch & tDoc = pQword->GetNextDoc ( pInlineStorage );
+			if ( !tDoc.m_uDocID )
+				break;
+
+			// checks!
+			if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN )
+			{
+				SphDocID_t uDocID = tDoc.m_uDocID;
+				if ( !tDoclist->HasDocid ( uDocID ) )
+				{
+					LOC_FAIL(( fp, "row not found (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ")",
+						uint64_t(uWordid), sWord, tDoc.m_uDocID ));
+				}
+			}
+
+			if ( tDoc.m_uDocID<=uLastDocid )
+				LOC_FAIL(( fp, "docid decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", lastid=" DOCID_FMT ")",
+					uint64_t(uWordid), sWord, tDoc.m_uDocID, uLastDocid ));
+
+			uLastDocid = tDoc.m_uDocID;
+			iDoclistDocs++;
+			iDoclistHits += pQword->m_uMatchHits;
+
+			// check position in case of regular (not-inline) hit
+			if (!( pQword->m_iHitlistPos>>63 ))
+			{
+				if ( !bWordDict && pQword->m_iHitlistPos!=pQword->m_rdHitlist.GetPos() )
+					LOC_FAIL(( fp, "unexpected hitlist offset (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", expected=" INT64_FMT ", actual=" INT64_FMT ")",
+						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID,
+						(int64_t)pQword->m_iHitlistPos, (int64_t)pQword->m_rdHitlist.GetPos() ));
+			}
+
+			// aim
+			pQword->SeekHitlist ( pQword->m_iHitlistPos );
+
+			// loop the hitlist
+			int iDocHits = 0;
+			FieldMask_t dFieldMask;
+			dFieldMask.UnsetAll();
+			Hitpos_t uLastHit = EMPTY_HIT;
+
+			while ( !bHitless )
+			{
+				Hitpos_t uHit = pQword->GetNextHit();
+				if ( uHit==EMPTY_HIT )
+					break;
+
+				if ( !( uLastHit<uHit ) )
+					LOC_FAIL(( fp, "hit entries sorting order decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=%u, last=%u)",
+							(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, uHit, uLastHit ));
+
+				if ( HITMAN::GetField ( uLastHit )==HITMAN::GetField ( uHit ) )
+				{
+					if ( !( HITMAN::GetPos ( uLastHit )<HITMAN::GetPos ( uHit ) ) )
+						LOC_FAIL(( fp, "hit decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=%u, last=%u)",
+								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, HITMAN::GetPos ( uHit ), HITMAN::GetPos ( uLastHit ) ));
+					if ( HITMAN::IsEnd ( uLastHit ) )
+						LOC_FAIL(( fp, "multiple tail hits (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=0x%x, last=0x%x)",
+								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, uHit, uLastHit ));
+				} else
+				{
+					if ( !( HITMAN::GetField ( uLastHit )<HITMAN::GetField ( uHit ) ) )
+						LOC_FAIL(( fp, "hit field decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit field=%u, last field=%u)",
+								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, HITMAN::GetField ( uHit ), HITMAN::GetField ( uLastHit ) ));
+				}
+
+				uLastHit = uHit;
+
+				int iField = HITMAN::GetField ( uHit );
+				if ( iField<0 || iField>=SPH_MAX_FIELDS )
+				{
+					LOC_FAIL(( fp, "hit field out of bounds (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", field=%d)",
+						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, iField ));
+
+				} else if ( iField>=m_tSchema.m_dFields.GetLength() )
+				{
+					LOC_FAIL(( fp, "hit field out of schema (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", field=%d)",
+						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, iField ));
+				} else
+				{
+					dFieldMask.Set(iField);
+				}
+
+				iDocHits++; // to check doclist entry
+				iHitlistHits++; // to check dictionary entry
+			}
+
+			// check hit count
+			if ( iDocHits!=(int)pQword->m_uMatchHits && !bHitless )
+				LOC_FAIL(( fp, "doc hit count mismatch (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", doclist=%d, hitlist=%d)",
+					(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, pQword->m_uMatchHits, iDocHits ));
+
+			if ( GetMatchSchema().m_dFields.GetLength()>32 )
+				pQword->CollectHitMask();
+
+			// check the mask
+			if ( memcmp ( dFieldMask.m_dMask, pQword->m_dQwordFields.m_dMask, sizeof(dFieldMask.m_dMask) ) && !bHitless )
+				LOC_FAIL(( fp, "field mask mismatch (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ")",
+					(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID ));
+
+			// update my hitlist reader
+			rdHits.SeekTo ( pQword->m_rdHitlist.GetPos(), READ_NO_SIZE_HINT );
+		}
+
+		// do checks
+		if ( iDictDocs!=iDoclistDocs )
+			LOC_FAIL(( fp, "doc count mismatch (wordid=" UINT64_FMT "(%s), dict=%d, doclist=%d, hitless=%s)",
+				uint64_t(uWordid), sWord, iDictDocs, iDoclistDocs, ( bHitless?"true":"false" ) ));
+
+		if ( ( iDictHits!=iDoclistHits || iDictHits!=iHitlistHits ) && !bHitless )
+			LOC_FAIL(( fp, "hit count mismatch (wordid=" UINT64_FMT "(%s), dict=%d, doclist=%d, hitlist=%d)",
+				uint64_t(uWordid), sWord, iDictHits, iDoclistHits, iHitlistHits ));
+
+		while ( m_bHaveSkips && iDoclistDocs>SPH_SKIPLIST_BLOCK && !bHitless )
+		{
+			if ( iSkipsOffset<=0 || iSkipsOffset>iSkiplistLen )
+			{
+				LOC_FAIL(( fp, "invalid skiplist offset (wordid=%llu(%s), off=%d, max=" INT64_FMT ")",
+					UINT64 ( uWordid ), sWord, iSkipsOffset, iSkiplistLen ));
+				break;
+			}
+
+			// boundary adjustment
+			if ( ( iDoclistDocs & ( SPH_SKIPLIST_BLOCK-1 ) )==0 )
+				dDoclistSkips.Pop();
+
+			SkiplistEntry_t t;
+			t.m_iBaseDocid = m_uMinDocid;
+			t.m_iOffset = iDoclistOffset;
+			t.m_iBaseHitlistPos = 0;
+
+			// hint is: dDoclistSkips * ZIPPED( sizeof(int64_t) * 3 ) == dDoclistSkips * 8
+			rdSkips.SeekTo ( iSkipsOffset, dDoclistSkips.GetLength ()*8 );
+			int i = 0;
+			while ( ++i<dDoclistSkips.GetLength() )
+			{
+				const SkiplistEntry_t & r = dDoclistSkips[i];
+
+				uint64_t uDocidDelta = rdSkips.UnzipOffset ();
+				uint64_t uOff = rdSkips.UnzipOffset ();
+				uint64_t uPosDelta = rdSkips.UnzipOffset ();
+
+				if ( rdSkips.GetErrorFlag () )
+				{
+					LOC_FAIL ( ( fp, "skiplist reading error (wordid=%llu(%s), exp=%d, got=%d, error='%s')",
+						UINT64 ( uWordid ), sWord, i, dDoclistSkips.GetLength (), rdSkips.GetErrorMessage ().cstr () ) );
+					rdSkips.ResetError ();
+					break;
+				}
+
+				t.m_iBaseDocid += SPH_SKIPLIST_BLOCK + (SphDocID_t)uDocidDelta;
+				t.m_iOffset += 4*SPH_SKIPLIST_BLOCK + uOff;
+				t.m_iBaseHitlistPos += uPosDelta;
+				if ( t.m_iBaseDocid!=r.m_iBaseDocid
+					|| t.m_iOffset!=r.m_iOffset ||
+					t.m_iBaseHitlistPos!=r.m_iBaseHitlistPos )
+				{
+					LOC_FAIL(( fp, "skiplist entry %d mismatch (wordid=%llu(%s), exp={%llu, %llu, %llu}, got={%llu, %llu, %llu})",
+						i, UINT64 ( uWordid ), sWord,
+						UINT64 ( r.m_iBaseDocid ), UINT64 ( r.m_iOffset ), UINT64 ( r.m_iBaseHitlistPos ),
+						UINT64 ( t.m_iBaseDocid ), UINT64 ( t.m_iOffset ), UINT64 ( t.m_iBaseHitlistPos ) ));
+					break;
+				}
+			}
+			break;
+		}
+
+		// move my reader instance forward too
+		rdDocs.SeekTo ( pQword->m_rdDoclist.GetPos(), READ_NO_SIZE_HINT );
+
+		// cleanup
+		SafeDelete ( pInlineStorage );
+		SafeDelete ( pQword );
+
+		// progress bar
+		if ( (++iWordsChecked)%1000==0 && bProgress )
+		{
+			fprintf ( fp, "%d/%d\r", iWordsChecked, iWordsTotal );
+			fflush ( fp );
+		}
+	}
+
+	tDoclist = NULL;
+
+	///////////////////////////
+	// check rows (attributes)
+	///////////////////////////
+
+	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_tAttr.IsEmpty() )
+	{
+		fprintf ( fp, "checking rows...\n" );
+
+		// sizes and counts
+		int64_t iRowsTotal = m_iDocinfo;
+		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+
+		int64_t iAllRowsTotal = iRowsTotal;
+		iAllRowsTotal += (m_iDocinfoIndex+1)*2; // should had been fixed up to v.20 by the loader
+
+		if ( iAllRowsTotal*uStride!=(int64_t)m_tAttr.GetNumEntries() )
+			LOC_FAIL(( fp, "rowitems count mismatch (expected=" INT64_FMT ", loaded=" INT64_FMT ")",
+				iAllRowsTotal*uStride, (int64_t)m_tAttr.GetNumEntries() ));
+
+		iStrEnd = rdString.GetFilesize();
+		iMvaEnd = rdMva.GetFilesize();
+		CSphFixedVector<DWORD> dRow ( uStride );
+		CSphVector<DWORD> dMva;
+		rdAttr.SeekTo ( 0, sizeof ( dRow[0] ) * dRow.GetLength() );
+
+		// extract rowitem indexes for MVAs etc
+		// (ie. attr types that we can and will run additional checks on)
+		CSphVector<int> dMvaItems;
+		CSphVector<CSphAttrLocator> dFloatItems;
+		CSphVector<CSphAttrLocator> dStrItems;
+		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
+		{
+			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
+			if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET || tAttr.m_eAttrType==SPH_ATTR_INT64SET )
+			{
+				if ( tAttr.m_tLocator.m_iBitCount!=ROWITEM_BITS )
+				{
+					LOC_FAIL(( fp, "unexpected MVA bitcount (attr=%d, expected=%d, got=%d)",
+						i, ROWITEM_BITS, tAttr.m_tLocator.m_iBitCount ));
+					continue;
+				}
+				if ( ( tAttr.m_tLocator.m_iBitOffset % ROWITEM_BITS )!=0 )
+				{
+					LOC_FAIL(( fp, "unaligned MVA bitoffset (attr=%d, bitoffset=%d)",
+						i, tAttr.m_tLocator.m_iBitOffset ));
+					continue;
+				}
+				if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET )
+				dMvaItems.Add ( tAttr.m_tLocator.m_iBitOffset/ROWITEM_BITS );
+			} else if ( tAttr.m_eAttrType==SPH_ATTR_FLOAT )
+				dFloatItems.Add	( tAttr.m_tLocator );
+			else if ( tAttr.m_eAttrType==SPH_ATTR_STRING || tAttr.m_eAttrType==SPH_ATTR_JSON )
+				dStrItems.Add ( tAttr.m_tLocator );
+		}
+		int iMva64 = dMvaItems.GetLength();
+		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
+		{
+			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
+			if ( tAttr.m_eAttrType==SPH_ATTR_INT64SET )
+				dMvaItems.Add ( tAttr.m_tLocator.m_iBitOffset/ROWITEM_BITS );
+		}
+
+		// walk string data, build a list of acceptable start offsets
+		// must be sorted by construction
+		CSphVector<DWORD> dStringOffsets;
+		if ( m_tString.GetNumEntries()>1 )
+		{
+			rdString.SeekTo ( 1, READ_NO_SIZE_HINT );
+			while ( rdString.GetPos()<iStrEnd )
+			{
+				int64_t iLastPos = rdString.GetPos();
+				const int iLen = sphUnpackStrLength ( rdString );
+
+				// 4 bytes must be enough to encode string length, hence pCur+4
+				if ( rdString.GetPos()+iLen>iStrEnd || rdString.GetPos()>iLastPos+4 )
+				{
+					LOC_FAIL(( fp, "string length out of bounds (offset=" INT64_FMT ", len=%d)", iLastPos, iLen ));
+					break;
+				}
+
+				dStringOffsets.Add ( (DWORD)iLastPos );
+				rdString.SkipBytes ( iLen );
+			}
+		}
+
+		// loop the rows
+		int iOrphan = 0;
+		SphDocID_t uLastID = 0;
+
+		for ( int64_t iRow=0; iRow<iRowsTotal; iRow++ )
+		{
+			// fetch the row
+			rdAttr.GetBytes ( dRow.Begin(), sizeof(dRow[0])*dRow.GetLength() );
+			SphDocID_t uCurID = DOCINFO2ID ( dRow.Begin() );
+
+			// check that ids are ascending
+			bool bIsSpaValid = ( uLastID<uCurID );
+			if ( !bIsSpaValid )
+				LOC_FAIL(( fp, "docid decreased (row=" INT64_FMT ", id=" DOCID_FMT ", lastid=" DOCID_FMT ")",
+					iRow, uCurID, uLastID ));
+
+			uLastID = uCurID;
+
+			///////////////////////////
+			// check MVAs
+			///////////////////////////
+
+			if ( dMvaItems.GetLength() )
+			{
+				bool bMvaFix = false;
+				DWORD uMvaSpaFixed = 0;
+				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
+				bool bHasValues = false;
+				bool bHasArena = false;
+				ARRAY_FOREACH ( iItem, dMvaItems )
+				{
+					const DWORD uOffset = pAttrs[dMvaItems[iItem]];
+					bHasValues |= ( uOffset!=0 );
+					bool bArena = ( ( uOffset & MVA_ARENA_FLAG )!=0 ) && !m_bArenaProhibit;
+					bHasArena |= bArena;
+
+					if ( uOffset && !bArena && uOffset>=iMvaEnd )
+					{
+						bIsSpaValid = false;
+						LOC_FAIL(( fp, "MVA index out of bounds (row=" INT64_FMT ", mvaattr=%d, docid=" DOCID_FMT ", index=%u)",
+							iRow, iItem, uLastID, uOffset ));
+					}
+
+					if ( uOffset && !bArena && uOffset<iMvaEnd && !bMvaFix )
+					{
+						uMvaSpaFixed = uOffset - sizeof(SphDocID_t) / sizeof(DWORD);
+						bMvaFix = true;
+					}
+				}
+
+				// MVAs ptr recovery from previous errors only if current spa record is valid
+				if ( rdMva.GetPos()!=SphOffset_t(sizeof(DWORD)*uMvaSpaFixed) && bIsSpaValid && bMvaFix )
+					rdMva.SeekTo ( sizeof(DWORD)*uMvaSpaFixed, READ_NO_SIZE_HINT );
+
+				bool bLastIDChecked = false;
+				SphDocID_t uLastMvaID = 0;
+				while ( rdMva.GetPos()<iMvaEnd )
+				{
+					// current row does not reference any MVA values
+					// lets mark it as checked and bail
+					if ( !bHasValues )
+					{
+						bLastIDChecked = true;
+						break;
+					}
+
+					int64_t iLastPos = rdMva.GetPos();
+					const SphDocID_t uMvaID = rdMva.GetDocid();
+					if ( uMvaID>uLastID )
+						break;
+
+					if ( bLastIDChecked && uLastID==uMvaID )
+						LOC_FAIL(( fp, "duplicate docid found (row=" INT64_FMT ", docid expected=" DOCID_FMT ", got=" DOCID_FMT ", index=" INT64_FMT ")",
+							iRow, uLastID, uMvaID, iLastPos ));
+
+					if ( uMvaID<uLastMvaID )
+						LOC_FAIL(( fp, "MVA docid decreased (row=" INT64_FMT ", spa docid=" DOCID_FMT ", last MVA docid=" DOCID_FMT ", MVA docid=" DOCID_FMT ", index=" INT64_FMT ")",
+							iRow, uLastID, uLastMvaID, uMvaID, iLastPos ));
+
+					bool bIsMvaCorrect = ( uLastMvaID<=uMvaID && uMvaID<=uLastID );
+					uLastMvaID = uMvaID;
+					bool bWasArena = false;
+					int iLastEmpty = INT_MAX;
+
+					// loop MVAs
+					ARRAY_FOREACH_COND ( iItem, dMvaItems, bIsMvaCorrect )
+					{
+						const DWORD uSpaOffset = pAttrs[dMvaItems[iItem]];
+						bool bArena = ( ( uSpaOffset & MVA_ARENA_FLAG )!=0 ) && !m_bArenaProhibit;
+						bWasArena |= bArena;
+
+						// zero offset means empty MVA in rt index, however plain index stores offset to zero length
+						if ( !uSpaOffset || bArena )
+						{
+							iLastEmpty = iItem;
+							continue;
+						}
+
+						// where also might be updated mva with zero length
+						if ( bWasArena || ( iLastEmpty==iItem-1 ) )
+							rdMva.SeekTo ( sizeof(DWORD)*uSpaOffset, READ_NO_SIZE_HINT );
+						bWasArena = false;
+						iLastEmpty = INT_MAX;
+
+						// check offset (index)
+						if ( uMvaID==uLastID && bIsSpaValid && rdMva.GetPos()!=int(sizeof(DWORD))*uSpaOffset )
+						{
+							LOC_FAIL(( fp, "unexpected MVA docid (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", expected=" INT64_FMT ", got=%u)",
+								iRow, iItem, uLastID, uMvaID, rdMva.GetPos()/sizeof(DWORD), uSpaOffset ));
+							// it's unexpected but it's our best guess
+							// but do fix up only once, to prevent infinite loop
+							if ( !bLastIDChecked )
+								rdMva.SeekTo ( sizeof(DWORD)*uSpaOffset, READ_NO_SIZE_HINT );
+						}
+
+						if ( rdMva.GetPos()>=iMvaEnd )
+						{
+							LOC_FAIL(( fp, "MVA index out of bounds (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", index=" INT64_FMT ")",
+								iRow, iItem, uLastID, uMvaID, rdMva.GetPos()/sizeof(DWORD) ));
+							bIsMvaCorrect = false;
+							continue;
+						}
+
+						// check values
+						DWORD uValues = rdMva.GetDword();
+
+						if ( rdMva.GetPos()+int(sizeof(DWORD))*uValues-1>=iMvaEnd )
+						{
+							LOC_FAIL(( fp, "MVA count out of bounds (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", count=%u)",
+								iRow, iItem, uLastID, uMvaID, uValues ));
+							rdMva.SeekTo ( rdMva.GetPos() + sizeof(DWORD)*uValues, READ_NO_SIZE_HINT );
+							bIsMvaCorrect = false;
+							continue;
+						}
+
+						dMva.Resize ( uValues );
+						rdMva.GetBytes ( dMva.Begin(), sizeof(DWORD)*uValues );
+
+						// check that values are ascending
+						for ( DWORD uVal=(iItem>=iMva64 ? 2 : 1); uVal<uValues && bIsMvaCorrect; )
+						{
+							int64_t iPrev, iCur;
+							if ( iItem>=iMva64 )
+							{
+								iPrev = MVA_UPSIZE ( dMva.Begin() + uVal - 2 );
+								iCur = MVA_UPSIZE ( dMva.Begin() + uVal );
+								uVal += 2;
+							} else
+							{
+								iPrev = dMva[uVal-1];
+								iCur = dMva[uVal];
+								uVal++;
+							}
+
+							if ( iCur<=iPrev )
+							{
+								LOC_FAIL(( fp, "unsorted MVA values (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", val[%u]=%u, val[%u]=%u)",
+									iRow, iItem, uLastID, uMvaID, ( iItem>=iMva64 ? uVal-2 : uVal-1 ), (unsigned int)iPrev, uVal, (unsigned int)iCur ));
+								bIsMvaCorrect = false;
+							}
+
+							uVal += ( iItem>=iMva64 ? 2 : 1 );
+						}
+					}
+
+					if ( !bIsMvaCorrect )
+						break;
+
+					// orphan only ON no errors && ( not matched ids || ids matched multiply times )
+					if ( bIsMvaCorrect && ( uMvaID!=uLastID || ( uMvaID==uLastID && bLastIDChecked ) ) )
+						iOrphan++;
 
-	m_tWordlist.DebugPopulateCheckpoints();
-	for ( int i=0; i < Min ( dCheckpoints.GetLength(), m_tWordlist.m_dCheckpoints.GetLength() ); i++ )
-	{
-		CSphWordlistCheckpoint tRefCP = dCheckpoints[i];
-		const CSphWordlistCheckpoint & tCP = m_tWordlist.m_dCheckpoints[i];
-		const int iLen = bWordDict ? strlen ( tCP.m_sWord ) : 0;
-		if ( bWordDict )
-			tRefCP.m_sWord = dCheckpointWords.Begin() + tRefCP.m_uWordID;
-		if ( bWordDict && ( tRefCP.m_sWord[0]=='\0' || tCP.m_sWord[0]=='\0' ) )
-		{
-			LOC_FAIL(( fp, "empty checkpoint %d (read_word=%s, read_len=%u, readpos=" INT64_FMT ", calc_word=%s, calc_len=%u, calcpos=" INT64_FMT ")",
-				i, tCP.m_sWord, (DWORD)strlen ( tCP.m_sWord ), (int64_t)tCP.m_iWordlistOffset,
-					tRefCP.m_sWord, (DWORD)strlen ( tRefCP.m_sWord ), (int64_t)tRefCP.m_iWordlistOffset ));
+					bLastIDChecked |= ( uLastID==uMvaID );
+				}
 
-		} else if ( sphCheckpointCmpStrictly ( tCP.m_sWord, iLen, tCP.m_uWordID, bWordDict, tRefCP )
-			|| tRefCP.m_iWordlistOffset!=tCP.m_iWordlistOffset )
-		{
-			if ( bWordDict )
-			{
-				LOC_FAIL(( fp, "checkpoint %d differs (read_word=%s, readpos=" INT64_FMT ", calc_word=%s, calcpos=" INT64_FMT ")",
-					i,
-					tCP.m_sWord,
-					(int64_t)tCP.m_iWordlistOffset,
-					tRefCP.m_sWord,
-					(int64_t)tRefCP.m_iWordlistOffset ));
-			} else
-			{
-				LOC_FAIL(( fp, "checkpoint %d differs (readid=" UINT64_FMT ", readpos=" INT64_FMT ", calcid=" UINT64_FMT ", calcpos=" INT64_FMT ")",
-					i,
-					(uint64_t)tCP.m_uWordID,
-					(int64_t)tCP.m_iWordlistOffset,
-					(uint64_t)tRefCP.m_uWordID,
-					(int64_t)tRefCP.m_iWordlistOffset ));
+				if ( !bLastIDChecked && bHasValues && !bHasArena )
+					LOC_FAIL(( fp, "missed or damaged MVA (row=" INT64_FMT ", docid expected=" DOCID_FMT ")",
+						iRow, uLastID ));
 			}
-		}
-	}
 
-	dCheckpoints.Reset();
-	dCheckpointWords.Reset();
+			///////////////////////////
+			// check floats
+			///////////////////////////
 
-	///////////////////////
-	// check docs and hits
-	///////////////////////
+			ARRAY_FOREACH ( iItem, dFloatItems )
+			{
+				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
+				const DWORD uValue = (DWORD)sphGetRowAttr ( pAttrs, dFloatItems[ iItem ] );
+				const DWORD uExp = ( uValue >> 23 ) & 0xff;
+				const DWORD uMantissa = uValue & 0x003fffff;
 
-	fprintf ( fp, "checking data...\n" );
+				// check normalized
+				if ( uExp==0 && uMantissa!=0 )
+					LOC_FAIL(( fp, "float attribute value is unnormalized (row=" INT64_FMT ", attr=%d, id=" DOCID_FMT ", raw=0x%x, value=%f)",
+						iRow, iItem, uLastID, uValue, sphDW2F ( uValue ) ));
 
-	CSphScopedPtr<CSphDocidList> tDoclist ( new CSphDocidList );
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !tDoclist->Init ( m_tSchema.GetRowSize (), m_iDocinfo, rdAttr, sError ) )
-		LOC_FAIL ( ( fp, "%s", sError.cstr () ) );
+				// check +-inf
+				if ( uExp==0xff && uMantissa==0 )
+					LOC_FAIL(( fp, "float attribute is infinity (row=" INT64_FMT ", attr=%d, id=" DOCID_FMT ", raw=0x%x, value=%f)",
+						iRow, iItem, uLastID, uValue, sphDW2F ( uValue ) ));
+			}
 
-	int64_t iDocsSize = rdDocs.GetFilesize();
+			/////////////////
+			// check strings
+			/////////////////
 
-	rdDict.SeekTo ( 1, READ_NO_SIZE_HINT );
-	rdDocs.SeekTo ( 1, READ_NO_SIZE_HINT );
-	rdHits.SeekTo ( 1, READ_NO_SIZE_HINT );
+			ARRAY_FOREACH ( iItem, dStrItems )
+			{
+				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
 
-	uWordid = 0;
-	iDoclistOffset = 0;
-	int iDictDocs, iDictHits;
-	bool bHitless = false;
+				const DWORD uOffset = (DWORD)sphGetRowAttr ( pAttrs, dStrItems[ iItem ] );
+				if ( uOffset>=iStrEnd )
+				{
+					LOC_FAIL(( fp, "string offset out of bounds (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", index=%u)",
+						iRow, iItem, uLastID, uOffset ));
+					continue;
+				}
 
-	int iWordsChecked = 0;
-	while ( rdDict.GetPos()<iWordsEnd )
-	{
-		bHitless = false;
-		SphWordID_t iDeltaWord = 0;
-		if ( bWordDict )
-		{
-			iDeltaWord = rdDict.GetByte();
-		} else
-		{
-			iDeltaWord = rdDict.UnzipWordid();
-		}
-		if ( !iDeltaWord )
-		{
-			rdDict.UnzipOffset();
+				if ( !uOffset )
+					continue;
 
-			uWordid = 0;
-			iDoclistOffset = 0;
-			continue;
-		}
+				rdString.SeekTo ( uOffset, READ_NO_SIZE_HINT );
+				const int iLen = sphUnpackStrLength ( rdString );
 
-		if ( bWordDict )
-		{
-			// unpack next word
-			// must be in sync with DictEnd()!
-			BYTE uPack = (BYTE)iDeltaWord;
+				// check that length is sane
+				if ( rdString.GetPos()+iLen-1>=iStrEnd )
+				{
+					LOC_FAIL(( fp, "string length out of bounds (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", index=%u)",
+						iRow, iItem, uLastID, uOffset ));
+					continue;
+				}
 
-			int iMatch, iDelta;
-			if ( uPack & 0x80 )
-			{
-				iDelta = ( ( uPack>>4 ) & 7 ) + 1;
-				iMatch = uPack & 15;
-			} else
-			{
-				iDelta = uPack & 127;
-				iMatch = rdDict.GetByte();
-			}
-			const int iLastWordLen = strlen(sWord);
-			if ( iMatch+iDelta>=(int)sizeof(sWord)-1 || iMatch>iLastWordLen )
-			{
-				rdDict.SkipBytes ( iDelta );
-			} else
-			{
-				rdDict.GetBytes ( sWord+iMatch, iDelta );
-				sWord [ iMatch+iDelta ] = '\0';
+				// check that offset is one of the good ones
+				// (that is, that we don't point in the middle of some other data)
+				if ( !dStringOffsets.BinarySearch ( uOffset ) )
+				{
+					LOC_FAIL(( fp, "string offset is not a string start (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", offset=%u)",
+						iRow, iItem, uLastID, uOffset ));
+				}
 			}
 
-			iDoclistOffset = rdDict.UnzipOffset();
-			iDictDocs = rdDict.UnzipInt();
-			iDictHits = rdDict.UnzipInt();
-			if ( iDictDocs>=DOCLIST_HINT_THRESH )
-				rdDict.GetByte();
-
-			if ( m_tSettings.m_eHitless==SPH_HITLESS_SOME && ( iDictDocs & HITLESS_DOC_FLAG ) )
+			// progress bar
+			if ( iRow%1000==0 && bProgress )
 			{
-				iDictDocs = ( iDictDocs & HITLESS_DOC_MASK );
-				bHitless = true;
+				fprintf ( fp, INT64_FMT"/" INT64_FMT "\r", iRow, iRowsTotal );
+				fflush ( fp );
 			}
-		} else
-		{
-			// finish reading the entire entry
-			uWordid = uWordid + iDeltaWord;
-			bHitless = ( dHitlessWords.BinarySearch ( uWordid )!=NULL );
-			iDoclistOffset = iDoclistOffset + rdDict.UnzipOffset();
-			iDictDocs = rdDict.UnzipInt();
-			if ( bHitless )
-				iDictDocs = ( iDictDocs & HITLESS_DOC_MASK );
-			iDictHits = rdDict.UnzipInt();
 		}
 
-		// FIXME? verify skiplist content too
-		int iSkipsOffset = 0;
-		if ( m_bHaveSkips && iDictDocs>SPH_SKIPLIST_BLOCK && !bHitless )
-			iSkipsOffset = rdDict.UnzipInt();
+		if ( iOrphan )
+			fprintf ( fp, "WARNING: %d orphaned MVA entries were found\n", iOrphan );
 
-		// check whether the offset is as expected
-		if ( iDoclistOffset!=rdDocs.GetPos() )
-		{
-			if ( !bWordDict )
-				LOC_FAIL(( fp, "unexpected doclist offset (wordid=" UINT64_FMT "(%s)(%d), dictpos=" INT64_FMT ", doclistpos=" INT64_FMT ")",
-					(uint64_t)uWordid, sWord, iWordsChecked, iDoclistOffset, (int64_t)rdDocs.GetPos() ));
+		///////////////////////////
+		// check blocks index
+		///////////////////////////
 
-			if ( iDoclistOffset>=iDocsSize || iDoclistOffset<0 )
-			{
-				LOC_FAIL(( fp, "unexpected doclist offset, off the file (wordid=" UINT64_FMT "(%s)(%d), dictpos=" INT64_FMT ", doclistsize=" INT64_FMT ")",
-					(uint64_t)uWordid, sWord, iWordsChecked, iDoclistOffset, iDocsSize ));
-				iWordsChecked++;
-				continue;
-			} else
-				rdDocs.SeekTo ( iDoclistOffset, READ_NO_SIZE_HINT );
-		}
+		fprintf ( fp, "checking attribute blocks index...\n" );
 
-		// create and manually setup doclist reader
-		DiskIndexQwordTraits_c * pQword = NULL;
-		DWORD uInlineHits = ( m_tSettings.m_eHitFormat==SPH_HIT_FORMAT_INLINE );
-		DWORD uInlineDocinfo = ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE );
-		switch ( ( uInlineHits<<1 ) | uInlineDocinfo )
-		{
-		case 0: { typedef DiskIndexQword_c < false, false, false > T; pQword = new T ( false, false ); break; }
-		case 1: { typedef DiskIndexQword_c < false, true, false > T; pQword = new T ( false, false ); break; }
-		case 2: { typedef DiskIndexQword_c < true, false, false > T; pQword = new T ( false, false ); break; }
-		case 3: { typedef DiskIndexQword_c < true, true, false > T; pQword = new T ( false, false ); break; }
-		}
-		if ( !pQword )
-			sphDie ( "INTERNAL ERROR: impossible qword settings" );
+		// check size
+		const int64_t iTempDocinfoIndex = ( m_iDocinfo+DOCINFO_INDEX_FREQ-1 ) / DOCINFO_INDEX_FREQ;
+		if ( iTempDocinfoIndex!=m_iDocinfoIndex )
+			LOC_FAIL(( fp, "block count differs (expected=" INT64_FMT ", got=" INT64_FMT ")",
+				iTempDocinfoIndex, m_iDocinfoIndex ));
 
-		pQword->m_tDoc.Reset ( m_tSchema.GetDynamicSize() );
-		pQword->m_iMinID = m_uMinDocid;
-		pQword->m_tDoc.m_uDocID = m_uMinDocid;
-		if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_INLINE )
-		{
-			pQword->m_iInlineAttrs = m_tSchema.GetDynamicSize();
-			pQword->m_pInlineFixup = m_dMinRow.Begin();
-		} else
+		const DWORD uMinMaxStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
+		const DWORD * pDocinfoIndexMax = m_pDocinfoIndex + ( m_iDocinfoIndex+1 )*uMinMaxStride*2;
+
+		rdAttr.SeekTo ( 0, sizeof ( dRow[0] ) * dRow.GetLength() );
+
+		for ( int64_t iIndexEntry=0; iIndexEntry<m_iDocinfo; iIndexEntry++ )
 		{
-			pQword->m_iInlineAttrs = 0;
-			pQword->m_pInlineFixup = NULL;
-		}
-		pQword->m_iDocs = 0;
-		pQword->m_iHits = 0;
-		pQword->m_rdDoclist.SetFile ( rdDocs.GetFD(), rdDocs.GetFilename().cstr() );
-		pQword->m_rdDoclist.SeekTo ( rdDocs.GetPos(), READ_NO_SIZE_HINT );
-		pQword->m_rdHitlist.SetFile ( rdHits.GetFD(), rdHits.GetFilename().cstr() );
-		pQword->m_rdHitlist.SeekTo ( rdHits.GetPos(), READ_NO_SIZE_HINT );
+			const int64_t iBlock = iIndexEntry / DOCINFO_INDEX_FREQ;
+
+			// we have to do some checks in border cases, for example: when move from 1st to 2nd block
+			const int64_t iPrevEntryBlock = ( iIndexEntry-1 )/DOCINFO_INDEX_FREQ;
+			const bool bIsBordersCheckTime = ( iPrevEntryBlock!=iBlock );
+
+			rdAttr.GetBytes ( dRow.Begin(), sizeof(dRow[0]) * dRow.GetLength() );
+			const SphDocID_t uDocID = DOCINFO2ID ( dRow.Begin() );
+
+			const DWORD * pMinEntry = m_pDocinfoIndex + iBlock * uMinMaxStride * 2;
+			const DWORD * pMaxEntry = pMinEntry + uMinMaxStride;
+			const DWORD * pMinAttrs = DOCINFO2ATTRS ( pMinEntry );
+			const DWORD * pMaxAttrs = pMinAttrs + uMinMaxStride;
 
-		CSphRowitem * pInlineStorage = NULL;
-		if ( pQword->m_iInlineAttrs )
-			pInlineStorage = new CSphRowitem [ pQword->m_iInlineAttrs ];
+			// check docid vs global range
+			if ( pMaxEntry+uMinMaxStride > pDocinfoIndexMax )
+				LOC_FAIL(( fp, "unexpected block index end (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", max=" INT64_FMT ", cur=" INT64_FMT ")",
+					iIndexEntry, uDocID, iBlock, int64_t ( pDocinfoIndexMax-m_pDocinfoIndex ), int64_t ( pMaxEntry+uMinMaxStride-m_pDocinfoIndex ) ));
 
-		// loop the doclist
-		SphDocID_t uLastDocid = 0;
-		int iDoclistDocs = 0;
-		int iDoclistHits = 0;
-		int iHitlistHits = 0;
+			// check attribute location vs global range
+			if ( pMaxAttrs+uMinMaxStride > pDocinfoIndexMax )
+				LOC_FAIL(( fp, "attribute position out of blocks index (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", expected<" INT64_FMT ", got=" INT64_FMT ")",
+					iIndexEntry, uDocID, iBlock, int64_t ( pDocinfoIndexMax-m_pDocinfoIndex ), int64_t ( pMaxAttrs+uMinMaxStride-m_pDocinfoIndex ) ));
 
-		bHitless |= ( m_tSettings.m_eHitless==SPH_HITLESS_ALL ||
-			( m_tSettings.m_eHitless==SPH_HITLESS_SOME && dHitlessWords.BinarySearch ( uWordid ) ) );
-		pQword->m_bHasHitlist = !bHitless;
+			const SphDocID_t uMinDocID = DOCINFO2ID ( pMinEntry );
+			const SphDocID_t uMaxDocID = DOCINFO2ID ( pMaxEntry );
 
-		CSphVector<SkiplistEntry_t> dDoclistSkips;
-		for ( ;; )
-		{
-			// skiplist state is saved just *before* decoding those boundary entries
-			if ( m_bHaveSkips && ( iDoclistDocs & ( SPH_SKIPLIST_BLOCK-1 ) )==0 )
-			{
-				SkiplistEntry_t & tBlock = dDoclistSkips.Add();
-				tBlock.m_iBaseDocid = pQword->m_tDoc.m_uDocID;
-				tBlock.m_iOffset = pQword->m_rdDoclist.GetPos();
-				tBlock.m_iBaseHitlistPos = pQword->m_uHitPosition;
-			}
+			// checks is docid min max range valid
+			if ( uMinDocID > uMaxDocID && bIsBordersCheckTime )
+				LOC_FAIL(( fp, "invalid docid range (row=" INT64_FMT ", block=" INT64_FMT ", min=" DOCID_FMT ", max=" DOCID_FMT ")",
+					iIndexEntry, iBlock, uMinDocID, uMaxDocID ));
 
-			// FIXME? this can fail on a broken entry (eg fieldid over 256)
-			const CSphMatch & tDoc = pQword->GetNextDoc ( pInlineStorage );
-			if ( !tDoc.m_uDocID )
-				break;
+			// checks docid vs blocks range
+			if ( uDocID < uMinDocID || uDocID > uMaxDocID )
+				LOC_FAIL(( fp, "unexpected docid range (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", min=" DOCID_FMT ", max=" DOCID_FMT ")",
+					iIndexEntry, uDocID, iBlock, uMinDocID, uMaxDocID ));
 
-			// checks!
-			if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN )
+			bool bIsFirstMva = true;
+			bool bWasArenaMva = false;
+
+			// check values vs blocks range
+			const DWORD * pSpaRow = DOCINFO2ATTRS ( dRow.Begin() );
+			for ( int iItem=0; iItem<m_tSchema.GetAttrsCount(); iItem++ )
 			{
-				SphDocID_t uDocID = tDoc.m_uDocID;
-				if ( !tDoclist->HasDocid ( uDocID ) )
-				{
-					LOC_FAIL(( fp, "row not found (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ")",
-						uint64_t(uWordid), sWord, tDoc.m_uDocID ));
-				}
-			}
+				const CSphColumnInfo & tCol = m_tSchema.GetAttr(iItem);
 
-			if ( tDoc.m_uDocID<=uLastDocid )
-				LOC_FAIL(( fp, "docid decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", lastid=" DOCID_FMT ")",
-					uint64_t(uWordid), sWord, tDoc.m_uDocID, uLastDocid ));
+				switch ( tCol.m_eAttrType )
+				{
+				case SPH_ATTR_INTEGER:
+				case SPH_ATTR_TIMESTAMP:
+				case SPH_ATTR_BOOL:
+				case SPH_ATTR_BIGINT:
+					{
+						const SphAttr_t uVal = sphGetRowAttr ( pSpaRow, tCol.m_tLocator );
+						const SphAttr_t uMin = sphGetRowAttr ( pMinAttrs, tCol.m_tLocator );
+						const SphAttr_t uMax = sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator );
 
-			uLastDocid = tDoc.m_uDocID;
-			iDoclistDocs++;
-			iDoclistHits += pQword->m_uMatchHits;
+						// checks is attribute min max range valid
+						if ( uMin > uMax && bIsBordersCheckTime )
+							LOC_FAIL(( fp, "invalid attribute range (row=" INT64_FMT ", block=" INT64_FMT ", min=" INT64_FMT ", max=" INT64_FMT ")",
+								iIndexEntry, iBlock, uMin, uMax ));
 
-			// check position in case of regular (not-inline) hit
-			if (!( pQword->m_iHitlistPos>>63 ))
-			{
-				if ( !bWordDict && pQword->m_iHitlistPos!=pQword->m_rdHitlist.GetPos() )
-					LOC_FAIL(( fp, "unexpected hitlist offset (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", expected=" INT64_FMT ", actual=" INT64_FMT ")",
-						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID,
-						(int64_t)pQword->m_iHitlistPos, (int64_t)pQword->m_rdHitlist.GetPos() ));
-			}
+						if ( uVal < uMin || uVal > uMax )
+							LOC_FAIL(( fp, "unexpected attribute value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", value=0x" UINT64_FMT ", min=0x" UINT64_FMT ", max=0x" UINT64_FMT ")",
+								iIndexEntry, iItem, uDocID, iBlock, uint64_t(uVal), uint64_t(uMin), uint64_t(uMax) ));
+					}
+					break;
 
-			// aim
-			pQword->SeekHitlist ( pQword->m_iHitlistPos );
+				case SPH_ATTR_FLOAT:
+					{
+						const float fVal = sphDW2F ( (DWORD)sphGetRowAttr ( pSpaRow, tCol.m_tLocator ) );
+						const float fMin = sphDW2F ( (DWORD)sphGetRowAttr ( pMinAttrs, tCol.m_tLocator ) );
+						const float fMax = sphDW2F ( (DWORD)sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator ) );
 
-			// loop the hitlist
-			int iDocHits = 0;
-			FieldMask_t dFieldMask;
-			dFieldMask.UnsetAll();
-			Hitpos_t uLastHit = EMPTY_HIT;
+						// checks is attribute min max range valid
+						if ( fMin > fMax && bIsBordersCheckTime )
+							LOC_FAIL(( fp, "invalid attribute range (row=" INT64_FMT ", block=" INT64_FMT ", min=%f, max=%f)",
+								iIndexEntry, iBlock, fMin, fMax ));
 
-			while ( !bHitless )
-			{
-				Hitpos_t uHit = pQword->GetNextHit();
-				if ( uHit==EMPTY_HIT )
+						if ( fVal < fMin || fVal > fMax )
+							LOC_FAIL(( fp, "unexpected attribute value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", value=%f, min=%f, max=%f)",
+								iIndexEntry, iItem, uDocID, iBlock, fVal, fMin, fMax ));
+					}
 					break;
 
-				if ( !( uLastHit<uHit ) )
-					LOC_FAIL(( fp, "hit entries sorting order decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=%u, last=%u)",
-							(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, uHit, uLastHit ));
+				case SPH_ATTR_UINT32SET:
+					{
+						const DWORD uMin = (DWORD)sphGetRowAttr ( pMinAttrs, tCol.m_tLocator );
+						const DWORD uMax = (DWORD)sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator );
 
-				if ( HITMAN::GetField ( uLastHit )==HITMAN::GetField ( uHit ) )
-				{
-					if ( !( HITMAN::GetPos ( uLastHit )<HITMAN::GetPos ( uHit ) ) )
-						LOC_FAIL(( fp, "hit decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=%u, last=%u)",
-								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, HITMAN::GetPos ( uHit ), HITMAN::GetPos ( uLastHit ) ));
-					if ( HITMAN::IsEnd ( uLastHit ) )
-						LOC_FAIL(( fp, "multiple tail hits (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit=0x%x, last=0x%x)",
-								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, uHit, uLastHit ));
-				} else
-				{
-					if ( !( HITMAN::GetField ( uLastHit )<HITMAN::GetField ( uHit ) ) )
-						LOC_FAIL(( fp, "hit field decreased (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", hit field=%u, last field=%u)",
-								(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, HITMAN::GetField ( uHit ), HITMAN::GetField ( uLastHit ) ));
-				}
+						// checks is MVA attribute min max range valid
+						if ( uMin > uMax && bIsBordersCheckTime && uMin!=0xffffffff && uMax!=0 )
+							LOC_FAIL(( fp, "invalid MVA range (row=" INT64_FMT ", block=" INT64_FMT ", min=0x%x, max=0x%x)",
+							iIndexEntry, iBlock, uMin, uMax ));
 
-				uLastHit = uHit;
+						SphAttr_t uOff = sphGetRowAttr ( pSpaRow, tCol.m_tLocator );
+						if ( !uOff || ( uOff & MVA_ARENA_FLAG )!=0 )
+						{
+							bWasArenaMva |= ( ( uOff & MVA_ARENA_FLAG )!=0 );
+							break;
+						}
 
-				int iField = HITMAN::GetField ( uHit );
-				if ( iField<0 || iField>=SPH_MAX_FIELDS )
-				{
-					LOC_FAIL(( fp, "hit field out of bounds (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", field=%d)",
-						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, iField ));
+						SphDocID_t uMvaDocID = 0;
+						if ( bIsFirstMva && !bWasArenaMva )
+						{
+							bIsFirstMva = false;
+							rdMva.SeekTo ( sizeof(DWORD) * uOff - sizeof(SphDocID_t), READ_NO_SIZE_HINT );
+							uMvaDocID = rdMva.GetDocid();
+						} else
+						{
+							rdMva.SeekTo ( sizeof(DWORD) * uOff, READ_NO_SIZE_HINT );
+						}
 
-				} else if ( iField>=m_tSchema.m_dFields.GetLength() )
-				{
-					LOC_FAIL(( fp, "hit field out of schema (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", field=%d)",
-						(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, iField ));
-				} else
-				{
-					dFieldMask.Set(iField);
+						if ( uOff>=iMvaEnd )
+							break;
+
+						if ( uMvaDocID && uMvaDocID!=uDocID && !bWasArenaMva )
+						{
+							LOC_FAIL(( fp, "unexpected MVA docid (row=" INT64_FMT ", mvaattr=%d, expected=" DOCID_FMT ", got=" DOCID_FMT ", block=" INT64_FMT ", index=%u)",
+								iIndexEntry, iItem, uDocID, uMvaDocID, iBlock, (DWORD)uOff ));
+							break;
+						}
+
+						// check values
+						const DWORD uValues = rdMva.GetDword();
+						if ( uOff+uValues>iMvaEnd )
+							break;
+
+						dMva.Resize ( uValues );
+						rdMva.GetBytes ( dMva.Begin(), sizeof ( dMva[0] ) * uValues );
+
+						for ( DWORD iVal=0; iVal<uValues; iVal++ )
+						{
+							const DWORD uVal = dMva[iVal];
+							if ( uVal < uMin || uVal > uMax )
+								LOC_FAIL(( fp, "unexpected MVA value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", index=%u, value=0x%x, min=0x%x, max=0x%x)",
+									iIndexEntry, iItem, uDocID, iBlock, iVal, (DWORD)uVal, (DWORD)uMin, (DWORD)uMax ));
+						}
+					}
+					break;
+
+				default:
+					break;
 				}
+			}
 
-				iDocHits++; // to check doclist entry
-				iHitlistHits++; // to check dictionary entry
+			// progress bar
+			if ( iIndexEntry%1000==0 && bProgress )
+			{
+				fprintf ( fp, INT64_FMT"/" INT64_FMT "\r", iIndexEntry, m_iDocinfo );
+				fflush ( fp );
 			}
+		}
+	}
 
-			// check hit count
-			if ( iDocHits!=(int)pQword->m_uMatchHits && !bHitless )
-				LOC_FAIL(( fp, "doc hit count mismatch (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ", doclist=%d, hitlist=%d)",
-					(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID, pQword->m_uMatchHits, iDocHits ));
+	///////////////////////////
+	// check kill-list
+	///////////////////////////
 
-			if ( GetMatchSchema().m_dFields.GetLength()>32 )
-				pQword->CollectHitMask();
+	fprintf ( fp, "checking kill-list...\n" );
 
-			// check the mask
-			if ( memcmp ( dFieldMask.m_dMask, pQword->m_dQwordFields.m_dMask, sizeof(dFieldMask.m_dMask) ) && !bHitless )
-				LOC_FAIL(( fp, "field mask mismatch (wordid=" UINT64_FMT "(%s), docid=" DOCID_FMT ")",
-					(uint64_t)uWordid, sWord, pQword->m_tDoc.m_uDocID ));
+	// check that ids are ascending
+	for ( DWORD uID=1; uID<m_tKillList.GetNumEntries(); uID++ )
+		if ( m_tKillList[uID]<=m_tKillList[uID-1] )
+			LOC_FAIL(( fp, "unsorted kill-list values (val[%d]=%d, val[%d]=%d)",
+				uID-1, (DWORD)m_tKillList[uID-1], uID, (DWORD)m_tKillList[uID] ));
+
+	///////////////////////////
+	// all finished
+	///////////////////////////
+
+	// well, no known kinds of failures, maybe some unknown ones
+	tmCheck = sphMicroTimer() - tmCheck;
+	if ( !iFails )
+		fprintf ( fp, "check passed" );
+	else if ( iFails!=iFailsPrinted )
+		fprintf ( fp, "check FAILED, %d of " INT64_FMT " failures reported", iFailsPrinted, iFails );
+	else
+		fprintf ( fp, "check FAILED, " INT64_FMT " failures reported", iFails );
+	fprintf ( fp, ", %d.%d sec elapsed\n", (int)(tmCheck/1000000), (int)((tmCheck/100000)%10) );
+
+	return (int)Min ( iFails, 255 ); // this is the exitcode; so cap it
+} // NOLINT function length
+
+
+//////////////////////////////////////////////////////////////////////////
+
+/// morphology
+enum
+{
+	SPH_MORPH_STEM_EN,
+	SPH_MORPH_STEM_RU_UTF8,
+	SPH_MORPH_STEM_CZ,
+	SPH_MORPH_STEM_AR_UTF8,
+	SPH_MORPH_SOUNDEX,
+	SPH_MORPH_METAPHONE_UTF8,
+	SPH_MORPH_AOTLEMMER_BASE,
+	SPH_MORPH_AOTLEMMER_RU_UTF8 = SPH_MORPH_AOTLEMMER_BASE,
+	SPH_MORPH_AOTLEMMER_EN,
+	SPH_MORPH_AOTLEMMER_DE_UTF8,
+	SPH_MORPH_AOTLEMMER_BASE_ALL,
+	SPH_MORPH_AOTLEMMER_RU_ALL = SPH_MORPH_AOTLEMMER_BASE_ALL,
+	SPH_MORPH_AOTLEMMER_EN_ALL,
+	SPH_MORPH_AOTLEMMER_DE_ALL,
+	SPH_MORPH_LIBSTEMMER_FIRST,
+	SPH_MORPH_LIBSTEMMER_LAST = SPH_MORPH_LIBSTEMMER_FIRST + 64
+};
 
-			// update my hitlist reader
-			rdHits.SeekTo ( pQword->m_rdHitlist.GetPos(), READ_NO_SIZE_HINT );
-		}
 
-		// do checks
-		if ( iDictDocs!=iDoclistDocs )
-			LOC_FAIL(( fp, "doc count mismatch (wordid=" UINT64_FMT "(%s), dict=%d, doclist=%d, hitless=%s)",
-				uint64_t(uWordid), sWord, iDictDocs, iDoclistDocs, ( bHitless?"true":"false" ) ));
+/////////////////////////////////////////////////////////////////////////////
+// BASE DICTIONARY INTERFACE
+/////////////////////////////////////////////////////////////////////////////
 
-		if ( ( iDictHits!=iDoclistHits || iDictHits!=iHitlistHits ) && !bHitless )
-			LOC_FAIL(( fp, "hit count mismatch (wordid=" UINT64_FMT "(%s), dict=%d, doclist=%d, hitlist=%d)",
-				uint64_t(uWordid), sWord, iDictHits, iDoclistHits, iHitlistHits ));
+void CSphDict::DictBegin ( CSphAutofile &, CSphAutofile &, int, ThrottleState_t * )		{}
+void CSphDict::DictEntry ( const CSphDictEntry & )										{}
+void CSphDict::DictEndEntries ( SphOffset_t )											{}
+bool CSphDict::DictEnd ( DictHeader_t *, int, CSphString &, ThrottleState_t * )			{ return true; }
+bool CSphDict::DictIsError () const														{ return true; }
 
-		while ( m_bHaveSkips && iDoclistDocs>SPH_SKIPLIST_BLOCK && !bHitless )
-		{
-			if ( iSkipsOffset<=0 || iSkipsOffset>iSkiplistLen )
-			{
-				LOC_FAIL(( fp, "invalid skiplist offset (wordid=%llu(%s), off=%d, max=" INT64_FMT ")",
-					UINT64 ( uWordid ), sWord, iSkipsOffset, iSkiplistLen ));
-				break;
-			}
+/////////////////////////////////////////////////////////////////////////////
+// CRC32/64 DICTIONARIES
+/////////////////////////////////////////////////////////////////////////////
 
-			// boundary adjustment
-			if ( ( iDoclistDocs & ( SPH_SKIPLIST_BLOCK-1 ) )==0 )
-				dDoclistSkips.Pop();
+struct CSphTemplateDictTraits : CSphDict
+{
+	CSphTemplateDictTraits ();
+	virtual				~CSphTemplateDictTraits ();
 
-			SkiplistEntry_t t;
-			t.m_iBaseDocid = m_uMinDocid;
-			t.m_iOffset = iDoclistOffset;
-			t.m_iBaseHitlistPos = 0;
+	virtual void		LoadStopwords ( const char * sFiles, const ISphTokenizer * pTokenizer );
+	virtual void		LoadStopwords ( const CSphVector<SphWordID_t> & dStopwords );
+	virtual void		WriteStopwords ( CSphWriter & tWriter );
+	virtual bool		LoadWordforms ( const CSphVector<CSphString> & dFiles, const CSphEmbeddedFiles * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex );
+	virtual void		WriteWordforms ( CSphWriter & tWriter );
+	virtual const CSphWordforms *	GetWordforms() { return m_pWordforms; }
+	virtual void		DisableWordforms() { m_bDisableWordforms = true; }
+	virtual int			SetMorphology ( const char * szMorph, CSphString & sMessage );
+	virtual bool		HasMorphology() const;
+	virtual void		ApplyStemmers ( BYTE * pWord ) const;
 
-			// hint is: dDoclistSkips * ZIPPED( sizeof(int64_t) * 3 ) == dDoclistSkips * 8
-			rdSkips.SeekTo ( iSkipsOffset, dDoclistSkips.GetLength ()*8 );
-			int i = 0;
-			while ( ++i<dDoclistSkips.GetLength() )
-			{
-				const SkiplistEntry_t & r = dDoclistSkips[i];
+	virtual void		Setup ( const CSphDictSettings & tSettings ) { m_tSettings = tSettings; }
+	virtual const CSphDictSettings & GetSettings () const { return m_tSettings; }
+	virtual const CSphVector <CSphSavedFile> & GetStopwordsFileInfos () { return m_dSWFileInfos; }
+	virtual const CSphVector <CSphSavedFile> & GetWordformsFileInfos () { return m_dWFFileInfos; }
+	virtual const CSphMultiformContainer * GetMultiWordforms () const;
+	virtual uint64_t	GetSettingsFNV () const;
+	static void			SweepWordformContainers ( const CSphVector<CSphSavedFile> & dFiles );
 
-				uint64_t uDocidDelta = rdSkips.UnzipOffset ();
-				uint64_t uOff = rdSkips.UnzipOffset ();
-				uint64_t uPosDelta = rdSkips.UnzipOffset ();
+protected:
+	CSphVector < int >	m_dMorph;
+#if USE_LIBSTEMMER
+	CSphVector < sb_stemmer * >	m_dStemmers;
+	CSphVector<CSphString> m_dDescStemmers;
+#endif
 
-				if ( rdSkips.GetErrorFlag () )
-				{
-					LOC_FAIL ( ( fp, "skiplist reading error (wordid=%llu(%s), exp=%d, got=%d, error='%s')",
-						UINT64 ( uWordid ), sWord, i, dDoclistSkips.GetLength (), rdSkips.GetErrorMessage ().cstr () ) );
-					rdSkips.ResetError ();
-					break;
-				}
+	int					m_iStopwords;	///< stopwords count
+	SphWordID_t *		m_pStopwords;	///< stopwords ID list
+	CSphFixedVector<SphWordID_t> m_dStopwordContainer;
 
-				t.m_iBaseDocid += SPH_SKIPLIST_BLOCK + (SphDocID_t)uDocidDelta;
-				t.m_iOffset += 4*SPH_SKIPLIST_BLOCK + uOff;
-				t.m_iBaseHitlistPos += uPosDelta;
-				if ( t.m_iBaseDocid!=r.m_iBaseDocid
-					|| t.m_iOffset!=r.m_iOffset ||
-					t.m_iBaseHitlistPos!=r.m_iBaseHitlistPos )
-				{
-					LOC_FAIL(( fp, "skiplist entry %d mismatch (wordid=%llu(%s), exp={%llu, %llu, %llu}, got={%llu, %llu, %llu})",
-						i, UINT64 ( uWordid ), sWord,
-						UINT64 ( r.m_iBaseDocid ), UINT64 ( r.m_iOffset ), UINT64 ( r.m_iBaseHitlistPos ),
-						UINT64 ( t.m_iBaseDocid ), UINT64 ( t.m_iOffset ), UINT64 ( t.m_iBaseHitlistPos ) ));
-					break;
-				}
-			}
-			break;
-		}
+protected:
+	int					ParseMorphology ( const char * szMorph, CSphString & sError );
+	SphWordID_t			FilterStopword ( SphWordID_t uID ) const;	///< filter ID against stopwords list
+	CSphDict *			CloneBase ( CSphTemplateDictTraits * pDict ) const;
+	virtual bool		HasState () const;
 
-		// move my reader instance forward too
-		rdDocs.SeekTo ( pQword->m_rdDoclist.GetPos(), READ_NO_SIZE_HINT );
+	bool				m_bDisableWordforms;
 
-		// cleanup
-		SafeDelete ( pInlineStorage );
-		SafeDelete ( pQword );
+private:
+	CSphWordforms *				m_pWordforms;
+	CSphVector<CSphSavedFile>	m_dSWFileInfos;
+	CSphVector<CSphSavedFile>	m_dWFFileInfos;
+	CSphDictSettings			m_tSettings;
 
-		// progress bar
-		if ( (++iWordsChecked)%1000==0 && bProgress )
-		{
-			fprintf ( fp, "%d/%d\r", iWordsChecked, iWordsTotal );
-			fflush ( fp );
-		}
-	}
+	static CSphVector<CSphWordforms*>		m_dWordformContainers;
 
-	tDoclist = NULL;
+	CSphWordforms *		GetWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos, const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex );
+	CSphWordforms *		LoadWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos, const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex );
 
-	///////////////////////////
-	// check rows (attributes)
-	///////////////////////////
+	int					InitMorph ( const char * szMorph, int iLength, CSphString & sError );
+	int					AddMorph ( int iMorph ); ///< helper that always returns ST_OK
+	bool				StemById ( BYTE * pWord, int iStemmer ) const;
+	void				AddWordform ( CSphWordforms * pContainer, char * sBuffer, int iLen, ISphTokenizer * pTokenizer, const char * szFile, const CSphVector<int> & dBlended, int iFileId );
+};
 
-	if ( m_tSettings.m_eDocinfo==SPH_DOCINFO_EXTERN && !m_tAttr.IsEmpty() )
-	{
-		fprintf ( fp, "checking rows...\n" );
+CSphVector<CSphWordforms*> CSphTemplateDictTraits::m_dWordformContainers;
 
-		// sizes and counts
-		int64_t iRowsTotal = m_iDocinfo;
-		DWORD uStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
 
-		int64_t iAllRowsTotal = iRowsTotal;
-		iAllRowsTotal += (m_iDocinfoIndex+1)*2; // should had been fixed up to v.20 by the loader
+/// common CRC32/64 dictionary stuff
+struct CSphDiskDictTraits : CSphTemplateDictTraits
+{
+						CSphDiskDictTraits ()
+							: m_iEntries ( 0 )
+							, m_iLastDoclistPos ( 0 )
+							, m_iLastWordID ( 0 )
+						{}
+						virtual				~CSphDiskDictTraits () {}
 
-		if ( iAllRowsTotal*uStride!=(int64_t)m_tAttr.GetNumEntries() )
-			LOC_FAIL(( fp, "rowitems count mismatch (expected=" INT64_FMT ", loaded=" INT64_FMT ")",
-				iAllRowsTotal*uStride, (int64_t)m_tAttr.GetNumEntries() ));
+	virtual void DictBegin ( CSphAutofile & tTempDict, CSphAutofile & tDict, int iDictLimit, ThrottleState_t * pThrottle );
+	virtual void DictEntry ( const CSphDictEntry & tEntry );
+	virtual void DictEndEntries ( SphOffset_t iDoclistOffset );
+	virtual bool DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphString & sError, ThrottleState_t * );
+	virtual bool DictIsError () const { return m_wrDict.IsError(); }
 
-		iStrEnd = rdString.GetFilesize();
-		iMvaEnd = rdMva.GetFilesize();
-		CSphFixedVector<DWORD> dRow ( uStride );
-		CSphVector<DWORD> dMva;
-		rdAttr.SeekTo ( 0, sizeof ( dRow[0] ) * dRow.GetLength() );
+protected:
 
-		// extract rowitem indexes for MVAs etc
-		// (ie. attr types that we can and will run additional checks on)
-		CSphVector<int> dMvaItems;
-		CSphVector<CSphAttrLocator> dFloatItems;
-		CSphVector<CSphAttrLocator> dStrItems;
-		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
-		{
-			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
-			if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET || tAttr.m_eAttrType==SPH_ATTR_INT64SET )
-			{
-				if ( tAttr.m_tLocator.m_iBitCount!=ROWITEM_BITS )
-				{
-					LOC_FAIL(( fp, "unexpected MVA bitcount (attr=%d, expected=%d, got=%d)",
-						i, ROWITEM_BITS, tAttr.m_tLocator.m_iBitCount ));
-					continue;
-				}
-				if ( ( tAttr.m_tLocator.m_iBitOffset % ROWITEM_BITS )!=0 )
-				{
-					LOC_FAIL(( fp, "unaligned MVA bitoffset (attr=%d, bitoffset=%d)",
-						i, tAttr.m_tLocator.m_iBitOffset ));
-					continue;
-				}
-				if ( tAttr.m_eAttrType==SPH_ATTR_UINT32SET )
-				dMvaItems.Add ( tAttr.m_tLocator.m_iBitOffset/ROWITEM_BITS );
-			} else if ( tAttr.m_eAttrType==SPH_ATTR_FLOAT )
-				dFloatItems.Add	( tAttr.m_tLocator );
-			else if ( tAttr.m_eAttrType==SPH_ATTR_STRING || tAttr.m_eAttrType==SPH_ATTR_JSON )
-				dStrItems.Add ( tAttr.m_tLocator );
-		}
-		int iMva64 = dMvaItems.GetLength();
-		for ( int i=0; i<m_tSchema.GetAttrsCount(); i++ )
-		{
-			const CSphColumnInfo & tAttr = m_tSchema.GetAttr(i);
-			if ( tAttr.m_eAttrType==SPH_ATTR_INT64SET )
-				dMvaItems.Add ( tAttr.m_tLocator.m_iBitOffset/ROWITEM_BITS );
-		}
+	CSphTightVector<CSphWordlistCheckpoint>	m_dCheckpoints;		///< checkpoint offsets
+	CSphWriter			m_wrDict;			///< final dict file writer
+	CSphString			m_sWriterError;		///< writer error message storage
+	int					m_iEntries;			///< dictionary entries stored
+	SphOffset_t			m_iLastDoclistPos;
+	SphWordID_t			m_iLastWordID;
+};
 
-		// walk string data, build a list of acceptable start offsets
-		// must be sorted by construction
-		CSphVector<DWORD> dStringOffsets;
-		if ( m_tString.GetNumEntries()>1 )
-		{
-			rdString.SeekTo ( 1, READ_NO_SIZE_HINT );
-			while ( rdString.GetPos()<iStrEnd )
-			{
-				int64_t iLastPos = rdString.GetPos();
-				const int iLen = sphUnpackStrLength ( rdString );
 
-				// 4 bytes must be enough to encode string length, hence pCur+4
-				if ( rdString.GetPos()+iLen>iStrEnd || rdString.GetPos()>iLastPos+4 )
-				{
-					LOC_FAIL(( fp, "string length out of bounds (offset=" INT64_FMT ", len=%d)", iLastPos, iLen ));
-					break;
-				}
+template < bool CRCALGO >
+struct CCRCEngine
+{
+	inline static SphWordID_t		DoCrc ( const BYTE * pWord );
+	inline static SphWordID_t		DoCrc ( const BYTE * pWord, int iLen );
+};
 
-				dStringOffsets.Add ( (DWORD)iLastPos );
-				rdString.SkipBytes ( iLen );
-			}
-		}
+/// specialized CRC32/64 implementations
+template < bool CRC32DICT >
+struct CSphDictCRC : public CSphDiskDictTraits, CCRCEngine<CRC32DICT>
+{
+	typedef CCRCEngine<CRC32DICT> tHASH;
+	virtual SphWordID_t		GetWordID ( BYTE * pWord );
+	virtual SphWordID_t		GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops );
+	virtual SphWordID_t		GetWordIDWithMarkers ( BYTE * pWord );
+	virtual SphWordID_t		GetWordIDNonStemmed ( BYTE * pWord );
+	virtual bool			IsStopWord ( const BYTE * pWord ) const;
 
-		// loop the rows
-		int iOrphan = 0;
-		SphDocID_t uLastID = 0;
+	virtual CSphDict *		Clone () const { return CloneBase ( new CSphDictCRC<CRC32DICT>() ); }
+};
 
-		for ( int64_t iRow=0; iRow<iRowsTotal; iRow++ )
-		{
-			// fetch the row
-			rdAttr.GetBytes ( dRow.Begin(), sizeof(dRow[0])*dRow.GetLength() );
-			SphDocID_t uCurID = DOCINFO2ID ( dRow.Begin() );
+struct CSphDictTemplate : public CSphTemplateDictTraits, CCRCEngine<false> // based on flv64
+{
+	virtual SphWordID_t		GetWordID ( BYTE * pWord );
+	virtual SphWordID_t		GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops );
+	virtual SphWordID_t		GetWordIDWithMarkers ( BYTE * pWord );
+	virtual SphWordID_t		GetWordIDNonStemmed ( BYTE * pWord );
+	virtual bool			IsStopWord ( const BYTE * pWord ) const;
 
-			// check that ids are ascending
-			bool bIsSpaValid = ( uLastID<uCurID );
-			if ( !bIsSpaValid )
-				LOC_FAIL(( fp, "docid decreased (row=" INT64_FMT ", id=" DOCID_FMT ", lastid=" DOCID_FMT ")",
-					iRow, uCurID, uLastID ));
+	virtual CSphDict *		Clone () const { return CloneBase ( new CSphDictTemplate() ); }
+};
 
-			uLastID = uCurID;
 
-			///////////////////////////
-			// check MVAs
-			///////////////////////////
+/////////////////////////////////////////////////////////////////////////////
 
-			if ( dMvaItems.GetLength() )
-			{
-				bool bMvaFix = false;
-				DWORD uMvaSpaFixed = 0;
-				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
-				bool bHasValues = false;
-				bool bHasArena = false;
-				ARRAY_FOREACH ( iItem, dMvaItems )
-				{
-					const DWORD uOffset = pAttrs[dMvaItems[iItem]];
-					bHasValues |= ( uOffset!=0 );
-					bool bArena = ( ( uOffset & MVA_ARENA_FLAG )!=0 ) && !m_bArenaProhibit;
-					bHasArena |= bArena;
+uint64_t sphFNV64 ( const void * s )
+{
+	return sphFNV64cont ( s, SPH_FNV64_SEED );
+}
 
-					if ( uOffset && !bArena && uOffset>=iMvaEnd )
-					{
-						bIsSpaValid = false;
-						LOC_FAIL(( fp, "MVA index out of bounds (row=" INT64_FMT ", mvaattr=%d, docid=" DOCID_FMT ", index=%u)",
-							iRow, iItem, uLastID, uOffset ));
-					}
 
-					if ( uOffset && !bArena && uOffset<iMvaEnd && !bMvaFix )
-					{
-						uMvaSpaFixed = uOffset - sizeof(SphDocID_t) / sizeof(DWORD);
-						bMvaFix = true;
-					}
-				}
+uint64_t sphFNV64 ( const void * s, int iLen, uint64_t uPrev )
+{
+	const BYTE * p = (const BYTE*)s;
+	uint64_t hval = uPrev;
+	for ( ; iLen>0; iLen-- )
+	{
+		// xor the bottom with the current octet
+		hval ^= (uint64_t)*p++;
 
-				// MVAs ptr recovery from previous errors only if current spa record is valid
-				if ( rdMva.GetPos()!=SphOffset_t(sizeof(DWORD)*uMvaSpaFixed) && bIsSpaValid && bMvaFix )
-					rdMva.SeekTo ( sizeof(DWORD)*uMvaSpaFixed, READ_NO_SIZE_HINT );
+		// multiply by the 64 bit FNV magic prime mod 2^64
+		hval += (hval << 1) + (hval << 4) + (hval << 5) + (hval << 7) + (hval << 8) + (hval << 40); // gcc optimization
+	}
+	return hval;
+}
 
-				bool bLastIDChecked = false;
-				SphDocID_t uLastMvaID = 0;
-				while ( rdMva.GetPos()<iMvaEnd )
-				{
-					// current row does not reference any MVA values
-					// lets mark it as checked and bail
-					if ( !bHasValues )
-					{
-						bLastIDChecked = true;
-						break;
-					}
 
-					int64_t iLastPos = rdMva.GetPos();
-					const SphDocID_t uMvaID = rdMva.GetDocid();
-					if ( uMvaID>uLastID )
-						break;
+uint64_t sphFNV64cont ( const void * s, uint64_t uPrev )
+{
+	const BYTE * p = (const BYTE*)s;
+	if ( !p )
+		return uPrev;
 
-					if ( bLastIDChecked && uLastID==uMvaID )
-						LOC_FAIL(( fp, "duplicate docid found (row=" INT64_FMT ", docid expected=" DOCID_FMT ", got=" DOCID_FMT ", index=" INT64_FMT ")",
-							iRow, uLastID, uMvaID, iLastPos ));
+	uint64_t hval = uPrev;
+	while ( *p )
+	{
+		// xor the bottom with the current octet
+		hval ^= (uint64_t)*p++;
 
-					if ( uMvaID<uLastMvaID )
-						LOC_FAIL(( fp, "MVA docid decreased (row=" INT64_FMT ", spa docid=" DOCID_FMT ", last MVA docid=" DOCID_FMT ", MVA docid=" DOCID_FMT ", index=" INT64_FMT ")",
-							iRow, uLastID, uLastMvaID, uMvaID, iLastPos ));
+		// multiply by the 64 bit FNV magic prime mod 2^64
+		hval += (hval << 1) + (hval << 4) + (hval << 5) + (hval << 7) + (hval << 8) + (hval << 40); // gcc optimization
+	}
+	return hval;
+}
 
-					bool bIsMvaCorrect = ( uLastMvaID<=uMvaID && uMvaID<=uLastID );
-					uLastMvaID = uMvaID;
-					bool bWasArena = false;
-					int iLastEmpty = INT_MAX;
+/////////////////////////////////////////////////////////////////////////////
 
-					// loop MVAs
-					ARRAY_FOREACH_COND ( iItem, dMvaItems, bIsMvaCorrect )
-					{
-						const DWORD uSpaOffset = pAttrs[dMvaItems[iItem]];
-						bool bArena = ( ( uSpaOffset & MVA_ARENA_FLAG )!=0 ) && !m_bArenaProhibit;
-						bWasArena |= bArena;
+extern DWORD g_dSphinxCRC32 [ 256 ];
 
-						// zero offset means empty MVA in rt index, however plain index stores offset to zero length
-						if ( !uSpaOffset || bArena )
-						{
-							iLastEmpty = iItem;
-							continue;
-						}
+bool sphCalcFileCRC32 ( const char * szFilename, DWORD & uCRC32 )
+{
+	uCRC32 = 0;
 
-						// where also might be updated mva with zero length
-						if ( bWasArena || ( iLastEmpty==iItem-1 ) )
-							rdMva.SeekTo ( sizeof(DWORD)*uSpaOffset, READ_NO_SIZE_HINT );
-						bWasArena = false;
-						iLastEmpty = INT_MAX;
+	if ( !szFilename )
+		return false;
 
-						// check offset (index)
-						if ( uMvaID==uLastID && bIsSpaValid && rdMva.GetPos()!=int(sizeof(DWORD))*uSpaOffset )
-						{
-							LOC_FAIL(( fp, "unexpected MVA docid (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", expected=" INT64_FMT ", got=%u)",
-								iRow, iItem, uLastID, uMvaID, rdMva.GetPos()/sizeof(DWORD), uSpaOffset ));
-							// it's unexpected but it's our best guess
-							// but do fix up only once, to prevent infinite loop
-							if ( !bLastIDChecked )
-								rdMva.SeekTo ( sizeof(DWORD)*uSpaOffset, READ_NO_SIZE_HINT );
-						}
+	FILE * pFile = fopen ( szFilename, "rb" );
+	if ( !pFile )
+		return false;
 
-						if ( rdMva.GetPos()>=iMvaEnd )
-						{
-							LOC_FAIL(( fp, "MVA index out of bounds (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", index=" INT64_FMT ")",
-								iRow, iItem, uLastID, uMvaID, rdMva.GetPos()/sizeof(DWORD) ));
-							bIsMvaCorrect = false;
-							continue;
-						}
+	DWORD crc = ~((DWORD)0);
 
-						// check values
-						DWORD uValues = rdMva.GetDword();
+	const int BUFFER_SIZE = 131072;
+	static BYTE * pBuffer = NULL;
+	if ( !pBuffer )
+		pBuffer = new BYTE [ BUFFER_SIZE ];
 
-						if ( rdMva.GetPos()+int(sizeof(DWORD))*uValues-1>=iMvaEnd )
-						{
-							LOC_FAIL(( fp, "MVA count out of bounds (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", count=%u)",
-								iRow, iItem, uLastID, uMvaID, uValues ));
-							rdMva.SeekTo ( rdMva.GetPos() + sizeof(DWORD)*uValues, READ_NO_SIZE_HINT );
-							bIsMvaCorrect = false;
-							continue;
-						}
+	int iBytesRead;
+	while ( ( iBytesRead = fread ( pBuffer, 1, BUFFER_SIZE, pFile ) )!=0 )
+	{
+		for ( int i=0; i<iBytesRead; i++ )
+			crc = (crc >> 8) ^ g_dSphinxCRC32 [ (crc ^ pBuffer[i]) & 0xff ];
+	}
 
-						dMva.Resize ( uValues );
-						rdMva.GetBytes ( dMva.Begin(), sizeof(DWORD)*uValues );
+	fclose ( pFile );
 
-						// check that values are ascending
-						for ( DWORD uVal=(iItem>=iMva64 ? 2 : 1); uVal<uValues && bIsMvaCorrect; )
-						{
-							int64_t iPrev, iCur;
-							if ( iItem>=iMva64 )
-							{
-								iPrev = MVA_UPSIZE ( dMva.Begin() + uVal - 2 );
-								iCur = MVA_UPSIZE ( dMva.Begin() + uVal );
-								uVal += 2;
-							} else
-							{
-								iPrev = dMva[uVal-1];
-								iCur = dMva[uVal];
-								uVal++;
-							}
+	uCRC32 = ~crc;
+	return true;
+}
 
-							if ( iCur<=iPrev )
-							{
-								LOC_FAIL(( fp, "unsorted MVA values (row=" INT64_FMT ", mvaattr=%d, docid expected=" DOCID_FMT ", got=" DOCID_FMT ", val[%u]=%u, val[%u]=%u)",
-									iRow, iItem, uLastID, uMvaID, ( iItem>=iMva64 ? uVal-2 : uVal-1 ), (unsigned int)iPrev, uVal, (unsigned int)iCur ));
-								bIsMvaCorrect = false;
-							}
 
-							uVal += ( iItem>=iMva64 ? 2 : 1 );
-						}
-					}
+static bool GetFileStats ( const char * szFilename, CSphSavedFile & tInfo, CSphString * pError )
+{
+	if ( !szFilename || !*szFilename )
+	{
+		memset ( &tInfo, 0, sizeof ( tInfo ) );
+		return true;
+	}
 
-					if ( !bIsMvaCorrect )
-						break;
+	tInfo.m_sFilename = szFilename;
 
-					// orphan only ON no errors && ( not matched ids || ids matched multiply times )
-					if ( bIsMvaCorrect && ( uMvaID!=uLastID || ( uMvaID==uLastID && bLastIDChecked ) ) )
-						iOrphan++;
+	struct_stat tStat;
+	memset ( &tStat, 0, sizeof ( tStat ) );
+	if ( stat ( szFilename, &tStat ) < 0 )
+	{
+		if ( pError )
+			*pError = strerror ( errno );
+		memset ( &tStat, 0, sizeof ( tStat ) );
+		return false;
+	}
 
-					bLastIDChecked |= ( uLastID==uMvaID );
-				}
+	tInfo.m_uSize = tStat.st_size;
+	tInfo.m_uCTime = tStat.st_ctime;
+	tInfo.m_uMTime = tStat.st_mtime;
 
-				if ( !bLastIDChecked && bHasValues && !bHasArena )
-					LOC_FAIL(( fp, "missed or damaged MVA (row=" INT64_FMT ", docid expected=" DOCID_FMT ")",
-						iRow, uLastID ));
-			}
+	DWORD uCRC32 = 0;
+	if ( !sphCalcFileCRC32 ( szFilename, uCRC32 ) )
+		return false;
 
-			///////////////////////////
-			// check floats
-			///////////////////////////
+	tInfo.m_uCRC32 = uCRC32;
 
-			ARRAY_FOREACH ( iItem, dFloatItems )
-			{
-				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
-				const DWORD uValue = (DWORD)sphGetRowAttr ( pAttrs, dFloatItems[ iItem ] );
-				const DWORD uExp = ( uValue >> 23 ) & 0xff;
-				const DWORD uMantissa = uValue & 0x003fffff;
+	return true;
+}
 
-				// check normalized
-				if ( uExp==0 && uMantissa!=0 )
-					LOC_FAIL(( fp, "float attribute value is unnormalized (row=" INT64_FMT ", attr=%d, id=" DOCID_FMT ", raw=0x%x, value=%f)",
-						iRow, iItem, uLastID, uValue, sphDW2F ( uValue ) ));
+/////////////////////////////////////////////////////////////////////////////
 
-				// check +-inf
-				if ( uExp==0xff && uMantissa==0 )
-					LOC_FAIL(( fp, "float attribute is infinity (row=" INT64_FMT ", attr=%d, id=" DOCID_FMT ", raw=0x%x, value=%f)",
-						iRow, iItem, uLastID, uValue, sphDW2F ( uValue ) ));
-			}
+CSphWordforms::CSphWordforms()
+	: m_iRefCount ( 0 )
+	, m_uTokenizerFNV ( 0 )
+	, m_bHavePostMorphNF ( false )
+	, m_pMultiWordforms ( NULL )
+{
+}
 
-			/////////////////
-			// check strings
-			/////////////////
 
-			ARRAY_FOREACH ( iItem, dStrItems )
-			{
-				const CSphRowitem * pAttrs = DOCINFO2ATTRS ( dRow.Begin() );
+CSphWordforms::~CSphWordforms()
+{
+	if ( m_pMultiWordforms )
+	{
+		m_pMultiWordforms->m_Hash.IterateStart ();
+		while ( m_pMultiWordforms->m_Hash.IterateNext () )
+		{
+			CSphMultiforms * pWordforms = m_pMultiWordforms->m_Hash.IterateGet ();
+			ARRAY_FOREACH ( i, pWordforms->m_pForms )
+				SafeDelete ( pWordforms->m_pForms[i] );
 
-				const DWORD uOffset = (DWORD)sphGetRowAttr ( pAttrs, dStrItems[ iItem ] );
-				if ( uOffset>=iStrEnd )
-				{
-					LOC_FAIL(( fp, "string offset out of bounds (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", index=%u)",
-						iRow, iItem, uLastID, uOffset ));
-					continue;
-				}
+			SafeDelete ( pWordforms );
+		}
 
-				if ( !uOffset )
-					continue;
+		SafeDelete ( m_pMultiWordforms );
+	}
+}
 
-				rdString.SeekTo ( uOffset, READ_NO_SIZE_HINT );
-				const int iLen = sphUnpackStrLength ( rdString );
 
-				// check that length is sane
-				if ( rdString.GetPos()+iLen-1>=iStrEnd )
-				{
-					LOC_FAIL(( fp, "string length out of bounds (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", index=%u)",
-						iRow, iItem, uLastID, uOffset ));
-					continue;
-				}
+bool CSphWordforms::IsEqual ( const CSphVector<CSphSavedFile> & dFiles )
+{
+	if ( m_dFiles.GetLength()!=dFiles.GetLength() )
+		return false;
 
-				// check that offset is one of the good ones
-				// (that is, that we don't point in the middle of some other data)
-				if ( !dStringOffsets.BinarySearch ( uOffset ) )
-				{
-					LOC_FAIL(( fp, "string offset is not a string start (row=" INT64_FMT ", stringattr=%d, docid=" DOCID_FMT ", offset=%u)",
-						iRow, iItem, uLastID, uOffset ));
-				}
-			}
+	ARRAY_FOREACH ( i, m_dFiles )
+	{
+		const CSphSavedFile & tF1 = m_dFiles[i];
+		const CSphSavedFile & tF2 = dFiles[i];
+		if ( tF1.m_sFilename!=tF2.m_sFilename || tF1.m_uCRC32!=tF2.m_uCRC32 || tF1.m_uSize!=tF2.m_uSize ||
+			tF1.m_uCTime!=tF2.m_uCTime || tF1.m_uMTime!=tF2.m_uMTime )
+			return false;
+	}
 
-			// progress bar
-			if ( iRow%1000==0 && bProgress )
-			{
-				fprintf ( fp, INT64_FMT"/" INT64_FMT "\r", iRow, iRowsTotal );
-				fflush ( fp );
-			}
-		}
+	return true;
+}
 
-		if ( iOrphan )
-			fprintf ( fp, "WARNING: %d orphaned MVA entries were found\n", iOrphan );
 
-		///////////////////////////
-		// check blocks index
-		///////////////////////////
+bool CSphWordforms::ToNormalForm ( BYTE * pWord, bool bBefore, bool bOnlyCheck ) const
+{
+	int * pIndex = m_dHash ( (char *)pWord );
+	if ( !pIndex )
+		return false;
 
-		fprintf ( fp, "checking attribute blocks index...\n" );
+	if ( *pIndex<0 || *pIndex>=m_dNormalForms.GetLength () )
+		return false;
 
-		// check size
-		const int64_t iTempDocinfoIndex = ( m_iDocinfo+DOCINFO_INDEX_FREQ-1 ) / DOCINFO_INDEX_FREQ;
-		if ( iTempDocinfoIndex!=m_iDocinfoIndex )
-			LOC_FAIL(( fp, "block count differs (expected=" INT64_FMT ", got=" INT64_FMT ")",
-				iTempDocinfoIndex, m_iDocinfoIndex ));
+	if ( bBefore==m_dNormalForms[*pIndex].m_bAfterMorphology )
+		return false;
 
-		const DWORD uMinMaxStride = DOCINFO_IDSIZE + m_tSchema.GetRowSize();
-		const DWORD * pDocinfoIndexMax = m_pDocinfoIndex + ( m_iDocinfoIndex+1 )*uMinMaxStride*2;
+	if ( m_dNormalForms[*pIndex].m_sWord.IsEmpty() )
+		return false;
 
-		rdAttr.SeekTo ( 0, sizeof ( dRow[0] ) * dRow.GetLength() );
+	if ( bOnlyCheck )
+		return true;
 
-		for ( int64_t iIndexEntry=0; iIndexEntry<m_iDocinfo; iIndexEntry++ )
-		{
-			const int64_t iBlock = iIndexEntry / DOCINFO_INDEX_FREQ;
+	strcpy ( (char *)pWord, m_dNormalForms[*pIndex].m_sWord.cstr() ); // NOLINT
+	return true;
+}
 
-			// we have to do some checks in border cases, for example: when move from 1st to 2nd block
-			const int64_t iPrevEntryBlock = ( iIndexEntry-1 )/DOCINFO_INDEX_FREQ;
-			const bool bIsBordersCheckTime = ( iPrevEntryBlock!=iBlock );
+/////////////////////////////////////////////////////////////////////////////
 
-			rdAttr.GetBytes ( dRow.Begin(), sizeof(dRow[0]) * dRow.GetLength() );
-			const SphDocID_t uDocID = DOCINFO2ID ( dRow.Begin() );
+CSphTemplateDictTraits::CSphTemplateDictTraits ()
+	: m_iStopwords	( 0 )
+	, m_pStopwords	( NULL )
+	, m_dStopwordContainer ( 0 )
+	, m_bDisableWordforms ( false )
+	, m_pWordforms	( NULL )
+{
+}
 
-			const DWORD * pMinEntry = m_pDocinfoIndex + iBlock * uMinMaxStride * 2;
-			const DWORD * pMaxEntry = pMinEntry + uMinMaxStride;
-			const DWORD * pMinAttrs = DOCINFO2ATTRS ( pMinEntry );
-			const DWORD * pMaxAttrs = pMinAttrs + uMinMaxStride;
 
-			// check docid vs global range
-			if ( pMaxEntry+uMinMaxStride > pDocinfoIndexMax )
-				LOC_FAIL(( fp, "unexpected block index end (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", max=" INT64_FMT ", cur=" INT64_FMT ")",
-					iIndexEntry, uDocID, iBlock, int64_t ( pDocinfoIndexMax-m_pDocinfoIndex ), int64_t ( pMaxEntry+uMinMaxStride-m_pDocinfoIndex ) ));
+CSphTemplateDictTraits::~CSphTemplateDictTraits ()
+{
+#if USE_LIBSTEMMER
+	ARRAY_FOREACH ( i, m_dStemmers )
+		sb_stemmer_delete ( m_dStemmers[i] );
+#endif
 
-			// check attribute location vs global range
-			if ( pMaxAttrs+uMinMaxStride > pDocinfoIndexMax )
-				LOC_FAIL(( fp, "attribute position out of blocks index (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", expected<" INT64_FMT ", got=" INT64_FMT ")",
-					iIndexEntry, uDocID, iBlock, int64_t ( pDocinfoIndexMax-m_pDocinfoIndex ), int64_t ( pMaxAttrs+uMinMaxStride-m_pDocinfoIndex ) ));
+	if ( m_pWordforms )
+		--m_pWordforms->m_iRefCount;
+}
 
-			const SphDocID_t uMinDocID = DOCINFO2ID ( pMinEntry );
-			const SphDocID_t uMaxDocID = DOCINFO2ID ( pMaxEntry );
 
-			// checks is docid min max range valid
-			if ( uMinDocID > uMaxDocID && bIsBordersCheckTime )
-				LOC_FAIL(( fp, "invalid docid range (row=" INT64_FMT ", block=" INT64_FMT ", min=" DOCID_FMT ", max=" DOCID_FMT ")",
-					iIndexEntry, iBlock, uMinDocID, uMaxDocID ));
+SphWordID_t CSphTemplateDictTraits::FilterStopword ( SphWordID_t uID ) const
+{
+	if ( !m_iStopwords )
+		return uID;
 
-			// checks docid vs blocks range
-			if ( uDocID < uMinDocID || uDocID > uMaxDocID )
-				LOC_FAIL(( fp, "unexpected docid range (row=" INT64_FMT ", docid=" DOCID_FMT ", block=" INT64_FMT ", min=" DOCID_FMT ", max=" DOCID_FMT ")",
-					iIndexEntry, uDocID, iBlock, uMinDocID, uMaxDocID ));
+	// OPTIMIZE: binary search is not too good, could do some hashing instead
+	SphWordID_t * pStart = m_pStopwords;
+	SphWordID_t * pEnd = m_pStopwords + m_iStopwords - 1;
+	do
+	{
+		if ( uID==*pStart || uID==*pEnd )
+			return 0;
 
-			bool bIsFirstMva = true;
-			bool bWasArenaMva = false;
+		if ( uID<*pStart || uID>*pEnd )
+			return uID;
 
-			// check values vs blocks range
-			const DWORD * pSpaRow = DOCINFO2ATTRS ( dRow.Begin() );
-			for ( int iItem=0; iItem<m_tSchema.GetAttrsCount(); iItem++ )
-			{
-				const CSphColumnInfo & tCol = m_tSchema.GetAttr(iItem);
+		SphWordID_t * pMid = pStart + (pEnd-pStart)/2;
+		if ( uID==*pMid )
+			return 0;
 
-				switch ( tCol.m_eAttrType )
-				{
-				case SPH_ATTR_INTEGER:
-				case SPH_ATTR_TIMESTAMP:
-				case SPH_ATTR_BOOL:
-				case SPH_ATTR_BIGINT:
-					{
-						const SphAttr_t uVal = sphGetRowAttr ( pSpaRow, tCol.m_tLocator );
-						const SphAttr_t uMin = sphGetRowAttr ( pMinAttrs, tCol.m_tLocator );
-						const SphAttr_t uMax = sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator );
+		if ( uID<*pMid )
+			pEnd = pMid;
+		else
+			pStart = pMid;
+	} while ( pEnd-pStart>1 );
 
-						// checks is attribute min max range valid
-						if ( uMin > uMax && bIsBordersCheckTime )
-							LOC_FAIL(( fp, "invalid attribute range (row=" INT64_FMT ", block=" INT64_FMT ", min=" INT64_FMT ", max=" INT64_FMT ")",
-								iIndexEntry, iBlock, uMin, uMax ));
+	return uID;
+}
 
-						if ( uVal < uMin || uVal > uMax )
-							LOC_FAIL(( fp, "unexpected attribute value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", value=0x" UINT64_FMT ", min=0x" UINT64_FMT ", max=0x" UINT64_FMT ")",
-								iIndexEntry, iItem, uDocID, iBlock, uint64_t(uVal), uint64_t(uMin), uint64_t(uMax) ));
-					}
-					break;
 
-				case SPH_ATTR_FLOAT:
-					{
-						const float fVal = sphDW2F ( (DWORD)sphGetRowAttr ( pSpaRow, tCol.m_tLocator ) );
-						const float fMin = sphDW2F ( (DWORD)sphGetRowAttr ( pMinAttrs, tCol.m_tLocator ) );
-						const float fMax = sphDW2F ( (DWORD)sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator ) );
+int CSphTemplateDictTraits::ParseMorphology ( const char * sMorph, CSphString & sMessage )
+{
+	int iRes = ST_OK;
+	for ( const char * sStart=sMorph; ; )
+	{
+		while ( *sStart && ( sphIsSpace ( *sStart ) || *sStart==',' ) )
+			++sStart;
+		if ( !*sStart )
+			break;
 
-						// checks is attribute min max range valid
-						if ( fMin > fMax && bIsBordersCheckTime )
-							LOC_FAIL(( fp, "invalid attribute range (row=" INT64_FMT ", block=" INT64_FMT ", min=%f, max=%f)",
-								iIndexEntry, iBlock, fMin, fMax ));
+		const char * sWordStart = sStart;
+		while ( *sStart && !sphIsSpace ( *sStart ) && *sStart!=',' )
+			++sStart;
 
-						if ( fVal < fMin || fVal > fMax )
-							LOC_FAIL(( fp, "unexpected attribute value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", value=%f, min=%f, max=%f)",
-								iIndexEntry, iItem, uDocID, iBlock, fVal, fMin, fMax ));
-					}
-					break;
+		if ( sStart > sWordStart )
+		{
+			switch ( InitMorph ( sWordStart, sStart - sWordStart, sMessage ) )
+			{
+				case ST_ERROR:		return ST_ERROR;
+				case ST_WARNING:	iRes = ST_WARNING;
+				default:			break;
+			}
+		}
+	}
+	return iRes;
+}
 
-				case SPH_ATTR_UINT32SET:
-					{
-						const DWORD uMin = (DWORD)sphGetRowAttr ( pMinAttrs, tCol.m_tLocator );
-						const DWORD uMax = (DWORD)sphGetRowAttr ( pMaxAttrs, tCol.m_tLocator );
 
-						// checks is MVA attribute min max range valid
-						if ( uMin > uMax && bIsBordersCheckTime && uMin!=0xffffffff && uMax!=0 )
-							LOC_FAIL(( fp, "invalid MVA range (row=" INT64_FMT ", block=" INT64_FMT ", min=0x%x, max=0x%x)",
-							iIndexEntry, iBlock, uMin, uMax ));
+int CSphTemplateDictTraits::InitMorph ( const char * szMorph, int iLength, CSphString & sMessage )
+{
+	if ( iLength==0 )
+		return ST_OK;
 
-						SphAttr_t uOff = sphGetRowAttr ( pSpaRow, tCol.m_tLocator );
-						if ( !uOff || ( uOff & MVA_ARENA_FLAG )!=0 )
-						{
-							bWasArenaMva |= ( ( uOff & MVA_ARENA_FLAG )!=0 );
-							break;
-						}
+	if ( iLength==4 && !strncmp ( szMorph, "none", iLength ) )
+		return ST_OK;
 
-						SphDocID_t uMvaDocID = 0;
-						if ( bIsFirstMva && !bWasArenaMva )
-						{
-							bIsFirstMva = false;
-							rdMva.SeekTo ( sizeof(DWORD) * uOff - sizeof(SphDocID_t), READ_NO_SIZE_HINT );
-							uMvaDocID = rdMva.GetDocid();
-						} else
-						{
-							rdMva.SeekTo ( sizeof(DWORD) * uOff, READ_NO_SIZE_HINT );
-						}
+	if ( iLength==7 && !strncmp ( szMorph, "stem_en", iLength ) )
+	{
+		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_EN ) )
+		{
+			sMessage.SetSprintf ( "stem_en and lemmatize_en clash" );
+			return ST_ERROR;
+		}
 
-						if ( uOff>=iMvaEnd )
-							break;
+		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_EN_ALL ) )
+		{
+			sMessage.SetSprintf ( "stem_en and lemmatize_en_all clash" );
+			return ST_ERROR;
+		}
 
-						if ( uMvaDocID && uMvaDocID!=uDocID && !bWasArenaMva )
-						{
-							LOC_FAIL(( fp, "unexpected MVA docid (row=" INT64_FMT ", mvaattr=%d, expected=" DOCID_FMT ", got=" DOCID_FMT ", block=" INT64_FMT ", index=%u)",
-								iIndexEntry, iItem, uDocID, uMvaDocID, iBlock, (DWORD)uOff ));
-							break;
-						}
+		stem_en_init ();
+		return AddMorph ( SPH_MORPH_STEM_EN );
+	}
 
-						// check values
-						const DWORD uValues = rdMva.GetDword();
-						if ( uOff+uValues>iMvaEnd )
-							break;
+	if ( iLength==7 && !strncmp ( szMorph, "stem_ru", iLength ) )
+	{
+		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_RU_UTF8 ) )
+		{
+			sMessage.SetSprintf ( "stem_ru and lemmatize_ru clash" );
+			return ST_ERROR;
+		}
 
-						dMva.Resize ( uValues );
-						rdMva.GetBytes ( dMva.Begin(), sizeof ( dMva[0] ) * uValues );
+		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_RU_ALL ) )
+		{
+			sMessage.SetSprintf ( "stem_ru and lemmatize_ru_all clash" );
+			return ST_ERROR;
+		}
 
-						for ( DWORD iVal=0; iVal<uValues; iVal++ )
-						{
-							const DWORD uVal = dMva[iVal];
-							if ( uVal < uMin || uVal > uMax )
-								LOC_FAIL(( fp, "unexpected MVA value (row=" INT64_FMT ", attr=%u, docid=" DOCID_FMT ", block=" INT64_FMT ", index=%u, value=0x%x, min=0x%x, max=0x%x)",
-									iIndexEntry, iItem, uDocID, iBlock, iVal, (DWORD)uVal, (DWORD)uMin, (DWORD)uMax ));
-						}
-					}
-					break;
+		stem_ru_init ();
+		return AddMorph ( SPH_MORPH_STEM_RU_UTF8 );
+	}
 
-				default:
-					break;
-				}
-			}
+	for ( int j=0; j<AOT_LENGTH; ++j )
+	{
+		char buf[20];
+		char buf_all[20];
+		sprintf ( buf, "lemmatize_%s", AOT_LANGUAGES[j] ); // NOLINT
+		sprintf ( buf_all, "lemmatize_%s_all", AOT_LANGUAGES[j] ); // NOLINT
 
-			// progress bar
-			if ( iIndexEntry%1000==0 && bProgress )
+		if ( iLength==12 && !strncmp ( szMorph, buf, iLength ) )
+		{
+			if ( j==AOT_RU && m_dMorph.Contains ( SPH_MORPH_STEM_RU_UTF8 ) )
 			{
-				fprintf ( fp, INT64_FMT"/" INT64_FMT "\r", iIndexEntry, m_iDocinfo );
-				fflush ( fp );
+				sMessage.SetSprintf ( "stem_ru and lemmatize_ru clash" );
+				return ST_ERROR;
 			}
-		}
-	}
-
-	///////////////////////////
-	// check kill-list
-	///////////////////////////
 
-	fprintf ( fp, "checking kill-list...\n" );
+			if ( j==AOT_EN && m_dMorph.Contains ( SPH_MORPH_STEM_EN ) )
+			{
+				sMessage.SetSprintf ( "stem_en and lemmatize_en clash" );
+				return ST_ERROR;
+			}
 
-	// check that ids are ascending
-	for ( DWORD uID=1; uID<m_tKillList.GetNumEntries(); uID++ )
-		if ( m_tKillList[uID]<=m_tKillList[uID-1] )
-			LOC_FAIL(( fp, "unsorted kill-list values (val[%d]=%d, val[%d]=%d)",
-				uID-1, (DWORD)m_tKillList[uID-1], uID, (DWORD)m_tKillList[uID] ));
+			// no test for SPH_MORPH_STEM_DE since we doesn't have it.
 
-	///////////////////////////
-	// all finished
-	///////////////////////////
+			if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_BASE_ALL+j ) )
+			{
+				sMessage.SetSprintf ( "%s and %s clash", buf, buf_all );
+				return ST_ERROR;
+			}
 
-	// well, no known kinds of failures, maybe some unknown ones
-	tmCheck = sphMicroTimer() - tmCheck;
-	if ( !iFails )
-		fprintf ( fp, "check passed" );
-	else if ( iFails!=iFailsPrinted )
-		fprintf ( fp, "check FAILED, %d of " INT64_FMT " failures reported", iFailsPrinted, iFails );
-	else
-		fprintf ( fp, "check FAILED, " INT64_FMT " failures reported", iFails );
-	fprintf ( fp, ", %d.%d sec elapsed\n", (int)(tmCheck/1000000), (int)((tmCheck/100000)%10) );
+			CSphString sDictFile;
+			sDictFile.SetSprintf ( "%s/%s.pak", g_sLemmatizerBase.cstr(), AOT_LANGUAGES[j] );
+			if ( !sphAotInit ( sDictFile, sMessage, j ) )
+				return ST_ERROR;
 
-	return (int)Min ( iFails, 255 ); // this is the exitcode; so cap it
-} // NOLINT function length
+			// add manually instead of AddMorph(), because we need to update that fingerprint
+			int iMorph = j + SPH_MORPH_AOTLEMMER_BASE;
+			if ( j==AOT_RU )
+				iMorph = SPH_MORPH_AOTLEMMER_RU_UTF8;
+			else if ( j==AOT_DE )
+				iMorph = SPH_MORPH_AOTLEMMER_DE_UTF8;
 
+			if ( !m_dMorph.Contains ( iMorph ) )
+			{
+				if ( m_sMorphFingerprint.IsEmpty() )
+					m_sMorphFingerprint.SetSprintf ( "%s:%08x"
+						, sphAotDictinfo(j).m_sName.cstr()
+						, sphAotDictinfo(j).m_iValue );
+				else
+					m_sMorphFingerprint.SetSprintf ( "%s;%s:%08x"
+					, m_sMorphFingerprint.cstr()
+					, sphAotDictinfo(j).m_sName.cstr()
+					, sphAotDictinfo(j).m_iValue );
+				m_dMorph.Add ( iMorph );
+			}
+			return ST_OK;
+		}
 
-//////////////////////////////////////////////////////////////////////////
+		if ( iLength==16 && !strncmp ( szMorph, buf_all, iLength ) )
+		{
+			if ( j==AOT_RU && ( m_dMorph.Contains ( SPH_MORPH_STEM_RU_UTF8 ) ) )
+			{
+				sMessage.SetSprintf ( "stem_ru and lemmatize_ru_all clash" );
+				return ST_ERROR;
+			}
 
-/// morphology
-enum
-{
-	SPH_MORPH_STEM_EN,
-	SPH_MORPH_STEM_RU_UTF8,
-	SPH_MORPH_STEM_CZ,
-	SPH_MORPH_STEM_AR_UTF8,
-	SPH_MORPH_SOUNDEX,
-	SPH_MORPH_METAPHONE_UTF8,
-	SPH_MORPH_AOTLEMMER_BASE,
-	SPH_MORPH_AOTLEMMER_RU_UTF8 = SPH_MORPH_AOTLEMMER_BASE,
-	SPH_MORPH_AOTLEMMER_EN,
-	SPH_MORPH_AOTLEMMER_DE_UTF8,
-	SPH_MORPH_AOTLEMMER_BASE_ALL,
-	SPH_MORPH_AOTLEMMER_RU_ALL = SPH_MORPH_AOTLEMMER_BASE_ALL,
-	SPH_MORPH_AOTLEMMER_EN_ALL,
-	SPH_MORPH_AOTLEMMER_DE_ALL,
-	SPH_MORPH_LIBSTEMMER_FIRST,
-	SPH_MORPH_LIBSTEMMER_LAST = SPH_MORPH_LIBSTEMMER_FIRST + 64
-};
+			if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_BASE+j ) )
+			{
+				sMessage.SetSprintf ( "%s and %s clash", buf, buf_all );
+				return ST_ERROR;
+			}
 
+			CSphString sDictFile;
+			sDictFile.SetSprintf ( "%s/%s.pak", g_sLemmatizerBase.cstr(), AOT_LANGUAGES[j] );
+			if ( !sphAotInit ( sDictFile, sMessage, j ) )
+				return ST_ERROR;
 
-/////////////////////////////////////////////////////////////////////////////
-// BASE DICTIONARY INTERFACE
-/////////////////////////////////////////////////////////////////////////////
+			return AddMorph ( SPH_MORPH_AOTLEMMER_BASE_ALL+j );
+		}
+	}
 
-void CSphDict::DictBegin ( CSphAutofile &, CSphAutofile &, int, ThrottleState_t * )		{}
-void CSphDict::DictEntry ( const CSphDictEntry & )										{}
-void CSphDict::DictEndEntries ( SphOffset_t )											{}
-bool CSphDict::DictEnd ( DictHeader_t *, int, CSphString &, ThrottleState_t * )			{ return true; }
-bool CSphDict::DictIsError () const														{ return true; }
+	if ( iLength==7 && !strncmp ( szMorph, "stem_cz", iLength ) )
+	{
+		stem_cz_init ();
+		return AddMorph ( SPH_MORPH_STEM_CZ );
+	}
 
-/////////////////////////////////////////////////////////////////////////////
-// CRC32/64 DICTIONARIES
-/////////////////////////////////////////////////////////////////////////////
+	if ( iLength==7 && !strncmp ( szMorph, "stem_ar", iLength ) )
+		return AddMorph ( SPH_MORPH_STEM_AR_UTF8 );
 
-struct CSphTemplateDictTraits : CSphDict
-{
-	CSphTemplateDictTraits ();
-	virtual				~CSphTemplateDictTraits ();
+	if ( iLength==9 && !strncmp ( szMorph, "stem_enru", iLength ) )
+	{
+		stem_en_init ();
+		stem_ru_init ();
+		AddMorph ( SPH_MORPH_STEM_EN );
+		return AddMorph ( SPH_MORPH_STEM_RU_UTF8 );
+	}
 
-	virtual void		LoadStopwords ( const char * sFiles, const ISphTokenizer * pTokenizer );
-	virtual void		LoadStopwords ( const CSphVector<SphWordID_t> & dStopwords );
-	virtual void		WriteStopwords ( CSphWriter & tWriter );
-	virtual bool		LoadWordforms ( const CSphVector<CSphString> & dFiles, const CSphEmbeddedFiles * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex );
-	virtual void		WriteWordforms ( CSphWriter & tWriter );
-	virtual const CSphWordforms *	GetWordforms() { return m_pWordforms; }
-	virtual void		DisableWordforms() { m_bDisableWordforms = true; }
-	virtual int			SetMorphology ( const char * szMorph, CSphString & sMessage );
-	virtual bool		HasMorphology() const;
-	virtual void		ApplyStemmers ( BYTE * pWord ) const;
+	if ( iLength==7 && !strncmp ( szMorph, "soundex", iLength ) )
+		return AddMorph ( SPH_MORPH_SOUNDEX );
 
-	virtual void		Setup ( const CSphDictSettings & tSettings ) { m_tSettings = tSettings; }
-	virtual const CSphDictSettings & GetSettings () const { return m_tSettings; }
-	virtual const CSphVector <CSphSavedFile> & GetStopwordsFileInfos () { return m_dSWFileInfos; }
-	virtual const CSphVector <CSphSavedFile> & GetWordformsFileInfos () { return m_dWFFileInfos; }
-	virtual const CSphMultiformContainer * GetMultiWordforms () const;
-	virtual uint64_t	GetSettingsFNV () const;
-	static void			SweepWordformContainers ( const CSphVector<CSphSavedFile> & dFiles );
+	if ( iLength==9 && !strncmp ( szMorph, "metaphone", iLength ) )
+		return AddMorph ( SPH_MORPH_METAPHONE_UTF8 );
 
-protected:
-	CSphVector < int >	m_dMorph;
 #if USE_LIBSTEMMER
-	CSphVector < sb_stemmer * >	m_dStemmers;
-	CSphVector<CSphString> m_dDescStemmers;
-#endif
+	const int LIBSTEMMER_LEN = 11;
+	const int MAX_ALGO_LENGTH = 64;
+	if ( iLength > LIBSTEMMER_LEN && iLength - LIBSTEMMER_LEN < MAX_ALGO_LENGTH && !strncmp ( szMorph, "libstemmer_", LIBSTEMMER_LEN ) )
+	{
+		CSphString sAlgo;
+		sAlgo.SetBinary ( szMorph+LIBSTEMMER_LEN, iLength - LIBSTEMMER_LEN );
 
-	int					m_iStopwords;	///< stopwords count
-	SphWordID_t *		m_pStopwords;	///< stopwords ID list
-	CSphFixedVector<SphWordID_t> m_dStopwordContainer;
+		sb_stemmer * pStemmer = NULL;
 
-protected:
-	int					ParseMorphology ( const char * szMorph, CSphString & sError );
-	SphWordID_t			FilterStopword ( SphWordID_t uID ) const;	///< filter ID against stopwords list
-	CSphDict *			CloneBase ( CSphTemplateDictTraits * pDict ) const;
-	virtual bool		HasState () const;
+		pStemmer = sb_stemmer_new ( sAlgo.cstr(), "UTF_8" );
 
-	bool				m_bDisableWordforms;
+		if ( !pStemmer )
+		{
+			sMessage.SetSprintf ( "unknown stemmer libstemmer_%s; skipped", sAlgo.cstr() );
+			return ST_WARNING;
+		}
 
-private:
-	CSphWordforms *				m_pWordforms;
-	CSphVector<CSphSavedFile>	m_dSWFileInfos;
-	CSphVector<CSphSavedFile>	m_dWFFileInfos;
-	CSphDictSettings			m_tSettings;
+		AddMorph ( SPH_MORPH_LIBSTEMMER_FIRST + m_dStemmers.GetLength () );
+		ARRAY_FOREACH ( i, m_dStemmers )
+		{
+			if ( m_dStemmers[i]==pStemmer )
+			{
+				sb_stemmer_delete ( pStemmer );
+				return ST_OK;
+			}
+		}
 
-	static CSphVector<CSphWordforms*>		m_dWordformContainers;
+		m_dStemmers.Add ( pStemmer );
+		m_dDescStemmers.Add ( sAlgo );
+		return ST_OK;
+	}
+#endif
 
-	CSphWordforms *		GetWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos, const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex );
-	CSphWordforms *		LoadWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos, const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex );
+	if ( iLength==11 && !strncmp ( szMorph, "rlp_chinese", iLength ) )
+		return ST_OK;
 
-	int					InitMorph ( const char * szMorph, int iLength, CSphString & sError );
-	int					AddMorph ( int iMorph ); ///< helper that always returns ST_OK
-	bool				StemById ( BYTE * pWord, int iStemmer ) const;
-	void				AddWordform ( CSphWordforms * pContainer, char * sBuffer, int iLen, ISphTokenizer * pTokenizer, const char * szFile, const CSphVector<int> & dBlended, int iFileId );
-};
+	if ( iLength==19 && !strncmp ( szMorph, "rlp_chinese_batched", iLength ) )
+		return ST_OK;
 
-CSphVector<CSphWordforms*> CSphTemplateDictTraits::m_dWordformContainers;
+	sMessage.SetBinary ( szMorph, iLength );
+	sMessage.SetSprintf ( "unknown stemmer %s; skipped", sMessage.cstr() );
+	return ST_WARNING;
+}
 
 
-/// common CRC32/64 dictionary stuff
-struct CSphDiskDictTraits : CSphTemplateDictTraits
+int CSphTemplateDictTraits::AddMorph ( int iMorph )
 {
-						CSphDiskDictTraits ()
-							: m_iEntries ( 0 )
-							, m_iLastDoclistPos ( 0 )
-							, m_iLastWordID ( 0 )
-						{}
-						virtual				~CSphDiskDictTraits () {}
+	if ( !m_dMorph.Contains ( iMorph ) )
+		m_dMorph.Add ( iMorph );
+	return ST_OK;
+}
 
-	virtual void DictBegin ( CSphAutofile & tTempDict, CSphAutofile & tDict, int iDictLimit, ThrottleState_t * pThrottle );
-	virtual void DictEntry ( const CSphDictEntry & tEntry );
-	virtual void DictEndEntries ( SphOffset_t iDoclistOffset );
-	virtual bool DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphString & sError, ThrottleState_t * );
-	virtual bool DictIsError () const { return m_wrDict.IsError(); }
 
-protected:
 
-	CSphTightVector<CSphWordlistCheckpoint>	m_dCheckpoints;		///< checkpoint offsets
-	CSphWriter			m_wrDict;			///< final dict file writer
-	CSphString			m_sWriterError;		///< writer error message storage
-	int					m_iEntries;			///< dictionary entries stored
-	SphOffset_t			m_iLastDoclistPos;
-	SphWordID_t			m_iLastWordID;
-};
+void CSphTemplateDictTraits::ApplyStemmers ( BYTE * pWord ) const
+{
+	// try wordforms
+	if ( m_pWordforms && m_pWordforms->ToNormalForm ( pWord, true, m_bDisableWordforms ) )
+		return;
+
+	// check length
+	if ( m_tSettings.m_iMinStemmingLen<=1 || sphUTF8Len ( (const char*)pWord )>=m_tSettings.m_iMinStemmingLen )
+	{
+		// try stemmers
+		ARRAY_FOREACH ( i, m_dMorph )
+			if ( StemById ( pWord, m_dMorph[i] ) )
+				break;
+	}
 
+	if ( m_pWordforms && m_pWordforms->m_bHavePostMorphNF )
+		m_pWordforms->ToNormalForm ( pWord, false, m_bDisableWordforms );
+}
 
-template < bool CRCALGO >
-struct CCRCEngine
+const CSphMultiformContainer * CSphTemplateDictTraits::GetMultiWordforms () const
 {
-	inline static SphWordID_t		DoCrc ( const BYTE * pWord );
-	inline static SphWordID_t		DoCrc ( const BYTE * pWord, int iLen );
-};
+	return m_pWordforms ? m_pWordforms->m_pMultiWordforms : NULL;
+}
 
-/// specialized CRC32/64 implementations
-template < bool CRC32DICT >
-struct CSphDictCRC : public CSphDiskDictTraits, CCRCEngine<CRC32DICT>
+uint64_t CSphTemplateDictTraits::GetSettingsFNV () const
 {
-	typedef CCRCEngine<CRC32DICT> tHASH;
-	virtual SphWordID_t		GetWordID ( BYTE * pWord );
-	virtual SphWordID_t		GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops );
-	virtual SphWordID_t		GetWordIDWithMarkers ( BYTE * pWord );
-	virtual SphWordID_t		GetWordIDNonStemmed ( BYTE * pWord );
-	virtual bool			IsStopWord ( const BYTE * pWord ) const;
+	uint64_t uHash = (uint64_t)m_pWordforms;
 
-	virtual CSphDict *		Clone () const { return CloneBase ( new CSphDictCRC<CRC32DICT>() ); }
-};
+	if ( m_pStopwords )
+		uHash = sphFNV64 ( m_pStopwords, m_iStopwords*sizeof(*m_pStopwords), uHash );
 
-struct CSphDictTemplate : public CSphTemplateDictTraits, CCRCEngine<false> // based on flv64
+	uHash = sphFNV64 ( &m_tSettings.m_iMinStemmingLen, sizeof(m_tSettings.m_iMinStemmingLen), uHash );
+	DWORD uFlags = 0;
+	if ( m_tSettings.m_bWordDict )
+		uFlags |= 1<<0;
+	if ( m_tSettings.m_bStopwordsUnstemmed )
+		uFlags |= 1<<2;
+	uHash = sphFNV64 ( &uFlags, sizeof(uFlags), uHash );
+
+	uHash = sphFNV64 ( m_dMorph.Begin(), m_dMorph.GetLength()*sizeof(m_dMorph[0]), uHash );
+#if USE_LIBSTEMMER
+	ARRAY_FOREACH ( i, m_dDescStemmers )
+		uHash = sphFNV64 ( m_dDescStemmers[i].cstr(), m_dDescStemmers[i].Length(), uHash );
+#endif
+
+	return uHash;
+}
+
+
+CSphDict * CSphTemplateDictTraits::CloneBase ( CSphTemplateDictTraits * pDict ) const
 {
-	virtual SphWordID_t		GetWordID ( BYTE * pWord );
-	virtual SphWordID_t		GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops );
-	virtual SphWordID_t		GetWordIDWithMarkers ( BYTE * pWord );
-	virtual SphWordID_t		GetWordIDNonStemmed ( BYTE * pWord );
-	virtual bool			IsStopWord ( const BYTE * pWord ) const;
+	assert ( pDict );
+	pDict->m_tSettings = m_tSettings;
+	pDict->m_iStopwords = m_iStopwords;
+	pDict->m_pStopwords = m_pStopwords;
+	pDict->m_dSWFileInfos = m_dSWFileInfos;
+	pDict->m_dWFFileInfos = m_dWFFileInfos;
+	pDict->m_pWordforms = m_pWordforms;
+	if ( m_pWordforms )
+		m_pWordforms->m_iRefCount++;
 
-	virtual CSphDict *		Clone () const { return CloneBase ( new CSphDictTemplate() ); }
-};
+	pDict->m_dMorph = m_dMorph;
+#if USE_LIBSTEMMER
+	assert ( m_dDescStemmers.GetLength()==m_dStemmers.GetLength() );
+	pDict->m_dDescStemmers = m_dDescStemmers;
+	ARRAY_FOREACH ( i, m_dDescStemmers )
+	{
+		pDict->m_dStemmers.Add ( sb_stemmer_new ( m_dDescStemmers[i].cstr(), "UTF_8" ) );
+		assert ( pDict->m_dStemmers.Last() );
+	}
+#endif
+
+	return pDict;
+}
 
+bool CSphTemplateDictTraits::HasState() const
+{
+#if !USE_LIBSTEMMER
+	return false;
+#else
+	return ( m_dDescStemmers.GetLength()>0 );
+#endif
+}
 
 /////////////////////////////////////////////////////////////////////////////
 
-uint64_t sphFNV64 ( const void * s )
+template<>
+SphWordID_t CCRCEngine<true>::DoCrc ( const BYTE * pWord )
 {
-	return sphFNV64cont ( s, SPH_FNV64_SEED );
+	return sphCRC32 ( pWord );
 }
 
 
-uint64_t sphFNV64 ( const void * s, int iLen, uint64_t uPrev )
+template<>
+SphWordID_t CCRCEngine<false>::DoCrc ( const BYTE * pWord )
 {
-	const BYTE * p = (const BYTE*)s;
-	uint64_t hval = uPrev;
-	for ( ; iLen>0; iLen-- )
-	{
-		// xor the bottom with the current octet
-		hval ^= (uint64_t)*p++;
-
-		// multiply by the 64 bit FNV magic prime mod 2^64
-		hval += (hval << 1) + (hval << 4) + (hval << 5) + (hval << 7) + (hval << 8) + (hval << 40); // gcc optimization
-	}
-	return hval;
+	return (SphWordID_t) sphFNV64 ( pWord );
 }
 
 
-uint64_t sphFNV64cont ( const void * s, uint64_t uPrev )
+template<>
+SphWordID_t CCRCEngine<true>::DoCrc ( const BYTE * pWord, int iLen )
 {
-	const BYTE * p = (const BYTE*)s;
-	if ( !p )
-		return uPrev;
+	return sphCRC32 ( pWord, iLen );
+}
 
-	uint64_t hval = uPrev;
-	while ( *p )
-	{
-		// xor the bottom with the current octet
-		hval ^= (uint64_t)*p++;
 
-		// multiply by the 64 bit FNV magic prime mod 2^64
-		hval += (hval << 1) + (hval << 4) + (hval << 5) + (hval << 7) + (hval << 8) + (hval << 40); // gcc optimization
-	}
-	return hval;
+template<>
+SphWordID_t CCRCEngine<false>::DoCrc ( const BYTE * pWord, int iLen )
+{
+	return (SphWordID_t) sphFNV64 ( pWord, iLen );
 }
 
-/////////////////////////////////////////////////////////////////////////////
-
-extern DWORD g_dSphinxCRC32 [ 256 ];
 
-bool sphCalcFileCRC32 ( const char * szFilename, DWORD & uCRC32 )
+template < bool CRC32DICT >
+SphWordID_t CSphDictCRC<CRC32DICT>::GetWordID ( BYTE * pWord )
 {
-	uCRC32 = 0;
+	// apply stopword filter before stemmers
+	if ( GetSettings().m_bStopwordsUnstemmed && !FilterStopword ( tHASH::DoCrc ( pWord ) ) )
+		return 0;
 
-	if ( !szFilename )
-		return false;
+	// skip stemmers for magic words
+	if ( pWord[0]>=0x20 )
+		ApplyStemmers ( pWord );
 
-	FILE * pFile = fopen ( szFilename, "rb" );
-	if ( !pFile )
-		return false;
+	// stemmer might squeeze out the word
+	if ( !pWord[0] )
+		return 0;
+
+	return GetSettings().m_bStopwordsUnstemmed
+		? tHASH::DoCrc ( pWord )
+		: FilterStopword ( tHASH::DoCrc ( pWord ) );
+}
+
+
+template < bool CRC32DICT >
+SphWordID_t CSphDictCRC<CRC32DICT>::GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops )
+{
+	SphWordID_t uId = tHASH::DoCrc ( pWord, iLen );
+	return bFilterStops ? FilterStopword ( uId ) : uId;
+}
 
-	DWORD crc = ~((DWORD)0);
 
-	const int BUFFER_SIZE = 131072;
-	static BYTE * pBuffer = NULL;
-	if ( !pBuffer )
-		pBuffer = new BYTE [ BUFFER_SIZE ];
+template < bool CRC32DICT >
+SphWordID_t CSphDictCRC<CRC32DICT>::GetWordIDWithMarkers ( BYTE * pWord )
+{
+	ApplyStemmers ( pWord + 1 );
+	SphWordID_t uWordId = tHASH::DoCrc ( pWord + 1 );
+	int iLength = strlen ( (const char *)(pWord + 1) );
+	pWord [iLength + 1] = MAGIC_WORD_TAIL;
+	pWord [iLength + 2] = '\0';
+	return FilterStopword ( uWordId ) ? tHASH::DoCrc ( pWord ) : 0;
+}
 
-	int iBytesRead;
-	while ( ( iBytesRead = fread ( pBuffer, 1, BUFFER_SIZE, pFile ) )!=0 )
-	{
-		for ( int i=0; i<iBytesRead; i++ )
-			crc = (crc >> 8) ^ g_dSphinxCRC32 [ (crc ^ pBuffer[i]) & 0xff ];
-	}
 
-	fclose ( pFile );
+template < bool CRC32DICT >
+SphWordID_t CSphDictCRC<CRC32DICT>::GetWordIDNonStemmed ( BYTE * pWord )
+{
+	// this method can generally receive both '=stopword' with a marker and 'stopword' without it
+	// so for filtering stopwords, let's handle both
+	int iOff = ( pWord[0]<' ' );
+	SphWordID_t uWordId = tHASH::DoCrc ( pWord+iOff );
+	if ( !FilterStopword ( uWordId ) )
+		return 0;
 
-	uCRC32 = ~crc;
-	return true;
+	return tHASH::DoCrc ( pWord );
 }
 
 
-static bool GetFileStats ( const char * szFilename, CSphSavedFile & tInfo, CSphString * pError )
+template < bool CRC32DICT >
+bool CSphDictCRC<CRC32DICT>::IsStopWord ( const BYTE * pWord ) const
 {
-	if ( !szFilename || !*szFilename )
-	{
-		memset ( &tInfo, 0, sizeof ( tInfo ) );
-		return true;
-	}
+	return FilterStopword ( tHASH::DoCrc ( pWord ) )==0;
+}
 
-	tInfo.m_sFilename = szFilename;
 
-	struct_stat tStat;
-	memset ( &tStat, 0, sizeof ( tStat ) );
-	if ( stat ( szFilename, &tStat ) < 0 )
-	{
-		if ( pError )
-			*pError = strerror ( errno );
-		memset ( &tStat, 0, sizeof ( tStat ) );
-		return false;
-	}
+//////////////////////////////////////////////////////////////////////////
+SphWordID_t CSphDictTemplate::GetWordID ( BYTE * pWord )
+{
+	// apply stopword filter before stemmers
+	if ( GetSettings().m_bStopwordsUnstemmed && !FilterStopword ( DoCrc ( pWord ) ) )
+		return 0;
 
-	tInfo.m_uSize = tStat.st_size;
-	tInfo.m_uCTime = tStat.st_ctime;
-	tInfo.m_uMTime = tStat.st_mtime;
+	// skip stemmers for magic words
+	if ( pWord[0]>=0x20 )
+		ApplyStemmers ( pWord );
 
-	DWORD uCRC32 = 0;
-	if ( !sphCalcFileCRC32 ( szFilename, uCRC32 ) )
-		return false;
+	return GetSettings().m_bStopwordsUnstemmed
+		? DoCrc ( pWord )
+		: FilterStopword ( DoCrc ( pWord ) );
+}
 
-	tInfo.m_uCRC32 = uCRC32;
 
-	return true;
+SphWordID_t CSphDictTemplate::GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops )
+{
+	SphWordID_t uId = DoCrc ( pWord, iLen );
+	return bFilterStops ? FilterStopword ( uId ) : uId;
 }
 
-/////////////////////////////////////////////////////////////////////////////
 
-CSphWordforms::CSphWordforms()
-	: m_iRefCount ( 0 )
-	, m_uTokenizerFNV ( 0 )
-	, m_bHavePostMorphNF ( false )
-	, m_pMultiWordforms ( NULL )
+SphWordID_t CSphDictTemplate::GetWordIDWithMarkers ( BYTE * pWord )
 {
+	ApplyStemmers ( pWord + 1 );
+	// stemmer might squeeze out the word
+	if ( !pWord[1] )
+		return 0;
+	SphWordID_t uWordId = DoCrc ( pWord + 1 );
+	int iLength = strlen ( (const char *)(pWord + 1) );
+	pWord [iLength + 1] = MAGIC_WORD_TAIL;
+	pWord [iLength + 2] = '\0';
+	return FilterStopword ( uWordId ) ? DoCrc ( pWord ) : 0;
 }
 
 
-CSphWordforms::~CSphWordforms()
+SphWordID_t CSphDictTemplate::GetWordIDNonStemmed ( BYTE * pWord )
 {
-	if ( m_pMultiWordforms )
-	{
-		m_pMultiWordforms->m_Hash.IterateStart ();
-		while ( m_pMultiWordforms->m_Hash.IterateNext () )
-		{
-			CSphMultiforms * pWordforms = m_pMultiWordforms->m_Hash.IterateGet ();
-			ARRAY_FOREACH ( i, pWordforms->m_pForms )
-				SafeDelete ( pWordforms->m_pForms[i] );
+	SphWordID_t uWordId = DoCrc ( pWord + 1 );
+	if ( !FilterStopword ( uWordId ) )
+		return 0;
 
-			SafeDelete ( pWordforms );
-		}
+	return DoCrc ( pWord );
+}
 
-		SafeDelete ( m_pMultiWordforms );
-	}
+bool CSphDictTemplate::IsStopWord ( const BYTE * pWord ) const
+{
+	return FilterStopword ( DoCrc ( pWord ) )==0;
 }
 
+//////////////////////////////////////////////////////////////////////////
 
-bool CSphWordforms::IsEqual ( const CSphVector<CSphSavedFile> & dFiles )
+void CSphTemplateDictTraits::LoadStopwords ( const char * sFiles, const ISphTokenizer * pTokenizer )
 {
-	if ( m_dFiles.GetLength()!=dFiles.GetLength() )
-		return false;
+	assert ( !m_pStopwords );
+	assert ( !m_iStopwords );
 
-	ARRAY_FOREACH ( i, m_dFiles )
-	{
-		const CSphSavedFile & tF1 = m_dFiles[i];
-		const CSphSavedFile & tF2 = dFiles[i];
-		if ( tF1.m_sFilename!=tF2.m_sFilename || tF1.m_uCRC32!=tF2.m_uCRC32 || tF1.m_uSize!=tF2.m_uSize ||
-			tF1.m_uCTime!=tF2.m_uCTime || tF1.m_uMTime!=tF2.m_uMTime )
-			return false;
-	}
+	// tokenize file list
+	if ( !sFiles || !*sFiles )
+		return;
 
-	return true;
-}
+	m_dSWFileInfos.Resize ( 0 );
 
+	CSphScopedPtr<ISphTokenizer> tTokenizer ( pTokenizer->Clone ( SPH_CLONE_INDEX ) );
+	CSphFixedVector<char> dList ( 1+strlen(sFiles) );
+	strcpy ( dList.Begin(), sFiles ); // NOLINT
 
-bool CSphWordforms::ToNormalForm ( BYTE * pWord, bool bBefore, bool bOnlyCheck ) const
-{
-	int * pIndex = m_dHash ( (char *)pWord );
-	if ( !pIndex )
-		return false;
+	char * pCur = dList.Begin();
+	char * sName = NULL;
 
-	if ( *pIndex<0 || *pIndex>=m_dNormalForms.GetLength () )
-		return false;
+	CSphVector<SphWordID_t> dStop;
 
-	if ( bBefore==m_dNormalForms[*pIndex].m_bAfterMorphology )
-		return false;
+	for ( ;; )
+	{
+		// find next name start
+		while ( *pCur && isspace(*pCur) ) pCur++;
+		if ( !*pCur ) break;
+		sName = pCur;
 
-	if ( m_dNormalForms[*pIndex].m_sWord.IsEmpty() )
-		return false;
+		// find next name end
+		while ( *pCur && !isspace(*pCur) ) pCur++;
+		if ( *pCur ) *pCur++ = '\0';
 
-	if ( bOnlyCheck )
-		return true;
+		BYTE * pBuffer = NULL;
 
-	strcpy ( (char *)pWord, m_dNormalForms[*pIndex].m_sWord.cstr() ); // NOLINT
-	return true;
-}
+		CSphSavedFile tInfo;
+		tInfo.m_sFilename = sName;
+		GetFileStats ( sName, tInfo, NULL );
+		m_dSWFileInfos.Add ( tInfo );
 
-/////////////////////////////////////////////////////////////////////////////
+		// open file
+		struct_stat st;
+		if ( stat ( sName, &st )==0 )
+			pBuffer = new BYTE [(size_t)st.st_size];
+		else
+		{
+			sphWarn ( "stopwords: failed to get file size for '%s'", sName );
+			continue;
+		}
 
-CSphTemplateDictTraits::CSphTemplateDictTraits ()
-	: m_iStopwords	( 0 )
-	, m_pStopwords	( NULL )
-	, m_dStopwordContainer ( 0 )
-	, m_bDisableWordforms ( false )
-	, m_pWordforms	( NULL )
-{
-}
+		FILE * fp = fopen ( sName, "rb" );
+		if ( !fp )
+		{
+			sphWarn ( "failed to load stopwords from '%s'", sName );
+			SafeDeleteArray ( pBuffer );
+			continue;
+		}
 
+		// tokenize file
+		int iLength = (int)fread ( pBuffer, 1, (size_t)st.st_size, fp );
 
-CSphTemplateDictTraits::~CSphTemplateDictTraits ()
-{
-#if USE_LIBSTEMMER
-	ARRAY_FOREACH ( i, m_dStemmers )
-		sb_stemmer_delete ( m_dStemmers[i] );
-#endif
+		BYTE * pToken;
+		tTokenizer->SetBuffer ( pBuffer, iLength );
+		while ( ( pToken = tTokenizer->GetToken() )!=NULL )
+			if ( m_tSettings.m_bStopwordsUnstemmed )
+				dStop.Add ( GetWordIDNonStemmed ( pToken ) );
+			else
+				dStop.Add ( GetWordID ( pToken ) );
 
-	if ( m_pWordforms )
-		--m_pWordforms->m_iRefCount;
-}
+		// close file
+		fclose ( fp );
 
+		SafeDeleteArray ( pBuffer );
+	}
 
-SphWordID_t CSphTemplateDictTraits::FilterStopword ( SphWordID_t uID ) const
-{
-	if ( !m_iStopwords )
-		return uID;
+	// sort stopwords
+	dStop.Uniq();
 
-	// OPTIMIZE: binary search is not too good, could do some hashing instead
-	SphWordID_t * pStart = m_pStopwords;
-	SphWordID_t * pEnd = m_pStopwords + m_iStopwords - 1;
-	do
+	// store IDs
+	if ( dStop.GetLength() )
 	{
-		if ( uID==*pStart || uID==*pEnd )
-			return 0;
+		m_dStopwordContainer.Reset ( dStop.GetLength() );
+		ARRAY_FOREACH ( i, dStop )
+			m_dStopwordContainer[i] = dStop[i];
 
-		if ( uID<*pStart || uID>*pEnd )
-			return uID;
+		m_iStopwords = m_dStopwordContainer.GetLength ();
+		m_pStopwords = m_dStopwordContainer.Begin();
+	}
+}
 
-		SphWordID_t * pMid = pStart + (pEnd-pStart)/2;
-		if ( uID==*pMid )
-			return 0;
 
-		if ( uID<*pMid )
-			pEnd = pMid;
-		else
-			pStart = pMid;
-	} while ( pEnd-pStart>1 );
+void CSphTemplateDictTraits::LoadStopwords ( const CSphVector<SphWordID_t> & dStopwords )
+{
+	m_dStopwordContainer.Reset ( dStopwords.GetLength() );
+	ARRAY_FOREACH ( i, dStopwords )
+		m_dStopwordContainer[i] = dStopwords[i];
 
-	return uID;
+	m_iStopwords = m_dStopwordContainer.GetLength ();
+	m_pStopwords = m_dStopwordContainer.Begin();
 }
 
 
-int CSphTemplateDictTraits::ParseMorphology ( const char * sMorph, CSphString & sMessage )
+void CSphTemplateDictTraits::WriteStopwords ( CSphWriter & tWriter )
 {
-	int iRes = ST_OK;
-	for ( const char * sStart=sMorph; ; )
-	{
-		while ( *sStart && ( sphIsSpace ( *sStart ) || *sStart==',' ) )
-			++sStart;
-		if ( !*sStart )
-			break;
+	tWriter.PutDword ( (DWORD)m_iStopwords );
+	for ( int i = 0; i < m_iStopwords; i++ )
+		tWriter.ZipOffset ( m_pStopwords[i] );
+}
 
-		const char * sWordStart = sStart;
-		while ( *sStart && !sphIsSpace ( *sStart ) && *sStart!=',' )
-			++sStart;
 
-		if ( sStart > sWordStart )
+void CSphTemplateDictTraits::SweepWordformContainers ( const CSphVector<CSphSavedFile> & dFiles )
+{
+	for ( int i = 0; i < m_dWordformContainers.GetLength (); )
+	{
+		CSphWordforms * WC = m_dWordformContainers[i];
+		if ( WC->m_iRefCount==0 && !WC->IsEqual ( dFiles ) )
 		{
-			switch ( InitMorph ( sWordStart, sStart - sWordStart, sMessage ) )
-			{
-				case ST_ERROR:		return ST_ERROR;
-				case ST_WARNING:	iRes = ST_WARNING;
-				default:			break;
-			}
-		}
+			delete WC;
+			m_dWordformContainers.Remove ( i );
+		} else
+			++i;
 	}
-	return iRes;
 }
 
 
-int CSphTemplateDictTraits::InitMorph ( const char * szMorph, int iLength, CSphString & sMessage )
-{
-	if ( iLength==0 )
-		return ST_OK;
+static const int MAX_REPORT_LEN = 1024;
 
-	if ( iLength==4 && !strncmp ( szMorph, "none", iLength ) )
-		return ST_OK;
+void AddStringToReport ( CSphString & sReport, const CSphString & sString, bool bLast )
+{
+	int iLen = sReport.Length();
+	if ( iLen + sString.Length() + 2 > MAX_REPORT_LEN )
+		return;
 
-	if ( iLength==7 && !strncmp ( szMorph, "stem_en", iLength ) )
+	char * szReport = (char *)sReport.cstr();
+	strcat ( szReport, sString.cstr() );	// NOLINT
+	iLen += sString.Length();
+	if ( bLast )
+		szReport[iLen] = '\0';
+	else
 	{
-		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_EN ) )
-		{
-			sMessage.SetSprintf ( "stem_en and lemmatize_en clash" );
-			return ST_ERROR;
-		}
-
-		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_EN_ALL ) )
-		{
-			sMessage.SetSprintf ( "stem_en and lemmatize_en_all clash" );
-			return ST_ERROR;
-		}
-
-		stem_en_init ();
-		return AddMorph ( SPH_MORPH_STEM_EN );
+		szReport[iLen] = ' ';
+		szReport[iLen+1] = '\0';
 	}
+}
 
-	if ( iLength==7 && !strncmp ( szMorph, "stem_ru", iLength ) )
-	{
-		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_RU_UTF8 ) )
-		{
-			sMessage.SetSprintf ( "stem_ru and lemmatize_ru clash" );
-			return ST_ERROR;
-		}
-
-		if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_RU_ALL ) )
-		{
-			sMessage.SetSprintf ( "stem_ru and lemmatize_ru_all clash" );
-			return ST_ERROR;
-		}
 
-		stem_ru_init ();
-		return AddMorph ( SPH_MORPH_STEM_RU_UTF8 );
-	}
+void ConcatReportStrings ( const CSphTightVector<CSphString> & dStrings, CSphString & sReport )
+{
+	sReport.Reserve ( MAX_REPORT_LEN );
+	*(char *)sReport.cstr() = '\0';
 
-	for ( int j=0; j<AOT_LENGTH; ++j )
-	{
-		char buf[20];
-		char buf_all[20];
-		sprintf ( buf, "lemmatize_%s", AOT_LANGUAGES[j] ); // NOLINT
-		sprintf ( buf_all, "lemmatize_%s_all", AOT_LANGUAGES[j] ); // NOLINT
+	ARRAY_FOREACH ( i, dStrings )
+		AddStringToReport ( sReport, dStrings[i], i==dStrings.GetLength()-1 );
+}
 
-		if ( iLength==12 && !strncmp ( szMorph, buf, iLength ) )
-		{
-			if ( j==AOT_RU && m_dMorph.Contains ( SPH_MORPH_STEM_RU_UTF8 ) )
-			{
-				sMessage.SetSprintf ( "stem_ru and lemmatize_ru clash" );
-				return ST_ERROR;
-			}
 
-			if ( j==AOT_EN && m_dMorph.Contains ( SPH_MORPH_STEM_EN ) )
-			{
-				sMessage.SetSprintf ( "stem_en and lemmatize_en clash" );
-				return ST_ERROR;
-			}
+void ConcatReportStrings ( const CSphTightVector<CSphNormalForm> & dStrings, CSphString & sReport )
+{
+	sReport.Reserve ( MAX_REPORT_LEN );
+	*(char *)sReport.cstr() = '\0';
 
-			// no test for SPH_MORPH_STEM_DE since we doesn't have it.
+	ARRAY_FOREACH ( i, dStrings )
+		AddStringToReport ( sReport, dStrings[i].m_sForm, i==dStrings.GetLength()-1 );
+}
 
-			if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_BASE_ALL+j ) )
-			{
-				sMessage.SetSprintf ( "%s and %s clash", buf, buf_all );
-				return ST_ERROR;
-			}
 
-			CSphString sDictFile;
-			sDictFile.SetSprintf ( "%s/%s.pak", g_sLemmatizerBase.cstr(), AOT_LANGUAGES[j] );
-			if ( !sphAotInit ( sDictFile, sMessage, j ) )
-				return ST_ERROR;
+CSphWordforms * CSphTemplateDictTraits::GetWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos,
+	const CSphVector<CSphString> * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex )
+{
+	uint64_t uTokenizerFNV = pTokenizer->GetSettingsFNV();
+	ARRAY_FOREACH ( i, m_dWordformContainers )
+		if ( m_dWordformContainers[i]->IsEqual ( dFileInfos ) )
+		{
+			CSphWordforms * pContainer = m_dWordformContainers[i];
+			if ( uTokenizerFNV==pContainer->m_uTokenizerFNV )
+				return pContainer;
 
-			// add manually instead of AddMorph(), because we need to update that fingerprint
-			int iMorph = j + SPH_MORPH_AOTLEMMER_BASE;
-			if ( j==AOT_RU )
-				iMorph = SPH_MORPH_AOTLEMMER_RU_UTF8;
-			else if ( j==AOT_DE )
-				iMorph = SPH_MORPH_AOTLEMMER_DE_UTF8;
+			CSphTightVector<CSphString> dErrorReport;
+			ARRAY_FOREACH ( j, dFileInfos )
+				dErrorReport.Add ( dFileInfos[j].m_sFilename );
 
-			if ( !m_dMorph.Contains ( iMorph ) )
-			{
-				if ( m_sMorphFingerprint.IsEmpty() )
-					m_sMorphFingerprint.SetSprintf ( "%s:%08x"
-						, sphAotDictinfo(j).m_sName.cstr()
-						, sphAotDictinfo(j).m_iValue );
-				else
-					m_sMorphFingerprint.SetSprintf ( "%s;%s:%08x"
-					, m_sMorphFingerprint.cstr()
-					, sphAotDictinfo(j).m_sName.cstr()
-					, sphAotDictinfo(j).m_iValue );
-				m_dMorph.Add ( iMorph );
-			}
-			return ST_OK;
+			CSphString sAllFiles;
+			ConcatReportStrings ( dErrorReport, sAllFiles );
+			sphWarning ( "index '%s': wordforms file '%s' is shared with index '%s', "
+				"but tokenizer settings are different",
+				sIndex, sAllFiles.cstr(), pContainer->m_sIndexName.cstr() );
 		}
 
-		if ( iLength==16 && !strncmp ( szMorph, buf_all, iLength ) )
-		{
-			if ( j==AOT_RU && ( m_dMorph.Contains ( SPH_MORPH_STEM_RU_UTF8 ) ) )
-			{
-				sMessage.SetSprintf ( "stem_ru and lemmatize_ru_all clash" );
-				return ST_ERROR;
-			}
-
-			if ( m_dMorph.Contains ( SPH_MORPH_AOTLEMMER_BASE+j ) )
-			{
-				sMessage.SetSprintf ( "%s and %s clash", buf, buf_all );
-				return ST_ERROR;
-			}
+	CSphWordforms * pContainer = LoadWordformContainer ( dFileInfos, pEmbedded, pTokenizer, sIndex );
+	if ( pContainer )
+		m_dWordformContainers.Add ( pContainer );
 
-			CSphString sDictFile;
-			sDictFile.SetSprintf ( "%s/%s.pak", g_sLemmatizerBase.cstr(), AOT_LANGUAGES[j] );
-			if ( !sphAotInit ( sDictFile, sMessage, j ) )
-				return ST_ERROR;
+	return pContainer;
+}
 
-			return AddMorph ( SPH_MORPH_AOTLEMMER_BASE_ALL+j );
-		}
-	}
 
-	if ( iLength==7 && !strncmp ( szMorph, "stem_cz", iLength ) )
+struct CmpMultiforms_fn
+{
+	inline bool IsLess ( const CSphMultiform * pA, const CSphMultiform * pB ) const
 	{
-		stem_cz_init ();
-		return AddMorph ( SPH_MORPH_STEM_CZ );
+		assert ( pA && pB );
+		if ( pA->m_iFileId==pB->m_iFileId )
+			return pA->m_dTokens.GetLength() > pB->m_dTokens.GetLength();
+
+		return pA->m_iFileId > pB->m_iFileId;
 	}
+};
 
-	if ( iLength==7 && !strncmp ( szMorph, "stem_ar", iLength ) )
-		return AddMorph ( SPH_MORPH_STEM_AR_UTF8 );
 
-	if ( iLength==9 && !strncmp ( szMorph, "stem_enru", iLength ) )
-	{
-		stem_en_init ();
-		stem_ru_init ();
-		AddMorph ( SPH_MORPH_STEM_EN );
-		return AddMorph ( SPH_MORPH_STEM_RU_UTF8 );
-	}
+void CSphTemplateDictTraits::AddWordform ( CSphWordforms * pContainer, char * sBuffer, int iLen,
+	ISphTokenizer * pTokenizer, const char * szFile, const CSphVector<int> & dBlended, int iFileId )
+{
+	CSphVector<CSphString> dTokens;
 
-	if ( iLength==7 && !strncmp ( szMorph, "soundex", iLength ) )
-		return AddMorph ( SPH_MORPH_SOUNDEX );
+	bool bSeparatorFound = false;
+	bool bAfterMorphology = false;
 
-	if ( iLength==9 && !strncmp ( szMorph, "metaphone", iLength ) )
-		return AddMorph ( SPH_MORPH_METAPHONE_UTF8 );
+	// parse the line
+	pTokenizer->SetBuffer ( (BYTE*)sBuffer, iLen );
 
-#if USE_LIBSTEMMER
-	const int LIBSTEMMER_LEN = 11;
-	const int MAX_ALGO_LENGTH = 64;
-	if ( iLength > LIBSTEMMER_LEN && iLength - LIBSTEMMER_LEN < MAX_ALGO_LENGTH && !strncmp ( szMorph, "libstemmer_", LIBSTEMMER_LEN ) )
+	bool bFirstToken = true;
+	bool bStopwordsPresent = false;
+	bool bCommentedWholeLine = false;
+
+	BYTE * pFrom = NULL;
+	while ( ( pFrom = pTokenizer->GetToken () )!=NULL )
 	{
-		CSphString sAlgo;
-		sAlgo.SetBinary ( szMorph+LIBSTEMMER_LEN, iLength - LIBSTEMMER_LEN );
+		if ( *pFrom=='#' )
+		{
+			bCommentedWholeLine = bFirstToken;
+			break;
+		}
 
-		sb_stemmer * pStemmer = NULL;
+		if ( *pFrom=='~' && bFirstToken )
+		{
+			bAfterMorphology = true;
+			bFirstToken = false;
+			continue;
+		}
 
-		pStemmer = sb_stemmer_new ( sAlgo.cstr(), "UTF_8" );
+		bFirstToken = false;
 
-		if ( !pStemmer )
+		if ( *pFrom=='>' )
 		{
-			sMessage.SetSprintf ( "unknown stemmer libstemmer_%s; skipped", sAlgo.cstr() );
-			return ST_WARNING;
+			bSeparatorFound = true;
+			break;
 		}
 
-		AddMorph ( SPH_MORPH_LIBSTEMMER_FIRST + m_dStemmers.GetLength () );
-		ARRAY_FOREACH ( i, m_dStemmers )
+		if ( *pFrom=='=' && *pTokenizer->GetBufferPtr()=='>' )
 		{
-			if ( m_dStemmers[i]==pStemmer )
-			{
-				sb_stemmer_delete ( pStemmer );
-				return ST_OK;
-			}
+			pTokenizer->GetToken();
+			bSeparatorFound = true;
+			break;
 		}
 
-		m_dStemmers.Add ( pStemmer );
-		m_dDescStemmers.Add ( sAlgo );
-		return ST_OK;
+		if ( GetWordID ( pFrom, strlen ( (const char*)pFrom ), true ) )
+			dTokens.Add ( (const char*)pFrom );
+		else
+			bStopwordsPresent = true;
 	}
-#endif
-
-	if ( iLength==11 && !strncmp ( szMorph, "rlp_chinese", iLength ) )
-		return ST_OK;
-
-	if ( iLength==19 && !strncmp ( szMorph, "rlp_chinese_batched", iLength ) )
-		return ST_OK;
-
-	sMessage.SetBinary ( szMorph, iLength );
-	sMessage.SetSprintf ( "unknown stemmer %s; skipped", sMessage.cstr() );
-	return ST_WARNING;
-}
-
-
-int CSphTemplateDictTraits::AddMorph ( int iMorph )
-{
-	if ( !m_dMorph.Contains ( iMorph ) )
-		m_dMorph.Add ( iMorph );
-	return ST_OK;
-}
-
 
+	if ( !dTokens.GetLength() )
+	{
+		if ( !bCommentedWholeLine )
+			sphWarning ( "index '%s': all source tokens are stopwords (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+		return;
+	}
 
-void CSphTemplateDictTraits::ApplyStemmers ( BYTE * pWord ) const
-{
-	// try wordforms
-	if ( m_pWordforms && m_pWordforms->ToNormalForm ( pWord, true, m_bDisableWordforms ) )
+	if ( !bSeparatorFound )
+	{
+		sphWarning ( "index '%s': no wordform separator found (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
 		return;
+	}
 
-	// check length
-	if ( m_tSettings.m_iMinStemmingLen<=1 || sphUTF8Len ( (const char*)pWord )>=m_tSettings.m_iMinStemmingLen )
+	BYTE * pTo = pTokenizer->GetToken ();
+	if ( !pTo )
 	{
-		// try stemmers
-		ARRAY_FOREACH ( i, m_dMorph )
-			if ( StemById ( pWord, m_dMorph[i] ) )
-				break;
+		sphWarning ( "index '%s': no destination token found (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+		return;
 	}
 
-	if ( m_pWordforms && m_pWordforms->m_bHavePostMorphNF )
-		m_pWordforms->ToNormalForm ( pWord, false, m_bDisableWordforms );
-}
+	if ( *pTo=='#' )
+	{
+		sphWarning ( "index '%s': misplaced comment (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+		return;
+	}
 
-const CSphMultiformContainer * CSphTemplateDictTraits::GetMultiWordforms () const
-{
-	return m_pWordforms ? m_pWordforms->m_pMultiWordforms : NULL;
-}
+	CSphVector<CSphNormalForm> dDestTokens;
+	bool bFirstDestIsStop = !GetWordID ( pTo, strlen ( (const char*)pTo ), true );
+	CSphNormalForm & tForm = dDestTokens.Add();
+	tForm.m_sForm = (const char *)pTo;
+	tForm.m_iLengthCP = pTokenizer->GetLastTokenLen();
 
-uint64_t CSphTemplateDictTraits::GetSettingsFNV () const
-{
-	uint64_t uHash = (uint64_t)m_pWordforms;
+	// what if we have more than one word in the right part?
+	const BYTE * pDestToken;
+	while ( ( pDestToken = pTokenizer->GetToken() )!=NULL )
+	{
+		bool bStop = ( !GetWordID ( pDestToken, strlen ( (const char*)pDestToken ), true ) );
+		if ( !bStop )
+		{
+			CSphNormalForm & tForm = dDestTokens.Add();
+			tForm.m_sForm = (const char *)pDestToken;
+			tForm.m_iLengthCP = pTokenizer->GetLastTokenLen();
+		}
 
-	if ( m_pStopwords )
-		uHash = sphFNV64 ( m_pStopwords, m_iStopwords*sizeof(*m_pStopwords), uHash );
+		bStopwordsPresent |= bStop;
+	}
 
-	uHash = sphFNV64 ( &m_tSettings.m_iMinStemmingLen, sizeof(m_tSettings.m_iMinStemmingLen), uHash );
-	DWORD uFlags = 0;
-	if ( m_tSettings.m_bWordDict )
-		uFlags |= 1<<0;
-	if ( m_tSettings.m_bStopwordsUnstemmed )
-		uFlags |= 1<<2;
-	uHash = sphFNV64 ( &uFlags, sizeof(uFlags), uHash );
+	// we can have wordforms with 1 destination token that is a stopword
+	if ( dDestTokens.GetLength()>1 && bFirstDestIsStop )
+		dDestTokens.Remove(0);
 
-	uHash = sphFNV64 ( m_dMorph.Begin(), m_dMorph.GetLength()*sizeof(m_dMorph[0]), uHash );
-#if USE_LIBSTEMMER
-	ARRAY_FOREACH ( i, m_dDescStemmers )
-		uHash = sphFNV64 ( m_dDescStemmers[i].cstr(), m_dDescStemmers[i].Length(), uHash );
-#endif
+	if ( !dDestTokens.GetLength() )
+	{
+		sphWarning ( "index '%s': destination token is a stopword (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+		return;
+	}
 
-	return uHash;
-}
+	if ( bStopwordsPresent )
+		sphWarning ( "index '%s': wordform contains stopwords (wordform='%s'). Fix your wordforms file '%s'.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
 
+	// we disabled all blended, so we need to filter them manually
+	bool bBlendedPresent = false;
+	if ( dBlended.GetLength() )
+		ARRAY_FOREACH ( i, dDestTokens )
+		{
+			int iCode;
+			const BYTE * pBuf = (const BYTE *) dDestTokens[i].m_sForm.cstr();
+			while ( ( iCode = sphUTF8Decode ( pBuf ) )>0 && !bBlendedPresent )
+				bBlendedPresent = ( dBlended.BinarySearch ( iCode )!=NULL );
+		}
 
-CSphDict * CSphTemplateDictTraits::CloneBase ( CSphTemplateDictTraits * pDict ) const
-{
-	assert ( pDict );
-	pDict->m_tSettings = m_tSettings;
-	pDict->m_iStopwords = m_iStopwords;
-	pDict->m_pStopwords = m_pStopwords;
-	pDict->m_dSWFileInfos = m_dSWFileInfos;
-	pDict->m_dWFFileInfos = m_dWFFileInfos;
-	pDict->m_pWordforms = m_pWordforms;
-	if ( m_pWordforms )
-		m_pWordforms->m_iRefCount++;
+	if ( bBlendedPresent )
+		sphWarning ( "invalid mapping (destination contains blended characters) (wordform='%s'). Fix your wordforms file '%s'.", sBuffer, szFile );
 
-	pDict->m_dMorph = m_dMorph;
-#if USE_LIBSTEMMER
-	assert ( m_dDescStemmers.GetLength()==m_dStemmers.GetLength() );
-	pDict->m_dDescStemmers = m_dDescStemmers;
-	ARRAY_FOREACH ( i, m_dDescStemmers )
+	if ( bBlendedPresent && dDestTokens.GetLength()>1 )
 	{
-		pDict->m_dStemmers.Add ( sb_stemmer_new ( m_dDescStemmers[i].cstr(), "UTF_8" ) );
-		assert ( pDict->m_dStemmers.Last() );
+		sphWarning ( "blended characters are not allowed with multiple destination tokens (wordform='%s', file='%s'). IGNORED.", sBuffer, szFile );
+		return;
 	}
-#endif
 
-	return pDict;
-}
-
-bool CSphTemplateDictTraits::HasState() const
-{
-#if !USE_LIBSTEMMER
-	return false;
-#else
-	return ( m_dDescStemmers.GetLength()>0 );
-#endif
-}
-
-/////////////////////////////////////////////////////////////////////////////
-
-template<>
-SphWordID_t CCRCEngine<true>::DoCrc ( const BYTE * pWord )
-{
-	return sphCRC32 ( pWord );
-}
+	if ( dTokens.GetLength()>1 || dDestTokens.GetLength()>1 )
+	{
+		CSphMultiform * pMultiWordform = new CSphMultiform;
+		pMultiWordform->m_iFileId = iFileId;
+		pMultiWordform->m_dNormalForm.Resize ( dDestTokens.GetLength() );
+		ARRAY_FOREACH ( i, dDestTokens )
+			pMultiWordform->m_dNormalForm[i] = dDestTokens[i];
 
+		for ( int i = 1; i < dTokens.GetLength(); i++ )
+			pMultiWordform->m_dTokens.Add ( dTokens[i] );
 
-template<>
-SphWordID_t CCRCEngine<false>::DoCrc ( const BYTE * pWord )
-{
-	return (SphWordID_t) sphFNV64 ( pWord );
-}
+		if ( !pContainer->m_pMultiWordforms )
+			pContainer->m_pMultiWordforms = new CSphMultiformContainer;
 
+		CSphMultiforms ** pWordforms = pContainer->m_pMultiWordforms->m_Hash ( dTokens[0] );
+		if ( pWordforms )
+		{
+			ARRAY_FOREACH ( iMultiform, (*pWordforms)->m_pForms )
+			{
+				CSphMultiform * pStoredMF = (*pWordforms)->m_pForms[iMultiform];
+				if ( pStoredMF->m_dTokens.GetLength()==pMultiWordform->m_dTokens.GetLength() )
+				{
+					bool bSameTokens = true;
+					ARRAY_FOREACH_COND ( iToken, pStoredMF->m_dTokens, bSameTokens )
+						if ( pStoredMF->m_dTokens[iToken]!=pMultiWordform->m_dTokens[iToken] )
+							bSameTokens = false;
 
-template<>
-SphWordID_t CCRCEngine<true>::DoCrc ( const BYTE * pWord, int iLen )
-{
-	return sphCRC32 ( pWord, iLen );
-}
+					if ( bSameTokens )
+					{
+						CSphString sStoredTokens, sStoredForms;
+						ConcatReportStrings ( pStoredMF->m_dTokens, sStoredTokens );
+						ConcatReportStrings ( pStoredMF->m_dNormalForm, sStoredForms );
+						sphWarning ( "index '%s': duplicate wordform found - overridden ( current='%s', old='%s %s > %s' ). Fix your wordforms file '%s'.",
+							pContainer->m_sIndexName.cstr(), sBuffer, dTokens[0].cstr(), sStoredTokens.cstr(), sStoredForms.cstr(), szFile );
 
+						pStoredMF->m_dNormalForm.Resize ( pMultiWordform->m_dNormalForm.GetLength() );
+						ARRAY_FOREACH ( iForm, pMultiWordform->m_dNormalForm )
+							pStoredMF->m_dNormalForm[iForm] = pMultiWordform->m_dNormalForm[iForm];
 
-template<>
-SphWordID_t CCRCEngine<false>::DoCrc ( const BYTE * pWord, int iLen )
-{
-	return (SphWordID_t) sphFNV64 ( pWord, iLen );
-}
+						pStoredMF->m_iFileId = iFileId;
 
+						SafeDelete ( pMultiWordform );
+						break; // otherwise, we crash next turn
+					}
+				}
+			}
 
-template < bool CRC32DICT >
-SphWordID_t CSphDictCRC<CRC32DICT>::GetWordID ( BYTE * pWord )
-{
-	// apply stopword filter before stemmers
-	if ( GetSettings().m_bStopwordsUnstemmed && !FilterStopword ( tHASH::DoCrc ( pWord ) ) )
-		return 0;
+			if ( pMultiWordform )
+			{
+				(*pWordforms)->m_pForms.Add ( pMultiWordform );
 
-	// skip stemmers for magic words
-	if ( pWord[0]>=0x20 )
-		ApplyStemmers ( pWord );
+				// sort forms by files and length
+				// but do not sort if we're loading embedded
+				if ( iFileId>=0 )
+					(*pWordforms)->m_pForms.Sort ( CmpMultiforms_fn() );
 
-	// stemmer might squeeze out the word
-	if ( !pWord[0] )
-		return 0;
+				(*pWordforms)->m_iMinTokens = Min ( (*pWordforms)->m_iMinTokens, pMultiWordform->m_dTokens.GetLength () );
+				(*pWordforms)->m_iMaxTokens = Max ( (*pWordforms)->m_iMaxTokens, pMultiWordform->m_dTokens.GetLength () );
+				pContainer->m_pMultiWordforms->m_iMaxTokens = Max ( pContainer->m_pMultiWordforms->m_iMaxTokens, (*pWordforms)->m_iMaxTokens );
+			}
+		} else
+		{
+			CSphMultiforms * pNewWordforms = new CSphMultiforms;
+			pNewWordforms->m_pForms.Add ( pMultiWordform );
+			pNewWordforms->m_iMinTokens = pMultiWordform->m_dTokens.GetLength ();
+			pNewWordforms->m_iMaxTokens = pMultiWordform->m_dTokens.GetLength ();
+			pContainer->m_pMultiWordforms->m_iMaxTokens = Max ( pContainer->m_pMultiWordforms->m_iMaxTokens, pNewWordforms->m_iMaxTokens );
+			pContainer->m_pMultiWordforms->m_Hash.Add ( pNewWordforms, dTokens[0] );
+		}
 
-	return GetSettings().m_bStopwordsUnstemmed
-		? tHASH::DoCrc ( pWord )
-		: FilterStopword ( tHASH::DoCrc ( pWord ) );
-}
+		// let's add destination form to regular wordform to keep destination from being stemmed
+		// FIXME!!! handle multiple destination tokens and ~flag for wordforms
+		if ( !bAfterMorphology && dDestTokens.GetLength()==1 && !pContainer->m_dHash.Exists ( dDestTokens[0].m_sForm ) )
+		{
+			CSphStoredNF tForm;
+			tForm.m_sWord = dDestTokens[0].m_sForm;
+			tForm.m_bAfterMorphology = bAfterMorphology;
+			pContainer->m_bHavePostMorphNF |= bAfterMorphology;
+			if ( !pContainer->m_dNormalForms.GetLength()
+				|| pContainer->m_dNormalForms.Last().m_sWord!=dDestTokens[0].m_sForm
+				|| pContainer->m_dNormalForms.Last().m_bAfterMorphology!=bAfterMorphology )
+				pContainer->m_dNormalForms.Add ( tForm );
 
+			pContainer->m_dHash.Add ( pContainer->m_dNormalForms.GetLength()-1, dDestTokens[0].m_sForm );
+		}
+	} else
+	{
+		if ( bAfterMorphology )
+		{
+			BYTE pBuf [16+3*SPH_MAX_WORD_LEN];
+			memcpy ( pBuf, dTokens[0].cstr(), dTokens[0].Length()+1 );
+			ApplyStemmers ( pBuf );
+			dTokens[0] = (char *)pBuf;
+		}
 
-template < bool CRC32DICT >
-SphWordID_t CSphDictCRC<CRC32DICT>::GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops )
-{
-	SphWordID_t uId = tHASH::DoCrc ( pWord, iLen );
-	return bFilterStops ? FilterStopword ( uId ) : uId;
-}
+		// check wordform that source token is a new token or has same destination token
+		int * pRefTo = pContainer->m_dHash ( dTokens[0] );
+		assert ( !pRefTo || ( *pRefTo>=0 && *pRefTo<pContainer->m_dNormalForms.GetLength() ) );
+		if ( pRefTo )
+		{
+			// replace with a new wordform
+			if ( pContainer->m_dNormalForms[*pRefTo].m_sWord!=dDestTokens[0].m_sForm || pContainer->m_dNormalForms[*pRefTo].m_bAfterMorphology!=bAfterMorphology )
+			{
+				CSphStoredNF & tRefTo = pContainer->m_dNormalForms[*pRefTo];
+				sphWarning ( "index '%s': duplicate wordform found - overridden ( current='%s', old='%s%s > %s' ). Fix your wordforms file '%s'.",
+					pContainer->m_sIndexName.cstr(), sBuffer, tRefTo.m_bAfterMorphology ? "~" : "", dTokens[0].cstr(), tRefTo.m_sWord.cstr(), szFile );
 
+				tRefTo.m_sWord = dDestTokens[0].m_sForm;
+				tRefTo.m_bAfterMorphology = bAfterMorphology;
+				pContainer->m_bHavePostMorphNF |= bAfterMorphology;
+			} else
+				sphWarning ( "index '%s': duplicate wordform found ( '%s' ). Fix your wordforms file '%s'.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+		} else
+		{
+			CSphStoredNF tForm;
+			tForm.m_sWord = dDestTokens[0].m_sForm;
+			tForm.m_bAfterMorphology = bAfterMorphology;
+			pContainer->m_bHavePostMorphNF |= bAfterMorphology;
+			if ( !pContainer->m_dNormalForms.GetLength()
+				|| pContainer->m_dNormalForms.Last().m_sWord!=dDestTokens[0].m_sForm
+				|| pContainer->m_dNormalForms.Last().m_bAfterMorphology!=bAfterMorphology)
+				pContainer->m_dNormalForms.Add ( tForm );
 
-template < bool CRC32DICT >
-SphWordID_t CSphDictCRC<CRC32DICT>::GetWordIDWithMarkers ( BYTE * pWord )
-{
-	ApplyStemmers ( pWord + 1 );
-	SphWordID_t uWordId = tHASH::DoCrc ( pWord + 1 );
-	int iLength = strlen ( (const char *)(pWord + 1) );
-	pWord [iLength + 1] = MAGIC_WORD_TAIL;
-	pWord [iLength + 2] = '\0';
-	return FilterStopword ( uWordId ) ? tHASH::DoCrc ( pWord ) : 0;
+			pContainer->m_dHash.Add ( pContainer->m_dNormalForms.GetLength()-1, dTokens[0] );
+		}
+	}
 }
 
 
-template < bool CRC32DICT >
-SphWordID_t CSphDictCRC<CRC32DICT>::GetWordIDNonStemmed ( BYTE * pWord )
+CSphWordforms * CSphTemplateDictTraits::LoadWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos,
+	const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex )
 {
-	// this method can generally receive both '=stopword' with a marker and 'stopword' without it
-	// so for filtering stopwords, let's handle both
-	int iOff = ( pWord[0]<' ' );
-	SphWordID_t uWordId = tHASH::DoCrc ( pWord+iOff );
-	if ( !FilterStopword ( uWordId ) )
-		return 0;
-
-	return tHASH::DoCrc ( pWord );
-}
+	// allocate it
+	CSphWordforms * pContainer = new CSphWordforms();
+	pContainer->m_dFiles = dFileInfos;
+	pContainer->m_uTokenizerFNV = pTokenizer->GetSettingsFNV();
+	pContainer->m_sIndexName = sIndex;
 
+	CSphScopedPtr<ISphTokenizer> pMyTokenizer ( pTokenizer->Clone ( SPH_CLONE_INDEX ) );
+	const CSphTokenizerSettings & tSettings = pMyTokenizer->GetSettings();
+	CSphVector<int> dBlended;
 
-template < bool CRC32DICT >
-bool CSphDictCRC<CRC32DICT>::IsStopWord ( const BYTE * pWord ) const
-{
-	return FilterStopword ( tHASH::DoCrc ( pWord ) )==0;
-}
+	// get a list of blend chars and set add them to the tokenizer as simple chars
+	if ( tSettings.m_sBlendChars.Length() )
+	{
+		CSphVector<char> dNewCharset;
+		dNewCharset.Resize ( tSettings.m_sCaseFolding.Length() );
+		memcpy ( dNewCharset.Begin(), tSettings.m_sCaseFolding.cstr(), dNewCharset.GetLength() );
 
+		CSphVector<CSphRemapRange> dRemaps;
+		CSphCharsetDefinitionParser tParser;
+		if ( tParser.Parse ( tSettings.m_sBlendChars.cstr(), dRemaps ) )
+			ARRAY_FOREACH ( i, dRemaps )
+				for ( int j = dRemaps[i].m_iStart; j<=dRemaps[i].m_iEnd; j++ )
+				{
+					dNewCharset.Add ( ',' );
+					dNewCharset.Add ( ' ' );
+					dNewCharset.Add ( char(j) );
+					dBlended.Add ( j );
+				}
 
-//////////////////////////////////////////////////////////////////////////
-SphWordID_t CSphDictTemplate::GetWordID ( BYTE * pWord )
-{
-	// apply stopword filter before stemmers
-	if ( GetSettings().m_bStopwordsUnstemmed && !FilterStopword ( DoCrc ( pWord ) ) )
-		return 0;
+		dNewCharset.Add(0);
 
-	// skip stemmers for magic words
-	if ( pWord[0]>=0x20 )
-		ApplyStemmers ( pWord );
+		// sort dBlended for binary search
+		dBlended.Sort ();
 
-	return GetSettings().m_bStopwordsUnstemmed
-		? DoCrc ( pWord )
-		: FilterStopword ( DoCrc ( pWord ) );
-}
+		CSphString sError;
+		pMyTokenizer->SetCaseFolding ( dNewCharset.Begin(), sError );
 
+		// disable blend chars
+		pMyTokenizer->SetBlendChars ( NULL, sError );
+	}
 
-SphWordID_t CSphDictTemplate::GetWordID ( const BYTE * pWord, int iLen, bool bFilterStops )
-{
-	SphWordID_t uId = DoCrc ( pWord, iLen );
-	return bFilterStops ? FilterStopword ( uId ) : uId;
-}
+	// add wordform-specific specials
+	pMyTokenizer->AddSpecials ( "#=>~" );
 
+	if ( pEmbeddedWordforms )
+	{
+		CSphTightVector<CSphString> dFilenames;
+		dFilenames.Resize ( dFileInfos.GetLength() );
+		ARRAY_FOREACH ( i, dFileInfos )
+			dFilenames[i] = dFileInfos[i].m_sFilename;
 
-SphWordID_t CSphDictTemplate::GetWordIDWithMarkers ( BYTE * pWord )
-{
-	ApplyStemmers ( pWord + 1 );
-	// stemmer might squeeze out the word
-	if ( !pWord[1] )
-		return 0;
-	SphWordID_t uWordId = DoCrc ( pWord + 1 );
-	int iLength = strlen ( (const char *)(pWord + 1) );
-	pWord [iLength + 1] = MAGIC_WORD_TAIL;
-	pWord [iLength + 2] = '\0';
-	return FilterStopword ( uWordId ) ? DoCrc ( pWord ) : 0;
-}
+		CSphString sAllFiles;
+		ConcatReportStrings ( dFilenames, sAllFiles );
 
+		ARRAY_FOREACH ( i, (*pEmbeddedWordforms) )
+			AddWordform ( pContainer, (char*)(*pEmbeddedWordforms)[i].cstr(),
+				(*pEmbeddedWordforms)[i].Length(), pMyTokenizer.Ptr(), sAllFiles.cstr(), dBlended, -1 );
+	} else
+	{
+		char sBuffer [ 6*SPH_MAX_WORD_LEN + 512 ]; // enough to hold 2 UTF-8 words, plus some whitespace overhead
 
-SphWordID_t CSphDictTemplate::GetWordIDNonStemmed ( BYTE * pWord )
-{
-	SphWordID_t uWordId = DoCrc ( pWord + 1 );
-	if ( !FilterStopword ( uWordId ) )
-		return 0;
+		ARRAY_FOREACH ( i, dFileInfos )
+		{
+			CSphAutoreader rdWordforms;
+			const char * szFile = dFileInfos[i].m_sFilename.cstr();
+			CSphString sError;
+			if ( !rdWordforms.Open ( szFile, sError ) )
+			{
+				sphWarning ( "index '%s': %s", sIndex, sError.cstr() );
+				return NULL;
+			}
 
-	return DoCrc ( pWord );
-}
+			int iLen;
+			while ( ( iLen = rdWordforms.GetLine ( sBuffer, sizeof(sBuffer) ) )>=0 )
+				AddWordform ( pContainer, sBuffer, iLen, pMyTokenizer.Ptr(), szFile, dBlended, i );
+		}
+	}
 
-bool CSphDictTemplate::IsStopWord ( const BYTE * pWord ) const
-{
-	return FilterStopword ( DoCrc ( pWord ) )==0;
+	return pContainer;
 }
 
-//////////////////////////////////////////////////////////////////////////
 
-void CSphTemplateDictTraits::LoadStopwords ( const char * sFiles, const ISphTokenizer * pTokenizer )
+bool CSphTemplateDictTraits::LoadWordforms ( const CSphVector<CSphString> & dFiles,
+	const CSphEmbeddedFiles * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex )
 {
-	assert ( !m_pStopwords );
-	assert ( !m_iStopwords );
-
-	// tokenize file list
-	if ( !sFiles || !*sFiles )
-		return;
-
-	m_dSWFileInfos.Resize ( 0 );
-
-	CSphScopedPtr<ISphTokenizer> tTokenizer ( pTokenizer->Clone ( SPH_CLONE_INDEX ) );
-	CSphFixedVector<char> dList ( 1+strlen(sFiles) );
-	strcpy ( dList.Begin(), sFiles ); // NOLINT
+	if ( pEmbedded )
+	{
+		m_dWFFileInfos.Resize ( pEmbedded->m_dWordformFiles.GetLength() );
+		ARRAY_FOREACH ( i, m_dWFFileInfos )
+			m_dWFFileInfos[i] = pEmbedded->m_dWordformFiles[i];
+	} else
+	{
+		m_dWFFileInfos.Reserve ( dFiles.GetLength() );
+		CSphSavedFile tFile;
+		ARRAY_FOREACH ( i, dFiles )
+			if ( !dFiles[i].IsEmpty() )
+			{
+				if ( GetFileStats ( dFiles[i].cstr(), tFile, NULL ) )
+					m_dWFFileInfos.Add ( tFile );
+				else
+					sphWarning ( "index '%s': wordforms file '%s' not found", sIndex, dFiles[i].cstr() );
+			}
+	}
 
-	char * pCur = dList.Begin();
-	char * sName = NULL;
+	if ( !m_dWFFileInfos.GetLength() )
+		return false;
 
-	CSphVector<SphWordID_t> dStop;
+	SweepWordformContainers ( m_dWFFileInfos );
 
-	for ( ;; )
+	m_pWordforms = GetWordformContainer ( m_dWFFileInfos, pEmbedded ? &(pEmbedded->m_dWordforms) : NULL, pTokenizer, sIndex );
+	if ( m_pWordforms )
 	{
-		// find next name start
-		while ( *pCur && isspace(*pCur) ) pCur++;
-		if ( !*pCur ) break;
-		sName = pCur;
-
-		// find next name end
-		while ( *pCur && !isspace(*pCur) ) pCur++;
-		if ( *pCur ) *pCur++ = '\0';
+		m_pWordforms->m_iRefCount++;
+		if ( m_pWordforms->m_bHavePostMorphNF && !m_dMorph.GetLength() )
+			sphWarning ( "index '%s': wordforms contain post-morphology normal forms, but no morphology was specified", sIndex );
+	}
 
-		BYTE * pBuffer = NULL;
+	return !!m_pWordforms;
+}
 
-		CSphSavedFile tInfo;
-		tInfo.m_sFilename = sName;
-		GetFileStats ( sName, tInfo, NULL );
-		m_dSWFileInfos.Add ( tInfo );
 
-		// open file
-		struct_stat st;
-		if ( stat ( sName, &st )==0 )
-			pBuffer = new BYTE [(size_t)st.st_size];
-		else
-		{
-			sphWarn ( "stopwords: failed to get file size for '%s'", sName );
-			continue;
-		}
+void CSphTemplateDictTraits::WriteWordforms ( CSphWriter & tWriter )
+{
+	if ( !m_pWordforms )
+	{
+		tWriter.PutDword(0);
+		return;
+	}
 
-		FILE * fp = fopen ( sName, "rb" );
-		if ( !fp )
+	int nMultiforms = 0;
+	if ( m_pWordforms->m_pMultiWordforms )
+	{
+		CSphMultiformContainer::CSphMultiformHash & tHash = m_pWordforms->m_pMultiWordforms->m_Hash;
+		tHash.IterateStart();
+		while ( tHash.IterateNext() )
 		{
-			sphWarn ( "failed to load stopwords from '%s'", sName );
-			SafeDeleteArray ( pBuffer );
-			continue;
+			CSphMultiforms * pMF = tHash.IterateGet();
+			nMultiforms += pMF ? pMF->m_pForms.GetLength() : 0;
 		}
-
-		// tokenize file
-		int iLength = (int)fread ( pBuffer, 1, (size_t)st.st_size, fp );
-
-		BYTE * pToken;
-		tTokenizer->SetBuffer ( pBuffer, iLength );
-		while ( ( pToken = tTokenizer->GetToken() )!=NULL )
-			if ( m_tSettings.m_bStopwordsUnstemmed )
-				dStop.Add ( GetWordIDNonStemmed ( pToken ) );
-			else
-				dStop.Add ( GetWordID ( pToken ) );
-
-		// close file
-		fclose ( fp );
-
-		SafeDeleteArray ( pBuffer );
 	}
 
-	// sort stopwords
-	dStop.Uniq();
+	tWriter.PutDword ( m_pWordforms->m_dHash.GetLength()+nMultiforms );
+	m_pWordforms->m_dHash.IterateStart();
+	while ( m_pWordforms->m_dHash.IterateNext() )
+	{
+		const CSphString & sKey = m_pWordforms->m_dHash.IterateGetKey();
+		int iIndex = m_pWordforms->m_dHash.IterateGet();
+		CSphString sLine;
+		sLine.SetSprintf ( "%s%s > %s", m_pWordforms->m_dNormalForms[iIndex].m_bAfterMorphology ? "~" : "",
+			sKey.cstr(), m_pWordforms->m_dNormalForms[iIndex].m_sWord.cstr() );
+		tWriter.PutString ( sLine );
+	}
 
-	// store IDs
-	if ( dStop.GetLength() )
+	if ( m_pWordforms->m_pMultiWordforms )
 	{
-		m_dStopwordContainer.Reset ( dStop.GetLength() );
-		ARRAY_FOREACH ( i, dStop )
-			m_dStopwordContainer[i] = dStop[i];
+		CSphMultiformContainer::CSphMultiformHash & tHash = m_pWordforms->m_pMultiWordforms->m_Hash;
+		tHash.IterateStart();
+		while ( tHash.IterateNext() )
+		{
+			const CSphString & sKey = tHash.IterateGetKey();
+			CSphMultiforms * pMF = tHash.IterateGet();
+			if ( !pMF )
+				continue;
 
-		m_iStopwords = m_dStopwordContainer.GetLength ();
-		m_pStopwords = m_dStopwordContainer.Begin();
+			ARRAY_FOREACH ( i, pMF->m_pForms )
+			{
+				CSphString sLine, sTokens, sForms;
+				ConcatReportStrings ( pMF->m_pForms[i]->m_dTokens, sTokens );
+				ConcatReportStrings ( pMF->m_pForms[i]->m_dNormalForm, sForms );
+
+				sLine.SetSprintf ( "%s %s > %s", sKey.cstr(), sTokens.cstr(), sForms.cstr() );
+				tWriter.PutString ( sLine );
+			}
+		}
 	}
 }
 
 
-void CSphTemplateDictTraits::LoadStopwords ( const CSphVector<SphWordID_t> & dStopwords )
+int CSphTemplateDictTraits::SetMorphology ( const char * szMorph, CSphString & sMessage )
 {
-	m_dStopwordContainer.Reset ( dStopwords.GetLength() );
-	ARRAY_FOREACH ( i, dStopwords )
-		m_dStopwordContainer[i] = dStopwords[i];
+	m_dMorph.Reset ();
+#if USE_LIBSTEMMER
+	ARRAY_FOREACH ( i, m_dStemmers )
+		sb_stemmer_delete ( m_dStemmers[i] );
+	m_dStemmers.Reset ();
+#endif
 
-	m_iStopwords = m_dStopwordContainer.GetLength ();
-	m_pStopwords = m_dStopwordContainer.Begin();
+	if ( !szMorph )
+		return ST_OK;
+
+	CSphString sOption = szMorph;
+	sOption.ToLower ();
+
+	CSphString sError;
+	int iRes = ParseMorphology ( sOption.cstr(), sMessage );
+	if ( iRes==ST_WARNING && sMessage.IsEmpty() )
+		sMessage.SetSprintf ( "invalid morphology option %s; skipped", sOption.cstr() );
+	return iRes;
 }
 
 
-void CSphTemplateDictTraits::WriteStopwords ( CSphWriter & tWriter )
+bool CSphTemplateDictTraits::HasMorphology() const
 {
-	tWriter.PutDword ( (DWORD)m_iStopwords );
-	for ( int i = 0; i < m_iStopwords; i++ )
-		tWriter.ZipOffset ( m_pStopwords[i] );
+	return ( m_dMorph.GetLength()>0 );
 }
 
 
-void CSphTemplateDictTraits::SweepWordformContainers ( const CSphVector<CSphSavedFile> & dFiles )
+/// common id-based stemmer
+bool CSphTemplateDictTraits::StemById ( BYTE * pWord, int iStemmer ) const
 {
-	for ( int i = 0; i < m_dWordformContainers.GetLength (); )
+	char szBuf [ MAX_KEYWORD_BYTES ];
+
+	// safe quick strncpy without (!) padding and with a side of strlen
+	char * p = szBuf;
+	char * pMax = szBuf + sizeof(szBuf) - 1;
+	BYTE * pLastSBS = NULL;
+	while ( *pWord && p<pMax )
 	{
-		CSphWordforms * WC = m_dWordformContainers[i];
-		if ( WC->m_iRefCount==0 && !WC->IsEqual ( dFiles ) )
-		{
-			delete WC;
-			m_dWordformContainers.Remove ( i );
-		} else
-			++i;
+		pLastSBS = ( *pWord )<0x80 ? pWord : pLastSBS;
+		*p++ = *pWord++;
 	}
-}
+	int iLen = p - szBuf;
+	*p = '\0';
+	pWord -= iLen;
 
+	switch ( iStemmer )
+	{
+	case SPH_MORPH_STEM_EN:
+		stem_en ( pWord, iLen );
+		break;
 
-static const int MAX_REPORT_LEN = 1024;
+	case SPH_MORPH_STEM_RU_UTF8:
+		// skip stemming in case of SBC at the end of the word
+		if ( pLastSBS && ( pLastSBS-pWord+1 )>=iLen )
+			break;
 
-void AddStringToReport ( CSphString & sReport, const CSphString & sString, bool bLast )
-{
-	int iLen = sReport.Length();
-	if ( iLen + sString.Length() + 2 > MAX_REPORT_LEN )
-		return;
+		// stem only UTF8 tail
+		if ( !pLastSBS )
+		{
+			stem_ru_utf8 ( (WORD*)pWord );
+		} else
+		{
+			stem_ru_utf8 ( (WORD *)( pLastSBS+1 ) );
+		}
+		break;
 
-	char * szReport = (char *)sReport.cstr();
-	strcat ( szReport, sString.cstr() );	// NOLINT
-	iLen += sString.Length();
-	if ( bLast )
-		szReport[iLen] = '\0';
-	else
-	{
-		szReport[iLen] = ' ';
-		szReport[iLen+1] = '\0';
-	}
-}
+	case SPH_MORPH_STEM_CZ:
+		stem_cz ( pWord );
+		break;
 
+	case SPH_MORPH_STEM_AR_UTF8:
+		stem_ar_utf8 ( pWord );
+		break;
 
-void ConcatReportStrings ( const CSphTightVector<CSphString> & dStrings, CSphString & sReport )
-{
-	sReport.Reserve ( MAX_REPORT_LEN );
-	*(char *)sReport.cstr() = '\0';
+	case SPH_MORPH_SOUNDEX:
+		stem_soundex ( pWord );
+		break;
 
-	ARRAY_FOREACH ( i, dStrings )
-		AddStringToReport ( sReport, dStrings[i], i==dStrings.GetLength()-1 );
-}
+	case SPH_MORPH_METAPHONE_UTF8:
+		stem_dmetaphone ( pWord );
+		break;
 
+	case SPH_MORPH_AOTLEMMER_RU_UTF8:
+		sphAotLemmatizeRuUTF8 ( pWord );
+		break;
 
-void ConcatReportStrings ( const CSphTightVector<CSphNormalForm> & dStrings, CSphString & sReport )
-{
-	sReport.Reserve ( MAX_REPORT_LEN );
-	*(char *)sReport.cstr() = '\0';
+	case SPH_MORPH_AOTLEMMER_EN:
+		sphAotLemmatize ( pWord, AOT_EN );
+		break;
 
-	ARRAY_FOREACH ( i, dStrings )
-		AddStringToReport ( sReport, dStrings[i].m_sForm, i==dStrings.GetLength()-1 );
-}
+	case SPH_MORPH_AOTLEMMER_DE_UTF8:
+		sphAotLemmatizeDeUTF8 ( pWord );
+		break;
 
+	case SPH_MORPH_AOTLEMMER_RU_ALL:
+	case SPH_MORPH_AOTLEMMER_EN_ALL:
+	case SPH_MORPH_AOTLEMMER_DE_ALL:
+		// do the real work somewhere else
+		// this is mostly for warning suppressing and making some features like
+		// index_exact_words=1 vs expand_keywords=1 work
+		break;
 
-CSphWordforms * CSphTemplateDictTraits::GetWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos,
-	const CSphVector<CSphString> * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex )
-{
-	uint64_t uTokenizerFNV = pTokenizer->GetSettingsFNV();
-	ARRAY_FOREACH ( i, m_dWordformContainers )
-		if ( m_dWordformContainers[i]->IsEqual ( dFileInfos ) )
+	default:
+#if USE_LIBSTEMMER
+		if ( iStemmer>=SPH_MORPH_LIBSTEMMER_FIRST && iStemmer<SPH_MORPH_LIBSTEMMER_LAST )
 		{
-			CSphWordforms * pContainer = m_dWordformContainers[i];
-			if ( uTokenizerFNV==pContainer->m_uTokenizerFNV )
-				return pContainer;
-
-			CSphTightVector<CSphString> dErrorReport;
-			ARRAY_FOREACH ( j, dFileInfos )
-				dErrorReport.Add ( dFileInfos[j].m_sFilename );
+			sb_stemmer * pStemmer = m_dStemmers [iStemmer - SPH_MORPH_LIBSTEMMER_FIRST];
+			assert ( pStemmer );
 
-			CSphString sAllFiles;
-			ConcatReportStrings ( dErrorReport, sAllFiles );
-			sphWarning ( "index '%s': wordforms file '%s' is shared with index '%s', "
-				"but tokenizer settings are different",
-				sIndex, sAllFiles.cstr(), pContainer->m_sIndexName.cstr() );
-		}
+			const sb_symbol * sStemmed = sb_stemmer_stem ( pStemmer, (sb_symbol*)pWord, strlen ( (const char*)pWord ) );
+			int iLen = sb_stemmer_length ( pStemmer );
 
-	CSphWordforms * pContainer = LoadWordformContainer ( dFileInfos, pEmbedded, pTokenizer, sIndex );
-	if ( pContainer )
-		m_dWordformContainers.Add ( pContainer );
+			memcpy ( pWord, sStemmed, iLen );
+			pWord[iLen] = '\0';
+		} else
+			return false;
 
-	return pContainer;
+	break;
+#else
+		return false;
+#endif
+	}
+
+	return strcmp ( (char *)pWord, szBuf )!=0;
 }
 
+void CSphDiskDictTraits::DictBegin ( CSphAutofile & , CSphAutofile & tDict, int, ThrottleState_t * pThrottle )
+{
+	m_wrDict.CloseFile ();
+	m_wrDict.SetFile ( tDict, NULL, m_sWriterError );
+	m_wrDict.SetThrottle ( pThrottle );
+	m_wrDict.PutByte ( 1 );
+}
 
-struct CmpMultiforms_fn
+bool CSphDiskDictTraits::DictEnd ( DictHeader_t * pHeader, int, CSphString & sError, ThrottleState_t * )
 {
-	inline bool IsLess ( const CSphMultiform * pA, const CSphMultiform * pB ) const
+	// flush wordlist checkpoints
+	pHeader->m_iDictCheckpointsOffset = m_wrDict.GetPos();
+	pHeader->m_iDictCheckpoints = m_dCheckpoints.GetLength();
+	ARRAY_FOREACH ( i, m_dCheckpoints )
 	{
-		assert ( pA && pB );
-		if ( pA->m_iFileId==pB->m_iFileId )
-			return pA->m_dTokens.GetLength() > pB->m_dTokens.GetLength();
-
-		return pA->m_iFileId > pB->m_iFileId;
+		assert ( m_dCheckpoints[i].m_iWordlistOffset );
+		m_wrDict.PutOffset ( m_dCheckpoints[i].m_uWordID );
+		m_wrDict.PutOffset ( m_dCheckpoints[i].m_iWordlistOffset );
 	}
-};
 
+	// done
+	m_wrDict.CloseFile ();
+	if ( m_wrDict.IsError() )
+		sError = m_sWriterError;
+	return !m_wrDict.IsError();
+}
 
-void CSphTemplateDictTraits::AddWordform ( CSphWordforms * pContainer, char * sBuffer, int iLen,
-	ISphTokenizer * pTokenizer, const char * szFile, const CSphVector<int> & dBlended, int iFileId )
+void CSphDiskDictTraits::DictEntry ( const CSphDictEntry & tEntry )
 {
-	CSphVector<CSphString> dTokens;
-
-	bool bSeparatorFound = false;
-	bool bAfterMorphology = false;
-
-	// parse the line
-	pTokenizer->SetBuffer ( (BYTE*)sBuffer, iLen );
-
-	bool bFirstToken = true;
-	bool bStopwordsPresent = false;
-	bool bCommentedWholeLine = false;
-
-	BYTE * pFrom = NULL;
-	while ( ( pFrom = pTokenizer->GetToken () )!=NULL )
+	// insert wordlist checkpoint
+	if ( ( m_iEntries % SPH_WORDLIST_CHECKPOINT )==0 )
 	{
-		if ( *pFrom=='#' )
+		if ( m_iEntries ) // but not the 1st entry
 		{
-			bCommentedWholeLine = bFirstToken;
-			break;
+			assert ( tEntry.m_iDoclistOffset > m_iLastDoclistPos );
+			m_wrDict.ZipInt ( 0 ); // indicate checkpoint
+			m_wrDict.ZipOffset ( tEntry.m_iDoclistOffset - m_iLastDoclistPos ); // store last length
 		}
 
-		if ( *pFrom=='~' && bFirstToken )
-		{
-			bAfterMorphology = true;
-			bFirstToken = false;
-			continue;
-		}
+		// restart delta coding, once per SPH_WORDLIST_CHECKPOINT entries
+		m_iLastWordID = 0;
+		m_iLastDoclistPos = 0;
 
-		bFirstToken = false;
+		// begin new wordlist entry
+		assert ( m_wrDict.GetPos()<=UINT_MAX );
 
-		if ( *pFrom=='>' )
-		{
-			bSeparatorFound = true;
-			break;
-		}
+		CSphWordlistCheckpoint & tCheckpoint = m_dCheckpoints.Add();
+		tCheckpoint.m_uWordID = tEntry.m_uWordID;
+		tCheckpoint.m_iWordlistOffset = m_wrDict.GetPos();
+	}
 
-		if ( *pFrom=='=' && *pTokenizer->GetBufferPtr()=='>' )
-		{
-			pTokenizer->GetToken();
-			bSeparatorFound = true;
-			break;
-		}
+	assert ( tEntry.m_iDoclistOffset>m_iLastDoclistPos );
+	m_wrDict.ZipOffset ( tEntry.m_uWordID - m_iLastWordID ); // FIXME! slow with 32bit wordids
+	m_wrDict.ZipOffset ( tEntry.m_iDoclistOffset - m_iLastDoclistPos );
 
-		if ( GetWordID ( pFrom, strlen ( (const char*)pFrom ), true ) )
-			dTokens.Add ( (const char*)pFrom );
-		else
-			bStopwordsPresent = true;
-	}
+	m_iLastWordID = tEntry.m_uWordID;
+	m_iLastDoclistPos = tEntry.m_iDoclistOffset;
 
-	if ( !dTokens.GetLength() )
-	{
-		if ( !bCommentedWholeLine )
-			sphWarning ( "index '%s': all source tokens are stopwords (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		return;
-	}
+	assert ( tEntry.m_iDocs );
+	assert ( tEntry.m_iHits );
+	m_wrDict.ZipInt ( tEntry.m_iDocs );
+	m_wrDict.ZipInt ( tEntry.m_iHits );
 
-	if ( !bSeparatorFound )
-	{
-		sphWarning ( "index '%s': no wordform separator found (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		return;
-	}
+	// write skiplist location info, if any
+	if ( tEntry.m_iDocs > SPH_SKIPLIST_BLOCK )
+		m_wrDict.ZipOffset ( tEntry.m_iSkiplistOffset );
 
-	BYTE * pTo = pTokenizer->GetToken ();
-	if ( !pTo )
-	{
-		sphWarning ( "index '%s': no destination token found (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		return;
-	}
+	m_iEntries++;
+}
 
-	if ( *pTo=='#' )
-	{
-		sphWarning ( "index '%s': misplaced comment (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		return;
-	}
+void CSphDiskDictTraits::DictEndEntries ( SphOffset_t iDoclistOffset )
+{
+	assert ( iDoclistOffset>=m_iLastDoclistPos );
+	m_wrDict.ZipInt ( 0 ); // indicate checkpoint
+	m_wrDict.ZipOffset ( iDoclistOffset - m_iLastDoclistPos ); // store last doclist length
+}
 
-	CSphVector<CSphNormalForm> dDestTokens;
-	bool bFirstDestIsStop = !GetWordID ( pTo, strlen ( (const char*)pTo ), true );
-	CSphNormalForm & tForm = dDestTokens.Add();
-	tForm.m_sForm = (const char *)pTo;
-	tForm.m_iLengthCP = pTokenizer->GetLastTokenLen();
+//////////////////////////////////////////////////////////////////////////
+// KEYWORDS STORING DICTIONARY, INFIX HASH BUILDER
+//////////////////////////////////////////////////////////////////////////
 
-	// what if we have more than one word in the right part?
-	const BYTE * pDestToken;
-	while ( ( pDestToken = pTokenizer->GetToken() )!=NULL )
-	{
-		bool bStop = ( !GetWordID ( pDestToken, strlen ( (const char*)pDestToken ), true ) );
-		if ( !bStop )
-		{
-			CSphNormalForm & tForm = dDestTokens.Add();
-			tForm.m_sForm = (const char *)pDestToken;
-			tForm.m_iLengthCP = pTokenizer->GetLastTokenLen();
-		}
+template < int SIZE >
+struct Infix_t
+{
+	DWORD m_Data[SIZE];
 
-		bStopwordsPresent |= bStop;
-	}
+#ifndef NDEBUG
+	BYTE m_TrailingZero;
 
-	// we can have wordforms with 1 destination token that is a stopword
-	if ( dDestTokens.GetLength()>1 && bFirstDestIsStop )
-		dDestTokens.Remove(0);
+	Infix_t ()
+		: m_TrailingZero ( 0 )
+	{}
+#endif
 
-	if ( !dDestTokens.GetLength() )
+	void Reset ()
 	{
-		sphWarning ( "index '%s': destination token is a stopword (wordform='%s', file='%s'). IGNORED.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		return;
+		for ( int i=0; i<SIZE; i++ )
+			m_Data[i] = 0;
 	}
 
-	if ( bStopwordsPresent )
-		sphWarning ( "index '%s': wordform contains stopwords (wordform='%s'). Fix your wordforms file '%s'.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
+	bool operator == ( const Infix_t<SIZE> & rhs ) const;
+};
 
-	// we disabled all blended, so we need to filter them manually
-	bool bBlendedPresent = false;
-	if ( dBlended.GetLength() )
-		ARRAY_FOREACH ( i, dDestTokens )
-		{
-			int iCode;
-			const BYTE * pBuf = (const BYTE *) dDestTokens[i].m_sForm.cstr();
-			while ( ( iCode = sphUTF8Decode ( pBuf ) )>0 && !bBlendedPresent )
-				bBlendedPresent = ( dBlended.BinarySearch ( iCode )!=NULL );
-		}
 
-	if ( bBlendedPresent )
-		sphWarning ( "invalid mapping (destination contains blended characters) (wordform='%s'). Fix your wordforms file '%s'.", sBuffer, szFile );
+template<>
+bool Infix_t<2>::operator == ( const Infix_t<2> & rhs ) const
+{
+	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1];
+}
 
-	if ( bBlendedPresent && dDestTokens.GetLength()>1 )
-	{
-		sphWarning ( "blended characters are not allowed with multiple destination tokens (wordform='%s', file='%s'). IGNORED.", sBuffer, szFile );
-		return;
-	}
 
-	if ( dTokens.GetLength()>1 || dDestTokens.GetLength()>1 )
-	{
-		CSphMultiform * pMultiWordform = new CSphMultiform;
-		pMultiWordform->m_iFileId = iFileId;
-		pMultiWordform->m_dNormalForm.Resize ( dDestTokens.GetLength() );
-		ARRAY_FOREACH ( i, dDestTokens )
-			pMultiWordform->m_dNormalForm[i] = dDestTokens[i];
+template<>
+bool Infix_t<3>::operator == ( const Infix_t<3> & rhs ) const
+{
+	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1] && m_Data[2]==rhs.m_Data[2];
+}
 
-		for ( int i = 1; i < dTokens.GetLength(); i++ )
-			pMultiWordform->m_dTokens.Add ( dTokens[i] );
 
-		if ( !pContainer->m_pMultiWordforms )
-			pContainer->m_pMultiWordforms = new CSphMultiformContainer;
+template<>
+bool Infix_t<5>::operator == ( const Infix_t<5> & rhs ) const
+{
+	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1] && m_Data[2]==rhs.m_Data[2]
+		&& m_Data[3]==rhs.m_Data[3] && m_Data[4]==rhs.m_Data[4];
+}
 
-		CSphMultiforms ** pWordforms = pContainer->m_pMultiWordforms->m_Hash ( dTokens[0] );
-		if ( pWordforms )
+
+struct InfixIntvec_t
+{
+public:
+	// do not change the order of fields in this union - it matters a lot
+	union
+	{
+		DWORD			m_dData[4];
+		struct
 		{
-			ARRAY_FOREACH ( iMultiform, (*pWordforms)->m_pForms )
-			{
-				CSphMultiform * pStoredMF = (*pWordforms)->m_pForms[iMultiform];
-				if ( pStoredMF->m_dTokens.GetLength()==pMultiWordform->m_dTokens.GetLength() )
-				{
-					bool bSameTokens = true;
-					ARRAY_FOREACH_COND ( iToken, pStoredMF->m_dTokens, bSameTokens )
-						if ( pStoredMF->m_dTokens[iToken]!=pMultiWordform->m_dTokens[iToken] )
-							bSameTokens = false;
+			int				m_iDynLen;
+			int				m_iDynLimit;
+			DWORD *			m_pDynData;
+		};
+	};
+
+public:
+	InfixIntvec_t()
+	{
+		m_dData[0] = 0;
+		m_dData[1] = 0;
+		m_dData[2] = 0;
+		m_dData[3] = 0;
+	}
 
-					if ( bSameTokens )
-					{
-						CSphString sStoredTokens, sStoredForms;
-						ConcatReportStrings ( pStoredMF->m_dTokens, sStoredTokens );
-						ConcatReportStrings ( pStoredMF->m_dNormalForm, sStoredForms );
-						sphWarning ( "index '%s': duplicate wordform found - overridden ( current='%s', old='%s %s > %s' ). Fix your wordforms file '%s'.",
-							pContainer->m_sIndexName.cstr(), sBuffer, dTokens[0].cstr(), sStoredTokens.cstr(), sStoredForms.cstr(), szFile );
+	~InfixIntvec_t()
+	{
+		if ( IsDynamic() )
+			SafeDeleteArray ( m_pDynData );
+	}
 
-						pStoredMF->m_dNormalForm.Resize ( pMultiWordform->m_dNormalForm.GetLength() );
-						ARRAY_FOREACH ( iForm, pMultiWordform->m_dNormalForm )
-							pStoredMF->m_dNormalForm[iForm] = pMultiWordform->m_dNormalForm[iForm];
+	bool IsDynamic() const
+	{
+		return ( m_dData[0] & 0x80000000UL )!=0;
+	}
 
-						pStoredMF->m_iFileId = iFileId;
+	void Add ( DWORD uVal )
+	{
+		if ( !m_dData[0] )
+		{
+			// empty
+			m_dData[0] = uVal | ( 1UL<<24 );
 
-						SafeDelete ( pMultiWordform );
-						break; // otherwise, we crash next turn
-					}
-				}
-			}
+		} else if ( !IsDynamic() )
+		{
+			// 1..4 static entries
+			int iLen = m_dData[0] >> 24;
+			DWORD uLast = m_dData [ iLen-1 ] & 0xffffffUL;
 
-			if ( pMultiWordform )
+			// redundant
+			if ( uVal==uLast )
+				return;
+
+			// grow static part
+			if ( iLen<4 )
 			{
-				(*pWordforms)->m_pForms.Add ( pMultiWordform );
+				m_dData[iLen] = uVal;
+				m_dData[0] = ( m_dData[0] & 0xffffffUL ) | ( ++iLen<<24 );
+				return;
+			}
 
-				// sort forms by files and length
-				// but do not sort if we're loading embedded
-				if ( iFileId>=0 )
-					(*pWordforms)->m_pForms.Sort ( CmpMultiforms_fn() );
+			// dynamize
+			DWORD * pDyn = new DWORD[16];
+			pDyn[0] = m_dData[0] & 0xffffffUL;
+			pDyn[1] = m_dData[1];
+			pDyn[2] = m_dData[2];
+			pDyn[3] = m_dData[3];
+			pDyn[4] = uVal;
+			m_iDynLen = 0x80000005UL; // dynamic flag, len=5
+			m_iDynLimit = 16; // limit=16
+			m_pDynData = pDyn;
 
-				(*pWordforms)->m_iMinTokens = Min ( (*pWordforms)->m_iMinTokens, pMultiWordform->m_dTokens.GetLength () );
-				(*pWordforms)->m_iMaxTokens = Max ( (*pWordforms)->m_iMaxTokens, pMultiWordform->m_dTokens.GetLength () );
-				pContainer->m_pMultiWordforms->m_iMaxTokens = Max ( pContainer->m_pMultiWordforms->m_iMaxTokens, (*pWordforms)->m_iMaxTokens );
-			}
 		} else
 		{
-			CSphMultiforms * pNewWordforms = new CSphMultiforms;
-			pNewWordforms->m_pForms.Add ( pMultiWordform );
-			pNewWordforms->m_iMinTokens = pMultiWordform->m_dTokens.GetLength ();
-			pNewWordforms->m_iMaxTokens = pMultiWordform->m_dTokens.GetLength ();
-			pContainer->m_pMultiWordforms->m_iMaxTokens = Max ( pContainer->m_pMultiWordforms->m_iMaxTokens, pNewWordforms->m_iMaxTokens );
-			pContainer->m_pMultiWordforms->m_Hash.Add ( pNewWordforms, dTokens[0] );
-		}
-
-		// let's add destination form to regular wordform to keep destination from being stemmed
-		// FIXME!!! handle multiple destination tokens and ~flag for wordforms
-		if ( !bAfterMorphology && dDestTokens.GetLength()==1 && !pContainer->m_dHash.Exists ( dDestTokens[0].m_sForm ) )
-		{
-			CSphStoredNF tForm;
-			tForm.m_sWord = dDestTokens[0].m_sForm;
-			tForm.m_bAfterMorphology = bAfterMorphology;
-			pContainer->m_bHavePostMorphNF |= bAfterMorphology;
-			if ( !pContainer->m_dNormalForms.GetLength()
-				|| pContainer->m_dNormalForms.Last().m_sWord!=dDestTokens[0].m_sForm
-				|| pContainer->m_dNormalForms.Last().m_bAfterMorphology!=bAfterMorphology )
-				pContainer->m_dNormalForms.Add ( tForm );
+			// N dynamic entries
+			int iLen = m_iDynLen & 0xffffffUL;
+			if ( uVal==m_pDynData[iLen-1] )
+				return;
+			if ( iLen>=m_iDynLimit )
+			{
+				m_iDynLimit *= 2;
+				DWORD * pNew = new DWORD [ m_iDynLimit ];
+				for ( int i=0; i<iLen; i++ )
+					pNew[i] = m_pDynData[i];
+				SafeDeleteArray ( m_pDynData );
+				m_pDynData = pNew;
+			}
 
-			pContainer->m_dHash.Add ( pContainer->m_dNormalForms.GetLength()-1, dDestTokens[0].m_sForm );
+			m_pDynData[iLen] = uVal;
+			m_iDynLen++;
 		}
-	} else
+	}
+
+	bool operator == ( const InfixIntvec_t & rhs ) const
 	{
-		if ( bAfterMorphology )
+		// check dynflag, length, maybe first element
+		if ( m_dData[0]!=rhs.m_dData[0] )
+			return false;
+
+		// check static data
+		if ( !IsDynamic() )
 		{
-			BYTE pBuf [16+3*SPH_MAX_WORD_LEN];
-			memcpy ( pBuf, dTokens[0].cstr(), dTokens[0].Length()+1 );
-			ApplyStemmers ( pBuf );
-			dTokens[0] = (char *)pBuf;
+			for ( int i=1; i<(int)(m_dData[0]>>24); i++ )
+				if ( m_dData[i]!=rhs.m_dData[i] )
+					return false;
+			return true;
 		}
 
-		// check wordform that source token is a new token or has same destination token
-		int * pRefTo = pContainer->m_dHash ( dTokens[0] );
-		assert ( !pRefTo || ( *pRefTo>=0 && *pRefTo<pContainer->m_dNormalForms.GetLength() ) );
-		if ( pRefTo )
-		{
-			// replace with a new wordform
-			if ( pContainer->m_dNormalForms[*pRefTo].m_sWord!=dDestTokens[0].m_sForm || pContainer->m_dNormalForms[*pRefTo].m_bAfterMorphology!=bAfterMorphology )
-			{
-				CSphStoredNF & tRefTo = pContainer->m_dNormalForms[*pRefTo];
-				sphWarning ( "index '%s': duplicate wordform found - overridden ( current='%s', old='%s%s > %s' ). Fix your wordforms file '%s'.",
-					pContainer->m_sIndexName.cstr(), sBuffer, tRefTo.m_bAfterMorphology ? "~" : "", dTokens[0].cstr(), tRefTo.m_sWord.cstr(), szFile );
+		// check dynamic data
+		const DWORD * a = m_pDynData;
+		const DWORD * b = rhs.m_pDynData;
+		const DWORD * m = a + ( m_iDynLen & 0xffffffUL );
+		while ( a<m )
+			if ( *a++!=*b++ )
+				return false;
+		return true;
+	}
 
-				tRefTo.m_sWord = dDestTokens[0].m_sForm;
-				tRefTo.m_bAfterMorphology = bAfterMorphology;
-				pContainer->m_bHavePostMorphNF |= bAfterMorphology;
-			} else
-				sphWarning ( "index '%s': duplicate wordform found ( '%s' ). Fix your wordforms file '%s'.", pContainer->m_sIndexName.cstr(), sBuffer, szFile );
-		} else
-		{
-			CSphStoredNF tForm;
-			tForm.m_sWord = dDestTokens[0].m_sForm;
-			tForm.m_bAfterMorphology = bAfterMorphology;
-			pContainer->m_bHavePostMorphNF |= bAfterMorphology;
-			if ( !pContainer->m_dNormalForms.GetLength()
-				|| pContainer->m_dNormalForms.Last().m_sWord!=dDestTokens[0].m_sForm
-				|| pContainer->m_dNormalForms.Last().m_bAfterMorphology!=bAfterMorphology)
-				pContainer->m_dNormalForms.Add ( tForm );
+public:
+	int GetLength() const
+	{
+		if ( !IsDynamic() )
+			return m_dData[0] >> 24;
+		return m_iDynLen & 0xffffffUL;
+	}
 
-			pContainer->m_dHash.Add ( pContainer->m_dNormalForms.GetLength()-1, dTokens[0] );
-		}
+	DWORD operator[] ( int iIndex )const
+	{
+		if ( !IsDynamic() )
+			return m_dData[iIndex] & 0xffffffUL;
+		return m_pDynData[iIndex];
 	}
-}
+};
 
 
-CSphWordforms * CSphTemplateDictTraits::LoadWordformContainer ( const CSphVector<CSphSavedFile> & dFileInfos,
-	const CSphVector<CSphString> * pEmbeddedWordforms, const ISphTokenizer * pTokenizer, const char * sIndex )
+void Swap ( InfixIntvec_t & a, InfixIntvec_t & b )
 {
-	// allocate it
-	CSphWordforms * pContainer = new CSphWordforms();
-	pContainer->m_dFiles = dFileInfos;
-	pContainer->m_uTokenizerFNV = pTokenizer->GetSettingsFNV();
-	pContainer->m_sIndexName = sIndex;
-
-	CSphScopedPtr<ISphTokenizer> pMyTokenizer ( pTokenizer->Clone ( SPH_CLONE_INDEX ) );
-	const CSphTokenizerSettings & tSettings = pMyTokenizer->GetSettings();
-	CSphVector<int> dBlended;
-
-	// get a list of blend chars and set add them to the tokenizer as simple chars
-	if ( tSettings.m_sBlendChars.Length() )
-	{
-		CSphVector<char> dNewCharset;
-		dNewCharset.Resize ( tSettings.m_sCaseFolding.Length() );
-		memcpy ( dNewCharset.Begin(), tSettings.m_sCaseFolding.cstr(), dNewCharset.GetLength() );
+	::Swap ( a.m_dData[0], b.m_dData[0] );
+	::Swap ( a.m_dData[1], b.m_dData[1] );
+	::Swap ( a.m_dData[2], b.m_dData[2] );
+	::Swap ( a.m_dData[3], b.m_dData[3] );
+}
 
-		CSphVector<CSphRemapRange> dRemaps;
-		CSphCharsetDefinitionParser tParser;
-		if ( tParser.Parse ( tSettings.m_sBlendChars.cstr(), dRemaps ) )
-			ARRAY_FOREACH ( i, dRemaps )
-				for ( int j = dRemaps[i].m_iStart; j<=dRemaps[i].m_iEnd; j++ )
-				{
-					dNewCharset.Add ( ',' );
-					dNewCharset.Add ( ' ' );
-					dNewCharset.Add ( char(j) );
-					dBlended.Add ( j );
-				}
 
-		dNewCharset.Add(0);
+template < int SIZE >
+struct InfixHashEntry_t
+{
+	Infix_t<SIZE>	m_tKey;		///< key, owned by the hash
+	InfixIntvec_t	m_tValue;	///< data, owned by the hash
+	int				m_iNext;	///< next entry in hash arena
+};
 
-		// sort dBlended for binary search
-		dBlended.Sort ();
 
-		CSphString sError;
-		pMyTokenizer->SetCaseFolding ( dNewCharset.Begin(), sError );
+template < int SIZE >
+class InfixBuilder_c : public ISphInfixBuilder
+{
+protected:
+	static const int							LENGTH = 1048576;
 
-		// disable blend chars
-		pMyTokenizer->SetBlendChars ( NULL, sError );
-	}
+protected:
+	int											m_dHash [ LENGTH ];		///< all the hash entries
+	CSphSwapVector < InfixHashEntry_t<SIZE> >	m_dArena;
+	CSphVector<InfixBlock_t>					m_dBlocks;
+	CSphTightVector<BYTE>						m_dBlocksWords;
 
-	// add wordform-specific specials
-	pMyTokenizer->AddSpecials ( "#=>~" );
+public:
+					InfixBuilder_c();
+	virtual void	AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology );
+	virtual void	SaveEntries ( CSphWriter & wrDict );
+	virtual int64_t	SaveEntryBlocks ( CSphWriter & wrDict );
+	virtual int		GetBlocksWordsSize () const { return m_dBlocksWords.GetLength(); }
 
-	if ( pEmbeddedWordforms )
+protected:
+	/// add new entry
+	void AddEntry ( const Infix_t<SIZE> & tKey, DWORD uHash, int iCheckpoint )
 	{
-		CSphTightVector<CSphString> dFilenames;
-		dFilenames.Resize ( dFileInfos.GetLength() );
-		ARRAY_FOREACH ( i, dFileInfos )
-			dFilenames[i] = dFileInfos[i].m_sFilename;
+		uHash &= ( LENGTH-1 );
 
-		CSphString sAllFiles;
-		ConcatReportStrings ( dFilenames, sAllFiles );
+		int iEntry = m_dArena.GetLength();
+		InfixHashEntry_t<SIZE> & tNew = m_dArena.Add();
+		tNew.m_tKey = tKey;
+		tNew.m_tValue.m_dData[0] = 0x1000000UL | iCheckpoint; // len=1, data=iCheckpoint
+		tNew.m_iNext = m_dHash[uHash];
+		m_dHash[uHash] = iEntry;
+	}
 
-		ARRAY_FOREACH ( i, (*pEmbeddedWordforms) )
-			AddWordform ( pContainer, (char*)(*pEmbeddedWordforms)[i].cstr(),
-				(*pEmbeddedWordforms)[i].Length(), pMyTokenizer.Ptr(), sAllFiles.cstr(), dBlended, -1 );
-	} else
+	/// get value pointer by key
+	InfixIntvec_t * LookupEntry ( const Infix_t<SIZE> & tKey, DWORD uHash )
 	{
-		char sBuffer [ 6*SPH_MAX_WORD_LEN + 512 ]; // enough to hold 2 UTF-8 words, plus some whitespace overhead
+		uHash &= ( LENGTH-1 );
+		int iEntry = m_dHash [ uHash ];
+		int iiEntry = 0;
 
-		ARRAY_FOREACH ( i, dFileInfos )
+		while ( iEntry )
 		{
-			CSphAutoreader rdWordforms;
-			const char * szFile = dFileInfos[i].m_sFilename.cstr();
-			CSphString sError;
-			if ( !rdWordforms.Open ( szFile, sError ) )
+			if ( m_dArena[iEntry].m_tKey==tKey )
 			{
-				sphWarning ( "index '%s': %s", sIndex, sError.cstr() );
-				return NULL;
+				// mtf it, if needed
+				if ( iiEntry )
+				{
+					m_dArena[iiEntry].m_iNext = m_dArena[iEntry].m_iNext;
+					m_dArena[iEntry].m_iNext = m_dHash[uHash];
+					m_dHash[uHash] = iEntry;
+				}
+				return &m_dArena[iEntry].m_tValue;
 			}
-
-			int iLen;
-			while ( ( iLen = rdWordforms.GetLine ( sBuffer, sizeof(sBuffer) ) )>=0 )
-				AddWordform ( pContainer, sBuffer, iLen, pMyTokenizer.Ptr(), szFile, dBlended, i );
+			iiEntry = iEntry;
+			iEntry = m_dArena[iEntry].m_iNext;
 		}
+		return NULL;
 	}
+};
 
-	return pContainer;
+
+template < int SIZE >
+InfixBuilder_c<SIZE>::InfixBuilder_c()
+{
+	// init the hash
+	for ( int i=0; i<LENGTH; i++ )
+		m_dHash[i] = 0;
+	m_dArena.Reserve ( 1048576 );
+	m_dArena.Resize ( 1 ); // 0 is a reserved index
 }
 
 
-bool CSphTemplateDictTraits::LoadWordforms ( const CSphVector<CSphString> & dFiles,
-	const CSphEmbeddedFiles * pEmbedded, const ISphTokenizer * pTokenizer, const char * sIndex )
+/// single-byte case, 2-dword infixes
+template<>
+void InfixBuilder_c<2>::AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology )
 {
-	if ( pEmbedded )
-	{
-		m_dWFFileInfos.Resize ( pEmbedded->m_dWordformFiles.GetLength() );
-		ARRAY_FOREACH ( i, m_dWFFileInfos )
-			m_dWFFileInfos[i] = pEmbedded->m_dWordformFiles[i];
-	} else
+	if ( bHasMorphology && *pWord!=MAGIC_WORD_HEAD_NONSTEMMED )
+		return;
+
+	if ( *pWord<0x20 ) // skip heading magic chars, like NONSTEMMED maker
 	{
-		m_dWFFileInfos.Reserve ( dFiles.GetLength() );
-		CSphSavedFile tFile;
-		ARRAY_FOREACH ( i, dFiles )
-			if ( !dFiles[i].IsEmpty() )
-			{
-				if ( GetFileStats ( dFiles[i].cstr(), tFile, NULL ) )
-					m_dWFFileInfos.Add ( tFile );
-				else
-					sphWarning ( "index '%s': wordforms file '%s' not found", sIndex, dFiles[i].cstr() );
-			}
+		pWord++;
+		iWordLength--;
 	}
 
-	if ( !m_dWFFileInfos.GetLength() )
-		return false;
+	Infix_t<2> sKey;
+	for ( int p=0; p<=iWordLength-2; p++ )
+	{
+		sKey.Reset();
 
-	SweepWordformContainers ( m_dWFFileInfos );
+		BYTE * pKey = (BYTE*)sKey.m_Data;
+		const BYTE * s = pWord + p;
+		const BYTE * sMax = s + Min ( 6, iWordLength-p );
 
-	m_pWordforms = GetWordformContainer ( m_dWFFileInfos, pEmbedded ? &(pEmbedded->m_dWordforms) : NULL, pTokenizer, sIndex );
-	if ( m_pWordforms )
-	{
-		m_pWordforms->m_iRefCount++;
-		if ( m_pWordforms->m_bHavePostMorphNF && !m_dMorph.GetLength() )
-			sphWarning ( "index '%s': wordforms contain post-morphology normal forms, but no morphology was specified", sIndex );
-	}
+		DWORD uHash = 0xffffffUL ^ g_dSphinxCRC32 [ 0xff ^ *s ];
+		*pKey++ = *s++; // copy first infix byte
 
-	return !!m_pWordforms;
+		while ( s<sMax )
+		{
+			uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
+			*pKey++ = *s++; // copy another infix byte
+
+			InfixIntvec_t * pVal = LookupEntry ( sKey, uHash );
+			if ( pVal )
+				pVal->Add ( iCheckpoint );
+			else
+				AddEntry ( sKey, uHash, iCheckpoint );
+		}
+	}
 }
 
 
-void CSphTemplateDictTraits::WriteWordforms ( CSphWriter & tWriter )
+/// UTF-8 case, 3/5-dword infixes
+template < int SIZE >
+void InfixBuilder_c<SIZE>::AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology )
 {
-	if ( !m_pWordforms )
-	{
-		tWriter.PutDword(0);
+	if ( bHasMorphology && *pWord!=MAGIC_WORD_HEAD_NONSTEMMED )
 		return;
+
+	if ( *pWord<0x20 ) // skip heading magic chars, like NONSTEMMED maker
+	{
+		pWord++;
+		iWordLength--;
 	}
 
-	int nMultiforms = 0;
-	if ( m_pWordforms->m_pMultiWordforms )
+	int iCodes = 0; // codepoints in current word
+	BYTE dBytes[SPH_MAX_WORD_LEN+1]; // byte offset for each codepoints
+
+	// build an offsets table into the bytestring
+	dBytes[0] = 0;
+	for ( const BYTE * p = (const BYTE*)pWord; p<pWord+iWordLength && iCodes<SPH_MAX_WORD_LEN; )
 	{
-		CSphMultiformContainer::CSphMultiformHash & tHash = m_pWordforms->m_pMultiWordforms->m_Hash;
-		tHash.IterateStart();
-		while ( tHash.IterateNext() )
+		int iLen = 0;
+		BYTE uVal = *p;
+		while ( uVal & 0x80 )
 		{
-			CSphMultiforms * pMF = tHash.IterateGet();
-			nMultiforms += pMF ? pMF->m_pForms.GetLength() : 0;
+			uVal <<= 1;
+			iLen++;
 		}
-	}
+		if ( !iLen )
+			iLen = 1;
 
-	tWriter.PutDword ( m_pWordforms->m_dHash.GetLength()+nMultiforms );
-	m_pWordforms->m_dHash.IterateStart();
-	while ( m_pWordforms->m_dHash.IterateNext() )
-	{
-		const CSphString & sKey = m_pWordforms->m_dHash.IterateGetKey();
-		int iIndex = m_pWordforms->m_dHash.IterateGet();
-		CSphString sLine;
-		sLine.SetSprintf ( "%s%s > %s", m_pWordforms->m_dNormalForms[iIndex].m_bAfterMorphology ? "~" : "",
-			sKey.cstr(), m_pWordforms->m_dNormalForms[iIndex].m_sWord.cstr() );
-		tWriter.PutString ( sLine );
+		// skip word with large codepoints
+		if ( iLen>SIZE )
+			return;
+
+		assert ( iLen>=1 && iLen<=4 );
+		p += iLen;
+
+		dBytes[iCodes+1] = dBytes[iCodes] + (BYTE)iLen;
+		iCodes++;
 	}
+	assert ( pWord[dBytes[iCodes]]==0 || iCodes==SPH_MAX_WORD_LEN );
 
-	if ( m_pWordforms->m_pMultiWordforms )
+	// generate infixes
+	Infix_t<SIZE> sKey;
+	for ( int p=0; p<=iCodes-2; p++ )
 	{
-		CSphMultiformContainer::CSphMultiformHash & tHash = m_pWordforms->m_pMultiWordforms->m_Hash;
-		tHash.IterateStart();
-		while ( tHash.IterateNext() )
+		sKey.Reset();
+		BYTE * pKey = (BYTE*)sKey.m_Data;
+
+		const BYTE * s = pWord + dBytes[p];
+		const BYTE * sMax = pWord + dBytes[ p+Min ( 6, iCodes-p ) ];
+
+		// copy first infix codepoint
+		DWORD uHash = 0xffffffffUL;
+		do
 		{
-			const CSphString & sKey = tHash.IterateGetKey();
-			CSphMultiforms * pMF = tHash.IterateGet();
-			if ( !pMF )
-				continue;
+			uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
+			*pKey++ = *s++;
+		} while ( ( *s & 0xC0 )==0x80 );
 
-			ARRAY_FOREACH ( i, pMF->m_pForms )
+		while ( s<sMax )
+		{
+			// copy next infix codepoint
+			do
 			{
-				CSphString sLine, sTokens, sForms;
-				ConcatReportStrings ( pMF->m_pForms[i]->m_dTokens, sTokens );
-				ConcatReportStrings ( pMF->m_pForms[i]->m_dNormalForm, sForms );
+				uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
+				*pKey++ = *s++;
+			} while ( ( *s & 0xC0 )==0x80 );
 
-				sLine.SetSprintf ( "%s %s > %s", sKey.cstr(), sTokens.cstr(), sForms.cstr() );
-				tWriter.PutString ( sLine );
-			}
+			InfixIntvec_t * pVal = LookupEntry ( sKey, uHash );
+			if ( pVal )
+				pVal->Add ( iCheckpoint );
+			else
+				AddEntry ( sKey, uHash, iCheckpoint );
 		}
 	}
 }
 
 
-int CSphTemplateDictTraits::SetMorphology ( const char * szMorph, CSphString & sMessage )
+template < int SIZE >
+struct InfixHashCmp_fn
 {
-	m_dMorph.Reset ();
-#if USE_LIBSTEMMER
-	ARRAY_FOREACH ( i, m_dStemmers )
-		sb_stemmer_delete ( m_dStemmers[i] );
-	m_dStemmers.Reset ();
-#endif
+	InfixHashEntry_t<SIZE> * m_pBase;
 
-	if ( !szMorph )
-		return ST_OK;
+	explicit InfixHashCmp_fn ( InfixHashEntry_t<SIZE> * pBase )
+		: m_pBase ( pBase )
+	{}
 
-	CSphString sOption = szMorph;
-	sOption.ToLower ();
+	bool IsLess ( int a, int b ) const
+	{
+		return strncmp ( (const char*)m_pBase[a].m_tKey.m_Data, (const char*)m_pBase[b].m_tKey.m_Data, sizeof(DWORD)*SIZE )<0;
+	}
+};
 
-	CSphString sError;
-	int iRes = ParseMorphology ( sOption.cstr(), sMessage );
-	if ( iRes==ST_WARNING && sMessage.IsEmpty() )
-		sMessage.SetSprintf ( "invalid morphology option %s; skipped", sOption.cstr() );
-	return iRes;
+
+static inline int ZippedIntSize ( DWORD v )
+{
+	if ( v < (1UL<<7) )
+		return 1;
+	if ( v < (1UL<<14) )
+		return 2;
+	if ( v < (1UL<<21) )
+		return 3;
+	if ( v < (1UL<<28) )
+		return 4;
+	return 5;
 }
 
 
-bool CSphTemplateDictTraits::HasMorphology() const
+static const char * g_sTagInfixEntries = "infix-entries";
+
+template < int SIZE >
+void InfixBuilder_c<SIZE>::SaveEntries ( CSphWriter & wrDict )
 {
-	return ( m_dMorph.GetLength()>0 );
-}
+	// intentionally local to this function
+	// we mark the block end with an editcode of 0
+	const int INFIX_BLOCK_SIZE = 64;
+
+	wrDict.PutBytes ( g_sTagInfixEntries, strlen ( g_sTagInfixEntries ) );
 
+	CSphVector<int> dIndex;
+	dIndex.Resize ( m_dArena.GetLength()-1 );
+	for ( int i=0; i<m_dArena.GetLength()-1; i++ )
+		dIndex[i] = i+1;
 
-/// common id-based stemmer
-bool CSphTemplateDictTraits::StemById ( BYTE * pWord, int iStemmer ) const
-{
-	char szBuf [ MAX_KEYWORD_BYTES ];
+	InfixHashCmp_fn<SIZE> fnCmp ( m_dArena.Begin() );
+	dIndex.Sort ( fnCmp );
 
-	// safe quick strncpy without (!) padding and with a side of strlen
-	char * p = szBuf;
-	char * pMax = szBuf + sizeof(szBuf) - 1;
-	BYTE * pLastSBS = NULL;
-	while ( *pWord && p<pMax )
+	m_dBlocksWords.Reserve ( m_dArena.GetLength()/INFIX_BLOCK_SIZE*sizeof(DWORD)*SIZE );
+	int iBlock = 0;
+	int iPrevKey = -1;
+	ARRAY_FOREACH ( iIndex, dIndex )
 	{
-		pLastSBS = ( *pWord )<0x80 ? pWord : pLastSBS;
-		*p++ = *pWord++;
-	}
-	int iLen = p - szBuf;
-	*p = '\0';
-	pWord -= iLen;
+		InfixIntvec_t & dData = m_dArena[dIndex[iIndex]].m_tValue;
+		const BYTE * sKey = (const BYTE*) m_dArena[dIndex[iIndex]].m_tKey.m_Data;
+		int iChars = ( SIZE==2 )
+			? strnlen ( (const char*)sKey, sizeof(DWORD)*SIZE )
+			: sphUTF8Len ( (const char*)sKey, sizeof(DWORD)*SIZE );
+		assert ( iChars>=2 && iChars<int(1 + sizeof ( Infix_t<SIZE> ) ) );
 
-	switch ( iStemmer )
-	{
-	case SPH_MORPH_STEM_EN:
-		stem_en ( pWord, iLen );
-		break;
+		// keep track of N-infix blocks
+		int iAppendBytes = strnlen ( (const char*)sKey, sizeof(DWORD)*SIZE );
+		if ( !iBlock )
+		{
+			int iOff = m_dBlocksWords.GetLength();
+			m_dBlocksWords.Resize ( iOff+iAppendBytes+1 );
 
-	case SPH_MORPH_STEM_RU_UTF8:
-		// skip stemming in case of SBC at the end of the word
-		if ( pLastSBS && ( pLastSBS-pWord+1 )>=iLen )
-			break;
+			InfixBlock_t & tBlock = m_dBlocks.Add();
+			tBlock.m_iInfixOffset = iOff;
+			tBlock.m_iOffset = (DWORD)wrDict.GetPos();
 
-		// stem only UTF8 tail
-		if ( !pLastSBS )
-		{
-			stem_ru_utf8 ( (WORD*)pWord );
-		} else
-		{
-			stem_ru_utf8 ( (WORD *)( pLastSBS+1 ) );
+			memcpy ( m_dBlocksWords.Begin()+iOff, sKey, iAppendBytes );
+			m_dBlocksWords[iOff+iAppendBytes] = '\0';
 		}
-		break;
 
-	case SPH_MORPH_STEM_CZ:
-		stem_cz ( pWord );
-		break;
+		// compute max common prefix
+		// edit_code = ( num_keep_chars<<4 ) + num_append_chars
+		int iEditCode = iChars;
+		if ( iPrevKey>=0 )
+		{
+			const BYTE * sPrev = (const BYTE*) m_dArena[dIndex[iPrevKey]].m_tKey.m_Data;
+			const BYTE * sCur = (const BYTE*) sKey;
+			const BYTE * sMax = sCur + iAppendBytes;
 
-	case SPH_MORPH_STEM_AR_UTF8:
-		stem_ar_utf8 ( pWord );
-		break;
+			int iKeepChars = 0;
+			if_const ( SIZE==2 )
+			{
+				// SBCS path
+				while ( sCur<sMax && *sCur && *sCur==*sPrev )
+				{
+					sCur++;
+					sPrev++;
+				}
+				iKeepChars = (int)( sCur- ( const BYTE* ) sKey );
 
-	case SPH_MORPH_SOUNDEX:
-		stem_soundex ( pWord );
-		break;
+				assert ( iKeepChars>=0 && iKeepChars<16 );
+				assert ( iChars-iKeepChars>=0 );
+				assert ( iChars-iKeepChars<16 );
 
-	case SPH_MORPH_METAPHONE_UTF8:
-		stem_dmetaphone ( pWord );
-		break;
+				iEditCode = ( iKeepChars<<4 ) + ( iChars-iKeepChars );
+				iAppendBytes = ( iChars-iKeepChars );
+				sKey = sCur;
 
-	case SPH_MORPH_AOTLEMMER_RU_UTF8:
-		sphAotLemmatizeRuUTF8 ( pWord );
-		break;
+			} else
+			{
+				// UTF-8 path
+				const BYTE * sKeyMax = sCur; // track max matching sPrev prefix in [sKey,sKeyMax)
+				while ( sCur<sMax && *sCur && *sCur==*sPrev )
+				{
+					// current byte matches, move the pointer
+					sCur++;
+					sPrev++;
 
-	case SPH_MORPH_AOTLEMMER_EN:
-		sphAotLemmatize ( pWord, AOT_EN );
-		break;
+					// tricky bit
+					// if the next (!) byte is a valid UTF-8 char start (or eof!)
+					// then we just matched not just a byte, but a full char
+					// so bump the matching prefix boundary and length
+					if ( sCur>=sMax || ( *sCur & 0xC0 )!=0x80 )
+					{
+						sKeyMax = sCur;
+						iKeepChars++;
+					}
+				}
 
-	case SPH_MORPH_AOTLEMMER_DE_UTF8:
-		sphAotLemmatizeDeUTF8 ( pWord );
-		break;
+				assert ( iKeepChars>=0 && iKeepChars<16 );
+				assert ( iChars-iKeepChars>=0 );
+				assert ( iChars-iKeepChars<16 );
 
-	case SPH_MORPH_AOTLEMMER_RU_ALL:
-	case SPH_MORPH_AOTLEMMER_EN_ALL:
-	case SPH_MORPH_AOTLEMMER_DE_ALL:
-		// do the real work somewhere else
-		// this is mostly for warning suppressing and making some features like
-		// index_exact_words=1 vs expand_keywords=1 work
-		break;
+				iEditCode = ( iKeepChars<<4 ) + ( iChars-iKeepChars );
+				iAppendBytes -= (int)( sKeyMax-sKey );
+				sKey = sKeyMax;
+			}
+		}
 
-	default:
-#if USE_LIBSTEMMER
-		if ( iStemmer>=SPH_MORPH_LIBSTEMMER_FIRST && iStemmer<SPH_MORPH_LIBSTEMMER_LAST )
-		{
-			sb_stemmer * pStemmer = m_dStemmers [iStemmer - SPH_MORPH_LIBSTEMMER_FIRST];
-			assert ( pStemmer );
+		// write edit code, postfix
+		wrDict.PutByte ( iEditCode );
+		wrDict.PutBytes ( sKey, iAppendBytes );
 
-			const sb_symbol * sStemmed = sb_stemmer_stem ( pStemmer, (sb_symbol*)pWord, strlen ( (const char*)pWord ) );
-			int iLen = sb_stemmer_length ( pStemmer );
+		// compute data length
+		int iDataLen = ZippedIntSize ( dData[0] );
+		for ( int j=1; j<dData.GetLength(); j++ )
+			iDataLen += ZippedIntSize ( dData[j] - dData[j-1] );
 
-			memcpy ( pWord, sStemmed, iLen );
-			pWord[iLen] = '\0';
-		} else
-			return false;
+		// write data length, data
+		wrDict.ZipInt ( iDataLen );
+		wrDict.ZipInt ( dData[0] );
+		for ( int j=1; j<dData.GetLength(); j++ )
+			wrDict.ZipInt ( dData[j] - dData[j-1] );
 
-	break;
-#else
-		return false;
-#endif
+		// mark block end, restart deltas
+		iPrevKey = iIndex;
+		if ( ++iBlock==INFIX_BLOCK_SIZE )
+		{
+			iBlock = 0;
+			iPrevKey = -1;
+			wrDict.PutByte ( 0 );
+		}
 	}
 
-	return strcmp ( (char *)pWord, szBuf )!=0;
-}
-
-void CSphDiskDictTraits::DictBegin ( CSphAutofile & , CSphAutofile & tDict, int, ThrottleState_t * pThrottle )
-{
-	m_wrDict.CloseFile ();
-	m_wrDict.SetFile ( tDict, NULL, m_sWriterError );
-	m_wrDict.SetThrottle ( pThrottle );
-	m_wrDict.PutByte ( 1 );
-}
+	// put end marker
+	if ( iBlock )
+		wrDict.PutByte ( 0 );
 
-bool CSphDiskDictTraits::DictEnd ( DictHeader_t * pHeader, int, CSphString & sError, ThrottleState_t * )
-{
-	// flush wordlist checkpoints
-	pHeader->m_iDictCheckpointsOffset = m_wrDict.GetPos();
-	pHeader->m_iDictCheckpoints = m_dCheckpoints.GetLength();
-	ARRAY_FOREACH ( i, m_dCheckpoints )
-	{
-		assert ( m_dCheckpoints[i].m_iWordlistOffset );
-		m_wrDict.PutOffset ( m_dCheckpoints[i].m_uWordID );
-		m_wrDict.PutOffset ( m_dCheckpoints[i].m_iWordlistOffset );
-	}
+	const char * pBlockWords = (const char *)m_dBlocksWords.Begin();
+	ARRAY_FOREACH ( i, m_dBlocks )
+		m_dBlocks[i].m_sInfix = pBlockWords+m_dBlocks[i].m_iInfixOffset;
 
-	// done
-	m_wrDict.CloseFile ();
-	if ( m_wrDict.IsError() )
-		sError = m_sWriterError;
-	return !m_wrDict.IsError();
+	if ( wrDict.GetPos()>UINT_MAX ) // FIXME!!! change to int64
+		sphDie ( "INTERNAL ERROR: dictionary size " INT64_FMT " overflow at infix save", wrDict.GetPos() );
 }
 
-void CSphDiskDictTraits::DictEntry ( const CSphDictEntry & tEntry )
-{
-	// insert wordlist checkpoint
-	if ( ( m_iEntries % SPH_WORDLIST_CHECKPOINT )==0 )
-	{
-		if ( m_iEntries ) // but not the 1st entry
-		{
-			assert ( tEntry.m_iDoclistOffset > m_iLastDoclistPos );
-			m_wrDict.ZipInt ( 0 ); // indicate checkpoint
-			m_wrDict.ZipOffset ( tEntry.m_iDoclistOffset - m_iLastDoclistPos ); // store last length
-		}
-
-		// restart delta coding, once per SPH_WORDLIST_CHECKPOINT entries
-		m_iLastWordID = 0;
-		m_iLastDoclistPos = 0;
-
-		// begin new wordlist entry
-		assert ( m_wrDict.GetPos()<=UINT_MAX );
-
-		CSphWordlistCheckpoint & tCheckpoint = m_dCheckpoints.Add();
-		tCheckpoint.m_uWordID = tEntry.m_uWordID;
-		tCheckpoint.m_iWordlistOffset = m_wrDict.GetPos();
-	}
 
-	assert ( tEntry.m_iDoclistOffset>m_iLastDoclistPos );
-	m_wrDict.ZipOffset ( tEntry.m_uWordID - m_iLastWordID ); // FIXME! slow with 32bit wordids
-	m_wrDict.ZipOffset ( tEntry.m_iDoclistOffset - m_iLastDoclistPos );
+static const char * g_sTagInfixBlocks = "infix-blocks";
 
-	m_iLastWordID = tEntry.m_uWordID;
-	m_iLastDoclistPos = tEntry.m_iDoclistOffset;
+template < int SIZE >
+int64_t InfixBuilder_c<SIZE>::SaveEntryBlocks ( CSphWriter & wrDict )
+{
+	// save the blocks
+	wrDict.PutBytes ( g_sTagInfixBlocks, strlen ( g_sTagInfixBlocks ) );
 
-	assert ( tEntry.m_iDocs );
-	assert ( tEntry.m_iHits );
-	m_wrDict.ZipInt ( tEntry.m_iDocs );
-	m_wrDict.ZipInt ( tEntry.m_iHits );
+	SphOffset_t iInfixBlocksOffset = wrDict.GetPos();
+	assert ( iInfixBlocksOffset<=INT_MAX );
 
-	// write skiplist location info, if any
-	if ( tEntry.m_iDocs > SPH_SKIPLIST_BLOCK )
-		m_wrDict.ZipOffset ( tEntry.m_iSkiplistOffset );
+	wrDict.ZipInt ( m_dBlocks.GetLength() );
+	ARRAY_FOREACH ( i, m_dBlocks )
+	{
+		int iBytes = strlen ( m_dBlocks[i].m_sInfix );
+		wrDict.PutByte ( iBytes );
+		wrDict.PutBytes ( m_dBlocks[i].m_sInfix, iBytes );
+		wrDict.ZipInt ( m_dBlocks[i].m_iOffset ); // maybe delta these on top?
+	}
 
-	m_iEntries++;
+	return iInfixBlocksOffset;
 }
 
-void CSphDiskDictTraits::DictEndEntries ( SphOffset_t iDoclistOffset )
+
+ISphInfixBuilder * sphCreateInfixBuilder ( int iCodepointBytes, CSphString * pError )
 {
-	assert ( iDoclistOffset>=m_iLastDoclistPos );
-	m_wrDict.ZipInt ( 0 ); // indicate checkpoint
-	m_wrDict.ZipOffset ( iDoclistOffset - m_iLastDoclistPos ); // store last doclist length
+	assert ( pError );
+	*pError = CSphString();
+	switch ( iCodepointBytes )
+	{
+	case 0:		return NULL;
+	case 1:		return new InfixBuilder_c<2>(); // upto 6x1 bytes, 2 dwords, sbcs
+	case 2:		return new InfixBuilder_c<3>(); // upto 6x2 bytes, 3 dwords, utf-8
+	case 3:		return new InfixBuilder_c<5>(); // upto 6x3 bytes, 5 dwords, utf-8
+	default:	pError->SetSprintf ( "unhandled max infix codepoint size %d", iCodepointBytes ); return NULL;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
-// KEYWORDS STORING DICTIONARY, INFIX HASH BUILDER
+// KEYWORDS FST
 //////////////////////////////////////////////////////////////////////////
 
-template < int SIZE >
-struct Infix_t
-{
-	DWORD m_Data[SIZE];
-
-#ifndef NDEBUG
-	BYTE m_TrailingZero;
+// state is stored as zipped ( arcs_count<<1 | is_final ), zipped keywords count,
+// then arcs sorted by label, each as ( label byte, zipped ordinal delta, zipped target state offset )
 
-	Infix_t ()
-		: m_TrailingZero ( 0 )
-	{}
-#endif
+const char * g_sTagKeywordsFst = "keywords-fst";
 
-	void Reset ()
+static inline void FstZip ( CSphTightVector<BYTE> & dOut, uint64_t uValue )
+{
+	while ( uValue>=0x80 )
 	{
-		for ( int i=0; i<SIZE; i++ )
-			m_Data[i] = 0;
+		dOut.Add ( (BYTE)( uValue | 0x80 ) );
+		uValue >>= 7;
 	}
-
-	bool operator == ( const Infix_t<SIZE> & rhs ) const;
-};
+	dOut.Add ( (BYTE)uValue );
+}
 
 
-template<>
-bool Infix_t<2>::operator == ( const Infix_t<2> & rhs ) const
+static inline uint64_t FstUnzip ( const BYTE * & pBuf )
 {
-	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1];
+	uint64_t uRes = 0;
+	int iShift = 0;
+	BYTE uByte;
+	do
+	{
+		uByte = *pBuf++;
+		uRes |= uint64_t ( uByte & 0x7f )<<iShift;
+		iShift += 7;
+	} while ( uByte & 0x80 );
+	return uRes;
 }
 
 
-template<>
-bool Infix_t<3>::operator == ( const Infix_t<3> & rhs ) const
+KeywordsFstBuilder_c::KeywordsFstBuilder_c ()
+	: m_iLastLen ( 0 )
+	, m_iWords ( 0 )
+	, m_iRegistered ( 0 )
 {
-	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1] && m_Data[2]==rhs.m_Data[2];
+	m_dPath[0].m_bFinal = false;
+	m_dPath[0].m_iBase = 0;
+
+	m_dRegister.Resize ( 4096 );
+	ARRAY_FOREACH ( i, m_dRegister )
+		m_dRegister[i].m_iOffset = -1;
 }
 
 
-template<>
-bool Infix_t<5>::operator == ( const Infix_t<5> & rhs ) const
+void KeywordsFstBuilder_c::AddWord ( const BYTE * pWord, int iLen )
 {
-	return m_Data[0]==rhs.m_Data[0] && m_Data[1]==rhs.m_Data[1] && m_Data[2]==rhs.m_Data[2]
-		&& m_Data[3]==rhs.m_Data[3] && m_Data[4]==rhs.m_Data[4];
-}
+	assert ( pWord && iLen>0 && iLen<(int)sizeof(m_sLast) );
 
+	int iPrefix = 0;
+	int iCommon = Min ( iLen, m_iLastLen );
+	while ( iPrefix<iCommon && pWord[iPrefix]==m_sLast[iPrefix] )
+		iPrefix++;
 
-struct InfixIntvec_t
-{
-public:
-	// do not change the order of fields in this union - it matters a lot
-	union
-	{
-		DWORD			m_dData[4];
-		struct
-		{
-			int				m_iDynLen;
-			int				m_iDynLimit;
-			DWORD *			m_pDynData;
-		};
-	};
+	// wordlist must be strictly ascending
+	assert ( !m_iWords || ( iPrefix<iLen && ( iPrefix==m_iLastLen || pWord[iPrefix]>m_sLast[iPrefix] ) ) );
 
-public:
-	InfixIntvec_t()
-	{
-		m_dData[0] = 0;
-		m_dData[1] = 0;
-		m_dData[2] = 0;
-		m_dData[3] = 0;
-	}
+	// states past the common prefix will not get any new arcs, so freeze them
+	for ( int i=m_iLastLen; i>iPrefix; i-- )
+		m_dPath[i-1].m_dArcs.Last().m_iTarget = Freeze ( i );
 
-	~InfixIntvec_t()
+	// append the suffix
+	for ( int i=iPrefix; i<iLen; i++ )
 	{
-		if ( IsDynamic() )
-			SafeDeleteArray ( m_pDynData );
+		Arc_t & tArc = m_dPath[i].m_dArcs.Add();
+		tArc.m_uLabel = pWord[i];
+		tArc.m_uOut = m_iWords - m_dPath[i].m_iBase;
+		tArc.m_iTarget = -1;
+
+		State_t & tNext = m_dPath[i+1];
+		tNext.m_bFinal = false;
+		tNext.m_iBase = m_iWords;
+		tNext.m_dArcs.Resize ( 0 );
 	}
+	m_dPath[iLen].m_bFinal = true;
 
-	bool IsDynamic() const
+	memcpy ( m_sLast, pWord, iLen );
+	m_iLastLen = iLen;
+	m_iWords++;
+}
+
+
+int64_t KeywordsFstBuilder_c::Freeze ( int iDepth )
+{
+	const State_t & tState = m_dPath[iDepth];
+
+	// all the keywords that pass this state are already added
+	m_dScratch.Resize ( 0 );
+	FstZip ( m_dScratch, ( uint64_t ( tState.m_dArcs.GetLength() )<<1 ) | ( tState.m_bFinal ? 1 : 0 ) );
+	FstZip ( m_dScratch, m_iWords - tState.m_iBase );
+	ARRAY_FOREACH ( i, tState.m_dArcs )
 	{
-		return ( m_dData[0] & 0x80000000UL )!=0;
+		const Arc_t & tArc = tState.m_dArcs[i];
+		assert ( tArc.m_iTarget>=0 );
+		m_dScratch.Add ( tArc.m_uLabel );
+		FstZip ( m_dScratch, tArc.m_uOut );
+		FstZip ( m_dScratch, tArc.m_iTarget );
 	}
 
-	void Add ( DWORD uVal )
+	// equivalent state already frozen? reuse it
+	const int iLen = m_dScratch.GetLength();
+	const int iMask = m_dRegister.GetLength()-1;
+	int iSlot = (int)( sphFNV64 ( m_dScratch.Begin(), iLen ) & iMask );
+	while ( m_dRegister[iSlot].m_iOffset>=0 )
 	{
-		if ( !m_dData[0] )
-		{
-			// empty
-			m_dData[0] = uVal | ( 1UL<<24 );
+		const RegEntry_t & tEntry = m_dRegister[iSlot];
+		if ( tEntry.m_iLen==iLen && memcmp ( m_dStates.Begin()+tEntry.m_iOffset, m_dScratch.Begin(), iLen )==0 )
+			return tEntry.m_iOffset;
+		iSlot = ( iSlot+1 ) & iMask;
+	}
 
-		} else if ( !IsDynamic() )
-		{
-			// 1..4 static entries
-			int iLen = m_dData[0] >> 24;
-			DWORD uLast = m_dData [ iLen-1 ] & 0xffffffUL;
+	int64_t iOffset = m_dStates.GetLength();
+	memcpy ( m_dStates.AddN ( iLen ), m_dScratch.Begin(), iLen );
 
-			// redundant
-			if ( uVal==uLast )
-				return;
+	m_dRegister[iSlot].m_iOffset = iOffset;
+	m_dRegister[iSlot].m_iLen = iLen;
+	if ( ++m_iRegistered*2>m_dRegister.GetLength() )
+		RegisterGrow();
 
-			// grow static part
-			if ( iLen<4 )
-			{
-				m_dData[iLen] = uVal;
-				m_dData[0] = ( m_dData[0] & 0xffffffUL ) | ( ++iLen<<24 );
-				return;
-			}
+	return iOffset;
+}
 
-			// dynamize
-			DWORD * pDyn = new DWORD[16];
-			pDyn[0] = m_dData[0] & 0xffffffUL;
-			pDyn[1] = m_dData[1];
-			pDyn[2] = m_dData[2];
-			pDyn[3] = m_dData[3];
-			pDyn[4] = uVal;
-			m_iDynLen = 0x80000005UL; // dynamic flag, len=5
-			m_iDynLimit = 16; // limit=16
-			m_pDynData = pDyn;
 
-		} else
-		{
-			// N dynamic entries
-			int iLen = m_iDynLen & 0xffffffUL;
-			if ( uVal==m_pDynData[iLen-1] )
-				return;
-			if ( iLen>=m_iDynLimit )
-			{
-				m_iDynLimit *= 2;
-				DWORD * pNew = new DWORD [ m_iDynLimit ];
-				for ( int i=0; i<iLen; i++ )
-					pNew[i] = m_pDynData[i];
-				SafeDeleteArray ( m_pDynData );
-				m_pDynData = pNew;
-			}
+void KeywordsFstBuilder_c::RegisterGrow ()
+{
+	CSphVector<RegEntry_t> dOld;
+	dOld.SwapData ( m_dRegister );
 
-			m_pDynData[iLen] = uVal;
-			m_iDynLen++;
-		}
-	}
+	m_dRegister.Resize ( dOld.GetLength()*2 );
+	ARRAY_FOREACH ( i, m_dRegister )
+		m_dRegister[i].m_iOffset = -1;
 
-	bool operator == ( const InfixIntvec_t & rhs ) const
+	const int iMask = m_dRegister.GetLength()-1;
+	ARRAY_FOREACH ( i, dOld )
 	{
-		// check dynflag, length, maybe first element
-		if ( m_dData[0]!=rhs.m_dData[0] )
-			return false;
-
-		// check static data
-		if ( !IsDynamic() )
-		{
-			for ( int i=1; i<(int)(m_dData[0]>>24); i++ )
-				if ( m_dData[i]!=rhs.m_dData[i] )
-					return false;
-			return true;
-		}
+		if ( dOld[i].m_iOffset<0 )
+			continue;
 
-		// check dynamic data
-		const DWORD * a = m_pDynData;
-		const DWORD * b = rhs.m_pDynData;
-		const DWORD * m = a + ( m_iDynLen & 0xffffffUL );
-		while ( a<m )
-			if ( *a++!=*b++ )
-				return false;
-		return true;
+		int iSlot = (int)( sphFNV64 ( m_dStates.Begin()+dOld[i].m_iOffset, dOld[i].m_iLen ) & iMask );
+		while ( m_dRegister[iSlot].m_iOffset>=0 )
+			iSlot = ( iSlot+1 ) & iMask;
+		m_dRegister[iSlot] = dOld[i];
 	}
+}
 
-public:
-	int GetLength() const
-	{
-		if ( !IsDynamic() )
-			return m_dData[0] >> 24;
-		return m_iDynLen & 0xffffffUL;
-	}
 
-	DWORD operator[] ( int iIndex )const
-	{
-		if ( !IsDynamic() )
-			return m_dData[iIndex] & 0xffffffUL;
-		return m_pDynData[iIndex];
-	}
-};
+int64_t KeywordsFstBuilder_c::Save ( CSphWriter & wrDict )
+{
+	for ( int i=m_iLastLen; i>0; i-- )
+		m_dPath[i-1].m_dArcs.Last().m_iTarget = Freeze ( i );
+	int64_t iRoot = Freeze ( 0 );
 
+	wrDict.PutBytes ( g_sTagKeywordsFst, strlen ( g_sTagKeywordsFst ) );
+	int64_t iFstOffset = wrDict.GetPos();
 
-void Swap ( InfixIntvec_t & a, InfixIntvec_t & b )
-{
-	::Swap ( a.m_dData[0], b.m_dData[0] );
-	::Swap ( a.m_dData[1], b.m_dData[1] );
-	::Swap ( a.m_dData[2], b.m_dData[2] );
-	::Swap ( a.m_dData[3], b.m_dData[3] );
+	wrDict.ZipInt ( m_iWords );
+	wrDict.ZipOffset ( iRoot );
+	wrDict.ZipOffset ( m_dStates.GetLength() );
+	wrDict.PutBytes ( m_dStates.Begin(), m_dStates.GetLength() );
+
+	m_dStates.Reset();
+	m_dRegister.Reset();
+	return iFstOffset;
 }
 
 
-template < int SIZE >
-struct InfixHashEntry_t
+bool KeywordsFst_c::Setup ( const BYTE * pSection, const BYTE * pMax, CSphString & sError )
 {
-	Infix_t<SIZE>	m_tKey;		///< key, owned by the hash
-	InfixIntvec_t	m_tValue;	///< data, owned by the hash
-	int				m_iNext;	///< next entry in hash arena
-};
-
+	Reset();
 
-template < int SIZE >
-class InfixBuilder_c : public ISphInfixBuilder
-{
-protected:
-	static const int							LENGTH = 1048576;
+	const BYTE * pCur = pSection;
+	int iWords = sphUnzipInt ( pCur );
+	int64_t iRoot = sphUnzipOffset ( pCur );
+	int64_t iBlobLen = sphUnzipOffset ( pCur );
 
-protected:
-	int											m_dHash [ LENGTH ];		///< all the hash entries
-	CSphSwapVector < InfixHashEntry_t<SIZE> >	m_dArena;
-	CSphVector<InfixBlock_t>					m_dBlocks;
-	CSphTightVector<BYTE>						m_dBlocksWords;
+	if ( pCur+iBlobLen>pMax || iRoot>=iBlobLen )
+	{
+		sError.SetSprintf ( "keywords FST out of bounds (root=" INT64_FMT ", size=" INT64_FMT ", available=" INT64_FMT ")",
+			iRoot, iBlobLen, (int64_t)( pMax-pCur ) );
+		return false;
+	}
 
-public:
-					InfixBuilder_c();
-	virtual void	AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology );
-	virtual void	SaveEntries ( CSphWriter & wrDict );
-	virtual int64_t	SaveEntryBlocks ( CSphWriter & wrDict );
-	virtual int		GetBlocksWordsSize () const { return m_dBlocksWords.GetLength(); }
+	m_pBlob = pCur;
+	m_iBlobLen = iBlobLen;
+	m_iRoot = iRoot;
+	m_iWords = iWords;
+	return true;
+}
 
-protected:
-	/// add new entry
-	void AddEntry ( const Infix_t<SIZE> & tKey, DWORD uHash, int iCheckpoint )
-	{
-		uHash &= ( LENGTH-1 );
 
-		int iEntry = m_dArena.GetLength();
-		InfixHashEntry_t<SIZE> & tNew = m_dArena.Add();
-		tNew.m_tKey = tKey;
-		tNew.m_tValue.m_dData[0] = 0x1000000UL | iCheckpoint; // len=1, data=iCheckpoint
-		tNew.m_iNext = m_dHash[uHash];
-		m_dHash[uHash] = iEntry;
-	}
+// follows an arc by label, accumulates ordinal
+static inline bool FstStep ( const BYTE * pBlob, const BYTE * & pState, BYTE uLabel, int & iOrdinal )
+{
+	const BYTE * pCur = pState;
+	int iArcs = (int)( FstUnzip ( pCur )>>1 );
+	FstUnzip ( pCur ); // keywords count
 
-	/// get value pointer by key
-	InfixIntvec_t * LookupEntry ( const Infix_t<SIZE> & tKey, DWORD uHash )
+	for ( int i=0; i<iArcs; i++ )
 	{
-		uHash &= ( LENGTH-1 );
-		int iEntry = m_dHash [ uHash ];
-		int iiEntry = 0;
+		BYTE uArc = *pCur++;
+		if ( uArc>uLabel )
+			return false;
 
-		while ( iEntry )
+		DWORD uOut = (DWORD)FstUnzip ( pCur );
+		uint64_t uTarget = FstUnzip ( pCur );
+		if ( uArc==uLabel )
 		{
-			if ( m_dArena[iEntry].m_tKey==tKey )
-			{
-				// mtf it, if needed
-				if ( iiEntry )
-				{
-					m_dArena[iiEntry].m_iNext = m_dArena[iEntry].m_iNext;
-					m_dArena[iEntry].m_iNext = m_dHash[uHash];
-					m_dHash[uHash] = iEntry;
-				}
-				return &m_dArena[iEntry].m_tValue;
-			}
-			iiEntry = iEntry;
-			iEntry = m_dArena[iEntry].m_iNext;
+			iOrdinal += uOut;
+			pState = pBlob + uTarget;
+			return true;
 		}
-		return NULL;
 	}
-};
+	return false;
+}
+
 
+int KeywordsFst_c::Find ( const BYTE * pWord, int iLen ) const
+{
+	if ( !m_pBlob )
+		return -1;
 
-template < int SIZE >
-InfixBuilder_c<SIZE>::InfixBuilder_c()
+	const BYTE * pState = m_pBlob + m_iRoot;
+	int iOrdinal = 0;
+	for ( int i=0; i<iLen; i++ )
+		if ( !FstStep ( m_pBlob, pState, pWord[i], iOrdinal ) )
+			return -1;
+
+	return ( FstUnzip ( pState ) & 1 ) ? iOrdinal : -1;
+}
+
+
+bool KeywordsFst_c::FindPrefix ( const BYTE * pPrefix, int iLen, int & iFirst, int & iCount ) const
 {
-	// init the hash
-	for ( int i=0; i<LENGTH; i++ )
-		m_dHash[i] = 0;
-	m_dArena.Reserve ( 1048576 );
-	m_dArena.Resize ( 1 ); // 0 is a reserved index
+	iFirst = iCount = 0;
+	if ( !m_pBlob )
+		return false;
+
+	const BYTE * pState = m_pBlob + m_iRoot;
+	int iOrdinal = 0;
+	for ( int i=0; i<iLen; i++ )
+		if ( !FstStep ( m_pBlob, pState, pPrefix[i], iOrdinal ) )
+			return false;
+
+	FstUnzip ( pState ); // arcs and final flag
+	iFirst = iOrdinal;
+	iCount = (int)FstUnzip ( pState );
+	return iCount>0;
 }
 
 
-/// single-byte case, 2-dword infixes
-template<>
-void InfixBuilder_c<2>::AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology )
+/// depth-first walk over FST that keeps one levenshtein row per decoded codepoint
+/// and cuts off subtrees that can not get within edits threshold anymore
+struct FstFuzzyWalker_t
 {
-	if ( bHasMorphology && *pWord!=MAGIC_WORD_HEAD_NONSTEMMED )
-		return;
+	static const int	MAX_BYTES = SPH_MAX_WORD_LEN*3+4;
 
-	if ( *pWord<0x20 ) // skip heading magic chars, like NONSTEMMED maker
+	const BYTE *		m_pBlob;
+	const int *			m_pRef;
+	int					m_iRefLen;
+	int					m_iMaxEdits;
+	int					m_iMinChars;
+	int					m_iMaxChars;
+	bool				m_bNonCharAllowed;
+	int					m_iHead;		///< magic head bytes to match and skip (exact words dictionary)
+
+	BYTE				m_sWord [ MAX_BYTES ];
+	CSphVector<int>		m_dRows;
+
+	CSphVector<KeywordsFst_c::FuzzyMatch_t> *	m_pMatches;
+	CSphVector<BYTE> *							m_pWords;
+
+	int * Row ( int iChars )
 	{
-		pWord++;
-		iWordLength--;
+		return m_dRows.Begin() + iChars * ( m_iRefLen+1 );
 	}
 
-	Infix_t<2> sKey;
-	for ( int p=0; p<=iWordLength-2; p++ )
+	void Walk ( const BYTE * pState, int iBytes, int iCharStart, int iChars, int iOrdinal )
 	{
-		sKey.Reset();
+		const BYTE * pCur = pState;
+		uint64_t uHead = FstUnzip ( pCur );
+		FstUnzip ( pCur ); // keywords count
+		int iArcs = (int)( uHead>>1 );
 
-		BYTE * pKey = (BYTE*)sKey.m_Data;
-		const BYTE * s = pWord + p;
-		const BYTE * sMax = s + Min ( 6, iWordLength-p );
+		// got a keyword at complete codepoint?
+		if ( ( uHead & 1 ) && iCharStart==iBytes && iBytes>m_iHead
+			&& iChars>m_iMinChars && iChars<m_iMaxChars && Row ( iChars )[m_iRefLen]<=m_iMaxEdits )
+		{
+			KeywordsFst_c::FuzzyMatch_t & tMatch = m_pMatches->Add();
+			tMatch.m_iOrdinal = iOrdinal;
+			tMatch.m_iDistance = Row ( iChars )[m_iRefLen];
+			tMatch.m_iWordOff = m_pWords->GetLength();
+			tMatch.m_iWordLen = iBytes - m_iHead;
+			memcpy ( m_pWords->AddN ( tMatch.m_iWordLen ), m_sWord + m_iHead, tMatch.m_iWordLen );
+		}
 
-		DWORD uHash = 0xffffffUL ^ g_dSphinxCRC32 [ 0xff ^ *s ];
-		*pKey++ = *s++; // copy first infix byte
+		if ( iBytes+1>=MAX_BYTES )
+			return;
 
-		while ( s<sMax )
+		for ( int i=0; i<iArcs; i++ )
 		{
-			uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
-			*pKey++ = *s++; // copy another infix byte
+			BYTE uLabel = *pCur++;
+			int iOut = (int)FstUnzip ( pCur );
+			const BYTE * pTarget = m_pBlob + FstUnzip ( pCur );
 
-			InfixIntvec_t * pVal = LookupEntry ( sKey, uHash );
-			if ( pVal )
-				pVal->Add ( iCheckpoint );
-			else
-				AddEntry ( sKey, uHash, iCheckpoint );
+			// heading magic must match exactly, and is not a part of the word
+			if ( iBytes<m_iHead )
+			{
+				if ( uLabel==MAGIC_WORD_HEAD_NONSTEMMED )
+					Walk ( pTarget, iBytes+1, iBytes+1, iChars, iOrdinal+iOut );
+				continue;
+			}
+
+			m_sWord[iBytes] = uLabel;
+			if ( iBytes+1-iCharStart<sphUtf8CharBytes ( m_sWord[iCharStart] ) )
+			{
+				// codepoint is not yet complete
+				Walk ( pTarget, iBytes+1, iCharStart, iChars, iOrdinal+iOut );
+				continue;
+			}
+
+			if ( iChars+1>=m_iMaxChars )
+				continue;
+
+			const BYTE * pChar = m_sWord + iCharStart;
+			int iCode = sphUTF8Decode ( pChar );
+			if ( !m_bNonCharAllowed && ( iCode<'A' || ( iCode>'Z' && iCode<'a' ) ) )
+				continue;
+
+			const int * pPrev = Row ( iChars );
+			int * pNext = Row ( iChars+1 );
+			pNext[0] = pPrev[0] + 1;
+			int iBest = pNext[0];
+			for ( int j=1; j<=m_iRefLen; j++ )
+			{
+				int iDist = pPrev[j-1] + ( m_pRef[j-1]==iCode ? 0 : 1 );
+				iDist = Min ( iDist, pPrev[j]+1 );
+				iDist = Min ( iDist, pNext[j-1]+1 );
+				pNext[j] = iDist;
+				iBest = Min ( iBest, iDist );
+			}
+
+			if ( iBest<=m_iMaxEdits )
+				Walk ( pTarget, iBytes+1, iBytes+1, iChars+1, iOrdinal+iOut );
 		}
 	}
-}
+};
 
 
-/// UTF-8 case, 3/5-dword infixes
-template < int SIZE >
-void InfixBuilder_c<SIZE>::AddWord ( const BYTE * pWord, int iWordLength, int iCheckpoint, bool bHasMorphology )
+void KeywordsFst_c::FuzzyWords ( const SuggestArgs_t & tArgs, const SuggestResult_t & tRes, CSphVector<FuzzyMatch_t> & dMatches, CSphVector<BYTE> & dWords ) const
 {
-	if ( bHasMorphology && *pWord!=MAGIC_WORD_HEAD_NONSTEMMED )
+	if ( !m_pBlob || !tRes.m_iCodepoints )
 		return;
 
-	if ( *pWord<0x20 ) // skip heading magic chars, like NONSTEMMED maker
-	{
-		pWord++;
-		iWordLength--;
+	FstFuzzyWalker_t tWalker;
+	tWalker.m_pBlob = m_pBlob;
+	tWalker.m_pRef = tRes.m_dCodepoints;
+	tWalker.m_iRefLen = tRes.m_iCodepoints;
+	tWalker.m_iMinChars = ( tArgs.m_iDeltaLen>0 ? Max ( 0, tRes.m_iCodepoints - tArgs.m_iDeltaLen ) : -1 );
+	tWalker.m_iMaxChars = ( tArgs.m_iDeltaLen>0 ? tRes.m_iCodepoints + tArgs.m_iDeltaLen : INT_MAX );
+	tWalker.m_bNonCharAllowed = tArgs.m_bNonCharAllowed;
+	tWalker.m_iHead = ( tRes.m_bHasExactDict ? 1 : 0 );
+	tWalker.m_pMatches = &dMatches;
+	tWalker.m_pWords = &dWords;
+
+	tWalker.m_dRows.Resize ( ( FstFuzzyWalker_t::MAX_BYTES+1 ) * ( tWalker.m_iRefLen+1 ) );
+	for ( int j=0; j<=tWalker.m_iRefLen; j++ )
+		tWalker.m_dRows[j] = j;
+
+	// results are ranked by distance first, so once there are enough
+	// closer keywords there is no point to collect (lots of) further ones
+	for ( int iEdits=Min ( 1, tArgs.m_iMaxEdits ); iEdits<=tArgs.m_iMaxEdits; iEdits++ )
+	{
+		dMatches.Resize ( 0 );
+		dWords.Resize ( 0 );
+		tWalker.m_iMaxEdits = iEdits;
+		tWalker.Walk ( m_pBlob + m_iRoot, 0, 0, 0, 0 );
+
+		if ( dMatches.GetLength()>=tArgs.m_iLimit || sphInterrupted() )
+			break;
 	}
+}
 
-	int iCodes = 0; // codepoints in current word
-	BYTE dBytes[SPH_MAX_WORD_LEN+1]; // byte offset for each codepoints
+//////////////////////////////////////////////////////////////////////////
+// INFIX TRIGRAMS
+//////////////////////////////////////////////////////////////////////////
 
-	// build an offsets table into the bytestring
-	dBytes[0] = 0;
-	for ( const BYTE * p = (const BYTE*)pWord; p<pWord+iWordLength && iCodes<SPH_MAX_WORD_LEN; )
-	{
-		int iLen = 0;
-		BYTE uVal = *p;
-		while ( uVal & 0x80 )
-		{
-			uVal <<= 1;
-			iLen++;
-		}
-		if ( !iLen )
-			iLen = 1;
+// section is zipped trigrams count, zipped postings size, then ( trigram hash, posting offset ) table sorted by hash,
+// then postings; posting is ( count, ordinal deltas ), first delta is from -1, all fst-zipped
 
-		// skip word with large codepoints
-		if ( iLen>SIZE )
-			return;
+const char * g_sTagInfixTrigrams = "infix-trigrams";
 
-		assert ( iLen>=1 && iLen<=4 );
-		p += iLen;
+static const int TRIGRAMS_TABLE_ENTRY = 2*sizeof(uint64_t);
 
-		dBytes[iCodes+1] = dBytes[iCodes] + (BYTE)iLen;
-		iCodes++;
-	}
-	assert ( pWord[dBytes[iCodes]]==0 || iCodes==SPH_MAX_WORD_LEN );
+// hashes every 3 consecutive codepoints of a string, returns trigrams count
+static int InfixTrigramKeys ( const BYTE * pStr, int iLen, uint64_t * pKeys )
+{
+	assert ( iLen<=MAX_KEYWORD_BYTES );
 
-	// generate infixes
-	Infix_t<SIZE> sKey;
-	for ( int p=0; p<=iCodes-2; p++ )
-	{
-		sKey.Reset();
-		BYTE * pKey = (BYTE*)sKey.m_Data;
+	int dStarts [ MAX_KEYWORD_BYTES+1 ];
+	int iChars = 0;
+	for ( int i=0; i<iLen; i+=sphUtf8CharBytes ( pStr[i] ) )
+		dStarts[iChars++] = i;
+	dStarts[iChars] = iLen;
 
-		const BYTE * s = pWord + dBytes[p];
-		const BYTE * sMax = pWord + dBytes[ p+Min ( 6, iCodes-p ) ];
+	for ( int i=0; i<iChars-2; i++ )
+		pKeys[i] = sphFNV64 ( pStr+dStarts[i], dStarts[i+3]-dStarts[i] );
 
-		// copy first infix codepoint
-		DWORD uHash = 0xffffffffUL;
-		do
-		{
-			uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
-			*pKey++ = *s++;
-		} while ( ( *s & 0xC0 )==0x80 );
+	return Max ( iChars-2, 0 );
+}
 
-		while ( s<sMax )
-		{
-			// copy next infix codepoint
-			do
-			{
-				uHash = (uHash >> 8) ^ g_dSphinxCRC32 [ (uHash ^ *s) & 0xff ];
-				*pKey++ = *s++;
-			} while ( ( *s & 0xC0 )==0x80 );
 
-			InfixIntvec_t * pVal = LookupEntry ( sKey, uHash );
-			if ( pVal )
-				pVal->Add ( iCheckpoint );
-			else
-				AddEntry ( sKey, uHash, iCheckpoint );
-		}
-	}
+InfixTrigramsBuilder_c::InfixTrigramsBuilder_c ()
+	: m_iWords ( 0 )
+{
+	m_dHash.Resize ( 65536 );
+	ARRAY_FOREACH ( i, m_dHash )
+		m_dHash[i] = -1;
 }
 
 
-template < int SIZE >
-struct InfixHashCmp_fn
+void InfixTrigramsBuilder_c::AddWord ( const BYTE * pWord, int iLen, bool bHasMorphology )
 {
-	InfixHashEntry_t<SIZE> * m_pBase;
+	const int iOrdinal = m_iWords++;
 
-	explicit InfixHashCmp_fn ( InfixHashEntry_t<SIZE> * pBase )
-		: m_pBase ( pBase )
-	{}
+	// stemmed terms should not match infixes
+	if ( bHasMorphology && *pWord!=MAGIC_WORD_HEAD_NONSTEMMED )
+		return;
 
-	bool IsLess ( int a, int b ) const
+	if ( iLen && *pWord<0x20 ) // skip heading magic chars, like NONSTEMMED maker
 	{
-		return strncmp ( (const char*)m_pBase[a].m_tKey.m_Data, (const char*)m_pBase[b].m_tKey.m_Data, sizeof(DWORD)*SIZE )<0;
+		pWord++;
+		iLen--;
 	}
-};
 
+	uint64_t dKeys [ MAX_KEYWORD_BYTES ];
+	int iKeys = InfixTrigramKeys ( pWord, Min ( iLen, MAX_KEYWORD_BYTES ), dKeys );
 
-static inline int ZippedIntSize ( DWORD v )
-{
-	if ( v < (1UL<<7) )
-		return 1;
-	if ( v < (1UL<<14) )
-		return 2;
-	if ( v < (1UL<<21) )
-		return 3;
-	if ( v < (1UL<<28) )
-		return 4;
-	return 5;
-}
-
+	for ( int i=0; i<iKeys; i++ )
+	{
+		if ( m_dPostings.GetLength()*2>=m_dHash.GetLength() )
+			HashGrow();
 
-static const char * g_sTagInfixEntries = "infix-entries";
+		const int iMask = m_dHash.GetLength()-1;
+		int iSlot = (int)( dKeys[i] & iMask );
+		while ( m_dHash[iSlot]>=0 && m_dPostings [ m_dHash[iSlot] ].m_uKey!=dKeys[i] )
+			iSlot = ( iSlot+1 ) & iMask;
 
-template < int SIZE >
-void InfixBuilder_c<SIZE>::SaveEntries ( CSphWriter & wrDict )
-{
-	// intentionally local to this function
-	// we mark the block end with an editcode of 0
-	const int INFIX_BLOCK_SIZE = 64;
+		if ( m_dHash[iSlot]<0 )
+		{
+			m_dHash[iSlot] = m_dPostings.GetLength();
+			Posting_t & tNew = m_dPostings.Add();
+			tNew.m_uKey = dKeys[i];
+			tNew.m_iLast = -1;
+			tNew.m_iCount = 0;
+			tNew.m_iBytes = 0;
+			tNew.m_iHead = tNew.m_iTail = -1;
+			tNew.m_iTailUsed = CHUNK_SIZE;
+		}
 
-	wrDict.PutBytes ( g_sTagInfixEntries, strlen ( g_sTagInfixEntries ) );
+		Append ( m_dPostings [ m_dHash[iSlot] ], iOrdinal );
+	}
+}
 
-	CSphVector<int> dIndex;
-	dIndex.Resize ( m_dArena.GetLength()-1 );
-	for ( int i=0; i<m_dArena.GetLength()-1; i++ )
-		dIndex[i] = i+1;
 
-	InfixHashCmp_fn<SIZE> fnCmp ( m_dArena.Begin() );
-	dIndex.Sort ( fnCmp );
+void InfixTrigramsBuilder_c::Append ( Posting_t & tPosting, int iOrdinal )
+{
+	// same trigram might occur several times in a keyword
+	if ( tPosting.m_iLast==iOrdinal )
+		return;
 
-	m_dBlocksWords.Reserve ( m_dArena.GetLength()/INFIX_BLOCK_SIZE*sizeof(DWORD)*SIZE );
-	int iBlock = 0;
-	int iPrevKey = -1;
-	ARRAY_FOREACH ( iIndex, dIndex )
+	BYTE dDelta[8];
+	int iDelta = 0;
+	DWORD uDelta = iOrdinal - tPosting.m_iLast;
+	while ( uDelta>=0x80 )
 	{
-		InfixIntvec_t & dData = m_dArena[dIndex[iIndex]].m_tValue;
-		const BYTE * sKey = (const BYTE*) m_dArena[dIndex[iIndex]].m_tKey.m_Data;
-		int iChars = ( SIZE==2 )
-			? strnlen ( (const char*)sKey, sizeof(DWORD)*SIZE )
-			: sphUTF8Len ( (const char*)sKey, sizeof(DWORD)*SIZE );
-		assert ( iChars>=2 && iChars<int(1 + sizeof ( Infix_t<SIZE> ) ) );
+		dDelta[iDelta++] = (BYTE)( uDelta | 0x80 );
+		uDelta >>= 7;
+	}
+	dDelta[iDelta++] = (BYTE)uDelta;
 
-		// keep track of N-infix blocks
-		int iAppendBytes = strnlen ( (const char*)sKey, sizeof(DWORD)*SIZE );
-		if ( !iBlock )
+	for ( int i=0; i<iDelta; i++ )
+	{
+		if ( tPosting.m_iTailUsed==CHUNK_SIZE )
 		{
-			int iOff = m_dBlocksWords.GetLength();
-			m_dBlocksWords.Resize ( iOff+iAppendBytes+1 );
+			int iChunk = m_dChunks.GetLength() / CHUNK_SIZE;
+			m_dChunks.Resize ( m_dChunks.GetLength() + CHUNK_SIZE );
+			sphUnalignedWrite ( m_dChunks.Begin() + iChunk*CHUNK_SIZE, -1 );
 
-			InfixBlock_t & tBlock = m_dBlocks.Add();
-			tBlock.m_iInfixOffset = iOff;
-			tBlock.m_iOffset = (DWORD)wrDict.GetPos();
+			if ( tPosting.m_iTail>=0 )
+				sphUnalignedWrite ( m_dChunks.Begin() + tPosting.m_iTail*CHUNK_SIZE, iChunk );
+			else
+				tPosting.m_iHead = iChunk;
 
-			memcpy ( m_dBlocksWords.Begin()+iOff, sKey, iAppendBytes );
-			m_dBlocksWords[iOff+iAppendBytes] = '\0';
+			tPosting.m_iTail = iChunk;
+			tPosting.m_iTailUsed = sizeof(int);
 		}
+		m_dChunks [ tPosting.m_iTail*CHUNK_SIZE + tPosting.m_iTailUsed++ ] = dDelta[i];
+	}
 
-		// compute max common prefix
-		// edit_code = ( num_keep_chars<<4 ) + num_append_chars
-		int iEditCode = iChars;
-		if ( iPrevKey>=0 )
-		{
-			const BYTE * sPrev = (const BYTE*) m_dArena[dIndex[iPrevKey]].m_tKey.m_Data;
-			const BYTE * sCur = (const BYTE*) sKey;
-			const BYTE * sMax = sCur + iAppendBytes;
+	tPosting.m_iLast = iOrdinal;
+	tPosting.m_iCount++;
+	tPosting.m_iBytes += iDelta;
+}
 
-			int iKeepChars = 0;
-			if_const ( SIZE==2 )
-			{
-				// SBCS path
-				while ( sCur<sMax && *sCur && *sCur==*sPrev )
-				{
-					sCur++;
-					sPrev++;
-				}
-				iKeepChars = (int)( sCur- ( const BYTE* ) sKey );
 
-				assert ( iKeepChars>=0 && iKeepChars<16 );
-				assert ( iChars-iKeepChars>=0 );
-				assert ( iChars-iKeepChars<16 );
+void InfixTrigramsBuilder_c::HashGrow ()
+{
+	m_dHash.Resize ( m_dHash.GetLength()*2 );
+	ARRAY_FOREACH ( i, m_dHash )
+		m_dHash[i] = -1;
 
-				iEditCode = ( iKeepChars<<4 ) + ( iChars-iKeepChars );
-				iAppendBytes = ( iChars-iKeepChars );
-				sKey = sCur;
+	const int iMask = m_dHash.GetLength()-1;
+	ARRAY_FOREACH ( i, m_dPostings )
+	{
+		int iSlot = (int)( m_dPostings[i].m_uKey & iMask );
+		while ( m_dHash[iSlot]>=0 )
+			iSlot = ( iSlot+1 ) & iMask;
+		m_dHash[iSlot] = i;
+	}
+}
 
-			} else
-			{
-				// UTF-8 path
-				const BYTE * sKeyMax = sCur; // track max matching sPrev prefix in [sKey,sKeyMax)
-				while ( sCur<sMax && *sCur && *sCur==*sPrev )
-				{
-					// current byte matches, move the pointer
-					sCur++;
-					sPrev++;
 
-					// tricky bit
-					// if the next (!) byte is a valid UTF-8 char start (or eof!)
-					// then we just matched not just a byte, but a full char
-					// so bump the matching prefix boundary and length
-					if ( sCur>=sMax || ( *sCur & 0xC0 )!=0x80 )
-					{
-						sKeyMax = sCur;
-						iKeepChars++;
-					}
-				}
+struct TrigramPostingKeyLess_fn
+{
+	template < typename POSTING >
+	inline bool IsLess ( const POSTING & a, const POSTING & b ) const
+	{
+		return a.m_uKey < b.m_uKey;
+	}
+};
 
-				assert ( iKeepChars>=0 && iKeepChars<16 );
-				assert ( iChars-iKeepChars>=0 );
-				assert ( iChars-iKeepChars<16 );
 
-				iEditCode = ( iKeepChars<<4 ) + ( iChars-iKeepChars );
-				iAppendBytes -= (int)( sKeyMax-sKey );
-				sKey = sKeyMax;
-			}
-		}
+int64_t InfixTrigramsBuilder_c::Save ( CSphWriter & wrDict )
+{
+	m_dHash.Reset();
+	m_dPostings.Sort ( TrigramPostingKeyLess_fn() );
 
-		// write edit code, postfix
-		wrDict.PutByte ( iEditCode );
-		wrDict.PutBytes ( sKey, iAppendBytes );
+	// posting goes as zipped count followed by deltas
+	CSphTightVector<BYTE> dCount;
+	int64_t iPostingsLen = 0;
+	ARRAY_FOREACH ( i, m_dPostings )
+	{
+		dCount.Resize ( 0 );
+		FstZip ( dCount, m_dPostings[i].m_iCount );
+		iPostingsLen += dCount.GetLength() + m_dPostings[i].m_iBytes;
+	}
 
-		// compute data length
-		int iDataLen = ZippedIntSize ( dData[0] );
-		for ( int j=1; j<dData.GetLength(); j++ )
-			iDataLen += ZippedIntSize ( dData[j] - dData[j-1] );
+	wrDict.PutBytes ( g_sTagInfixTrigrams, strlen ( g_sTagInfixTrigrams ) );
+	int64_t iTrigramsOffset = wrDict.GetPos();
 
-		// write data length, data
-		wrDict.ZipInt ( iDataLen );
-		wrDict.ZipInt ( dData[0] );
-		for ( int j=1; j<dData.GetLength(); j++ )
-			wrDict.ZipInt ( dData[j] - dData[j-1] );
+	wrDict.ZipInt ( m_dPostings.GetLength() );
+	wrDict.ZipOffset ( iPostingsLen );
 
-		// mark block end, restart deltas
-		iPrevKey = iIndex;
-		if ( ++iBlock==INFIX_BLOCK_SIZE )
+	int64_t iOffset = 0;
+	ARRAY_FOREACH ( i, m_dPostings )
+	{
+		wrDict.PutOffset ( (SphOffset_t)m_dPostings[i].m_uKey );
+		wrDict.PutOffset ( iOffset );
+
+		dCount.Resize ( 0 );
+		FstZip ( dCount, m_dPostings[i].m_iCount );
+		iOffset += dCount.GetLength() + m_dPostings[i].m_iBytes;
+	}
+
+	ARRAY_FOREACH ( i, m_dPostings )
+	{
+		const Posting_t & tPosting = m_dPostings[i];
+		dCount.Resize ( 0 );
+		FstZip ( dCount, tPosting.m_iCount );
+		wrDict.PutBytes ( dCount.Begin(), dCount.GetLength() );
+
+		for ( int iChunk=tPosting.m_iHead; iChunk>=0; )
 		{
-			iBlock = 0;
-			iPrevKey = -1;
-			wrDict.PutByte ( 0 );
+			const BYTE * pChunk = m_dChunks.Begin() + iChunk*CHUNK_SIZE;
+			int iUsed = ( iChunk==tPosting.m_iTail ? tPosting.m_iTailUsed : CHUNK_SIZE );
+			wrDict.PutBytes ( pChunk+sizeof(int), iUsed-sizeof(int) );
+			iChunk = sphUnalignedRead ( *(const int*)pChunk );
 		}
 	}
 
-	// put end marker
-	if ( iBlock )
-		wrDict.PutByte ( 0 );
+	m_dPostings.Reset();
+	m_dChunks.Reset();
+	return iTrigramsOffset;
+}
 
-	const char * pBlockWords = (const char *)m_dBlocksWords.Begin();
-	ARRAY_FOREACH ( i, m_dBlocks )
-		m_dBlocks[i].m_sInfix = pBlockWords+m_dBlocks[i].m_iInfixOffset;
 
-	if ( wrDict.GetPos()>UINT_MAX ) // FIXME!!! change to int64
-		sphDie ( "INTERNAL ERROR: dictionary size " INT64_FMT " overflow at infix save", wrDict.GetPos() );
+bool InfixTrigrams_c::Setup ( const BYTE * pSection, const BYTE * pMax, CSphString & sError )
+{
+	Reset();
+
+	const BYTE * pCur = pSection;
+	int iTrigrams = sphUnzipInt ( pCur );
+	int64_t iPostingsLen = sphUnzipOffset ( pCur );
+
+	if ( iTrigrams<0 || pCur + (int64_t)iTrigrams*TRIGRAMS_TABLE_ENTRY + iPostingsLen>pMax )
+	{
+		sError.SetSprintf ( "infix trigrams out of bounds (trigrams=%d, postings size=" INT64_FMT ", available=" INT64_FMT ")",
+			iTrigrams, iPostingsLen, (int64_t)( pMax-pCur ) );
+		return false;
+	}
+
+	m_pTable = pCur;
+	m_pPostings = pCur + (int64_t)iTrigrams*TRIGRAMS_TABLE_ENTRY;
+	m_iPostingsLen = iPostingsLen;
+	m_iTrigrams = iTrigrams;
+	return true;
 }
 
 
-static const char * g_sTagInfixBlocks = "infix-blocks";
+const BYTE * InfixTrigrams_c::FindPosting ( uint64_t uKey ) const
+{
+	int iL = 0;
+	int iR = m_iTrigrams-1;
+	while ( iL<=iR )
+	{
+		int iMid = iL + ( iR-iL )/2;
+		const BYTE * pEntry = m_pTable + (int64_t)iMid*TRIGRAMS_TABLE_ENTRY;
+		uint64_t uMid = sphUnalignedRead ( *(const uint64_t*)pEntry );
+		if ( uMid==uKey )
+			return m_pPostings + sphUnalignedRead ( *(const int64_t*)( pEntry+sizeof(uint64_t) ) );
 
-template < int SIZE >
-int64_t InfixBuilder_c<SIZE>::SaveEntryBlocks ( CSphWriter & wrDict )
+		if ( uMid<uKey )
+			iL = iMid+1;
+		else
+			iR = iMid-1;
+	}
+	return NULL;
+}
+
+
+struct TrigramPosting_t
 {
-	// save the blocks
-	wrDict.PutBytes ( g_sTagInfixBlocks, strlen ( g_sTagInfixBlocks ) );
+	const BYTE *	m_pDeltas;
+	int				m_iCount;
 
-	SphOffset_t iInfixBlocksOffset = wrDict.GetPos();
-	assert ( iInfixBlocksOffset<=INT_MAX );
+	bool operator < ( const TrigramPosting_t & rhs ) const
+	{
+		return m_iCount < rhs.m_iCount;
+	}
+};
 
-	wrDict.ZipInt ( m_dBlocks.GetLength() );
-	ARRAY_FOREACH ( i, m_dBlocks )
+
+bool InfixTrigrams_c::GetCandidates ( const char * sWildcard, CSphVector<int> & dOrdinals ) const
+{
+	dOrdinals.Resize ( 0 );
+	if ( !m_pTable )
+		return false;
+
+	// collect trigrams of all the literal fragments
+	// escapes break fragments too, that only costs a little selectivity
+	CSphVector<uint64_t> dKeys;
+	uint64_t dFragmentKeys [ MAX_KEYWORD_BYTES ];
+	const BYTE * sFragment = (const BYTE *)sWildcard;
+	for ( const BYTE * s = sFragment; ; s++ )
 	{
-		int iBytes = strlen ( m_dBlocks[i].m_sInfix );
-		wrDict.PutByte ( iBytes );
-		wrDict.PutBytes ( m_dBlocks[i].m_sInfix, iBytes );
-		wrDict.ZipInt ( m_dBlocks[i].m_iOffset ); // maybe delta these on top?
+		if ( *s && !sphIsWild ( *s ) && *s!='\\' )
+			continue;
+
+		int iKeys = InfixTrigramKeys ( sFragment, Min ( (int)( s-sFragment ), MAX_KEYWORD_BYTES ), dFragmentKeys );
+		for ( int i=0; i<iKeys; i++ )
+			dKeys.Add ( dFragmentKeys[i] );
+
+		if ( !*s )
+			break;
+		sFragment = s+1;
 	}
 
-	return iInfixBlocksOffset;
+	if ( !dKeys.GetLength() )
+		return false;
+	dKeys.Uniq();
+
+	// any missing trigram means no matches at all
+	CSphVector<TrigramPosting_t> dPostings ( dKeys.GetLength() );
+	ARRAY_FOREACH ( i, dKeys )
+	{
+		const BYTE * pPosting = FindPosting ( dKeys[i] );
+		if ( !pPosting )
+			return true;
+
+		dPostings[i].m_iCount = (int)FstUnzip ( pPosting );
+		dPostings[i].m_pDeltas = pPosting;
+	}
+	dPostings.Sort();
+
+	// shortest posting gives the candidates
+	const BYTE * pDeltas = dPostings[0].m_pDeltas;
+	dOrdinals.Resize ( dPostings[0].m_iCount );
+	int iOrdinal = -1;
+	ARRAY_FOREACH ( i, dOrdinals )
+	{
+		iOrdinal += (int)FstUnzip ( pDeltas );
+		dOrdinals[i] = iOrdinal;
+	}
+
+	// then intersect with the others, while that is cheaper than checking the candidates
+	// (every candidate costs a partial keyword block unpack)
+	for ( int i=1; i<dPostings.GetLength() && dOrdinals.GetLength(); i++ )
+	{
+		if ( dPostings[i].m_iCount>dOrdinals.GetLength()*SPH_WORDLIST_CHECKPOINT )
+			break;
+
+		pDeltas = dPostings[i].m_pDeltas;
+		iOrdinal = -1;
+		int iSrc = 0;
+		int iDst = 0;
+		for ( int iLeft=dPostings[i].m_iCount; iLeft>0 && iSrc<dOrdinals.GetLength(); iLeft-- )
+		{
+			iOrdinal += (int)FstUnzip ( pDeltas );
+			while ( iSrc<dOrdinals.GetLength() && dOrdinals[iSrc]<iOrdinal )
+				iSrc++;
+			if ( iSrc<dOrdinals.GetLength() && dOrdinals[iSrc]==iOrdinal )
+				dOrdinals[iDst++] = dOrdinals[iSrc++];
+		}
+		dOrdinals.Resize ( iDst );
+	}
+
+	return true;
 }
 
 
-ISphInfixBuilder * sphCreateInfixBuilder ( int iCodepointBytes, CSphString * pError )
+bool InfixTrigrams_c::Check ( int iWords, CSphString & sError ) const
 {
-	assert ( pError );
-	*pError = CSphString();
-	switch ( iCodepointBytes )
+	const BYTE * pMax = m_pPostings + m_iPostingsLen;
+	uint64_t uPrevKey = 0;
+	for ( int i=0; i<m_iTrigrams; i++ )
 	{
-	case 0:		return NULL;
-	case 1:		return new InfixBuilder_c<2>(); // upto 6x1 bytes, 2 dwords, sbcs
-	case 2:		return new InfixBuilder_c<3>(); // upto 6x2 bytes, 3 dwords, utf-8
-	case 3:		return new InfixBuilder_c<5>(); // upto 6x3 bytes, 5 dwords, utf-8
-	default:	pError->SetSprintf ( "unhandled max infix codepoint size %d", iCodepointBytes ); return NULL;
+		const BYTE * pEntry = m_pTable + (int64_t)i*TRIGRAMS_TABLE_ENTRY;
+		uint64_t uKey = sphUnalignedRead ( *(const uint64_t*)pEntry );
+		int64_t iOffset = sphUnalignedRead ( *(const int64_t*)( pEntry+sizeof(uint64_t) ) );
+
+		if ( i && uKey<=uPrevKey )
+		{
+			sError.SetSprintf ( "trigram %d: hash out of order", i );
+			return false;
+		}
+		uPrevKey = uKey;
+
+		if ( iOffset<0 || iOffset>=m_iPostingsLen )
+		{
+			sError.SetSprintf ( "trigram %d: posting offset out of bounds (offset=" INT64_FMT ", size=" INT64_FMT ")", i, iOffset, m_iPostingsLen );
+			return false;
+		}
+
+		const BYTE * pCur = m_pPostings + iOffset;
+		int iCount = (int)FstUnzip ( pCur );
+		int iOrdinal = -1;
+		for ( int j=0; j<iCount; j++ )
+		{
+			if ( pCur>=pMax )
+			{
+				sError.SetSprintf ( "trigram %d: posting out of bounds", i );
+				return false;
+			}
+
+			int iDelta = (int)FstUnzip ( pCur );
+			iOrdinal += iDelta;
+			if ( iDelta<=0 || iOrdinal>=iWords )
+			{
+				sError.SetSprintf ( "trigram %d: ordinal %d out of order or range (delta=%d, words=%d)", i, iOrdinal, iDelta, iWords );
+				return false;
+			}
+		}
 	}
+
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -22476,6 +24953,12 @@ bool CSphDictKeywords::DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphStri
 		return false;
 	}
 
+	// keywords FST builder, if needed
+	KeywordsFstBuilder_c * pFst = pHeader->m_bBuildFst ? new KeywordsFstBuilder_c() : NULL;
+
+	// infix trigrams builder, if needed
+	InfixTrigramsBuilder_c * pTrigrams = pHeader->m_bBuildTrigrams ? new InfixTrigramsBuilder_c() : NULL;
+
 	// initialize readers
 	CSphVector<CSphBin*> dBins ( m_dDictBlocks.GetLength() );
 
@@ -22505,6 +24988,8 @@ bool CSphDictKeywords::DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphStri
 				SafeDelete ( dBins[iIdx] ); \
 			SafeDeleteArray ( pKeywords ); \
 			SafeDelete ( pInfixer ); \
+			SafeDelete ( pFst ); \
+			SafeDelete ( pTrigrams ); \
 		}
 
 	// do the sort
@@ -22574,6 +25059,12 @@ bool CSphDictKeywords::DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphStri
 		if ( pInfixer )
 			pInfixer->AddWord ( (const BYTE*)tWord.m_sKeyword, iLen, m_dCheckpoints.GetLength(), bHasMorphology );
 
+		if ( pFst )
+			pFst->AddWord ( (const BYTE*)tWord.m_sKeyword, iLen );
+
+		if ( pTrigrams )
+			pTrigrams->AddWord ( (const BYTE*)tWord.m_sKeyword, iLen, bHasMorphology );
+
 		// next
 		int iBin = tWord.m_iBlock;
 		qWords.Pop ();
@@ -22628,6 +25119,14 @@ bool CSphDictKeywords::DictEnd ( DictHeader_t * pHeader, int iMemLimit, CSphStri
 			sphDie ( "INTERNAL ERROR: dictionary size " INT64_FMT " overflow at dictend save", pHeader->m_iInfixBlocksOffset );
 	}
 
+	// flush keywords FST
+	if ( pFst )
+		pHeader->m_iFstOffset = pFst->Save ( m_wrDict );
+
+	// flush infix trigrams
+	if ( pTrigrams )
+		pHeader->m_iTrigramsOffset = pTrigrams->Save ( m_wrDict );
+
 	// flush header
 	// mostly for debugging convenience
 	// primary storage is in the index wide header
@@ -29867,11 +32366,12 @@ void CSphSource_CSV::SetDelimiter ( const char * sDelimiter )
 /////////////////////////////////////////////////////////////////////////////
 
 
-void sphSetJsonOptions ( bool bStrict, bool bAutoconvNumbers, bool bKeynamesToLowercase )
+void sphSetJsonOptions ( bool bStrict, bool bAutoconvNumbers, bool bKeynamesToLowercase, int iKeyDirectory )
 {
 	g_bJsonStrict = bStrict;
 	g_bJsonAutoconvNumbers = bAutoconvNumbers;
 	g_bJsonKeynamesToLowercase = bKeynamesToLowercase;
+	g_iJsonKeyDirectory = iKeyDirectory;
 }
 
 
@@ -30004,6 +32504,7 @@ CWordlist::CWordlist ()
 	, m_dInfixBlocks ( 0 )
 	, m_pWords ( 0 )
 	, m_tMapedCpReader ( NULL )
+	, m_iInfixCacheOrdinals ( 0 )
 {
 	m_iDictCheckpointsOffset = 0;
 	m_bWordDict = false;
@@ -30022,6 +32523,12 @@ void CWordlist::Reset ()
 	m_pWords.Reset ( 0 );
 	SafeDeleteArray ( m_pInfixBlocksWords );
 	m_tMapedCpReader.Reset();
+	m_tFst.Reset();
+	m_tTrigrams.Reset();
+
+	CSphScopedLock<CSphMutex> tLock ( m_tInfixCacheLock );
+	m_hInfixCache.Reset();
+	m_iInfixCacheOrdinals = 0;
 }
 
 
@@ -30143,6 +32650,10 @@ bool CWordlist::Preread ( const char * sName, DWORD uVersion, bool bWordDict, CS
 	int iCheckpointOnlySize = (int)(iFileSize-m_iDictCheckpointsOffset);
 	if ( m_iInfixCodepointBytes && m_iInfixBlocksOffset )
 		iCheckpointOnlySize = (int)(m_iInfixBlocksOffset - strlen ( g_sTagInfixBlocks ) - m_iDictCheckpointsOffset);
+	else if ( m_iFstOffset )
+		iCheckpointOnlySize = (int)(m_iFstOffset - strlen ( g_sTagKeywordsFst ) - m_iDictCheckpointsOffset);
+	else if ( m_iTrigramsOffset )
+		iCheckpointOnlySize = (int)(m_iTrigramsOffset - strlen ( g_sTagInfixTrigrams ) - m_iDictCheckpointsOffset);
 
 	if ( iFileSize-m_iDictCheckpointsOffset>=UINT_MAX )
 	{
@@ -30154,25 +32665,40 @@ bool CWordlist::Preread ( const char * sName, DWORD uVersion, bool bWordDict, CS
 	tReader.SeekTo ( m_iDictCheckpointsOffset, iCheckpointOnlySize );
 
 	assert ( m_bWordDict );
-	int iArenaSize = iCheckpointOnlySize
-		- (sizeof(DWORD)+sizeof(SphOffset_t))*m_dCheckpoints.GetLength()
-		+ sizeof(BYTE)*m_dCheckpoints.GetLength();
-	assert ( iArenaSize>=0 );
-	m_pWords.Reset ( iArenaSize );
+	if ( m_iFstOffset )
+	{
+		// keywords FST does all the lookups, so only keep block offsets
+		ARRAY_FOREACH ( i, m_dCheckpoints )
+		{
+			const int iLen = tReader.GetDword();
+			assert ( iLen>0 );
+			tReader.SkipBytes ( iLen );
 
-	BYTE * pWord = m_pWords.Begin();
-	ARRAY_FOREACH ( i, m_dCheckpoints )
+			m_dCheckpoints[i].m_sWord = NULL;
+			m_dCheckpoints[i].m_iWordlistOffset = tReader.GetOffset();
+		}
+	} else
 	{
-		m_dCheckpoints[i].m_sWord = (char *)pWord;
+		int iArenaSize = iCheckpointOnlySize
+			- (sizeof(DWORD)+sizeof(SphOffset_t))*m_dCheckpoints.GetLength()
+			+ sizeof(BYTE)*m_dCheckpoints.GetLength();
+		assert ( iArenaSize>=0 );
+		m_pWords.Reset ( iArenaSize );
 
-		const int iLen = tReader.GetDword();
-		assert ( iLen>0 );
-		assert ( iLen + 1 + ( pWord - m_pWords.Begin() )<=iArenaSize );
-		tReader.GetBytes ( pWord, iLen );
-		pWord[iLen] = '\0';
-		pWord += iLen+1;
+		BYTE * pWord = m_pWords.Begin();
+		ARRAY_FOREACH ( i, m_dCheckpoints )
+		{
+			m_dCheckpoints[i].m_sWord = (char *)pWord;
+
+			const int iLen = tReader.GetDword();
+			assert ( iLen>0 );
+			assert ( iLen + 1 + ( pWord - m_pWords.Begin() )<=iArenaSize );
+			tReader.GetBytes ( pWord, iLen );
+			pWord[iLen] = '\0';
+			pWord += iLen+1;
 
-		m_dCheckpoints[i].m_iWordlistOffset = tReader.GetOffset();
+			m_dCheckpoints[i].m_iWordlistOffset = tReader.GetOffset();
+		}
 	}
 
 	////////////////////////
@@ -30225,6 +32751,14 @@ bool CWordlist::Preread ( const char * sName, DWORD uVersion, bool bWordDict, CS
 	if ( !m_tBuf.Setup ( sName, sError, false ) )
 		return false;
 
+	// keywords FST lives in the same map
+	if ( m_iFstOffset && !m_tFst.Setup ( m_tBuf.GetWritePtr() + m_iFstOffset, m_tBuf.GetWritePtr() + m_tBuf.GetLengthBytes(), sError ) )
+		return false;
+
+	// and so do infix trigrams
+	if ( m_iTrigramsOffset && !m_tTrigrams.Setup ( m_tBuf.GetWritePtr() + m_iTrigramsOffset, m_tBuf.GetWritePtr() + m_tBuf.GetLengthBytes(), sError ) )
+		return false;
+
 	return true;
 }
 
@@ -30538,6 +33072,17 @@ struct DictEntryDiskPayload_t
 
 			pPayload->m_iTotalDocs = iTotalDocs;
 			pPayload->m_iTotalHits = iTotalHits;
+
+			// doclists are immutable, so their locations (and the stats) identify merged postings
+			uint64_t uKey = SPH_FNV64_SEED;
+			ARRAY_FOREACH ( i, pPayload->m_dDoclist )
+			{
+				uKey = sphFNV64 ( &pPayload->m_dDoclist[i].m_uOff, sizeof(pPayload->m_dDoclist[i].m_uOff), uKey );
+				uKey = sphFNV64 ( &pPayload->m_dDoclist[i].m_iLen, sizeof(pPayload->m_dDoclist[i].m_iLen), uKey );
+			}
+			uKey = sphFNV64 ( &iTotalDocs, sizeof(iTotalDocs), uKey );
+			pPayload->m_uCacheKey = sphFNV64 ( &iTotalHits, sizeof(iTotalHits), uKey );
+
 			tArgs.m_pPayload = pPayload;
 		}
 		tArgs.m_iTotalDocs = iTotalDocs;
@@ -30577,8 +33122,42 @@ void CWordlist::GetPrefixedWords ( const char * sSubstring, int iSubLen, const c
 	int dWildcard [ SPH_MAX_WORD_LEN + 1 ];
 	int * pWildcard = ( sphIsUTF8 ( sWildcard ) && sphUTF8ToWideChar ( sWildcard, dWildcard, SPH_MAX_WORD_LEN ) ) ? dWildcard : NULL;
 
-	const CSphWordlistCheckpoint * pCheckpoint = FindCheckpoint ( sSubstring, iSubLen, 0, true );
 	const int iSkipMagic = ( BYTE(*sSubstring)<0x20 ); // whether to skip heading magic chars in the prefix, like NONSTEMMED maker
+
+	// keywords FST gives exact range of the prefixed keywords, no need to compare them
+	if ( !m_tFst.IsEmpty() )
+	{
+		int iFirst, iCount;
+		if ( m_tFst.FindPrefix ( (const BYTE *)sSubstring, iSubLen, iFirst, iCount ) )
+		{
+			const CSphWordlistCheckpoint * pCheckpoint = m_dCheckpoints.Begin() + iFirst / SPH_WORDLIST_CHECKPOINT;
+			KeywordsBlockReader_c tDictReader ( AcquireDict ( pCheckpoint ), m_bHaveSkips );
+			for ( int i=iFirst % SPH_WORDLIST_CHECKPOINT; i>0; i-- )
+				tDictReader.UnpackWord();
+
+			for ( int i=0; i<iCount; i++ )
+			{
+				if ( !tDictReader.UnpackWord() )
+				{
+					pCheckpoint++;
+					assert ( pCheckpoint<=&m_dCheckpoints.Last() );
+					tDictReader.Reset ( AcquireDict ( pCheckpoint ) );
+					tDictReader.UnpackWord();
+				}
+
+				if ( sphWildcardMatch ( (const char *)tDictReader.m_sKeyword + iSkipMagic, sWildcard, pWildcard ) )
+					tDict2Payload.Add ( tDictReader, tDictReader.GetWordLen() );
+
+				if ( ( i & 1023 )==0 && sphInterrupted() )
+					break;
+			}
+		}
+
+		tDict2Payload.Convert ( tArgs );
+		return;
+	}
+
+	const CSphWordlistCheckpoint * pCheckpoint = FindCheckpoint ( sSubstring, iSubLen, 0, true );
 	while ( pCheckpoint )
 	{
 		// decode wordlist chunk
@@ -30720,6 +33299,84 @@ int sphGetInfixLength ( const char * sInfix, int iBytes, int iInfixCodepointByte
 }
 
 
+// unpacks keyword entries by ascending ordinals, adds the ones that match the wildcard
+// (or all of them, if there's no wildcard) to the payload, and collects the matched ordinals
+static void ExpandInfixOrdinals ( const CWordlist & tWordlist, const CSphVector<int> & dOrdinals, const char * sWildcard, bool bHasMorphology,
+	DictEntryDiskPayload_t & tPayload, CSphVector<int> * pMatched )
+{
+	const int iSkipMagic = ( bHasMorphology ? 1 : 0 ); // whether to skip heading magic chars in the prefix, like NONSTEMMED maker
+
+	int dWildcard [ SPH_MAX_WORD_LEN + 1 ];
+	int * pWildcard = ( sWildcard && sphIsUTF8 ( sWildcard ) && sphUTF8ToWideChar ( sWildcard, dWildcard, SPH_MAX_WORD_LEN ) ) ? dWildcard : NULL;
+
+	int i = 0;
+	while ( i<dOrdinals.GetLength() && !sphInterrupted() )
+	{
+		const int iBlock = dOrdinals[i] / SPH_WORDLIST_CHECKPOINT;
+		if ( iBlock>=tWordlist.m_dCheckpoints.GetLength() )
+			break;
+
+		KeywordsBlockReader_c tDictReader ( tWordlist.m_tBuf.GetWritePtr() + tWordlist.m_dCheckpoints[iBlock].m_iWordlistOffset, tWordlist.m_bHaveSkips );
+		int iOrdinal = iBlock * SPH_WORDLIST_CHECKPOINT;
+		while ( i<dOrdinals.GetLength() && dOrdinals[i]/SPH_WORDLIST_CHECKPOINT==iBlock && tDictReader.UnpackWord() )
+		{
+			if ( iOrdinal++!=dOrdinals[i] )
+				continue;
+			i++;
+
+			if ( sWildcard )
+			{
+				// stemmed terms should not match suffixes
+				if ( bHasMorphology && *tDictReader.m_sKeyword!=MAGIC_WORD_HEAD_NONSTEMMED )
+					continue;
+
+				if ( !sphWildcardMatch ( (const char *)tDictReader.m_sKeyword+iSkipMagic, sWildcard, pWildcard ) )
+					continue;
+			}
+
+			tPayload.Add ( tDictReader, tDictReader.GetWordLen() );
+			if ( pMatched )
+				pMatched->Add ( iOrdinal-1 );
+		}
+
+		// block ended early; should not happen
+		while ( i<dOrdinals.GetLength() && dOrdinals[i]/SPH_WORDLIST_CHECKPOINT==iBlock )
+			i++;
+	}
+}
+
+
+bool CWordlist::GetCachedInfix ( const CSphString & sKey, CSphVector<int> & dOrdinals ) const
+{
+	CSphScopedLock<CSphMutex> tLock ( m_tInfixCacheLock );
+	const CSphVector<int> * pCached = m_hInfixCache ( sKey );
+	if ( !pCached )
+		return false;
+
+	dOrdinals = *pCached;
+	return true;
+}
+
+
+void CWordlist::CacheInfix ( const CSphString & sKey, const CSphVector<int> & dOrdinals ) const
+{
+	// too wide expansions would just flush everything else
+	int iCost = dOrdinals.GetLength()+1;
+	if ( iCost>INFIX_CACHE_ORDINALS/16 )
+		return;
+
+	CSphScopedLock<CSphMutex> tLock ( m_tInfixCacheLock );
+	if ( m_iInfixCacheOrdinals+iCost>INFIX_CACHE_ORDINALS )
+	{
+		m_hInfixCache.Reset();
+		m_iInfixCacheOrdinals = 0;
+	}
+
+	if ( m_hInfixCache.Add ( dOrdinals, sKey ) )
+		m_iInfixCacheOrdinals += iCost;
+}
+
+
 void CWordlist::GetInfixedWords ( const char * sSubstring, int iSubLen, const char * sWildcard, Args_t & tArgs ) const
 {
 	// dict must be of keywords type, and fully cached
@@ -30729,43 +33386,73 @@ void CWordlist::GetInfixedWords ( const char * sSubstring, int iSubLen, const ch
 
 	assert ( !m_tMapedCpReader.Ptr() );
 
-	// extract key1, upto 6 chars from infix start
-	int iBytes1 = sphGetInfixLength ( sSubstring, iSubLen, m_iInfixCodepointBytes );
+	DictEntryDiskPayload_t tDict2Payload ( tArgs.m_bPayload, tArgs.m_eHitless );
 
-	// lookup key1
-	// OPTIMIZE? maybe lookup key2 and reduce checkpoint set size, if possible?
-	CSphVector<DWORD> dPoints;
-	if ( !sphLookupInfixCheckpoints ( sSubstring, iBytes1, m_tBuf.GetWritePtr(), m_dInfixBlocks, m_iInfixCodepointBytes, dPoints ) )
-		return;
+	// matched keywords only depend on the wildcard (and morphology), so repeated expansions
+	// just unpack the cached entries
+	CSphString sCacheKey;
+	sCacheKey.SetSprintf ( "%d%s", tArgs.m_bHasMorphology ? 1 : 0, sWildcard );
 
-	DictEntryDiskPayload_t tDict2Payload ( tArgs.m_bPayload, tArgs.m_eHitless );
-	const int iSkipMagic = ( tArgs.m_bHasMorphology ? 1 : 0 ); // whether to skip heading magic chars in the prefix, like NONSTEMMED maker
+	CSphVector<int> dOrdinals;
+	if ( GetCachedInfix ( sCacheKey, dOrdinals ) )
+	{
+		ExpandInfixOrdinals ( *this, dOrdinals, NULL, false, tDict2Payload, NULL );
+		tDict2Payload.Convert ( tArgs );
+		return;
+	}
 
-	int dWildcard [ SPH_MAX_WORD_LEN + 1 ];
-	int * pWildcard = ( sphIsUTF8 ( sWildcard ) && sphUTF8ToWideChar ( sWildcard, dWildcard, SPH_MAX_WORD_LEN ) ) ? dWildcard : NULL;
+	CSphVector<int> dMatched;
+	if ( m_tTrigrams.GetCandidates ( sWildcard, dOrdinals ) )
+	{
+		// trigram postings intersection gives the candidate keywords, check just those
+		ExpandInfixOrdinals ( *this, dOrdinals, sWildcard, tArgs.m_bHasMorphology, tDict2Payload, &dMatched );
 
-	// walk those checkpoints, check all their words
-	ARRAY_FOREACH ( i, dPoints )
+	} else
 	{
-		// OPTIMIZE? add a quicker path than a generic wildcard for "*infix*" case?
-		KeywordsBlockReader_c tDictReader ( m_tBuf.GetWritePtr() + m_dCheckpoints[dPoints[i]-1].m_iWordlistOffset, m_bHaveSkips );
-		while ( tDictReader.UnpackWord() )
+		// extract key1, upto 6 chars from infix start
+		int iBytes1 = sphGetInfixLength ( sSubstring, iSubLen, m_iInfixCodepointBytes );
+
+		// lookup key1
+		// OPTIMIZE? maybe lookup key2 and reduce checkpoint set size, if possible?
+		CSphVector<DWORD> dPoints;
+		sphLookupInfixCheckpoints ( sSubstring, iBytes1, m_tBuf.GetWritePtr(), m_dInfixBlocks, m_iInfixCodepointBytes, dPoints );
+
+		const int iSkipMagic = ( tArgs.m_bHasMorphology ? 1 : 0 ); // whether to skip heading magic chars in the prefix, like NONSTEMMED maker
+
+		int dWildcard [ SPH_MAX_WORD_LEN + 1 ];
+		int * pWildcard = ( sphIsUTF8 ( sWildcard ) && sphUTF8ToWideChar ( sWildcard, dWildcard, SPH_MAX_WORD_LEN ) ) ? dWildcard : NULL;
+
+		// walk those checkpoints, check all their words
+		ARRAY_FOREACH ( i, dPoints )
 		{
-			if ( sphInterrupted () )
-				break;
+			// OPTIMIZE? add a quicker path than a generic wildcard for "*infix*" case?
+			KeywordsBlockReader_c tDictReader ( m_tBuf.GetWritePtr() + m_dCheckpoints[dPoints[i]-1].m_iWordlistOffset, m_bHaveSkips );
+			int iOrdinal = ( dPoints[i]-1 ) * SPH_WORDLIST_CHECKPOINT;
+			for ( ; tDictReader.UnpackWord(); iOrdinal++ )
+			{
+				if ( sphInterrupted () )
+					break;
 
-			// stemmed terms should not match suffixes
-			if ( tArgs.m_bHasMorphology && *tDictReader.m_sKeyword!=MAGIC_WORD_HEAD_NONSTEMMED )
-				continue;
+				// stemmed terms should not match suffixes
+				if ( tArgs.m_bHasMorphology && *tDictReader.m_sKeyword!=MAGIC_WORD_HEAD_NONSTEMMED )
+					continue;
 
-			if ( sphWildcardMatch ( (const char *)tDictReader.m_sKeyword+iSkipMagic, sWildcard, pWildcard ) )
-				tDict2Payload.Add ( tDictReader, tDictReader.GetWordLen() );
-		}
+				if ( sphWildcardMatch ( (const char *)tDictReader.m_sKeyword+iSkipMagic, sWildcard, pWildcard ) )
+				{
+					tDict2Payload.Add ( tDictReader, tDictReader.GetWordLen() );
+					dMatched.Add ( iOrdinal );
+				}
+			}
 
-		if ( sphInterrupted () )
-			break;
+			if ( sphInterrupted () )
+				break;
+		}
+		dMatched.Uniq();
 	}
 
+	if ( !sphInterrupted() )
+		CacheInfix ( sCacheKey, dMatched );
+
 	tDict2Payload.Convert ( tArgs );
 }
 
@@ -31230,6 +33917,54 @@ void SuggestMatchWords ( const ISphWordlistSuggest * pWordlist, const CSphVector
 }
 
 
+void CWordlist::GetFuzzyWords ( const SuggestArgs_t & tArgs, SuggestResult_t & tRes ) const
+{
+	CSphVector<KeywordsFst_c::FuzzyMatch_t> dMatches;
+	CSphVector<BYTE> dWords;
+	m_tFst.FuzzyWords ( tArgs, tRes, dMatches, dWords );
+	if ( !dMatches.GetLength() || sphInterrupted() )
+		return;
+
+	// matches come in dictionary order, so fetch their stats block by block
+	KeywordsBlockReader_c tReader ( NULL, m_bHaveSkips );
+	int iBlock = -1;
+	int iPos = 0;
+	tRes.m_dMatched.Reserve ( tRes.m_dMatched.GetLength() + dMatches.GetLength() );
+	ARRAY_FOREACH ( i, dMatches )
+	{
+		const KeywordsFst_c::FuzzyMatch_t & tMatch = dMatches[i];
+		int iMatchBlock = tMatch.m_iOrdinal / SPH_WORDLIST_CHECKPOINT;
+		int iMatchPos = tMatch.m_iOrdinal % SPH_WORDLIST_CHECKPOINT;
+		if ( iMatchBlock!=iBlock )
+		{
+			iBlock = iMatchBlock;
+			iPos = 0;
+			tReader.Reset ( AcquireDict ( m_dCheckpoints.Begin() + iBlock ) );
+		}
+		for ( ; iPos<=iMatchPos; iPos++ )
+			tReader.UnpackWord();
+
+		const BYTE * sWord = dWords.Begin() + tMatch.m_iWordOff;
+		SuggestWord_t & tElem = tRes.m_dMatched.Add();
+		tElem.m_iNameOff = tRes.m_dBuf.GetLength();
+		tElem.m_iLen = tMatch.m_iWordLen;
+		tElem.m_iDistance = tMatch.m_iDistance;
+		tElem.m_iDocs = tReader.m_iDocs;
+		if ( tRes.m_bMergeWords )
+			tElem.m_iNameHash = sphCRC32 ( sWord, tMatch.m_iWordLen );
+
+		BYTE * pDst = tRes.m_dBuf.AddN ( tMatch.m_iWordLen+1 );
+		memcpy ( pDst, sWord, tMatch.m_iWordLen );
+		pDst[tMatch.m_iWordLen] = '\0';
+	}
+
+	if ( tRes.m_bMergeWords )
+		SuggestMergeDocs ( tRes.m_dMatched );
+	tRes.m_dMatched.Sort ( CmpSuggestOrder_fn() );
+	tRes.Flattern ( tArgs.m_iLimit );
+}
+
+
 void sphGetSuggest ( const ISphWordlistSuggest * pWordlist, int iInfixCodepointBytes, const SuggestArgs_t & tArgs, SuggestResult_t & tRes )
 {
 	assert ( pWordlist );
@@ -31312,6 +34047,7 @@ CSphQueryResultMeta::CSphQueryResultMeta ()
 	, m_iAgentFetchedSkips ( 0 )
 	, m_bHasPrediction ( false )
 	, m_iBadRows ( 0 )
+	, m_iUnscannedRows ( 0 )
 {
 }
 
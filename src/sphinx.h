@@ -306,6 +306,48 @@ private:
 };
 
 
+/// initialize per-query match arenas
+bool			sphInitMatchArena ();
+
+/// clean up per-query match arenas
+void			sphDoneMatchArena ();
+
+struct MatchArenaChunk_t;
+
+/// per-query arena for match dynamic rows
+/// while an arena is active, the thread bump-allocates match rows from its chunks instead of the heap
+/// chunks are refcounted by their rows, so matches can safely outlive the arena (and move to other threads);
+/// a chunk is freed in bulk once the arena is stopped and its last row is freed
+class CSphMatchArena : public ISphNoncopyable
+{
+public:
+						CSphMatchArena ();
+						~CSphMatchArena ();
+
+	/// make this arena current for the thread, unless there already is an outer one
+	void				Start();
+	void				Stop();
+
+	CSphRowitem *		Alloc ( int iDynamic );
+
+private:
+	bool				m_bEnabled;
+	CSphMatchArena *	m_pPrev;
+	MatchArenaChunk_t *	m_pChunk;		///< current chunk
+	int					m_iChunkItems;	///< current chunk size, in rowitems
+	int					m_iUsed;		///< rowitems used in current chunk
+	int					m_iRows;		///< rows allocated from current chunk
+
+	void				Retire();
+};
+
+/// allocate match dynamic row, from the current thread arena if any, or from the heap
+CSphRowitem *	sphAllocMatchRow ( int iDynamic );
+
+/// free match dynamic row
+void			sphFreeMatchRow ( CSphRowitem * pRow );
+
+
 //////////////////////////////////////////////////////////////////////////
 
 #if UNALIGNED_RAM_ACCESS
@@ -442,6 +484,15 @@ public:
 
 	int GetMaxCodepointLength () const;
 
+	/// length of the leading run of plain (flagless, ascii-to-ascii) word chars at pSrc
+	int			GetAsciiRun ( const BYTE * pSrc, const BYTE * pMax ) const;
+
+	/// fold a run previously measured by GetAsciiRun() into pDst
+	void		FoldAsciiRun ( BYTE * pDst, const BYTE * pSrc, int iLen ) const;
+
+	/// rebuild ascii fast path tables from chunk 0
+	void		UpdateAsciiTables ();
+
 protected:
 	static const int	CHUNK_COUNT	= 0x300;
 	static const int	CHUNK_BITS	= 8;
@@ -453,6 +504,10 @@ protected:
 	int					m_iChunks;					///< how much chunks are actually allocated
 	int *				m_pData;					///< chunks themselves
 	int *				m_pChunk [ CHUNK_COUNT ];	///< pointers to non-empty chunks
+
+	BYTE				m_dAsciiFold [ 128 ];		///< folded plain ascii chars, 0 for anything else (separators, specials, flagged or non-ascii remaps)
+	BYTE				m_dAsciiClass [ 16 ];		///< same set as a low-nibble to high-nibble bitmask, for vectorized classification
+	bool				m_bAsciiCaseOnly;			///< plain ascii folding is either identity or A..Z->a..z
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1309,11 +1364,8 @@ public:
 	/// dtor. frees everything
 	~CSphMatch ()
 	{
-#ifndef NDEBUG
 		if ( m_pDynamic )
-			m_pDynamic--;
-#endif
-		SafeDeleteArray ( m_pDynamic );
+			sphFreeMatchRow ( m_pDynamic );
 	}
 
 	/// reset
@@ -1326,12 +1378,7 @@ public:
 		m_uDocID = 0;
 		if ( !m_pDynamic && iDynamic )
 		{
-#ifndef NDEBUG
-			m_pDynamic = new CSphRowitem [ iDynamic+1 ];
-			*m_pDynamic++ = iDynamic;
-#else
-			m_pDynamic = new CSphRowitem [ iDynamic ];
-#endif
+			m_pDynamic = sphAllocMatchRow ( iDynamic );
 			// dynamic stuff might contain pointers now (STRINGPTR type)
 			// so we gotta cleanup
 			memset ( m_pDynamic, 0, iDynamic*sizeof(CSphRowitem) );
@@ -1357,14 +1404,7 @@ private:
 		if ( iDynamic )
 		{
 			if ( !m_pDynamic )
-			{
-#ifndef NDEBUG
-				m_pDynamic = new CSphRowitem [ iDynamic+1 ];
-				*m_pDynamic++ = iDynamic;
-#else
-				m_pDynamic = new CSphRowitem [ iDynamic ];
-#endif
-			}
+				m_pDynamic = sphAllocMatchRow ( iDynamic );
 
 			if ( this!=&rhs )
 			{
@@ -1519,6 +1559,7 @@ struct CSphColumnInfo
 	bool							m_bPayload;
 	bool							m_bFilename;	///< column is a file name
 	bool							m_bWeight;		///< is a weight column
+	DWORD							m_uStringDict;	///< string dictionary table offset in .sps (0 if the string is stored verbatim)
 
 	WORD							m_uNext;		///< next in linked list for hash in CSphSchema
 
@@ -2679,6 +2720,7 @@ public:
 	bool			m_bNormalizedTFIDF;	///< whether to scale IDFs by query word count, so that TF*IDF is normalized
 	bool			m_bLocalDF;			///< whether to use calculate DF among local indexes
 	bool			m_bLowPriority;		///< set low thread priority for this query
+	bool			m_bPackedReply;		///< master accepts compressed agent reply
 	DWORD			m_uDebugFlags;
 
 	CSphVector<CSphFilterSettings>	m_dFilters;	///< filters
@@ -2707,6 +2749,8 @@ public:
 	DWORD			m_uMaxQueryMsec;	///< max local index search time, in milliseconds (default is 0; means no limit)
 	int				m_iMaxPredictedMsec; ///< max predicted (!) search time limit, in milliseconds (0 means no limit)
 	CSphString		m_sComment;			///< comment to pass verbatim in the log file
+	CSphString		m_sSearchAfter;		///< sort key values of the last row of the previous page (comma separated), if any
+	bool			m_bSearchAfter;		///< whether search_after was given at all (an empty one asks for the first page cursor)
 
 	CSphVector<CSphAttrOverride>	m_dOverrides;	///< per-query attribute value overrides
 
@@ -2806,6 +2850,8 @@ public:
 	CSphString				m_sError;			///< error message
 	CSphString				m_sWarning;			///< warning message
 	int64_t					m_iBadRows;
+	int64_t					m_iUnscannedRows;	///< rows an ordered fullscan stopped before, so total_found misses any matches among them
+	CSphString				m_sNextSearchAfter;	///< search_after cursor for the next page, if asked for
 
 	CSphQueryResultMeta ();													///< ctor
 	virtual					~CSphQueryResultMeta () {}						///< dtor
@@ -2988,8 +3034,11 @@ struct CSphMatchComparatorState
 	ISphExpr *			m_tSubExpr[MAX_ATTRS];		///< sort-by attr expression
 	ESphAttr			m_tSubType[MAX_ATTRS];		///< sort-by expression type
 	int					m_dAttrs[MAX_ATTRS];		///< sort-by attr index
+	CSphAttrLocator		m_tKeyLocator[MAX_ATTRS];	///< sort-by string collation key locator
 
 	DWORD				m_uAttrDesc;				///< sort order mask (if i-th bit is set, i-th attr order is DESC)
+	DWORD				m_uStringRanks;				///< dictionary rank mask (if i-th bit is set, i-th string attr compares by its dictionary rank)
+	DWORD				m_uStringKeys;				///< collation key mask (if i-th bit is set, i-th string attr compares by its key prefix first)
 	DWORD				m_iNow;						///< timestamp (for timesegments sorting mode)
 	SphStringCmp_fn		m_fnStrCmp;					///< string comparator
 
@@ -2997,6 +3046,8 @@ struct CSphMatchComparatorState
 	/// create default empty state
 	CSphMatchComparatorState ()
 		: m_uAttrDesc ( 0 )
+		, m_uStringRanks ( 0 )
+		, m_uStringKeys ( 0 )
 		, m_iNow ( 0 )
 		, m_fnStrCmp ( NULL )
 	{
@@ -3032,6 +3083,23 @@ struct CSphMatchComparatorState
 				return -1;
 			return 1;
 		}
+
+		// dictionary encoded strings keep their collation rank right before the packed length
+		if ( m_uStringRanks & ( 1<<iAttr ) )
+		{
+			DWORD uRankA = sphGetDword ( aa-4 );
+			DWORD uRankB = sphGetDword ( bb-4 );
+			return uRankA<uRankB ? -1 : ( uRankA>uRankB ? 1 : 0 );
+		}
+
+		// collation keys only decide when they differ; zero means the match got no key
+		if ( m_uStringKeys & ( 1<<iAttr ) )
+		{
+			uint64_t uKeyA = a.GetAttr ( m_tKeyLocator[iAttr] );
+			uint64_t uKeyB = b.GetAttr ( m_tKeyLocator[iAttr] );
+			if ( uKeyA && uKeyB && uKeyA!=uKeyB )
+				return uKeyA<uKeyB ? -1 : 1;
+		}
 		return m_fnStrCmp ( aa, bb, ( m_eKeypart[iAttr]==SPH_KEYPART_STRING ) );
 	}
 };
@@ -3045,6 +3113,34 @@ struct ISphMatchProcessor
 };
 
 
+/// lowest weight that still can make the top-N of a query searched over several local indexes
+/// sorters of each index publish the worst weight of their full queue; any match below that
+/// can not make the final result set, provided that docids do not repeat across the indexes
+struct SharedTopWeight_t : public ISphNoncopyable
+{
+	CSphAtomic		m_iWeight;
+
+	SharedTopWeight_t () : m_iWeight ( INT_MIN ) {}
+
+	int GetWeight () const
+	{
+		return (int)m_iWeight.GetValue();
+	}
+
+	/// raise the threshold (never lower it)
+	void Publish ( int iWeight )
+	{
+		for ( long iOld = m_iWeight.GetValue(); iOld<iWeight; )
+		{
+			long iSeen = m_iWeight.CAS ( iOld, iWeight );
+			if ( iSeen==iOld )
+				break;
+			iOld = iSeen;
+		}
+	}
+};
+
+
 /// generic match sorter interface
 class ISphMatchSorter
 {
@@ -3125,6 +3221,15 @@ public:
 
 	/// get a pointer to the worst element, NULL if there is no fixed location
 	virtual const CSphMatch *	GetWorst() const { return NULL; }
+
+	/// check if result sets ordered by this sorter can be merged using IsBetter() instead of pushing them
+	virtual bool		CanMergeSorted () const { return false; }
+
+	/// check if a goes before b in the result set (only for sorters that CanMergeSorted)
+	virtual bool		IsBetter ( const CSphMatch &, const CSphMatch & ) const { return false; }
+
+	/// share top-N weight threshold with the sorters of other local indexes (only for sorters with weight desc as the first key)
+	virtual void		SetSharedTopWeight ( SharedTopWeight_t * ) {}
 };
 
 
@@ -3182,6 +3287,12 @@ struct CSphIndexSettings : public CSphSourceSettings
 	CSphString		m_sRLPContext;			///< path to RLP context file
 
 	CSphString		m_sIndexTokenFilter;	///< indexing time token filter spec string (pretty useless for disk, vital for RT)
+	bool			m_bDictFst;				///< whether to build keywords FST (dict=keywords only)
+	bool			m_bInfixTrigrams;		///< whether to build trigram to keyword index for infix expansion (dict=keywords only)
+	CSphVector<CSphString>	m_dStringDict;	///< string attributes to dictionary encode at indexing time (plain indexes only)
+	CSphString		m_sGeoLat;				///< latitude attribute of the load time geo grid (empty means no grid)
+	CSphString		m_sGeoLon;				///< longitude attribute of the load time geo grid
+	CSphString		m_sSortByAttr;			///< attribute to keep a load time scan order by (empty means docid order only)
 
 					CSphIndexSettings ();
 };
@@ -3283,6 +3394,7 @@ public:
 	virtual SphDocID_t *		GetKillList () const = 0;
 	virtual int					GetKillListSize () const = 0;
 	virtual bool				HasDocid ( SphDocID_t uDocid ) const = 0;
+	virtual bool				GetDocidRange ( SphDocID_t & , SphDocID_t & ) const { return false; }	///< min and max docid stored (killed ones included); false if unknown or empty
 	virtual bool				IsRT() const { return false; }
 	void						SetBinlog ( bool bBinlog ) { m_bBinlog = bBinlog; }
 	virtual int64_t *			GetFieldLens() const { return NULL; }
@@ -3364,6 +3476,9 @@ public:
 	/// internal debugging hook, DO NOT USE
 	virtual void				DebugDumpDict ( FILE * fp ) = 0;
 
+	/// internal debugging hook, DO NOT USE
+	virtual void				DebugEstimateReorder ( FILE * fp, const char * sAttr ) = 0;
+
 	/// internal debugging hook, DO NOT USE
 	virtual int					DebugCheck ( FILE * fp ) = 0;
 	virtual void				SetDebugCheck () {}
@@ -3464,6 +3579,8 @@ struct SphQueueSettings_t : public ISphNoncopyable
 	DWORD						m_uPackedFactorFlags;
 	ISphExprHook *				m_pHook;
 	const CSphFilterSettings *	m_pAggrFilter;
+	SharedTopWeight_t *			m_pTopWeight;
+	bool						m_bStringDicts;	///< all the matches come from the index that owns the schema, so dictionary encoded strings may compare by rank
 
 	SphQueueSettings_t ( const CSphQuery & tQuery, const ISphSchema & tSchema, CSphString & sError, CSphQueryProfile * pProfiler )
 		: m_tQuery ( tQuery )
@@ -3478,6 +3595,8 @@ struct SphQueueSettings_t : public ISphNoncopyable
 		, m_uPackedFactorFlags ( SPH_FACTOR_DISABLE )
 		, m_pHook ( NULL )
 		, m_pAggrFilter ( NULL )
+		, m_pTopWeight ( NULL )
+		, m_bStringDicts ( false )
 	{ }
 };
 
@@ -3493,7 +3612,8 @@ CSphIndex *			sphCreateIndexTemplate ( );
 /// bStrict is whether to stop indexing on error, or just ignore the attribute value
 /// bAutoconvNumbers is whether to auto-convert eligible (!) strings to integers and floats, or keep them as strings
 /// bKeynamesToLowercase is whether to convert all key names to lowercase
-void				sphSetJsonOptions ( bool bStrict, bool bAutoconvNumbers, bool bKeynamesToLowercase );
+/// iKeyDirectory is the minimum object size (in keys) to store a key directory for, 0 means never
+void				sphSetJsonOptions ( bool bStrict, bool bAutoconvNumbers, bool bKeynamesToLowercase, int iKeyDirectory );
 
 /// parses sort clause, using a given schema
 /// fills eFunc and tState and optionally sError, returns result code
@@ -1770,6 +1770,8 @@ struct Expr_MinTopWeight : public ISphExpr
 	virtual void Command ( ESphExprCommand eCmd, void * pArg )
 	{
 		CSphMatch * pWorst;
+		if ( eCmd==SPH_EXPR_GET_MIN_TOP )
+			*(bool*)pArg = true;
 		if ( eCmd!=SPH_EXPR_SET_EXTRA_DATA )
 			return;
 		if ( static_cast<ISphExtra*>(pArg)->ExtraData ( EXTRA_GET_QUEUE_WORST, (void**)&pWorst ) )
@@ -1802,6 +1804,8 @@ struct Expr_MinTopSortval : public ISphExpr
 
 	virtual void Command ( ESphExprCommand eCmd, void * pArg )
 	{
+		if ( eCmd==SPH_EXPR_GET_MIN_TOP )
+			*(bool*)pArg = true;
 		if ( eCmd!=SPH_EXPR_SET_EXTRA_DATA )
 			return;
 		ISphExtra * p = (ISphExtra*)pArg;
@@ -2672,6 +2676,7 @@ private:
 
 	bool					CheckForConstSet ( int iArgsNode, int iSkip );
 	int						ParseAttr ( int iAttr, const char* sTok, YYSTYPE * lvalp );
+	int						ParseJsonExtracted ( const CSphString & sColumn, YYSTYPE * lvalp );
 
 	template < typename T >
 	void					WalkTree ( int iRoot, T & FUNCTOR );
@@ -2788,6 +2793,36 @@ int ExprParser_t::ParseAttr ( int iAttr, const char* sTok, YYSTYPE * lvalp )
 }
 
 
+/// check whether jsoncol.key.path at the cursor maps to an extracted typed column
+/// consumes the path and returns attr token if it does, returns 0 otherwise
+int ExprParser_t::ParseJsonExtracted ( const CSphString & sColumn, YYSTYPE * lvalp )
+{
+	const char * p = m_pCur;
+	while ( p[0]=='.' && sphIsAttr ( p[1] ) && !isdigit ( p[1] ) )
+	{
+		p++;
+		while ( sphIsAttr ( *p ) )
+			p++;
+	}
+
+	// subscripts, deeper numeric keys, and IS [NOT] NULL checks still need the raw JSON value
+	const char * pNext = p;
+	while ( isspace ( *pNext ) )
+		pNext++;
+	if ( p==m_pCur || *pNext=='[' || *pNext=='.' || ( !strncasecmp ( pNext, "is", 2 ) && !sphIsAttr ( pNext[2] ) ) )
+		return 0;
+
+	CSphString sName;
+	sName.SetSprintf ( "%s%.*s", sColumn.cstr(), int ( p-m_pCur ), m_pCur );
+	int iAttr = m_pSchema->GetAttrIndex ( sName.cstr() );
+	if ( iAttr<0 )
+		return 0;
+
+	m_pCur = p;
+	return ParseAttr ( iAttr, sName.cstr(), lvalp );
+}
+
+
 /// a lexer of my own
 /// returns token id and fills lvalp on success
 /// returns -1 and fills sError on failure
@@ -2865,7 +2900,16 @@ int ExprParser_t::GetToken ( YYSTYPE * lvalp )
 		// check for attribute
 		int iAttr = m_pSchema->GetAttrIndex ( sTok.cstr() );
 		if ( iAttr>=0 )
+		{
+			// plain jsoncol.key.path might be backed by a typed column extracted at insert time
+			if ( *m_pCur=='.' && m_pSchema->GetAttr(iAttr).m_eAttrType==SPH_ATTR_JSON )
+			{
+				int iExtracted = ParseJsonExtracted ( sTok, lvalp );
+				if ( iExtracted )
+					return iExtracted;
+			}
 			return ParseAttr ( iAttr, sTok.cstr(), lvalp );
+		}
 
 		// hook might replace built-in function
 		int iHookFunc = -1;
@@ -5569,9 +5613,10 @@ static float Geodist ( GeoFunc_e eFunc, bool bDeg, float lat1, float lon1, float
 class Expr_GeodistAttrConst_c : public ISphExpr
 {
 public:
-	Expr_GeodistAttrConst_c ( Geofunc_fn pFunc, float fOut, CSphAttrLocator tLat, CSphAttrLocator tLon, float fAnchorLat, float fAnchorLon, int iLat, int iLon )
+	Expr_GeodistAttrConst_c ( Geofunc_fn pFunc, float fOut, bool bDeg, CSphAttrLocator tLat, CSphAttrLocator tLon, float fAnchorLat, float fAnchorLon, int iLat, int iLon )
 		: m_pFunc ( pFunc )
 		, m_fOut ( fOut )
+		, m_bDeg ( bDeg )
 		, m_tLat ( tLat )
 		, m_tLon ( tLon )
 		, m_fAnchorLat ( fAnchorLat )
@@ -5592,6 +5637,18 @@ public:
 			static_cast < CSphVector<int>* > ( pArg )->Add ( m_iLat );
 			static_cast < CSphVector<int>* > ( pArg )->Add ( m_iLon );
 		}
+
+		if ( eCmd==SPH_EXPR_GET_GEODIST_SETTINGS )
+		{
+			GeodistSettings_t & tSettings = *static_cast<GeodistSettings_t*> ( pArg );
+			tSettings.m_pExpr = this;
+			tSettings.m_iLat = m_iLat;
+			tSettings.m_iLon = m_iLon;
+			tSettings.m_fAnchorLat = m_fAnchorLat;
+			tSettings.m_fAnchorLon = m_fAnchorLon;
+			tSettings.m_fOut = m_fOut;
+			tSettings.m_bDeg = m_bDeg;
+		}
 	}
 
 	virtual uint64_t GetHash ( const ISphSchema & tSorterSchema, uint64_t uPrevHash, bool & bDisable )
@@ -5607,6 +5664,7 @@ public:
 private:
 	Geofunc_fn		m_pFunc;
 	float			m_fOut;
+	bool			m_bDeg;
 	CSphAttrLocator	m_tLat;
 	CSphAttrLocator	m_tLon;
 	float			m_fAnchorLat;
@@ -6049,7 +6107,7 @@ ISphExpr * ExprParser_t::CreateGeodistNode ( int iArgs )
 		if ( m_dNodes[dArgs[0]].m_iToken==TOK_ATTR_FLOAT && m_dNodes[dArgs[1]].m_iToken==TOK_ATTR_FLOAT )
 		{
 			// attr point
-			return new Expr_GeodistAttrConst_c ( GeodistFn ( eMethod, bDeg ), fOut,
+			return new Expr_GeodistAttrConst_c ( GeodistFn ( eMethod, bDeg ), fOut, bDeg,
 				m_dNodes[dArgs[0]].m_tLocator, m_dNodes[dArgs[1]].m_tLocator,
 				FloatVal ( &m_dNodes[dArgs[2]] ), FloatVal ( &m_dNodes[dArgs[3]] ),
 				m_dNodes[dArgs[0]].m_iLocator, m_dNodes[dArgs[1]].m_iLocator );
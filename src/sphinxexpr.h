@@ -76,7 +76,9 @@ enum ESphExprCommand
 	SPH_EXPR_SET_STRING_POOL,
 	SPH_EXPR_SET_EXTRA_DATA,
 	SPH_EXPR_GET_DEPENDENT_COLS, ///< used to determine proper evaluating stage
-	SPH_EXPR_GET_UDF
+	SPH_EXPR_GET_UDF,
+	SPH_EXPR_GET_GEODIST_SETTINGS, ///< used to map geodist() filters and sorting to an index geo grid
+	SPH_EXPR_GET_MIN_TOP ///< used to keep min_top_weight() and min_top_sortval() on sorters that expose their worst match
 };
 
 /// expression evaluator
@@ -131,6 +133,28 @@ public:
 	virtual uint64_t GetHash ( const ISphSchema & tSorterSchema, uint64_t uPrevHash, bool & bDisable ) = 0;
 };
 
+/// geodist() over a pair of float attributes and a constant anchor, as reported by SPH_EXPR_GET_GEODIST_SETTINGS
+struct GeodistSettings_t
+{
+	const ISphExpr *	m_pExpr;		///< expression that reported these settings (to tell it apart from a wrapping one)
+	int					m_iLat;			///< latitude attribute index
+	int					m_iLon;			///< longitude attribute index
+	float				m_fAnchorLat;	///< anchor latitude, in argument units
+	float				m_fAnchorLon;	///< anchor longitude, in argument units
+	float				m_fOut;			///< meters to result units scale
+	bool				m_bDeg;			///< whether arguments are in degrees (radians otherwise)
+
+	GeodistSettings_t ()
+		: m_pExpr ( NULL )
+		, m_iLat ( -1 )
+		, m_iLon ( -1 )
+		, m_fAnchorLat ( 0.0f )
+		, m_fAnchorLon ( 0.0f )
+		, m_fOut ( 1.0f )
+		, m_bDeg ( false )
+	{}
+};
+
 /// string expression traits
 /// can never be evaluated in floats or integers, only StringEval() is allowed
 struct ISphStringExpr : public ISphExpr
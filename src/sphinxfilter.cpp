@@ -21,6 +21,14 @@
 #pragma warning(disable:4250) // inheritance via dominance is our intent
 #endif
 
+// sse2 is always there on x86-64, so the small value scan needs no runtime dispatch
+#if defined(__x86_64__) || defined(_M_X64)
+#define SPH_FILTER_SSE2 1
+#include <emmintrin.h>
+#else
+#define SPH_FILTER_SSE2 0
+#endif
+
 /// attribute-based
 struct IFilter_Attr: virtual ISphFilter
 {
@@ -32,11 +40,170 @@ struct IFilter_Attr: virtual ISphFilter
 	}
 };
 
+/// membership test over a sorted value list
+/// picks a representation by list size and density: a short array scanned at once,
+/// a bitmap over [min,max] for dense lists, or an open addressing hash for sparse ones
+class ValueSet_c
+{
+public:
+	static const int	SMALL_MAX = 16;			///< lists up to this size are scanned
+	static const int	BITS_PER_VALUE = 128;	///< bitmap is picked while it is no bigger than the hash (2 slots per value, 8 bytes per slot)
+	static const int	MAX_BITMAP_BITS = 1<<28;
+
+	ValueSet_c ()
+		: m_eKind ( SET_SMALL )
+		, m_iMin ( 0 )
+		, m_uRange ( 0 )
+		, m_iEmpty ( 0 )
+		, m_iShift ( 0 )
+		, m_dSmall ( 0 )
+		, m_dBits ( 0 )
+		, m_dHash ( 0 )
+	{}
+
+	void Setup ( const SphAttr_t * pValues, int iCount )
+	{
+		assert ( pValues && iCount>0 );
+
+		if ( iCount<=SMALL_MAX )
+		{
+			// pad up to a full vector, repeating the last value
+			m_eKind = SET_SMALL;
+			m_dSmall.Reset ( SMALL_MAX );
+			for ( int i=0; i<SMALL_MAX; i++ )
+				m_dSmall[i] = pValues [ Min ( i, iCount-1 ) ];
+			return;
+		}
+
+		m_iMin = pValues[0];
+		uint64_t uSpan = (uint64_t)pValues[iCount-1] - (uint64_t)m_iMin;
+		if ( uSpan<(uint64_t)MAX_BITMAP_BITS && uSpan<(uint64_t)iCount*BITS_PER_VALUE )
+		{
+			m_eKind = SET_BITMAP;
+			m_uRange = uSpan+1;
+			m_dBits.Reset ( (int)( ( m_uRange+63 )/64 ) );
+			memset ( m_dBits.Begin(), 0, m_dBits.GetSizeBytes() );
+			for ( int i=0; i<iCount; i++ )
+			{
+				uint64_t uOff = (uint64_t)pValues[i] - (uint64_t)m_iMin;
+				m_dBits [ (int)( uOff>>6 ) ] |= U64C(1) << ( uOff & 63 );
+			}
+			return;
+		}
+
+		// empty slot marker must not be one of the values: take one below the min, or else a gap, or else one past the max
+		m_eKind = SET_HASH;
+		m_iEmpty = pValues[0]-1;
+		if ( pValues[0]==LLONG_MIN )
+		{
+			m_iEmpty = (SphAttr_t)( (uint64_t)pValues[iCount-1]+1 );
+			for ( int i=0; i<iCount-1; i++ )
+				if ( pValues[i+1]!=pValues[i] && pValues[i+1]!=pValues[i]+1 )
+				{
+					m_iEmpty = pValues[i]+1;
+					break;
+				}
+		}
+
+		int iBits = sphLog2 ( (uint64_t)iCount*2-1 );
+		m_iShift = 64-iBits;
+		m_dHash.Reset ( 1<<iBits );
+		ARRAY_FOREACH ( i, m_dHash )
+			m_dHash[i] = m_iEmpty;
+
+		int iMask = m_dHash.GetLength()-1;
+		for ( int i=0; i<iCount; i++ )
+		{
+			int iSlot = HashSlot ( pValues[i] );
+			while ( m_dHash[iSlot]!=m_iEmpty && m_dHash[iSlot]!=pValues[i] )
+				iSlot = ( iSlot+1 ) & iMask;
+			m_dHash[iSlot] = pValues[i];
+		}
+	}
+
+	inline bool IsSmall () const
+	{
+		return m_eKind==SET_SMALL;
+	}
+
+	inline bool Contains ( SphAttr_t uValue ) const
+	{
+		switch ( m_eKind )
+		{
+			case SET_SMALL:
+				return SmallContains ( uValue );
+
+			case SET_BITMAP:
+			{
+				uint64_t uOff = (uint64_t)uValue - (uint64_t)m_iMin;
+				return uOff<m_uRange && ( m_dBits [ (int)( uOff>>6 ) ] & ( U64C(1) << ( uOff & 63 ) ) )!=0;
+			}
+
+			default:
+			{
+				int iMask = m_dHash.GetLength()-1;
+				for ( int iSlot = HashSlot ( uValue ); ; iSlot = ( iSlot+1 ) & iMask )
+				{
+					if ( m_dHash[iSlot]==uValue )
+						return uValue!=m_iEmpty;
+					if ( m_dHash[iSlot]==m_iEmpty )
+						return false;
+				}
+			}
+		}
+	}
+
+private:
+	enum Kind_e
+	{
+		SET_SMALL,
+		SET_BITMAP,
+		SET_HASH
+	};
+
+	Kind_e						m_eKind;
+	SphAttr_t					m_iMin;
+	uint64_t					m_uRange;
+	SphAttr_t					m_iEmpty;
+	int							m_iShift;
+	CSphFixedVector<SphAttr_t>	m_dSmall;
+	CSphFixedVector<uint64_t>	m_dBits;
+	CSphFixedVector<SphAttr_t>	m_dHash;
+
+	inline int HashSlot ( SphAttr_t uValue ) const
+	{
+		return (int)( ( (uint64_t)uValue * U64C(0x9E3779B97F4A7C15) ) >> m_iShift );
+	}
+
+	inline bool SmallContains ( SphAttr_t uValue ) const
+	{
+		const SphAttr_t * pValues = m_dSmall.Begin();
+#if SPH_FILTER_SSE2
+		// no 64-bit compare in sse2; both 32-bit halves must match
+		__m128i tNeedle = _mm_set1_epi64x ( uValue );
+		__m128i tAny = _mm_setzero_si128();
+		for ( int i=0; i<SMALL_MAX; i+=2 )
+		{
+			__m128i tEq = _mm_cmpeq_epi32 ( _mm_loadu_si128 ( (const __m128i *)( pValues+i ) ), tNeedle );
+			tAny = _mm_or_si128 ( tAny, _mm_and_si128 ( tEq, _mm_shuffle_epi32 ( tEq, _MM_SHUFFLE ( 2, 3, 0, 1 ) ) ) );
+		}
+		return _mm_movemask_epi8 ( tAny )!=0;
+#else
+		bool bFound = false;
+		for ( int i=0; i<SMALL_MAX; i++ )
+			bFound |= ( pValues[i]==uValue );
+		return bFound;
+#endif
+	}
+};
+
+
 /// values
 struct IFilter_Values : virtual ISphFilter
 {
 	const SphAttr_t *	m_pValues;
 	int					m_iValueCount;
+	ValueSet_c			m_tSet;
 
 	IFilter_Values ()
 		: m_pValues		( NULL )
@@ -54,6 +221,7 @@ struct IFilter_Values : virtual ISphFilter
 
 		m_pValues = pStorage;
 		m_iValueCount = iCount;
+		m_tSet.Setup ( pStorage, iCount );
 	}
 
 	inline SphAttr_t GetValue ( int iIndex ) const
@@ -72,34 +240,24 @@ bool IFilter_Values::EvalValues ( SphAttr_t uValue ) const
 	if ( !m_pValues )
 		return true;
 
-	const SphAttr_t * pA = m_pValues;
-	const SphAttr_t * pB = m_pValues + m_iValueCount - 1;
-
-	if ( uValue==*pA || uValue==*pB ) return true;
-	if ( uValue<(*pA) || uValue>(*pB) ) return false;
-
-	while ( pB-pA>1 )
-	{
-		const SphAttr_t * pM = pA + ((pB-pA)/2);
-		if ( uValue==(*pM) )
-			return true;
-		if ( uValue<(*pM) )
-			pB = pM;
-		else
-			pA = pM;
-	}
-	return false;
+	return m_tSet.Contains ( uValue );
 }
 
 
-// OPTIMIZE: use binary search
 bool IFilter_Values::EvalBlockValues ( SphAttr_t uBlockMin, SphAttr_t uBlockMax ) const
 {
-	// is any of our values inside the block?
-	for ( int i = 0; i < m_iValueCount; i++ )
-		if ( GetValue(i)>=uBlockMin && GetValue(i)<=uBlockMax )
-			return true;
-	return false;
+	// is any of our values inside the block? find the first value not below the block min
+	int iLeft = 0;
+	int iRight = m_iValueCount;
+	while ( iLeft<iRight )
+	{
+		int iMid = iLeft + ( iRight-iLeft )/2;
+		if ( GetValue(iMid)<uBlockMin )
+			iLeft = iMid+1;
+		else
+			iRight = iMid;
+	}
+	return iLeft<m_iValueCount && GetValue(iLeft)<=uBlockMax;
 }
 
 
@@ -408,6 +566,15 @@ struct Filter_MVAValues_Any : public IFilter_MVA, IFilter_Values
 
 	bool MvaEval ( const DWORD * pMva, const DWORD * pMvaMax ) const
 	{
+		// long lists are cheaper to probe with every mva value than to binary search the mva for every list value
+		if ( !m_tSet.IsSmall() )
+		{
+			for ( const T * pVal = (const T *)pMva; pVal<(const T *)pMvaMax; pVal++ )
+				if ( m_tSet.Contains ( *pVal ) )
+					return true;
+			return false;
+		}
+
 		const SphAttr_t * pFilter = m_pValues;
 		const SphAttr_t * pFilterMax = pFilter + m_iValueCount;
 
@@ -452,11 +619,8 @@ struct Filter_MVAValues_All : public IFilter_MVA, IFilter_Values
 		const T * R = (const T *)pMvaMax;
 
 		for ( const T * pVal=L; pVal<R; pVal++ )
-		{
-			const SphAttr_t iCheck = *pVal;
-			if ( !sphBinarySearch ( m_pValues, m_pValues + m_iValueCount - 1, iCheck ) )
+			if ( !m_tSet.Contains ( *pVal ) )
 				return false;
-		}
 		return true;
 	}
 };
@@ -674,6 +838,84 @@ struct Filter_StringValues_c: FilterString_c
 };
 
 
+/// string filter over a dictionary encoded attribute
+/// resolves reference strings to dictionary ranks once, then compares ranks per row
+class FilterStringDict_c : public IFilter_Attr
+{
+private:
+	DWORD					m_uTable;
+	bool					m_bEq;
+	const BYTE *			m_pStringBase;
+	CSphVector<DWORD>		m_dRanks;
+
+public:
+	FilterStringDict_c ( DWORD uTable, bool bEq )
+		: m_uTable ( uTable )
+		, m_bEq ( bEq )
+		, m_pStringBase ( NULL )
+	{}
+
+	virtual void SetStringStorage ( const BYTE * pStrings )
+	{
+		m_pStringBase = pStrings;
+	}
+
+	virtual void SetRefString ( const CSphString * pRef, int iCount )
+	{
+		assert ( m_pStringBase );
+		const BYTE * pTable = NULL;
+		sphUnpackStr ( m_pStringBase + m_uTable, &pTable );
+		int iEntries = (int)sphGetDword ( pTable );
+		pTable += sizeof(DWORD);
+
+		CSphFixedVector<BYTE> dVal ( 0 );
+		for ( int i=0; i<iCount; i++ )
+		{
+			int iLen = pRef[i].Length();
+			dVal.Reset ( iLen+4 );
+			int iPacked = sphPackStrlen ( dVal.Begin(), iLen );
+			memcpy ( dVal.Begin()+iPacked, pRef[i].cstr(), iLen );
+
+			// entries are sorted by libc_ci, so any of the equal ones carries the rank
+			int iLeft = 0;
+			int iRight = iEntries-1;
+			while ( iLeft<=iRight )
+			{
+				int iMid = iLeft + ( iRight-iLeft )/2;
+				const BYTE * pEntry = m_pStringBase + sphGetDword ( pTable + iMid*sizeof(DWORD) );
+				int iCmp = sphCollateLibcCI ( pEntry, dVal.Begin(), true );
+				if ( iCmp==0 )
+				{
+					m_dRanks.Add ( sphGetDword ( pEntry-4 ) );
+					break;
+				}
+				if ( iCmp<0 )
+					iLeft = iMid+1;
+				else
+					iRight = iMid-1;
+			}
+		}
+		m_dRanks.Uniq();
+	}
+
+	virtual bool Eval ( const CSphMatch & tMatch ) const
+	{
+		SphAttr_t uVal = tMatch.GetAttr ( m_tLocator );
+		bool bEq = ( uVal && m_dRanks.BinarySearch ( sphGetDword ( m_pStringBase+uVal-4 ) )!=NULL );
+		return ( m_bEq==bEq );
+	}
+};
+
+
+static bool HasEmptyRefString ( const CSphFilterSettings & tSettings )
+{
+	ARRAY_FOREACH ( i, tSettings.m_dStrings )
+		if ( tSettings.m_dStrings[i].IsEmpty() )
+			return true;
+	return !tSettings.m_dStrings.GetLength();
+}
+
+
 struct Filter_And2 : public ISphFilter
 {
 	ISphFilter * m_pArg1;
@@ -1316,7 +1558,7 @@ struct Filter_KillList : public ISphFilter
 //////////////////////////////////////////////////////////////////////////
 
 static ISphFilter * CreateFilter ( const CSphFilterSettings & tSettings, const CSphString & sAttrName, const ISphSchema & tSchema, const DWORD * pMvaPool, const BYTE * pStrings,
-	CSphString & sError, CSphString & sWarning, bool bHaving, ESphCollation eCollation, bool bArenaProhibit )
+	CSphString & sError, CSphString & sWarning, bool bHaving, ESphCollation eCollation, bool bArenaProhibit, bool bStringDicts )
 {
 	ISphFilter * pFilter = NULL;
 	const CSphColumnInfo * pAttr = NULL;
@@ -1342,12 +1584,19 @@ static ISphFilter * CreateFilter ( const CSphFilterSettings & tSettings, const C
 
 	if ( !pFilter )
 	{
-		const int iAttr = tSchema.GetAttrIndex ( sAttrName.cstr() );
+		int iAttr = tSchema.GetAttrIndex ( sAttrName.cstr() );
+
+		// typed columns extracted from JSON only serve numeric filters; string and null checks need the raw JSON value
+		CSphString sJsonExpr;
+		if ( iAttr>=0 && ( eType==SPH_FILTER_STRING || eType==SPH_FILTER_NULL || eType==SPH_FILTER_STRING_LIST )
+			&& sphJsonExtractedExpr ( sAttrName.cstr(), sJsonExpr ) )
+			iAttr = -1;
+
 		if ( iAttr<0 )
 		{
 			// try expression
 			ESphAttr eAttrType;
-			ISphExpr * pExpr = sphExprParse ( sAttrName.cstr(), tSchema, &eAttrType, NULL, sError, NULL, eCollation );
+			ISphExpr * pExpr = sphExprParse ( sJsonExpr.IsEmpty() ? sAttrName.cstr() : sJsonExpr.cstr(), tSchema, &eAttrType, NULL, sError, NULL, eCollation );
 			if ( pExpr )
 			{
 				pFilter = CreateFilterExpr ( pExpr, tSettings.m_eType, tSettings.m_bHasEqual, sError, eCollation, eAttrType );
@@ -1374,6 +1623,12 @@ static ISphFilter * CreateFilter ( const CSphFilterSettings & tSettings, const C
 
 				pFilter = CreateFilterExpr ( pAttr->m_pExpr.Ptr(), tSettings.m_eType, tSettings.m_bHasEqual, sError, eCollation, pAttr->m_eAttrType );
 
+			} else if ( pAttr->m_eAttrType==SPH_ATTR_STRING && pAttr->m_uStringDict && bStringDicts && pStrings && !bHaving && eCollation==SPH_COLLATION_LIBC_CI
+				&& ( eType==SPH_FILTER_STRING || eType==SPH_FILTER_STRING_LIST ) && !HasEmptyRefString ( tSettings ) )
+			{
+				// dictionary ranks are libc_ci classes; empty strings are not in the dictionary
+				pFilter = new FilterStringDict_c ( pAttr->m_uStringDict, eType==SPH_FILTER_STRING ? tSettings.m_bHasEqual : true );
+
 			} else
 			{
 				// fixup "fltcol=intval" conditions
@@ -1424,9 +1679,9 @@ static ISphFilter * CreateFilter ( const CSphFilterSettings & tSettings, const C
 }
 
 
-ISphFilter * sphCreateFilter ( const CSphFilterSettings & tSettings, const ISphSchema & tSchema, const DWORD * pMvaPool, const BYTE * pStrings, CSphString & sError, CSphString & sWarning, ESphCollation eCollation, bool bArenaProhibit )
+ISphFilter * sphCreateFilter ( const CSphFilterSettings & tSettings, const ISphSchema & tSchema, const DWORD * pMvaPool, const BYTE * pStrings, CSphString & sError, CSphString & sWarning, ESphCollation eCollation, bool bArenaProhibit, bool bStringDicts )
 {
-	return CreateFilter ( tSettings, tSettings.m_sAttrName, tSchema, pMvaPool, pStrings, sError, sWarning, false, eCollation, bArenaProhibit );
+	return CreateFilter ( tSettings, tSettings.m_sAttrName, tSchema, pMvaPool, pStrings, sError, sWarning, false, eCollation, bArenaProhibit, bStringDicts );
 }
 
 
@@ -1434,7 +1689,7 @@ ISphFilter * sphCreateAggrFilter ( const CSphFilterSettings * pSettings, const C
 {
 	assert ( pSettings );
 	CSphString sWarning;
-	ISphFilter * pRes = CreateFilter ( *pSettings, sAttrName, tSchema, NULL, NULL, sError, sWarning, true, SPH_COLLATION_DEFAULT, false );
+	ISphFilter * pRes = CreateFilter ( *pSettings, sAttrName, tSchema, NULL, NULL, sError, sWarning, true, SPH_COLLATION_DEFAULT, false, false );
 	assert ( sWarning.IsEmpty() );
 	return pRes;
 }
@@ -49,7 +49,7 @@
 //////////////////////////////////////////////////////////////////////////
 
 const DWORD		INDEX_MAGIC_HEADER			= 0x58485053;		///< my magic 'SPHX' header
-const DWORD		INDEX_FORMAT_VERSION		= 42;				///< my format version
+const DWORD		INDEX_FORMAT_VERSION		= 47;				///< my format version
 
 const char		MAGIC_SYNONYM_WHITESPACE	= 1;				// used internally in tokenizer only
 const char		MAGIC_CODE_SENTENCE			= 2;				// emitted from tokenizer on sentence boundary
@@ -81,6 +81,8 @@ extern int g_iPredictorCostMatch;
 extern bool g_bJsonStrict;
 extern bool g_bJsonAutoconvNumbers;
 extern bool g_bJsonKeynamesToLowercase;
+extern int g_iJsonKeyDirectory;
+extern bool g_bTokenizerAsciiFast;
 
 //////////////////////////////////////////////////////////////////////////
 // INTERNAL HELPER FUNCTIONS, CLASSES, ETC
@@ -477,6 +479,7 @@ public:
 	const SmallStringHash_T<int64_t> *		m_pLocalDocs;
 	int64_t									m_iTotalDocs;
 	int64_t									m_iBadRows;
+	bool									m_bStringDicts;			///< filter schema and string pool come from the same index
 
 public:
 	explicit CSphQueryContext ( const CSphQuery & q );
@@ -1741,6 +1744,32 @@ struct SphStringSorterRemap_t
 	CSphAttrLocator m_tDst;
 };
 
+/// orders matches by docid, and then the copies of the same document by tag
+/// so that the copy master prefers (local over remote, then the latest tag) goes first
+struct TaggedMatchSorter_fn : public SphAccessor_T<CSphMatch>
+{
+	void CopyKey ( CSphMatch * pMed, CSphMatch * pVal ) const
+	{
+		pMed->m_uDocID = pVal->m_uDocID;
+		pMed->m_iTag = pVal->m_iTag;
+	}
+
+	bool IsLess ( const CSphMatch & a, const CSphMatch & b ) const
+	{
+		bool bDistA = ( ( a.m_iTag & 0x80000000 )==0x80000000 );
+		bool bDistB = ( ( b.m_iTag & 0x80000000 )==0x80000000 );
+		// sort by doc_id, dist_tag, tag
+		return ( a.m_uDocID < b.m_uDocID ) ||
+			( a.m_uDocID==b.m_uDocID && ( ( !bDistA && bDistB ) || ( ( a.m_iTag & 0x7FFFFFFF )>( b.m_iTag & 0x7FFFFFFF ) ) ) );
+	}
+
+	// inherited swap does not work on gcc
+	void Swap ( CSphMatch * a, CSphMatch * b ) const
+	{
+		::Swap ( *a, *b );
+	}
+};
+
 struct ThrottleState_t
 {
 	int64_t	m_tmLastIOTime;
@@ -1758,6 +1787,12 @@ const BYTE *	SkipQuoted ( const BYTE * p );
 
 bool			sphSortGetStringRemap ( const ISphSchema & tSorterSchema, const ISphSchema & tIndexSchema, CSphVector<SphStringSorterRemap_t> & dAttrs );
 bool			sphIsSortStringInternal ( const char * sColumnName );
+/// k-way merge of result sets (dCounts long each) which are all ordered by the sorter already, keeping one copy of every document
+/// returns false if some set turns out to be not ordered, and leaves the matches intact then
+bool			sphMergeSortedSets ( const ISphMatchSorter & tSorter, CSphSwapVector<CSphMatch> & dMatches, const CSphVector<int> & dCounts, int iMaxMatches, const ISphSchema & tSchema, int & iDupes );
+/// search_after cursor that continues right after the given match, with floats printed precisely enough to round-trip
+/// returns false if the query order can't be continued by a cursor
+bool			sphFormatSearchAfter ( const CSphQuery & tQuery, const ISphSchema & tSchema, const CSphMatch & tMatch, CSphString & sCursor );
 /// make string lowercase but keep case of JSON.field
 void			sphColumnToLowercase ( char * sVal );
 
@@ -1907,6 +1942,14 @@ int sphCollateLibcCS ( const BYTE * pStr1, const BYTE * pStr2, bool bPacked );
 int sphCollateUtf8GeneralCI ( const BYTE * pArg1, const BYTE * pArg2, bool bPacked );
 int sphCollateBinary ( const BYTE * pStr1, const BYTE * pStr2, bool bPacked );
 
+/// libc_ci string hash, same as used by the string grouper
+uint64_t sphHashLibcCI ( const BYTE * pStr, int iLen );
+
+/// collation sort key, a string prefix packed into an integer that orders the same way as the collation
+/// differing keys decide the comparison, equal keys need the full compare; 0 means there is no key
+/// (libc_cs compares a length-dependent prefix, so it never gets keys)
+uint64_t sphCollateKey ( const BYTE * pStr, int iLen, ESphCollation eCollation );
+
 class ISphRtDictWraper : public CSphDict
 {
 public:
@@ -1930,8 +1973,10 @@ struct SphExpanded_t
 
 struct ISphSubstringPayload
 {
-	ISphSubstringPayload () {}
+	ISphSubstringPayload () : m_uCacheKey ( 0 ) {}
 	virtual ~ISphSubstringPayload() {}
+
+	uint64_t	m_uCacheKey;	///< identifies merged doclists within the index for expansion cache (0 means do not cache)
 };
 
 
@@ -2245,6 +2290,168 @@ bool sphLookupInfixCheckpoints ( const char * sInfix, int iBytes, const BYTE * p
 int sphGetInfixLength ( const char * sInfix, int iBytes, int iInfixCodepointBytes );
 
 
+/// keywords FST builder (dict=keywords only)
+/// builds a minimal acyclic automaton over the sorted wordlist that maps every keyword
+/// to its ordinal number; keyword entry then is at ordinal%SPH_WORDLIST_CHECKPOINT
+/// in the ordinal/SPH_WORDLIST_CHECKPOINT keyword block
+class KeywordsFstBuilder_c : public ISphNoncopyable
+{
+public:
+					KeywordsFstBuilder_c ();
+
+	/// keywords must come in strictly ascending dictionary order
+	void			AddWord ( const BYTE * pWord, int iLen );
+
+	/// freezes pending states and writes FST section, returns its position
+	int64_t			Save ( CSphWriter & wrDict );
+
+	int				GetWords () const { return m_iWords; }
+
+private:
+	struct Arc_t
+	{
+		BYTE		m_uLabel;
+		DWORD		m_uOut;		///< ordinal delta from the state base
+		int64_t		m_iTarget;	///< frozen target state offset
+	};
+
+	struct State_t
+	{
+		bool				m_bFinal;
+		int					m_iBase;	///< ordinal of the first keyword that passes this state
+		CSphVector<Arc_t>	m_dArcs;
+	};
+
+	struct RegEntry_t
+	{
+		int64_t		m_iOffset;
+		int			m_iLen;
+	};
+
+	State_t					m_dPath [ SPH_MAX_WORD_LEN*3+5 ];	///< pending (not yet frozen) states along the last keyword
+	BYTE					m_sLast [ SPH_MAX_WORD_LEN*3+4 ];
+	int						m_iLastLen;
+	int						m_iWords;
+
+	CSphTightVector<BYTE>	m_dStates;		///< frozen states, serialized
+	CSphVector<RegEntry_t>	m_dRegister;	///< open addressing hash of frozen states
+	int						m_iRegistered;
+	CSphTightVector<BYTE>	m_dScratch;
+
+	int64_t			Freeze ( int iDepth );
+	void			RegisterGrow ();
+};
+
+
+/// keywords FST reader over a memory mapped dictionary
+class KeywordsFst_c
+{
+public:
+					KeywordsFst_c () : m_pBlob ( NULL ), m_iBlobLen ( 0 ), m_iRoot ( 0 ), m_iWords ( 0 ) {}
+
+	/// pSection points right past the FST section tag
+	bool			Setup ( const BYTE * pSection, const BYTE * pMax, CSphString & sError );
+	void			Reset () { m_pBlob = NULL; m_iBlobLen = m_iRoot = 0; m_iWords = 0; }
+	bool			IsEmpty () const { return !m_pBlob; }
+	int				GetWords () const { return m_iWords; }
+
+	/// returns keyword ordinal, or -1 if there's no such keyword
+	int				Find ( const BYTE * pWord, int iLen ) const;
+
+	/// returns ordinals range [iFirst, iFirst+iCount) of all keywords that start with a given prefix
+	bool			FindPrefix ( const BYTE * pPrefix, int iLen, int & iFirst, int & iCount ) const;
+
+	struct FuzzyMatch_t
+	{
+		int			m_iOrdinal;
+		int			m_iDistance;
+		int			m_iWordOff;		///< offset into words buffer
+		int			m_iWordLen;
+	};
+
+	/// walks the automaton along with levenshtein rows, collects keywords within tArgs.m_iMaxEdits from tRes.m_sWord
+	void			FuzzyWords ( const SuggestArgs_t & tArgs, const SuggestResult_t & tRes, CSphVector<FuzzyMatch_t> & dMatches, CSphVector<BYTE> & dWords ) const;
+
+private:
+	const BYTE *	m_pBlob;
+	int64_t			m_iBlobLen;
+	int64_t			m_iRoot;
+	int				m_iWords;
+};
+
+extern const char * g_sTagKeywordsFst;
+
+
+/// infix trigrams builder (dict=keywords only)
+/// maps every 3-codepoint substring of a keyword to the ascending list of ordinals of keywords
+/// that contain it; substring expansion then intersects a few such lists instead of scanning infix blocks
+class InfixTrigramsBuilder_c : public ISphNoncopyable
+{
+public:
+					InfixTrigramsBuilder_c ();
+
+	/// every keyword must be passed, in dictionary order, as ordinals are counted here
+	void			AddWord ( const BYTE * pWord, int iLen, bool bHasMorphology );
+
+	/// writes trigrams section, returns its position
+	int64_t			Save ( CSphWriter & wrDict );
+
+private:
+	struct Posting_t
+	{
+		uint64_t	m_uKey;			///< trigram hash
+		int			m_iLast;		///< last added ordinal
+		int			m_iCount;		///< ordinals count
+		int64_t		m_iBytes;		///< encoded deltas size
+		int			m_iHead;		///< first deltas chunk
+		int			m_iTail;		///< last deltas chunk
+		int			m_iTailUsed;	///< bytes used in the last chunk
+	};
+
+	static const int		CHUNK_SIZE = 32;	///< chunk starts with next chunk index, then deltas follow
+
+	CSphVector<Posting_t>	m_dPostings;
+	CSphVector<int>			m_dHash;		///< open addressing hash of postings by key
+	CSphTightVector<BYTE>	m_dChunks;
+	int						m_iWords;
+
+	void			Append ( Posting_t & tPosting, int iOrdinal );
+	void			HashGrow ();
+};
+
+
+/// infix trigrams reader over a memory mapped dictionary
+class InfixTrigrams_c
+{
+public:
+					InfixTrigrams_c () { Reset(); }
+
+	/// pSection points right past the trigrams section tag
+	bool			Setup ( const BYTE * pSection, const BYTE * pMax, CSphString & sError );
+	void			Reset () { m_pTable = m_pPostings = NULL; m_iPostingsLen = 0; m_iTrigrams = 0; }
+	bool			IsEmpty () const { return !m_pTable; }
+	int				GetTrigrams () const { return m_iTrigrams; }
+
+	/// intersects postings of all the trigrams from literal fragments of a wildcard, ordinals are ascending
+	/// candidates still need to be checked against the wildcard (trigrams are hashed and unordered)
+	/// returns false when the wildcard has no trigrams at all, and the dictionary must be scanned
+	bool			GetCandidates ( const char * sWildcard, CSphVector<int> & dOrdinals ) const;
+
+	/// checks that all postings are ascending and within the wordlist
+	bool			Check ( int iWords, CSphString & sError ) const;
+
+private:
+	const BYTE *	m_pTable;
+	const BYTE *	m_pPostings;
+	int64_t			m_iPostingsLen;
+	int				m_iTrigrams;
+
+	const BYTE *	FindPosting ( uint64_t uKey ) const;
+};
+
+extern const char * g_sTagInfixTrigrams;
+
+
 /// compute utf-8 character length in bytes from its first byte
 inline int sphUtf8CharBytes ( BYTE uFirst )
 {
@@ -2489,6 +2696,98 @@ uint64_t sphCalcLocatorHash ( const CSphAttrLocator & tLoc, uint64_t uPrevHash )
 uint64_t sphCalcExprDepHash ( const char * szTag, ISphExpr * pExpr, const ISphSchema & tSorterSchema, uint64_t uPrevHash, bool & bDisable );
 uint64_t sphCalcExprDepHash ( ISphExpr * pExpr, const ISphSchema & tSorterSchema, uint64_t uPrevHash, bool & bDisable );
 
+/// uniform latitude/longitude cell grid over disk index rows
+/// built at load time from the attributes in RAM, works in raw attribute units (degrees or radians)
+class GeoGrid_c
+{
+public:
+	/// lookup box in raw attribute units
+	/// longitude is a set of disjoint ranges, as a circle around the anchor might wrap around the antimeridian
+	struct Box_t
+	{
+		static const int MAX_LON_RANGES = 4;
+
+		float	m_fLatMin;
+		float	m_fLatMax;
+		float	m_dLonMin [ MAX_LON_RANGES ];
+		float	m_dLonMax [ MAX_LON_RANGES ];
+		int		m_iLonRanges;
+
+				Box_t ();
+		bool	IsEmpty () const { return m_fLatMin>m_fLatMax || !m_iLonRanges; }
+		bool	Intersect ( const Box_t & tBox );	///< false if the result has too many longitude ranges
+	};
+
+public:
+					GeoGrid_c ();
+
+	void			Build ( const DWORD * pDocinfo, int64_t iRows, int iStride, const CSphAttrLocator & tLat, const CSphAttrLocator & tLon );
+	void			Reset ();
+	bool			IsEmpty () const { return m_dRows.GetLength()==0; }
+
+	/// grid bounds box, covers all the rows
+	Box_t			GetBounds () const;
+
+	/// box that covers every point within given geodist() meters from the anchor
+	/// false if data is out of sphere coordinate ranges and cannot be bounded
+	bool			GetCircleBox ( float fLat, float fLon, float fMeters, bool bDeg, Box_t & tBox ) const;
+
+	/// approximate latitude extent of one cell, in meters
+	float			GetCellMeters ( bool bDeg ) const;
+
+	/// count rows in the cells that intersect the box
+	int64_t			CountRows ( const Box_t & tBox ) const;
+
+	/// collect row numbers from the cells that intersect the box
+	/// cells flagged in pVisited are skipped, and collected cells get flagged there
+	void			CollectRows ( const Box_t & tBox, CSphVector<DWORD> & dRows, CSphBitvec * pVisited ) const;
+
+	int				GetCellsCount () const { return m_iLatCells*m_iLonCells; }
+
+private:
+	float					m_fLatMin;
+	float					m_fLatMax;
+	float					m_fLonMin;
+	float					m_fLonMax;
+	float					m_fLatScale;
+	float					m_fLonScale;
+	int						m_iLatCells;
+	int						m_iLonCells;
+	CSphFixedVector<DWORD>	m_dCells;	///< per-cell offsets into m_dRows, cells+1 entries
+	CSphFixedVector<DWORD>	m_dRows;	///< row numbers sorted by cell, ascending within each cell
+
+	int				GetCell ( float fLat, float fLon ) const;
+	bool			GetCellRange ( float fMin, float fMax, float fFrom, float fTo, float fScale, int iCells, int & iFirst, int & iLast ) const;
+
+	template < typename FN >
+	void			ForEachCell ( const Box_t & tBox, FN & tFunc ) const;
+};
+
+/// sort disk index row numbers by an integer or float attribute (ties by row), for ordered fullscans
+/// false if the attribute can not be ordered (other types, NaN floats)
+bool sphBuildAttrOrder ( const DWORD * pDocinfo, int64_t iRows, int iStride, const CSphColumnInfo & tCol, CSphFixedVector<DWORD> & dOrder );
+
+/// docid delta bytes of disk index doclists, as stored now and if documents were renumbered
+/// densely in the current order, or densely in some other order (given as row ranks)
+struct ReorderEstimate_t
+{
+	int64_t			m_iPostings;
+	int64_t			m_iCurBytes;
+	int64_t			m_iDenseBytes;
+	int64_t			m_iOrderBytes;
+
+					ReorderEstimate_t ();
+
+	void			StartDoclist ( SphDocID_t uMinDocid );
+	void			AddDoc ( SphDocID_t uDocID, int64_t iRow, DWORD uRank );	///< postings must come in docid (and row) order
+	void			FinishDoclist ();
+
+private:
+	SphDocID_t		m_uLastID;
+	int64_t			m_iLastRow;
+	CSphVector<DWORD>	m_dRanks;
+};
+
 inline void FlipEndianess ( DWORD* pData )
 {
 	BYTE* pB = (BYTE*)pData;
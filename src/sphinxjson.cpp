@@ -40,6 +40,21 @@ struct JsonNode_t
 };
 #define YYSTYPE JsonNode_t
 
+
+/// key directory entry; directory is sorted by key hash, offsets are from the first object entry past the directory
+struct JsonKeyDirEntry_t
+{
+	DWORD	m_uHash;
+	DWORD	m_uOffset;
+
+	bool operator < ( const JsonKeyDirEntry_t & rhs ) const
+	{
+		return m_uHash<rhs.m_uHash || ( m_uHash==rhs.m_uHash && m_uOffset<rhs.m_uOffset );
+	}
+};
+
+static const int JSON_KEYDIR_ENTRY = 8; // bytes per directory entry, ie. hash and offset
+
 // must be included after YYSTYPE declaration
 class JsonParser_c;
 
@@ -53,18 +68,20 @@ public:
 	CSphString &		m_sError;
 	bool				m_bAutoconv;
 	bool				m_bToLowercase;
+	int					m_iKeyDirectory;
 	char *				m_pBuf;
 	CSphVector < CSphVector<JsonNode_t> >	m_dNodes;
 	CSphVector<JsonNode_t>					m_dEmpty;
 
 public:
-	JsonParser_c ( CSphVector<BYTE> & dBuffer, bool bAutoconv, bool bToLowercase, CSphString & sError )
+	JsonParser_c ( CSphVector<BYTE> & dBuffer, bool bAutoconv, bool bToLowercase, int iKeyDirectory, CSphString & sError )
 		: m_pScanner ( NULL )
 		, m_pLastToken ( NULL )
 		, m_dBuffer ( dBuffer )
 		, m_sError ( sError )
 		, m_bAutoconv ( bAutoconv )
 		, m_bToLowercase ( bToLowercase )
+		, m_iKeyDirectory ( iKeyDirectory )
 	{
 		// reserve 4 bytes for Bloom mask
 		StoreInt ( 0 );
@@ -205,6 +222,7 @@ protected:
 		return iLen;
 	}
 
+	/// store little-endian dword at a given (previously reserved) buffer offset
 	void StoreMask ( int iOfs, DWORD uMask )
 	{
 		for ( int i=0; i<4; i++ )
@@ -241,6 +259,27 @@ protected:
 		m_dBuffer.Resize ( iOfs+iPackLen+iSize );
 	}
 
+	/// reserve an unnamed JSON_KEYDIR entry for iKeys keys, to be filled later with StoreKeyDir()
+	int ReserveKeyDir ( int iKeys )
+	{
+		m_dBuffer.Add ( JSON_KEYDIR );
+		PackStr ( NULL, 0 );
+		PackInt ( iKeys );
+		int iOfs = m_dBuffer.GetLength();
+		BufAlloc ( iKeys*JSON_KEYDIR_ENTRY );
+		return iOfs;
+	}
+
+	void StoreKeyDir ( int iOfs, CSphVector<JsonKeyDirEntry_t> & dDir )
+	{
+		dDir.Sort();
+		ARRAY_FOREACH ( i, dDir )
+		{
+			StoreMask ( iOfs + i*JSON_KEYDIR_ENTRY, dDir[i].m_uHash );
+			StoreMask ( iOfs + i*JSON_KEYDIR_ENTRY + 4, dDir[i].m_uOffset );
+		}
+	}
+
 public:
 	void Finalize()
 	{
@@ -335,15 +374,35 @@ public:
 					StoreInt ( uMask );
 				}
 
+				// large objects get a key directory, so that key lookups do not need to scan all the entries
+				// (nested objects might move their own data, but never the entries that precede them)
+				int iDirOfs = -1;
+				CSphVector<JsonKeyDirEntry_t> dDir;
+				if ( m_iKeyDirectory>0 && dNodes.GetLength()>=m_iKeyDirectory )
+				{
+					iDirOfs = ReserveKeyDir ( dNodes.GetLength() );
+					dDir.Reserve ( dNodes.GetLength() );
+				}
+				int iEntries = m_dBuffer.GetLength();
+
 				ARRAY_FOREACH ( i, dNodes )
 				{
 					char * sObjKey = m_pBuf + dNodes[i].m_iKeyStart;
 					int iLen = KeyUnescape ( &sObjKey, dNodes[i].m_iKeyEnd-dNodes[i].m_iKeyStart );
+					if ( iDirOfs>=0 )
+					{
+						JsonKeyDirEntry_t & tEntry = dDir.Add();
+						tEntry.m_uHash = sphCRC32 ( sObjKey, iLen );
+						tEntry.m_uOffset = m_dBuffer.GetLength()-iEntries;
+					}
 					WriteNode ( dNodes[i], sObjKey, iLen );
 					uMask |= sphJsonKeyMask ( sObjKey, iLen );
 				}
 				m_dBuffer.Add ( JSON_EOF );
 
+				if ( iDirOfs>=0 )
+					StoreKeyDir ( iDirOfs, dDir );
+
 				if ( eType==JSON_OBJECT )
 				{
 					StoreMask ( iOfs+1, uMask );
@@ -430,6 +489,13 @@ public:
 		case JSON_FALSE:	printf ( "JSON_FALSE\n" ); break;
 		case JSON_NULL:		printf ( "JSON_NULL\n" ); break;
 		case JSON_EOF:		printf ( "JSON_EOF\n" ); break;
+		case JSON_KEYDIR:
+			{
+				int iKeys = sphJsonUnpackInt ( &p );
+				printf ( "JSON_KEYDIR (%d keys)\n", iKeys );
+				p += iKeys*JSON_KEYDIR_ENTRY;
+				break;
+			}
 
 		// associative arrays
 		case JSON_ROOT:
@@ -559,7 +625,7 @@ static int yylex ( YYSTYPE * lvalp, JsonParser_c * pParser )
 	#include "yysphinxjson.c"
 #endif
 
-bool sphJsonParse ( CSphVector<BYTE> & dData, char * sData, bool bAutoconv, bool bToLowercase, CSphString & sError )
+bool sphJsonParse ( CSphVector<BYTE> & dData, char * sData, bool bAutoconv, bool bToLowercase, int iKeyDirectory, CSphString & sError )
 {
 	int iLen = strlen ( sData );
 	if ( sData[iLen+1]!=0 )
@@ -568,7 +634,7 @@ bool sphJsonParse ( CSphVector<BYTE> & dData, char * sData, bool bAutoconv, bool
 		return false;
 	}
 
-	JsonParser_c tParser ( dData, bAutoconv, bToLowercase, sError );
+	JsonParser_c tParser ( dData, bAutoconv, bToLowercase, iKeyDirectory, sError );
 	yy2lex_init ( &tParser.m_pScanner );
 
 	tParser.m_pBuf = sData; // sphJsonParse() is intentionally destructive, no need to copy data here
@@ -626,6 +692,11 @@ int sphJsonNodeSize ( ESphJsonType eType, const BYTE *pData )
 			return -1;
 		iLen = sphJsonUnpackInt ( &p );
 		return p - pData + iLen * 4;
+	case JSON_KEYDIR:
+		if ( !p )
+			return -1;
+		iLen = sphJsonUnpackInt ( &p );
+		return p - pData + iLen * JSON_KEYDIR_ENTRY;
 	case JSON_INT64_VECTOR:
 	case JSON_DOUBLE_VECTOR:
 		if ( !p )
@@ -699,7 +770,8 @@ int sphJsonFieldLength ( ESphJsonType eType, const BYTE * pData )
 			int iLen = sphJsonUnpackInt ( &p );
 			p += iLen;
 			sphJsonSkipNode ( eNode, &p );
-			iCount++;
+			if ( eNode!=JSON_KEYDIR )
+				iCount++;
 		}
 		return iCount;
 	default:
@@ -734,6 +806,40 @@ ESphJsonType sphJsonFindByKey ( ESphJsonType eType, const BYTE ** ppValue, const
 		return JSON_EOF;
 
 	p += 4;
+	if ( *p==JSON_KEYDIR )
+	{
+		p++;
+		sphJsonUnpackInt ( &p ); // unnamed
+		int iKeys = sphJsonUnpackInt ( &p );
+		const BYTE * pEntries = p + iKeys*JSON_KEYDIR_ENTRY;
+		DWORD uHash = sphCRC32 ( pKey, iLen );
+
+		// lower bound by hash, then check the (very likely single) candidate names
+		int iLo = 0;
+		int iHi = iKeys;
+		while ( iLo<iHi )
+		{
+			int iMid = ( iLo+iHi ) >> 1;
+			if ( sphGetDword ( p + iMid*JSON_KEYDIR_ENTRY )<uHash )
+				iLo = iMid+1;
+			else
+				iHi = iMid;
+		}
+
+		for ( ; iLo<iKeys && sphGetDword ( p + iLo*JSON_KEYDIR_ENTRY )==uHash; iLo++ )
+		{
+			const BYTE * pEntry = pEntries + sphGetDword ( p + iLo*JSON_KEYDIR_ENTRY + 4 );
+			eType = (ESphJsonType) *pEntry++;
+			int iStrLen = sphJsonUnpackInt ( &pEntry );
+			if ( iStrLen==iLen && !memcmp ( pEntry, pKey, iStrLen ) )
+			{
+				*ppValue = pEntry+iStrLen;
+				return eType;
+			}
+		}
+		return JSON_EOF;
+	}
+
 	for ( ;; )
 	{
 		eType = (ESphJsonType) *p++;
@@ -970,6 +1076,13 @@ const BYTE * sphJsonFieldFormat ( CSphVector<BYTE> & dOut, const BYTE * pData, E
 					ESphJsonType eNode = (ESphJsonType) *p++;
 					if ( eNode==JSON_EOF )
 						break;
+					if ( eNode==JSON_KEYDIR )
+					{
+						sphJsonUnpackInt ( &p ); // unnamed
+						sphJsonSkipNode ( eNode, &p );
+						i--;
+						continue;
+					}
 					if ( i>0 )
 						dOut.Add ( ',' );
 					p = JsonFormatStr ( dOut, p );
@@ -983,6 +1096,7 @@ const BYTE * sphJsonFieldFormat ( CSphVector<BYTE> & dOut, const BYTE * pData, E
 		case JSON_FALSE:	JsonAddStr ( dOut, bQuoteString ? "false" : "0" ); break;
 		case JSON_NULL:		JsonAddStr ( dOut, bQuoteString ? "null" : "" ); break;
 		case JSON_EOF:		break;
+		case JSON_KEYDIR:	break;
 		case JSON_TOTAL:	break;
 	}
 
@@ -1022,6 +1136,69 @@ bool sphJsonNameSplit ( const char * sName, CSphString * sColumn, CSphString * s
 }
 
 
+bool sphJsonExtractedExpr ( const char * sName, CSphString & sExpr )
+{
+	CSphString sColumn, sPath;
+	if ( !sphJsonNameSplit ( sName, &sColumn, &sPath ) )
+		return false;
+
+	// jsoncol.key1.key2 becomes jsoncol['key1']['key2'], which the expression lexer never maps to a typed column
+	CSphStringBuilder tExpr;
+	tExpr += sColumn.cstr();
+	const char * sKey = sPath.cstr();
+	while ( *sKey )
+	{
+		const char * sEnd = strchr ( sKey, '.' );
+		int iLen = sEnd ? int ( sEnd-sKey ) : (int)strlen ( sKey );
+		tExpr.Appendf ( "['%.*s']", iLen, sKey );
+		sKey += iLen + ( sEnd ? 1 : 0 );
+	}
+
+	sExpr = tExpr.cstr();
+	return true;
+}
+
+
+void sphJsonExtractColumns ( const CSphSchema & tSchema, const CSphString & sColumn, const BYTE * pData, CSphRowitem * pRow )
+{
+	CSphString sJsonCol, sPath;
+	for ( int i=0; i<tSchema.GetAttrsCount(); i++ )
+	{
+		const CSphColumnInfo & tCol = tSchema.GetAttr(i);
+		if ( !sphJsonNameSplit ( tCol.m_sName.cstr(), &sJsonCol, &sPath ) || sJsonCol!=sColumn )
+			continue;
+
+		// walk the dotted path; anything missing or non-numeric reads as zero
+		const BYTE * p = pData;
+		ESphJsonType eType = p ? sphJsonFindFirst ( &p ) : JSON_EOF;
+		const char * sKey = sPath.cstr();
+		while ( *sKey && eType!=JSON_EOF )
+		{
+			const char * sEnd = strchr ( sKey, '.' );
+			int iLen = sEnd ? int ( sEnd-sKey ) : (int)strlen ( sKey );
+			eType = sphJsonFindByKey ( eType, &p, sKey, iLen, sphJsonKeyMask ( sKey, iLen ) );
+			sKey += iLen + ( sEnd ? 1 : 0 );
+		}
+
+		int64_t iValue = 0;
+		double fValue = 0.0;
+		switch ( eType )
+		{
+			case JSON_INT32:	iValue = sphJsonLoadInt ( &p ); fValue = (double)iValue; break;
+			case JSON_INT64:	iValue = sphJsonLoadBigint ( &p ); fValue = (double)iValue; break;
+			case JSON_DOUBLE:	fValue = sphQW2D ( sphJsonLoadBigint ( &p ) ); iValue = (int64_t)fValue; break;
+			case JSON_TRUE:		iValue = 1; fValue = 1.0; break;
+			default:			break;
+		}
+
+		if ( tCol.m_eAttrType==SPH_ATTR_FLOAT )
+			sphSetRowAttr ( pRow, tCol.m_tLocator, sphF2DW ( (float)fValue ) );
+		else
+			sphSetRowAttr ( pRow, tCol.m_tLocator, (SphAttr_t)iValue );
+	}
+}
+
+
 JsonKey_t::JsonKey_t ()
 	: m_uMask ( 0 )
 	, m_iLen ( 0 )
@@ -36,6 +36,7 @@ enum ESphJsonType
 	JSON_FALSE			= 12,
 	JSON_NULL			= 13,
 	JSON_ROOT			= 14,
+	JSON_KEYDIR			= 15,	///< sorted key hash directory; optional first (unnamed) entry of a large object
 
 	JSON_TOTAL
 };
@@ -95,7 +96,8 @@ inline DWORD sphJsonUnpackInt ( const BYTE ** pp )
 }
 
 /// parse JSON, convert it into SphinxBSON blob
-bool sphJsonParse ( CSphVector<BYTE> & dData, char * sData, bool bAutoconv, bool bToLowercase, CSphString & sError );
+/// objects with iKeyDirectory or more keys get a key directory (0 means never)
+bool sphJsonParse ( CSphVector<BYTE> & dData, char * sData, bool bAutoconv, bool bToLowercase, int iKeyDirectory, CSphString & sError );
 
 /// convert SphinxBSON blob back to JSON document
 void sphJsonFormat ( CSphVector<BYTE> & dOut, const BYTE * pData );
@@ -119,6 +121,12 @@ ESphJsonType sphJsonFindByIndex ( ESphJsonType eType, const BYTE ** ppValue, int
 /// split name to object and key parts, return false if not JSON name
 bool sphJsonNameSplit ( const char * sName, CSphString * sColumn, CSphString * sKey );
 
+/// build an expression that reads the raw JSON value behind an extracted column name (eg. j.a.b to j['a']['b'])
+bool sphJsonExtractedExpr ( const char * sName, CSphString & sExpr );
+
+/// fill the typed columns extracted from a given JSON attribute (named as jsoncol.key.path) from its SphinxBSON blob
+void sphJsonExtractColumns ( const CSphSchema & tSchema, const CSphString & sColumn, const BYTE * pData, CSphRowitem * pRow );
+
 /// compute node size, in bytes
 /// returns -1 when data itself is required to compute the size, but pData is NULL
 int sphJsonNodeSize ( ESphJsonType eType, const BYTE * pData );
@@ -719,9 +719,205 @@ void QcacheSetup ( int64_t iMaxBytes, int iThreshMsec, int iTtlSec )
 	g_Qcache.Setup ( iMaxBytes, iThreshMsec, iTtlSec );
 }
 
+//////////////////////////////////////////////////////////////////////////
+// EXPANSION CACHE
+//////////////////////////////////////////////////////////////////////////
+
+/// pre-merged expansion postings cache
+/// keys only get cached on a repeated request, so that one-off wildcards do not flush the popular ones
+class Pcache_c : public PcacheStatus_t
+{
+private:
+	static const int			SEEN_SIZE = 4096;
+
+	CSphMutex					m_tLock;
+	CSphOrderedHash < PcacheEntry_c *, uint64_t, IdentityHash_fn, 1024 >	m_hEntries;
+	uint64_t					m_dSeen [ SEEN_SIZE ];	///< recently missed keys, direct mapped
+	bool						m_dRepeated [ SEEN_SIZE ];	///< whether that key was missed more than once
+	int64_t						m_iTick;
+
+public:
+								Pcache_c();
+								~Pcache_c();
+
+	void						Setup ( int64_t iMaxBytes );
+	PcacheEntry_c *				Find ( int64_t iIndexId, uint64_t uKey );
+	void						Add ( PcacheEntry_c * pEntry );
+	void						DeleteIndex ( int64_t iIndexId );
+
+private:
+	static uint64_t				GetKey ( int64_t iIndexId, uint64_t uKey ) { return sphFNV64 ( &iIndexId, sizeof(iIndexId), uKey ); }
+	void						EnforceLimits ();
+	void						DeleteEntry ( uint64_t uHashKey );
+};
+
+/// expansion cache instance
+Pcache_c						g_Pcache;
+
+
+Pcache_c::Pcache_c()
+	: m_iTick ( 0 )
+{
+	// defaults are here
+	m_iMaxBytes = 16777216;
+#ifndef NDEBUG
+	m_iMaxBytes = 0; // disable expansion cache in debug builds
+#endif
+
+	m_iCachedEntries = 0;
+	m_iUsedBytes = 0;
+	m_iHits = 0;
+
+	for ( int i=0; i<SEEN_SIZE; i++ )
+	{
+		m_dSeen[i] = 0;
+		m_dRepeated[i] = false;
+	}
+}
+
+Pcache_c::~Pcache_c()
+{
+	m_hEntries.IterateStart();
+	while ( m_hEntries.IterateNext() )
+		SafeRelease ( m_hEntries.IterateGet() );
+}
+
+void Pcache_c::Setup ( int64_t iMaxBytes )
+{
+	m_tLock.Lock();
+	m_iMaxBytes = Max ( iMaxBytes, 0 );
+	EnforceLimits();
+	m_tLock.Unlock();
+}
+
+PcacheEntry_c * Pcache_c::Find ( int64_t iIndexId, uint64_t uKey )
+{
+	if ( m_iMaxBytes<=0 || !uKey )
+		return NULL;
+
+	uint64_t uHashKey = GetKey ( iIndexId, uKey );
+	PcacheEntry_c * p = NULL;
+
+	m_tLock.Lock();
+	PcacheEntry_c ** pp = m_hEntries ( uHashKey );
+	if ( pp && (*pp)->m_iIndexId==iIndexId && (*pp)->m_uKey==uKey )
+	{
+		p = *pp;
+		p->AddRef();
+		p->m_iLastUsed = ++m_iTick;
+		m_iHits++;
+	} else
+	{
+		// remember the miss, so that the next request could be cached
+		int iSlot = (int)( uHashKey % SEEN_SIZE );
+		m_dRepeated[iSlot] = ( m_dSeen[iSlot]==uHashKey );
+		m_dSeen[iSlot] = uHashKey;
+	}
+	m_tLock.Unlock();
+
+	return p;
+}
+
+void Pcache_c::Add ( PcacheEntry_c * pEntry )
+{
+	assert ( pEntry );
+	if ( m_iMaxBytes<=0 || !pEntry->m_uKey )
+		return;
+
+	// too big entries would just flush everything else
+	if ( pEntry->GetSize()>m_iMaxBytes/4 )
+		return;
+
+	uint64_t uHashKey = GetKey ( pEntry->m_iIndexId, pEntry->m_uKey );
+
+	int iSlot = (int)( uHashKey % SEEN_SIZE );
+
+	m_tLock.Lock();
+	if ( m_dSeen[iSlot]==uHashKey && m_dRepeated[iSlot] && m_hEntries.Add ( pEntry, uHashKey ) )
+	{
+		pEntry->AddRef();
+		pEntry->m_iLastUsed = ++m_iTick;
+		m_iCachedEntries++;
+		m_iUsedBytes += pEntry->GetSize();
+		m_dSeen[iSlot] = 0;
+		m_dRepeated[iSlot] = false;
+		EnforceLimits();
+	}
+	m_tLock.Unlock();
+}
+
+void Pcache_c::DeleteEntry ( uint64_t uHashKey )
+{
+	PcacheEntry_c ** pp = m_hEntries ( uHashKey );
+	assert ( pp );
+
+	m_iCachedEntries--;
+	m_iUsedBytes -= (*pp)->GetSize();
+	SafeRelease ( *pp );
+	m_hEntries.Delete ( uHashKey );
+}
+
+void Pcache_c::EnforceLimits ()
+{
+	// evict least recently used entries, one by one
+	while ( m_iUsedBytes>m_iMaxBytes && m_iCachedEntries>0 )
+	{
+		uint64_t uOldest = 0;
+		int64_t iOldest = INT64_MAX;
+		m_hEntries.IterateStart();
+		while ( m_hEntries.IterateNext() )
+			if ( m_hEntries.IterateGet()->m_iLastUsed<iOldest )
+			{
+				iOldest = m_hEntries.IterateGet()->m_iLastUsed;
+				uOldest = m_hEntries.IterateGetKey();
+			}
+
+		DeleteEntry ( uOldest );
+	}
+}
+
+void Pcache_c::DeleteIndex ( int64_t iIndexId )
+{
+	m_tLock.Lock();
+
+	CSphVector<uint64_t> dKeys;
+	m_hEntries.IterateStart();
+	while ( m_hEntries.IterateNext() )
+		if ( m_hEntries.IterateGet()->m_iIndexId==iIndexId )
+			dKeys.Add ( m_hEntries.IterateGetKey() );
+
+	ARRAY_FOREACH ( i, dKeys )
+		DeleteEntry ( dKeys[i] );
+
+	m_tLock.Unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void QcacheDeleteIndex ( int64_t iIndexId )
 {
 	g_Qcache.DeleteIndex ( iIndexId );
+	g_Pcache.DeleteIndex ( iIndexId ); // pre-merged expansions are per index generation too
+}
+
+PcacheEntry_c * PcacheFind ( int64_t iIndexId, uint64_t uKey )
+{
+	return g_Pcache.Find ( iIndexId, uKey );
+}
+
+void PcacheAdd ( PcacheEntry_c * pEntry )
+{
+	g_Pcache.Add ( pEntry );
+}
+
+const PcacheStatus_t & PcacheGetStatus()
+{
+	return g_Pcache;
+}
+
+void PcacheSetup ( int64_t iMaxBytes )
+{
+	g_Pcache.Setup ( iMaxBytes );
 }
 
 //
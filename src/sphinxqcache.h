@@ -88,6 +88,58 @@ const QcacheStatus_t &	QcacheGetStatus();
 void					QcacheSetup ( int64_t iMaxBytes, int iThreshMsec, int iTtlSec );
 void					QcacheDeleteIndex ( int64_t iIndexId );
 
+//////////////////////////////////////////////////////////////////////////
+
+/// merged payload entry is a simple {docid,hitpos} pair
+struct ExtPayloadEntry_t
+{
+	SphDocID_t	m_uDocid;
+	Hitpos_t	m_uHitpos;
+
+	bool operator < ( const ExtPayloadEntry_t & rhs ) const
+	{
+		if ( m_uDocid!=rhs.m_uDocid )
+			return ( m_uDocid<rhs.m_uDocid );
+		return ( m_uHitpos<rhs.m_uHitpos );
+	}
+};
+
+/// expansion cache entry
+/// already merged and sorted doclists (and hitlists) of a wildcard expansion payload
+class PcacheEntry_c : public ISphRefcountedMT
+{
+public:
+	int64_t							m_iIndexId;
+	uint64_t						m_uKey;
+	int64_t							m_iLastUsed;	///< lru tick
+	int								m_iDocs;		///< expanded keyword stats
+	int								m_iHits;
+	CSphVector<ExtPayloadEntry_t>	m_dEntries;
+
+public:
+	PcacheEntry_c() : m_iIndexId ( -1 ), m_uKey ( 0 ), m_iLastUsed ( 0 ), m_iDocs ( 0 ), m_iHits ( 0 ) {}
+	int								GetSize() const { return sizeof(*this) + m_dEntries.GetSizeBytes(); }
+};
+
+/// expansion cache status
+struct PcacheStatus_t
+{
+	// settings that can be changed
+	int64_t		m_iMaxBytes;		///< max RAM bytes
+
+	// report-only statistics
+	int			m_iCachedEntries;	///< cached expansions count
+	int64_t		m_iUsedBytes;		///< used RAM bytes
+	int64_t		m_iHits;			///< cache hits
+};
+
+/// returns referenced entry, or NULL
+PcacheEntry_c *			PcacheFind ( int64_t iIndexId, uint64_t uKey );
+/// caches the entry (and adds a reference) if its key was recently requested and missed
+void					PcacheAdd ( PcacheEntry_c * pEntry );
+const PcacheStatus_t &	PcacheGetStatus();
+void					PcacheSetup ( int64_t iMaxBytes );
+
 #endif // _sphinxqcache_
 
 //
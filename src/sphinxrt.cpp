@@ -34,6 +34,10 @@
 #include <sys/time.h>
 #endif
 
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 
 #define BINLOG_WRITE_BUFFER		256*1024
@@ -880,6 +884,11 @@ public:
 	CSphTightVector<DWORD>		m_dMvas;
 	CSphVector<DWORD>			m_dPerDocHitsCount;
 
+	// logical binlog; raw source documents of the txn
+	CSphTightVector<BYTE>		m_dSource;
+	int							m_iSourceDocs;
+	bool						m_bSourceLost;		///< some docs came without source, so txn must be logged as segment
+
 	bool						m_bKeywordDict;
 	CSphDict *					m_pDict;
 
@@ -898,6 +907,9 @@ public:
 	void			Sort ();
 
 	void			AddDocument ( ISphHits * pHits, const CSphMatch & tDoc, bool bReplace, int iRowSize, const char ** ppStr, const CSphVector<DWORD> & dMvas, const CSphVector<JSONAttr_t> & dJson );
+	void			AddSource ( const CSphMatch & tDoc, bool bReplace, int iRowSize, int iFields, const char ** ppFields, const char ** ppStr, const CSphVector<DWORD> & dMvas );
+	bool			HasSource () const { return m_iSourceDocs>0 && !m_bSourceLost; }
+	void			ResetSource ();
 	RtSegment_t *	CreateSegment ( int iRowSize, int iWordsCheckpoint );
 	void			CleanupDuplicates ( int iRowSize );
 	void			GrabLastWarning ( CSphString & sWarning );
@@ -954,6 +966,7 @@ enum Blop_e
 	BLOP_ADD_INDEX		= 3,
 	BLOP_ADD_CACHE		= 4,
 	BLOP_RECONFIGURE	= 5,
+	BLOP_COMMIT_SOURCE	= 6,	///< logical commit; source documents to re-index instead of built segment
 
 	BLOP_TOTAL
 };
@@ -969,6 +982,7 @@ public:
 					BinlogWriter_c ();
 	virtual			~BinlogWriter_c () {}
 
+	bool			OpenFile ( const CSphString & sName, CSphString & sError );
 	virtual	void	Flush ();
 	void			Write ();
 	void			Fsync ();
@@ -1011,20 +1025,24 @@ public:
 	RtBinlog_c ();
 	~RtBinlog_c ();
 
-	void	BinlogCommit ( int64_t * pTID, const char * sIndexName, const RtSegment_t * pSeg, const CSphVector<SphDocID_t> & dKlist, bool bKeywordDict );
+	int64_t	BinlogCommit ( int64_t * pTID, const char * sIndexName, const RtSegment_t * pSeg, const CSphVector<SphDocID_t> & dKlist, bool bKeywordDict, const RtAccum_t * pSource );
+	void	BinlogWaitSynced ( const char * sIndexName, int64_t iTicket );
 	void	BinlogUpdateAttributes ( int64_t * pTID, const char * sIndexName, const CSphAttrUpdate & tUpd );
 	void	BinlogReconfigure ( int64_t * pTID, const char * sIndexName, const CSphReconfigureSetup & tSetup );
 	void	NotifyIndexFlush ( const char * sIndexName, int64_t iTID, bool bShutdown );
 
 	void	Configure ( const CSphConfigSection & hSearchd, bool bTestMode );
-	void	Replay ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback );
+	void	Replay ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback, BinlogReplayed_t * pfnReplayed );
+	void	WaitReplay ();
 
 	void	CreateTimerThread ();
 	bool	IsActive ()			{ return !m_bDisabled; }
+	bool	IsLogical ()		{ return !m_bDisabled && m_bLogical; }
 	void	CheckPath ( const CSphConfigSection & hSearchd, bool bTestMode );
 
 private:
-	static const DWORD		BINLOG_VERSION = 6;
+	static const DWORD		BINLOG_VERSION = 7;
+	static const DWORD		BINLOG_MIN_VERSION = 6;	///< oldest version we can still replay; v.7 only added logical commits
 
 	static const DWORD		BINLOG_HEADER_MAGIC = 0x4c425053;	/// magic 'SPBL' header that marks binlog file
 	static const DWORD		BLOP_MAGIC = 0x214e5854;			/// magic 'TXN!' header that marks binlog entry
@@ -1040,9 +1058,28 @@ private:
 		ACTION_WRITE
 	};
 	OnCommitAction_e		m_eOnCommit;
+	bool					m_bLogical;		///< log source documents instead of built segments where possible
 
 	CSphMutex				m_tWriteLock; // lock on operation
 
+	// group commit; txns enqueued with binlog_flush=1 get written and synced in batches by a writer thread
+	struct SyncWaiter_t
+	{
+		int64_t				m_iTicket;
+		CSphAutoEvent *		m_pEvent;
+	};
+
+	bool					m_bGroupCommit;
+	int						m_iGroupCommitDelay;	///< max delay to collect more txns into a batch, in msec
+	CSphMutex				m_tSyncLock;			///< protects sync queue below
+	int64_t					m_iQueuedTicket;		///< last enqueued txn
+	int64_t					m_iSyncedTicket;		///< last synced txn
+	CSphVector<SyncWaiter_t>	m_dSyncWaiters;
+	CSphAutoEvent			m_tSyncPending;			///< wakes writer thread up
+	bool					m_bSyncStop;
+	bool					m_bSyncThread;			///< whether writer thread is running
+	SphThread_t				m_tSyncThread;
+
 	int						m_iLockFD;
 	CSphString				m_sWriterError;
 	BinlogWriter_c			m_tWriter;
@@ -1050,8 +1087,24 @@ private:
 	mutable CSphVector<BinlogFileDesc_t>	m_dLogFiles; // active log files
 
 	CSphString				m_sLogPath;
+	CSphString				m_sLogName;			///< file name prefix; binlog.<index> for per-index streams
+
+	// per-index streams; in that mode this binlog only routes ops to child binlogs, one per index
+	bool					m_bPerIndex;
+	CSphMutex				m_tStreamsLock;
+	SmallStringHash_T<RtBinlog_c*>	m_hStreams;
+	CSphString				m_sStreamIndex;		///< index that owns this stream
+	CSphIndex *				m_pReplayIndex;		///< the only index a stream replays
+
+	// background replay of per-index streams
+	CSphVector<RtBinlog_c*>	m_dReplayQueue;
+	CSphAtomic				m_iReplayNext;
+	CSphVector<SphThread_t>	m_dReplayThreads;
+	DWORD					m_uReplayFlags;
+	BinlogReplayed_t *		m_pfnReplayed;		///< notify about replayed indexes, if set
 
 	SphThread_t				m_tUpdateTread;
+	bool					m_bUpdateThread;
 	bool					m_bReplayMode; // replay mode indicator
 	bool					m_bDisabled;
 
@@ -1062,17 +1115,30 @@ private:
 
 private:
 	static void				DoAutoFlush ( void * pBinlog );
+	static void				DoGroupCommit ( void * pBinlog );
+	static void				DoReplayStreams ( void * pBinlog );
+	void					AutoFlush ();
+	void					CreateSyncThread ();
+	void					WaitSynced ( int64_t iTicket );
+	void					MarkSynced ( int64_t iTicket );
+	RtBinlog_c *			GetStream ( const char * sIndexName );
+	RtBinlog_c *			FindStream ( const char * sIndexName );
+	RtBinlog_c *			CreateStream ( const char * sIndexName );
+	void					ReplayStreams ( const CSphVector<RtBinlog_c*> & dStreams, bool bBackground );
+	int						ReplayStream ( DWORD uReplayFlags );
+	int						ReplayLogs ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback );
+	void					DropReplayedLogs ();
 	int 					GetWriteIndexID ( const char * sName, int64_t iTID, int64_t tmNow );
 	void					LoadMeta ();
 	void					SaveMeta ();
 	void					LockFile ( bool bLock );
 	void					DoCacheWrite ();
 	void					CheckDoRestart ();
-	void					CheckDoFlush ();
+	int64_t					CheckDoFlush ();
 	void					OpenNewLog ( int iLastState=0 );
 
 	int						ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, int iBinlog );
-	bool					ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c & tReader ) const;
+	bool					ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c & tReader, bool bSource ) const;
 	bool					ReplayUpdateAttributes ( int iBinlog, BinlogReader_c & tReader ) const;
 	bool					ReplayIndexAdd ( int iBinlog, const SmallStringHash_T<CSphIndex*> & hIndexes, BinlogReader_c & tReader ) const;
 	bool					ReplayCacheAdd ( int iBinlog, BinlogReader_c & tReader ) const;
@@ -1178,9 +1244,11 @@ public:
 	virtual bool				DeleteDocument ( const SphDocID_t * pDocs, int iDocs, CSphString & sError, ISphRtAccum * pAccExt );
 	virtual void				Commit ( int * pDeleted, ISphRtAccum * pAccExt );
 	virtual void				RollBack ( ISphRtAccum * pAccExt );
-	void						CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t> & dAccKlist, int * pTotalKilled ); // FIXME? protect?
+	int64_t						CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t> & dAccKlist, int * pTotalKilled, const RtAccum_t * pSource=NULL ); // FIXME? protect?
+	bool						ReplaySource ( const BYTE * pSource, int iLen, int iDocs, CSphVector<SphDocID_t> & dKlist, CSphString & sError );
 	virtual void				CheckRamFlush ();
 	virtual void				ForceRamFlush ( bool bPeriodic=false );
+	bool						IsRamFlushed () const { return m_iTID<=m_iSavedTID; }
 	virtual void				ForceDiskChunk ();
 	virtual bool				AttachDiskIndex ( CSphIndex * pIndex, CSphString & sError );
 	virtual bool				Truncate ( CSphString & sError );
@@ -1193,6 +1261,8 @@ private:
 	/// acquire thread-local indexing accumulator
 	/// returns NULL if another index already uses it in an open txn
 	RtAccum_t *					AcquireAccum ( CSphString * sError, ISphRtAccum * pAccExt, bool bSetTLS );
+	bool						IndexDocument ( ISphTokenizer * pTokenizer, int iFields, const char ** ppFields, const CSphMatch & tDoc, bool bReplace, const CSphString & sTokenFilterOptions, const char ** ppStr, const CSphVector<DWORD> & dMvas, CSphString & sError, CSphString & sWarning, RtAccum_t * pAcc );
+	bool						AddDocumentHits ( ISphHits * pHits, const CSphMatch & tDoc, bool bReplace, const char ** ppStr, const CSphVector<DWORD> & dMvas, CSphString & sError, CSphString & sWarning, RtAccum_t * pAcc );
 	virtual ISphRtAccum *		CreateAccum ( CSphString & sError );
 
 	RtSegment_t *				MergeSegments ( const RtSegment_t * pSeg1, const RtSegment_t * pSeg2, const CSphVector<SphDocID_t> * pAccKlist, bool bHasMorphology );
@@ -1201,7 +1271,7 @@ private:
 	void						CopyDoc ( RtSegment_t * pSeg, RtDocWriter_t & tOutDoc, RtWord_t * pWord, const RtSegment_t * pSrc, const RtDoc_t * pDoc );
 
 	void						SaveMeta ( int iDiskChunks, int64_t iTID );
-	void						SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, int iCheckpoints, SphOffset_t iCheckpointsPosition, DWORD iInfixBlocksOffset, int iInfixCheckpointWordsSize, DWORD uKillListSize, uint64_t uMinMaxSize, const ChunkStats_t & tStats ) const;
+	void						SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, int iCheckpoints, SphOffset_t iCheckpointsPosition, DWORD iInfixBlocksOffset, int iInfixCheckpointWordsSize, int64_t iFstOffset, int64_t iTrigramsOffset, DWORD uKillListSize, uint64_t uMinMaxSize, const ChunkStats_t & tStats ) const;
 	void						SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t & tGuard, const ChunkStats_t & tStats ) const;
 	void						SaveDiskChunk ( int64_t iTID, const SphChunkGuard_t & tGuard, const ChunkStats_t & tStats );
 	CSphIndex *					LoadDiskChunk ( const char * sChunk, CSphString & sError ) const;
@@ -1250,6 +1320,7 @@ public:
 	virtual void				DebugDumpDocids ( FILE * ) {}
 	virtual void				DebugDumpHitlist ( FILE * , const char * , bool ) {}
 	virtual void				DebugDumpDict ( FILE * ) {}
+	virtual void				DebugEstimateReorder ( FILE *, const char * ) {}
 	virtual int					DebugCheck ( FILE * fp );
 #if USE_WINDOWS
 #pragma warning(pop)
@@ -1260,6 +1331,7 @@ public:
 	virtual const CSphSourceStats &		GetStats () const { return m_tStats; }
 	virtual int64_t *					GetFieldLens() const { return m_tSettings.m_bIndexFieldLens ? m_dFieldLens.Begin() : NULL; }
 	virtual void				GetStatus ( CSphIndexStatus* ) const;
+	virtual bool				GetDocidRange ( SphDocID_t & uMin, SphDocID_t & uMax ) const;
 
 	virtual bool				MultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult, int iSorters, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const;
 	virtual bool				MultiQueryEx ( int iQueries, const CSphQuery * ppQueries, CSphQueryResult ** ppResults, ISphMatchSorter ** ppSorters, const CSphMultiQueryArgs & tArgs ) const;
@@ -1551,6 +1623,25 @@ bool RtIndex_t::AddDocument ( ISphTokenizer * pTokenizer, int iFields, const cha
 	if ( !pAcc )
 		return false;
 
+	// logical binlog needs the source to replay; token filter options are per-statement, so those txns have to go as segments
+	if ( g_pRtBinlog->IsLogical() )
+	{
+		if ( m_tSettings.m_sIndexTokenFilter.IsEmpty() )
+			pAcc->AddSource ( tDoc, bReplace, m_tSchema.GetRowSize(), iFields, ppFields, ppStr, dMvas );
+		else
+			pAcc->m_bSourceLost = true;
+	}
+
+	return IndexDocument ( tTokenizer.LeakPtr(), iFields, ppFields, tDoc, bReplace, sTokenFilterOptions, ppStr, dMvas, sError, sWarning, pAcc );
+}
+
+
+bool RtIndex_t::IndexDocument ( ISphTokenizer * pTokenizer, int iFields, const char ** ppFields, const CSphMatch & tDoc,
+	bool bReplace, const CSphString & sTokenFilterOptions, const char ** ppStr, const CSphVector<DWORD> & dMvas,
+	CSphString & sError, CSphString & sWarning, RtAccum_t * pAcc )
+{
+	CSphScopedPtr<ISphTokenizer> tTokenizer ( pTokenizer );
+
 	// OPTIMIZE? do not create filter on each(!) INSERT
 	if ( !m_tSettings.m_sIndexTokenFilter.IsEmpty() )
 	{
@@ -1601,7 +1692,7 @@ bool RtIndex_t::AddDocument ( ISphTokenizer * pTokenizer, int iFields, const cha
 	ISphHits * pHits = tSrc.IterateHits ( sError );
 	pAcc->GrabLastWarning ( sWarning );
 
-	if ( !AddDocument ( pHits, tDoc, bReplace, ppStr, dMvas, sError, sWarning, pAcc ) )
+	if ( !AddDocumentHits ( pHits, tDoc, bReplace, ppStr, dMvas, sError, sWarning, pAcc ) )
 		return false;
 
 	m_tStats.m_iTotalBytes += tSrc.GetStats().m_iTotalBytes;
@@ -1663,7 +1754,16 @@ bool RtIndex_t::AddDocument ( ISphHits * pHits, const CSphMatch & tDoc, bool bRe
 	assert ( g_bRTChangesAllowed );
 
 	RtAccum_t * pAcc = (RtAccum_t *)pAccExt;
+	if ( pAcc )
+		pAcc->m_bSourceLost = true; // no source text here
+
+	return AddDocumentHits ( pHits, tDoc, bReplace, ppStr, dMvas, sError, sWarning, pAcc );
+}
+
 
+bool RtIndex_t::AddDocumentHits ( ISphHits * pHits, const CSphMatch & tDoc, bool bReplace, const char ** ppStr, const CSphVector<DWORD> & dMvas,
+	CSphString & sError, CSphString & sWarning, RtAccum_t * pAcc )
+{
 	if ( pAcc )
 	{
 		CSphVector<JSONAttr_t> dJsonData;
@@ -1686,7 +1786,7 @@ bool RtIndex_t::AddDocument ( ISphHits * pHits, const CSphMatch & tDoc, bool bRe
 					pData[iLen+1] = '\0';
 
 					CSphVector<BYTE> dBuf;
-					if ( !sphJsonParse ( dBuf, pData, g_bJsonAutoconvNumbers, g_bJsonKeynamesToLowercase, sError ) )
+					if ( !sphJsonParse ( dBuf, pData, g_bJsonAutoconvNumbers, g_bJsonKeynamesToLowercase, g_iJsonKeyDirectory, sError ) )
 					{
 						sError.SetSprintf ( "column %s: JSON error: %s", tColumn.m_sName.cstr(), sError.cstr() );
 
@@ -1724,6 +1824,8 @@ bool RtIndex_t::AddDocument ( ISphHits * pHits, const CSphMatch & tDoc, bool bRe
 
 RtAccum_t::RtAccum_t ( bool bKeywordDict )
 	: m_iAccumDocs ( 0 )
+	, m_iSourceDocs ( 0 )
+	, m_bSourceLost ( false )
 	, m_bKeywordDict ( bKeywordDict )
 	, m_pDict ( NULL )
 	, m_pRefDict ( NULL )
@@ -1777,6 +1879,69 @@ void RtAccum_t::ResetDict ()
 	}
 }
 
+static void SourcePut ( CSphTightVector<BYTE> & dBuf, const void * pData, int iLen )
+{
+	int iOff = dBuf.GetLength();
+	dBuf.Resize ( iOff+iLen );
+	if ( iLen )
+		memcpy ( dBuf.Begin()+iOff, pData, iLen );
+}
+
+static void SourcePutDword ( CSphTightVector<BYTE> & dBuf, DWORD uVal )
+{
+	SourcePut ( dBuf, &uVal, sizeof(uVal) );
+}
+
+static void SourcePutString ( CSphTightVector<BYTE> & dBuf, const char * sVal )
+{
+	DWORD uLen = sVal ? strlen ( sVal ) : 0;
+	SourcePutDword ( dBuf, uLen );
+	SourcePut ( dBuf, sVal, uLen );
+}
+
+/// save raw document for logical binlog
+/// must be called before indexing, as JSON attrs get parsed in place
+void RtAccum_t::AddSource ( const CSphMatch & tDoc, bool bReplace, int iRowSize, int iFields, const char ** ppFields,
+	const char ** ppStr, const CSphVector<DWORD> & dMvas )
+{
+	if ( m_bSourceLost )
+		return;
+
+	MEMORY ( MEM_RT_ACCUM );
+
+	const CSphSchema & tSchema = m_pIndex->GetInternalSchema();
+	int iStrings = 0;
+	for ( int i=0; i<tSchema.GetAttrsCount(); i++ )
+		if ( tSchema.GetAttr(i).m_eAttrType==SPH_ATTR_STRING || tSchema.GetAttr(i).m_eAttrType==SPH_ATTR_JSON )
+			iStrings++;
+
+	SourcePut ( m_dSource, &tDoc.m_uDocID, sizeof(tDoc.m_uDocID) );
+	m_dSource.Add ( bReplace ? 1 : 0 );
+
+	SourcePutDword ( m_dSource, iRowSize );
+	SourcePut ( m_dSource, tDoc.m_pDynamic, iRowSize*sizeof(CSphRowitem) );
+
+	SourcePutDword ( m_dSource, iFields );
+	for ( int i=0; i<iFields; i++ )
+		SourcePutString ( m_dSource, ppFields[i] );
+
+	SourcePutDword ( m_dSource, iStrings );
+	for ( int i=0; i<iStrings; i++ )
+		SourcePutString ( m_dSource, ppStr ? ppStr[i] : NULL );
+
+	SourcePutDword ( m_dSource, dMvas.GetLength() );
+	SourcePut ( m_dSource, dMvas.Begin(), dMvas.GetLength()*sizeof(DWORD) );
+
+	m_iSourceDocs++;
+}
+
+void RtAccum_t::ResetSource ()
+{
+	m_dSource.Resize ( 0 );
+	m_iSourceDocs = 0;
+	m_bSourceLost = false;
+}
+
 void RtAccum_t::Sort ()
 {
 	if ( !m_bKeywordDict )
@@ -1839,6 +2004,9 @@ void RtAccum_t::AddDocument ( ISphHits * pHits, const CSphMatch & tDoc, bool bRe
 				bJsonCleanup = true;
 			}
 
+			if ( tColumn.m_eAttrType==SPH_ATTR_JSON )
+				sphJsonExtractColumns ( tSchema, tColumn.m_sName, iLen ? (const BYTE*)pStr : NULL, pAttrs );
+
 			if ( pStr && iLen )
 			{
 				BYTE dLen[3];
@@ -2891,6 +3059,7 @@ void RtIndex_t::Commit ( int * pDeleted, ISphRtAccum * pAccExt )
 		pAcc->m_dMvas.Resize ( 1 );
 		pAcc->m_dPerDocHitsCount.Resize ( 0 );
 		pAcc->ResetDict();
+		pAcc->ResetSource();
 		return;
 	}
 
@@ -2924,18 +3093,165 @@ void RtIndex_t::Commit ( int * pDeleted, ISphRtAccum * pAccExt )
 	pAcc->m_dAccumKlist.Uniq ();
 
 	// now on to the stuff that needs locking and recovery
-	CommitReplayable ( pNewSeg, pAcc->m_dAccumKlist, pDeleted );
+	int64_t iBinlogTicket = CommitReplayable ( pNewSeg, pAcc->m_dAccumKlist, pDeleted, pAcc );
+
+	// group commit; do not report success until txn is synced, but let other writers go meanwhile
+	g_pRtBinlog->BinlogWaitSynced ( m_sIndexName.cstr(), iBinlogTicket );
 
 	// done; cleanup accum
 	pAcc->SetIndex ( NULL );
 	pAcc->m_iAccumDocs = 0;
 	pAcc->m_dAccumKlist.Reset();
+	pAcc->ResetSource();
 	// reset accumulated warnings
 	CSphString sWarning;
 	pAcc->GrabLastWarning ( sWarning );
 }
 
-void RtIndex_t::CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t> & dAccKlist, int * pTotalKilled )
+/// reader over raw documents saved by RtAccum_t::AddSource()
+class SourceReader_c
+{
+public:
+	SourceReader_c ( const BYTE * pData, int iLen )
+		: m_pCur ( pData )
+		, m_pMax ( pData+iLen )
+		, m_bError ( false )
+	{}
+
+	bool GetDocument ( CSphMatch & tDoc, bool & bReplace, CSphVector<CSphString> & dFields, CSphVector<CSphString> & dStrings, CSphVector<DWORD> & dMvas )
+	{
+		GetBytes ( &tDoc.m_uDocID, sizeof(tDoc.m_uDocID) );
+		BYTE uReplace = 0;
+		GetBytes ( &uReplace, 1 );
+		bReplace = ( uReplace!=0 );
+
+		int iRowSize = GetDword();
+		if ( m_bError || iRowSize!=(int)tDoc.m_pDynamic[-1] )
+			return false;
+		GetBytes ( tDoc.m_pDynamic, iRowSize*sizeof(CSphRowitem) );
+
+		// every string takes at least its length dword
+		dFields.Resize ( GetCount ( sizeof(DWORD) ) );
+		ARRAY_FOREACH_COND ( i, dFields, !m_bError )
+			GetString ( dFields[i] );
+
+		dStrings.Resize ( GetCount ( sizeof(DWORD) ) );
+		ARRAY_FOREACH_COND ( i, dStrings, !m_bError )
+			GetString ( dStrings[i] );
+
+		dMvas.Resize ( GetCount ( sizeof(DWORD) ) );
+		GetBytes ( dMvas.Begin(), dMvas.GetLength()*sizeof(DWORD) );
+		return !m_bError;
+	}
+
+private:
+	const BYTE *	m_pCur;
+	const BYTE *	m_pMax;
+	bool			m_bError;
+
+	void GetBytes ( void * pBuf, int iLen )
+	{
+		if ( m_bError || iLen<0 || iLen>m_pMax-m_pCur )
+		{
+			m_bError = true;
+			return;
+		}
+		if ( iLen )
+			memcpy ( pBuf, m_pCur, iLen );
+		m_pCur += iLen;
+	}
+
+	DWORD GetDword ()
+	{
+		DWORD uVal = 0;
+		GetBytes ( &uVal, sizeof(uVal) );
+		return m_bError ? 0 : uVal;
+	}
+
+	/// count of the items that follow, each iItemBytes or more; 0 and error if they can't fit into the rest of the data
+	int GetCount ( int iItemBytes )
+	{
+		DWORD uCount = GetDword();
+		if ( m_bError || uCount>(DWORD)( ( m_pMax-m_pCur )/iItemBytes ) )
+		{
+			m_bError = true;
+			return 0;
+		}
+		return (int)uCount;
+	}
+
+	void GetString ( CSphString & sVal )
+	{
+		int iLen = GetDword();
+		if ( m_bError || iLen<0 || iLen>m_pMax-m_pCur )
+		{
+			m_bError = true;
+			return;
+		}
+		CSphString sTmp;
+		if ( iLen )
+			sTmp.SetBinary ( (const char *)m_pCur, iLen );
+		sVal.Swap ( sTmp );
+		m_pCur += iLen;
+	}
+};
+
+
+/// re-tokenize source documents from logical binlog, and commit them; binlog replay only
+bool RtIndex_t::ReplaySource ( const BYTE * pSource, int iLen, int iDocs, CSphVector<SphDocID_t> & dKlist, CSphString & sError )
+{
+	MEMORY ( MEM_INDEX_RT );
+
+	RtAccum_t tAcc ( m_bKeywordDict );
+	tAcc.SetIndex ( this );
+	tAcc.SetupDict ( this, m_pDict, m_bKeywordDict );
+
+	SourceReader_c tReader ( pSource, iLen );
+	CSphMatch tDoc;
+	tDoc.Reset ( m_tSchema.GetRowSize() );
+
+	CSphVector<CSphString> dFields, dStrings;
+	CSphVector<const char *> dFieldPtrs, dStrPtrs;
+	CSphVector<DWORD> dMvas;
+	CSphString sWarning;
+	for ( int iDoc=0; iDoc<iDocs; iDoc++ )
+	{
+		bool bReplace = false;
+		if ( !tReader.GetDocument ( tDoc, bReplace, dFields, dStrings, dMvas ) )
+		{
+			sError.SetSprintf ( "broken source document %d", iDoc );
+			return false;
+		}
+
+		// strings live in CSphString, so there's room for the extra zero that JSON parser wants
+		dFieldPtrs.Resize ( dFields.GetLength() );
+		ARRAY_FOREACH ( i, dFields )
+			dFieldPtrs[i] = dFields[i].cstr();
+		dStrPtrs.Resize ( dStrings.GetLength() );
+		ARRAY_FOREACH ( i, dStrings )
+			dStrPtrs[i] = dStrings[i].cstr();
+
+		if ( !IndexDocument ( CloneIndexingTokenizer(), dFieldPtrs.GetLength(), dFieldPtrs.Begin(), tDoc, bReplace, CSphString(),
+			dStrPtrs.Begin(), dMvas, sError, sWarning, &tAcc ) )
+			return false;
+	}
+
+	// same as Commit() does
+	tAcc.CleanupDuplicates ( m_tSchema.GetRowSize() );
+	tAcc.Sort();
+
+	RtSegment_t * pNewSeg = tAcc.CreateSegment ( m_tSchema.GetRowSize(), m_iWordsCheckpoint );
+	BuildSegmentInfixes ( pNewSeg, m_pDict->HasMorphology() );
+
+	// accum kill-list also got ids of re-added docs, but logged one already has them
+	dKlist.Uniq();
+	CommitReplayable ( pNewSeg, dKlist, NULL );
+	return true;
+}
+
+/// returns binlog ticket that must be synced before the commit is reported
+/// pSource is accumulator the segment was built from, to log source docs rather than segment (if it has them)
+int64_t RtIndex_t::CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t> & dAccKlist, int * pTotalKilled, const RtAccum_t * pSource )
 {
 	// store statistics, because pNewSeg just might get merged
 	int iNewDocs = pNewSeg ? pNewSeg->m_iRows : 0;
@@ -2959,7 +3275,7 @@ void RtIndex_t::CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t>
 	Verify ( m_tWriting.Lock() );
 
 	// first of all, binlog txn data for recovery
-	g_pRtBinlog->BinlogCommit ( &m_iTID, m_sIndexName.cstr(), pNewSeg, dAccKlist, m_bKeywordDict );
+	int64_t iBinlogTicket = g_pRtBinlog->BinlogCommit ( &m_iTID, m_sIndexName.cstr(), pNewSeg, dAccKlist, m_bKeywordDict, pSource );
 	int64_t iTID = m_iTID;
 
 	// let merger know that existing segments are subject to additional, TLS K-list filter
@@ -3259,7 +3575,7 @@ void RtIndex_t::CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t>
 	{
 		// all done, enable other writers
 		Verify ( m_tWriting.Unlock() );
-		return;
+		return iBinlogTicket;
 	}
 
 	// scope for guard then retired clean up
@@ -3279,6 +3595,8 @@ void RtIndex_t::CommitReplayable ( RtSegment_t * pNewSeg, CSphVector<SphDocID_t>
 		SaveDiskChunk ( iTID, tGuard, tStat2Dump );
 		g_pBinlog->NotifyIndexFlush ( m_sIndexName.cstr(), iTID, false );
 	}
+
+	return iBinlogTicket;
 }
 
 
@@ -3317,6 +3635,7 @@ void RtIndex_t::RollBack ( ISphRtAccum * pAccExt )
 	pAcc->SetIndex ( NULL );
 	pAcc->m_iAccumDocs = 0;
 	pAcc->m_dAccumKlist.Reset();
+	pAcc->ResetSource();
 }
 
 bool RtIndex_t::DeleteDocument ( const SphDocID_t * pDocs, int iDocs, CSphString & sError, ISphRtAccum * pAccExt )
@@ -3556,6 +3875,14 @@ void RtIndex_t::SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t
 	if ( m_tSettings.m_iMinInfixLen && m_pDict->GetSettings().m_bWordDict )
 		pInfixer = sphCreateInfixBuilder ( m_pTokenizer->GetMaxCodepointLength(), &sError );
 
+	CSphScopedPtr<KeywordsFstBuilder_c> pFst ( NULL );
+	if ( m_tSettings.m_bDictFst && m_bKeywordDict )
+		pFst = new KeywordsFstBuilder_c();
+
+	CSphScopedPtr<InfixTrigramsBuilder_c> pTrigrams ( NULL );
+	if ( m_tSettings.m_bInfixTrigrams && m_tSettings.m_iMinInfixLen && m_bKeywordDict )
+		pTrigrams = new InfixTrigramsBuilder_c();
+
 	for ( ;; )
 	{
 		// find keyword with min id
@@ -3742,6 +4069,12 @@ void RtIndex_t::SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t
 				// build infixes
 				if ( pInfixer.Ptr() )
 					pInfixer->AddWord ( pWord->m_sWord+1, pWord->m_sWord[0], dCheckpoints.GetLength(), bHasMorphology );
+
+				if ( pFst.Ptr() )
+					pFst->AddWord ( pWord->m_sWord+1, pWord->m_sWord[0] );
+
+				if ( pTrigrams.Ptr() )
+					pTrigrams->AddWord ( pWord->m_sWord+1, pWord->m_sWord[0], bHasMorphology );
 			}
 
 			// emit skiplist pointer
@@ -3827,6 +4160,16 @@ void RtIndex_t::SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t
 			sphWarning ( "INTERNAL ERROR: dictionary size " INT64_FMT " overflow at infix save", iInfixBlockOffset );
 	}
 
+	// flush keywords FST
+	int64_t iFstOffset = 0;
+	if ( pFst.Ptr() )
+		iFstOffset = pFst->Save ( wrDict );
+
+	// flush infix trigrams
+	int64_t iTrigramsOffset = 0;
+	if ( pTrigrams.Ptr() )
+		iTrigramsOffset = pTrigrams->Save ( wrDict );
+
 	// flush header
 	// mostly for debugging convenience
 	// primary storage is in the index wide header
@@ -3847,7 +4190,7 @@ void RtIndex_t::SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t
 
 	// header
 	SaveDiskHeader ( sFilename, iMinDocID, dCheckpoints.GetLength(), iCheckpointsPosition, (DWORD)iInfixBlockOffset, iInfixCheckpointWordsSize,
-		m_dDiskChunkKlist.GetLength(), uMinMaxOff, tStats );
+		iFstOffset, iTrigramsOffset, m_dDiskChunkKlist.GetLength(), uMinMaxOff, tStats );
 
 	// cleanup
 	ARRAY_FOREACH ( i, pWordReaders )
@@ -3867,10 +4210,10 @@ void RtIndex_t::SaveDiskDataImpl ( const char * sFilename, const SphChunkGuard_t
 
 
 void RtIndex_t::SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, int iCheckpoints,
-	SphOffset_t iCheckpointsPosition, DWORD iInfixBlocksOffset, int iInfixCheckpointWordsSize, DWORD uKillListSize, uint64_t uMinMaxSize,
+	SphOffset_t iCheckpointsPosition, DWORD iInfixBlocksOffset, int iInfixCheckpointWordsSize, int64_t iFstOffset, int64_t iTrigramsOffset, DWORD uKillListSize, uint64_t uMinMaxSize,
 	const ChunkStats_t & tStats ) const
 {
-	static const DWORD INDEX_FORMAT_VERSION	= 39;			///< my format version
+	static const DWORD INDEX_FORMAT_VERSION	= 47;			///< my format version
 
 	CSphWriter tWriter;
 	CSphString sName, sError;
@@ -3898,10 +4241,13 @@ void RtIndex_t::SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, i
 	tWriter.PutByte ( iInfixCodepointBytes ); // m_iInfixCodepointBytes, v.27+
 	tWriter.PutDword ( iInfixBlocksOffset ); // m_iInfixBlocksOffset, v.27+
 	tWriter.PutDword ( iInfixCheckpointWordsSize ); // m_iInfixCheckpointWordsSize, v.34+
+	tWriter.PutOffset ( iFstOffset ); // m_iFstOffset, v.43+
+	tWriter.PutOffset ( iTrigramsOffset ); // m_iTrigramsOffset, v.44+
 
 	// stats
 	tWriter.PutDword ( (DWORD)tStats.m_Stats.m_iTotalDocuments ); // FIXME? we don't expect over 4G docs per just 1 local index
 	tWriter.PutOffset ( tStats.m_Stats.m_iTotalBytes );
+	tWriter.PutDword ( 0 ); // m_iTotalDups, v.40+
 
 	// index settings
 	tWriter.PutDword ( m_tSettings.m_iMinPrefixLen );
@@ -3924,6 +4270,12 @@ void RtIndex_t::SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, i
 	tWriter.PutByte ( m_tSettings.m_bIndexFieldLens ); // v. 35+
 	tWriter.PutByte ( m_tSettings.m_eChineseRLP ); // v. 39+
 	tWriter.PutString ( m_tSettings.m_sRLPContext ); // v. 39+
+	tWriter.PutString ( m_tSettings.m_sIndexTokenFilter ); // v. 41+
+	tWriter.PutByte ( m_tSettings.m_bDictFst ? 1 : 0 ); // v. 43+
+	tWriter.PutByte ( m_tSettings.m_bInfixTrigrams ? 1 : 0 ); // v. 44+
+	tWriter.PutString ( m_tSettings.m_sGeoLat ); // v. 46+
+	tWriter.PutString ( m_tSettings.m_sGeoLon ); // v. 46+
+	tWriter.PutString ( m_tSettings.m_sSortByAttr ); // v. 47+
 
 	// tokenizer
 	SaveTokenizerSettings ( tWriter, m_pTokenizer, m_tSettings.m_iEmbeddedLimit );
@@ -3945,6 +4297,9 @@ void RtIndex_t::SaveDiskHeader ( const char * sFilename, SphDocID_t iMinDocID, i
 		ARRAY_FOREACH ( i, m_tSchema.m_dFields )
 			tWriter.PutOffset ( tStats.m_dFieldLens[i] );
 
+	// string dictionaries, v.45+
+	tWriter.PutDword ( 0 );
+
 	// done
 	tWriter.CloseFile ();
 }
@@ -4190,7 +4545,11 @@ bool RtIndex_t::Prealloc ( bool bStripPath )
 		// load them settings
 		DWORD uSettingsVer = rdMeta.GetDword();
 		ReadSchema ( rdMeta, m_tSchema, uSettingsVer, false );
+		bool bConfigDictFst = m_tSettings.m_bDictFst;
 		LoadIndexSettings ( m_tSettings, rdMeta, uSettingsVer );
+		if ( m_tSettings.m_bDictFst!=bConfigDictFst )
+			sphWarning ( "index '%s': dict_fst=%d from config differs from dict_fst=%d stored in meta, using stored value",
+				m_sIndexName.cstr(), bConfigDictFst ? 1 : 0, m_tSettings.m_bDictFst ? 1 : 0 );
 		if ( !LoadTokenizerSettings ( rdMeta, tTokenizerSettings, tEmbeddedFiles, uSettingsVer, m_sLastError ) )
 			return false;
 		LoadDictionarySettings ( rdMeta, tDictSettings, tEmbeddedFiles, uSettingsVer, sWarning );
@@ -5584,6 +5943,13 @@ int RtIndex_t::DebugCheck ( FILE * fp )
 						break;
 					}
 
+					case JSON_KEYDIR:
+					{
+						for ( int iLen=sphJsonUnpackInt ( &p ); iLen; iLen-- )
+							sphJsonLoadBigint ( &p ); // key hash and entry offset
+						break;
+					}
+
 					case JSON_INT64_VECTOR:
 					case JSON_DOUBLE_VECTOR:
 					{
@@ -6963,6 +7329,9 @@ bool RtIndex_t::MultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult
 	assert ( ppSorters );
 	assert ( pResult );
 
+	CSphMatchArena tArena;
+	tArena.Start();
+
 	// to avoid the checking of a ppSorters's element for NULL on every next step, just filter out all nulls right here
 	CSphVector<ISphMatchSorter*> dSorters;
 	dSorters.Reserve ( iSorters );
@@ -7168,6 +7537,7 @@ bool RtIndex_t::MultiQuery ( const CSphQuery * pQuery, CSphQueryResult * pResult
 		if ( tChunkResult.m_bArenaProhibit )
 			tMvaArenaFlag.BitSet ( iChunk );
 		pResult->m_iBadRows += tChunkResult.m_iBadRows;
+		pResult->m_iUnscannedRows += tChunkResult.m_iUnscannedRows;
 
 		if ( pResult->m_bHasPrediction )
 		{
@@ -7964,6 +8334,13 @@ int RtIndex_t::UpdateAttributes ( const CSphAttrUpdate & tUpd, int iIndex, CSphS
 	{
 		int iIdx = m_tSchema.GetAttrIndex ( tUpd.m_dAttrs[i] );
 
+		// typed columns extracted from JSON must stay in sync with the JSON value itself
+		if ( iIdx>=0 && sphJsonNameSplit ( tUpd.m_dAttrs[i], NULL, NULL ) )
+		{
+			sError.SetSprintf ( "attribute '%s' is extracted from JSON and can not be updated (use REPLACE instead)", tUpd.m_dAttrs[i] );
+			return -1;
+		}
+
 		if ( iIdx<0 )
 		{
 			CSphString sJsonCol, sJsonKey;
@@ -9109,6 +9486,37 @@ void RtIndex_t::GetStatus ( CSphIndexStatus * pRes ) const
 	Verify ( m_tChunkLock.Unlock() );
 }
 
+
+bool RtIndex_t::GetDocidRange ( SphDocID_t & uMin, SphDocID_t & uMax ) const
+{
+	SphChunkGuard_t tGuard;
+	GetReaderChunks ( tGuard );
+
+	uMin = DOCID_MAX;
+	uMax = 0;
+
+	// rows of every segment are sorted by docid
+	ARRAY_FOREACH ( i, tGuard.m_dRamChunks )
+	{
+		const RtSegment_t * pSeg = tGuard.m_dRamChunks[i];
+		if ( !pSeg->m_iRows )
+			continue;
+		uMin = Min ( uMin, DOCINFO2ID ( pSeg->m_dRows.Begin() ) );
+		uMax = Max ( uMax, DOCINFO2ID ( pSeg->m_dRows.Begin() + ( pSeg->m_iRows-1 )*m_iStride ) );
+	}
+
+	ARRAY_FOREACH ( i, tGuard.m_dDiskChunks )
+	{
+		SphDocID_t uChunkMin, uChunkMax;
+		if ( !tGuard.m_dDiskChunks[i]->GetDocidRange ( uChunkMin, uChunkMax ) )
+			return false;
+		uMin = Min ( uMin, uChunkMin );
+		uMax = Max ( uMax, uChunkMax );
+	}
+
+	return uMin<=uMax;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // RECONFIGURE
 //////////////////////////////////////////////////////////////////////////
@@ -9307,10 +9715,10 @@ CSphReconfigureSetup::~CSphReconfigureSetup()
 extern DWORD g_dSphinxCRC32 [ 256 ];
 
 
-static CSphString MakeBinlogName ( const char * sPath, int iExt )
+static CSphString MakeBinlogName ( const char * sPath, const char * sLogName, int iExt )
 {
 	CSphString sName;
-	sName.SetSprintf ( "%s/binlog.%03d", sPath, iExt );
+	sName.SetSprintf ( "%s/%s.%03d", sPath, sLogName, iExt );
 	return sName;
 }
 
@@ -9324,6 +9732,16 @@ BinlogWriter_c::BinlogWriter_c ()
 }
 
 
+bool BinlogWriter_c::OpenFile ( const CSphString & sName, CSphString & sError )
+{
+	// positions are per file; stale ones from the previous log could make Fsync() skip the new one
+	m_iLastWritePos = 0;
+	m_iLastFsyncPos = 0;
+	ResetCrc();
+	return CSphWriter::OpenFile ( sName, sError );
+}
+
+
 void BinlogWriter_c::ResetCrc ()
 {
 	m_uCRC = ~((DWORD)0);
@@ -9466,7 +9884,20 @@ RtBinlog_c::RtBinlog_c ()
 	: m_iFlushTimeLeft ( 0 )
 	, m_iFlushPeriod ( BINLOG_AUTO_FLUSH )
 	, m_eOnCommit ( ACTION_NONE )
+	, m_bLogical ( false )
+	, m_bGroupCommit ( false )
+	, m_iGroupCommitDelay ( 0 )
+	, m_iQueuedTicket ( 0 )
+	, m_iSyncedTicket ( 0 )
+	, m_bSyncStop ( false )
+	, m_bSyncThread ( false )
 	, m_iLockFD ( -1 )
+	, m_sLogName ( "binlog" )
+	, m_bPerIndex ( false )
+	, m_pReplayIndex ( NULL )
+	, m_uReplayFlags ( 0 )
+	, m_pfnReplayed ( NULL )
+	, m_bUpdateThread ( false )
 	, m_bReplayMode ( false )
 	, m_bDisabled ( true )
 	, m_iRestartSize ( 0 )
@@ -9480,10 +9911,26 @@ RtBinlog_c::~RtBinlog_c ()
 {
 	if ( !m_bDisabled )
 	{
+		WaitReplay();
+
 		m_iFlushPeriod = 0;
-		if ( m_eOnCommit!=ACTION_FSYNC )
+		if ( m_bUpdateThread )
 			sphThreadJoin ( &m_tUpdateTread );
 
+		m_hStreams.IterateStart();
+		while ( m_hStreams.IterateNext() )
+			SafeDelete ( m_hStreams.IterateGet() );
+
+		if ( m_bSyncThread )
+		{
+			Verify ( m_tSyncLock.Lock() );
+			m_bSyncStop = true;
+			m_tSyncPending.SetEvent();
+			Verify ( m_tSyncLock.Unlock() );
+			sphThreadJoin ( &m_tSyncThread );
+			m_tSyncPending.Done();
+		}
+
 		DoCacheWrite();
 		m_tWriter.CloseFile();
 		LockFile ( false );
@@ -9491,13 +9938,33 @@ RtBinlog_c::~RtBinlog_c ()
 }
 
 
-void RtBinlog_c::BinlogCommit ( int64_t * pTID, const char * sIndexName, const RtSegment_t * pSeg,
-	const CSphVector<SphDocID_t> & dKlist, bool bKeywordDict )
+int64_t RtBinlog_c::BinlogCommit ( int64_t * pTID, const char * sIndexName, const RtSegment_t * pSeg,
+	const CSphVector<SphDocID_t> & dKlist, bool bKeywordDict, const RtAccum_t * pSource )
 {
 	if ( m_bReplayMode || m_bDisabled )
-		return;
+		return 0;
+
+	if ( m_bPerIndex )
+		return GetStream ( sIndexName )->BinlogCommit ( pTID, sIndexName, pSeg, dKlist, bKeywordDict, pSource );
 
 	MEMORY ( MEM_BINLOG );
+
+	// logical commit; pack source docs before taking the lock
+	bool bSource = pSeg && pSeg->m_iRows && pSource && pSource->HasSource();
+	CSphVector<BYTE> dPacked;
+#if USE_ZLIB
+	if ( bSource )
+	{
+		uLongf uPacked = compressBound ( pSource->m_dSource.GetLength() );
+		dPacked.Resize ( (int)uPacked );
+		if ( compress2 ( dPacked.Begin(), &uPacked, pSource->m_dSource.Begin(), pSource->m_dSource.GetLength(), Z_BEST_SPEED )==Z_OK
+			&& (int)uPacked<pSource->m_dSource.GetLength() )
+			dPacked.Resize ( (int)uPacked );
+		else
+			dPacked.Reset();
+	}
+#endif
+
 	Verify ( m_tWriteLock.Lock() );
 
 	int64_t iTID = ++(*pTID);
@@ -9508,13 +9975,23 @@ void RtBinlog_c::BinlogCommit ( int64_t * pTID, const char * sIndexName, const R
 	m_tWriter.PutDword ( BLOP_MAGIC );
 	m_tWriter.ResetCrc ();
 
-	m_tWriter.ZipOffset ( BLOP_COMMIT );
+	m_tWriter.ZipOffset ( bSource ? BLOP_COMMIT_SOURCE : BLOP_COMMIT );
 	m_tWriter.ZipOffset ( uIndex );
 	m_tWriter.ZipOffset ( iTID );
 	m_tWriter.ZipOffset ( tmNow );
 
 	// save txn data
-	if ( !pSeg || !pSeg->m_iRows )
+	if ( bSource )
+	{
+		// docs, raw length, packed length (0 if stored as is), data
+		m_tWriter.ZipOffset ( pSource->m_iSourceDocs );
+		m_tWriter.ZipOffset ( pSource->m_dSource.GetLength() );
+		m_tWriter.ZipOffset ( dPacked.GetLength() );
+		if ( dPacked.GetLength() )
+			m_tWriter.PutBytes ( dPacked.Begin(), dPacked.GetLength() );
+		else
+			m_tWriter.PutBytes ( pSource->m_dSource.Begin(), pSource->m_dSource.GetLength() );
+	} else if ( !pSeg || !pSeg->m_iRows )
 	{
 		m_tWriter.ZipOffset ( 0 );
 	} else
@@ -9551,9 +10028,52 @@ void RtBinlog_c::BinlogCommit ( int64_t * pTID, const char * sIndexName, const R
 	m_tWriter.WriteCrc ();
 
 	// finalize
-	CheckDoFlush();
+	int64_t iTicket = CheckDoFlush();
 	CheckDoRestart();
 	Verify ( m_tWriteLock.Unlock() );
+	return iTicket;
+}
+
+
+/// wait until txn gets synced by group commit writer thread
+void RtBinlog_c::BinlogWaitSynced ( const char * sIndexName, int64_t iTicket )
+{
+	if ( !iTicket )
+		return;
+
+	RtBinlog_c * pStream = m_bPerIndex ? FindStream ( sIndexName ) : this;
+	if ( pStream )
+		pStream->WaitSynced ( iTicket );
+}
+
+void RtBinlog_c::WaitSynced ( int64_t iTicket )
+{
+	if ( !iTicket )
+		return;
+
+	CSphAutoEvent tSynced;
+	tSynced.Init ( &m_tSyncLock );
+
+	Verify ( m_tSyncLock.Lock() );
+	bool bSynced = ( m_iSyncedTicket>=iTicket );
+	if ( !bSynced )
+	{
+		SyncWaiter_t & tWaiter = m_dSyncWaiters.Add();
+		tWaiter.m_iTicket = iTicket;
+		tWaiter.m_pEvent = &tSynced;
+	}
+	Verify ( m_tSyncLock.Unlock() );
+
+	while ( !bSynced )
+	{
+		tSynced.WaitEvent();
+
+		Verify ( m_tSyncLock.Lock() );
+		bSynced = ( m_iSyncedTicket>=iTicket );
+		Verify ( m_tSyncLock.Unlock() );
+	}
+
+	tSynced.Done();
 }
 
 void RtBinlog_c::BinlogUpdateAttributes ( int64_t * pTID, const char * sIndexName, const CSphAttrUpdate & tUpd )
@@ -9561,6 +10081,12 @@ void RtBinlog_c::BinlogUpdateAttributes ( int64_t * pTID, const char * sIndexNam
 	if ( m_bReplayMode || m_bDisabled )
 		return;
 
+	if ( m_bPerIndex )
+	{
+		GetStream ( sIndexName )->BinlogUpdateAttributes ( pTID, sIndexName, tUpd );
+		return;
+	}
+
 	MEMORY ( MEM_BINLOG );
 	Verify ( m_tWriteLock.Lock() );
 
@@ -9606,9 +10132,10 @@ void RtBinlog_c::BinlogUpdateAttributes ( int64_t * pTID, const char * sIndexNam
 	m_tWriter.WriteCrc ();
 
 	// finalize
-	CheckDoFlush();
+	int64_t iTicket = CheckDoFlush();
 	CheckDoRestart();
 	Verify ( m_tWriteLock.Unlock() );
+	WaitSynced ( iTicket );
 }
 
 void RtBinlog_c::BinlogReconfigure ( int64_t * pTID, const char * sIndexName, const CSphReconfigureSetup & tSetup )
@@ -9616,6 +10143,12 @@ void RtBinlog_c::BinlogReconfigure ( int64_t * pTID, const char * sIndexName, co
 	if ( m_bReplayMode || m_bDisabled )
 		return;
 
+	if ( m_bPerIndex )
+	{
+		GetStream ( sIndexName )->BinlogReconfigure ( pTID, sIndexName, tSetup );
+		return;
+	}
+
 	MEMORY ( MEM_BINLOG );
 	Verify ( m_tWriteLock.Lock() );
 
@@ -9642,9 +10175,10 @@ void RtBinlog_c::BinlogReconfigure ( int64_t * pTID, const char * sIndexName, co
 	m_tWriter.WriteCrc ();
 
 	// finalize
-	CheckDoFlush();
+	int64_t iTicket = CheckDoFlush();
 	CheckDoRestart();
 	Verify ( m_tWriteLock.Unlock() );
+	WaitSynced ( iTicket );
 }
 
 
@@ -9657,6 +10191,14 @@ void RtBinlog_c::NotifyIndexFlush ( const char * sIndexName, int64_t iTID, bool
 	if ( m_bReplayMode || m_bDisabled )
 		return;
 
+	if ( m_bPerIndex )
+	{
+		RtBinlog_c * pStream = FindStream ( sIndexName );
+		if ( pStream )
+			pStream->NotifyIndexFlush ( sIndexName, iTID, bShutdown );
+		return;
+	}
+
 	MEMORY ( MEM_BINLOG );
 	assert ( bShutdown || m_dLogFiles.GetLength() );
 
@@ -9701,7 +10243,7 @@ void RtBinlog_c::NotifyIndexFlush ( const char * sIndexName, int64_t iTID, bool
 		}
 
 		// do unlink
-		CSphString sLog = MakeBinlogName ( m_sLogPath.cstr(), tLog.m_iExt );
+		CSphString sLog = MakeBinlogName ( m_sLogPath.cstr(), m_sLogName.cstr(), tLog.m_iExt );
 		if ( ::unlink ( sLog.cstr() ) )
 			sphWarning ( "binlog: failed to unlink %s: %s (remove it manually)", sLog.cstr(), strerror(errno) );
 
@@ -9747,6 +10289,18 @@ void RtBinlog_c::Configure ( const CSphConfigSection & hSearchd, bool bTestMode
 
 	m_iRestartSize = hSearchd.GetSize ( "binlog_max_log_size", m_iRestartSize );
 
+	m_bGroupCommit = ( m_eOnCommit==ACTION_FSYNC && hSearchd.GetInt ( "binlog_group_commit", 0 )!=0 );
+	m_iGroupCommitDelay = Max ( hSearchd.GetInt ( "binlog_group_commit_delay", 0 ), 0 );
+	if ( hSearchd.GetInt ( "binlog_group_commit", 0 )!=0 && m_eOnCommit!=ACTION_FSYNC )
+		sphWarning ( "binlog_group_commit only works with binlog_flush=1, ignored" );
+
+	m_bPerIndex = ( hSearchd.GetInt ( "binlog_per_index", 0 )!=0 );
+
+	CSphString sFormat = hSearchd.GetStr ( "binlog_format", "segment" );
+	m_bLogical = ( sFormat=="logical" );
+	if ( !m_bLogical && sFormat!="segment" )
+		sphWarning ( "unknown binlog_format '%s', using 'segment'", sFormat.cstr() );
+
 	if ( !m_bDisabled )
 	{
 		LockFile ( true );
@@ -9754,19 +10308,10 @@ void RtBinlog_c::Configure ( const CSphConfigSection & hSearchd, bool bTestMode
 	}
 }
 
-void RtBinlog_c::Replay ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags,
+int RtBinlog_c::ReplayLogs ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags,
 	ProgressCallbackSimple_t * pfnProgressCallback )
 {
-	if ( m_bDisabled || !hIndexes.GetLength() )
-		return;
-
-	// on replay started
-	if ( pfnProgressCallback )
-		pfnProgressCallback();
-
 	int64_t tmReplay = sphMicroTimer();
-	// do replay
-	m_bReplayMode = true;
 	int iLastLogState = 0;
 	ARRAY_FOREACH ( i, m_dLogFiles )
 	{
@@ -9788,9 +10333,236 @@ void RtBinlog_c::Replay ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD
 	// and we might therefore want to update m_iFlushedTID everywhere
 	// but for now, let's just wait until next flush for simplicity
 
-	// resume normal operation
+	return iLastLogState;
+}
+
+/// flush indexes recovered from just replayed logs, then get rid of these logs
+/// used for logs left by the other binlog_per_index mode, as new txns will not go there
+void RtBinlog_c::DropReplayedLogs ()
+{
+	bool bFlushed = true;
+	ARRAY_FOREACH ( iLog, m_dLogFiles )
+		ARRAY_FOREACH ( i, m_dLogFiles[iLog].m_dIndexInfos )
+		{
+			const BinlogIndexInfo_t & tIndex = m_dLogFiles[iLog].m_dIndexInfos[i];
+			if ( !tIndex.m_pIndex || tIndex.m_iPreReplayTID>=tIndex.m_iMaxTID )
+				continue;
+
+			CSphString sError;
+			if ( tIndex.m_pRT )
+			{
+				tIndex.m_pRT->ForceRamFlush();
+				if ( !tIndex.m_pRT->IsRamFlushed() )
+					bFlushed = false;
+			} else if ( !tIndex.m_pIndex->SaveAttributes ( sError ) )
+			{
+				sphWarning ( "binlog: index %s: failed to save attributes: %s", tIndex.m_sName.cstr(), sError.cstr() );
+				bFlushed = false;
+			}
+		}
+
+	if ( !bFlushed )
+	{
+		sphWarning ( "binlog: some indexes failed to flush, keeping %s.* logs until next restart", m_sLogName.cstr() );
+		m_dLogFiles.Reset();
+		return;
+	}
+
+	ARRAY_FOREACH ( i, m_dLogFiles )
+	{
+		CSphString sLog = MakeBinlogName ( m_sLogPath.cstr(), m_sLogName.cstr(), m_dLogFiles[i].m_iExt );
+		if ( ::unlink ( sLog.cstr() ) )
+			sphWarning ( "binlog: failed to unlink %s: %s (remove it manually)", sLog.cstr(), strerror(errno) );
+	}
+	m_dLogFiles.Reset();
+
+	CSphString sMeta;
+	sMeta.SetSprintf ( "%s/%s.meta", m_sLogPath.cstr(), m_sLogName.cstr() );
+	::unlink ( sMeta.cstr() );
+}
+
+void RtBinlog_c::Replay ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags,
+	ProgressCallbackSimple_t * pfnProgressCallback, BinlogReplayed_t * pfnReplayed )
+{
+	if ( m_bDisabled || !hIndexes.GetLength() )
+		return;
+
+	// on replay started
+	if ( pfnProgressCallback )
+		pfnProgressCallback();
+
+	// do replay
+	m_bReplayMode = true;
+
+	// per-index streams that exist on disk
+	CSphVector<RtBinlog_c*> dStreams;
+	hIndexes.IterateStart();
+	while ( hIndexes.IterateNext() )
+	{
+		CSphString sMeta;
+		sMeta.SetSprintf ( "%s/binlog.%s.meta", m_sLogPath.cstr(), hIndexes.IterateGetKey().cstr() );
+		if ( !sphIsReadable ( sMeta.cstr() ) )
+			continue;
+
+		RtBinlog_c * pStream = CreateStream ( hIndexes.IterateGetKey().cstr() );
+		pStream->m_pReplayIndex = hIndexes.IterateGet();
+		pStream->m_bReplayMode = true;
+		dStreams.Add ( pStream );
+	}
+
+	if ( !m_bPerIndex )
+	{
+		// streams were left by binlog_per_index mode, so they are older than the shared log
+		ARRAY_FOREACH ( i, dStreams )
+		{
+			RtBinlog_c * pStream = dStreams[i];
+			pStream->ReplayStream ( uReplayFlags );
+			pStream->DropReplayedLogs();
+
+			m_hStreams.Delete ( pStream->m_sStreamIndex );
+			pStream->m_bDisabled = true; // nothing to finalize, it never logged
+			SafeDelete ( pStream );
+		}
+
+		int iLastLogState = ReplayLogs ( hIndexes, uReplayFlags, pfnProgressCallback );
+
+		// resume normal operation
+		m_bReplayMode = false;
+		OpenNewLog ( iLastLogState );
+		return;
+	}
+
+	// shared log was left by regular mode, so it goes first
+	ReplayLogs ( hIndexes, uReplayFlags, pfnProgressCallback );
+	DropReplayedLogs();
+
+	// plain indexes only log attribute updates, and are replayed right away
+	// rt indexes might replay in background; caller keeps them unavailable until notified
+	CSphVector<RtBinlog_c*> dForeground, dBackground;
+	ARRAY_FOREACH ( i, dStreams )
+	{
+		if ( pfnReplayed && dStreams[i]->m_pReplayIndex->IsRT() )
+			dBackground.Add ( dStreams[i] );
+		else
+			dForeground.Add ( dStreams[i] );
+	}
+
+	m_uReplayFlags = uReplayFlags;
+	ReplayStreams ( dForeground, false );
+
+	m_pfnReplayed = pfnReplayed;
+	ARRAY_FOREACH ( i, dBackground )
+		pfnReplayed ( dBackground[i]->m_sStreamIndex.cstr(), false );
+	ReplayStreams ( dBackground, true );
+
+	// resume normal operation; streams of other indexes get created on demand
 	m_bReplayMode = false;
-	OpenNewLog ( iLastLogState );
+}
+
+/// replay per-index streams on a pool of threads, one index per thread at a time
+void RtBinlog_c::ReplayStreams ( const CSphVector<RtBinlog_c*> & dStreams, bool bBackground )
+{
+	if ( !dStreams.GetLength() )
+		return;
+
+	m_dReplayQueue = dStreams;
+	m_iReplayNext.SetValue ( 0 );
+
+	int iThreads = Min ( dStreams.GetLength(), Max ( sphCpuThreadsCount(), 1 ) );
+	CSphVector<SphThread_t> dThreads ( iThreads );
+	ARRAY_FOREACH ( i, dThreads )
+		if ( !sphThreadCreate ( &dThreads[i], RtBinlog_c::DoReplayStreams, this ) )
+			sphDie ( "failed to create binlog replay thread" );
+
+	if ( bBackground )
+	{
+		sphInfo ( "binlog: replaying %d indexes in background, %d threads", dStreams.GetLength(), iThreads );
+		m_dReplayThreads.SwapData ( dThreads );
+		return;
+	}
+
+	ARRAY_FOREACH ( i, dThreads )
+		sphThreadJoin ( &dThreads[i] );
+}
+
+void RtBinlog_c::DoReplayStreams ( void * pBinlog )
+{
+	assert ( pBinlog );
+	RtBinlog_c * pLog = (RtBinlog_c *)pBinlog;
+
+	for ( ;; )
+	{
+		int iStream = (int)pLog->m_iReplayNext.Inc();
+		if ( iStream>=pLog->m_dReplayQueue.GetLength() )
+			break;
+
+		RtBinlog_c * pStream = pLog->m_dReplayQueue[iStream];
+		int iLastLogState = pStream->ReplayStream ( pLog->m_uReplayFlags );
+
+		// resume normal operation
+		Verify ( pStream->m_tWriteLock.Lock() );
+		pStream->OpenNewLog ( iLastLogState );
+		pStream->CreateSyncThread();
+		pStream->m_bReplayMode = false;
+		Verify ( pStream->m_tWriteLock.Unlock() );
+
+		if ( pLog->m_pfnReplayed && pStream->m_pReplayIndex->IsRT() )
+			pLog->m_pfnReplayed ( pStream->m_sStreamIndex.cstr(), true );
+	}
+}
+
+int RtBinlog_c::ReplayStream ( DWORD uReplayFlags )
+{
+	assert ( m_pReplayIndex && m_bReplayMode );
+	SmallStringHash_T<CSphIndex*> hIndex;
+	hIndex.Add ( m_pReplayIndex, m_sStreamIndex );
+	return ReplayLogs ( hIndex, uReplayFlags, NULL );
+}
+
+void RtBinlog_c::WaitReplay ()
+{
+	ARRAY_FOREACH ( i, m_dReplayThreads )
+		sphThreadJoin ( &m_dReplayThreads[i] );
+	m_dReplayThreads.Reset();
+}
+
+RtBinlog_c * RtBinlog_c::FindStream ( const char * sIndexName )
+{
+	CSphScopedLock<CSphMutex> tLock ( m_tStreamsLock );
+	RtBinlog_c ** ppStream = m_hStreams ( sIndexName );
+	return ppStream ? *ppStream : NULL;
+}
+
+/// get index stream, start a new one if there's none yet
+RtBinlog_c * RtBinlog_c::GetStream ( const char * sIndexName )
+{
+	CSphScopedLock<CSphMutex> tLock ( m_tStreamsLock );
+	RtBinlog_c ** ppStream = m_hStreams ( sIndexName );
+	if ( ppStream )
+		return *ppStream;
+
+	RtBinlog_c * pStream = CreateStream ( sIndexName );
+	pStream->OpenNewLog();
+	pStream->CreateSyncThread();
+	return pStream;
+}
+
+/// create per-index stream that lives next to main binlog, and load its meta
+RtBinlog_c * RtBinlog_c::CreateStream ( const char * sIndexName )
+{
+	RtBinlog_c * pStream = new RtBinlog_c();
+	pStream->m_sLogPath = m_sLogPath;
+	pStream->m_sLogName.SetSprintf ( "binlog.%s", sIndexName );
+	pStream->m_sStreamIndex = sIndexName;
+	pStream->m_eOnCommit = m_eOnCommit;
+	pStream->m_iRestartSize = m_iRestartSize;
+	pStream->m_bGroupCommit = m_bGroupCommit;
+	pStream->m_iGroupCommitDelay = m_iGroupCommitDelay;
+	pStream->m_bDisabled = false;
+	pStream->LoadMeta();
+
+	m_hStreams.Add ( pStream, sIndexName );
+	return pStream;
 }
 
 void RtBinlog_c::CreateTimerThread ()
@@ -9798,7 +10570,24 @@ void RtBinlog_c::CreateTimerThread ()
 	if ( !m_bDisabled && m_eOnCommit!=ACTION_FSYNC )
 	{
 		m_iFlushTimeLeft = sphMicroTimer() + m_iFlushPeriod;
-		sphThreadCreate ( &m_tUpdateTread, RtBinlog_c::DoAutoFlush, this );
+		if ( !sphThreadCreate ( &m_tUpdateTread, RtBinlog_c::DoAutoFlush, this ) )
+			sphDie ( "failed to create binlog flush thread" );
+		m_bUpdateThread = true;
+	}
+
+	// per-index streams start their own writer threads
+	if ( !m_bPerIndex )
+		CreateSyncThread();
+}
+
+void RtBinlog_c::CreateSyncThread ()
+{
+	if ( !m_bDisabled && m_bGroupCommit )
+	{
+		m_tSyncPending.Init ( &m_tSyncLock );
+		if ( !sphThreadCreate ( &m_tSyncThread, RtBinlog_c::DoGroupCommit, this ) )
+			sphDie ( "failed to create binlog group commit thread" );
+		m_bSyncThread = true;
 	}
 }
 
@@ -9812,19 +10601,24 @@ void RtBinlog_c::DoAutoFlush ( void * pBinlog )
 	{
 		if ( pLog->m_iFlushTimeLeft < sphMicroTimer() )
 		{
-			MEMORY ( MEM_BINLOG );
-
 			pLog->m_iFlushTimeLeft = sphMicroTimer() + pLog->m_iFlushPeriod;
 
-			if ( pLog->m_eOnCommit==ACTION_NONE || pLog->m_tWriter.HasUnwrittenData() )
+			if ( !pLog->m_bPerIndex )
+			{
+				pLog->AutoFlush();
+			} else
 			{
-				Verify ( pLog->m_tWriteLock.Lock() );
-				pLog->m_tWriter.Flush();
-				Verify ( pLog->m_tWriteLock.Unlock() );
+				// streams are never removed while we're running
+				CSphVector<RtBinlog_c*> dStreams;
+				Verify ( pLog->m_tStreamsLock.Lock() );
+				pLog->m_hStreams.IterateStart();
+				while ( pLog->m_hStreams.IterateNext() )
+					dStreams.Add ( pLog->m_hStreams.IterateGet() );
+				Verify ( pLog->m_tStreamsLock.Unlock() );
+
+				ARRAY_FOREACH ( i, dStreams )
+					dStreams[i]->AutoFlush();
 			}
-
-			if ( pLog->m_tWriter.HasUnsyncedData() )
-				pLog->m_tWriter.Fsync();
 		}
 
 		// sleep N msec before next iter or terminate because of shutdown
@@ -9832,6 +10626,78 @@ void RtBinlog_c::DoAutoFlush ( void * pBinlog )
 	}
 }
 
+void RtBinlog_c::AutoFlush ()
+{
+	MEMORY ( MEM_BINLOG );
+
+	// stream being replayed has no log open yet
+	Verify ( m_tWriteLock.Lock() );
+	bool bReplaying = m_bReplayMode;
+	if ( !bReplaying && ( m_eOnCommit==ACTION_NONE || m_tWriter.HasUnwrittenData() ) )
+		m_tWriter.Flush();
+	Verify ( m_tWriteLock.Unlock() );
+
+	if ( !bReplaying && m_tWriter.HasUnsyncedData() )
+		m_tWriter.Fsync();
+}
+
+void RtBinlog_c::DoGroupCommit ( void * pBinlog )
+{
+	assert ( pBinlog );
+	RtBinlog_c * pLog = (RtBinlog_c *)pBinlog;
+	assert ( !pLog->m_bDisabled && pLog->m_bGroupCommit );
+
+	for ( ;; )
+	{
+		Verify ( pLog->m_tSyncLock.Lock() );
+		bool bPending = ( pLog->m_iQueuedTicket>pLog->m_iSyncedTicket );
+		bool bStop = pLog->m_bSyncStop;
+		Verify ( pLog->m_tSyncLock.Unlock() );
+
+		if ( !bPending )
+		{
+			if ( bStop )
+				break;
+			pLog->m_tSyncPending.WaitEvent();
+			continue;
+		}
+
+		// let more committers join the batch
+		if ( pLog->m_iGroupCommitDelay && !bStop )
+			sphSleepMsec ( pLog->m_iGroupCommitDelay );
+
+		// one write and one fsync for the whole batch
+		// txns are only enqueued under write lock, so everything up to the last ticket is in the buffer (or already in the file)
+		MEMORY ( MEM_BINLOG );
+		Verify ( pLog->m_tWriteLock.Lock() );
+		Verify ( pLog->m_tSyncLock.Lock() );
+		int64_t iTicket = pLog->m_iQueuedTicket;
+		Verify ( pLog->m_tSyncLock.Unlock() );
+
+		if ( pLog->m_tWriter.HasUnwrittenData() )
+			pLog->m_tWriter.Write();
+		pLog->m_tWriter.Fsync();
+		Verify ( pLog->m_tWriteLock.Unlock() );
+
+		pLog->MarkSynced ( iTicket );
+	}
+}
+
+/// wake up committers waiting for tickets up to a given one
+void RtBinlog_c::MarkSynced ( int64_t iTicket )
+{
+	Verify ( m_tSyncLock.Lock() );
+	// log restart might have synced a newer batch meanwhile
+	m_iSyncedTicket = Max ( m_iSyncedTicket, iTicket );
+	ARRAY_FOREACH ( i, m_dSyncWaiters )
+		if ( m_dSyncWaiters[i].m_iTicket<=m_iSyncedTicket )
+		{
+			m_dSyncWaiters[i].m_pEvent->SetEvent();
+			m_dSyncWaiters.RemoveFast ( i-- );
+		}
+	Verify ( m_tSyncLock.Unlock() );
+}
+
 int RtBinlog_c::GetWriteIndexID ( const char * sName, int64_t iTID, int64_t tmNow )
 {
 	MEMORY ( MEM_BINLOG );
@@ -9880,7 +10746,7 @@ void RtBinlog_c::LoadMeta ()
 	MEMORY ( MEM_BINLOG );
 
 	CSphString sMeta;
-	sMeta.SetSprintf ( "%s/binlog.meta", m_sLogPath.cstr() );
+	sMeta.SetSprintf ( "%s/%s.meta", m_sLogPath.cstr(), m_sLogName.cstr() );
 	if ( !sphIsReadable ( sMeta.cstr() ) )
 		return;
 
@@ -9909,8 +10775,8 @@ void RtBinlog_c::LoadMeta ()
 		return;
 
 	// ok, so there is actual recovery data
-	// let's require that exact version and bitness, then
-	if ( uVersion!=BINLOG_VERSION )
+	// let's require compatible version and exact bitness, then
+	if ( uVersion<BINLOG_MIN_VERSION )
 		sphDie ( "binlog meta file %s is v.%d, binary is v.%d; recovery requires previous binary version",
 			sMeta.cstr(), uVersion, BINLOG_VERSION );
 
@@ -9928,8 +10794,8 @@ void RtBinlog_c::SaveMeta ()
 	MEMORY ( MEM_BINLOG );
 
 	CSphString sMeta, sMetaOld;
-	sMeta.SetSprintf ( "%s/binlog.meta.new", m_sLogPath.cstr() );
-	sMetaOld.SetSprintf ( "%s/binlog.meta", m_sLogPath.cstr() );
+	sMeta.SetSprintf ( "%s/%s.meta.new", m_sLogPath.cstr(), m_sLogName.cstr() );
+	sMetaOld.SetSprintf ( "%s/%s.meta", m_sLogPath.cstr(), m_sLogName.cstr() );
 
 	CSphString sError;
 
@@ -9974,8 +10840,11 @@ void RtBinlog_c::LockFile ( bool bLock )
 		m_iLockFD = iLockFD;
 	} else
 	{
-		if ( m_iLockFD>=0 )
-			sphLockUn ( m_iLockFD );
+		// per-index streams do not lock, main binlog does it for them
+		if ( m_iLockFD<0 )
+			return;
+
+		sphLockUn ( m_iLockFD );
 		SafeClose ( m_iLockFD );
 		::unlink ( sName.cstr()	);
 	}
@@ -10001,7 +10870,7 @@ void RtBinlog_c::OpenNewLog ( int iLastState )
 	m_dLogFiles.Add ( tLog );
 
 	// create file
-	CSphString sLog = MakeBinlogName ( m_sLogPath.cstr(), tLog.m_iExt );
+	CSphString sLog = MakeBinlogName ( m_sLogPath.cstr(), m_sLogName.cstr(), tLog.m_iExt );
 
 	if ( !iLastState ) // reuse the last binlog since it is empty or useless.
 		::unlink ( sLog.cstr() );
@@ -10049,27 +10918,53 @@ void RtBinlog_c::CheckDoRestart ()
 
 		assert ( m_dLogFiles.GetLength() );
 
+		// txns queued for group commit are in this file, but writer thread would only sync the next one
+		// so sync it here, and release them right away
+		int64_t iQueued = 0;
+		if ( m_bSyncThread )
+		{
+			Verify ( m_tSyncLock.Lock() );
+			iQueued = m_iQueuedTicket;
+			Verify ( m_tSyncLock.Unlock() );
+		}
+
 		DoCacheWrite();
+		m_tWriter.Flush();
 		m_tWriter.CloseFile();
 		OpenNewLog();
+
+		if ( iQueued )
+			MarkSynced ( iQueued );
 	}
 }
 
-void RtBinlog_c::CheckDoFlush ()
+/// returns group commit ticket to wait for, or 0 if txn is already as durable as configured
+int64_t RtBinlog_c::CheckDoFlush ()
 {
 	if ( m_eOnCommit==ACTION_NONE )
-		return;
+		return 0;
 
 	if ( m_eOnCommit==ACTION_WRITE && m_tWriter.HasUnwrittenData() )
 		m_tWriter.Write();
 
-	if ( m_eOnCommit==ACTION_FSYNC && m_tWriter.HasUnsyncedData() )
+	if ( m_eOnCommit==ACTION_FSYNC && m_bSyncThread )
+	{
+		Verify ( m_tSyncLock.Lock() );
+		int64_t iTicket = ++m_iQueuedTicket;
+		m_tSyncPending.SetEvent();
+		Verify ( m_tSyncLock.Unlock() );
+		return iTicket;
+	}
+
+	// txn data is usually still in the buffer here, so unsynced flag alone is not enough
+	if ( m_eOnCommit==ACTION_FSYNC && ( m_tWriter.HasUnwrittenData() || m_tWriter.HasUnsyncedData() ) )
 	{
 		if ( m_tWriter.HasUnwrittenData() )
 			m_tWriter.Write();
 
 		m_tWriter.Fsync();
 	}
+	return 0;
 }
 
 int RtBinlog_c::ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, int iBinlog )
@@ -10077,7 +10972,7 @@ int RtBinlog_c::ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, D
 	assert ( iBinlog>=0 && iBinlog<m_dLogFiles.GetLength() );
 	CSphString sError;
 
-	const CSphString sLog ( MakeBinlogName ( m_sLogPath.cstr(), m_dLogFiles[iBinlog].m_iExt ) );
+	const CSphString sLog ( MakeBinlogName ( m_sLogPath.cstr(), m_sLogName.cstr(), m_dLogFiles[iBinlog].m_iExt ) );
 	BinlogFileDesc_t & tLog = m_dLogFiles[iBinlog];
 
 	// open, check, play
@@ -10106,7 +11001,7 @@ int RtBinlog_c::ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, D
 		sphDie ( "binlog: log %s missing magic header (corrupted?)", sLog.cstr() );
 
 	DWORD uVersion = tReader.GetDword();
-	if ( uVersion!=BINLOG_VERSION || tReader.GetErrorFlag() )
+	if ( uVersion<BINLOG_MIN_VERSION || uVersion>BINLOG_VERSION || tReader.GetErrorFlag() )
 		sphDie ( "binlog: log %s is v.%d, binary is v.%d; recovery requires previous binary version", sLog.cstr(), uVersion, BINLOG_VERSION );
 
 	/////////////
@@ -10147,7 +11042,8 @@ int RtBinlog_c::ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, D
 		switch ( uOp )
 		{
 			case BLOP_COMMIT:
-				bReplayOK = ReplayCommit ( iBinlog, uReplayFlags, tReader );
+			case BLOP_COMMIT_SOURCE:
+				bReplayOK = ReplayCommit ( iBinlog, uReplayFlags, tReader, uOp==BLOP_COMMIT_SOURCE );
 				break;
 
 			case BLOP_UPDATE_ATTRS:
@@ -10207,7 +11103,7 @@ int RtBinlog_c::ReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, D
 	}
 
 	sphInfo ( "binlog: replay stats: %d rows in %d commits; %d updates, %d reconfigure; %d indexes",
-		m_iReplayedRows, dTotal[BLOP_COMMIT], dTotal[BLOP_UPDATE_ATTRS], dTotal[BLOP_RECONFIGURE], dTotal[BLOP_ADD_INDEX] );
+		m_iReplayedRows, dTotal[BLOP_COMMIT]+dTotal[BLOP_COMMIT_SOURCE], dTotal[BLOP_UPDATE_ATTRS], dTotal[BLOP_RECONFIGURE], dTotal[BLOP_ADD_INDEX] );
 	sphInfo ( "binlog: finished replaying %s; %d.%d MB in %d.%03d sec",
 		sLog.cstr(),
 		(int)(iFileSize/1048576), (int)((iFileSize*10/1048576)%10),
@@ -10233,7 +11129,7 @@ static BinlogIndexInfo_t & ReplayIndexID ( BinlogReader_c & tReader, BinlogFileD
 }
 
 
-bool RtBinlog_c::ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c & tReader ) const
+bool RtBinlog_c::ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c & tReader, bool bSource ) const
 {
 	// load and lookup index
 	const int64_t iTxnPos = tReader.GetPos();
@@ -10246,9 +11142,35 @@ bool RtBinlog_c::ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c
 
 	CSphScopedPtr<RtSegment_t> pSeg ( NULL );
 	CSphVector<SphDocID_t> dKlist;
+	CSphVector<BYTE> dSource;
 
 	int iRows = (int)tReader.UnzipOffset();
-	if ( iRows )
+	if ( bSource )
+	{
+		m_iReplayedRows += iRows;
+		int iRawLen = (int)tReader.UnzipOffset();
+		int iPackedLen = (int)tReader.UnzipOffset();
+		if ( iRawLen<0 || iPackedLen<0 || iPackedLen>=iRawLen )
+			sphDie ( "binlog: commit: broken source (index=%s, tid=" INT64_FMT ", pos=" INT64_FMT ")",
+				tIndex.m_sName.cstr(), iTID, iTxnPos );
+
+		dSource.Resize ( iPackedLen ? iPackedLen : iRawLen );
+		tReader.GetBytes ( dSource.Begin(), dSource.GetLength() );
+		if ( iPackedLen && !tReader.GetErrorFlag() )
+		{
+#if USE_ZLIB
+			CSphVector<BYTE> dRaw ( iRawLen );
+			uLongf uRawLen = iRawLen;
+			if ( uncompress ( dRaw.Begin(), &uRawLen, dSource.Begin(), iPackedLen )!=Z_OK || (int)uRawLen!=iRawLen )
+				sphDie ( "binlog: commit: failed to unpack source (index=%s, tid=" INT64_FMT ", pos=" INT64_FMT ")",
+					tIndex.m_sName.cstr(), iTID, iTxnPos );
+			dSource.SwapData ( dRaw );
+#else
+			sphDie ( "binlog: commit: packed source requires zlib support (index=%s, tid=" INT64_FMT ", pos=" INT64_FMT ")",
+				tIndex.m_sName.cstr(), iTID, iTxnPos );
+#endif
+		}
+	} else if ( iRows )
 	{
 		pSeg = new RtSegment_t();
 		pSeg->m_iRows = pSeg->m_iAliveRows = iRows;
@@ -10311,7 +11233,12 @@ bool RtBinlog_c::ReplayCommit ( int iBinlog, DWORD uReplayFlags, BinlogReader_c
 		}
 
 		// actually replay
-		tIndex.m_pRT->CommitReplayable ( pSeg.LeakPtr(), dKlist, NULL );
+		CSphString sError;
+		if ( !bSource )
+			tIndex.m_pRT->CommitReplayable ( pSeg.LeakPtr(), dKlist, NULL );
+		else if ( !tIndex.m_pRT->ReplaySource ( dSource.Begin(), dSource.GetLength(), iRows, dKlist, sError ) )
+			sphDie ( "binlog: commit: %s (index=%s, tid=" INT64_FMT ", pos=" INT64_FMT ")",
+				sError.cstr(), tIndex.m_sName.cstr(), iTID, iTxnPos );
 
 		// update committed tid on replay in case of unexpected / mismatched tid
 		tIndex.m_pRT->m_iTID = iTID;
@@ -10639,14 +11566,22 @@ void sphRTDone ()
 }
 
 
-void sphReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback )
+void sphReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback,
+	BinlogReplayed_t * pfnReplayed )
 {
 	MEMORY ( MEM_BINLOG );
-	g_pRtBinlog->Replay ( hIndexes, uReplayFlags, pfnProgressCallback );
+	g_pRtBinlog->Replay ( hIndexes, uReplayFlags, pfnProgressCallback, pfnReplayed );
 	g_pRtBinlog->CreateTimerThread();
 	g_bRTChangesAllowed = true;
 }
 
+
+void sphWaitBinlogReplay ()
+{
+	if ( g_pRtBinlog )
+		g_pRtBinlog->WaitReplay();
+}
+
 static bool g_bTestMode = false;
 
 void sphRTSetTestMode ()
@@ -10730,6 +11665,58 @@ bool sphRTSchemaConfigure ( const CSphConfigSection & hIndex, CSphSchema * pSche
 		}
 	}
 
+	// typed columns extracted from JSON paths, named as the path itself
+	for ( CSphVariant * v = hIndex ( "rt_attr_json_extract" ); v; v = v->m_pNext )
+	{
+		const char * sSpec = v->cstr();
+		const char * pColon = strrchr ( sSpec, ':' );
+		CSphString sColumn, sPath;
+		if ( pColon )
+			tCol.m_sName.SetBinary ( sSpec, pColon-sSpec );
+		else
+			tCol.m_sName = sSpec;
+		tCol.m_sName.Trim();
+
+		if ( !sphJsonNameSplit ( tCol.m_sName.cstr(), &sColumn, &sPath ) || sPath.IsEmpty() || sPath.Ends(".") || strchr ( tCol.m_sName.cstr(), '[' ) )
+		{
+			pError->SetSprintf ( "rt_attr_json_extract '%s': expected jsoncol.key[.key...]:type", sSpec );
+			return false;
+		}
+
+		sColumn.ToLower();
+		int iJson = pSchema->GetAttrIndex ( sColumn.cstr() );
+		if ( iJson<0 || pSchema->GetAttr(iJson).m_eAttrType!=SPH_ATTR_JSON )
+		{
+			pError->SetSprintf ( "rt_attr_json_extract '%s': '%s' is not a JSON attribute", sSpec, sColumn.cstr() );
+			return false;
+		}
+
+		CSphString sType ( pColon ? pColon+1 : "" );
+		sType.Trim();
+		sType.ToLower();
+		if ( sType=="uint" )
+			tCol.m_eAttrType = SPH_ATTR_INTEGER;
+		else if ( sType=="bigint" )
+			tCol.m_eAttrType = SPH_ATTR_BIGINT;
+		else if ( sType=="float" )
+			tCol.m_eAttrType = SPH_ATTR_FLOAT;
+		else
+		{
+			pError->SetSprintf ( "rt_attr_json_extract '%s': unknown type '%s' (must be uint, bigint, or float)", sSpec, sType.cstr() );
+			return false;
+		}
+
+		tCol.m_sName.SetSprintf ( "%s.%s", sColumn.cstr(), sPath.cstr() );
+		if ( pSchema->GetAttrIndex ( tCol.m_sName.cstr() )>=0 )
+		{
+			pError->SetSprintf ( "rt_attr_json_extract '%s': duplicate path", sSpec );
+			return false;
+		}
+
+		tCol.m_tLocator = CSphAttrLocator();
+		pSchema->AddAttr ( tCol, false );
+	}
+
 	if ( !pSchema->m_dAttrs.GetLength() && !g_bTestMode )
 	{
 		pError->SetSprintf ( "no attribute configured (use rt_attr directive)" );
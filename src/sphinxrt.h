@@ -115,8 +115,16 @@ enum ESphBinlogReplayFlags
 	SPH_REPLAY_IGNORE_OPEN_ERROR = 2
 };
 
+/// per-index binlog replay notification
+/// called with bReplayed=false right before index replay gets scheduled, and with bReplayed=true from replay thread once it's done
+typedef void BinlogReplayed_t ( const char * sIndex, bool bReplayed );
+
 /// replay stored binlog
-void sphReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback=NULL );
+/// with binlog_per_index and a notification callback, RT indexes are replayed in background threads
+void sphReplayBinlog ( const SmallStringHash_T<CSphIndex*> & hIndexes, DWORD uReplayFlags, ProgressCallbackSimple_t * pfnProgressCallback=NULL, BinlogReplayed_t * pfnReplayed=NULL );
+
+/// wait for background binlog replay (if any) to complete
+void sphWaitBinlogReplay ();
 
 #endif // _sphinxrt_
 
@@ -1473,19 +1473,6 @@ ExtNode_i * ExtNode_i::Create ( ISphQword * pQword, const XQNode_t * pNode, cons
 
 //////////////////////////////////////////////////////////////////////////
 
-struct ExtPayloadEntry_t
-{
-	SphDocID_t	m_uDocid;
-	Hitpos_t	m_uHitpos;
-
-	bool operator < ( const ExtPayloadEntry_t & rhs ) const
-	{
-		if ( m_uDocid!=rhs.m_uDocid )
-			return ( m_uDocid<rhs.m_uDocid );
-		return ( m_uHitpos<rhs.m_uHitpos );
-	}
-};
-
 struct ExtPayloadKeyword_t : public XQKeyword_t
 {
 	CSphString	m_sDictWord;
@@ -1499,7 +1486,7 @@ struct ExtPayloadKeyword_t : public XQKeyword_t
 class ExtPayload_c : public ExtNode_i
 {
 private:
-	CSphVector<ExtPayloadEntry_t>	m_dCache;
+	PcacheEntry_c *					m_pCache;			///< merged postings, either shared by expansion cache, or just built
 	ExtPayloadKeyword_t				m_tWord;
 	FieldMask_t						m_dFieldMask;
 
@@ -1511,6 +1498,7 @@ private:
 
 public:
 	explicit						ExtPayload_c ( const XQNode_t * pNode, const ISphQwordSetup & tSetup );
+									~ExtPayload_c () { SafeRelease ( m_pCache ); }
 	virtual void					Reset ( const ISphQwordSetup & tSetup );
 	virtual void					HintDocid ( SphDocID_t ) {} // FIXME!!! implement with tree
 	virtual const ExtDoc_t *		GetDocsChunk();
@@ -1529,6 +1517,7 @@ private:
 
 
 ExtPayload_c::ExtPayload_c ( const XQNode_t * pNode, const ISphQwordSetup & tSetup )
+	: m_pCache ( NULL )
 {
 	// sanity checks
 	// this node must be only created for a huge OR of tiny expansions
@@ -1562,6 +1551,36 @@ ExtPayload_c::ExtPayload_c ( const XQNode_t * pNode, const ISphQwordSetup & tSet
 
 void ExtPayload_c::PopulateCache ( const ISphQwordSetup & tSetup, bool bFillStat )
 {
+	SafeRelease ( m_pCache );
+	m_iCurDocsEnd = 0;
+	m_iCurHit = 0;
+
+	// merged postings only depend on payload doclists, and on the keyword modifiers
+	int64_t iIndexId = tSetup.m_pIndex ? tSetup.m_pIndex->GetIndexId() : -1;
+	uint64_t uKey = ( (const ISphSubstringPayload *)m_tWord.m_pPayload )->m_uCacheKey;
+	if ( uKey )
+	{
+		BYTE uFlags = ( m_tWord.m_bFieldStart ? 1 : 0 ) | ( m_tWord.m_bFieldEnd ? 2 : 0 );
+		uKey = sphFNV64 ( m_dFieldMask.m_dMask, sizeof(m_dFieldMask.m_dMask), uKey );
+		uKey = sphFNV64 ( &uFlags, sizeof(uFlags), uKey );
+
+		m_pCache = PcacheFind ( iIndexId, uKey );
+		if ( m_pCache )
+		{
+			if ( bFillStat )
+			{
+				m_tWord.m_iDocs = m_pCache->m_iDocs;
+				m_tWord.m_iHits = m_pCache->m_iHits;
+			}
+			return;
+		}
+	}
+
+	m_pCache = new PcacheEntry_c();
+	m_pCache->m_iIndexId = iIndexId;
+	m_pCache->m_uKey = uKey;
+	CSphVector<ExtPayloadEntry_t> & dCache = m_pCache->m_dEntries;
+
 	ISphQword * pQword = tSetup.QwordSpawn ( m_tWord );
 	pQword->m_sWord = m_tWord.m_sWord;
 	pQword->m_uWordID = m_tWord.m_uWordID;
@@ -1571,12 +1590,9 @@ void ExtPayload_c::PopulateCache ( const ISphQwordSetup & tSetup, bool bFillStat
 	bool bOk = tSetup.QwordSetup ( pQword );
 
 	// setup keyword idf and stats
-	if ( bFillStat )
-	{
-		m_tWord.m_iDocs = pQword->m_iDocs;
-		m_tWord.m_iHits = pQword->m_iHits;
-	}
-	m_dCache.Reserve ( Max ( pQword->m_iHits, pQword->m_iDocs ) );
+	m_pCache->m_iDocs = pQword->m_iDocs;
+	m_pCache->m_iHits = pQword->m_iHits;
+	dCache.Reserve ( Max ( pQword->m_iHits, pQword->m_iDocs ) );
 
 	// read and cache all docs and hits
 	if ( bOk )
@@ -1602,20 +1618,20 @@ void ExtPayload_c::PopulateCache ( const ISphQwordSetup & tSetup, bool bFillStat
 				continue;
 
 			// ok, this hit works, copy it
-			ExtPayloadEntry_t & tEntry = m_dCache.Add ();
+			ExtPayloadEntry_t & tEntry = dCache.Add ();
 			tEntry.m_uDocid = tMatch.m_uDocID;
 			tEntry.m_uHitpos = uHit;
 		}
 	}
 
-	m_dCache.Sort();
-	if ( bFillStat && m_dCache.GetLength() )
+	dCache.Sort();
+	if ( dCache.GetLength() )
 	{
 		// there might be duplicate documents, but not hits, lets recalculate docs count
 		// FIXME!!! that not work for RT index - get rid of ExtPayload_c and move PopulateCache code to index specific QWord
-		SphDocID_t uLastDoc = m_dCache.Begin()->m_uDocid;
-		const ExtPayloadEntry_t * pCur = m_dCache.Begin() + 1;
-		const ExtPayloadEntry_t * pEnd = m_dCache.Begin() + m_dCache.GetLength();
+		SphDocID_t uLastDoc = dCache.Begin()->m_uDocid;
+		const ExtPayloadEntry_t * pCur = dCache.Begin() + 1;
+		const ExtPayloadEntry_t * pEnd = dCache.Begin() + dCache.GetLength();
 		int iDocsTotal = 1;
 		while ( pCur!=pEnd )
 		{
@@ -1623,30 +1639,36 @@ void ExtPayload_c::PopulateCache ( const ISphQwordSetup & tSetup, bool bFillStat
 			uLastDoc = pCur->m_uDocid;
 			pCur++;
 		}
-		m_tWord.m_iDocs = iDocsTotal;
+		m_pCache->m_iDocs = iDocsTotal;
 	}
 
-	// reset iterators
-	m_iCurDocsEnd = 0;
-	m_iCurHit = 0;
+	if ( bFillStat )
+	{
+		m_tWord.m_iDocs = m_pCache->m_iDocs;
+		m_tWord.m_iHits = m_pCache->m_iHits;
+	}
 
 	// dismissed
 	SafeDelete ( pQword );
+
+	// repeated expansions of this very payload will reuse the merged postings
+	if ( bOk && uKey )
+		PcacheAdd ( m_pCache );
 }
 
 
 void ExtPayload_c::Reset ( const ISphQwordSetup & tSetup )
 {
 	m_iMaxTimer = tSetup.m_iMaxTimer;
-	m_dCache.Resize ( 0 );
 	PopulateCache ( tSetup, false );
 }
 
 
 const ExtDoc_t * ExtPayload_c::GetDocsChunk()
 {
+	const CSphVector<ExtPayloadEntry_t> & dCache = m_pCache->m_dEntries;
 	m_iCurHit = m_iCurDocsEnd;
-	if ( m_iCurDocsEnd>=m_dCache.GetLength() )
+	if ( m_iCurDocsEnd>=dCache.GetLength() )
 		return NULL;
 
 	// max_query_time
@@ -1667,9 +1689,9 @@ const ExtDoc_t * ExtPayload_c::GetDocsChunk()
 
 	int iDoc = 0;
 	int iEnd = m_iCurDocsEnd; // shortcut, and vs2005 optimization
-	while ( iDoc<MAX_DOCS-1 && iEnd<m_dCache.GetLength() )
+	while ( iDoc<MAX_DOCS-1 && iEnd<dCache.GetLength() )
 	{
-		SphDocID_t uDocid = m_dCache[iEnd].m_uDocid;
+		SphDocID_t uDocid = dCache[iEnd].m_uDocid;
 
 		ExtDoc_t & tDoc = m_dDocs[iDoc++];
 		tDoc.m_uDocid = uDocid;
@@ -1678,9 +1700,9 @@ const ExtDoc_t * ExtPayload_c::GetDocsChunk()
 		tDoc.m_uHitlistOffset = 0;
 
 		int iHitStart = iEnd;
-		while ( iEnd<m_dCache.GetLength() && m_dCache[iEnd].m_uDocid==uDocid )
+		while ( iEnd<dCache.GetLength() && dCache[iEnd].m_uDocid==uDocid )
 		{
-			tDoc.m_uDocFields |= 1<< ( HITMAN::GetField ( m_dCache[iEnd].m_uHitpos ) );
+			tDoc.m_uDocFields |= 1<< ( HITMAN::GetField ( dCache[iEnd].m_uHitpos ) );
 			iEnd++;
 		}
 
@@ -1695,6 +1717,7 @@ const ExtDoc_t * ExtPayload_c::GetDocsChunk()
 
 const ExtHit_t * ExtPayload_c::GetHitsChunk ( const ExtDoc_t * pDocs )
 {
+	const CSphVector<ExtPayloadEntry_t> & dCache = m_pCache->m_dEntries;
 	if ( m_iCurHit>=m_iCurDocsEnd )
 		return NULL;
 
@@ -1702,13 +1725,13 @@ const ExtHit_t * ExtPayload_c::GetHitsChunk ( const ExtDoc_t * pDocs )
 	while ( pDocs->m_uDocid!=DOCID_MAX )
 	{
 		// skip rejected documents
-		while ( m_iCurHit<m_iCurDocsEnd && m_dCache[m_iCurHit].m_uDocid<pDocs->m_uDocid )
+		while ( m_iCurHit<m_iCurDocsEnd && dCache[m_iCurHit].m_uDocid<pDocs->m_uDocid )
 			m_iCurHit++;
 		if ( m_iCurHit>=m_iCurDocsEnd )
 			break;
 
 		// skip non-matching documents
-		SphDocID_t uDocid = m_dCache[m_iCurHit].m_uDocid;
+		SphDocID_t uDocid = dCache[m_iCurHit].m_uDocid;
 		if ( pDocs->m_uDocid<uDocid )
 		{
 			while ( pDocs->m_uDocid<uDocid )
@@ -1718,11 +1741,11 @@ const ExtHit_t * ExtPayload_c::GetHitsChunk ( const ExtDoc_t * pDocs )
 		}
 
 		// copy accepted documents
-		while ( m_iCurHit<m_iCurDocsEnd && m_dCache[m_iCurHit].m_uDocid==pDocs->m_uDocid && iHit<MAX_HITS-1 )
+		while ( m_iCurHit<m_iCurDocsEnd && dCache[m_iCurHit].m_uDocid==pDocs->m_uDocid && iHit<MAX_HITS-1 )
 		{
 			ExtHit_t & tHit = m_dHits[iHit++];
-			tHit.m_uDocid = m_dCache[m_iCurHit].m_uDocid;
-			tHit.m_uHitpos = m_dCache[m_iCurHit].m_uHitpos;
+			tHit.m_uDocid = dCache[m_iCurHit].m_uDocid;
+			tHit.m_uHitpos = dCache[m_iCurHit].m_uHitpos;
 			tHit.m_uQuerypos = (WORD) m_tWord.m_iAtomPos;
 			tHit.m_uWeight = tHit.m_uMatchlen = tHit.m_uSpanlen = 1;
 			m_iCurHit++;
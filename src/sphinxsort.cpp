@@ -68,6 +68,27 @@ static bool HasString ( const CSphMatchComparatorState * pState )
 }
 
 
+/// search_after cursor, the sort keys of the last match of the previous page
+struct SearchAfter_t : public ISphNoncopyable
+{
+	CSphMatch					m_tMatch;
+	CSphFixedVector<CSphRowitem>	m_dStatic;	///< static part for the keys stored in the index row
+
+	explicit SearchAfter_t ( int iStaticSize )
+		: m_dStatic ( iStaticSize )
+	{
+		if ( iStaticSize )
+			memset ( m_dStatic.Begin(), 0, iStaticSize*sizeof(CSphRowitem) );
+		m_tMatch.m_pStatic = m_dStatic.Begin();
+	}
+
+	~SearchAfter_t ()
+	{
+		m_tMatch.m_pStatic = NULL;
+	}
+};
+
+
 /// match-sorting priority queue traits
 class CSphMatchQueueTraits : public ISphMatchSorter, ISphNoncopyable
 {
@@ -76,6 +97,7 @@ protected:
 	int							m_iUsed;
 	int							m_iSize;
 	const bool					m_bUsesAttrs;
+	SearchAfter_t *				m_pAfter;		///< only matches sorted past this one are kept, if any
 
 private:
 	const int					m_iDataLength;
@@ -86,6 +108,7 @@ public:
 		: m_iUsed ( 0 )
 		, m_iSize ( iSize )
 		, m_bUsesAttrs ( bUsesAttrs )
+		, m_pAfter ( NULL )
 		, m_iDataLength ( iSize )
 	{
 		assert ( iSize>0 );
@@ -102,10 +125,12 @@ public:
 		for ( int i=0; i<m_iDataLength; ++i )
 			m_tSchema.FreeStringPtrs ( m_pData+i );
 		SafeDeleteArray ( m_pData );
+		SafeDelete ( m_pAfter );
 	}
 
 public:
 	bool				UsesAttrs () const										{ return m_bUsesAttrs; }
+	void				SetSearchAfter ( SearchAfter_t * pAfter )				{ SafeDelete ( m_pAfter ); m_pAfter = pAfter; }
 	virtual int			GetLength () const										{ return m_iUsed; }
 	virtual int			GetDataLength () const									{ return m_iDataLength; }
 
@@ -141,10 +166,14 @@ struct CompareIndex_fn
 template < typename COMP, bool NOTIFICATIONS >
 class CSphMatchQueue : public CSphMatchQueueTraits
 {
+protected:
+	SharedTopWeight_t *		m_pTopWeight;	///< threshold shared with the sorters of other local indexes, if any
+
 public:
 	/// ctor
 	CSphMatchQueue ( int iSize, bool bUsesAttrs )
 		: CSphMatchQueueTraits ( iSize, bUsesAttrs )
+		, m_pTopWeight ( NULL )
 	{
 		if_const ( NOTIFICATIONS )
 			m_dJustPopped.Reserve(1);
@@ -161,6 +190,21 @@ public:
 		return m_pData;
 	}
 
+	virtual bool CanMergeSorted () const
+	{
+		return true;
+	}
+
+	virtual bool IsBetter ( const CSphMatch & a, const CSphMatch & b ) const
+	{
+		return COMP::IsLess ( b, a, m_tState );
+	}
+
+	virtual void SetSharedTopWeight ( SharedTopWeight_t * pTopWeight )
+	{
+		m_pTopWeight = pTopWeight;
+	}
+
 	/// add entry to the queue
 	virtual bool Push ( const CSphMatch & tEntry )
 	{
@@ -172,6 +216,14 @@ public:
 			m_dJustPopped.Resize(0);
 		}
 
+		// previous pages already got everything up to the cursor
+		if ( m_pAfter && !COMP::IsLess ( tEntry, m_pAfter->m_tMatch, m_tState ) )
+			return true;
+
+		// some other index already has a full queue of better matches
+		if ( m_pTopWeight && tEntry.m_iWeight<m_pTopWeight->GetWeight() )
+			return true;
+
 		if ( m_iUsed==m_iSize )
 		{
 			// if it's worse that current min, reject it, else pop off current min
@@ -201,6 +253,10 @@ public:
 			iEntry = iParent;
 		}
 
+		// full queue; its worst weight is now the bar for everyone
+		if ( m_pTopWeight && m_iUsed==m_iSize )
+			m_pTopWeight->Publish ( m_pData[0].m_iWeight );
+
 		return true;
 	}
 
@@ -358,6 +414,16 @@ public:
 		return false;
 	}
 
+	virtual bool CanMergeSorted () const
+	{
+		return true;
+	}
+
+	virtual bool IsBetter ( const CSphMatch & a, const CSphMatch & b ) const
+	{
+		return COMP::IsLess ( b, a, m_tState );
+	}
+
 	/// add entry to the queue
 	virtual bool Push ( const CSphMatch & tEntry )
 	{
@@ -372,6 +438,9 @@ public:
 		if ( m_pWorst && COMP::IsLess ( tEntry, *m_pWorst, m_tState ) )
 			return true;
 
+		if ( m_pAfter && !COMP::IsLess ( tEntry, m_pAfter->m_tMatch, m_tState ) )
+			return true;
+
 		// quick check passed
 		// fill the data, back to front
 		m_bFinalized = false;
@@ -382,9 +451,9 @@ public:
 			m_iJustPushed = tEntry.m_uDocID;
 
 		// do the initial sort once
-		if ( m_iTotal==m_iSize )
+		// (counting kept matches, as the search_after cursor rejects some before that)
+		if ( !m_pWorst && m_iUsed==m_iSize )
 		{
-			assert ( m_iUsed==m_iSize && !m_pWorst );
 			MatchSort_fn<COMP> tComp ( m_tState );
 			sphSort ( m_pEnd-m_iSize, m_iSize, tComp, tComp );
 			m_pWorst = m_pEnd-m_iSize;
@@ -479,6 +548,180 @@ public:
 	}
 };
 
+
+/// K-selection sorter
+/// keeps matches in place in a 2K pool and only shuffles their indexes around;
+/// once the pool fills up, introselect cuts it back to the best K and the K-th best
+/// becomes the admission threshold; the survivors get sorted just once, on finalize
+template < typename COMP, bool NOTIFICATIONS >
+class CSphKselectMatchQueue : public CSphMatchQueueTraits
+{
+protected:
+	static const int		COEFF = 2;
+
+	CSphFixedVector<int>	m_dIdx;			///< pool slots; kept matches first, then the free ones
+	int						m_iWorst;		///< slot of the admission threshold match, or -1
+	bool					m_bSorted;		///< whether kept matches are cut to K and ordered best to worst
+	SharedTopWeight_t *		m_pTopWeight;	///< threshold shared with the sorters of other local indexes, if any
+
+public:
+	/// ctor
+	CSphKselectMatchQueue ( int iSize, bool bUsesAttrs )
+		: CSphMatchQueueTraits ( iSize*COEFF, bUsesAttrs )
+		, m_dIdx ( iSize*COEFF )
+		, m_iWorst ( -1 )
+		, m_bSorted ( false )
+		, m_pTopWeight ( NULL )
+	{
+		ARRAY_FOREACH ( i, m_dIdx )
+			m_dIdx[i] = i;
+
+		if_const ( NOTIFICATIONS )
+			m_dJustPopped.Reserve ( iSize );
+
+		m_iSize /= COEFF;
+	}
+
+	/// check if this sorter does groupby
+	virtual bool IsGroupby () const
+	{
+		return false;
+	}
+
+	virtual bool CanMergeSorted () const
+	{
+		return true;
+	}
+
+	virtual bool IsBetter ( const CSphMatch & a, const CSphMatch & b ) const
+	{
+		return COMP::IsLess ( b, a, m_tState );
+	}
+
+	virtual void SetSharedTopWeight ( SharedTopWeight_t * pTopWeight )
+	{
+		m_pTopWeight = pTopWeight;
+	}
+
+	/// add entry to the queue
+	virtual bool Push ( const CSphMatch & tEntry )
+	{
+		m_iTotal++;
+
+		if_const ( NOTIFICATIONS )
+		{
+			m_iJustPushed = 0;
+			m_dJustPopped.Resize(0);
+		}
+
+		if ( m_iWorst>=0 && COMP::IsLess ( tEntry, m_pData[m_iWorst], m_tState ) )
+			return true;
+
+		if ( m_pAfter && !COMP::IsLess ( tEntry, m_pAfter->m_tMatch, m_tState ) )
+			return true;
+
+		if ( m_pTopWeight && tEntry.m_iWeight<m_pTopWeight->GetWeight() )
+			return true;
+
+		// pool is full; cut it, and recheck against the raised bar
+		if ( m_iUsed==m_iSize*COEFF )
+		{
+			Cut ( true );
+			if ( COMP::IsLess ( tEntry, m_pData[m_iWorst], m_tState ) )
+				return true;
+		}
+
+		m_tSchema.CloneMatch ( m_pData + m_dIdx[m_iUsed++], tEntry );
+		m_bSorted = false;
+
+		if_const ( NOTIFICATIONS )
+			m_iJustPushed = tEntry.m_uDocID;
+
+		return true;
+	}
+
+	/// add grouped entry (must not happen)
+	virtual bool PushGrouped ( const CSphMatch &, bool )
+	{
+		assert ( 0 );
+		return false;
+	}
+
+	/// current result set length
+	virtual int GetLength () const
+	{
+		return Min ( m_iUsed, m_iSize );
+	}
+
+	/// finalize, perform final cut and sort as needed, and evaluate in result set order
+	virtual void Finalize ( ISphMatchProcessor & tProcessor, bool )
+	{
+		if ( !GetLength() )
+			return;
+
+		Sort();
+		for ( int i=0; i<m_iUsed; i++ )
+			tProcessor.Process ( m_pData + m_dIdx[i] );
+	}
+
+	/// store all entries into specified location in sorted order, and remove them from queue
+	int Flatten ( CSphMatch * pTo, int iTag )
+	{
+		Sort();
+		for ( int i=0; i<m_iUsed; i++ )
+		{
+			m_tSchema.FreeStringPtrs ( pTo );
+			Swap ( *pTo, m_pData [ m_dIdx[i] ] );
+			if ( iTag>=0 )
+				pTo->m_iTag = iTag;
+			pTo++;
+		}
+
+		int iCopied = m_iUsed;
+		m_iTotal = 0;
+		m_iUsed = 0;
+		m_iWorst = -1;
+		m_bSorted = false;
+		return iCopied;
+	}
+
+protected:
+	/// move the best K matches to the front, free the rest, and raise the admission bar
+	void Cut ( bool bNotify )
+	{
+		assert ( m_iUsed>m_iSize );
+		CompareIndex_fn<COMP> tComp ( m_pData, &m_tState );
+		sphSelect ( m_dIdx.Begin(), m_iUsed, m_iSize-1, tComp );
+
+		if_const ( NOTIFICATIONS )
+		{
+			if ( bNotify )
+				for ( int i=m_iSize; i<m_iUsed; i++ )
+					m_dJustPopped.Add ( m_pData [ m_dIdx[i] ].m_uDocID );
+		}
+
+		m_iUsed = m_iSize;
+		m_iWorst = m_dIdx[m_iSize-1];
+
+		if ( m_pTopWeight )
+			m_pTopWeight->Publish ( m_pData[m_iWorst].m_iWeight );
+	}
+
+	/// cut to K and order the kept matches, unless that was already done
+	void Sort ()
+	{
+		if ( m_bSorted )
+			return;
+
+		if ( m_iUsed>m_iSize )
+			Cut ( false );
+
+		CompareIndex_fn<COMP> tComp ( m_pData, &m_tState );
+		sphSort ( m_dIdx.Begin(), m_iUsed, tComp );
+		m_bSorted = true;
+	}
+};
+
 //////////////////////////////////////////////////////////////////////////
 
 /// collector for UPDATE statement
@@ -680,11 +923,66 @@ static bool IsGroupbyMagic ( const CSphString & s )
 	};
 
 
+/// timestamp splitting grouper base
+/// adjacent matches mostly fall on the same local day, so the last one is remembered, and its stamps skip localtime_r()
+class CSphGrouperSplit : public CSphGrouper
+{
+protected:
+	CSphAttrLocator			m_tLocator;
+	mutable time_t			m_tDayStart;	///< local day of the last key, if any, as [start,end) stamps
+	mutable time_t			m_tDayEnd;
+	mutable SphGroupKey_t	m_uDayKey;
+
+public:
+	explicit CSphGrouperSplit ( const CSphAttrLocator & tLoc )
+		: m_tLocator ( tLoc )
+		, m_tDayStart ( 0 )
+		, m_tDayEnd ( 0 )
+		, m_uDayKey ( 0 )
+	{}
+
+	virtual void GetLocator ( CSphAttrLocator & tOut ) const { tOut = m_tLocator; }
+	virtual ESphAttr GetResultType () const { return m_tLocator.m_iBitCount>8*(int)sizeof(DWORD) ? SPH_ATTR_BIGINT : SPH_ATTR_INTEGER; }
+	virtual SphGroupKey_t KeyFromMatch ( const CSphMatch & tMatch ) const { return KeyFromValue ( tMatch.GetAttr ( m_tLocator ) ); }
+
+	virtual SphGroupKey_t KeyFromValue ( SphAttr_t uValue ) const
+	{
+		time_t tStamp = (time_t)uValue;
+		if ( tStamp>=m_tDayStart && tStamp<m_tDayEnd )
+			return m_uDayKey;
+
+		struct tm tSplit;
+		localtime_r ( &tStamp, &tSplit );
+		SphGroupKey_t uKey = KeyFromSplit ( tSplit );
+
+		// remember the day, unless it has a DST switch (then its first or last second is off)
+		time_t tStart = tStamp - ( tSplit.tm_hour*3600 + tSplit.tm_min*60 + tSplit.tm_sec );
+		time_t tLast = tStart + 86399;
+		struct tm tFirstSplit, tLastSplit;
+		localtime_r ( &tStart, &tFirstSplit );
+		localtime_r ( &tLast, &tLastSplit );
+		if ( tFirstSplit.tm_yday==tSplit.tm_yday && tFirstSplit.tm_hour==0 && tFirstSplit.tm_min==0 && tFirstSplit.tm_sec==0
+			&& tLastSplit.tm_yday==tSplit.tm_yday && tLastSplit.tm_hour==23 && tLastSplit.tm_min==59 && tLastSplit.tm_sec==59 )
+		{
+			m_tDayStart = tStart;
+			m_tDayEnd = tLast+1;
+			m_uDayKey = uKey;
+		}
+
+		return uKey;
+	}
+
+	virtual SphGroupKey_t KeyFromSplit ( const struct tm & tSplit ) const = 0;
+};
+
+
 #define GROUPER_BEGIN_SPLIT(_name) \
-	GROUPER_BEGIN(_name) \
-	time_t tStamp = (time_t)uValue; \
-	struct tm tSplit; \
-	localtime_r ( &tStamp, &tSplit );
+	class _name : public CSphGrouperSplit \
+	{ \
+	public: \
+		explicit _name ( const CSphAttrLocator & tLoc ) : CSphGrouperSplit ( tLoc ) {} \
+		virtual SphGroupKey_t KeyFromSplit ( const struct tm & tSplit ) const \
+		{
 
 
 GROUPER_BEGIN ( CSphGrouperAttr )
@@ -1675,6 +1973,8 @@ protected:
 	CSphGrouper *	m_pGrouper;
 
 	CSphFixedHash < CSphMatch *, SphGroupKey_t, IdentityHash_fn >	m_hGroup2Match;
+	CSphMatch *		m_pLastGroup;		///< group of the previous match, as matches often come in runs of one group
+	SphGroupKey_t	m_uLastGroup;
 
 protected:
 	int				m_iLimit;		///< max matches to be retrieved
@@ -1701,6 +2001,8 @@ public:
 		, m_eGroupBy ( pQuery->m_eGroupFunc )
 		, m_pGrouper ( tSettings.m_pGrouper )
 		, m_hGroup2Match ( pQuery->m_iMaxMatches*GROUPBY_FACTOR )
+		, m_pLastGroup ( NULL )
+		, m_uLastGroup ( 0 )
 		, m_iLimit ( pQuery->m_iMaxMatches )
 		, m_bSortByDistinct ( false )
 		, m_pComp ( pComp )
@@ -1788,13 +2090,16 @@ public:
 		}
 
 		// if this group is already hashed, we only need to update the corresponding match
-		CSphMatch ** ppMatch = m_hGroup2Match ( uGroupKey );
+		// groups that arrive contiguously (eg. by a docid-ordered timestamp) skip the hash lookup
+		CSphMatch ** ppMatch = ( m_pLastGroup && m_uLastGroup==uGroupKey ) ? &m_pLastGroup : m_hGroup2Match ( uGroupKey );
 		if ( ppMatch )
 		{
 			CSphMatch * pMatch = (*ppMatch);
 			assert ( pMatch );
 			assert ( pMatch->GetAttr ( m_tLocGroupby )==uGroupKey );
 			assert ( pMatch->m_pDynamic[-1]==tEntry.m_pDynamic[-1] );
+			m_pLastGroup = pMatch;
+			m_uLastGroup = uGroupKey;
 
 			if ( bGrouped )
 			{
@@ -1874,6 +2179,8 @@ public:
 		}
 
 		m_hGroup2Match.Add ( &tNew, uGroupKey );
+		m_pLastGroup = &tNew;
+		m_uLastGroup = uGroupKey;
 		m_iTotal++;
 		return true;
 	}
@@ -1938,6 +2245,7 @@ public:
 		m_iTotal = 0;
 
 		m_hGroup2Match.Reset ();
+		m_pLastGroup = NULL;
 		if_const ( DISTINCT )
 			m_tUniq.Resize ( 0 );
 
@@ -2036,6 +2344,7 @@ protected:
 	void SortGroups ()
 	{
 		sphSort ( m_pData, m_iUsed, m_tGroupSorter, m_tGroupSorter );
+		m_pLastGroup = NULL; // matches moved
 	}
 
 	virtual void Finalize ( ISphMatchProcessor & tProcessor, bool )
@@ -4013,12 +4322,12 @@ uint64_t ExprGeodist_t::GetHash ( const ISphSchema & tSorterSchema, uint64_t uPr
 // PUBLIC FUNCTIONS (FACTORY AND FLATTENING)
 //////////////////////////////////////////////////////////////////////////
 
-static CSphGrouper * sphCreateGrouperString ( const CSphAttrLocator & tLoc, ESphCollation eCollation );
+static CSphGrouper * sphCreateGrouperString ( const CSphAttrLocator & tLoc, ESphCollation eCollation, bool bStringDict );
 static CSphGrouper * sphCreateGrouperMulti ( const CSphVector<CSphAttrLocator> & dLocators, const CSphVector<ESphAttr> & dAttrTypes,
 											const CSphVector<ISphExpr *> & dJsonKeys, ESphCollation eCollation );
 
 static bool SetupGroupbySettings ( const CSphQuery * pQuery, const ISphSchema & tSchema,
-								CSphGroupSorterSettings & tSettings, CSphVector<int> & dGroupColumns, CSphString & sError, bool bImplicit )
+								CSphGroupSorterSettings & tSettings, CSphVector<int> & dGroupColumns, CSphString & sError, bool bImplicit, bool bStringDicts )
 {
 	tSettings.m_tDistinctLoc.m_iBitOffset = -1;
 
@@ -4166,7 +4475,7 @@ static bool SetupGroupbySettings ( const CSphQuery * pQuery, const ISphSchema &
 					tSettings.m_bJson = true;
 
 				} else if ( eType==SPH_ATTR_STRING )
-					tSettings.m_pGrouper = sphCreateGrouperString ( tLoc, pQuery->m_eCollation );
+					tSettings.m_pGrouper = sphCreateGrouperString ( tLoc, pQuery->m_eCollation, bStringDicts && tSchema.GetAttr ( iGroupBy ).m_uStringDict!=0 );
 				else
 					tSettings.m_pGrouper = new CSphGrouperAttr ( tLoc );
 				break;
@@ -4274,6 +4583,47 @@ struct ExprSortStringAttrFixup_c : public ISphExpr
 };
 
 
+// expression that computes the collation sort key of a string attribute
+struct ExprSortStringKey_c : public ISphExpr
+{
+	const BYTE *			m_pStrings; ///< string pool; base for offset of string attributes
+	const CSphAttrLocator	m_tLocator; ///< string attribute to compute the key of
+	const ESphCollation		m_eCollation;
+
+	ExprSortStringKey_c ( const CSphAttrLocator & tLocator, ESphCollation eCollation )
+		: m_pStrings ( NULL )
+		, m_tLocator ( tLocator )
+		, m_eCollation ( eCollation )
+	{
+	}
+
+	virtual float Eval ( const CSphMatch & ) const { assert ( 0 ); return 0.0f; }
+
+	virtual int64_t Int64Eval ( const CSphMatch & tMatch ) const
+	{
+		SphAttr_t uOff = tMatch.GetAttr ( m_tLocator );
+		if ( !m_pStrings || !uOff )
+			return 0;
+
+		const BYTE * pStr = NULL;
+		int iLen = sphUnpackStr ( m_pStrings + uOff, &pStr );
+		return (int64_t)sphCollateKey ( pStr, iLen, m_eCollation );
+	}
+
+	virtual void Command ( ESphExprCommand eCmd, void * pArg )
+	{
+		if ( eCmd==SPH_EXPR_SET_STRING_POOL )
+			m_pStrings = (const BYTE*)pArg;
+	}
+
+	virtual uint64_t GetHash ( const ISphSchema &, uint64_t, bool & )
+	{
+		assert ( 0 && "remap expressions in filters" );
+		return 0;
+	}
+};
+
+
 // expression that transform string pool base + offset -> ptr
 struct ExprSortJson2StringPtr_c : public ISphExpr
 {
@@ -4391,7 +4741,7 @@ bool sphIsSortStringInternal ( const char * sColumnName )
 
 
 // only STRING ( static packed ) and JSON fields mush be remapped
-static void SetupSortRemap ( CSphRsetSchema & tSorterSchema, CSphMatchComparatorState & tState )
+static void SetupSortRemap ( CSphRsetSchema & tSorterSchema, CSphMatchComparatorState & tState, ESphCollation eCollation, bool bStringDicts )
 {
 #ifndef NDEBUG
 	int iColWasCount = tSorterSchema.GetAttrsCount();
@@ -4428,6 +4778,12 @@ static void SetupSortRemap ( CSphRsetSchema & tSorterSchema, CSphMatchComparator
 			else
 				tRemapCol.m_pExpr = new ExprSortStringAttrFixup_c ( tState.m_tLocator[i] );
 
+			// dictionary ranks follow libc_ci order, so they can replace the collation call
+			// but ranks of different indexes are not comparable, so only sorters of a single index use them
+			const CSphColumnInfo & tCol = tSorterSchema.GetAttr ( tState.m_dAttrs[i] );
+			if ( bStringDicts && !bIsJson && tCol.m_eAttrType==SPH_ATTR_STRING && tCol.m_uStringDict && eCollation==SPH_COLLATION_LIBC_CI )
+				tState.m_uStringRanks |= ( 1<<i );
+
 			if ( bIsFunc )
 			{
 				tRemapCol.m_eAttrType = tState.m_tSubType[i];
@@ -4437,6 +4793,30 @@ static void SetupSortRemap ( CSphRsetSchema & tSorterSchema, CSphMatchComparator
 			iRemap = tSorterSchema.GetAttrsCount();
 			tSorterSchema.AddDynamicAttr ( tRemapCol );
 		}
+
+		// collation key prefix, computed once per match, so most comparisons skip the collation call
+		if ( !bIsJson && !( tState.m_uStringRanks & ( 1<<i ) ) )
+		{
+			CSphString sKeyCol;
+			sKeyCol.SetSprintf ( "%s@key", sRemapCol.cstr() );
+
+			int iKey = tSorterSchema.GetAttrIndex ( sKeyCol.cstr() );
+			if ( iKey==-1 && eCollation!=SPH_COLLATION_LIBC_CS )
+			{
+				CSphColumnInfo tKeyCol ( sKeyCol.cstr(), SPH_ATTR_BIGINT );
+				tKeyCol.m_eStage = SPH_EVAL_PRESORT;
+				tKeyCol.m_pExpr = new ExprSortStringKey_c ( tState.m_tLocator[i], eCollation );
+
+				iKey = tSorterSchema.GetAttrsCount();
+				tSorterSchema.AddDynamicAttr ( tKeyCol );
+			}
+
+			if ( iKey>=0 )
+			{
+				tState.m_uStringKeys |= ( 1<<i );
+				tState.m_tKeyLocator[i] = tSorterSchema.GetAttr ( iKey ).m_tLocator;
+			}
+		}
 		tState.m_tLocator[i] = tSorterSchema.GetAttr ( iRemap ).m_tLocator;
 	}
 }
@@ -4772,6 +5152,53 @@ int sphCollateUtf8GeneralCI ( const BYTE * pArg1, const BYTE * pArg2, bool bPack
 }
 
 
+/////////////////////////////
+// collation sort keys
+/////////////////////////////
+
+// the low bit is always set, so that a computed key is never zero
+// shorter strings pad with zero bits and sort before longer ones, just like the collations do
+
+uint64_t sphCollateKey ( const BYTE * pStr, int iLen, ESphCollation eCollation )
+{
+	if ( !pStr )
+		return 0;
+
+	const BYTE * pMax = pStr + iLen;
+	uint64_t uKey = 0;
+	switch ( eCollation )
+	{
+	case SPH_COLLATION_BINARY:
+		// 7 raw bytes
+		for ( int i=0; i<7 && pStr<pMax; i++ )
+			uKey |= uint64_t ( *pStr++ ) << ( 56-8*i );
+		break;
+
+	case SPH_COLLATION_LIBC_CI:
+		// 7 lowercased bytes; strncasecmp stops at zero bytes, so the key does too
+		for ( int i=0; i<7 && pStr<pMax && *pStr; i++ )
+			uKey |= uint64_t ( (BYTE) tolower ( *pStr++ ) ) << ( 56-8*i );
+		break;
+
+	case SPH_COLLATION_UTF8_GENERAL_CI:
+		// 3 collated codepoints, 21 bits each; zero or broken codepoints end the key
+		for ( int i=0; i<3 && pStr<pMax; i++ )
+		{
+			int iCode = sphUTF8Decode ( pStr );
+			if ( iCode<=0 || iCode>0x1fffff )
+				break;
+			uKey |= uint64_t ( CollateUTF8CI ( iCode ) & 0x1fffff ) << ( 43-21*i );
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	return uKey | 1;
+}
+
+
 /////////////////////////////
 // hashing functions
 /////////////////////////////
@@ -4831,6 +5258,12 @@ public:
 };
 
 
+uint64_t sphHashLibcCI ( const BYTE * pStr, int iLen )
+{
+	return LibcCIHash_fn().Hash ( pStr, iLen );
+}
+
+
 class Utf8CIHash_fn
 {
 public:
@@ -4852,10 +5285,32 @@ public:
 };
 
 
-CSphGrouper * sphCreateGrouperString ( const CSphAttrLocator & tLoc, ESphCollation eCollation )
+/// dictionary encoded string grouper
+/// reads the libc_ci hash stored in front of every dictionary entry instead of hashing the string
+class CSphGrouperStringDict : public CSphGrouperString<LibcCIHash_fn>
+{
+public:
+	explicit CSphGrouperStringDict ( const CSphAttrLocator & tLoc )
+		: CSphGrouperString<LibcCIHash_fn> ( tLoc )
+	{
+	}
+
+	virtual SphGroupKey_t KeyFromValue ( SphAttr_t uValue ) const
+	{
+		if ( !m_pStringBase || !uValue )
+			return 0;
+
+		return sphUnalignedRead ( *(const SphGroupKey_t*)( m_pStringBase + uValue - 12 ) );
+	}
+};
+
+
+CSphGrouper * sphCreateGrouperString ( const CSphAttrLocator & tLoc, ESphCollation eCollation, bool bStringDict )
 {
 	if ( eCollation==SPH_COLLATION_UTF8_GENERAL_CI )
 		return new CSphGrouperString<Utf8CIHash_fn> ( tLoc );
+	else if ( eCollation==SPH_COLLATION_LIBC_CI && bStringDict )
+		return new CSphGrouperStringDict ( tLoc );
 	else if ( eCollation==SPH_COLLATION_LIBC_CI )
 		return new CSphGrouperString<LibcCIHash_fn> ( tLoc );
 	else if ( eCollation==SPH_COLLATION_LIBC_CS )
@@ -4882,8 +5337,11 @@ CSphGrouper * sphCreateGrouperMulti ( const CSphVector<CSphAttrLocator> & dLocat
 // SORTING QUEUE FACTORY
 /////////////////////////
 
+/// from this many matches on, k-selection beats the heap
+static const int KSELECT_MIN_MATCHES = 4096;
+
 template < typename COMP >
-static ISphMatchSorter * CreatePlainSorter ( bool bKbuffer, int iMaxMatches, bool bUsesAttrs, bool bFactors )
+static CSphMatchQueueTraits * CreatePlainSorter ( bool bKbuffer, bool bKselect, int iMaxMatches, bool bUsesAttrs, bool bFactors )
 {
 	if ( bKbuffer )
 	{
@@ -4891,6 +5349,12 @@ static ISphMatchSorter * CreatePlainSorter ( bool bKbuffer, int iMaxMatches, boo
 			return new CSphKbufferMatchQueue<COMP, true> ( iMaxMatches, bUsesAttrs );
 		else
 			return new CSphKbufferMatchQueue<COMP, false> ( iMaxMatches, bUsesAttrs );
+	} else if ( bKselect )
+	{
+		if ( bFactors )
+			return new CSphKselectMatchQueue<COMP, true> ( iMaxMatches, bUsesAttrs );
+		else
+			return new CSphKselectMatchQueue<COMP, false> ( iMaxMatches, bUsesAttrs );
 	} else
 	{
 		if ( bFactors )
@@ -4901,24 +5365,223 @@ static ISphMatchSorter * CreatePlainSorter ( bool bKbuffer, int iMaxMatches, boo
 }
 
 
-static ISphMatchSorter * CreatePlainSorter ( ESphSortFunc eMatchFunc, bool bKbuffer, int iMaxMatches, bool bUsesAttrs, bool bFactors )
+static CSphMatchQueueTraits * CreatePlainSorter ( ESphSortFunc eMatchFunc, bool bKbuffer, bool bKselect, int iMaxMatches, bool bUsesAttrs, bool bFactors )
 {
 	switch ( eMatchFunc )
 	{
-		case FUNC_REL_DESC:		return CreatePlainSorter<MatchRelevanceLt_fn>	( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_ATTR_DESC:	return CreatePlainSorter<MatchAttrLt_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_ATTR_ASC:		return CreatePlainSorter<MatchAttrGt_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_TIMESEGS:		return CreatePlainSorter<MatchTimeSegments_fn>	( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_GENERIC2:		return CreatePlainSorter<MatchGeneric2_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_GENERIC3:		return CreatePlainSorter<MatchGeneric3_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_GENERIC4:		return CreatePlainSorter<MatchGeneric4_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_GENERIC5:		return CreatePlainSorter<MatchGeneric5_fn>		( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
-		case FUNC_EXPR:			return CreatePlainSorter<MatchExpr_fn>			( bKbuffer, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_REL_DESC:		return CreatePlainSorter<MatchRelevanceLt_fn>	( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_ATTR_DESC:	return CreatePlainSorter<MatchAttrLt_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_ATTR_ASC:		return CreatePlainSorter<MatchAttrGt_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_TIMESEGS:		return CreatePlainSorter<MatchTimeSegments_fn>	( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_GENERIC2:		return CreatePlainSorter<MatchGeneric2_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_GENERIC3:		return CreatePlainSorter<MatchGeneric3_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_GENERIC4:		return CreatePlainSorter<MatchGeneric4_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_GENERIC5:		return CreatePlainSorter<MatchGeneric5_fn>		( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
+		case FUNC_EXPR:			return CreatePlainSorter<MatchExpr_fn>			( bKbuffer, bKselect, iMaxMatches, bUsesAttrs, bFactors ); break;
 		default:				return NULL;
 	}
 }
 
 
+static bool ParseSearchAfterValue ( const CSphString & sValue, ESphSortKeyPart eKey, const CSphAttrLocator & tLoc,
+	SearchAfter_t & tAfter, CSphString & sError )
+{
+	const char * sStart = sValue.cstr();
+	char * sEnd = NULL;
+	switch ( eKey )
+	{
+		case SPH_KEYPART_ID:		tAfter.m_tMatch.m_uDocID = (SphDocID_t) strtoull ( sStart, &sEnd, 10 ); break;
+		case SPH_KEYPART_WEIGHT:	tAfter.m_tMatch.m_iWeight = (int) strtol ( sStart, &sEnd, 10 ); break;
+		case SPH_KEYPART_INT:
+		case SPH_KEYPART_FLOAT:
+		{
+			SphAttr_t uValue;
+			// float is parsed straight to single precision, so a %.9g (or hex) value round-trips exactly
+			if ( eKey==SPH_KEYPART_INT )
+				uValue = (SphAttr_t) strtoll ( sStart, &sEnd, 10 );
+			else
+				uValue = sphF2DW ( strtof ( sStart, &sEnd ) );
+
+			if ( tLoc.m_bDynamic )
+				tAfter.m_tMatch.SetAttr ( tLoc, uValue );
+			else
+				sphSetRowAttr ( tAfter.m_dStatic.Begin(), tLoc, uValue );
+			break;
+		}
+		default:
+			sError = "search_after does not work with string sort keys";
+			return false;
+	}
+
+	while ( sEnd && sphIsSpace ( *sEnd ) )
+		sEnd++;
+	if ( !sEnd || sEnd==sStart || *sEnd )
+	{
+		sError.SetSprintf ( "search_after: malformed value '%s'", sStart );
+		return false;
+	}
+	return true;
+}
+
+
+/// sort keys that make up search_after cursor, in ORDER BY order
+struct SearchAfterKeys_t
+{
+	ESphSortKeyPart		m_dKeys[CSphMatchComparatorState::MAX_ATTRS];
+	CSphAttrLocator		m_dLocators[CSphMatchComparatorState::MAX_ATTRS];
+	int					m_iKeys;
+	bool				m_bGotId;	///< id is one of the keys; otherwise it follows them as a tie-breaker
+
+	SearchAfterKeys_t () : m_iKeys ( 0 ), m_bGotId ( false ) {}
+};
+
+
+static bool GetSearchAfterKeys ( ESphSortFunc eMatchFunc, const CSphMatchComparatorState & tState, SearchAfterKeys_t & tKeys, CSphString & sError )
+{
+	switch ( eMatchFunc )
+	{
+		case FUNC_REL_DESC:		tKeys.m_dKeys[tKeys.m_iKeys++] = SPH_KEYPART_WEIGHT; break;
+		case FUNC_ATTR_DESC:
+		case FUNC_ATTR_ASC:		tKeys.m_dKeys[tKeys.m_iKeys] = tState.m_eKeypart[0]; tKeys.m_dLocators[tKeys.m_iKeys++] = tState.m_tLocator[0]; break;
+		case FUNC_EXPR:			tKeys.m_dKeys[tKeys.m_iKeys] = SPH_KEYPART_FLOAT; tKeys.m_dLocators[tKeys.m_iKeys++] = tState.m_tLocator[0]; break;
+		case FUNC_GENERIC2:
+		case FUNC_GENERIC3:
+		case FUNC_GENERIC4:
+		case FUNC_GENERIC5:
+			for ( int i=0; i<=eMatchFunc-FUNC_GENERIC2+1; i++ )
+			{
+				// implicit id tie-breaker might repeat an explicit id key
+				bool bId = ( tState.m_eKeypart[i]==SPH_KEYPART_ID );
+				if ( bId && tKeys.m_bGotId )
+					continue;
+
+				tKeys.m_bGotId |= bId;
+				tKeys.m_dKeys[tKeys.m_iKeys] = tState.m_eKeypart[i];
+				tKeys.m_dLocators[tKeys.m_iKeys++] = tState.m_tLocator[i];
+			}
+			break;
+		default:
+			sError = "search_after does not work with time segments sorting";
+			return false;
+	}
+	return true;
+}
+
+
+/// parse search_after cursor, ie. the sort key values of the last match of the previous page,
+/// followed by its document id (unless id is one of the sort keys already)
+static SearchAfter_t * ParseSearchAfter ( const CSphString & sAfter, ESphSortFunc eMatchFunc,
+	const CSphMatchComparatorState & tState, const ISphSchema & tSchema, CSphString & sError )
+{
+	SearchAfterKeys_t tKeys;
+	if ( !GetSearchAfterKeys ( eMatchFunc, tState, tKeys, sError ) )
+		return NULL;
+
+	CSphVector<CSphString> dValues;
+	sphSplit ( dValues, sAfter.cstr(), "," );
+	int iValues = tKeys.m_iKeys + ( tKeys.m_bGotId ? 0 : 1 );
+	if ( dValues.GetLength()!=iValues )
+	{
+		sError.SetSprintf ( "search_after: expected %d values (sort keys%s), got %d", iValues,
+			tKeys.m_bGotId ? "" : " and id", dValues.GetLength() );
+		return NULL;
+	}
+
+	CSphScopedPtr<SearchAfter_t> pAfter ( new SearchAfter_t ( tSchema.GetStaticSize() ) );
+	pAfter->m_tMatch.Reset ( tSchema.GetDynamicSize() );
+	for ( int i=0; i<tKeys.m_iKeys; i++ )
+		if ( !ParseSearchAfterValue ( dValues[i], tKeys.m_dKeys[i], tKeys.m_dLocators[i], *pAfter.Ptr(), sError ) )
+			return NULL;
+
+	if ( !tKeys.m_bGotId && !ParseSearchAfterValue ( dValues.Last(), SPH_KEYPART_ID, tKeys.m_dLocators[0], *pAfter.Ptr(), sError ) )
+		return NULL;
+
+	return pAfter.LeakPtr();
+}
+
+
+bool sphFormatSearchAfter ( const CSphQuery & tQuery, const ISphSchema & tSchema, const CSphMatch & tMatch, CSphString & sCursor )
+{
+	// same match order setup as the sorters do
+	ESphSortFunc eMatchFunc = FUNC_REL_DESC;
+	CSphMatchComparatorState tState;
+	CSphString sError;
+	switch ( tQuery.m_eSort )
+	{
+		case SPH_SORT_EXTENDED:
+		{
+			for ( int i=0; i<CSphMatchComparatorState::MAX_ATTRS; i++ )
+				tState.m_tSubExpr[i] = NULL;
+			if ( sphParseSortClause ( &tQuery, tQuery.m_sSortBy.cstr(), tSchema, eMatchFunc, tState, sError )!=SORT_CLAUSE_OK )
+				return false;
+
+			// json keys and functions are evaluated on the fly, so there's no stored value to take
+			bool bJson = false;
+			for ( int i=0; i<CSphMatchComparatorState::MAX_ATTRS; i++ )
+			{
+				bJson |= ( tState.m_tSubExpr[i]!=NULL );
+				SafeRelease ( tState.m_tSubExpr[i] );
+			}
+			if ( bJson )
+				return false;
+			break;
+		}
+
+		case SPH_SORT_EXPR:
+		{
+			int iExpr = tSchema.GetAttrIndex ( "@expr" );
+			if ( iExpr<0 )
+				return false;
+			tState.m_tLocator[0] = tSchema.GetAttr ( iExpr ).m_tLocator;
+			eMatchFunc = FUNC_EXPR;
+			break;
+		}
+
+		case SPH_SORT_ATTR_DESC:
+		case SPH_SORT_ATTR_ASC:
+		{
+			int iAttr = tSchema.GetAttrIndex ( tQuery.m_sSortBy.cstr() );
+			if ( iAttr<0 )
+				return false;
+			tState.m_eKeypart[0] = Attr2Keypart ( tSchema.GetAttr ( iAttr ).m_eAttrType );
+			tState.m_tLocator[0] = tSchema.GetAttr ( iAttr ).m_tLocator;
+			eMatchFunc = ( tQuery.m_eSort==SPH_SORT_ATTR_DESC ) ? FUNC_ATTR_DESC : FUNC_ATTR_ASC;
+			break;
+		}
+
+		case SPH_SORT_RELEVANCE:
+			break;
+
+		default:
+			return false;
+	}
+
+	SearchAfterKeys_t tKeys;
+	if ( !GetSearchAfterKeys ( eMatchFunc, tState, tKeys, sError ) )
+		return false;
+
+	CSphStringBuilder sOut;
+	for ( int i=0; i<tKeys.m_iKeys; i++ )
+	{
+		const char * sSep = i ? "," : "";
+		switch ( tKeys.m_dKeys[i] )
+		{
+			case SPH_KEYPART_ID:		sOut.Appendf ( "%s" DOCID_FMT, sSep, tMatch.m_uDocID ); break;
+			case SPH_KEYPART_WEIGHT:	sOut.Appendf ( "%s%d", sSep, tMatch.m_iWeight ); break;
+			case SPH_KEYPART_INT:		sOut.Appendf ( "%s" INT64_FMT, sSep, (int64_t)tMatch.GetAttr ( tKeys.m_dLocators[i] ) ); break;
+			// 9 significant digits are enough to tell any two floats apart
+			case SPH_KEYPART_FLOAT:		sOut.Appendf ( "%s%.9g", sSep, sphDW2F ( (DWORD)tMatch.GetAttr ( tKeys.m_dLocators[i] ) ) ); break;
+			default:					return false;
+		}
+	}
+	if ( !tKeys.m_bGotId )
+		sOut.Appendf ( "," DOCID_FMT, tMatch.m_uDocID );
+
+	sCursor = sOut.cstr();
+	return true;
+}
+
+
 static void ExtraAddSortkeys ( CSphSchema * pExtra, const ISphSchema & tSorterSchema, const int * dAttrs )
 {
 	if ( pExtra )
@@ -5237,7 +5900,7 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 			bImplicit = ( t.m_eAggrFunc!=SPH_AGGR_NONE ) || t.m_sExpr=="count(*)" || t.m_sExpr=="@distinct";
 		}
 
-	if ( !SetupGroupbySettings ( pQuery, tSorterSchema, tSettings, dGroupColumns, sError, bImplicit ) )
+	if ( !SetupGroupbySettings ( pQuery, tSorterSchema, tSettings, dGroupColumns, sError, bImplicit, tQueue.m_bStringDicts ) )
 		return NULL;
 
 	const bool bGotGroupby = !pQuery->m_sGroupBy.IsEmpty() || tSettings.m_bImplicit; // or else, check in SetupGroupbySettings() would already fail
@@ -5390,7 +6053,7 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 					bUsesAttrs = true;
 			}
 		}
-		SetupSortRemap ( tSorterSchema, tStateMatch );
+		SetupSortRemap ( tSorterSchema, tStateMatch, pQuery->m_eCollation, tQueue.m_bStringDicts );
 
 	} else if ( pQuery->m_eSort==SPH_SORT_EXPR )
 	{
@@ -5416,7 +6079,7 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 			tStateMatch.m_eKeypart[0] = Attr2Keypart ( tAttr.m_eAttrType );
 			tStateMatch.m_tLocator[0] = tAttr.m_tLocator;
 			tStateMatch.m_dAttrs[0] = iSortAttr;
-			SetupSortRemap ( tSorterSchema, tStateMatch );
+			SetupSortRemap ( tSorterSchema, tStateMatch, pQuery->m_eCollation, tQueue.m_bStringDicts );
 		}
 
 		// find out what function to use and whether it needs attributes
@@ -5470,7 +6133,7 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 		FixupDependency ( tSorterSchema, tStateGroup.m_dAttrs, CSphMatchComparatorState::MAX_ATTRS );
 
 		// GroupSortBy str attributes setup
-		SetupSortRemap ( tSorterSchema, tStateGroup );
+		SetupSortRemap ( tSorterSchema, tStateGroup, pQuery->m_eCollation, tQueue.m_bStringDicts );
 	}
 
 	// set up aggregate filter for grouper
@@ -5505,6 +6168,21 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 			return NULL;
 	}
 
+	// search_after cursor only makes sense for a plain well-defined order
+	SearchAfter_t * pAfter = NULL;
+	if ( !pQuery->m_sSearchAfter.IsEmpty() && !tQueue.m_pUpdate && !tQueue.m_pDeletes )
+	{
+		if ( bGotGroupby || bRandomize || pQuery->m_bHasOuter )
+		{
+			sError = "search_after does not work with grouping, random order, or subselects";
+			return NULL;
+		}
+
+		pAfter = ParseSearchAfter ( pQuery->m_sSearchAfter, eMatchFunc, tStateMatch, tSorterSchema, sError );
+		if ( !pAfter )
+			return NULL;
+	}
+
 	///////////////////
 	// spawn the queue
 	///////////////////
@@ -5516,7 +6194,24 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 		else if ( tQueue.m_pDeletes )
 			pTop = new CSphDeleteQueue ( pQuery->m_iMaxMatches, tQueue.m_pDeletes );
 		else
-			pTop = CreatePlainSorter ( eMatchFunc, pQuery->m_bSortKbuffer, pQuery->m_iMaxMatches, bUsesAttrs, uPackedFactorFlags & SPH_FACTOR_ENABLE );
+		{
+			// k-selection only pays off on big queues, and has no exact worst match for min_top_xxx() to peek at
+			bool bKselect = !pQuery->m_bSortKbuffer && pQuery->m_iMaxMatches>=KSELECT_MIN_MATCHES;
+			for ( int i=0; i<tSorterSchema.GetAttrsCount() && bKselect; i++ )
+			{
+				bool bMinTop = false;
+				if ( tSorterSchema.GetAttr(i).m_pExpr.Ptr() )
+					tSorterSchema.GetAttr(i).m_pExpr->Command ( SPH_EXPR_GET_MIN_TOP, &bMinTop );
+				bKselect = !bMinTop;
+			}
+
+			CSphMatchQueueTraits * pQueue = CreatePlainSorter ( eMatchFunc, pQuery->m_bSortKbuffer, bKselect, pQuery->m_iMaxMatches, bUsesAttrs, uPackedFactorFlags & SPH_FACTOR_ENABLE );
+			if ( pQueue )
+				pQueue->SetSearchAfter ( pAfter );
+			else
+				SafeDelete ( pAfter );
+			pTop = pQueue;
+		}
 	} else
 	{
 		pTop = sphCreateSorter1st ( eMatchFunc, eGroupFunc, pQuery, tSettings, uPackedFactorFlags & SPH_FACTOR_ENABLE );
@@ -5555,6 +6250,12 @@ ISphMatchSorter * sphCreateQueue ( SphQueueSettings_t & tQueue )
 	pTop->SetSchema ( tSorterSchema );
 	pTop->m_bRandomize = bRandomize;
 
+	// weight is the first sort key, so matches of other local indexes tell which weights are hopeless
+	bool bWeightFirst = ( eMatchFunc==FUNC_REL_DESC
+		|| ( eMatchFunc>=FUNC_GENERIC2 && eMatchFunc<=FUNC_GENERIC5 && tStateMatch.m_eKeypart[0]==SPH_KEYPART_WEIGHT && ( tStateMatch.m_uAttrDesc & 1 ) ) );
+	if ( tQueue.m_pTopWeight && bWeightFirst && !bGotGroupby && !bRandomize && !tQueue.m_pUpdate && !tQueue.m_pDeletes )
+		pTop->SetSharedTopWeight ( tQueue.m_pTopWeight );
+
 	if ( bRandomize )
 	{
 		if ( pQuery->m_iRandSeed>=0 )
@@ -5583,6 +6284,95 @@ int sphFlattenQueue ( ISphMatchSorter * pQueue, CSphQueryResult * pResult, int i
 }
 
 
+struct MergeCursor_t
+{
+	int m_iCur;
+	int m_iEnd;
+};
+
+/// flattened local sorters and agent replies are ordered already, so the master merges them instead of pushing
+/// the copy of every document that TaggedMatchSorter_fn prefers is kept; stops as soon as max_matches documents are out
+bool sphMergeSortedSets ( const ISphMatchSorter & tSorter, CSphSwapVector<CSphMatch> & dMatches, const CSphVector<int> & dCounts,
+	int iMaxMatches, const ISphSchema & tSchema, int & iDupes )
+{
+	TaggedMatchSorter_fn fnTagged;
+
+	// check the order and choose the winning copy of every document (the same way the docid sort does)
+	CSphHash<int> hWinners ( dMatches.GetLength()*2 );
+	CSphVector<MergeCursor_t> dHeap;
+	int iDocDupes = 0;
+	int iCur = 0;
+	ARRAY_FOREACH ( iSet, dCounts )
+	{
+		int iEnd = iCur + dCounts[iSet];
+		for ( int i=iCur; i<iEnd; i++ )
+		{
+			if ( i>iCur && tSorter.IsBetter ( dMatches[i], dMatches[i-1] ) )
+				return false;
+
+			int64_t iDocid = (int64_t)dMatches[i].m_uDocID;
+			if ( iDocid==LLONG_MAX || iDocid==LLONG_MAX-1 ) // reserved by the hash
+				return false;
+
+			int & iWinner = hWinners.FindOrAdd ( iDocid, i );
+			if ( iWinner==i )
+				continue;
+			++iDocDupes;
+			if ( fnTagged.IsLess ( dMatches[i], dMatches[iWinner] ) )
+				iWinner = i;
+		}
+		if ( iEnd>iCur )
+			dHeap.Add ( { iCur, iEnd } );
+		iCur = iEnd;
+	}
+
+	// heap of the sets, the one with the best current match on top
+	auto fnBetter = [&] ( const MergeCursor_t & a, const MergeCursor_t & b )
+	{
+		return tSorter.IsBetter ( dMatches[a.m_iCur], dMatches[b.m_iCur] );
+	};
+	auto fnSiftDown = [&] ( int iEntry )
+	{
+		for ( ;; )
+		{
+			int iChild = iEntry*2 + 1;
+			if ( iChild>=dHeap.GetLength() )
+				break;
+			if ( iChild+1<dHeap.GetLength() && fnBetter ( dHeap[iChild+1], dHeap[iChild] ) )
+				++iChild;
+			if ( !fnBetter ( dHeap[iChild], dHeap[iEntry] ) )
+				break;
+			Swap ( dHeap[iChild], dHeap[iEntry] );
+			iEntry = iChild;
+		}
+	};
+	for ( int i=dHeap.GetLength()/2-1; i>=0; --i )
+		fnSiftDown ( i );
+
+	// matches are moved, not cloned; they're in the sorter schema already
+	CSphSwapVector<CSphMatch> dMerged;
+	dMerged.Reserve ( Min ( iMaxMatches, hWinners.GetLength() ) );
+	while ( dHeap.GetLength() && dMerged.GetLength()<iMaxMatches )
+	{
+		MergeCursor_t & tTop = dHeap[0];
+		int iMatch = tTop.m_iCur++;
+		if ( *hWinners.Find ( (int64_t)dMatches[iMatch].m_uDocID )==iMatch )
+			Swap ( dMerged.Add(), dMatches[iMatch] );
+
+		if ( tTop.m_iCur==tTop.m_iEnd )
+			dHeap.RemoveFast ( 0 );
+		fnSiftDown ( 0 );
+	}
+
+	ARRAY_FOREACH ( i, dMatches )
+		tSchema.FreeStringPtrs ( &dMatches[i] );
+	dMatches.SwapData ( dMerged );
+
+	iDupes = iDocDupes;
+	return true;
+}
+
+
 bool sphHasExpressions ( const CSphQuery & tQuery, const CSphSchema & tSchema )
 {
 	ARRAY_FOREACH ( i, tQuery.m_dItems )
@@ -638,6 +638,56 @@ void sphSort ( T * pData, int iCount )
 	sphSort ( pData, iCount, SphLess_T<T>() );
 }
 
+
+/// generic selection (introselect)
+/// reorders data so that pData[iNth] is what a full sort would put there,
+/// with nothing greater before it and nothing lesser after it
+template < typename T, typename U >
+void sphSelect ( T * pData, int iCount, int iNth, U COMP )
+{
+	if ( iNth<0 || iNth>=iCount )
+		return;
+
+	const int SMALL_THRESH = 32;
+	int iDepthLimit = 2*sphLog2 ( iCount );
+
+	int a = 0;
+	int b = iCount-1;
+	while ( b-a>SMALL_THRESH )
+	{
+		// if quickselect fails on this data; sort what is left
+		if ( !--iDepthLimit )
+			break;
+
+		T x = pData [ a+(b-a)/2 ];
+		int i = a;
+		int j = b;
+		while ( i<=j )
+		{
+			while ( COMP.IsLess ( pData[i], x ) )
+				i++;
+			while ( COMP.IsLess ( x, pData[j] ) )
+				j--;
+			if ( i<=j )
+			{
+				Swap ( pData[i], pData[j] );
+				i++;
+				j--;
+			}
+		}
+
+		// everything in (j,i) equals the pivot
+		if ( iNth<=j )
+			b = j;
+		else if ( iNth>=i )
+			a = i;
+		else
+			return;
+	}
+
+	sphSort ( pData+a, b-a+1, COMP );
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 /// member functor, wraps object member access
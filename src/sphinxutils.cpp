@@ -548,6 +548,7 @@ static KeyDesc_t g_dKeysIndex[] =
 	{ "agent_persistent",		KEY_LIST, NULL },
 	{ "agent_connect_timeout",	0, NULL },
 	{ "ha_strategy",			0, NULL	},
+	{ "ha_hedge_delay",		0, NULL	},
 	{ "agent_query_timeout",	0, NULL },
 	{ "html_strip",				0, NULL },
 	{ "html_index_attrs",		0, NULL },
@@ -575,6 +576,7 @@ static KeyDesc_t g_dKeysIndex[] =
 	{ "rt_attr_multi",			KEY_LIST, NULL },
 	{ "rt_attr_multi_64",		KEY_LIST, NULL },
 	{ "rt_attr_json",			KEY_LIST, NULL },
+	{ "rt_attr_json_extract",	KEY_LIST, NULL },
 	{ "rt_attr_bool",			KEY_LIST, NULL },
 	{ "rt_mem_limit",			0, NULL },
 	{ "dict",					0, NULL },
@@ -591,6 +593,11 @@ static KeyDesc_t g_dKeysIndex[] =
 	{ "rlp_context",			0, NULL },
 	{ "ondisk_attrs",			0, NULL },
 	{ "index_token_filter",		0, NULL },
+	{ "dict_fst",				0, NULL },
+	{ "infix_trigrams",			0, NULL },
+	{ "string_dictionary",		0, NULL },
+	{ "geo_grid",				0, NULL },
+	{ "sort_by",				0, NULL },
 	{ NULL,						0, NULL }
 };
 
@@ -645,6 +652,10 @@ static KeyDesc_t g_dKeysSearchd[] =
 	{ "binlog_flush",			0, NULL },
 	{ "binlog_path",			0, NULL },
 	{ "binlog_max_log_size",	0, NULL },
+	{ "binlog_group_commit",	0, NULL },
+	{ "binlog_group_commit_delay",	0, NULL },
+	{ "binlog_per_index",		0, NULL },
+	{ "binlog_format",		0, NULL },
 	{ "thread_stack",			0, NULL },
 	{ "expansion_limit",		0, NULL },
 	{ "rt_flush_period",		0, NULL },
@@ -663,6 +674,8 @@ static KeyDesc_t g_dKeysSearchd[] =
 	{ "ha_period_karma",		0, NULL },
 	{ "predicted_time_costs",	0, NULL },
 	{ "persistent_connections_limit",	0, NULL },
+	{ "agent_multiplex",				0, NULL },
+	{ "agent_compression",			0, NULL },
 	{ "ondisk_attrs_default",	0, NULL },
 	{ "shutdown_timeout",		0, NULL },
 	{ "query_log_min_msec",		0, NULL },
@@ -675,10 +688,12 @@ static KeyDesc_t g_dKeysSearchd[] =
 	{ "net_throttle_accept",	0, NULL },
 	{ "net_send_job",			0, NULL },
 	{ "net_workers",			0, NULL },
+	{ "net_reuseport",			0, NULL },
 	{ "queue_max_length",		0, NULL },
 	{ "qcache_ttl_sec",			0, NULL },
 	{ "qcache_max_bytes",		0, NULL },
 	{ "qcache_thresh_msec",		0, NULL },
+	{ "expansion_cache_max_bytes",	0, NULL },
 	{ "sphinxql_timeout",		0, NULL },
 	{ "hostname_lookup",		0, NULL },
 	{ NULL,						0, NULL }
@@ -691,6 +706,7 @@ static KeyDesc_t g_dKeysCommon[] =
 	{ "on_json_attr_error",		0, NULL },
 	{ "json_autoconv_numbers",	0, NULL },
 	{ "json_autoconv_keynames",	0, NULL },
+	{ "json_key_directory",		0, NULL },
 	{ "rlp_root",				0, NULL },
 	{ "rlp_environment",		0, NULL },
 	{ "rlp_max_batch_size",		0, NULL },
@@ -1427,6 +1443,8 @@ bool sphConfIndex ( const CSphConfigSection & hIndex, CSphIndexSettings & tSetti
 	tSettings.m_iEmbeddedLimit = hIndex.GetSize ( "embedded_limit", 16384 );
 	tSettings.m_bIndexFieldLens = hIndex.GetInt ( "index_field_lengths" )!=0;
 	tSettings.m_sIndexTokenFilter = hIndex.GetStr ( "index_token_filter" );
+	tSettings.m_bDictFst = hIndex.GetInt ( "dict_fst" )!=0;
+	tSettings.m_bInfixTrigrams = hIndex.GetInt ( "infix_trigrams" )!=0;
 
 	// prefix/infix fields
 	CSphString sFields;
@@ -1439,6 +1457,11 @@ bool sphConfIndex ( const CSphConfigSection & hIndex, CSphIndexSettings & tSetti
 	sFields.ToLower();
 	sphSplit ( tSettings.m_dInfixFields, sFields.cstr() );
 
+	sFields = hIndex.GetStr ( "string_dictionary" );
+	sFields.ToLower();
+	sphSplit ( tSettings.m_dStringDict, sFields.cstr() );
+	tSettings.m_dStringDict.Uniq();
+
 	if ( tSettings.m_iMinPrefixLen==0 && tSettings.m_dPrefixFields.GetLength()!=0 )
 	{
 		fprintf ( stdout, "WARNING: min_prefix_len=0, prefix_fields ignored\n" );
@@ -1497,6 +1520,51 @@ bool sphConfIndex ( const CSphConfigSection & hIndex, CSphIndexSettings & tSetti
 		return false;
 	}
 
+	if ( !bWordDict && tSettings.m_bDictFst )
+	{
+		sphWarning ( "dict_fst requires dict=keywords, ignored" );
+		tSettings.m_bDictFst = false;
+	}
+
+	if ( tSettings.m_bInfixTrigrams && ( !bWordDict || tSettings.m_iMinInfixLen<=0 ) )
+	{
+		sphWarning ( "infix_trigrams requires dict=keywords and min_infix_len, ignored" );
+		tSettings.m_bInfixTrigrams = false;
+	}
+
+	if ( hIndex("type") && hIndex["type"]=="rt" && tSettings.m_dStringDict.GetLength() )
+	{
+		sphWarning ( "string_dictionary is not supported by RT indexes, ignored" );
+		tSettings.m_dStringDict.Reset();
+	}
+
+	if ( hIndex("geo_grid") )
+	{
+		CSphVector<CSphString> dGeo;
+		sFields = hIndex.GetStr ( "geo_grid" );
+		sFields.ToLower();
+		sphSplit ( dGeo, sFields.cstr() );
+		if ( dGeo.GetLength()==2 && dGeo[0]!=dGeo[1] )
+		{
+			tSettings.m_sGeoLat = dGeo[0];
+			tSettings.m_sGeoLon = dGeo[1];
+		} else
+			sphWarning ( "geo_grid requires two distinct attribute names (latitude, longitude), ignored" );
+	}
+
+	if ( hIndex("sort_by") )
+	{
+		// direction is optional, as both ORDER BY directions walk the same order
+		CSphVector<CSphString> dSort;
+		sFields = hIndex.GetStr ( "sort_by" );
+		sFields.ToLower();
+		sphSplit ( dSort, sFields.cstr(), " \t" );
+		if ( dSort.GetLength()==1 || ( dSort.GetLength()==2 && ( dSort[1]=="asc" || dSort[1]=="desc" ) ) )
+			tSettings.m_sSortByAttr = dSort[0];
+		else
+			sphWarning ( "sort_by requires an attribute name, optionally followed by ASC or DESC, ignored" );
+	}
+
 	// html stripping
 	if ( hIndex ( "html_strip" ) )
 	{
@@ -2456,7 +2524,8 @@ void sphConfigureCommon ( const CSphConfig & hConf )
 	}
 
 	bJsonAutoconvNumbers = ( hCommon.GetInt ( "json_autoconv_numbers", 0 )!=0 );
-	sphSetJsonOptions ( bJsonStrict, bJsonAutoconvNumbers, bJsonKeynamesToLowercase );
+	int iJsonKeyDirectory = Max ( hCommon.GetInt ( "json_key_directory", 0 ), 0 );
+	sphSetJsonOptions ( bJsonStrict, bJsonAutoconvNumbers, bJsonKeynamesToLowercase, iJsonKeyDirectory );
 
 	if ( hCommon("plugin_dir") )
 		sphPluginInit ( hCommon["plugin_dir"].cstr() );
@@ -19,6 +19,7 @@
 #include "sphinxquery.h"
 #include "sphinxrt.h"
 #include "sphinxint.h"
+#include "sphinxjson.h"
 #include "sphinxstem.h"
 #include <math.h>
 
@@ -571,6 +572,59 @@ void TestTokenizer()
 	assert ( pTokenizer->SetCaseFolding ( "0..9, A..Z->a..z, _, a..z", sError ) );
 	assert ( pTokenizer->SetNgramChars ( "U+410..U+42F->U+430..U+44F, U+430..U+44F", sError ) );
 	delete pTokenizer;
+
+	// ascii fast path must produce exactly the same tokens as the per-codepoint one
+	const char * dFastCharsets[] =
+	{
+		SPHINX_DEFAULT_UTF8_TABLE,
+		"0..9, A..Z->a..z, _, a..z, U+80..U+FF",
+		"0..9, A..Y->a..y, Z->q, _, a..z, #->x, U+C0..U+DF->U+E0..U+FF, U+E0..U+FF",
+		"0..9, a..z, A..Z"
+	};
+	const char * sFastAlphabet = "abcxyzABCXYZ019_-!#@. \t\n\xC3\x84\xC3\xA4\xD0\x96";
+	int iAlphabet = strlen ( sFastAlphabet );
+
+	for ( int iCharset=0; iCharset<(int)(sizeof(dFastCharsets)/sizeof(dFastCharsets[0])); iCharset++ )
+		for ( int iRun=0; iRun<50; iRun++ )
+	{
+		// random text with long ascii runs, overlong tokens, specials and some utf-8
+		CSphVector<BYTE> dText;
+		int iLen = sphRand() % 2000;
+		while ( dText.GetLength()<iLen )
+		{
+			int iWord = ( sphRand() % 8 )==0 ? 10 + sphRand() % 100 : sphRand() % 12;
+			for ( int j=0; j<iWord; j++ )
+				dText.Add ( sFastAlphabet [ sphRand() % 12 ] );
+			dText.Add ( sFastAlphabet [ sphRand() % iAlphabet ] );
+		}
+
+		printf ( "testing tokenizer ascii fast path, charset %d, run %d... ", iCharset, iRun );
+		CSphTokenizerSettings tSettings;
+		tSettings.m_iMinWordLen = 1 + iRun % 3;
+		ISphTokenizer * pFast = ISphTokenizer::Create ( tSettings, NULL, sError );
+		assert ( pFast->SetCaseFolding ( dFastCharsets[iCharset], sError ) );
+		pFast->AddSpecials ( "!-" );
+		ISphTokenizer * pSlow = pFast->Clone ( SPH_CLONE_INDEX );
+
+		CSphVector<CSphString> dTokens[2];
+		for ( int iPass=0; iPass<2; iPass++ )
+		{
+			ISphTokenizer * pTok = iPass ? pSlow : pFast;
+			g_bTokenizerAsciiFast = ( iPass==0 );
+			pTok->SetBuffer ( dText.Begin(), dText.GetLength() );
+			while ( BYTE * sTok = pTok->GetToken() )
+				dTokens[iPass].Add().SetSprintf ( "%s@%d", (const char*)sTok, (int)( pTok->GetTokenStart() - (const char*)dText.Begin() ) );
+		}
+		g_bTokenizerAsciiFast = true;
+
+		assert ( dTokens[0].GetLength()==dTokens[1].GetLength() );
+		ARRAY_FOREACH ( i, dTokens[0] )
+			assert ( dTokens[0][i]==dTokens[1][i] );
+
+		SafeDelete ( pFast );
+		SafeDelete ( pSlow );
+		printf ( "ok\n" );
+	}
 }
 
 
@@ -628,7 +682,7 @@ void BenchTokenizer ( ISphTokenizer * pTokenizer, BYTE * sData, int iBytes )
 
 	// report
 	printf ( "%d bytes, %d tokens, max %.1f MB/sec, avg %.1f MB/sec\n",
-		iBytes, iTokens, double(iBytes)/iMin, double(iBytes*iPasses)/iAvg );
+		iBytes, iTokens, double(iBytes)/iMin, double(iBytes)*iPasses/iAvg );
 }
 
 
@@ -668,6 +722,29 @@ void BenchTokenizer ()
 		SafeDelete ( pTokenizer );
 	}
 	SafeDeleteArray ( sData );
+
+	// synthetic mostly-english text, with and without the ascii fast path
+	const char * dWords[] = { "The", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "tokenization",
+		"Performance", "indexing", "of", "a", "and", "documents", "2017", "search-engine" };
+	const int iWords = sizeof(dWords)/sizeof(dWords[0]);
+	CSphVector<BYTE> dText;
+	while ( dText.GetLength()<1048576 )
+	{
+		const char * sWord = dWords [ sphRand() % iWords ];
+		int iWordLen = strlen ( sWord );
+		memcpy ( dText.AddN ( iWordLen ), sWord, iWordLen );
+		dText.Add ( ( sphRand() % 10 ) ? ' ' : '\n' );
+	}
+
+	for ( int iRun=4; iRun<=5; iRun++ )
+	{
+		g_bTokenizerAsciiFast = ( iRun==4 );
+		ISphTokenizer * pTokenizer = sphCreateUTF8Tokenizer ();
+		printf ( "run %d (ascii fast path %s): ", iRun, g_bTokenizerAsciiFast ? "on" : "off" );
+		BenchTokenizer ( pTokenizer, dText.Begin(), dText.GetLength() );
+		SafeDelete ( pTokenizer );
+	}
+	g_bTokenizerAsciiFast = true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1165,6 +1242,7 @@ public:
 	virtual void				DebugDumpHitlist ( FILE * , const char * , bool ) {}
 	virtual int					DebugCheck ( FILE * ) { return 0; } // NOLINT
 	virtual void				DebugDumpDict ( FILE * ) {}
+	virtual void				DebugEstimateReorder ( FILE *, const char * ) {}
 	virtual	void				SetProgressCallback ( CSphIndexProgress::IndexingProgress_fn ) {}
 
 	SmallStringHash_T < int > m_hHits;
@@ -2685,6 +2763,122 @@ void TestRTSendVsMerge ()
 	DeleteIndexFiles ( RT_INDEX_FILE_NAME );
 }
 
+static ISphRtIndex * CreateBinlogTestIndex ( const char * sName, const char * sPath )
+{
+	CSphString sError;
+	CSphDictSettings tDictSettings;
+	tDictSettings.m_bWordDict = false;
+
+	ISphTokenizer * pTok = sphCreateUTF8Tokenizer();
+	CSphDict * pDict = sphCreateDictionaryCRC ( tDictSettings, NULL, pTok, sName, sError );
+
+	CSphSchema tSchema;
+	tSchema.m_dFields.Add ( CSphColumnInfo ( "title" ) );
+	tSchema.AddAttr ( CSphColumnInfo ( "tag", SPH_ATTR_INTEGER ), false );
+
+	DeleteIndexFiles ( sPath );
+	ISphRtIndex * pIndex = sphCreateIndexRT ( tSchema, sName, 1024*1024, sPath, false );
+	pIndex->SetTokenizer ( pTok ); // index will own this pair from now on
+	pIndex->SetDictionary ( pDict );
+	pIndex->PostSetup();
+	Verify ( pIndex->Prealloc ( false ) );
+	return pIndex;
+}
+
+/// commits a single doc, returns how long commit took
+static int64_t BinlogTestCommit ( ISphRtIndex * pIndex, SphDocID_t uID )
+{
+	const char * dFields[] = { "hello binlog" };
+	CSphMatch tDoc;
+	tDoc.Reset ( pIndex->GetMatchSchema().GetRowSize() );
+	tDoc.m_uDocID = uID;
+
+	CSphString sError, sWarning, sFilter;
+	CSphVector<DWORD> dMvas;
+	int64_t tmStart = sphMicroTimer();
+	Verify ( pIndex->AddDocument ( pIndex->CloneIndexingTokenizer(), 1, dFields, tDoc, false, sFilter, NULL, dMvas, sError, sWarning, NULL ) );
+	pIndex->Commit ( NULL, NULL );
+	return sphMicroTimer() - tmStart;
+}
+
+static void DeleteBinlogFiles ( const char * sLogName )
+{
+	CSphString sName;
+	sName.SetSprintf ( "%s.meta", sLogName );
+	unlink ( sName.cstr() );
+	sName.SetSprintf ( "%s.lock", sLogName );
+	unlink ( sName.cstr() );
+	for ( int i=1; i<=16; i++ )
+	{
+		sName.SetSprintf ( "%s.%03d", sLogName, i );
+		unlink ( sName.cstr() );
+	}
+}
+
+static void TestBinlogRotate ( bool bPerIndex )
+{
+	const char * dLogs[] = { "binlog", "binlog.binlogrt1", "binlog.binlogrt2" };
+	const int iLogs = sizeof(dLogs)/sizeof(dLogs[0]);
+
+	// writer thread holds every batch for a long delay, and every commit restarts the log
+	// so commits only return early when log restart syncs txns pending in the old file
+	const int64_t MAX_COMMIT_TIME = 1000000;
+
+	printf ( "testing binlog restart with pending group commits, %s... ", bPerIndex ? "per-index streams" : "shared log" );
+	for ( int i=0; i<iLogs; i++ )
+		DeleteBinlogFiles ( dLogs[i] );
+
+	CSphConfigSection tConf;
+	Verify ( tConf.Add ( CSphVariant ( ".", 0 ), "binlog_path" ) );
+	Verify ( tConf.Add ( CSphVariant ( "1", 0 ), "binlog_flush" ) );
+	Verify ( tConf.Add ( CSphVariant ( "1", 0 ), "binlog_group_commit" ) );
+	Verify ( tConf.Add ( CSphVariant ( "3000", 0 ), "binlog_group_commit_delay" ) );
+	Verify ( tConf.Add ( CSphVariant ( "1", 0 ), "binlog_max_log_size" ) );
+	Verify ( tConf.Add ( CSphVariant ( bPerIndex ? "1" : "0", 0 ), "binlog_per_index" ) );
+	sphRTInit ( tConf, true );
+	sphRTConfigure ( tConf, true );
+
+	ISphRtIndex * pIndex1 = CreateBinlogTestIndex ( "binlogrt1", "test_binlog1" );
+	ISphRtIndex * pIndex2 = CreateBinlogTestIndex ( "binlogrt2", "test_binlog2" );
+
+	SmallStringHash_T<CSphIndex*> hIndexes;
+	hIndexes.Add ( pIndex1, "binlogrt1" );
+	hIndexes.Add ( pIndex2, "binlogrt2" );
+	sphReplayBinlog ( hIndexes, 0 );
+
+	for ( int i=1; i<=3; i++ )
+	{
+		Verify ( BinlogTestCommit ( pIndex1, i )<MAX_COMMIT_TIME );
+		Verify ( BinlogTestCommit ( pIndex2, i )<MAX_COMMIT_TIME );
+	}
+
+	// shared log, or every stream, got restarted
+	for ( int i=0; i<iLogs; i++ )
+	{
+		if ( ( i>0 )!=bPerIndex )
+			continue;
+		CSphString sLog;
+		sLog.SetSprintf ( "%s.003", dLogs[i] );
+		Verify ( sphIsReadable ( sLog.cstr() ) );
+	}
+
+	SafeDelete ( pIndex1 );
+	SafeDelete ( pIndex2 );
+	sphRTDone ();
+
+	DeleteIndexFiles ( "test_binlog1" );
+	DeleteIndexFiles ( "test_binlog2" );
+	for ( int i=0; i<iLogs; i++ )
+		DeleteBinlogFiles ( dLogs[i] );
+	printf ( "ok\n" );
+}
+
+void TestBinlogRotate ()
+{
+	TestBinlogRotate ( false );
+	TestBinlogRotate ( true );
+}
+
 void TestRankerFactors ()
 {
 	const char * dFields[] = {
@@ -4132,6 +4326,1586 @@ void TestLevenshtein()
 }
 
 
+static int FstTestCodepoints ( const char * sWord, int * pCodes )
+{
+	const BYTE * s = (const BYTE *)sWord;
+	int iCodes = 0;
+	while ( *s )
+		pCodes[iCodes++] = sphUTF8Decode ( s );
+	return iCodes;
+}
+
+
+void TestKeywordsFst()
+{
+	printf ( "testing keywords fst... " );
+
+	// small alphabet to get lots of shared prefixes and suffixes, some utf-8 and non-chars too
+	static const char * dChars[] = { "a", "b", "c", "d", "e", "1", "\xD0\xB0", "\xD0\xB1" };
+	const int iChars = sizeof(dChars)/sizeof(dChars[0]);
+
+	sphSrand ( 0 );
+	CSphVector<CSphString> dWords;
+	for ( int i=0; i<20000; i++ )
+	{
+		char sBuf[64];
+		char * p = sBuf;
+		int iLen = 1 + sphRand() % 8;
+		for ( int j=0; j<iLen; j++ )
+		{
+			const char * sChar = dChars [ sphRand() % iChars ];
+			strcpy ( p, sChar ); // NOLINT
+			p += strlen ( sChar );
+		}
+		*p = '\0';
+		dWords.Add ( sBuf );
+	}
+	dWords.Uniq();
+
+	// build
+	const char * sTmp = "__fst.tmp";
+	CSphString sError;
+	int64_t iFstOffset = 0;
+	{
+		CSphWriter tWriter;
+		Verify ( tWriter.OpenFile ( sTmp, sError ) );
+		tWriter.PutByte ( 1 );
+
+		KeywordsFstBuilder_c tBuilder;
+		ARRAY_FOREACH ( i, dWords )
+			tBuilder.AddWord ( (const BYTE *)dWords[i].cstr(), dWords[i].Length() );
+		assert ( tBuilder.GetWords()==dWords.GetLength() );
+		iFstOffset = tBuilder.Save ( tWriter );
+		tWriter.CloseFile();
+	}
+
+	CSphAutoreader tReader;
+	Verify ( tReader.Open ( sTmp, sError ) );
+	CSphFixedVector<BYTE> dFile ( (int)tReader.GetFilesize() );
+	tReader.GetBytes ( dFile.Begin(), dFile.GetLength() );
+	tReader.Close();
+	unlink ( sTmp );
+
+	KeywordsFst_c tFst;
+	Verify ( tFst.Setup ( dFile.Begin() + iFstOffset, dFile.Begin() + dFile.GetLength(), sError ) );
+	assert ( tFst.GetWords()==dWords.GetLength() );
+
+	// exact lookups, hits and misses
+	ARRAY_FOREACH ( i, dWords )
+		assert ( tFst.Find ( (const BYTE *)dWords[i].cstr(), dWords[i].Length() )==i );
+	assert ( tFst.Find ( (const BYTE *)"aaaaaaaaa", 9 )==-1 );
+	assert ( tFst.Find ( (const BYTE *)"f", 1 )==-1 );
+	assert ( tFst.Find ( (const BYTE *)"\xD0", 1 )==-1 );
+
+	// prefix ranges
+	static const char * dPrefixes[] = { "a", "ab", "abc", "e1", "\xD0\xB0", "\xD0", "c\xD0\xB1" "d", "zz", "aaaaaaaa" };
+	for ( int i=0; i<(int)( sizeof(dPrefixes)/sizeof(dPrefixes[0]) ); i++ )
+	{
+		int iRefFirst = -1, iRefCount = 0;
+		ARRAY_FOREACH ( j, dWords )
+			if ( dWords[j].Begins ( dPrefixes[i] ) )
+			{
+				if ( iRefFirst<0 )
+					iRefFirst = j;
+				iRefCount++;
+			}
+
+		int iFirst, iCount;
+		bool bFound = tFst.FindPrefix ( (const BYTE *)dPrefixes[i], strlen ( dPrefixes[i] ), iFirst, iCount );
+		assert ( bFound==( iRefCount>0 ) );
+		assert ( !bFound || ( iFirst==iRefFirst && iCount==iRefCount ) );
+	}
+
+	// levenshtein walk vs brute force
+	static const char * dQueries[] = { "abcd", "bad", "\xD0\xB0\xD0\xB1" "cde", "eeee" };
+	for ( int i=0; i<(int)( sizeof(dQueries)/sizeof(dQueries[0]) ); i++ )
+	{
+		SuggestArgs_t tArgs;
+		tArgs.m_iLimit = INT_MAX;
+		tArgs.m_iMaxEdits = 2;
+		tArgs.m_iDeltaLen = 2;
+
+		SuggestResult_t tRes;
+		tRes.m_sWord = dQueries[i];
+		tRes.m_iLen = tRes.m_sWord.Length();
+		tRes.m_iCodepoints = FstTestCodepoints ( dQueries[i], tRes.m_dCodepoints );
+
+		CSphVector<KeywordsFst_c::FuzzyMatch_t> dMatches;
+		CSphVector<BYTE> dMatchWords;
+		tFst.FuzzyWords ( tArgs, tRes, dMatches, dMatchWords );
+
+		int iMatch = 0;
+		ARRAY_FOREACH ( j, dWords )
+		{
+			int dCodes[64];
+			int iCodes = FstTestCodepoints ( dWords[j].cstr(), dCodes );
+			bool bNonChar = false;
+			for ( int k=0; k<iCodes; k++ )
+				bNonChar |= ( dCodes[k]<'A' || ( dCodes[k]>'Z' && dCodes[k]<'a' ) );
+			if ( bNonChar || iCodes<=tRes.m_iCodepoints-tArgs.m_iDeltaLen || iCodes>=tRes.m_iCodepoints+tArgs.m_iDeltaLen )
+				continue;
+
+			int iDist = sphLevenshtein ( tRes.m_dCodepoints, tRes.m_iCodepoints, dCodes, iCodes );
+			if ( iDist>tArgs.m_iMaxEdits )
+				continue;
+
+			assert ( iMatch<dMatches.GetLength() );
+			const KeywordsFst_c::FuzzyMatch_t & tMatch = dMatches[iMatch++];
+			assert ( tMatch.m_iOrdinal==j && tMatch.m_iDistance==iDist );
+			assert ( tMatch.m_iWordLen==dWords[j].Length() && !memcmp ( dMatchWords.Begin()+tMatch.m_iWordOff, dWords[j].cstr(), tMatch.m_iWordLen ) );
+		}
+		assert ( iMatch==dMatches.GetLength() );
+		assert ( iMatch>0 );
+	}
+
+	printf ( "ok\n" );
+}
+
+
+void TestInfixTrigrams()
+{
+	printf ( "testing infix trigrams... " );
+
+	static const char * dChars[] = { "a", "b", "c", "d", "e", "1", "\xD0\xB0", "\xD0\xB1" };
+	const int iChars = sizeof(dChars)/sizeof(dChars[0]);
+
+	sphSrand ( 0 );
+	CSphVector<CSphString> dWords;
+	for ( int i=0; i<20000; i++ )
+	{
+		char sBuf[64];
+		char * p = sBuf;
+		int iLen = 1 + sphRand() % 10;
+		for ( int j=0; j<iLen; j++ )
+		{
+			const char * sChar = dChars [ sphRand() % iChars ];
+			strcpy ( p, sChar ); // NOLINT
+			p += strlen ( sChar );
+		}
+		*p = '\0';
+		dWords.Add ( sBuf );
+	}
+	dWords.Uniq();
+
+	// build
+	const char * sTmp = "__trigrams.tmp";
+	CSphString sError;
+	int64_t iOffset = 0;
+	{
+		CSphWriter tWriter;
+		Verify ( tWriter.OpenFile ( sTmp, sError ) );
+		tWriter.PutByte ( 1 );
+
+		InfixTrigramsBuilder_c tBuilder;
+		ARRAY_FOREACH ( i, dWords )
+			tBuilder.AddWord ( (const BYTE *)dWords[i].cstr(), dWords[i].Length(), false );
+		iOffset = tBuilder.Save ( tWriter );
+		tWriter.CloseFile();
+	}
+
+	CSphAutoreader tReader;
+	Verify ( tReader.Open ( sTmp, sError ) );
+	CSphFixedVector<BYTE> dFile ( (int)tReader.GetFilesize() );
+	tReader.GetBytes ( dFile.Begin(), dFile.GetLength() );
+	tReader.Close();
+	unlink ( sTmp );
+
+	InfixTrigrams_c tTrigrams;
+	Verify ( tTrigrams.Setup ( dFile.Begin() + iOffset, dFile.Begin() + dFile.GetLength(), sError ) );
+	Verify ( tTrigrams.Check ( dWords.GetLength(), sError ) );
+
+	// candidates must include every matching keyword
+	static const char * dWildcards[] = { "*abc*", "*\xD0\xB0\xD0\xB1" "c*", "*1a1*", "*abc*cd1*", "*abc?de*", "a%bcd*", "*eeee*", "*abcdeabcde*" };
+	for ( int i=0; i<(int)( sizeof(dWildcards)/sizeof(dWildcards[0]) ); i++ )
+	{
+		CSphVector<int> dCandidates;
+		Verify ( tTrigrams.GetCandidates ( dWildcards[i], dCandidates ) );
+		for ( int j=1; j<dCandidates.GetLength(); j++ )
+			assert ( dCandidates[j-1]<dCandidates[j] );
+
+		int iMatches = 0;
+		ARRAY_FOREACH ( j, dWords )
+			if ( sphWildcardMatch ( dWords[j].cstr(), dWildcards[i] ) )
+			{
+				assert ( dCandidates.BinarySearch ( j ) );
+				iMatches++;
+			}
+		assert ( dCandidates.GetLength()>=iMatches );
+	}
+
+	// no trigrams in the wildcard means no candidates either
+	CSphVector<int> dCandidates;
+	assert ( !tTrigrams.GetCandidates ( "*ab*", dCandidates ) );
+	assert ( !tTrigrams.GetCandidates ( "*a?c*", dCandidates ) );
+	assert ( tTrigrams.GetCandidates ( "*zzz*", dCandidates ) && !dCandidates.GetLength() );
+
+	printf ( "ok\n" );
+}
+
+
+void TestMatchArena()
+{
+	printf ( "testing match arena... " );
+	Verify ( sphInitMatchArena() );
+
+	// no arena, heap rows
+	{
+		CSphMatch tMatch;
+		tMatch.Reset ( 5 );
+		assert ( tMatch.m_pDynamic[-1]==5 && tMatch.m_pDynamic[-2]==0 );
+	}
+
+	const int NUM_MATCHES = 20000;
+	CSphMatch * pMatches = new CSphMatch [ NUM_MATCHES ];
+	{
+		CSphMatchArena tArena;
+		tArena.Start();
+
+		// nested arena should just keep using the outer one
+		CSphMatchArena tNested;
+		tNested.Start();
+
+		for ( int i=0; i<NUM_MATCHES; i++ )
+		{
+			int iDynamic = 1 + i%7;
+			pMatches[i].Reset ( iDynamic );
+			assert ( pMatches[i].m_pDynamic[-1]==(DWORD)iDynamic && pMatches[i].m_pDynamic[-2]!=0 );
+			assert ( ( ( (size_t)pMatches[i].m_pDynamic ) & 7 )==0 );
+			for ( int j=0; j<iDynamic; j++ )
+			{
+				assert ( pMatches[i].m_pDynamic[j]==0 );
+				pMatches[i].m_pDynamic[j] = i;
+			}
+		}
+
+		// free some of the rows while arena is still alive
+		for ( int i=0; i<NUM_MATCHES; i+=2 )
+		{
+			CSphMatch tEmpty;
+			Swap ( pMatches[i], tEmpty );
+		}
+
+		// huge rows go to heap
+		CSphMatch tHuge;
+		tHuge.Reset ( 1000000 );
+		assert ( tHuge.m_pDynamic[-2]==0 );
+
+		tNested.Stop();
+		tArena.Stop();
+	}
+
+	// the rest of rows outlives the arena
+	for ( int i=1; i<NUM_MATCHES; i+=2 )
+		for ( int j=0; j<1+i%7; j++ )
+			assert ( pMatches[i].m_pDynamic[j]==(DWORD)i );
+	SafeDeleteArray ( pMatches );
+
+	sphDoneMatchArena();
+	printf ( "ok\n" );
+}
+
+
+static void JsonParseTest ( const CSphString & sJson, int iKeyDirectory, CSphVector<BYTE> & dBson )
+{
+	CSphVector<char> dBuf ( sJson.Length()+2 );
+	memcpy ( dBuf.Begin(), sJson.cstr(), sJson.Length() );
+	dBuf[sJson.Length()] = dBuf[sJson.Length()+1] = '\0';
+
+	CSphString sError;
+	dBson.Reset();
+	Verify ( sphJsonParse ( dBson, dBuf.Begin(), false, false, iKeyDirectory, sError ) );
+}
+
+
+void TestJsonKeyDirectory()
+{
+	printf ( "testing json key directory... " );
+
+	CSphStringBuilder sJson;
+	sJson += "{";
+	for ( int i=0; i<100; i++ )
+		sJson.Appendf ( "\"k%d\":%d,", i, i*3 );
+	sJson += "\"sub\":{\"a\":{\"b\":{\"c\":\"deep\"}}";
+	for ( int i=0; i<20; i++ )
+		sJson.Appendf ( ",\"s%d\":[%d,%d]", i, i, -i );
+	sJson += "}}";
+
+	CSphVector<BYTE> dPlain, dIndexed;
+	JsonParseTest ( sJson.cstr(), 0, dPlain );
+	JsonParseTest ( sJson.cstr(), 2, dIndexed );
+	assert ( dIndexed.GetLength()>dPlain.GetLength() );
+
+	// both encodings format back to the same document
+	CSphVector<BYTE> dOut1, dOut2;
+	sphJsonFormat ( dOut1, dPlain.Begin() );
+	sphJsonFormat ( dOut2, dIndexed.Begin() );
+	assert ( dOut1.GetLength()==dOut2.GetLength() && !memcmp ( dOut1.Begin(), dOut2.Begin(), dOut1.GetLength() ) );
+
+	const BYTE * dBlobs[2] = { dPlain.Begin(), dIndexed.Begin() };
+	for ( int iBlob=0; iBlob<2; iBlob++ )
+	{
+		const BYTE * pRoot = dBlobs[iBlob];
+		ESphJsonType eRoot = sphJsonFindFirst ( &pRoot );
+		assert ( eRoot==JSON_ROOT );
+		assert ( sphJsonFieldLength ( eRoot, pRoot )==101 );
+		assert ( sphJsonNodeSize ( eRoot, pRoot )==( iBlob ? dIndexed : dPlain ).GetLength()-1 ); // minus trailing EOF
+
+		for ( int i=0; i<100; i++ )
+		{
+			CSphString sKey;
+			sKey.SetSprintf ( "k%d", i );
+			const BYTE * p = pRoot;
+			ESphJsonType eType = sphJsonFindByKey ( eRoot, &p, sKey.cstr(), sKey.Length(), sphJsonKeyMask ( sKey.cstr(), sKey.Length() ) );
+			assert ( eType==JSON_INT32 && sphJsonLoadInt ( &p )==i*3 );
+		}
+
+		const BYTE * p = pRoot;
+		assert ( sphJsonFindByKey ( eRoot, &p, "nope", 4, sphJsonKeyMask ( "nope", 4 ) )==JSON_EOF );
+
+		// deep path, sub.a.b.c
+		const char * dPath[] = { "sub", "a", "b", "c" };
+		ESphJsonType eType = eRoot;
+		for ( int i=0; i<4; i++ )
+		{
+			int iLen = strlen ( dPath[i] );
+			eType = sphJsonFindByKey ( eType, &p, dPath[i], iLen, sphJsonKeyMask ( dPath[i], iLen ) );
+		}
+		assert ( eType==JSON_STRING && sphJsonUnpackInt ( &p )==4 && !memcmp ( p, "deep", 4 ) );
+
+		p = pRoot;
+		eType = sphJsonFindByKey ( eRoot, &p, "sub", 3, sphJsonKeyMask ( "sub", 3 ) );
+		assert ( eType==JSON_OBJECT && sphJsonFieldLength ( eType, p )==21 );
+		eType = sphJsonFindByKey ( eType, &p, "s19", 3, sphJsonKeyMask ( "s19", 3 ) );
+		assert ( eType==JSON_INT32_VECTOR && sphJsonFieldLength ( eType, p )==2 );
+	}
+
+	printf ( "ok\n" );
+}
+
+
+void TestJsonExtract()
+{
+	printf ( "testing json path extraction... " );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "j", SPH_ATTR_JSON );
+	tSchema.AddAttr ( tCol, false );
+	tCol.m_sName = "j.price";
+	tCol.m_eAttrType = SPH_ATTR_FLOAT;
+	tSchema.AddAttr ( tCol, false );
+	tCol.m_sName = "j.sub.big";
+	tCol.m_eAttrType = SPH_ATTR_BIGINT;
+	tSchema.AddAttr ( tCol, false );
+	tCol.m_sName = "j.flag";
+	tCol.m_eAttrType = SPH_ATTR_INTEGER;
+	tSchema.AddAttr ( tCol, false );
+
+	CSphVector<BYTE> dBson;
+	JsonParseTest ( "{\"price\":12.5, \"sub\":{\"big\":1099511627776}, \"flag\":true}", 0, dBson );
+
+	CSphFixedVector<CSphRowitem> dRow ( tSchema.GetRowSize() );
+	memset ( dRow.Begin(), 0xff, dRow.GetSizeBytes() );
+	sphJsonExtractColumns ( tSchema, "j", dBson.Begin(), dRow.Begin() );
+	assert ( sphDW2F ( (DWORD)sphGetRowAttr ( dRow.Begin(), tSchema.GetAttr(1).m_tLocator ) )==12.5f );
+	assert ( sphGetRowAttr ( dRow.Begin(), tSchema.GetAttr(2).m_tLocator )==I64C(1099511627776) );
+	assert ( sphGetRowAttr ( dRow.Begin(), tSchema.GetAttr(3).m_tLocator )==1 );
+
+	// missing keys, wrong types and missing documents all read as zero
+	JsonParseTest ( "{\"price\":\"cheap\", \"sub\":[1,2]}", 0, dBson );
+	sphJsonExtractColumns ( tSchema, "j", dBson.Begin(), dRow.Begin() );
+	for ( int i=1; i<4; i++ )
+		assert ( sphGetRowAttr ( dRow.Begin(), tSchema.GetAttr(i).m_tLocator )==0 );
+
+	memset ( dRow.Begin(), 0xff, dRow.GetSizeBytes() );
+	sphJsonExtractColumns ( tSchema, "j", NULL, dRow.Begin() );
+	for ( int i=1; i<4; i++ )
+		assert ( sphGetRowAttr ( dRow.Begin(), tSchema.GetAttr(i).m_tLocator )==0 );
+
+	CSphString sExpr;
+	Verify ( sphJsonExtractedExpr ( "j.sub.big", sExpr ) );
+	assert ( sExpr=="j['sub']['big']" );
+	assert ( !sphJsonExtractedExpr ( "price", sExpr ) );
+
+	printf ( "ok\n" );
+}
+
+
+static DWORD StringDictEntry ( CSphVector<BYTE> & dPool, const char * sValue, DWORD uRank )
+{
+	BYTE dPacked[4];
+	int iLen = strlen ( sValue );
+	uint64_t uHash = sphHashLibcCI ( (const BYTE*)sValue, iLen );
+	dPool.Add ( 12 );
+	memcpy ( dPool.AddN ( sizeof(uHash) ), &uHash, sizeof(uHash) );
+	memcpy ( dPool.AddN ( sizeof(uRank) ), &uRank, sizeof(uRank) );
+
+	DWORD uOffset = dPool.GetLength();
+	int iLenLen = sphPackStrlen ( dPacked, iLen );
+	memcpy ( dPool.AddN ( iLenLen ), dPacked, iLenLen );
+	memcpy ( dPool.AddN ( iLen ), sValue, iLen );
+	return uOffset;
+}
+
+
+void TestStringDict()
+{
+	printf ( "testing dictionary encoded strings... " );
+
+	// dictionary in libc_ci order, with a table of entry offsets after it
+	const char * dValues[] = { "apple", "Banana", "banana", "cherry" };
+	const DWORD dRanks[] = { 0, 1, 1, 2 };
+	const int iValues = sizeof(dValues)/sizeof(dValues[0]);
+
+	CSphVector<BYTE> dPool;
+	dPool.Add ( 0 );
+	DWORD dOffsets[iValues];
+	for ( int i=0; i<iValues; i++ )
+		dOffsets[i] = StringDictEntry ( dPool, dValues[i], dRanks[i] );
+
+	DWORD uTable = dPool.GetLength();
+	dPool.Add ( ( iValues+1 )*sizeof(DWORD) );
+	DWORD uCount = iValues;
+	memcpy ( dPool.AddN ( sizeof(DWORD) ), &uCount, sizeof(DWORD) );
+	memcpy ( dPool.AddN ( sizeof(dOffsets) ), dOffsets, sizeof(dOffsets) );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "s", SPH_ATTR_STRING );
+	tSchema.AddAttr ( tCol, false );
+	const_cast<CSphColumnInfo &>( tSchema.GetAttr(0) ).m_uStringDict = uTable;
+
+	// rank filters must agree with the plain libc_ci string filter
+	const char * dRefs[] = { "BANANA", "apple", "durian", "Cherry" };
+	for ( int iEq=0; iEq<2; iEq++ )
+		for ( int iRef=0; iRef<(int)( sizeof(dRefs)/sizeof(dRefs[0]) ); iRef++ )
+	{
+		CSphFilterSettings tSettings;
+		tSettings.m_sAttrName = "s";
+		tSettings.m_eType = SPH_FILTER_STRING;
+		tSettings.m_bHasEqual = ( iEq!=0 );
+		tSettings.m_dStrings.Add ( dRefs[iRef] );
+
+		CSphString sError, sWarning;
+		CSphScopedPtr<ISphFilter> pDict ( sphCreateFilter ( tSettings, tSchema, NULL, dPool.Begin(), sError, sWarning, SPH_COLLATION_LIBC_CI, false, true ) );
+		const_cast<CSphColumnInfo &>( tSchema.GetAttr(0) ).m_uStringDict = 0;
+		CSphScopedPtr<ISphFilter> pPlain ( sphCreateFilter ( tSettings, tSchema, NULL, dPool.Begin(), sError, sWarning, SPH_COLLATION_LIBC_CI, false ) );
+		const_cast<CSphColumnInfo &>( tSchema.GetAttr(0) ).m_uStringDict = uTable;
+		assert ( pDict.Ptr() && pPlain.Ptr() );
+
+		CSphRowitem uRow = 0;
+		CSphMatch tMatch;
+		tMatch.m_pStatic = &uRow;
+		for ( int i=-1; i<iValues; i++ )
+		{
+			uRow = i<0 ? 0 : dOffsets[i];
+			assert ( pDict->Eval ( tMatch )==pPlain->Eval ( tMatch ) );
+		}
+	}
+
+	// rank comparison must agree with the libc_ci collation
+	CSphMatchComparatorState tState;
+	tState.m_eKeypart[0] = SPH_KEYPART_STRING;
+	tState.m_tLocator[0].m_iBitOffset = 0;
+	tState.m_tLocator[0].m_iBitCount = 64;
+	tState.m_tLocator[0].m_bDynamic = true;
+	tState.m_fnStrCmp = sphCollateLibcCI;
+
+	CSphMatch tA, tB;
+	tA.Reset ( 2 );
+	tB.Reset ( 2 );
+	for ( int i=0; i<iValues; i++ )
+		for ( int j=0; j<iValues; j++ )
+		{
+			tA.SetAttr ( tState.m_tLocator[0], (SphAttr_t)( dPool.Begin() + dOffsets[i] ) );
+			tB.SetAttr ( tState.m_tLocator[0], (SphAttr_t)( dPool.Begin() + dOffsets[j] ) );
+			tState.m_uStringRanks = 0;
+			int iPlain = tState.CmpStrings ( tA, tB, 0 );
+			tState.m_uStringRanks = 1;
+			int iRank = tState.CmpStrings ( tA, tB, 0 );
+			assert ( ( iPlain<0 )==( iRank<0 ) && ( iPlain>0 )==( iRank>0 ) );
+		}
+
+	printf ( "ok\n" );
+}
+
+
+void TestCollateKeys()
+{
+	printf ( "testing collation sort keys... " );
+	sphCollationInit();
+
+	// ascii in both cases, zero and invalid bytes, 2- and 3-byte utf-8, and long shared prefixes
+	const char * dParts[] = { "a", "A", "b", "B", "z", "\0", "\xff", "\xc3\xa9", "\xc3\x89", "\xd0\xaf", "\xe2\x82\xac", "http://www." };
+	const int iParts = sizeof(dParts)/sizeof(dParts[0]);
+
+	sphSrand ( 0 );
+	CSphVector< CSphVector<BYTE> > dStrings ( 300 );
+	ARRAY_FOREACH ( i, dStrings )
+	{
+		BYTE dBuf[256];
+		int iLen = 0;
+		for ( int iPart = sphRand() % 6; iPart>0; iPart-- )
+		{
+			int iCur = sphRand() % iParts;
+			int iPartLen = iCur==5 ? 1 : strlen ( dParts[iCur] );
+			memcpy ( dBuf+iLen, dParts[iCur], iPartLen );
+			iLen += iPartLen;
+		}
+		int iLenLen = sphPackStrlen ( dBuf+iLen, iLen );
+		dStrings[i].Resize ( iLenLen+iLen+1 );
+		memcpy ( dStrings[i].Begin(), dBuf+iLen, iLenLen );
+		memcpy ( dStrings[i].Begin()+iLenLen, dBuf, iLen );
+		dStrings[i][iLenLen+iLen] = 0;
+	}
+
+	const ESphCollation dColl[] = { SPH_COLLATION_BINARY, SPH_COLLATION_LIBC_CI, SPH_COLLATION_UTF8_GENERAL_CI };
+	const SphStringCmp_fn dCmp[] = { sphCollateBinary, sphCollateLibcCI, sphCollateUtf8GeneralCI };
+
+	CSphMatchComparatorState tState;
+	tState.m_eKeypart[0] = SPH_KEYPART_STRING;
+	tState.m_tLocator[0].m_iBitOffset = 0;
+	tState.m_tLocator[0].m_iBitCount = 64;
+	tState.m_tLocator[0].m_bDynamic = true;
+	tState.m_tKeyLocator[0].m_iBitOffset = 64;
+	tState.m_tKeyLocator[0].m_iBitCount = 64;
+	tState.m_tKeyLocator[0].m_bDynamic = true;
+
+	CSphMatch tA, tB;
+	tA.Reset ( 4 );
+	tB.Reset ( 4 );
+	for ( int iColl=0; iColl<3; iColl++ )
+	{
+		tState.m_fnStrCmp = dCmp[iColl];
+		ARRAY_FOREACH ( i, dStrings )
+			ARRAY_FOREACH ( j, dStrings )
+		{
+			const BYTE * pA = dStrings[i].Begin();
+			const BYTE * pB = dStrings[j].Begin();
+			const BYTE * sA = NULL;
+			const BYTE * sB = NULL;
+			int iLenA = sphUnpackStr ( pA, &sA );
+			int iLenB = sphUnpackStr ( pB, &sB );
+			uint64_t uKeyA = sphCollateKey ( sA, iLenA, dColl[iColl] );
+			uint64_t uKeyB = sphCollateKey ( sB, iLenB, dColl[iColl] );
+			assert ( uKeyA && uKeyB );
+
+			// differing keys must agree with the collation
+			int iCmp = dCmp[iColl] ( pA, pB, true );
+			assert ( uKeyA==uKeyB || ( uKeyA<uKeyB )==( iCmp<0 ) );
+			assert ( uKeyA==uKeyB || iCmp!=0 );
+
+			// and so does the comparator that uses them
+			tA.SetAttr ( tState.m_tLocator[0], (SphAttr_t)pA );
+			tB.SetAttr ( tState.m_tLocator[0], (SphAttr_t)pB );
+			tA.SetAttr ( tState.m_tKeyLocator[0], (SphAttr_t)uKeyA );
+			tB.SetAttr ( tState.m_tKeyLocator[0], (SphAttr_t)uKeyB );
+			tState.m_uStringKeys = 1;
+			int iKeyed = tState.CmpStrings ( tA, tB, 0 );
+			assert ( ( iKeyed<0 )==( iCmp<0 ) && ( iKeyed>0 )==( iCmp>0 ) );
+
+			// no key on one side means a full compare
+			tB.SetAttr ( tState.m_tKeyLocator[0], 0 );
+			iKeyed = tState.CmpStrings ( tA, tB, 0 );
+			assert ( ( iKeyed<0 )==( iCmp<0 ) && ( iKeyed>0 )==( iCmp>0 ) );
+		}
+	}
+
+	assert ( !sphCollateKey ( (const BYTE*)"abc", 3, SPH_COLLATION_LIBC_CS ) );
+
+	printf ( "ok\n" );
+}
+
+
+void TestFilterValues()
+{
+	printf ( "testing value list filters... " );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "v", SPH_ATTR_BIGINT );
+	tSchema.AddAttr ( tCol, false );
+
+	sphSrand ( 0 );
+	for ( int iList=0; iList<5; iList++ )
+	{
+		// small, dense (bitmap), sparse (hash), and lists that hit the int64 edges
+		CSphFilterSettings tSettings;
+		tSettings.m_sAttrName = "v";
+		tSettings.m_eType = SPH_FILTER_VALUES;
+		int iCount = iList==0 ? 7 : 1000;
+		for ( int i=0; i<iCount; i++ )
+		{
+			SphAttr_t iValue;
+			switch ( iList )
+			{
+				case 1:		iValue = 5000 + sphRand()%20000; break;
+				case 3:		iValue = LLONG_MIN + i*1000; break;
+				case 4:		iValue = i%2 ? LLONG_MAX - i : LLONG_MIN + i; break;
+				default:	iValue = ( (SphAttr_t)sphRand()<<32 ) | sphRand(); break;
+			}
+			tSettings.m_dValues.Add ( iValue );
+		}
+		tSettings.m_dValues.Uniq();
+		const CSphVector<SphAttr_t> & dValues = tSettings.m_dValues;
+
+		CSphString sError, sWarning;
+		CSphScopedPtr<ISphFilter> pFilter ( sphCreateFilter ( tSettings, tSchema, NULL, NULL, sError, sWarning, SPH_COLLATION_DEFAULT, false ) );
+		tSettings.m_sAttrName = "@id";
+		CSphScopedPtr<ISphFilter> pIdFilter ( sphCreateFilter ( tSettings, tSchema, NULL, NULL, sError, sWarning, SPH_COLLATION_DEFAULT, false ) );
+		assert ( pFilter.Ptr() && pIdFilter.Ptr() );
+
+		CSphFixedVector<CSphRowitem> dRow ( tSchema.GetRowSize() );
+		CSphMatch tMatch;
+		tMatch.m_pStatic = dRow.Begin();
+		for ( int i=0; i<4000; i++ )
+		{
+			// probe the values themselves, their neighbours, and random misses
+			SphAttr_t iProbe = (SphAttr_t)( (uint64_t)dValues [ i%dValues.GetLength() ] + ( i/dValues.GetLength() )%3 - 1 );
+			if ( i%7==0 )
+				iProbe = ( (SphAttr_t)sphRand()<<32 ) | sphRand();
+
+			sphSetRowAttr ( dRow.Begin(), tSchema.GetAttr(0).m_tLocator, iProbe );
+			tMatch.m_uDocID = (SphDocID_t)iProbe;
+			bool bExpected = dValues.BinarySearch ( iProbe )!=NULL;
+			assert ( pFilter->Eval ( tMatch )==bExpected );
+			assert ( pIdFilter->Eval ( tMatch )==bExpected );
+		}
+	}
+
+	printf ( "ok\n" );
+}
+
+
+void TestGeoGrid()
+{
+	printf ( "testing geo grid... " );
+	GeodistInit();
+
+	CSphSchema tSchema;
+	CSphColumnInfo tLat ( "lat", SPH_ATTR_FLOAT );
+	CSphColumnInfo tLon ( "lon", SPH_ATTR_FLOAT );
+	tSchema.AddAttr ( tLat, false );
+	tSchema.AddAttr ( tLon, false );
+	const CSphAttrLocator & tLatLoc = tSchema.GetAttr(0).m_tLocator;
+	const CSphAttrLocator & tLonLoc = tSchema.GetAttr(1).m_tLocator;
+
+	// a dense spot around the antimeridian, and scattered points all over the globe
+	const int ROWS = 5000;
+	int iStride = DOCINFO_IDSIZE + tSchema.GetRowSize();
+	CSphFixedVector<DWORD> dDocinfo ( ROWS*iStride );
+	sphSrand ( 0 );
+	for ( int i=0; i<ROWS; i++ )
+	{
+		DWORD * pRow = dDocinfo.Begin() + i*iStride;
+		DOCINFOSETID ( pRow, (SphDocID_t)( i+1 ) );
+		float fLat, fLon;
+		if ( i%2 )
+		{
+			fLat = 60.0f + ( sphRand()%20000 )/1000.0f - 10.0f;
+			fLon = ( sphRand()%20000 )/1000.0f;
+			fLon = i%4==1 ? fLon-180.0f : 180.0f-fLon;
+		} else
+		{
+			fLat = ( sphRand()%180000 )/1000.0f - 90.0f;
+			fLon = ( sphRand()%360000 )/1000.0f - 180.0f;
+		}
+		sphSetRowAttr ( DOCINFO2ATTRS ( pRow ), tLatLoc, sphF2DW ( fLat ) );
+		sphSetRowAttr ( DOCINFO2ATTRS ( pRow ), tLonLoc, sphF2DW ( fLon ) );
+	}
+
+	GeoGrid_c tGrid;
+	tGrid.Build ( dDocinfo.Begin(), ROWS, iStride, tLatLoc, tLonLoc );
+	assert ( !tGrid.IsEmpty() );
+	assert ( tGrid.CountRows ( tGrid.GetBounds() )==ROWS );
+
+	// circles must cover every point that geodist() puts within the radius
+	const float dAnchors[][2] = { { 60.0f, 179.5f }, { 60.0f, -179.5f }, { 0.0f, 0.0f }, { 89.5f, 10.0f }, { -45.0f, 100.0f } };
+	const float dRadius[] = { 1000.0f, 50000.0f, 400000.0f, 3000000.0f, 30000000.0f };
+	for ( int iAnchor=0; iAnchor<(int)( sizeof(dAnchors)/sizeof(dAnchors[0]) ); iAnchor++ )
+		for ( int iRadius=0; iRadius<(int)( sizeof(dRadius)/sizeof(dRadius[0]) ); iRadius++ )
+			for ( int iDeg=0; iDeg<2; iDeg++ )
+			{
+				bool bDeg = iDeg==1;
+				float fUnit = bDeg ? 1.0f : (float)( 3.14159265358979323846/180.0 );
+				float fAnchorLat = dAnchors[iAnchor][0]*fUnit;
+				float fAnchorLon = dAnchors[iAnchor][1]*fUnit;
+
+				// radians need a grid over radians
+				GeoGrid_c tRadGrid;
+				CSphFixedVector<DWORD> dRadDocinfo ( bDeg ? 0 : ROWS*iStride );
+				if ( !bDeg )
+				{
+					memcpy ( dRadDocinfo.Begin(), dDocinfo.Begin(), dDocinfo.GetSizeBytes() );
+					for ( int i=0; i<ROWS; i++ )
+					{
+						DWORD * pAttrs = DOCINFO2ATTRS ( dRadDocinfo.Begin() + i*iStride );
+						sphSetRowAttr ( pAttrs, tLatLoc, sphF2DW ( sphDW2F ( (DWORD)sphGetRowAttr ( pAttrs, tLatLoc ) )*fUnit ) );
+						sphSetRowAttr ( pAttrs, tLonLoc, sphF2DW ( sphDW2F ( (DWORD)sphGetRowAttr ( pAttrs, tLonLoc ) )*fUnit ) );
+					}
+					tRadGrid.Build ( dRadDocinfo.Begin(), ROWS, iStride, tLatLoc, tLonLoc );
+				}
+				const GeoGrid_c & tUse = bDeg ? tGrid : tRadGrid;
+				const DWORD * pDocinfo = bDeg ? dDocinfo.Begin() : dRadDocinfo.Begin();
+
+				GeoGrid_c::Box_t tBox;
+				Verify ( tUse.GetCircleBox ( fAnchorLat, fAnchorLon, dRadius[iRadius], bDeg, tBox ) );
+
+				CSphVector<DWORD> dRows;
+				tUse.CollectRows ( tBox, dRows, NULL );
+				assert ( tUse.CountRows ( tBox )==dRows.GetLength() );
+				dRows.Sort();
+
+				for ( int i=0; i<ROWS; i++ )
+				{
+					const DWORD * pAttrs = DOCINFO2ATTRS ( pDocinfo + i*iStride );
+					float fLatRow = sphDW2F ( (DWORD)sphGetRowAttr ( pAttrs, tLatLoc ) );
+					float fLonRow = sphDW2F ( (DWORD)sphGetRowAttr ( pAttrs, tLonLoc ) );
+					float fAdaptive = bDeg
+						? GeodistAdaptiveDeg ( fLatRow, fLonRow, fAnchorLat, fAnchorLon )
+						: GeodistAdaptiveRad ( fLatRow, fLonRow, fAnchorLat, fAnchorLon );
+					float fSphere = bDeg
+						? GeodistSphereDeg ( fLatRow, fLonRow, fAnchorLat, fAnchorLon )
+						: GeodistSphereRad ( fLatRow, fLonRow, fAnchorLat, fAnchorLon );
+					if ( fAdaptive<=dRadius[iRadius] || fSphere<=dRadius[iRadius] )
+						assert ( dRows.BinarySearch ( (DWORD)i )!=NULL );
+				}
+
+				// small circles must actually narrow things down
+				if ( dRadius[iRadius]<=50000.0f )
+					assert ( dRows.GetLength()*4<ROWS );
+			}
+
+	// visited cells are skipped
+	CSphVector<DWORD> dAll, dAgain;
+	CSphBitvec dVisited ( tGrid.GetCellsCount() );
+	tGrid.CollectRows ( tGrid.GetBounds(), dAll, &dVisited );
+	tGrid.CollectRows ( tGrid.GetBounds(), dAgain, &dVisited );
+	assert ( dAll.GetLength()==ROWS && dAgain.GetLength()==0 );
+
+	// box intersection keeps disjoint longitude ranges
+	GeoGrid_c::Box_t tWrap, tRange;
+	Verify ( tGrid.GetCircleBox ( 60.0f, 179.5f, 100000.0f, true, tWrap ) );
+	assert ( tWrap.m_iLonRanges==2 );
+	tRange.m_dLonMin[0] = 0.0f;
+	tRange.m_dLonMax[0] = 180.0f;
+	Verify ( tWrap.Intersect ( tRange ) );
+	assert ( tWrap.m_iLonRanges==1 && tWrap.m_dLonMin[0]>170.0f && tWrap.m_dLonMax[0]==180.0f );
+
+	// out of range coordinates can not be bounded
+	GeoGrid_c::Box_t tBad;
+	assert ( !tGrid.GetCircleBox ( 0.0f, 0.0f, 1000.0f, false, tBad ) );
+
+	printf ( "ok\n" );
+}
+
+
+void TestAttrOrder()
+{
+	printf ( "testing attribute scan order... " );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tTs ( "ts", SPH_ATTR_TIMESTAMP );
+	CSphColumnInfo tBig ( "big", SPH_ATTR_BIGINT );
+	CSphColumnInfo tFloat ( "f", SPH_ATTR_FLOAT );
+	CSphColumnInfo tStr ( "s", SPH_ATTR_STRING );
+	tSchema.AddAttr ( tTs, false );
+	tSchema.AddAttr ( tBig, false );
+	tSchema.AddAttr ( tFloat, false );
+	tSchema.AddAttr ( tStr, false );
+
+	const int ROWS = 1000;
+	int iStride = DOCINFO_IDSIZE + tSchema.GetRowSize();
+	CSphFixedVector<DWORD> dDocinfo ( ROWS*iStride );
+	sphSrand ( 0 );
+	for ( int i=0; i<ROWS; i++ )
+	{
+		DWORD * pRow = dDocinfo.Begin() + i*iStride;
+		DOCINFOSETID ( pRow, (SphDocID_t)( i+1 ) );
+		sphSetRowAttr ( DOCINFO2ATTRS ( pRow ), tSchema.GetAttr(0).m_tLocator, 4000000000U - sphRand()%50 ); // over INT_MAX, lots of ties
+		sphSetRowAttr ( DOCINFO2ATTRS ( pRow ), tSchema.GetAttr(1).m_tLocator, (SphAttr_t)sphRand() - ( (SphAttr_t)1<<40 ) );
+		sphSetRowAttr ( DOCINFO2ATTRS ( pRow ), tSchema.GetAttr(2).m_tLocator, sphF2DW ( ( (int)( sphRand()%2001 ) - 1000 )/10.0f ) );
+	}
+
+	for ( int iAttr=0; iAttr<3; iAttr++ )
+	{
+		const CSphColumnInfo & tCol = tSchema.GetAttr(iAttr);
+		CSphFixedVector<DWORD> dOrder ( 0 );
+		Verify ( sphBuildAttrOrder ( dDocinfo.Begin(), ROWS, iStride, tCol, dOrder ) );
+		assert ( dOrder.GetLength()==ROWS );
+
+		CSphBitvec dSeen ( ROWS );
+		for ( int i=0; i<ROWS; i++ )
+		{
+			assert ( !dSeen.BitGet ( dOrder[i] ) );
+			dSeen.BitSet ( dOrder[i] );
+			if ( !i )
+				continue;
+
+			// ascending keys, ties by row
+			const DWORD * pPrev = DOCINFO2ATTRS ( dDocinfo.Begin() + dOrder[i-1]*iStride );
+			const DWORD * pCur = DOCINFO2ATTRS ( dDocinfo.Begin() + dOrder[i]*iStride );
+			SphAttr_t uPrev = sphGetRowAttr ( pPrev, tCol.m_tLocator );
+			SphAttr_t uCur = sphGetRowAttr ( pCur, tCol.m_tLocator );
+			if ( tCol.m_eAttrType==SPH_ATTR_FLOAT )
+			{
+				assert ( sphDW2F ( (DWORD)uPrev )<=sphDW2F ( (DWORD)uCur ) );
+				if ( sphDW2F ( (DWORD)uPrev )==sphDW2F ( (DWORD)uCur ) )
+					assert ( dOrder[i-1]<dOrder[i] );
+			} else
+			{
+				assert ( uPrev<=uCur );
+				if ( uPrev==uCur )
+					assert ( dOrder[i-1]<dOrder[i] );
+			}
+		}
+	}
+
+	// strings and NaN floats have no usable order
+	CSphFixedVector<DWORD> dOrder ( 0 );
+	assert ( !sphBuildAttrOrder ( dDocinfo.Begin(), ROWS, iStride, tSchema.GetAttr(3), dOrder ) );
+	sphSetRowAttr ( DOCINFO2ATTRS ( dDocinfo.Begin() ), tSchema.GetAttr(2).m_tLocator, sphF2DW ( sqrtf ( -1.0f ) ) );
+	assert ( !sphBuildAttrOrder ( dDocinfo.Begin(), ROWS, iStride, tSchema.GetAttr(2), dOrder ) );
+
+	printf ( "ok\n" );
+}
+
+
+static float OrderedScanKey ( SphDocID_t uID )
+{
+	return ( (int)( ( uID*37 )%50 ) - 25 )/4.0f;
+}
+
+/// fullscans the index, returns ids of the first matches and the number of rows pushed to the sorter (counted by the only group, if grouped)
+static int64_t OrderedScanRun ( ISphRtIndex * pIndex, CSphQuery & tQuery, CSphVector<SphDocID_t> & dIds, int64_t & iUnscanned )
+{
+	CSphQueryResult tResult;
+	CSphMultiQueryArgs tArgs ( KillListVector(), 1 );
+	tQuery.m_iLimit = 5;
+	Verify ( tQuery.ParseSelectList ( tResult.m_sError ) );
+
+	SphQueueSettings_t tQueueSettings ( tQuery, pIndex->GetMatchSchema(), tResult.m_sError, NULL );
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter );
+	Verify ( pIndex->MultiQuery ( &tQuery, &tResult, 1, &pSorter, tArgs ) );
+	int64_t iTotal = pSorter->GetTotalCount();
+	sphFlattenQueue ( pSorter, &tResult, 0 );
+	const CSphColumnInfo * pCount = pSorter->GetSchema().GetAttr ( "@count" );
+	if ( pCount && tResult.m_dMatches.GetLength()==1 )
+		iTotal = tResult.m_dMatches[0].GetAttr ( pCount->m_tLocator );
+	dIds.Resize ( 0 );
+	for ( int i=0; i<tResult.m_dMatches.GetLength() && i<tQuery.m_iLimit; i++ )
+		dIds.Add ( tResult.m_dMatches[i].m_uDocID );
+	iUnscanned = tResult.m_iUnscannedRows;
+	SafeDelete ( pSorter );
+	return iTotal;
+}
+
+void TestOrderedScan ()
+{
+	printf ( "testing sort_by ordered fullscans... " );
+	const int DOCS = 200;
+
+	TestRTInit ();
+	CSphString sError, sWarning, sFilter;
+	CSphDictSettings tDictSettings;
+	tDictSettings.m_bWordDict = false;
+	ISphTokenizer * pTok = sphCreateUTF8Tokenizer();
+	CSphDict * pDict = sphCreateDictionaryCRC ( tDictSettings, NULL, pTok, "ordscan", sError );
+
+	CSphSchema tSchema;
+	tSchema.m_dFields.Add ( CSphColumnInfo ( "title" ) );
+	tSchema.AddAttr ( CSphColumnInfo ( "f", SPH_ATTR_FLOAT ), false );
+
+	DeleteIndexFiles ( "test_ordscan" );
+	ISphRtIndex * pIndex = sphCreateIndexRT ( tSchema, "ordscan", 32*1024*1024, "test_ordscan", false );
+	CSphIndexSettings tSettings;
+	tSettings.m_sSortByAttr = "f";
+	pIndex->Setup ( tSettings );
+	pIndex->SetTokenizer ( pTok ); // index will own this pair from now on
+	pIndex->SetDictionary ( pDict );
+	pIndex->PostSetup();
+	Verify ( pIndex->Prealloc ( false ) );
+
+	// negative and positive keys with ties, saved to a disk chunk which gets the scan order
+	const char * dFields[] = { "hello" };
+	CSphVector<DWORD> dMvas;
+	CSphAttrLocator tLoc = pIndex->GetMatchSchema().GetAttr(0).m_tLocator;
+	tLoc.m_bDynamic = true;
+	for ( int i=1; i<=DOCS; i++ )
+	{
+		CSphMatch tDoc;
+		tDoc.Reset ( pIndex->GetMatchSchema().GetRowSize() );
+		tDoc.m_uDocID = i;
+		tDoc.SetAttrFloat ( tLoc, OrderedScanKey ( i ) );
+		Verify ( pIndex->AddDocument ( pIndex->CloneIndexingTokenizer(), 1, dFields, tDoc, false, sFilter, NULL, dMvas, sError, sWarning, NULL ) );
+	}
+	pIndex->Commit ( NULL, NULL );
+	pIndex->ForceDiskChunk();
+
+	CSphVector<SphDocID_t> dExpected;
+	for ( int i=1; i<=DOCS; i++ )
+		dExpected.Add ( i );
+	for ( int i=1; i<DOCS; i++ )
+		for ( int j=i; j>0; j-- )
+		{
+			float fA = OrderedScanKey ( dExpected[j-1] ), fB = OrderedScanKey ( dExpected[j] );
+			if ( fA>fB || ( fA==fB && dExpected[j-1]<dExpected[j] ) )
+				break;
+			Swap ( dExpected[j-1], dExpected[j] );
+		}
+
+	// plain order by the key stops early, and reports that
+	CSphVector<SphDocID_t> dIds;
+	int64_t iUnscanned = 0;
+	CSphQuery tQuery;
+	tQuery.m_sSelect = "*";
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = "f desc";
+	int64_t iTotal = OrderedScanRun ( pIndex, tQuery, dIds, iUnscanned );
+	assert ( iUnscanned>0 && iTotal+iUnscanned==DOCS );
+	assert ( dIds.GetLength()==5 );
+	ARRAY_FOREACH ( i, dIds )
+		assert ( dIds[i]==dExpected[i] );
+
+	// the next page by cursor gets every row
+	CSphQuery tAfter;
+	tAfter.m_sSelect = "*";
+	tAfter.m_eSort = SPH_SORT_EXTENDED;
+	tAfter.m_sSortBy = "f desc";
+	tAfter.m_sSearchAfter.SetSprintf ( "%.9g," DOCID_FMT, OrderedScanKey ( dExpected[4] ), dExpected[4] );
+	iTotal = OrderedScanRun ( pIndex, tAfter, dIds, iUnscanned );
+	assert ( iUnscanned==0 && iTotal==DOCS );
+	assert ( dIds.GetLength()==5 );
+	ARRAY_FOREACH ( i, dIds )
+		assert ( dIds[i]==dExpected[i+5] );
+
+	// so do aggregates with implicit grouping
+	CSphQuery tAggr;
+	tAggr.m_eSort = SPH_SORT_EXTENDED;
+	tAggr.m_sSortBy = "f desc";
+	tAggr.m_sSelect = "*, count(*) as c";
+	iTotal = OrderedScanRun ( pIndex, tAggr, dIds, iUnscanned );
+	assert ( iUnscanned==0 && iTotal==DOCS );
+
+	// and legacy attribute sorting, which compares floats as raw bits
+	CSphQuery tLegacy;
+	tLegacy.m_sSelect = "*";
+	tLegacy.m_eSort = SPH_SORT_ATTR_DESC;
+	tLegacy.m_sSortBy = "f";
+	iTotal = OrderedScanRun ( pIndex, tLegacy, dIds, iUnscanned );
+	assert ( iUnscanned==0 && iTotal==DOCS );
+
+	SafeDelete ( pIndex );
+	sphRTDone ();
+	DeleteIndexFiles ( "test_ordscan" );
+
+	printf ( "ok\n" );
+}
+
+
+void TestReorderEstimate ()
+{
+	printf ( "testing reorder estimate... " );
+
+	// docid deltas 0, 200, 200; row deltas from -1 are 1, 1, 199; sorted rank deltas are all 1
+	ReorderEstimate_t tEstimate;
+	tEstimate.StartDoclist ( 100 );
+	tEstimate.AddDoc ( 100, 0, 2 );
+	tEstimate.AddDoc ( 300, 1, 0 );
+	tEstimate.AddDoc ( 500, 200, 1 );
+	tEstimate.FinishDoclist();
+	assert ( tEstimate.m_iPostings==3 );
+	assert ( tEstimate.m_iCurBytes==5 && tEstimate.m_iDenseBytes==4 && tEstimate.m_iOrderBytes==3 );
+
+	// whole disk chunk, where every "kN" keyword is spread over the ids and clustered by the attribute
+	const int DOCS = 1000;
+	const int GROUPS = 200;
+
+	TestRTInit ();
+	CSphString sError, sWarning, sFilter;
+	CSphDictSettings tDictSettings;
+	tDictSettings.m_bWordDict = false;
+	ISphTokenizer * pTok = sphCreateUTF8Tokenizer();
+	CSphDict * pDict = sphCreateDictionaryCRC ( tDictSettings, NULL, pTok, "reorder", sError );
+
+	CSphSchema tSchema;
+	tSchema.m_dFields.Add ( CSphColumnInfo ( "title" ) );
+	tSchema.AddAttr ( CSphColumnInfo ( "g", SPH_ATTR_INTEGER ), false );
+
+	DeleteIndexFiles ( "test_reorder" );
+	ISphRtIndex * pIndex = sphCreateIndexRT ( tSchema, "reorder", 32*1024*1024, "test_reorder", false );
+	pIndex->SetTokenizer ( pTok ); // index will own this pair from now on
+	pIndex->SetDictionary ( pDict );
+	pIndex->PostSetup();
+	Verify ( pIndex->Prealloc ( false ) );
+
+	CSphVector<DWORD> dMvas;
+	CSphAttrLocator tLoc = pIndex->GetMatchSchema().GetAttr(0).m_tLocator;
+	tLoc.m_bDynamic = true;
+	for ( int i=1; i<=DOCS; i++ )
+	{
+		CSphString sText;
+		sText.SetSprintf ( "all k%d", i%GROUPS );
+		const char * dFields[] = { sText.cstr() };
+
+		CSphMatch tDoc;
+		tDoc.Reset ( pIndex->GetMatchSchema().GetRowSize() );
+		tDoc.m_uDocID = i*1000;
+		tDoc.SetAttr ( tLoc, i%GROUPS );
+		Verify ( pIndex->AddDocument ( pIndex->CloneIndexingTokenizer(), 1, dFields, tDoc, false, sFilter, NULL, dMvas, sError, sWarning, NULL ) );
+	}
+	pIndex->Commit ( NULL, NULL );
+	pIndex->ForceDiskChunk();
+	SafeDelete ( pIndex );
+	sphRTDone ();
+
+	CSphIndex * pChunk = sphCreateIndexPhrase ( "reorder", "test_reorder.0" );
+	Verify ( pChunk->Prealloc ( false ) );
+	pChunk->Preread();
+
+	FILE * fp = tmpfile();
+	assert ( fp );
+	pChunk->DebugEstimateReorder ( fp, "g" );
+	rewind ( fp );
+
+	int64_t iPostings = 0, iCur = 0, iDense = 0, iOrder = 0;
+	char sLine[256];
+	while ( fgets ( sLine, sizeof(sLine), fp ) )
+	{
+		sscanf ( sLine, "postings: " INT64_FMT, &iPostings );
+		sscanf ( sLine, "docid-delta-bytes: current=" INT64_FMT ", dense=" INT64_FMT ", reordered=" INT64_FMT, &iCur, &iDense, &iOrder );
+	}
+	fclose ( fp );
+
+	// id gaps of "all" are 1000 (2 bytes) and of "kN" 200000 (3 bytes), less a few short first gaps from the min id;
+	// dense row gaps are 1 and 200 (1 and 2 bytes); clustered "kN" rank gaps are 1 except the first one
+	assert ( iPostings==2*DOCS );
+	assert ( iCur==4981 && iDense==2873 && iOrder==2174 );
+
+	SafeDelete ( pChunk );
+	DeleteIndexFiles ( "test_reorder" );
+
+	printf ( "ok\n" );
+}
+
+static void SearchAfterPage ( const CSphSchema & tSchema, bool bKbuffer, const char * sAfter, CSphVector<SphDocID_t> & dIds )
+{
+	CSphQuery tQuery;
+	CSphQueryResult tResult;
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = "gid desc";
+	tQuery.m_bSortKbuffer = bKbuffer;
+	tQuery.m_sSearchAfter = sAfter;
+
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, tResult.m_sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter );
+
+	const CSphAttrLocator & tLoc = tSchema.GetAttr(0).m_tLocator;
+	for ( int i=1; i<=100; i++ )
+	{
+		CSphMatch tMatch;
+		tMatch.Reset ( tSchema.GetDynamicSize() );
+		tMatch.m_uDocID = i;
+		tMatch.SetAttr ( tLoc, i%10 );
+		pSorter->Push ( tMatch );
+	}
+	assert ( pSorter->GetTotalCount()==100 );
+
+	sphFlattenQueue ( pSorter, &tResult, 0 );
+	dIds.Resize ( 0 );
+	for ( int i=0; i<tResult.m_dMatches.GetLength() && i<7; i++ )
+		dIds.Add ( tResult.m_dMatches[i].m_uDocID );
+	SafeDelete ( pSorter );
+}
+
+
+void TestSearchAfter()
+{
+	printf ( "testing search_after cursor... " );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "gid", SPH_ATTR_INTEGER );
+	tSchema.AddAttr ( tCol, true );
+
+	for ( int iKbuffer=0; iKbuffer<2; iKbuffer++ )
+	{
+		// walk the pages by cursor, and check they make up the full ordering
+		CSphVector<SphDocID_t> dPage;
+		SphDocID_t uLast = 0;
+		int iLastGid = 0;
+		int iSeen = 0;
+		for ( ;; )
+		{
+			CSphString sAfter;
+			if ( iSeen )
+				sAfter.SetSprintf ( "%d," DOCID_FMT, iLastGid, uLast );
+			SearchAfterPage ( tSchema, iKbuffer!=0, sAfter.cstr(), dPage );
+			if ( !dPage.GetLength() )
+				break;
+
+			ARRAY_FOREACH ( i, dPage )
+			{
+				int iGid = (int)( dPage[i]%10 );
+				if ( iSeen )
+					assert ( iGid<iLastGid || ( iGid==iLastGid && dPage[i]>uLast ) );
+				iLastGid = iGid;
+				uLast = dPage[i];
+				iSeen++;
+			}
+		}
+		assert ( iSeen==100 );
+	}
+
+	// malformed cursors
+	CSphQuery tQuery;
+	CSphString sError;
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = "gid desc";
+	const char * dBad[] = { "5", "5,1,2", "x,1" };
+	for ( int i=0; i<(int)( sizeof(dBad)/sizeof(dBad[0]) ); i++ )
+	{
+		tQuery.m_sSearchAfter = dBad[i];
+		SphQueueSettings_t tQueueSettings ( tQuery, tSchema, sError, NULL );
+		tQueueSettings.m_bComputeItems = false;
+		assert ( !sphCreateQueue ( tQueueSettings ) && !sError.IsEmpty() );
+	}
+
+	printf ( "ok\n" );
+}
+
+
+// floats one ulp apart above 1.0, two docs per value, so the keys only differ past the %f precision
+static float SearchAfterFloat ( SphDocID_t uID )
+{
+	float fVal = 1.0f;
+	for ( int i=0; i<(int)( ( uID*37 )%50 ); i++ )
+		fVal = nextafterf ( fVal, 2.0f );
+	return fVal;
+}
+
+static void SearchAfterFloatPage ( const CSphSchema & tSchema, const char * sAfter, CSphVector<SphDocID_t> & dIds, CSphString & sNext )
+{
+	CSphQuery tQuery;
+	CSphQueryResult tResult;
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = "f asc";
+	tQuery.m_sSearchAfter = sAfter;
+
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, tResult.m_sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter );
+
+	const CSphAttrLocator & tLoc = tSchema.GetAttr(0).m_tLocator;
+	for ( int i=1; i<=100; i++ )
+	{
+		CSphMatch tMatch;
+		tMatch.Reset ( tSchema.GetDynamicSize() );
+		tMatch.m_uDocID = i;
+		tMatch.SetAttr ( tLoc, sphF2DW ( SearchAfterFloat ( i ) ) );
+		pSorter->Push ( tMatch );
+	}
+
+	sphFlattenQueue ( pSorter, &tResult, 0 );
+	dIds.Resize ( 0 );
+	sNext = "";
+	for ( int i=0; i<tResult.m_dMatches.GetLength() && i<7; i++ )
+	{
+		dIds.Add ( tResult.m_dMatches[i].m_uDocID );
+		Verify ( sphFormatSearchAfter ( tQuery, tSchema, tResult.m_dMatches[i], sNext ) );
+	}
+	SafeDelete ( pSorter );
+}
+
+
+void TestSearchAfterFloat()
+{
+	printf ( "testing search_after cursor on floats... " );
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "f", SPH_ATTR_FLOAT );
+	tSchema.AddAttr ( tCol, true );
+
+	// walk the pages by the cursors the server reports, nothing skipped or repeated
+	CSphVector<SphDocID_t> dPage;
+	CSphString sAfter, sNext;
+	CSphBitvec dSeen ( 101 );
+	float fLast = 0.0f;
+	SphDocID_t uLast = 0;
+	int iSeen = 0;
+	for ( ;; )
+	{
+		SearchAfterFloatPage ( tSchema, sAfter.cstr(), dPage, sNext );
+		if ( !dPage.GetLength() )
+			break;
+
+		ARRAY_FOREACH ( i, dPage )
+		{
+			float fVal = SearchAfterFloat ( dPage[i] );
+			assert ( !dSeen.BitGet ( (int)dPage[i] ) );
+			dSeen.BitSet ( (int)dPage[i] );
+			if ( iSeen )
+				assert ( fVal>fLast || ( fVal==fLast && dPage[i]>uLast ) );
+			fLast = fVal;
+			uLast = dPage[i];
+			iSeen++;
+		}
+		sAfter = sNext;
+	}
+	assert ( iSeen==100 );
+
+	// printed with the default 6 decimals, the keys all look alike, and the next page would skip some
+	SearchAfterFloatPage ( tSchema, "", dPage, sNext );
+	float fPageLast = SearchAfterFloat ( dPage.Last() );
+	assert ( fPageLast>1.0f );
+	CSphString sLossy;
+	sLossy.SetSprintf ( "%f," DOCID_FMT, fPageLast, dPage.Last() );
+	assert ( sphF2DW ( (float)strtod ( sLossy.cstr(), NULL ) )!=sphF2DW ( fPageLast ) );
+
+	// hex floats are exact too, and continue the same way as the reported cursor
+	CSphVector<SphDocID_t> dHexPage;
+	CSphString sHex, sDummy;
+	sHex.SetSprintf ( "%a," DOCID_FMT, fPageLast, dPage.Last() );
+	SearchAfterFloatPage ( tSchema, sNext.cstr(), dPage, sDummy );
+	SearchAfterFloatPage ( tSchema, sHex.cstr(), dHexPage, sDummy );
+	assert ( dPage.GetLength()==7 && dHexPage.GetLength()==7 );
+	ARRAY_FOREACH ( i, dPage )
+		assert ( dPage[i]==dHexPage[i] );
+
+	printf ( "ok\n" );
+}
+
+
+static void MergeTestAdd ( CSphSwapVector<CSphMatch> & dMatches, const CSphSchema & tSchema, SphDocID_t uID, int iSet )
+{
+	CSphMatch & tMatch = dMatches.Add();
+	tMatch.Reset ( tSchema.GetDynamicSize() );
+	tMatch.m_uDocID = uID;
+	tMatch.m_iTag = iSet;
+	tMatch.SetAttr ( tSchema.GetAttr(0).m_tLocator, uID%7 );
+	tMatch.SetAttr ( tSchema.GetAttr(1).m_tLocator, iSet );
+}
+
+// sets of matches ordered by gid desc, id asc, as flattened sorters would return them; doc 100 is in sets 0 and 2
+static void MergeTestSets ( const CSphSchema & tSchema, CSphSwapVector<CSphMatch> & dMatches, CSphVector<int> & dCounts )
+{
+	const int SETS = 3;
+	dMatches.Reset();
+	dCounts.Reset();
+	for ( int iSet=0; iSet<SETS; iSet++ )
+	{
+		int iStart = dMatches.GetLength();
+		for ( int iGid=6; iGid>=0; iGid-- )
+			for ( SphDocID_t uID=1; uID<=100; uID++ )
+				if ( (int)( uID%7 )==iGid && ( uID==100 ? iSet!=1 : (int)( uID%SETS )==iSet ) )
+					MergeTestAdd ( dMatches, tSchema, uID, iSet );
+		dCounts.Add ( dMatches.GetLength()-iStart );
+	}
+}
+
+void TestMergeSortedSets ()
+{
+	printf ( "testing merge of sorted result sets... " );
+
+	CSphSchema tSchema;
+	tSchema.AddAttr ( CSphColumnInfo ( "gid", SPH_ATTR_INTEGER ), true );
+	tSchema.AddAttr ( CSphColumnInfo ( "src", SPH_ATTR_INTEGER ), true );
+	const CSphAttrLocator & tGid = tSchema.GetAttr(0).m_tLocator;
+	const CSphAttrLocator & tSrc = tSchema.GetAttr(1).m_tLocator;
+
+	CSphQuery tQuery;
+	CSphString sError;
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = "gid desc, @id asc";
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter && pSorter->CanMergeSorted() );
+
+	CSphSwapVector<CSphMatch> dMatches;
+	CSphVector<int> dCounts;
+
+	// interleaved sets, one duplicate; the copy with the latest tag wins
+	MergeTestSets ( tSchema, dMatches, dCounts );
+	int iDupes = 0;
+	Verify ( sphMergeSortedSets ( *pSorter, dMatches, dCounts, 1000, tSchema, iDupes ) );
+	assert ( iDupes==1 );
+	assert ( dMatches.GetLength()==100 );
+	for ( int i=1; i<dMatches.GetLength(); i++ )
+	{
+		const CSphMatch & a = dMatches[i-1];
+		const CSphMatch & b = dMatches[i];
+		assert ( a.GetAttr ( tGid )>b.GetAttr ( tGid ) || ( a.GetAttr ( tGid )==b.GetAttr ( tGid ) && a.m_uDocID<b.m_uDocID ) );
+	}
+	ARRAY_FOREACH ( i, dMatches )
+		if ( dMatches[i].m_uDocID==100 )
+			assert ( dMatches[i].GetAttr ( tSrc )==2 );
+
+	// max_matches cap keeps the head of the same order
+	CSphVector<SphDocID_t> dHead;
+	for ( int i=0; i<10; i++ )
+		dHead.Add ( dMatches[i].m_uDocID );
+	MergeTestSets ( tSchema, dMatches, dCounts );
+	Verify ( sphMergeSortedSets ( *pSorter, dMatches, dCounts, 10, tSchema, iDupes ) );
+	assert ( dMatches.GetLength()==10 );
+	ARRAY_FOREACH ( i, dHead )
+		assert ( dMatches[i].m_uDocID==dHead[i] );
+
+	// unordered set is refused, and left alone
+	MergeTestSets ( tSchema, dMatches, dCounts );
+	int iTotal = dMatches.GetLength();
+	Swap ( dMatches[0], dMatches[dCounts[0]-1] );
+	SphDocID_t uFirst = dMatches[0].m_uDocID;
+	assert ( !sphMergeSortedSets ( *pSorter, dMatches, dCounts, 1000, tSchema, iDupes ) );
+	assert ( dMatches.GetLength()==iTotal && dMatches[0].m_uDocID==uFirst );
+
+	SafeDelete ( pSorter );
+	printf ( "ok\n" );
+}
+
+
+static void TopWeightPush ( ISphMatchSorter * pSorter, const CSphSchema & tSchema, SphDocID_t uID, int iWeight )
+{
+	CSphMatch tMatch;
+	tMatch.Reset ( tSchema.GetDynamicSize() );
+	tMatch.m_uDocID = uID;
+	tMatch.m_iWeight = iWeight;
+	pSorter->Push ( tMatch );
+}
+
+void TestSharedTopWeight ()
+{
+	printf ( "testing weight threshold shared by sorters... " );
+
+	CSphSchema tSchema;
+	tSchema.AddAttr ( CSphColumnInfo ( "gid", SPH_ATTR_INTEGER ), true );
+
+	CSphQuery tQuery;
+	CSphString sError;
+	tQuery.m_iMaxMatches = 3;
+	SharedTopWeight_t tTop;
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	tQueueSettings.m_pTopWeight = &tTop;
+	ISphMatchSorter * pFirst = sphCreateQueue ( tQueueSettings );
+	ISphMatchSorter * pSecond = sphCreateQueue ( tQueueSettings );
+	assert ( pFirst && pSecond );
+
+	// nothing published until a queue gets full
+	TopWeightPush ( pFirst, tSchema, 1, 10 );
+	TopWeightPush ( pFirst, tSchema, 2, 20 );
+	TopWeightPush ( pSecond, tSchema, 11, 5 );
+	assert ( pSecond->GetLength()==1 );
+	TopWeightPush ( pFirst, tSchema, 3, 30 );
+	assert ( tTop.GetWeight()==10 );
+
+	// hopeless matches still count towards total
+	TopWeightPush ( pSecond, tSchema, 12, 5 );
+	TopWeightPush ( pSecond, tSchema, 13, 15 );
+	assert ( pSecond->GetLength()==2 && pSecond->GetTotalCount()==3 );
+
+	// threshold only goes up
+	TopWeightPush ( pFirst, tSchema, 4, 40 );
+	TopWeightPush ( pSecond, tSchema, 14, 18 );
+	assert ( tTop.GetWeight()==20 && pSecond->GetLength()==2 );
+	tTop.Publish ( 1 );
+	assert ( tTop.GetWeight()==20 );
+
+	// sorters that must not drop anything are not wired
+	tQuery.m_sGroupBy = "gid";
+	SharedTopWeight_t tGroupTop;
+	SphQueueSettings_t tGroupSettings ( tQuery, tSchema, sError, NULL );
+	tGroupSettings.m_bComputeItems = false;
+	tGroupSettings.m_pTopWeight = &tGroupTop;
+	ISphMatchSorter * pGroup = sphCreateQueue ( tGroupSettings );
+	assert ( pGroup );
+	for ( int i=1; i<=5; i++ )
+		TopWeightPush ( pGroup, tSchema, i, 10*i );
+	assert ( tGroupTop.GetWeight()==INT_MIN );
+
+	SafeDelete ( pFirst );
+	SafeDelete ( pSecond );
+	SafeDelete ( pGroup );
+
+	// disjoint docid ranges is what allows sharing; check that rt index reports its range
+	TestRTInit ();
+	ISphRtIndex * pIndex = CreateBinlogTestIndex ( "rtrange", "test_rtrange" );
+	SphDocID_t uMin, uMax;
+	assert ( !pIndex->GetDocidRange ( uMin, uMax ) );
+	BinlogTestCommit ( pIndex, 7 );
+	BinlogTestCommit ( pIndex, 3 );
+	BinlogTestCommit ( pIndex, 5 );
+	assert ( pIndex->GetDocidRange ( uMin, uMax ) && uMin==3 && uMax==7 );
+	SafeDelete ( pIndex );
+	sphRTDone ();
+	DeleteIndexFiles ( "test_rtrange" );
+
+	printf ( "ok\n" );
+}
+
+static void KselectRun ( const CSphSchema & tSchema, const char * sSortBy, bool bKbuffer, int iMatches, CSphVector<SphDocID_t> & dIds )
+{
+	CSphQuery tQuery;
+	CSphQueryResult tResult;
+	tQuery.m_eSort = SPH_SORT_EXTENDED;
+	tQuery.m_sSortBy = sSortBy;
+	tQuery.m_bSortKbuffer = bKbuffer;
+	tQuery.m_iMaxMatches = 5000;
+
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, tResult.m_sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter );
+
+	// same pseudo-random stream for either sorter; lots of ties on gid and weight
+	sphSrand ( 0 );
+	const CSphAttrLocator & tLoc = tSchema.GetAttr(0).m_tLocator;
+	for ( int i=0; i<iMatches; i++ )
+	{
+		CSphMatch tMatch;
+		tMatch.Reset ( tSchema.GetDynamicSize() );
+		tMatch.m_uDocID = 1 + ( (SphDocID_t)i*7919 ) % iMatches;
+		tMatch.m_iWeight = sphRand() % 300;
+		tMatch.SetAttr ( tLoc, sphRand() % 500 );
+		pSorter->Push ( tMatch );
+	}
+	assert ( pSorter->GetTotalCount()==iMatches );
+
+	sphFlattenQueue ( pSorter, &tResult, 0 );
+	dIds.Resize ( 0 );
+	ARRAY_FOREACH ( i, tResult.m_dMatches )
+		dIds.Add ( tResult.m_dMatches[i].m_uDocID );
+	SafeDelete ( pSorter );
+}
+
+
+void TestKselect()
+{
+	printf ( "testing k-selection sorter... " );
+
+	// selection itself
+	sphSrand ( 0 );
+	CSphVector<int> dValues ( 5000 );
+	ARRAY_FOREACH ( i, dValues )
+		dValues[i] = sphRand() % 1000;
+	CSphVector<int> dSorted ( dValues );
+	dSorted.Sort();
+	const int dNth[] = { 0, 1, 31, 32, 33, 999, 2500, 4998, 4999 };
+	for ( int i=0; i<(int)( sizeof(dNth)/sizeof(dNth[0]) ); i++ )
+	{
+		CSphVector<int> dSel ( dValues );
+		int iNth = dNth[i];
+		sphSelect ( dSel.Begin(), dSel.GetLength(), iNth, SphLess_T<int>() );
+		assert ( dSel[iNth]==dSorted[iNth] );
+		for ( int j=0; j<iNth; j++ )
+			assert ( dSel[j]<=dSel[iNth] );
+		for ( int j=iNth+1; j<dSel.GetLength(); j++ )
+			assert ( dSel[j]>=dSel[iNth] );
+	}
+
+	// large pq queues switch to k-selection; check against the k-buffer
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "gid", SPH_ATTR_INTEGER );
+	tSchema.AddAttr ( tCol, true );
+
+	const char * dSortBy[] = { "gid desc", "gid asc, @weight desc", "@weight desc" };
+	const int dMatches[] = { 100, 5000, 9999, 30011 };
+	for ( int i=0; i<(int)( sizeof(dSortBy)/sizeof(dSortBy[0]) ); i++ )
+		for ( int j=0; j<(int)( sizeof(dMatches)/sizeof(dMatches[0]) ); j++ )
+		{
+			CSphVector<SphDocID_t> dKselect, dKbuffer;
+			KselectRun ( tSchema, dSortBy[i], false, dMatches[j], dKselect );
+			KselectRun ( tSchema, dSortBy[i], true, dMatches[j], dKbuffer );
+			assert ( dKselect.GetLength()==Min ( dMatches[j], 5000 ) );
+			assert ( dKselect.GetLength()==dKbuffer.GetLength() );
+			ARRAY_FOREACH ( k, dKselect )
+				assert ( dKselect[k]==dKbuffer[k] );
+		}
+
+	printf ( "ok\n" );
+}
+
+
+void TestGroupRuns()
+{
+	printf ( "testing group-by runs... " );
+
+	// a zone with DST, so that split days are 23 and 25 hours long too
+	CSphString sOldTZ ( getenv ( "TZ" ) );
+	setenv ( "TZ", "Europe/Berlin", 1 );
+	tzset();
+
+	CSphSchema tSchema;
+	CSphColumnInfo tCol ( "ts", SPH_ATTR_TIMESTAMP );
+	tSchema.AddAttr ( tCol, true );
+
+	CSphQuery tQuery;
+	CSphQueryResult tResult;
+	tQuery.m_sGroupBy = "ts";
+	tQuery.m_eGroupFunc = SPH_GROUPBY_DAY;
+	tQuery.m_sGroupSortBy = "@groupby asc";
+
+	SphQueueSettings_t tQueueSettings ( tQuery, tSchema, tResult.m_sError, NULL );
+	tQueueSettings.m_bComputeItems = false;
+	ISphMatchSorter * pSorter = sphCreateQueue ( tQueueSettings );
+	assert ( pSorter );
+
+	// a week around the spring switch in runs of days, then its middle once again, with gaps
+	CSphVector<DWORD> dStamps;
+	const DWORD uFrom = 1774566000; // 2026-03-27 00:00 CET
+	for ( DWORD uStamp=uFrom; uStamp<uFrom+7*86400; uStamp+=1237 )
+		dStamps.Add ( uStamp );
+	for ( DWORD uStamp=uFrom+2*86400-5000; uStamp<uFrom+4*86400; uStamp+=4999 )
+		dStamps.Add ( uStamp );
+
+	CSphVector<int> dExpected;
+	const CSphAttrLocator & tLoc = tSchema.GetAttr(0).m_tLocator;
+	ARRAY_FOREACH ( i, dStamps )
+	{
+		CSphMatch tMatch;
+		tMatch.Reset ( pSorter->GetSchema().GetDynamicSize() );
+		tMatch.m_uDocID = i+1;
+		tMatch.SetAttr ( tLoc, dStamps[i] );
+		pSorter->Push ( tMatch );
+
+		time_t tStamp = dStamps[i];
+		struct tm tSplit;
+		localtime_r ( &tStamp, &tSplit );
+		dExpected.Add ( (tSplit.tm_year+1900)*10000 + (1+tSplit.tm_mon)*100 + tSplit.tm_mday );
+	}
+	dExpected.Sort();
+
+	const CSphColumnInfo * pGroupby = pSorter->GetSchema().GetAttr ( "@groupby" );
+	const CSphColumnInfo * pCount = pSorter->GetSchema().GetAttr ( "@count" );
+	assert ( pGroupby && pCount );
+	CSphAttrLocator tLocGroupby = pGroupby->m_tLocator;
+	CSphAttrLocator tLocCount = pCount->m_tLocator;
+
+	sphFlattenQueue ( pSorter, &tResult, 0 );
+	assert ( tResult.m_dMatches.GetLength()==8 );
+	int iSeen = 0;
+	ARRAY_FOREACH ( i, tResult.m_dMatches )
+	{
+		const CSphMatch & tMatch = tResult.m_dMatches[i];
+		int iKey = (int)tMatch.GetAttr ( tLocGroupby );
+		int iCount = (int)tMatch.GetAttr ( tLocCount );
+		assert ( dExpected[iSeen]==iKey && dExpected[iSeen+iCount-1]==iKey );
+		assert ( iSeen+iCount==dExpected.GetLength() || dExpected[iSeen+iCount]!=iKey );
+		iSeen += iCount;
+	}
+	assert ( iSeen==dStamps.GetLength() );
+	SafeDelete ( pSorter );
+
+	if ( sOldTZ.IsEmpty() )
+		unsetenv ( "TZ" );
+	else
+		setenv ( "TZ", sOldTZ.cstr(), 1 );
+	tzset();
+
+	printf ( "ok\n" );
+}
+
+
 void TestTDigest()
 {
 	printf ( "testing t-digest... " );
@@ -4231,6 +6005,7 @@ int main ()
 	TestRTWeightBoundary ();
 	TestWriter();
 	TestRTSendVsMerge ();
+	TestBinlogRotate ();
 	TestSentenceTokenizer ();
 	TestSpanSearch ();
 	TestWildcards();
@@ -4240,6 +6015,24 @@ int main ()
 	TestRankerFactors ();
 	TestRebalance();
 	TestLevenshtein();
+	TestKeywordsFst();
+	TestInfixTrigrams();
+	TestMatchArena();
+	TestSearchAfter();
+	TestSearchAfterFloat();
+	TestMergeSortedSets();
+	TestSharedTopWeight();
+	TestJsonKeyDirectory();
+	TestJsonExtract();
+	TestStringDict();
+	TestCollateKeys();
+	TestFilterValues();
+	TestGeoGrid();
+	TestAttrOrder();
+	TestOrderedScan();
+	TestReorderEstimate();
+	TestKselect();
+	TestGroupRuns();
 	TestTDigest();
 #endif
 